@@ -1,228 +1,797 @@
 // Load generator for Mini-Redis
-// Connects to server and sends commands for performance benchmarking
+// Drives the server over many connections from several threads, each thread
+// polling its share of the connections. A connection sends a batch of
+// --pipeline commands, then waits for all of their replies before the next
+// batch, so the number of requests in flight is connections x pipeline.
+// Replies are parsed as RESP, however they are split across reads. Keys
+// are drawn uniformly or from a Zipfian distribution over the key space,
+// values from a fixed size or a size range, and commands from a weighted
+// mix. Each request's latency, from its batch being sent to its reply
+// arriving, goes into a log-linear histogram (p50 / p99 / p99.9) kept per thread
+// and per command. Results can be appended to a CSV file with the columns
+// of benchmark_results.csv, and to a JSON lines file with the percentiles.
 
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#define _WINSOCK_DEPRECATED_NO_WARNINGS
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-#else
-#error "This implementation currently supports only Windows (Winsock)."
-#endif
+#include "server/socket_compat.hpp"
+#include "utils/latency_histogram.hpp"
 
-#include <iostream>
-#include <string>
-#include <vector>
-#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
 #include <random>
-#include <atomic>
 #include <sstream>
-#include <iomanip>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using mini_redis::LatencyHistogram;
 
-// RESP protocol helpers
-static std::string resp_array(const std::vector<std::string>& items) {
-    std::string result = "*" + std::to_string(items.size()) + "\r\n";
-    for (const auto& item : items) {
-        result += "$" + std::to_string(item.size()) + "\r\n" + item + "\r\n";
+// Commands the mix can draw. Each type works on its own key prefix, so
+// mixes never hit a key holding another type.
+enum class Op { Ping, Get, Set, Incr, Del, Exists, Expire, Mget, Hset, Hget, Lpush, Rpop, Sadd, Sismember,
+                Zadd, Zrangebyscore, Count };
+
+const char* const OP_NAMES[] = {"ping", "get", "set", "incr", "del", "exists", "expire", "mget", "hset", "hget",
+                                "lpush", "rpop", "sadd", "sismember", "zadd", "zrangebyscore"};
+static_assert(sizeof(OP_NAMES) / sizeof(OP_NAMES[0]) == static_cast<size_t>(Op::Count),
+              "every Op needs a name");
+
+constexpr size_t OP_COUNT = static_cast<size_t>(Op::Count);
+constexpr int MGET_KEYS = 10;     // Keys per MGET
+constexpr int HASH_FIELDS = 16;   // Fields per hash key
+constexpr int FILL_BATCH = 1000;  // SETs per round trip while filling the key space
+
+struct Options {
+    std::string host = "localhost";
+    int port = 6379;
+    int threads = 1;
+    int clients = 0;           // Connections (0 = one per thread)
+    long long requests = 100000;
+    double duration_sec = 0;   // Run for this long instead of a request count (0 = count)
+    int pipeline = 1;
+    uint64_t keyspace = 100000;
+    bool zipf = false;
+    double zipf_exponent = 0.99;
+    size_t value_min = 64;
+    size_t value_max = 64;
+    std::vector<std::pair<Op, double>> mix = {{Op::Set, 50}, {Op::Get, 50}};
+    bool fill = false;         // SET every key:N before the run
+    uint64_t seed = 0;         // 0 = random
+    std::string name = "loadgen";
+    std::string csv_path;
+    std::string json_path;
+};
+
+// Zipfian ranks 1..n with P(k) proportional to k^-exponent, by rejection-
+// inversion (Hormann & Derflinger), in O(1) time and memory per draw
+class ZipfGenerator {
+public:
+    ZipfGenerator(uint64_t n, double exponent) : n_(static_cast<double>(n)), exponent_(exponent) {
+        h_integral_x1_ = h_integral(1.5) - 1.0;
+        h_integral_n_ = h_integral(n_ + 0.5);
+        s_ = 2.0 - h_integral_inverse(h_integral(2.5) - h(2.0));
     }
-    return result;
+
+    template <typename Rng>
+    uint64_t operator()(Rng& rng) {
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        while (true) {
+            const double u = h_integral_n_ + unit(rng) * (h_integral_x1_ - h_integral_n_);
+            const double x = h_integral_inverse(u);
+            double k = std::floor(x + 0.5);
+            k = std::min(std::max(k, 1.0), n_);
+            if (k - x <= s_ || u >= h_integral(k + 0.5) - h(k)) {
+                return static_cast<uint64_t>(k);
+            }
+        }
+    }
+
+private:
+    double h(double x) const { return std::exp(-exponent_ * std::log(x)); }
+    double h_integral(double x) const {
+        const double log_x = std::log(x);
+        return helper2((1.0 - exponent_) * log_x) * log_x;
+    }
+    double h_integral_inverse(double x) const {
+        const double t = std::max(x * (1.0 - exponent_), -1.0);
+        return std::exp(helper1(t) * x);
+    }
+    // log1p(x) / x and expm1(x) / x, with their series near 0
+    static double helper1(double x) {
+        return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+    }
+    static double helper2(double x) {
+        return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x / 3.0 * (1.0 + 0.25 * x));
+    }
+
+    double n_;
+    double exponent_;
+    double h_integral_x1_;
+    double h_integral_n_;
+    double s_;
+};
+
+// Length of the complete RESP reply at the start of data, or 0 if more bytes
+// are needed
+size_t complete_reply(const char* data, size_t size) {
+    size_t pos = 0;
+    uint64_t pending = 1; // Replies (or aggregate elements) still to skip
+    while (pending > 0) {
+        if (pos >= size) {
+            return 0;
+        }
+        const char* end = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+        if (!end) {
+            return 0;
+        }
+        const char type = data[pos];
+        const long long n = std::strtoll(data + pos + 1, nullptr, 10);
+        pos = static_cast<size_t>(end - data) + 1;
+        --pending;
+        switch (type) {
+        case '$':
+            if (n >= 0) {
+                if (pos + static_cast<size_t>(n) + 2 > size) {
+                    return 0;
+                }
+                pos += static_cast<size_t>(n) + 2;
+            }
+            break;
+        case '*':
+        case '~':
+            if (n > 0) {
+                pending += static_cast<uint64_t>(n);
+            }
+            break;
+        case '%':
+            if (n > 0) {
+                pending += 2 * static_cast<uint64_t>(n);
+            }
+            break;
+        default: // + - : _ , # (: the line is the whole reply
+            break;
+        }
+    }
+    return pos;
 }
 
-// Connect to server
-static SOCKET connect_to_server(const std::string& host, int port) {
+void append_command(std::string& out, std::initializer_list<std::string_view> args) {
+    out += '*';
+    out += std::to_string(args.size());
+    out += "\r\n";
+    for (std::string_view arg : args) {
+        out += '$';
+        out += std::to_string(arg.size());
+        out += "\r\n";
+        out.append(arg.data(), arg.size());
+        out += "\r\n";
+    }
+}
+
+// Per-thread results, merged at the end
+struct Stats {
+    LatencyHistogram all;
+    LatencyHistogram by_op[OP_COUNT];
+    uint64_t errors = 0; // Error replies
+    uint64_t failed = 0; // Requests lost with their connection
+};
+
+struct Connection {
+    SOCKET sock = INVALID_SOCKET;
+    std::string out;
+    size_t sent = 0;
+    std::string in;
+    size_t parsed = 0;
+    std::deque<Op> inflight; // Ops of the batch awaiting replies, in order
+    Clock::time_point batch_start;
+};
+
+// What every worker shares
+struct Run {
+    const Options& opts;
+    std::atomic<long long> budget; // Requests left to issue (count mode)
+    Clock::time_point deadline;    // End of the run (duration mode)
+    std::string values;            // Value bytes, sliced to each value's size
+
+    explicit Run(const Options& o) : opts(o), budget(o.requests) {}
+};
+
+SOCKET connect_to_server(const std::string& host, int port) {
     SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (sock == INVALID_SOCKET) {
         return INVALID_SOCKET;
     }
-    
-    sockaddr_in addr;
-    addr.sin_family = AF_INET;
+
+    // Resolve the host (inet_addr alone rejects names such as "localhost")
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* resolved = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &resolved) != 0 || !resolved) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    sockaddr_in addr = *reinterpret_cast<sockaddr_in*>(resolved->ai_addr);
+    freeaddrinfo(resolved);
     addr.sin_port = htons(static_cast<u_short>(port));
-    addr.sin_addr.s_addr = inet_addr(host.c_str());
-    
+
     if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR) {
         closesocket(sock);
         return INVALID_SOCKET;
     }
-    
+    mini_redis::set_nodelay(sock);
     return sock;
 }
 
-// Send command and receive response
-static bool send_command(SOCKET sock, const std::vector<std::string>& cmd_parts, std::string& response) {
-    std::string cmd = resp_array(cmd_parts);
-    
-    int sent = send(sock, cmd.c_str(), static_cast<int>(cmd.size()), 0);
-    if (sent != static_cast<int>(cmd.size())) {
+int poll_sockets(std::vector<pollfd>& fds, int timeout_ms) {
+#ifdef _WIN32
+    return WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeout_ms);
+#else
+    return ::poll(fds.data(), static_cast<nfds_t>(fds.size()), timeout_ms);
+#endif
+}
+
+class Worker {
+public:
+    Worker(Run& run, uint64_t seed) : run_(run), opts_(run.opts), rng_(seed), zipf_(opts_.keyspace, opts_.zipf_exponent) {
+        double total = 0;
+        for (const auto& entry : opts_.mix) {
+            total += entry.second;
+            cumulative_.push_back(total);
+        }
+    }
+
+    void add_connection(SOCKET sock) {
+        conns_.emplace_back();
+        conns_.back().sock = sock;
+        mini_redis::set_nonblocking(sock);
+    }
+
+    void run() {
+        std::vector<pollfd> fds;
+        std::vector<Connection*> polled;
+        while (true) {
+            fds.clear();
+            polled.clear();
+            for (Connection& conn : conns_) {
+                if (conn.sock == INVALID_SOCKET) {
+                    continue;
+                }
+                if (conn.inflight.empty() && !start_batch(conn)) {
+                    continue;
+                }
+                if (!flush(conn)) {
+                    continue;
+                }
+                pollfd pfd{};
+                pfd.fd = conn.sock;
+                pfd.events = conn.sent < conn.out.size() ? (POLLIN | POLLOUT) : POLLIN;
+                fds.push_back(pfd);
+                polled.push_back(&conn);
+            }
+            if (fds.empty()) {
+                break;
+            }
+            if (poll_sockets(fds, 1000) < 0) {
+                break;
+            }
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (fds[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+                    receive(*polled[i]);
+                }
+            }
+        }
+        for (Connection& conn : conns_) {
+            if (conn.sock != INVALID_SOCKET) {
+                closesocket(conn.sock);
+            }
+        }
+    }
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    // Claim and serialize the connection's next batch; false once the run is over
+    bool start_batch(Connection& conn) {
+        int count = opts_.pipeline;
+        if (opts_.duration_sec > 0) {
+            if (Clock::now() >= run_.deadline) {
+                return false;
+            }
+        } else {
+            const long long left = run_.budget.fetch_sub(count);
+            if (left <= 0) {
+                return false;
+            }
+            count = static_cast<int>(std::min<long long>(count, left));
+        }
+        conn.out.clear();
+        conn.sent = 0;
+        for (int i = 0; i < count; ++i) {
+            const Op op = next_op();
+            append_op(conn.out, op);
+            conn.inflight.push_back(op);
+        }
+        conn.batch_start = Clock::now();
+        return true;
+    }
+
+    // Write what the socket takes; false if the connection was lost
+    bool flush(Connection& conn) {
+        while (conn.sent < conn.out.size()) {
+            const int n = send(conn.sock, conn.out.data() + conn.sent, static_cast<int>(conn.out.size() - conn.sent), 0);
+            if (n > 0) {
+                conn.sent += static_cast<size_t>(n);
+                continue;
+            }
+            if (n < 0 && mini_redis::socket_would_block()) {
+                return true;
+            }
+            drop(conn);
+            return false;
+        }
+        return true;
+    }
+
+    void receive(Connection& conn) {
+        char buffer[64 * 1024];
+        const int n = recv(conn.sock, buffer, static_cast<int>(sizeof(buffer)), 0);
+        if (n < 0 && mini_redis::socket_would_block()) {
+            return;
+        }
+        if (n <= 0) {
+            drop(conn);
+            return;
+        }
+        conn.in.append(buffer, static_cast<size_t>(n));
+        const auto now = Clock::now();
+        const uint64_t latency_us = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(now - conn.batch_start).count());
+        while (!conn.inflight.empty()) {
+            const size_t len = complete_reply(conn.in.data() + conn.parsed, conn.in.size() - conn.parsed);
+            if (len == 0) {
+                break;
+            }
+            if (conn.in[conn.parsed] == '-') {
+                ++stats_.errors;
+            }
+            conn.parsed += len;
+            stats_.all.record(latency_us);
+            stats_.by_op[static_cast<size_t>(conn.inflight.front())].record(latency_us);
+            conn.inflight.pop_front();
+        }
+        if (conn.parsed == conn.in.size()) {
+            conn.in.clear();
+            conn.parsed = 0;
+        }
+    }
+
+    void drop(Connection& conn) {
+        std::cerr << "Lost a connection to " << opts_.host << ":" << opts_.port << "\n";
+        stats_.failed += conn.inflight.size();
+        conn.inflight.clear();
+        closesocket(conn.sock);
+        conn.sock = INVALID_SOCKET;
+    }
+
+    Op next_op() {
+        if (opts_.mix.size() == 1) {
+            return opts_.mix[0].first;
+        }
+        std::uniform_real_distribution<double> pick(0.0, cumulative_.back());
+        const double r = pick(rng_);
+        const size_t i = static_cast<size_t>(std::upper_bound(cumulative_.begin(), cumulative_.end(), r) -
+                                             cumulative_.begin());
+        return opts_.mix[std::min(i, opts_.mix.size() - 1)].first;
+    }
+
+    uint64_t next_key() {
+        if (opts_.zipf) {
+            return zipf_(rng_) - 1;
+        }
+        return std::uniform_int_distribution<uint64_t>(0, opts_.keyspace - 1)(rng_);
+    }
+
+    std::string_view next_value() {
+        size_t size = opts_.value_min;
+        if (opts_.value_max > opts_.value_min) {
+            size = std::uniform_int_distribution<size_t>(opts_.value_min, opts_.value_max)(rng_);
+        }
+        return std::string_view(run_.values).substr(0, size);
+    }
+
+    std::string key(const char* prefix) { return prefix + std::to_string(next_key()); }
+
+    void append_op(std::string& out, Op op) {
+        switch (op) {
+        case Op::Ping: append_command(out, {"PING"}); break;
+        case Op::Get: append_command(out, {"GET", key("key:")}); break;
+        case Op::Set: append_command(out, {"SET", key("key:"), next_value()}); break;
+        case Op::Incr: append_command(out, {"INCR", key("counter:")}); break;
+        case Op::Del: append_command(out, {"DEL", key("key:")}); break;
+        case Op::Exists: append_command(out, {"EXISTS", key("key:")}); break;
+        case Op::Expire: append_command(out, {"EXPIRE", key("key:"), "60"}); break;
+        case Op::Mget: {
+            std::string keys[MGET_KEYS];
+            for (std::string& k : keys) {
+                k = key("key:");
+            }
+            append_command(out, {"MGET", keys[0], keys[1], keys[2], keys[3], keys[4], keys[5], keys[6], keys[7],
+                                 keys[8], keys[9]});
+            break;
+        }
+        case Op::Hset:
+            append_command(out, {"HSET", key("hash:"), field(), next_value()});
+            break;
+        case Op::Hget: append_command(out, {"HGET", key("hash:"), field()}); break;
+        case Op::Lpush: append_command(out, {"LPUSH", key("list:"), next_value()}); break;
+        case Op::Rpop: append_command(out, {"RPOP", key("list:")}); break;
+        case Op::Sadd: append_command(out, {"SADD", key("set:"), member()}); break;
+        case Op::Sismember: append_command(out, {"SISMEMBER", key("set:"), member()}); break;
+        case Op::Zadd:
+            append_command(out, {"ZADD", key("zset:"), std::to_string(next_key() % 1000), member()});
+            break;
+        case Op::Zrangebyscore:
+            append_command(out, {"ZRANGEBYSCORE", key("zset:"), "-inf", "+inf", "LIMIT", "0", "10"});
+            break;
+        case Op::Count: break;
+        }
+    }
+
+    std::string field() { return "f" + std::to_string(rng_() % HASH_FIELDS); }
+    std::string member() { return "m" + std::to_string(next_key()); }
+
+    Run& run_;
+    const Options& opts_;
+    std::mt19937_64 rng_;
+    ZipfGenerator zipf_;
+    std::vector<double> cumulative_; // Running totals of the mix weights
+    std::deque<Connection> conns_;
+    Stats stats_;
+};
+
+// SET every key:N once, pipelined, so reads find their keys
+bool fill_keyspace(const Options& opts, const std::string& values) {
+    SOCKET sock = connect_to_server(opts.host, opts.port);
+    if (sock == INVALID_SOCKET) {
         return false;
     }
-    
-    // Read response (simplified - just read first line)
-    char buffer[1024];
-    int received = recv(sock, buffer, sizeof(buffer) - 1, 0);
-    if (received <= 0) {
+    std::string out;
+    std::string in;
+    bool ok = true;
+    for (uint64_t first = 0; first < opts.keyspace && ok; first += FILL_BATCH) {
+        const uint64_t last = std::min<uint64_t>(opts.keyspace, first + FILL_BATCH);
+        out.clear();
+        for (uint64_t k = first; k < last; ++k) {
+            append_command(out, {"SET", "key:" + std::to_string(k), std::string_view(values).substr(0, opts.value_max)});
+        }
+        ok = send(sock, out.data(), static_cast<int>(out.size()), 0) == static_cast<int>(out.size());
+        uint64_t replies = 0;
+        size_t parsed = 0;
+        in.clear();
+        while (ok && replies < last - first) {
+            char buffer[64 * 1024];
+            const int n = recv(sock, buffer, static_cast<int>(sizeof(buffer)), 0);
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            in.append(buffer, static_cast<size_t>(n));
+            size_t len;
+            while (replies < last - first && (len = complete_reply(in.data() + parsed, in.size() - parsed)) > 0) {
+                parsed += len;
+                ++replies;
+            }
+        }
+    }
+    closesocket(sock);
+    return ok;
+}
+
+bool parse_mix(const std::string& text, std::vector<std::pair<Op, double>>& out) {
+    out.clear();
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        const size_t colon = item.find(':');
+        std::string name = item.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        double weight = 1;
+        if (colon != std::string::npos) {
+            try {
+                weight = std::stod(item.substr(colon + 1));
+            } catch (...) {
+                return false;
+            }
+        }
+        const auto found = std::find_if(std::begin(OP_NAMES), std::end(OP_NAMES),
+                                        [&](const char* op) { return name == op; });
+        if (found == std::end(OP_NAMES) || weight <= 0) {
+            return false;
+        }
+        out.emplace_back(static_cast<Op>(found - std::begin(OP_NAMES)), weight);
+    }
+    return !out.empty();
+}
+
+void print_usage() {
+    std::cout << "Usage: loadgen [options]\n"
+              << "Options:\n"
+              << "  --host <host>          Server hostname (default: localhost)\n"
+              << "  --port <port>          Server port (default: 6379)\n"
+              << "  --threads <num>        Worker threads (default: 1)\n"
+              << "  --clients <num>        Connections, spread over the threads (default: one per thread)\n"
+              << "  --requests <num>       Total requests to send (default: 100000)\n"
+              << "  --duration <sec>       Run for this long instead of a request count\n"
+              << "  --pipeline <num>       Requests per batch on a connection (default: 1)\n"
+              << "  --keyspace <num>       Distinct keys per type (default: 100000)\n"
+              << "  --distribution <d>     Key choice: uniform | zipf (default: uniform)\n"
+              << "  --zipf-exponent <s>    Skew of --distribution zipf (default: 0.99)\n"
+              << "  --value-size <n|a-b>   Value bytes, fixed or uniform in a range (default: 64)\n"
+              << "  --mix <op:w,...>       Weighted command mix (default: set:50,get:50) from\n"
+              << "                         ping get set incr del exists expire mget hset hget\n"
+              << "                         lpush rpop sadd sismember zadd zrangebyscore\n"
+              << "  --fill                 SET every key first so reads hit\n"
+              << "  --seed <num>           Seed for keys, values and the mix (default: random)\n"
+              << "  --name <name>          Test name in the CSV / JSON output (default: loadgen)\n"
+              << "  --csv <file>           Append a row in benchmark_results.csv's columns\n"
+              << "  --json <file>          Append a JSON line with the percentiles\n"
+              << "  --help, -h             Show this help message\n";
+}
+
+// Parse command line arguments; false on a bad value
+bool parse_args(int argc, char* argv[], Options& opts) {
+    try {
+        for (int i = 1; i < argc; i++) {
+            const std::string arg = argv[i];
+            const bool has_value = i + 1 < argc;
+            if (arg == "--host" && has_value) {
+                opts.host = argv[++i];
+            } else if (arg == "--port" && has_value) {
+                opts.port = std::stoi(argv[++i]);
+            } else if (arg == "--threads" && has_value) {
+                opts.threads = std::stoi(argv[++i]);
+            } else if (arg == "--clients" && has_value) {
+                opts.clients = std::stoi(argv[++i]);
+            } else if (arg == "--requests" && has_value) {
+                opts.requests = std::stoll(argv[++i]);
+            } else if (arg == "--duration" && has_value) {
+                opts.duration_sec = std::stod(argv[++i]);
+            } else if (arg == "--pipeline" && has_value) {
+                opts.pipeline = std::stoi(argv[++i]);
+            } else if (arg == "--keyspace" && has_value) {
+                opts.keyspace = std::stoull(argv[++i]);
+            } else if (arg == "--distribution" && has_value) {
+                const std::string d = argv[++i];
+                if (d != "uniform" && d != "zipf") {
+                    return false;
+                }
+                opts.zipf = d == "zipf";
+            } else if (arg == "--zipf-exponent" && has_value) {
+                opts.zipf_exponent = std::stod(argv[++i]);
+            } else if (arg == "--value-size" && has_value) {
+                const std::string size = argv[++i];
+                const size_t dash = size.find('-');
+                opts.value_min = std::stoull(size.substr(0, dash));
+                opts.value_max = dash == std::string::npos ? opts.value_min : std::stoull(size.substr(dash + 1));
+            } else if (arg == "--mix" && has_value) {
+                if (!parse_mix(argv[++i], opts.mix)) {
+                    return false;
+                }
+            } else if (arg == "--fill") {
+                opts.fill = true;
+            } else if (arg == "--seed" && has_value) {
+                opts.seed = std::stoull(argv[++i]);
+            } else if (arg == "--name" && has_value) {
+                opts.name = argv[++i];
+            } else if (arg == "--csv" && has_value) {
+                opts.csv_path = argv[++i];
+            } else if (arg == "--json" && has_value) {
+                opts.json_path = argv[++i];
+            } else if (arg == "--help" || arg == "-h") {
+                print_usage();
+                exit(0);
+            } else {
+                return false;
+            }
+        }
+    } catch (...) {
         return false;
     }
-    
-    buffer[received] = '\0';
-    response = std::string(buffer, received);
-    return true;
+    if (opts.clients <= 0) {
+        opts.clients = opts.threads;
+    }
+    opts.threads = std::min(opts.threads, opts.clients);
+    return opts.threads > 0 && opts.pipeline > 0 && opts.keyspace > 0 && opts.value_min <= opts.value_max &&
+           opts.zipf_exponent > 0 && (opts.requests > 0 || opts.duration_sec > 0);
 }
 
-// Worker thread function
-static void worker_thread(const std::string& host, int port, int requests_per_thread, 
-                         std::atomic<long long>& total_requests, std::atomic<long long>& successful_requests,
-                         std::atomic<long long>& total_latency_us) {
-    SOCKET sock = connect_to_server(host, port);
-    if (sock == INVALID_SOCKET) {
-        std::cerr << "Failed to connect to " << host << ":" << port << std::endl;
-        return;
-    }
-    
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(0, 999999);
-    
-    for (int i = 0; i < requests_per_thread; ++i) {
-        auto start = std::chrono::high_resolution_clock::now();
-        
-        // Generate random key and value
-        int key_num = dis(gen);
-        int val_num = dis(gen);
-        std::string key = "key" + std::to_string(key_num);
-        std::string value = "value" + std::to_string(val_num);
-        
-        // Send SET command
-        std::vector<std::string> set_cmd = {"SET", key, value};
-        std::string response;
-        bool success = send_command(sock, set_cmd, response);
-        
-        auto end = std::chrono::high_resolution_clock::now();
-        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-        
-        total_requests++;
-        if (success) {
-            successful_requests++;
-        }
-        total_latency_us += latency;
-        
-        // Optionally send GET command
-        if (i % 2 == 0) {
-            start = std::chrono::high_resolution_clock::now();
-            std::vector<std::string> get_cmd = {"GET", key};
-            send_command(sock, get_cmd, response);
-            end = std::chrono::high_resolution_clock::now();
-            latency = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-            total_requests++;
-            if (success) {
-                successful_requests++;
-            }
-            total_latency_us += latency;
-        }
-    }
-    
-    closesocket(sock);
+// Local time as Python's datetime.isoformat() writes it, as the CSV's timestamps are
+std::string iso_timestamp() {
+    const auto now = std::chrono::system_clock::now();
+    const std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+    const long long micros =
+        std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count() % 1000000;
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &seconds);
+#else
+    localtime_r(&seconds, &local);
+#endif
+    std::ostringstream out;
+    out << std::put_time(&local, "%Y-%m-%dT%H:%M:%S") << '.' << std::setw(6) << std::setfill('0') << micros;
+    return out.str();
+}
+
+std::string mix_text(const Options& opts) {
+    std::string text;
+    for (const auto& entry : opts.mix) {
+        std::ostringstream weight;
+        weight << entry.second;
+        text += (text.empty() ? "" : ",") + std::string(OP_NAMES[static_cast<size_t>(entry.first)]) + ":" + weight.str();
+    }
+    return text;
+}
+
+void append_csv(const Options& opts, uint64_t operations, double seconds, double qps, uint64_t errors,
+                const std::string& timestamp) {
+    const bool exists = std::ifstream(opts.csv_path).good();
+    std::ofstream csv(opts.csv_path, std::ios::app);
+    if (!exists) {
+        csv << "test_name,operations,total_time_sec,qps,clients,ops_per_client,errors,timestamp\n";
+    }
+    csv << opts.name << ',' << operations << ',' << std::setprecision(17) << seconds << ',' << qps << ','
+        << opts.clients << ',' << operations / static_cast<uint64_t>(opts.clients) << ',' << errors << ','
+        << timestamp << '\n';
 }
 
-// Parse command line arguments
-static void parse_args(int argc, char* argv[], std::string& host, int& port, 
-                      int& total_requests, int& num_threads) {
-    host = "localhost";
-    port = 6379;
-    total_requests = 1000;
-    num_threads = 1;
-    
-    for (int i = 1; i < argc; i++) {
-        std::string arg = argv[i];
-        if (arg == "--host" && i + 1 < argc) {
-            host = argv[++i];
-        } else if (arg == "--port" && i + 1 < argc) {
-            port = std::stoi(argv[++i]);
-        } else if (arg == "--requests" && i + 1 < argc) {
-            total_requests = std::stoi(argv[++i]);
-        } else if (arg == "--threads" && i + 1 < argc) {
-            num_threads = std::stoi(argv[++i]);
-        } else if (arg == "--help" || arg == "-h") {
-            std::cout << "Usage: loadgen [options]\n"
-                      << "Options:\n"
-                      << "  --host <host>      Server hostname (default: localhost)\n"
-                      << "  --port <port>      Server port (default: 6379)\n"
-                      << "  --requests <num>  Total requests to send (default: 1000)\n"
-                      << "  --threads <num>   Number of worker threads (default: 1)\n"
-                      << "  --help, -h        Show this help message\n";
-            exit(0);
+void append_json(const Options& opts, const Stats& stats, uint64_t operations, double seconds, double qps,
+                 uint64_t errors, const std::string& timestamp) {
+    std::ofstream json(opts.json_path, std::ios::app);
+    json << std::setprecision(17) << "{\"test_name\":\"" << opts.name << "\",\"operations\":" << operations
+         << ",\"total_time_sec\":" << seconds << ",\"qps\":" << qps << ",\"clients\":" << opts.clients
+         << ",\"ops_per_client\":" << operations / static_cast<uint64_t>(opts.clients) << ",\"errors\":" << errors
+         << ",\"timestamp\":\"" << timestamp << "\",\"threads\":" << opts.threads << ",\"pipeline\":" << opts.pipeline
+         << ",\"keyspace\":" << opts.keyspace << ",\"distribution\":\"" << (opts.zipf ? "zipf" : "uniform")
+         << "\",\"value_size\":\"" << opts.value_min << (opts.value_max > opts.value_min ? "-" + std::to_string(opts.value_max) : "")
+         << "\",\"mix\":\"" << mix_text(opts) << "\",\"p50_us\":" << stats.all.percentile(50)
+         << ",\"p99_us\":" << stats.all.percentile(99) << ",\"p999_us\":" << stats.all.percentile(99.9)
+         << ",\"commands\":{";
+    bool first = true;
+    for (size_t op = 0; op < OP_COUNT; ++op) {
+        const LatencyHistogram& h = stats.by_op[op];
+        if (h.count() == 0) {
+            continue;
         }
+        json << (first ? "" : ",") << '"' << OP_NAMES[op] << "\":{\"operations\":" << h.count()
+             << ",\"p50_us\":" << h.percentile(50) << ",\"p99_us\":" << h.percentile(99)
+             << ",\"p999_us\":" << h.percentile(99.9) << '}';
+        first = false;
     }
+    json << "}}\n";
 }
 
+void merge(LatencyHistogram& into, const LatencyHistogram& from) {
+    for (size_t b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+        if (from.count_at(b) != 0) {
+            into.add(b, from.count_at(b));
+        }
+    }
+}
+
+} // anonymous namespace
+
 int main(int argc, char* argv[]) {
-    // Initialize Winsock
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        std::cerr << "WSAStartup failed" << std::endl;
+    // Initialize the socket library
+    if (!mini_redis::net_init()) {
+        std::cerr << "Socket library initialization failed" << std::endl;
         return 1;
     }
-    
-    // Parse arguments
-    std::string host;
-    int port, total_requests, num_threads;
-    parse_args(argc, argv, host, port, total_requests, num_threads);
-    
+
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        print_usage();
+        return 1;
+    }
+    const uint64_t seed = opts.seed != 0 ? opts.seed : std::random_device{}();
+
+    Run run(opts);
+    run.values.resize(opts.value_max);
+    std::mt19937_64 value_rng(seed);
+    for (char& c : run.values) {
+        c = static_cast<char>('a' + value_rng() % 26);
+    }
+
     std::cout << "Load Generator for Mini-Redis\n"
-              << "Connecting to " << host << ":" << port << "\n"
-              << "Total requests: " << total_requests << "\n"
-              << "Threads: " << num_threads << "\n"
-              << "Starting benchmark...\n\n";
-    
-    // Statistics
-    std::atomic<long long> total_requests_sent{0};
-    std::atomic<long long> successful_requests{0};
-    std::atomic<long long> total_latency_us{0};
-    
-    // Calculate requests per thread
-    int requests_per_thread = total_requests / num_threads;
-    int extra_requests = total_requests % num_threads;
-    
-    // Start worker threads
-    auto start_time = std::chrono::high_resolution_clock::now();
+              << "Connecting to " << opts.host << ":" << opts.port << "\n"
+              << "Threads: " << opts.threads << ", connections: " << opts.clients << ", pipeline: " << opts.pipeline << "\n"
+              << "Keys: " << opts.keyspace << " " << (opts.zipf ? "zipf" : "uniform") << ", values: "
+              << opts.value_min << (opts.value_max > opts.value_min ? "-" + std::to_string(opts.value_max) : "")
+              << " bytes, mix: " << mix_text(opts) << "\n";
+
+    if (opts.fill) {
+        std::cout << "Filling " << opts.keyspace << " keys...\n";
+        if (!fill_keyspace(opts, run.values)) {
+            std::cerr << "Failed to fill the key space" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int t = 0; t < opts.threads; ++t) {
+        workers.push_back(std::make_unique<Worker>(run, seed + static_cast<uint64_t>(t) + 1));
+    }
+    for (int c = 0; c < opts.clients; ++c) {
+        SOCKET sock = connect_to_server(opts.host, opts.port);
+        if (sock == INVALID_SOCKET) {
+            std::cerr << "Failed to connect to " << opts.host << ":" << opts.port << std::endl;
+            return 1;
+        }
+        workers[static_cast<size_t>(c % opts.threads)]->add_connection(sock);
+    }
+
+    std::cout << "Starting benchmark...\n\n";
+    const auto start_time = Clock::now();
+    run.deadline = start_time + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opts.duration_sec));
     std::vector<std::thread> threads;
-    
-    for (int i = 0; i < num_threads; ++i) {
-        int requests = requests_per_thread + (i < extra_requests ? 1 : 0);
-        threads.emplace_back(worker_thread, host, port, requests,
-                           std::ref(total_requests_sent),
-                           std::ref(successful_requests),
-                           std::ref(total_latency_us));
-    }
-    
-    // Wait for all threads
+    for (auto& worker : workers) {
+        threads.emplace_back([&worker] { worker->run(); });
+    }
     for (auto& t : threads) {
         t.join();
     }
-    
-    auto end_time = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
-    
-    // Print results
-    long long requests = total_requests_sent.load();
-    long long successful = successful_requests.load();
-    long long latency_sum = total_latency_us.load();
-    
-    double requests_per_sec = (requests * 1000.0) / duration;
-    double avg_latency_ms = (latency_sum / 1000.0) / requests;
-    double success_rate = (successful * 100.0) / requests;
-    
-    std::cout << "\n=== Benchmark Results ===\n"
-              << "Total requests: " << requests << "\n"
-              << "Successful: " << successful << " (" << std::fixed << std::setprecision(2) 
-              << success_rate << "%)\n"
-              << "Duration: " << duration << " ms\n"
-              << "Requests/sec: " << std::fixed << std::setprecision(2) << requests_per_sec << "\n"
-              << "Avg latency: " << std::fixed << std::setprecision(2) << avg_latency_ms << " ms\n";
-    
-    WSACleanup();
-    return 0;
-}
+    const double seconds = std::chrono::duration<double>(Clock::now() - start_time).count();
 
+    Stats total;
+    for (const auto& worker : workers) {
+        const Stats& stats = worker->stats();
+        merge(total.all, stats.all);
+        for (size_t op = 0; op < OP_COUNT; ++op) {
+            merge(total.by_op[op], stats.by_op[op]);
+        }
+        total.errors += stats.errors;
+        total.failed += stats.failed;
+    }
+    const uint64_t operations = total.all.count();
+    const uint64_t errors = total.errors + total.failed;
+    const double qps = seconds > 0 ? static_cast<double>(operations) / seconds : 0;
+
+    std::cout << "=== Benchmark Results ===\n"
+              << "Requests: " << operations << " (" << errors << " errors)\n"
+              << "Duration: " << std::fixed << std::setprecision(3) << seconds << " s\n"
+              << "Requests/sec: " << std::setprecision(2) << qps << "\n"
+              << "Latency (us): p50 " << total.all.percentile(50) << ", p99 " << total.all.percentile(99)
+              << ", p99.9 " << total.all.percentile(99.9) << "\n";
+    for (size_t op = 0; op < OP_COUNT; ++op) {
+        const LatencyHistogram& h = total.by_op[op];
+        if (h.count() != 0) {
+            std::cout << "  " << std::left << std::setw(14) << OP_NAMES[op] << std::right << std::setw(10) << h.count()
+                      << "  p50 " << h.percentile(50) << "  p99 " << h.percentile(99) << "  p99.9 "
+                      << h.percentile(99.9) << "\n";
+        }
+    }
+
+    const std::string timestamp = iso_timestamp();
+    if (!opts.csv_path.empty()) {
+        append_csv(opts, operations, seconds, qps, errors, timestamp);
+    }
+    if (!opts.json_path.empty()) {
+        append_json(opts, total, operations, seconds, qps, errors, timestamp);
+    }
+
+    mini_redis::net_cleanup();
+    return errors == 0 ? 0 : 2;
+}
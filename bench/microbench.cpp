@@ -0,0 +1,296 @@
+// In-process microbenchmarks for Mini-Redis hot paths
+// Times RespParser, KVStore, ReplyWriter and whole-command dispatch
+// (process_command) without the network, so a regression in one of them
+// shows up on its own. Each case runs --iterations operations, repeated
+// --repeat times, and reports the fastest repetition in ns/op.
+
+#include "server/socket_compat.hpp"
+#include "server/server_common.hpp"
+#include "protocol/parser.hpp"
+#include "protocol/resp_parser.hpp"
+#include "protocol/resp_utils.hpp"
+#include "storage/kv_store.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    uint64_t iterations = 1000000;
+    int repeat = 3;
+    int threads = 1; // For the multi-threaded KVStore cases
+    uint64_t keyspace = 100000;
+    size_t value_size = 64;
+    std::string filter; // Run only cases whose name contains this
+};
+
+// Keeps a result alive so the compiler cannot drop the work producing it
+volatile uint64_t sink = 0;
+
+struct Case {
+    std::string name;
+    // Run n operations; returns how many it actually ran
+    std::function<uint64_t(uint64_t n)> run;
+};
+
+std::string key_of(uint64_t i) {
+    return "key:" + std::to_string(i);
+}
+
+std::string resp_command(const std::vector<std::string>& args) {
+    std::string out = "*" + std::to_string(args.size()) + "\r\n";
+    for (const std::string& arg : args) {
+        out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    }
+    return out;
+}
+
+// Reused key names, so the cases time the store rather than to_string
+std::vector<std::string> make_keys(uint64_t n) {
+    std::vector<std::string> keys;
+    keys.reserve(n);
+    for (uint64_t i = 0; i < n; ++i) {
+        keys.push_back(key_of(i));
+    }
+    return keys;
+}
+
+std::vector<Case> make_cases(const Options& opts) {
+    std::vector<Case> cases;
+    const std::string value(opts.value_size, 'v');
+    const auto keys = std::make_shared<std::vector<std::string>>(make_keys(opts.keyspace));
+
+    // RESP parsing: a pipelined batch of SETs fed in 16 KB reads, as a server sees it
+    cases.push_back({"resp_parser/set_pipeline", [=](uint64_t n) {
+        std::string stream;
+        for (uint64_t i = 0; i < 1000; ++i) {
+            stream += resp_command({"SET", (*keys)[i % keys->size()], value});
+        }
+        RespParser parser;
+        std::vector<std::string_view> args;
+        std::string error;
+        uint64_t done = 0;
+        while (done < n) {
+            for (size_t pos = 0; pos < stream.size(); pos += 16 * 1024) {
+                parser.append(stream.data() + pos, std::min<size_t>(16 * 1024, stream.size() - pos));
+                while (parser.parseArgs(args, error) == RespStatus::Complete) {
+                    sink = sink + args.size();
+                    ++done;
+                }
+            }
+        }
+        return done;
+    }});
+    cases.push_back({"resp_parser/to_command", [=](uint64_t n) {
+        const std::vector<std::string_view> args = {"SET", (*keys)[0], value};
+        for (uint64_t i = 0; i < n; ++i) {
+            protocol::Command cmd = protocol::command_from_resp_args(args);
+            sink = sink + cmd.args.size();
+        }
+        return n;
+    }});
+
+    // Reply writer: the replies GET, INCR and MGET send
+    cases.push_back({"reply_writer/bulk", [=](uint64_t n) {
+        std::string out;
+        mini_redis::ReplyWriter reply(out);
+        for (uint64_t i = 0; i < n; ++i) {
+            if (out.size() > 1024 * 1024) {
+                out.clear();
+            }
+            reply.bulk(value);
+        }
+        sink = sink + out.size();
+        return n;
+    }});
+    cases.push_back({"reply_writer/integer", [=](uint64_t n) {
+        std::string out;
+        mini_redis::ReplyWriter reply(out);
+        for (uint64_t i = 0; i < n; ++i) {
+            if (out.size() > 1024 * 1024) {
+                out.clear();
+            }
+            reply.integer(static_cast<int64_t>(i));
+        }
+        sink = sink + out.size();
+        return n;
+    }});
+    cases.push_back({"reply_writer/array10", [=](uint64_t n) {
+        std::string out;
+        mini_redis::ReplyWriter reply(out);
+        for (uint64_t i = 0; i < n; ++i) {
+            if (out.size() > 1024 * 1024) {
+                out.clear();
+            }
+            reply.array_header(10);
+            for (int e = 0; e < 10; ++e) {
+                reply.bulk(value);
+            }
+        }
+        sink = sink + out.size();
+        return n;
+    }});
+
+    // Store: single-threaded, then a 3:1 GET/SET mix over --threads
+    auto store = std::make_shared<KVStore>();
+    store->set_eviction_limits(0, 0);
+    cases.push_back({"kvstore/set", [=](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            store->set((*keys)[i % keys->size()], value);
+        }
+        return n;
+    }});
+    cases.push_back({"kvstore/get", [=](uint64_t n) {
+        std::string out;
+        for (uint64_t i = 0; i < n; ++i) {
+            sink = sink + store->get((*keys)[i % keys->size()], out);
+        }
+        return n;
+    }});
+    const auto counters = std::make_shared<std::vector<std::string>>();
+    for (int i = 0; i < 1000; ++i) {
+        counters->push_back("counter:" + std::to_string(i));
+    }
+    cases.push_back({"kvstore/incr", [=](uint64_t n) {
+        for (uint64_t i = 0; i < n; ++i) {
+            sink = sink + static_cast<uint64_t>(store->incr((*counters)[i % counters->size()]).first);
+        }
+        return n;
+    }});
+    const int threads = opts.threads;
+    if (threads > 1) {
+        cases.push_back({"kvstore/get_set_mt" + std::to_string(threads), [=](uint64_t n) {
+            std::vector<std::thread> workers;
+            std::vector<uint64_t> hits(static_cast<size_t>(threads), 0);
+            const uint64_t per_thread = n / static_cast<uint64_t>(threads);
+            for (int t = 0; t < threads; ++t) {
+                workers.emplace_back([=, &hits] {
+                    std::string out;
+                    uint64_t found = 0;
+                    for (uint64_t i = 0; i < per_thread; ++i) {
+                        const std::string& key = (*keys)[(i * 7919 + static_cast<uint64_t>(t)) % keys->size()];
+                        if (i % 4 == 0) {
+                            store->set(key, value);
+                        } else {
+                            found += store->get(key, out);
+                        }
+                    }
+                    hits[static_cast<size_t>(t)] = found;
+                });
+            }
+            for (auto& w : workers) {
+                w.join();
+            }
+            for (uint64_t found : hits) {
+                sink = sink + found;
+            }
+            return per_thread * static_cast<uint64_t>(threads);
+        }});
+    }
+
+    // Whole commands as a connection runs them: parse, dispatch, reply
+    mini_redis::detail::databases[0].set_eviction_limits(0, 0);
+    cases.push_back({"dispatch/get_set", [=](uint64_t n) {
+        std::string stream;
+        for (uint64_t i = 0; i < 1000; ++i) {
+            const std::string& key = (*keys)[i % keys->size()];
+            stream += i % 2 == 0 ? resp_command({"SET", key, value}) : resp_command({"GET", key});
+        }
+        mini_redis::detail::ClientContext ctx;
+        std::string out;
+        uint64_t done = 0;
+        while (done < n) {
+            ctx.parser->append(stream.data(), stream.size());
+            for (const protocol::Command& cmd : mini_redis::extract_resp_commands(ctx.parser)) {
+                mini_redis::process_command(cmd, ctx, INVALID_SOCKET, out);
+                ++done;
+            }
+            sink = sink + out.size();
+            out.clear();
+        }
+        return done;
+    }});
+    return cases;
+}
+
+void print_usage() {
+    std::cout << "Usage: mini_redis_microbench [options]\n"
+              << "Options:\n"
+              << "  --iterations <num>  Operations per repetition (default: 1000000)\n"
+              << "  --repeat <num>      Repetitions per case; the fastest is reported (default: 3)\n"
+              << "  --threads <num>     Threads for the multi-threaded store case (default: 1 = skip)\n"
+              << "  --keyspace <num>    Distinct keys (default: 100000)\n"
+              << "  --value-size <num>  Value bytes (default: 64)\n"
+              << "  --filter <text>     Run only cases whose name contains text\n"
+              << "  --help, -h          Show this help message\n";
+}
+
+bool parse_args(int argc, char* argv[], Options& opts) {
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool has_value = i + 1 < argc;
+            if (arg == "--iterations" && has_value) {
+                opts.iterations = std::stoull(argv[++i]);
+            } else if (arg == "--repeat" && has_value) {
+                opts.repeat = std::stoi(argv[++i]);
+            } else if (arg == "--threads" && has_value) {
+                opts.threads = std::stoi(argv[++i]);
+            } else if (arg == "--keyspace" && has_value) {
+                opts.keyspace = std::stoull(argv[++i]);
+            } else if (arg == "--value-size" && has_value) {
+                opts.value_size = std::stoull(argv[++i]);
+            } else if (arg == "--filter" && has_value) {
+                opts.filter = argv[++i];
+            } else if (arg == "--help" || arg == "-h") {
+                print_usage();
+                exit(0);
+            } else {
+                return false;
+            }
+        }
+    } catch (...) {
+        return false;
+    }
+    return opts.iterations > 0 && opts.repeat > 0 && opts.threads > 0 && opts.keyspace > 0;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parse_args(argc, argv, opts)) {
+        print_usage();
+        return 1;
+    }
+
+    std::cout << std::left << std::setw(28) << "case" << std::right << std::setw(14) << "ns/op"
+              << std::setw(14) << "Mops/s" << "\n";
+    for (const Case& c : make_cases(opts)) {
+        if (!opts.filter.empty() && c.name.find(opts.filter) == std::string::npos) {
+            continue;
+        }
+        double best_ns = 0;
+        for (int r = 0; r < opts.repeat; ++r) {
+            const auto start = Clock::now();
+            const uint64_t ops = c.run(opts.iterations);
+            const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() /
+                              static_cast<double>(std::max<uint64_t>(ops, 1));
+            best_ns = r == 0 ? ns : std::min(best_ns, ns);
+        }
+        std::cout << std::left << std::setw(28) << c.name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(14) << best_ns << std::setw(14) << std::setprecision(2) << 1000.0 / best_ns << "\n";
+    }
+    return 0;
+}
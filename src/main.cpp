@@ -12,10 +12,35 @@ void print_usage() {
               << "Options:\n"
               << "  -p, --port PORT      Server port (default: 6379)\n"
               << "  -m, --max-keys N     Max keys before LRU eviction (default: 10000)\n"
+              << "      --shards N       Lock-striped shards per database (default: 16)\n"
+              << "      --maxmemory N    Byte budget per database, e.g. 100mb (default: 0 = off)\n"
+              << "      --maxmemory-policy P  allkeys-lru|volatile-lru|allkeys-lfu|volatile-ttl\n"
+              << "      --maxmemory-samples N Keys sampled per eviction (default: 5)\n"
+              << "      --hz N           Active expire cycles per second (default: 10)\n"
+              << "      --lazyfree-min-size N  Free values this big in the background (default: 64kb, 0 = off)\n"
               << "  -a, --aof PATH       AOF file path (default: mini_redis.aof)\n"
+              << "      --appendfsync P  AOF fsync policy: always|everysec|no (default: everysec)\n"
+              << "      --auto-aof-rewrite-percentage N  Rewrite the AOF after N% growth (default: 100, 0 = off)\n"
+              << "      --auto-aof-rewrite-min-size N    Smallest AOF to rewrite automatically (default: 64mb)\n"
               << "  -r, --rdb PATH       RDB file path (default: mini_redis_dump.rdb)\n"
+              << "      --slowlog-log-slower-than N  Log commands slower than N microseconds (default: 10000, -1 = off)\n"
+              << "      --slowlog-max-len N          Entries kept in the slow log (default: 128)\n"
+              << "      --client-output-buffer-limit pubsub HARD SOFT SECONDS\n"
+              << "                                   Disconnect subscribers this far behind (default: 32mb 8mb 60)\n"
+              << "      --tracking-table-max-keys N  Keys CLIENT TRACKING follows per database (default: 1000000, 0 = no limit)\n"
+              << "      --repl-backlog-size N        Replication backlog for partial resyncs (default: 1mb)\n"
+              << "      --replicaof HOST PORT        Start as a read-only replica of HOST:PORT\n"
+              << "      --replica-max-lag-ms N       Refuse reads on a replica this far behind (default: 10000, 0 = off)\n"
+              << "      --cluster-enabled            Cluster mode: serve this node's hash slots, redirect the rest\n"
+              << "      --cluster-config-file PATH   Node ID and cluster view (default: nodes.conf)\n"
+              << "      --cluster-announce-ip IP     Address given to other nodes and clients (default: 127.0.0.1)\n"
               << "  -c, --config PATH    Config file path\n"
-              << "      --iocp           Use IOCP server (high performance)\n"
+              << "      --iocp           Use IOCP server (Windows, high performance)\n"
+              << "      --iocp-accepts N AcceptEx calls kept outstanding (default: 16)\n"
+              << "      --event-loop     Use epoll/kqueue server (Linux, BSD, macOS)\n"
+              << "      --io-uring       Use io_uring server (Linux)\n"
+              << "      --thread-per-core  Shared-nothing server, one keyspace slice per core\n"
+              << "      --cores N        Cores for --thread-per-core (default: all)\n"
               << "  -h, --help           Show this help\n";
 }
 
@@ -35,7 +60,13 @@ int main(int argc, char* argv[]) {
     mini_redis::Logger::log(mini_redis::Logger::Level::Info, 
                            "Config: port=" + std::to_string(cfg.port) + 
                            " max_keys=" + std::to_string(cfg.max_keys) +
-                           " iocp=" + (cfg.use_iocp ? "true" : "false"));
+                           " shards=" + std::to_string(cfg.shards) +
+                           " maxmemory=" + std::to_string(cfg.maxmemory) +
+                           " policy=" + cfg.maxmemory_policy +
+                           " iocp=" + (cfg.use_iocp ? "true" : "false") +
+                           " event_loop=" + (cfg.use_event_loop ? "true" : "false") +
+                           " io_uring=" + (cfg.use_io_uring ? "true" : "false") +
+                           " thread_per_core=" + (cfg.use_thread_per_core ? "true" : "false"));
     
     // Check for persistence file
     std::ifstream check_file(cfg.rdb_path);
@@ -46,9 +77,15 @@ int main(int argc, char* argv[]) {
     }
 
     // Start server
-    if (cfg.use_iocp) {
-        return mini_redis::start_server_iocp(cfg.port);
+    if (cfg.use_thread_per_core) {
+        return mini_redis::start_server_thread_per_core(cfg);
+    } else if (cfg.use_io_uring) {
+        return mini_redis::start_server_io_uring(cfg);
+    } else if (cfg.use_event_loop) {
+        return mini_redis::start_server_event_loop(cfg);
+    } else if (cfg.use_iocp) {
+        return mini_redis::start_server_iocp(cfg);
     } else {
-        return mini_redis::start_server(cfg.port);
+        return mini_redis::start_server(cfg);
     }
 }
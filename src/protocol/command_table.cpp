@@ -0,0 +1,268 @@
+// Command table implementation
+// The name -> spec lookup is a compile-time perfect hash: a seed is searched at
+// compile time so every command lands in a distinct slot, and a lookup is one
+// hash, one slot load and one string compare.
+
+#include "command_table.hpp"
+
+#include <charconv>
+#include <cstring>
+
+namespace protocol {
+
+    namespace {
+
+        // Indexed by CommandType: SPECS[i].type == i (checked below)
+        constexpr CommandSpec SPECS[] = {
+            {"",          CommandType::UNKNOWN,    0, 0},
+            {"PING",      CommandType::PING,      -1, 0},
+            {"ECHO",      CommandType::ECHO,       2, 0},
+            {"SET",       CommandType::SET,       -3, CMD_WRITE},
+            {"GET",       CommandType::GET,        2, CMD_READ},
+            {"DEL",       CommandType::DEL,       -2, CMD_WRITE | CMD_KEYS_ALL},
+            {"EXISTS",    CommandType::EXISTS,    -2, CMD_READ | CMD_KEYS_ALL},
+            {"KEYS",      CommandType::KEYS,       2, CMD_READ | CMD_NO_KEYS},
+            {"EXPIRE",    CommandType::EXPIRE,    -3, CMD_WRITE},
+            {"TTL",       CommandType::TTL,        2, CMD_READ},
+            {"MGET",      CommandType::MGET,      -2, CMD_READ | CMD_KEYS_ALL},
+            {"QUIT",      CommandType::QUIT,      -1, 0},
+            {"SAVE",      CommandType::SAVE,       1, CMD_ADMIN},
+            {"LOAD",      CommandType::LOAD,       1, CMD_ADMIN},
+            {"SELECT",    CommandType::SELECT,     2, 0},
+            {"INFO",      CommandType::INFO,      -1, CMD_ADMIN},
+            {"SUBSCRIBE", CommandType::SUBSCRIBE, -2, CMD_PUBSUB},
+            {"PUBLISH",   CommandType::PUBLISH,    3, CMD_PUBSUB},
+            {"EVAL",      CommandType::EVAL,      -3, CMD_WRITE | CMD_NUMKEYS},
+            {"AUTH",      CommandType::AUTH,      -2, 0},
+            {"INCR",      CommandType::INCR,       2, CMD_WRITE},
+            {"DECR",      CommandType::DECR,       2, CMD_WRITE},
+            {"INCRBY",    CommandType::INCRBY,     3, CMD_WRITE},
+            {"DECRBY",    CommandType::DECRBY,     3, CMD_WRITE},
+            {"APPEND",    CommandType::APPEND,     3, CMD_WRITE},
+            {"STRLEN",    CommandType::STRLEN,     2, CMD_READ},
+            {"PEXPIRE",   CommandType::PEXPIRE,   -3, CMD_WRITE},
+            {"PTTL",      CommandType::PTTL,       2, CMD_READ},
+            {"PEXPIREAT", CommandType::PEXPIREAT,  3, CMD_WRITE},
+            {"BGREWRITEAOF", CommandType::BGREWRITEAOF, 1, CMD_ADMIN},
+            {"BGSAVE",    CommandType::BGSAVE,     1, CMD_ADMIN},
+            {"LATENCY",   CommandType::LATENCY,   -2, CMD_ADMIN},
+            {"SLOWLOG",   CommandType::SLOWLOG,   -2, CMD_ADMIN},
+            {"PSYNC",     CommandType::PSYNC,      3, CMD_ADMIN},
+            {"REPLCONF",  CommandType::REPLCONF,  -2, CMD_ADMIN},
+            {"REPLICAOF", CommandType::REPLICAOF,  3, CMD_ADMIN},
+            {"CLUSTER",   CommandType::CLUSTER,   -2, CMD_ADMIN},
+            {"ASKING",    CommandType::ASKING,     1, 0},
+            {"RESTORE-RECORDS", CommandType::RESTORE_RECORDS, 2, CMD_WRITE | CMD_NO_KEYS},
+            {"MSET",      CommandType::MSET,      -3, CMD_WRITE | CMD_KEY_PAIRS},
+            {"MSETNX",    CommandType::MSETNX,    -3, CMD_WRITE | CMD_KEY_PAIRS},
+            {"UNLINK",    CommandType::UNLINK,    -2, CMD_WRITE | CMD_KEYS_ALL},
+            {"FLUSHDB",   CommandType::FLUSHDB,   -1, CMD_WRITE | CMD_NO_KEYS},
+            {"FLUSHALL",  CommandType::FLUSHALL,  -1, CMD_WRITE | CMD_NO_KEYS},
+            {"SCAN",      CommandType::SCAN,      -2, CMD_READ | CMD_NO_KEYS},
+            {"HSET",      CommandType::HSET,      -4, CMD_WRITE},
+            {"HGET",      CommandType::HGET,       3, CMD_READ},
+            {"HMGET",     CommandType::HMGET,     -3, CMD_READ},
+            {"LPUSH",     CommandType::LPUSH,     -3, CMD_WRITE},
+            {"RPUSH",     CommandType::RPUSH,     -3, CMD_WRITE},
+            {"RPOP",      CommandType::RPOP,      -2, CMD_WRITE},
+            {"LRANGE",    CommandType::LRANGE,     4, CMD_READ},
+            {"SADD",      CommandType::SADD,      -3, CMD_WRITE},
+            {"SISMEMBER", CommandType::SISMEMBER,  3, CMD_READ},
+            {"ZADD",      CommandType::ZADD,      -4, CMD_WRITE},
+            {"ZRANGEBYSCORE", CommandType::ZRANGEBYSCORE, -4, CMD_READ},
+            {"TYPE",      CommandType::TYPE,       2, CMD_READ},
+            {"MULTI",     CommandType::MULTI,      1, 0},
+            {"EXEC",      CommandType::EXEC,       1, 0},
+            {"DISCARD",   CommandType::DISCARD,    1, 0},
+            {"WATCH",     CommandType::WATCH,     -2, CMD_READ | CMD_KEYS_ALL},
+            {"UNWATCH",   CommandType::UNWATCH,    1, 0},
+            {"EVALSHA",   CommandType::EVALSHA,   -3, CMD_WRITE | CMD_NUMKEYS},
+            {"SCRIPT",    CommandType::SCRIPT,    -2, 0},
+            {"HELLO",     CommandType::HELLO,     -1, 0},
+            {"CLIENT",    CommandType::CLIENT,    -2, 0},
+            {"EVAL_RO",   CommandType::EVAL_RO,   -3, CMD_READ | CMD_NUMKEYS},
+            {"EVALSHA_RO", CommandType::EVALSHA_RO, -3, CMD_READ | CMD_NUMKEYS},
+        };
+
+        constexpr size_t SPEC_COUNT = sizeof(SPECS) / sizeof(SPECS[0]);
+        constexpr uint8_t EMPTY_SLOT = 0xFF;
+        constexpr uint32_t NO_SEED = 0xFFFFFFFFu;
+        static_assert(SPEC_COUNT == static_cast<size_t>(CommandType::COUNT), "every CommandType needs a spec");
+        static_assert(SPEC_COUNT < EMPTY_SLOT, "slot indices are stored in uint8_t");
+
+        constexpr bool specs_in_enum_order() {
+            for (size_t i = 0; i < SPEC_COUNT; ++i) {
+                if (static_cast<size_t>(SPECS[i].type) != i) return false;
+            }
+            return true;
+        }
+        static_assert(specs_in_enum_order(), "SPECS must list commands in CommandType order");
+
+        // Power of two with ~8x headroom so a collision-free seed is found quickly
+        constexpr size_t slot_count_for(size_t n) {
+            size_t slots = 1;
+            while (slots < n * 8) slots <<= 1;
+            return slots;
+        }
+        constexpr size_t SLOT_COUNT = slot_count_for(SPEC_COUNT);
+
+        // Seeded FNV-1a with a final avalanche so the low bits are usable as a slot index
+        constexpr uint32_t hash_name(std::string_view name, uint32_t seed) {
+            uint32_t h = 2166136261u ^ seed;
+            for (char c : name) {
+                h ^= static_cast<uint8_t>(c);
+                h *= 16777619u;
+            }
+            h ^= h >> 16;
+            h *= 0x7feb352du;
+            h ^= h >> 15;
+            return h;
+        }
+
+        struct HashTable {
+            uint32_t seed = NO_SEED;
+            uint8_t slots[SLOT_COUNT] = {};
+        };
+
+        constexpr bool try_seed(uint32_t seed, HashTable& table) {
+            for (size_t i = 0; i < SLOT_COUNT; ++i) table.slots[i] = EMPTY_SLOT;
+            for (size_t i = 1; i < SPEC_COUNT; ++i) {
+                size_t slot = hash_name(SPECS[i].name, seed) & (SLOT_COUNT - 1);
+                if (table.slots[slot] != EMPTY_SLOT) return false;
+                table.slots[slot] = static_cast<uint8_t>(i);
+            }
+            table.seed = seed;
+            return true;
+        }
+
+        constexpr HashTable build_table() {
+            HashTable table;
+            for (uint32_t seed = 0; seed < 10000; ++seed) {
+                if (try_seed(seed, table)) return table;
+            }
+            table.seed = NO_SEED;
+            return table;
+        }
+
+        constexpr HashTable TABLE = build_table();
+        static_assert(TABLE.seed != NO_SEED, "no collision-free seed found; raise the slot headroom");
+
+    } // anonymous namespace
+
+    const CommandSpec* lookup_command(std::string_view name) {
+        uint8_t index = TABLE.slots[hash_name(name, TABLE.seed) & (SLOT_COUNT - 1)];
+        if (index == EMPTY_SLOT) {
+            return nullptr;
+        }
+        const CommandSpec& spec = SPECS[index];
+        return spec.name == name ? &spec : nullptr;
+    }
+
+    const CommandSpec& command_spec(CommandType type) {
+        size_t index = static_cast<size_t>(type);
+        return index < SPEC_COUNT ? SPECS[index] : SPECS[0];
+    }
+
+    bool check_arity(const CommandSpec& spec, size_t arg_count) {
+        size_t total = arg_count + 1; // Include the command name
+        if ((spec.flags & CMD_KEY_PAIRS) && arg_count % 2 != 0) {
+            return false;
+        }
+        if (spec.arity >= 0) {
+            return total == static_cast<size_t>(spec.arity);
+        }
+        return total >= static_cast<size_t>(-spec.arity);
+    }
+
+    KeyRange command_keys(const CommandSpec& spec, size_t arg_count) {
+        if (!(spec.flags & (CMD_READ | CMD_WRITE)) || (spec.flags & (CMD_NO_KEYS | CMD_NUMKEYS)) || arg_count == 0) {
+            return {0, 0, 1};
+        }
+        if (spec.flags & CMD_KEY_PAIRS) {
+            return {0, arg_count, 2};
+        }
+        return {0, (spec.flags & CMD_KEYS_ALL) ? arg_count : 1, 1};
+    }
+
+    KeyRange command_keys(const Command& cmd) {
+        const CommandSpec& spec = command_spec(cmd.type);
+        if (!(spec.flags & CMD_NUMKEYS)) {
+            return command_keys(spec, cmd.args.size());
+        }
+        size_t numkeys = 0;
+        if (cmd.args.size() < 2) {
+            return {0, 0, 1};
+        }
+        const std::string& arg = cmd.args[1];
+        auto parsed = std::from_chars(arg.data(), arg.data() + arg.size(), numkeys);
+        if (parsed.ec != std::errc() || parsed.ptr != arg.data() + arg.size() || numkeys > cmd.args.size() - 2) {
+            return {0, 0, 1};
+        }
+        return {2, 2 + numkeys, 1};
+    }
+
+    namespace {
+
+        size_t decimal_digits(size_t n) {
+            size_t digits = 1;
+            while (n >= 10) {
+                n /= 10;
+                ++digits;
+            }
+            return digits;
+        }
+
+        // <prefix><n>\r\n
+        char* write_header(char* out, char prefix, size_t n) {
+            *out++ = prefix;
+            out = std::to_chars(out, out + 20, n).ptr;
+            *out++ = '\r';
+            *out++ = '\n';
+            return out;
+        }
+
+        char* write_bulk(char* out, std::string_view value) {
+            out = write_header(out, '$', value.size());
+            std::memcpy(out, value.data(), value.size());
+            out += value.size();
+            *out++ = '\r';
+            *out++ = '\n';
+            return out;
+        }
+
+    } // anonymous namespace
+
+    size_t command_resp_size(const Command& cmd) {
+        std::string_view name = command_spec(cmd.type).name;
+        if (name.empty()) {
+            return 0;
+        }
+        // *<count>\r\n then each element as $<len>\r\n<value>\r\n
+        size_t total = 3 + decimal_digits(cmd.args.size() + 1);
+        total += 5 + decimal_digits(name.size()) + name.size();
+        for (const auto& arg : cmd.args) {
+            total += 5 + decimal_digits(arg.size()) + arg.size();
+        }
+        return total;
+    }
+
+    char* write_command_resp(const Command& cmd, char* out) {
+        std::string_view name = command_spec(cmd.type).name;
+        if (name.empty()) {
+            return out;
+        }
+        out = write_header(out, '*', cmd.args.size() + 1);
+        out = write_bulk(out, name);
+        for (const auto& arg : cmd.args) {
+            out = write_bulk(out, arg);
+        }
+        return out;
+    }
+
+    std::string command_to_resp(const Command& cmd) {
+        std::string result(command_resp_size(cmd), '\0');
+        write_command_resp(cmd, result.data());
+        return result;
+    }
+
+}
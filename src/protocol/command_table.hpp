@@ -0,0 +1,72 @@
+// Command table for Mini-Redis
+// Single source of truth for command names, arity and read/write flags.
+// Names are resolved through a perfect hash generated at compile time.
+
+#pragma once
+
+#include "parser.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace protocol {
+
+    // Command property flags
+    enum CommandFlags : uint8_t {
+        CMD_READ = 1 << 0,     // Reads the keyspace
+        CMD_WRITE = 1 << 1,    // Modifies the keyspace (logged to AOF and replicated)
+        CMD_ADMIN = 1 << 2,    // Server / persistence management
+        CMD_PUBSUB = 1 << 3,   // Pub/Sub messaging
+        CMD_KEYS_ALL = 1 << 4, // Every argument is a key (otherwise only the first)
+        CMD_NO_KEYS = 1 << 5,  // Touches the keyspace without naming keys
+        CMD_KEY_PAIRS = 1 << 6, // Arguments are key value pairs
+        CMD_NUMKEYS = 1 << 7    // Script, numkeys, then that many keys (EVAL)
+    };
+
+    struct CommandSpec {
+        std::string_view name; // Upper-case command name
+        CommandType type;
+        int arity;             // Argument count including the name; negative = at least -arity
+        uint8_t flags;
+    };
+
+    // Look up an upper-case command name; nullptr if unknown
+    const CommandSpec* lookup_command(std::string_view name);
+
+    // Spec for a known command type (UNKNOWN maps to a placeholder spec)
+    const CommandSpec& command_spec(CommandType type);
+
+    // Whether args.size() (excluding the name) satisfies the command's arity
+    // (and, for key value pairs, is even)
+    bool check_arity(const CommandSpec& spec, size_t arg_count);
+
+    // Key arguments of a command: args[first], args[first + step], ... before end
+    struct KeyRange {
+        size_t first;
+        size_t end;
+        size_t step;
+    };
+
+    // Which of arg_count arguments are keys (none for a command that does not
+    // touch the keyspace)
+    KeyRange command_keys(const CommandSpec& spec, size_t arg_count);
+    // The keys of a parsed command, including those counted by an argument
+    // (CMD_NUMKEYS; none if the count is not valid)
+    KeyRange command_keys(const Command& cmd);
+
+    inline bool is_write_command(CommandType type) {
+        return (command_spec(type).flags & CMD_WRITE) != 0;
+    }
+
+    // Serialize a command as a RESP array (used by AOF and replication)
+    std::string command_to_resp(const Command& cmd);
+
+    // Exact size of command_to_resp(cmd), 0 for UNKNOWN
+    size_t command_resp_size(const Command& cmd);
+
+    // Write command_to_resp(cmd) into out, which must hold command_resp_size(cmd)
+    // bytes; returns the end of the written data
+    char* write_command_resp(const Command& cmd, char* out);
+
+}
@@ -1,7 +1,9 @@
 // RESP protocol parser implementation
 // Converts raw command strings into structured Command objects with type and arguments
+// Command names are resolved through the shared command table
 
 #include "parser.hpp"
+#include "command_table.hpp"
 
 #include <algorithm>
 #include <cctype>
@@ -53,33 +55,9 @@ namespace protocol {
         if (tokens.empty()) return cmd;
 
         std::string name = to_upper(tokens[0]);
+        cmd.name = name;
 
-        if (name == "PING") cmd.type = CommandType::PING;
-        else if (name == "ECHO") cmd.type = CommandType::ECHO;
-        else if (name == "SET") cmd.type = CommandType::SET;
-        else if (name == "GET") cmd.type = CommandType::GET;
-        else if (name == "DEL") cmd.type = CommandType::DEL;
-        else if (name == "EXISTS") cmd.type = CommandType::EXISTS;
-        else if (name == "KEYS") cmd.type = CommandType::KEYS;
-        else if (name == "EXPIRE") cmd.type = CommandType::EXPIRE;
-        else if (name == "TTL") cmd.type = CommandType::TTL;
-        else if (name == "MGET") cmd.type = CommandType::MGET;
-        else if (name == "QUIT") cmd.type = CommandType::QUIT;
-        else if (name == "SAVE") cmd.type = CommandType::SAVE;
-        else if (name == "LOAD") cmd.type = CommandType::LOAD;
-        else if (name == "SELECT") cmd.type = CommandType::SELECT;
-        else if (name == "INFO") cmd.type = CommandType::INFO;
-        else if (name == "SUBSCRIBE") cmd.type = CommandType::SUBSCRIBE;
-        else if (name == "PUBLISH") cmd.type = CommandType::PUBLISH;
-        else if (name == "EVAL") cmd.type = CommandType::EVAL;
-        else if (name == "AUTH") cmd.type = CommandType::AUTH;
-        else if (name == "INCR") cmd.type = CommandType::INCR;
-        else if (name == "DECR") cmd.type = CommandType::DECR;
-        else if (name == "INCRBY") cmd.type = CommandType::INCRBY;
-        else if (name == "DECRBY") cmd.type = CommandType::DECRBY;
-        else if (name == "APPEND") cmd.type = CommandType::APPEND;
-        else if (name == "STRLEN") cmd.type = CommandType::STRLEN;
-        else cmd.type = CommandType::UNKNOWN;
+        if (const CommandSpec* spec = lookup_command(name)) cmd.type = spec->type;
 
         if (tokens.size() > 1)
             cmd.args.assign(tokens.begin() + 1, tokens.end());
@@ -90,44 +68,28 @@ namespace protocol {
     // Convert RESP array to Command struct
     // First element is command name (already uppercase from parser), rest are args
     Command command_from_resp_array(const std::vector<std::string>& args) {
+        std::vector<std::string_view> views(args.begin(), args.end());
+        return command_from_resp_args(views);
+    }
+
+    Command command_from_resp_args(const std::vector<std::string_view>& args) {
         Command cmd;
         
         if (args.empty()) {
             return cmd; // Empty command
         }
         
-        const std::string& name = args[0];
+        std::string_view name = args[0];
+        cmd.name.assign(name.data(), name.size());
         
-        if (name == "PING") cmd.type = CommandType::PING;
-        else if (name == "ECHO") cmd.type = CommandType::ECHO;
-        else if (name == "SET") cmd.type = CommandType::SET;
-        else if (name == "GET") cmd.type = CommandType::GET;
-        else if (name == "DEL") cmd.type = CommandType::DEL;
-        else if (name == "EXISTS") cmd.type = CommandType::EXISTS;
-        else if (name == "KEYS") cmd.type = CommandType::KEYS;
-        else if (name == "EXPIRE") cmd.type = CommandType::EXPIRE;
-        else if (name == "TTL") cmd.type = CommandType::TTL;
-        else if (name == "MGET") cmd.type = CommandType::MGET;
-        else if (name == "QUIT") cmd.type = CommandType::QUIT;
-        else if (name == "SAVE") cmd.type = CommandType::SAVE;
-        else if (name == "LOAD") cmd.type = CommandType::LOAD;
-        else if (name == "SELECT") cmd.type = CommandType::SELECT;
-        else if (name == "INFO") cmd.type = CommandType::INFO;
-        else if (name == "SUBSCRIBE") cmd.type = CommandType::SUBSCRIBE;
-        else if (name == "PUBLISH") cmd.type = CommandType::PUBLISH;
-        else if (name == "EVAL") cmd.type = CommandType::EVAL;
-        else if (name == "AUTH") cmd.type = CommandType::AUTH;
-        else if (name == "INCR") cmd.type = CommandType::INCR;
-        else if (name == "DECR") cmd.type = CommandType::DECR;
-        else if (name == "INCRBY") cmd.type = CommandType::INCRBY;
-        else if (name == "DECRBY") cmd.type = CommandType::DECRBY;
-        else if (name == "APPEND") cmd.type = CommandType::APPEND;
-        else if (name == "STRLEN") cmd.type = CommandType::STRLEN;
-        else cmd.type = CommandType::UNKNOWN;
+        if (const CommandSpec* spec = lookup_command(name)) cmd.type = spec->type;
         
         // Copy remaining elements as args
         if (args.size() > 1) {
-            cmd.args.assign(args.begin() + 1, args.end());
+            cmd.args.reserve(args.size() - 1);
+            for (size_t i = 1; i < args.size(); ++i) {
+                cmd.args.emplace_back(args[i]);
+            }
         }
         
         return cmd;
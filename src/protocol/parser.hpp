@@ -4,6 +4,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace protocol {
@@ -34,11 +35,55 @@ namespace protocol {
         INCRBY,
         DECRBY,
         APPEND,
-        STRLEN
+        STRLEN,
+        PEXPIRE,
+        PTTL,
+        PEXPIREAT,
+        BGREWRITEAOF,
+        BGSAVE,
+        LATENCY,
+        SLOWLOG,
+        PSYNC,
+        REPLCONF,
+        REPLICAOF,
+        CLUSTER,
+        ASKING,
+        RESTORE_RECORDS,
+        MSET,
+        MSETNX,
+        UNLINK,
+        FLUSHDB,
+        FLUSHALL,
+        SCAN,
+        HSET,
+        HGET,
+        HMGET,
+        LPUSH,
+        RPUSH,
+        RPOP,
+        LRANGE,
+        SADD,
+        SISMEMBER,
+        ZADD,
+        ZRANGEBYSCORE,
+        TYPE,
+        MULTI,
+        EXEC,
+        DISCARD,
+        WATCH,
+        UNWATCH,
+        EVALSHA,
+        SCRIPT,
+        HELLO,
+        CLIENT,
+        EVAL_RO,
+        EVALSHA_RO,
+        COUNT // Number of command types (keep last)
     };
 
     struct Command {
         CommandType type{CommandType::UNKNOWN};
+        std::string name; // Upper-cased command name as received
         std::vector<std::string> args;
     };
 
@@ -47,5 +92,9 @@ namespace protocol {
     // Convert RESP array (from RESP parser) to Command struct
     // First element is command name (uppercase), rest are arguments
     Command command_from_resp_array(const std::vector<std::string>& args);
+    
+    // Same as command_from_resp_array, for views into the RESP parser's buffer
+    // (each argument is copied exactly once, into the Command)
+    Command command_from_resp_args(const std::vector<std::string_view>& args);
 
 }
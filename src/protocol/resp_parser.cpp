@@ -1,93 +1,207 @@
 #include "resp_parser.hpp"
 
-#include <sstream>
 #include <algorithm>
 #include <cctype>
 
+namespace {
+
+// Keep large one-off buffers (e.g. a 1 MB SET) from pinning memory once drained
+const size_t SHRINK_THRESHOLD = 1024 * 1024;
+
+// Same limit as Redis' proto-max-bulk-len default
+const long long MAX_BULK_LEN = 512LL * 1024 * 1024;
+
+// Same limit as Redis on a multibulk header's element count: a longer array
+// is refused before any of it is buffered
+const long long MAX_MULTIBULK_LEN = 1024LL * 1024;
+
+} // anonymous namespace
+
 RespParser::RespParser() : buffer("") {}
 
 void RespParser::append(const char* data, size_t len) {
+    // Compact once per batch: drop every frame consumed since the last append
+    if (pos > 0) {
+        if (pos == buffer.size()) {
+            buffer.clear();
+            if (buffer.capacity() > SHRINK_THRESHOLD) {
+                buffer.shrink_to_fit();
+            }
+        } else {
+            buffer.erase(0, pos);
+        }
+        scan -= pos;
+        for (auto& span : spans) {
+            span.first -= pos;
+        }
+        pos = 0;
+    }
     buffer.append(data, len);
 }
 
-std::optional<std::string> RespParser::readLine() {
-    size_t pos = buffer.find("\r\n");
-    if (pos == std::string::npos)
-        return std::nullopt;
-    
-    std::string line = buffer.substr(0, pos);
-    buffer.erase(0, pos + 2);
-    return line;
+void RespParser::reset() {
+    buffer.clear();
+    pos = 0;
+    scan = 0;
+    inFrame = false;
+    remaining = 0;
+    bulkLen = -1;
+    spans.clear();
 }
 
-std::optional<std::string> RespParser::readBytes(size_t n) {
-    if (buffer.size() < n + 2) // need n + CRLF
-        return std::nullopt;
-    
-    std::string data = buffer.substr(0, n);
-    buffer.erase(0, n);
-    
-    // now must see CRLF
-    if (buffer.size() < 2 || buffer[0] != '\r' || buffer[1] != '\n')
-        return std::nullopt;
+RespStatus RespParser::readInteger(long long& out, std::string& error) {
+    size_t lineEnd = buffer.find("\r\n", scan + 1);
+    if (lineEnd == std::string::npos)
+        return RespStatus::Incomplete;
     
-    buffer.erase(0, 2);
-    return data;
+    size_t i = scan + 1;
+    bool negative = false;
+    if (i < lineEnd && buffer[i] == '-') {
+        negative = true;
+        ++i;
+    }
+    if (i == lineEnd || lineEnd - i > 18) {
+        error = "ERR Protocol error: invalid length";
+        return RespStatus::Error;
+    }
+    long long value = 0;
+    for (; i < lineEnd; ++i) {
+        char c = buffer[i];
+        if (c < '0' || c > '9') {
+            error = "ERR Protocol error: invalid length";
+            return RespStatus::Error;
+        }
+        value = value * 10 + (c - '0');
+    }
+    out = negative ? -value : value;
+    scan = lineEnd + 2;
+    return RespStatus::Complete;
 }
 
-RespResult RespParser::parse() {
-    if (buffer.empty())
-        return RespResult(false, {}, "");
-    
-    if (buffer[0] != '*')
-        return RespResult(true, {}, "ERR expected array");
-    
-    buffer.erase(0, 1);
-    
-    auto countLine = readLine();
-    if (!countLine)
-        return RespResult(false, {}, "");
-    
-    int count = std::stoi(*countLine);
-    if (count <= 0)
-        return RespResult(true, {}, "ERR invalid array length");
+RespStatus RespParser::parseArgs(std::vector<std::string_view>& args, std::string& error) {
+    args.clear();
     
-    std::vector<std::string> elements;
-    elements.reserve(count);
-    
-    for (int i = 0; i < count; i++) {
-        if (buffer.empty())
-            return RespResult(false, {}, "");
-        
-        if (buffer[0] != '$')
-            return RespResult(true, {}, "ERR expected bulk string");
+    if (!inFrame) {
+        scan = pos;
+        if (scan >= buffer.size())
+            return RespStatus::Incomplete;
         
-        buffer.erase(0, 1);
+        if (buffer[scan] != '*') {
+            error = "ERR expected array";
+            reset();
+            return RespStatus::Error;
+        }
         
-        auto lenLine = readLine();
-        if (!lenLine)
-            return RespResult(false, {}, "");
+        long long count = 0;
+        RespStatus status = readInteger(count, error);
+        if (status == RespStatus::Incomplete)
+            return status;
+        if (status == RespStatus::Error) {
+            reset();
+            return status;
+        }
         
-        int len = std::stoi(*lenLine);
+        if (count > MAX_MULTIBULK_LEN) {
+            error = "ERR Protocol error: invalid multibulk length";
+            reset();
+            return RespStatus::Error;
+        }
+        if (count <= 0) {
+            // Empty or null array: a complete frame with no elements
+            pos = scan;
+            return RespStatus::Complete;
+        }
         
-        if (len < 0) {
-            elements.push_back(""); // null bulk string
-            continue;
+        inFrame = true;
+        remaining = count;
+        bulkLen = -1;
+        spans.clear();
+        spans.reserve(static_cast<size_t>(std::min<long long>(count, 1024)));
+    }
+    
+    while (remaining > 0) {
+        if (bulkLen < 0) {
+            if (scan >= buffer.size())
+                return RespStatus::Incomplete;
+            
+            if (buffer[scan] != '$') {
+                error = "ERR expected bulk string";
+                reset();
+                return RespStatus::Error;
+            }
+            
+            long long len = 0;
+            RespStatus status = readInteger(len, error);
+            if (status == RespStatus::Incomplete)
+                return status;
+            if (status == RespStatus::Error) {
+                reset();
+                return status;
+            }
+            
+            if (len < 0) {
+                spans.emplace_back(scan, 0); // null bulk string
+                --remaining;
+                continue;
+            }
+            if (len > MAX_BULK_LEN) {
+                error = "ERR Protocol error: invalid bulk length";
+                reset();
+                return RespStatus::Error;
+            }
+            bulkLen = len;
         }
         
-        auto data = readBytes(len);
-        if (!data)
-            return RespResult(false, {}, "");  // incomplete
+        // need bulkLen + CRLF; nothing before scan is examined again
+        if (buffer.size() - scan < static_cast<size_t>(bulkLen) + 2)
+            return RespStatus::Incomplete;
+        
+        size_t end = scan + static_cast<size_t>(bulkLen);
+        if (buffer[end] != '\r' || buffer[end + 1] != '\n') {
+            error = "ERR Protocol error: bad bulk string terminator";
+            reset();
+            return RespStatus::Error;
+        }
         
-        elements.push_back(*data);
+        spans.emplace_back(scan, static_cast<size_t>(bulkLen));
+        scan = end + 2;
+        bulkLen = -1;
+        --remaining;
     }
     
+    // Frame complete: consume it and hand out views into the buffer
+    inFrame = false;
+    pos = scan;
+    
     // Convert first element (command name) to uppercase for command matching
-    if (!elements.empty()) {
-        std::string& cmd_name = elements[0];
-        std::transform(cmd_name.begin(), cmd_name.end(), cmd_name.begin(),
-            [](unsigned char c) { return std::toupper(c); });
+    if (!spans.empty()) {
+        char* name = &buffer[spans[0].first];
+        std::transform(name, name + spans[0].second, name,
+            [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    }
+    
+    args.reserve(spans.size());
+    for (const auto& span : spans) {
+        args.emplace_back(buffer.data() + span.first, span.second);
     }
+    spans.clear();
+    return RespStatus::Complete;
+}
+
+RespResult RespParser::parse() {
+    std::vector<std::string_view> args;
+    std::string error;
+    RespStatus status = parseArgs(args, error);
+    
+    if (status == RespStatus::Incomplete)
+        return RespResult(false, {}, "");
+    if (status == RespStatus::Error)
+        return RespResult(true, {}, error);
     
+    std::vector<std::string> elements;
+    elements.reserve(args.size());
+    for (const auto& arg : args) {
+        elements.emplace_back(arg);
+    }
     return RespResult(true, std::move(elements), "");
 }
@@ -1,8 +1,8 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
-#include <optional>
 
 class RespResult {
 public:
@@ -14,20 +14,47 @@ public:
         : complete(c), command(std::move(cmd)), error(std::move(err)) {}
 };
 
+enum class RespStatus { Incomplete, Complete, Error };
+
+// Incremental RESP array parser over one contiguous read buffer.
+// A read cursor walks the buffer; consumed bytes are only dropped when new data
+// is appended, so a pipelined batch costs one memmove instead of one per token.
+// A partial frame keeps its progress (element count, parsed spans, pending bulk
+// length) and resumes where it stopped once more bytes arrive.
 class RespParser {
 private:
     std::string buffer;
+    size_t pos = 0;          // Start of the first unconsumed frame
+    size_t scan = 0;         // Next byte to parse inside the current frame
+    bool inFrame = false;    // Array header of the current frame already parsed
+    long long remaining = 0; // Elements still to parse in the current frame
+    long long bulkLen = -1;  // Length of the pending bulk string, -1 if header not yet read
+    std::vector<std::pair<size_t, size_t>> spans; // Offset/length of parsed elements
     
-    // Reads exactly n bytes, returns empty optional if incomplete
-    std::optional<std::string> readBytes(size_t n);
-    
-    // Reads until CRLF, returns string without CRLF
-    std::optional<std::string> readLine();
+    // Parses the integer on the line at scan (after the type byte); advances scan past CRLF
+    RespStatus readInteger(long long& out, std::string& error);
 
 public:
     RespParser();
     
+    // Drops the frame in progress and all buffered data, after a protocol error
+    // or to reuse the parser for a new connection; the buffer keeps its capacity
+    void reset();
+    
+    // Appends received bytes, first compacting away already consumed frames.
+    // Invalidates views returned by parseArgs.
     void append(const char* data, size_t len);
     
+    // Parses the next complete frame. On Complete, args point into the internal
+    // buffer (command name upper-cased in place) and stay valid until the next append.
+    RespStatus parseArgs(std::vector<std::string_view>& args, std::string& error);
+    
+    // Owning-string wrapper around parseArgs
     RespResult parse();
+    
+    // Bytes received but not yet consumed by a complete frame
+    size_t buffered() const { return buffer.size() - pos; }
+    
+    // Bytes the buffer holds room for
+    size_t capacity() const { return buffer.capacity(); }
 };
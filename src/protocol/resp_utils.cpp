@@ -2,14 +2,139 @@
 
 #include "resp_utils.hpp"
 
+#include <algorithm>
+#include <charconv>
+
 namespace mini_redis {
 
+void ReplyChain::splice(ValueRef value) {
+    splice_pending_ += value.size();
+    splices_.push_back(Splice{bytes.size(), std::move(value)});
+}
+
+void ReplyChain::consume(size_t n) {
+    while (n > 0) {
+        const size_t end = next_ < splices_.size() ? splices_[next_].offset : bytes.size();
+        if (byte_pos_ < end) {
+            const size_t take = std::min(n, end - byte_pos_);
+            byte_pos_ += take;
+            n -= take;
+            continue;
+        }
+        if (next_ == splices_.size()) {
+            break;
+        }
+        Splice& splice = splices_[next_];
+        const size_t take = std::min(n, splice.value.size() - value_pos_);
+        value_pos_ += take;
+        splice_pending_ -= take;
+        n -= take;
+        if (value_pos_ == splice.value.size()) {
+            splice.value.reset(); // Sent: the store may free it now
+            ++next_;
+            value_pos_ = 0;
+        }
+    }
+    if (pending() == 0) {
+        clear();
+    }
+}
+
+void ReplyChain::clear() {
+    bytes.clear();
+    splices_.clear();
+    byte_pos_ = 0;
+    next_ = 0;
+    value_pos_ = 0;
+    splice_pending_ = 0;
+}
+
+void ReplyWriter::header(char prefix, int64_t value) {
+    // Prefix + up to 20 digits/sign + CRLF
+    char buf[24];
+    buf[0] = prefix;
+    char* end = std::to_chars(buf + 1, buf + sizeof(buf) - 2, value).ptr;
+    *end++ = '\r';
+    *end++ = '\n';
+    out_.append(buf, static_cast<size_t>(end - buf));
+}
+
+void ReplyWriter::line(char prefix, std::string_view msg) {
+    out_.push_back(prefix);
+    out_.append(msg.data(), msg.size());
+    out_.append("\r\n", 2);
+}
+
+void ReplyWriter::simple(std::string_view msg) {
+    line('+', msg);
+}
+
+void ReplyWriter::error(std::string_view msg) {
+    line('-', msg);
+}
+
+void ReplyWriter::bulk(std::string_view value) {
+    header('$', static_cast<int64_t>(value.size()));
+    out_.append(value.data(), value.size());
+    out_.append("\r\n", 2);
+}
+
+void ReplyWriter::bulk(std::string_view value, const SharedValue* shared) {
+    if (chain_ == nullptr || shared == nullptr || value.size() < SPLICE_MIN_BYTES) {
+        bulk(value);
+        return;
+    }
+    header('$', static_cast<int64_t>(value.size()));
+    chain_->splice(ValueRef(shared));
+    out_.append("\r\n", 2);
+}
+
+void ReplyWriter::nil() {
+    if (resp3_) {
+        out_.append("_\r\n", 3);
+        return;
+    }
+    out_.append("$-1\r\n", 5);
+}
+
+void ReplyWriter::nil_array() {
+    if (resp3_) {
+        out_.append("_\r\n", 3);
+        return;
+    }
+    out_.append("*-1\r\n", 5);
+}
+
+void ReplyWriter::integer(int64_t value) {
+    header(':', value);
+}
+
+void ReplyWriter::array_header(size_t count) {
+    header('*', static_cast<int64_t>(count));
+}
+
+void ReplyWriter::map_header(size_t pairs) {
+    if (resp3_) {
+        header('%', static_cast<int64_t>(pairs));
+        return;
+    }
+    header('*', static_cast<int64_t>(pairs * 2));
+}
+
+void ReplyWriter::push_header(size_t count) {
+    header('>', static_cast<int64_t>(count));
+}
+
 std::string resp_simple(const std::string& msg) {
-    return "+" + msg + "\r\n";
+    std::string out;
+    ReplyWriter(out).simple(msg);
+    return out;
 }
 
 std::string resp_bulk(const std::string& msg) {
-    return "$" + std::to_string(msg.size()) + "\r\n" + msg + "\r\n";
+    std::string out;
+    ReplyWriter(out).bulk(msg);
+    return out;
 }
 
 std::string resp_nil() {
@@ -17,23 +142,31 @@ std::string resp_nil() {
 }
 
 std::string resp_integer(int value) {
-    return ":" + std::to_string(value) + "\r\n";
+    std::string out;
+    ReplyWriter(out).integer(value);
+    return out;
 }
 
 std::string resp_integer64(int64_t value) {
-    return ":" + std::to_string(value) + "\r\n";
+    std::string out;
+    ReplyWriter(out).integer(value);
+    return out;
 }
 
 std::string resp_array(const std::vector<std::string>& items) {
-    std::string result = "*" + std::to_string(items.size()) + "\r\n";
+    std::string out;
+    ReplyWriter writer(out);
+    writer.array_header(items.size());
     for (const auto& item : items) {
-        result += "$" + std::to_string(item.size()) + "\r\n" + item + "\r\n";
+        writer.bulk(item);
     }
-    return result;
+    return out;
 }
 
 std::string resp_err(const std::string& msg) {
-    return "-" + msg + "\r\n";
+    std::string out;
+    ReplyWriter(out).error(msg);
+    return out;
 }
 
 } // namespace mini_redis
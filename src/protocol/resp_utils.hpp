@@ -4,11 +4,132 @@
 #ifndef MINI_REDIS_RESP_UTILS_HPP
 #define MINI_REDIS_RESP_UTILS_HPP
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "../storage/shared_value.hpp"
+
 namespace mini_redis {
 
+// Replies waiting to be sent: serialized bytes, plus stored values that are
+// referenced in place (spliced) rather than copied in. The stream is bytes up
+// to the first splice's offset, that value, bytes up to the next offset, and
+// so on, so a pipelined batch goes out as one gather list (iovec / WSABUF).
+class ReplyChain {
+public:
+    std::string bytes; // Serialized replies, spliced values left out
+
+    // Insert value's bytes at the current end of bytes
+    void splice(ValueRef value);
+
+    // Bytes not yet consumed, spliced values included
+    size_t pending() const { return bytes.size() - byte_pos_ + splice_pending_; }
+    // Call emit(std::string_view piece, const ValueRef* value) for at most
+    // max_pieces unsent pieces in order; value is set for a spliced piece.
+    // Returns the number of pieces emitted.
+    template <typename Emit>
+    size_t gather(size_t max_pieces, Emit&& emit) const;
+    // Mark n bytes as sent. Once nothing is pending the chain is cleared, so
+    // bytes keeps its capacity and the spliced values are released.
+    void consume(size_t n);
+    void clear();
+
+private:
+    struct Splice {
+        size_t offset; // Position in bytes the value goes before
+        ValueRef value;
+    };
+
+    std::vector<Splice> splices_;
+    size_t byte_pos_ = 0;       // Bytes of bytes already sent
+    size_t next_ = 0;           // First splice not completely sent
+    size_t value_pos_ = 0;      // Bytes of splices_[next_] already sent
+    size_t splice_pending_ = 0; // Spliced bytes not yet sent
+};
+
+template <typename Emit>
+size_t ReplyChain::gather(size_t max_pieces, Emit&& emit) const {
+    size_t pieces = 0;
+    size_t pos = byte_pos_;
+    size_t value_pos = value_pos_;
+    for (size_t i = next_; pieces < max_pieces;) {
+        const size_t end = i < splices_.size() ? splices_[i].offset : bytes.size();
+        if (pos < end) {
+            emit(std::string_view(bytes.data() + pos, end - pos), static_cast<const ValueRef*>(nullptr));
+            ++pieces;
+            pos = end;
+            continue;
+        }
+        if (i == splices_.size()) {
+            break;
+        }
+        const std::string_view value = splices_[i].value.view();
+        if (value_pos < value.size()) {
+            emit(value.substr(value_pos), &splices_[i].value);
+            ++pieces;
+        }
+        ++i;
+        value_pos = 0;
+    }
+    return pieces;
+}
+
+// Serializes RESP replies directly into a caller-owned output buffer.
+// Integers are formatted with std::to_chars and each header is appended in one
+// piece, so a reply costs no allocations once the buffer has grown to size.
+// A writer for a RESP3 client (HELLO 3) writes nulls and maps in RESP3 form.
+class ReplyWriter {
+public:
+    // Values at least this long are spliced into a ReplyChain, not copied
+    static constexpr size_t SPLICE_MIN_BYTES = 16 * 1024;
+
+    explicit ReplyWriter(std::string& out) : out_(out) {}
+    // Write into chain.bytes, splicing in large reference-counted values
+    explicit ReplyWriter(ReplyChain& chain) : out_(chain.bytes), chain_(&chain) {}
+
+    // Simple string: +msg\r\n
+    void simple(std::string_view msg);
+    // Error: -msg\r\n
+    void error(std::string_view msg);
+    // Bulk string: $len\r\nvalue\r\n
+    void bulk(std::string_view value);
+    // Bulk string from a stored value (shared is set if it is reference-counted,
+    // see KVStore::read_value): spliced when it is large and the writer has a
+    // chain, copied otherwise
+    void bulk(std::string_view value, const SharedValue* shared);
+    // Nil: $-1\r\n (RESP3: _\r\n)
+    void nil();
+    // Nil array: *-1\r\n (RESP3: _\r\n)
+    void nil_array();
+    // Integer: :value\r\n
+    void integer(int64_t value);
+    // Array header: *count\r\n (the elements follow)
+    void array_header(size_t count);
+    // Map header: %pairs\r\n (RESP2: an array of 2 * pairs), then key, value, ...
+    void map_header(size_t pairs);
+    // Out-of-band push (RESP3 only): >count\r\n (the elements follow)
+    void push_header(size_t count);
+
+    void set_resp3(bool resp3) { resp3_ = resp3; }
+    bool resp3() const { return resp3_; }
+
+    std::string& buffer() { return out_; }
+
+private:
+    // Append <prefix><value>\r\n
+    void header(char prefix, int64_t value);
+    // Append <prefix><msg>\r\n
+    void line(char prefix, std::string_view msg);
+
+    std::string& out_;
+    ReplyChain* chain_ = nullptr;
+    bool resp3_ = false;
+};
+
+// Convenience wrappers returning a fresh string (for one-off replies)
+
 // Simple string: +msg\r\n
 std::string resp_simple(const std::string& msg);
 
@@ -0,0 +1,973 @@
+// Cluster mode implementation
+// Slot ownership, redirection, topology polling and online slot migration
+
+#include "socket_compat.hpp"
+
+#include "cluster.hpp"
+#include "../protocol/resp_utils.hpp"
+#include "../storage/kv_store.hpp"
+#include "../utils/crc16.hpp"
+#include "../utils/logger.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+namespace {
+
+using mini_redis::CLUSTER_SLOTS;
+using mini_redis::ReplyWriter;
+
+constexpr int POLL_INTERVAL_MS = 1000;
+// Every connect, send and reply to another node is bounded by this
+constexpr int IO_TIMEOUT_MS = 2000;
+// A CLUSTER MEET address that never answers is dropped after this many polls
+constexpr int MEET_ATTEMPTS = 10;
+// Keys moved per RESTORE-RECORDS, and entries visited per scan step looking for them
+constexpr size_t MIGRATE_BATCH_KEYS = 1000;
+constexpr size_t MIGRATE_SCAN_COUNT = 4096;
+
+int64_t wall_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::string random_node_id() {
+    std::random_device seed;
+    std::mt19937_64 rng((static_cast<uint64_t>(seed()) << 32) ^ seed());
+    static const char hex[] = "0123456789abcdef";
+    std::string id(40, '0');
+    for (char& c : id) {
+        c = hex[rng() % 16];
+    }
+    return id;
+}
+
+void report(mini_redis::Logger::Level level, const std::string& message) {
+    mini_redis::Logger::log(level, message);
+}
+
+std::string to_upper(std::string s) {
+    for (char& c : s) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    return s;
+}
+
+bool parse_int(const std::string& text, int& out) {
+    try {
+        size_t used = 0;
+        out = std::stoi(text, &used);
+        return used == text.size();
+    } catch (...) {
+        return false;
+    }
+}
+
+bool parse_slot(const std::string& text, int& slot) {
+    return parse_int(text, slot) && slot >= 0 && slot < CLUSTER_SLOTS;
+}
+
+// host:port (anything after an '@' is the bus port, which we do not use)
+bool parse_address(const std::string& text, std::string& host, int& port) {
+    const std::string address = text.substr(0, text.find('@'));
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0) {
+        return false;
+    }
+    host = address.substr(0, colon);
+    return parse_int(address.substr(colon + 1), port) && port > 0 && port <= 65535;
+}
+
+// A request/reply connection to another node
+class PeerConnection {
+public:
+    ~PeerConnection() {
+        if (socket_ != INVALID_SOCKET) {
+            closesocket(socket_);
+        }
+    }
+
+    bool open(const std::string& host, int port) {
+        socket_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (socket_ == INVALID_SOCKET) {
+            return false;
+        }
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<u_short>(port));
+        addr.sin_addr.s_addr = inet_addr(host.c_str());
+        return mini_redis::connect_with_timeout(socket_, addr, IO_TIMEOUT_MS);
+    }
+
+    bool send_command(const std::vector<std::string>& args) {
+        std::string out;
+        ReplyWriter writer(out);
+        writer.array_header(args.size());
+        for (const auto& arg : args) {
+            writer.bulk(arg);
+        }
+        const char* data = out.data();
+        size_t size = out.size();
+        while (size > 0) {
+            const int sent = static_cast<int>(send(socket_, data, static_cast<int>(std::min<size_t>(size, INT_MAX)), 0));
+            if (sent > 0) {
+                data += sent;
+                size -= static_cast<size_t>(sent);
+            } else if (sent < 0 && mini_redis::socket_would_block()) {
+                if (!mini_redis::wait_writable(socket_, IO_TIMEOUT_MS)) {
+                    return false;
+                }
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool read_line(std::string& line) {
+        size_t eol;
+        while ((eol = buffer_.find("\r\n")) == std::string::npos) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        line = buffer_.substr(0, eol);
+        buffer_.erase(0, eol + 2);
+        return true;
+    }
+
+    // A bulk string reply
+    bool read_bulk(std::string& body) {
+        std::string header;
+        int size = 0;
+        if (!read_line(header) || header.size() < 2 || header[0] != '$' || !parse_int(header.substr(1), size) ||
+            size < 0) {
+            return false;
+        }
+        const size_t total = static_cast<size_t>(size) + 2;
+        while (buffer_.size() < total) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        body = buffer_.substr(0, static_cast<size_t>(size));
+        buffer_.erase(0, total);
+        return true;
+    }
+
+private:
+    bool fill() {
+        char chunk[16 * 1024];
+        if (!mini_redis::wait_readable(socket_, IO_TIMEOUT_MS)) {
+            return false;
+        }
+        const int n = static_cast<int>(recv(socket_, chunk, sizeof(chunk), 0));
+        if (n <= 0) {
+            return false;
+        }
+        buffer_.append(chunk, static_cast<size_t>(n));
+        return true;
+    }
+
+    SOCKET socket_ = INVALID_SOCKET;
+    std::string buffer_;
+};
+
+} // anonymous namespace
+
+ClusterState::ClusterState(KVStore& store, RemoveFn remove, const std::string& host, int port,
+                           const std::string& config_path)
+    : store_(store), remove_(std::move(remove)), config_path_(config_path), owner_(CLUSTER_SLOTS, NO_OWNER) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (!load()) {
+        nodes_.assign(1, Node{});
+        nodes_[MYSELF].id = random_node_id();
+    }
+    // The configured address wins over the one last saved
+    nodes_[MYSELF].host = host;
+    nodes_[MYSELF].port = port;
+    nodes_[MYSELF].connected = true;
+    save();
+}
+
+ClusterState::~ClusterState() {
+    stop();
+}
+
+void ClusterState::start() {
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    if (!poller_.joinable()) {
+        stopping_ = false;
+        poller_ = std::thread(&ClusterState::run, this);
+    }
+}
+
+void ClusterState::stop() {
+    std::thread poller;
+    std::thread migration;
+    {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        stopping_ = true;
+        poller = std::move(poller_);
+        migration = std::move(migration_);
+    }
+    thread_cv_.notify_all();
+    if (poller.joinable()) {
+        poller.join();
+    }
+    if (migration.joinable()) {
+        migration.join();
+    }
+}
+
+std::string ClusterState::myid() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return nodes_[MYSELF].id;
+}
+
+std::string ClusterState::route(const std::vector<std::string>& args, size_t first, size_t end, size_t step,
+                                bool asking, std::shared_lock<std::shared_mutex>& guard) {
+    const uint16_t slot = mini_redis::key_hash_slot(args[first]);
+    for (size_t i = first + step; i < end; i += step) {
+        if (mini_redis::key_hash_slot(args[i]) != slot) {
+            return "CROSSSLOT Keys in request don't hash to the same slot";
+        }
+    }
+
+    // Taken before reading the topology, so a migration that starts after
+    // this point waits for the command to finish
+    std::shared_lock<std::shared_mutex> gate_lock(gate(slot));
+    std::string target;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const int owner = owner_[slot];
+        if (owner == NO_OWNER) {
+            return "CLUSTERDOWN Hash slot not served";
+        }
+        if (owner != MYSELF) {
+            if (asking && importing_.count(slot)) {
+                guard = std::move(gate_lock);
+                return "";
+            }
+            return "MOVED " + std::to_string(slot) + " " + address_of(owner);
+        }
+        auto migrating = migrating_.find(slot);
+        if (migrating == migrating_.end()) {
+            guard = std::move(gate_lock);
+            return "";
+        }
+        const int node = find_node(migrating->second);
+        target = node < 0 ? std::string() : address_of(node);
+    }
+
+    // Moving out: keys still here are served here, the rest at the target
+    size_t present = 0;
+    size_t count = 0;
+    for (size_t i = first; i < end; i += step) {
+        present += store_.exists(args[i]) ? 1 : 0;
+        ++count;
+    }
+    if (present == count || target.empty()) {
+        guard = std::move(gate_lock);
+        return "";
+    }
+    if (present == 0) {
+        return "ASK " + std::to_string(slot) + " " + target;
+    }
+    return "TRYAGAIN Multiple keys request during rehashing of slot";
+}
+
+int ClusterState::find_node(const std::string& id) const {
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        if (nodes_[i].id == id) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+std::string ClusterState::address_of(int node) const {
+    return nodes_[node].host + ":" + std::to_string(nodes_[node].port);
+}
+
+bool ClusterState::has_slot_keys(uint16_t slot) {
+    KVStore::ScanCursor cursor;
+    std::vector<std::string> keys;
+    bool more = true;
+    while (more && keys.empty()) {
+        more = store_.scan(cursor, MIGRATE_SCAN_COUNT, keys,
+                           [slot](std::string_view key) { return mini_redis::key_hash_slot(key) == slot; });
+    }
+    return !keys.empty();
+}
+
+// One line per node:
+// <id> <host:port@bus-port> <flags> <primary> <ping-sent> <pong-recv> <config-epoch> <link-state> <slots>...
+// with [slot->-id] / [slot-<-id] for this node's migrating / importing slots
+std::string ClusterState::nodes_text() const {
+    std::ostringstream out;
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        const Node& node = nodes_[i];
+        out << node.id << " " << node.host << ":" << node.port << "@" << node.port + 10000 << " "
+            << (i == MYSELF ? "myself,master" : "master") << " - 0 " << (i == MYSELF ? 0 : node.pong_ms) << " "
+            << node.config_epoch << " " << (node.connected ? "connected" : "disconnected");
+        for (int slot = 0; slot < CLUSTER_SLOTS; ++slot) {
+            if (owner_[slot] != static_cast<int>(i)) {
+                continue;
+            }
+            int last = slot;
+            while (last + 1 < CLUSTER_SLOTS && owner_[last + 1] == static_cast<int>(i)) {
+                ++last;
+            }
+            out << " " << slot;
+            if (last != slot) {
+                out << "-" << last;
+            }
+            slot = last;
+        }
+        if (i == MYSELF) {
+            for (const auto& entry : migrating_) {
+                out << " [" << entry.first << "->-" << entry.second << "]";
+            }
+            for (const auto& entry : importing_) {
+                out << " [" << entry.first << "-<-" << entry.second << "]";
+            }
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+bool ClusterState::parse_nodes(const std::string& text, std::vector<NodeView>& views, uint64_t* current_epoch) {
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream words(line);
+        std::vector<std::string> fields;
+        std::string word;
+        while (words >> word) {
+            fields.push_back(word);
+        }
+        if (fields.empty()) {
+            continue;
+        }
+        if (fields[0] == "vars") {
+            for (size_t i = 1; i + 1 < fields.size(); i += 2) {
+                if (fields[i] == "currentEpoch" && current_epoch) {
+                    try {
+                        *current_epoch = std::stoull(fields[i + 1]);
+                    } catch (...) {
+                        return false;
+                    }
+                }
+            }
+            continue;
+        }
+        NodeView view;
+        if (fields.size() < 8 || fields[0].size() != 40 || !parse_address(fields[1], view.host, view.port)) {
+            return false;
+        }
+        view.id = fields[0];
+        view.myself = fields[2].find("myself") != std::string::npos;
+        try {
+            view.config_epoch = std::stoull(fields[6]);
+        } catch (...) {
+            return false;
+        }
+        for (size_t i = 8; i < fields.size(); ++i) {
+            const std::string& field = fields[i];
+            if (field.size() > 2 && field.front() == '[' && field.back() == ']') {
+                const std::string inner = field.substr(1, field.size() - 2);
+                const size_t out_mark = inner.find("->-");
+                const size_t in_mark = inner.find("-<-");
+                int slot = 0;
+                if (out_mark != std::string::npos && parse_slot(inner.substr(0, out_mark), slot)) {
+                    view.migrating.emplace_back(slot, inner.substr(out_mark + 3));
+                } else if (in_mark != std::string::npos && parse_slot(inner.substr(0, in_mark), slot)) {
+                    view.importing.emplace_back(slot, inner.substr(in_mark + 3));
+                } else {
+                    return false;
+                }
+                continue;
+            }
+            const size_t dash = field.find('-');
+            int start = 0;
+            int last = 0;
+            if (!parse_slot(field.substr(0, dash), start) ||
+                !parse_slot(dash == std::string::npos ? field : field.substr(dash + 1), last) || last < start) {
+                return false;
+            }
+            view.slots.emplace_back(start, last);
+        }
+        views.push_back(std::move(view));
+    }
+    return true;
+}
+
+bool ClusterState::load() {
+    if (config_path_.empty()) {
+        return false;
+    }
+    std::ifstream in(config_path_);
+    if (!in) {
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    std::vector<NodeView> views;
+    uint64_t current_epoch = 0;
+    if (!parse_nodes(text.str(), views, &current_epoch)) {
+        report(mini_redis::Logger::Level::Warn, "Ignoring malformed cluster config " + config_path_);
+        return false;
+    }
+    auto myself = std::find_if(views.begin(), views.end(), [](const NodeView& view) { return view.myself; });
+    if (myself == views.end()) {
+        return false;
+    }
+    std::iter_swap(views.begin(), myself);
+    for (const auto& view : views) {
+        Node node;
+        node.id = view.id;
+        node.host = view.host;
+        node.port = view.port;
+        node.config_epoch = view.config_epoch;
+        nodes_.push_back(node);
+        for (const auto& range : view.slots) {
+            std::fill(owner_.begin() + range.first, owner_.begin() + range.second + 1,
+                      static_cast<int>(nodes_.size() - 1));
+        }
+        current_epoch = std::max(current_epoch, view.config_epoch);
+    }
+    for (const auto& entry : views[0].migrating) {
+        migrating_[static_cast<uint16_t>(entry.first)] = entry.second;
+    }
+    for (const auto& entry : views[0].importing) {
+        importing_[static_cast<uint16_t>(entry.first)] = entry.second;
+    }
+    current_epoch_ = current_epoch;
+    report(mini_redis::Logger::Level::Info, "Loaded cluster config " + config_path_ + ", node " + nodes_[MYSELF].id);
+    return true;
+}
+
+void ClusterState::save() const {
+    if (config_path_.empty()) {
+        return;
+    }
+    const std::string temp = config_path_ + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        out << nodes_text() << "vars currentEpoch " << current_epoch_ << "\n";
+        if (!out) {
+            report(mini_redis::Logger::Level::Error, "Failed to write cluster config " + temp);
+            return;
+        }
+    }
+    if (std::rename(temp.c_str(), config_path_.c_str()) != 0) {
+        // std::rename does not replace an existing file on Windows
+        std::remove(config_path_.c_str());
+        std::rename(temp.c_str(), config_path_.c_str());
+    }
+}
+
+void ClusterState::merge(const std::vector<NodeView>& views) {
+    bool changed = false;
+    for (const auto& view : views) {
+        if (view.id == nodes_[MYSELF].id) {
+            continue; // Our own line, as the peer sees us
+        }
+        int index = find_node(view.id);
+        if (index < 0) {
+            Node node;
+            node.id = view.id;
+            node.host = view.host;
+            node.port = view.port;
+            nodes_.push_back(node);
+            index = static_cast<int>(nodes_.size() - 1);
+            changed = true;
+            report(mini_redis::Logger::Level::Info, "Cluster node " + view.id + " at " + address_of(index) + " joined");
+        }
+        // What a node serves is only taken from the node itself
+        if (!view.myself) {
+            continue;
+        }
+        Node& node = nodes_[index];
+        if (node.host != view.host || node.port != view.port || node.config_epoch != view.config_epoch) {
+            node.host = view.host;
+            node.port = view.port;
+            node.config_epoch = view.config_epoch;
+            changed = true;
+        }
+        node.connected = true;
+        node.pong_ms = wall_ms();
+        current_epoch_ = std::max(current_epoch_, view.config_epoch);
+
+        std::vector<bool> claimed(CLUSTER_SLOTS, false);
+        for (const auto& range : view.slots) {
+            for (int slot = range.first; slot <= range.second; ++slot) {
+                claimed[slot] = true;
+                const int owner = owner_[slot];
+                if (owner == index || (owner != NO_OWNER && nodes_[owner].config_epoch >= view.config_epoch)) {
+                    continue;
+                }
+                if (owner == MYSELF) {
+                    report(mini_redis::Logger::Level::Warn, "Slot " + std::to_string(slot) + " taken over by " +
+                        view.id + " with a newer config epoch");
+                    migrating_.erase(static_cast<uint16_t>(slot));
+                }
+                owner_[slot] = index;
+                changed = true;
+            }
+        }
+        for (int slot = 0; slot < CLUSTER_SLOTS; ++slot) {
+            if (owner_[slot] == index && !claimed[slot]) {
+                owner_[slot] = NO_OWNER;
+                changed = true;
+            }
+        }
+    }
+    if (changed) {
+        save();
+    }
+}
+
+void ClusterState::run() {
+    std::unique_lock<std::mutex> lock(thread_mutex_);
+    while (!stopping_) {
+        thread_cv_.wait_for(lock, std::chrono::milliseconds(POLL_INTERVAL_MS), [this] { return stopping_; });
+        if (stopping_) {
+            break;
+        }
+        lock.unlock();
+
+        // Known nodes first, then addresses from CLUSTER MEET
+        std::vector<std::pair<std::string, Meet>> targets;
+        {
+            std::shared_lock<std::shared_mutex> topology(mutex_);
+            for (size_t i = 1; i < nodes_.size(); ++i) {
+                targets.push_back({nodes_[i].id, Meet{nodes_[i].host, nodes_[i].port, 0}});
+            }
+            for (const auto& meet : meets_) {
+                targets.push_back({std::string(), meet});
+            }
+        }
+        for (const auto& target : targets) {
+            std::vector<NodeView> views;
+            const bool ok = poll(target.second.host, target.second.port, views);
+            std::unique_lock<std::shared_mutex> topology(mutex_);
+            if (ok) {
+                merge(views);
+            }
+            if (!target.first.empty()) {
+                const int index = find_node(target.first);
+                if (!ok && index > 0 && nodes_[index].connected) {
+                    nodes_[index].connected = false;
+                    report(mini_redis::Logger::Level::Warn, "Lost contact with cluster node " + target.first);
+                }
+                continue;
+            }
+            auto meet = std::find_if(meets_.begin(), meets_.end(), [&](const Meet& m) {
+                return m.host == target.second.host && m.port == target.second.port;
+            });
+            if (meet != meets_.end() && (ok || ++meet->attempts >= MEET_ATTEMPTS)) {
+                if (!ok) {
+                    report(mini_redis::Logger::Level::Warn, "Giving up on CLUSTER MEET " + meet->host + ":" +
+                        std::to_string(meet->port));
+                }
+                meets_.erase(meet);
+            }
+        }
+        lock.lock();
+    }
+}
+
+bool ClusterState::poll(const std::string& host, int port, std::vector<NodeView>& views) {
+    std::string myhost;
+    int myport = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        myhost = nodes_[MYSELF].host;
+        myport = nodes_[MYSELF].port;
+    }
+    // Introduce ourselves too, so the peer polls us back
+    PeerConnection conn;
+    std::string line;
+    std::string text;
+    return conn.open(host, port) &&
+           conn.send_command({"CLUSTER", "MEET", myhost, std::to_string(myport)}) &&
+           conn.send_command({"CLUSTER", "NODES"}) && conn.read_line(line) && conn.read_bulk(text) &&
+           parse_nodes(text, views, nullptr) &&
+           std::any_of(views.begin(), views.end(), [](const NodeView& view) { return view.myself; });
+}
+
+void ClusterState::command(const std::vector<std::string>& args, ReplyWriter& reply) {
+    const std::string sub = to_upper(args[0]);
+    const size_t argc = args.size();
+    if (sub == "MYID" && argc == 1) {
+        reply.bulk(myid());
+    } else if (sub == "INFO" && argc == 1) {
+        cmd_info(reply);
+    } else if (sub == "NODES" && argc == 1) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        reply.bulk(nodes_text());
+    } else if (sub == "SLOTS" && argc == 1) {
+        cmd_slots(reply);
+    } else if (sub == "KEYSLOT" && argc == 2) {
+        reply.integer(mini_redis::key_hash_slot(args[1]));
+    } else if ((sub == "ADDSLOTS" || sub == "DELSLOTS") && argc >= 2) {
+        std::vector<int> slots;
+        for (size_t i = 1; i < argc; ++i) {
+            int slot = 0;
+            if (!parse_slot(args[i], slot)) {
+                reply.error("ERR Invalid or out of range slot");
+                return;
+            }
+            slots.push_back(slot);
+        }
+        cmd_addslots(slots, sub == "ADDSLOTS", reply);
+    } else if ((sub == "ADDSLOTSRANGE" || sub == "DELSLOTSRANGE") && argc >= 3 && argc % 2 == 1) {
+        std::vector<int> slots;
+        for (size_t i = 1; i < argc; i += 2) {
+            int start = 0;
+            int last = 0;
+            if (!parse_slot(args[i], start) || !parse_slot(args[i + 1], last) || last < start) {
+                reply.error("ERR Invalid or out of range slot");
+                return;
+            }
+            for (int slot = start; slot <= last; ++slot) {
+                slots.push_back(slot);
+            }
+        }
+        cmd_addslots(slots, sub == "ADDSLOTSRANGE", reply);
+    } else if (sub == "SETSLOT" && argc >= 3) {
+        cmd_setslot(args, reply);
+    } else if (sub == "MEET" && argc == 3) {
+        int port = 0;
+        if (!parse_int(args[2], port) || port <= 0 || port > 65535 || inet_addr(args[1].c_str()) == INADDR_NONE) {
+            reply.error("ERR Invalid node address specified: " + args[1] + ":" + args[2]);
+            return;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        const bool known = std::any_of(nodes_.begin(), nodes_.end(), [&](const Node& node) {
+            return node.host == args[1] && node.port == port;
+        }) || std::any_of(meets_.begin(), meets_.end(), [&](const Meet& meet) {
+            return meet.host == args[1] && meet.port == port;
+        });
+        if (!known) {
+            meets_.push_back(Meet{args[1], port, 0}); // The poll thread does the handshake
+        }
+        reply.simple("OK");
+    } else if (sub == "COUNTKEYSINSLOT" && argc == 2) {
+        int slot = 0;
+        if (!parse_slot(args[1], slot)) {
+            reply.error("ERR Invalid slot");
+            return;
+        }
+        KVStore::ScanCursor cursor;
+        std::vector<std::string> keys;
+        while (store_.scan(cursor, MIGRATE_SCAN_COUNT, keys,
+                           [slot](std::string_view key) { return mini_redis::key_hash_slot(key) == slot; })) {
+        }
+        reply.integer(static_cast<int64_t>(keys.size()));
+    } else if (sub == "GETKEYSINSLOT" && argc == 3) {
+        int slot = 0;
+        int count = 0;
+        if (!parse_slot(args[1], slot) || !parse_int(args[2], count) || count < 0) {
+            reply.error("ERR Invalid slot or number of keys");
+            return;
+        }
+        KVStore::ScanCursor cursor;
+        std::vector<std::string> keys;
+        while (keys.size() < static_cast<size_t>(count) &&
+               store_.scan(cursor, MIGRATE_SCAN_COUNT, keys,
+                           [slot](std::string_view key) { return mini_redis::key_hash_slot(key) == slot; })) {
+        }
+        keys.resize(std::min(keys.size(), static_cast<size_t>(count)));
+        reply.array_header(keys.size());
+        for (const auto& key : keys) {
+            reply.bulk(key);
+        }
+    } else if (sub == "MIGRATE" && argc == 3) {
+        int slot = 0;
+        if (!parse_slot(args[1], slot)) {
+            reply.error("ERR Invalid slot");
+            return;
+        }
+        cmd_migrate(slot, args[2], reply);
+    } else {
+        reply.error("ERR unknown subcommand or wrong number of arguments for '" + args[0] +
+                    "'. Try CLUSTER INFO, NODES, SLOTS, MEET, ADDSLOTS, SETSLOT, MIGRATE.");
+    }
+}
+
+void ClusterState::cmd_info(ReplyWriter& reply) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    const size_t assigned = static_cast<size_t>(std::count_if(owner_.begin(), owner_.end(),
+                                                              [](int owner) { return owner != NO_OWNER; }));
+    std::vector<bool> serving(nodes_.size(), false);
+    for (int owner : owner_) {
+        if (owner != NO_OWNER) {
+            serving[owner] = true;
+        }
+    }
+    std::ostringstream info;
+    info << "cluster_enabled:1\r\n";
+    info << "cluster_state:" << (assigned == CLUSTER_SLOTS ? "ok" : "fail") << "\r\n";
+    info << "cluster_slots_assigned:" << assigned << "\r\n";
+    info << "cluster_known_nodes:" << nodes_.size() << "\r\n";
+    info << "cluster_size:" << std::count(serving.begin(), serving.end(), true) << "\r\n";
+    info << "cluster_current_epoch:" << current_epoch_ << "\r\n";
+    info << "cluster_my_epoch:" << nodes_[MYSELF].config_epoch << "\r\n";
+    info << "cluster_slots_migrating:" << migrating_.size() << "\r\n";
+    info << "cluster_slots_importing:" << importing_.size() << "\r\n";
+    info << "cluster_migration_in_progress:" << (migrating_now_ ? 1 : 0) << "\r\n";
+    reply.bulk(info.str());
+}
+
+// [[start, end, [host, port, id]], ...], one entry per owned range
+void ClusterState::cmd_slots(ReplyWriter& reply) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    std::vector<std::pair<int, int>> ranges;
+    for (int slot = 0; slot < CLUSTER_SLOTS; ++slot) {
+        if (owner_[slot] == NO_OWNER) {
+            continue;
+        }
+        int last = slot;
+        while (last + 1 < CLUSTER_SLOTS && owner_[last + 1] == owner_[slot]) {
+            ++last;
+        }
+        ranges.emplace_back(slot, last);
+        slot = last;
+    }
+    reply.array_header(ranges.size());
+    for (const auto& range : ranges) {
+        const Node& node = nodes_[owner_[range.first]];
+        reply.array_header(3);
+        reply.integer(range.first);
+        reply.integer(range.second);
+        reply.array_header(3);
+        reply.bulk(node.host);
+        reply.integer(node.port);
+        reply.bulk(node.id);
+    }
+}
+
+void ClusterState::cmd_addslots(const std::vector<int>& slots, bool add, ReplyWriter& reply) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (int slot : slots) {
+        if (add && owner_[slot] != NO_OWNER) {
+            reply.error("ERR Slot " + std::to_string(slot) + " is already busy");
+            return;
+        }
+        if (!add && owner_[slot] == NO_OWNER) {
+            reply.error("ERR Slot " + std::to_string(slot) + " is already unassigned");
+            return;
+        }
+    }
+    for (int slot : slots) {
+        owner_[slot] = add ? MYSELF : NO_OWNER;
+        if (!add) {
+            migrating_.erase(static_cast<uint16_t>(slot));
+            importing_.erase(static_cast<uint16_t>(slot));
+        }
+    }
+    save();
+    reply.simple("OK");
+}
+
+// SETSLOT <slot> MIGRATING <node-id> | IMPORTING <node-id> | STABLE | NODE <node-id>
+void ClusterState::cmd_setslot(const std::vector<std::string>& args, ReplyWriter& reply) {
+    int number = 0;
+    if (!parse_slot(args[1], number)) {
+        reply.error("ERR Invalid slot");
+        return;
+    }
+    const uint16_t slot = static_cast<uint16_t>(number);
+    const std::string action = to_upper(args[2]);
+    const bool needs_node = action == "MIGRATING" || action == "IMPORTING" || action == "NODE";
+    if ((needs_node && args.size() != 4) || (action == "STABLE" && args.size() != 3) ||
+        (!needs_node && action != "STABLE")) {
+        reply.error("ERR Invalid CLUSTER SETSLOT action or number of arguments. Try CLUSTER HELP");
+        return;
+    }
+
+    // Commands already past routing finish before the slot's state changes
+    std::unique_lock<std::shared_mutex> gate_lock(gate(slot));
+    const bool holds_keys = action == "NODE" && has_slot_keys(slot);
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    const int node = needs_node ? find_node(args[3]) : MYSELF;
+    if (node < 0) {
+        reply.error("ERR I don't know about node " + args[3]);
+        return;
+    }
+    const std::string me = std::to_string(slot);
+    if (action == "MIGRATING") {
+        if (owner_[slot] != MYSELF) {
+            reply.error("ERR I'm not the owner of hash slot " + me);
+            return;
+        }
+        if (node == MYSELF) {
+            reply.error("ERR I can't migrate a slot to myself");
+            return;
+        }
+        migrating_[slot] = args[3];
+    } else if (action == "IMPORTING") {
+        if (owner_[slot] == MYSELF) {
+            reply.error("ERR I'm already the owner of hash slot " + me);
+            return;
+        }
+        if (node == MYSELF) {
+            reply.error("ERR I can't import a slot from myself");
+            return;
+        }
+        importing_[slot] = args[3];
+    } else if (action == "STABLE") {
+        migrating_.erase(slot);
+        importing_.erase(slot);
+    } else if (node == MYSELF) {
+        // Taking a slot over: a newer epoch makes every node prefer our claim
+        if (owner_[slot] != MYSELF) {
+            nodes_[MYSELF].config_epoch = ++current_epoch_;
+            owner_[slot] = MYSELF;
+        }
+        migrating_.erase(slot);
+        importing_.erase(slot);
+    } else {
+        if (owner_[slot] == MYSELF && holds_keys) {
+            reply.error("ERR Can't assign hashslot " + me + " to a different node while I still hold keys for this hash slot.");
+            return;
+        }
+        owner_[slot] = node;
+        migrating_.erase(slot);
+        importing_.erase(slot);
+    }
+    save();
+    reply.simple("OK");
+}
+
+void ClusterState::cmd_migrate(int number, const std::string& target, ReplyWriter& reply) {
+    const uint16_t slot = static_cast<uint16_t>(number);
+    std::lock_guard<std::mutex> threads(thread_mutex_);
+    if (migrating_now_) {
+        reply.error("ERR A slot migration is already in progress");
+        return;
+    }
+    {
+        std::unique_lock<std::shared_mutex> gate_lock(gate(slot));
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        const int node = find_node(target);
+        if (owner_[slot] != MYSELF) {
+            reply.error("ERR I'm not the owner of hash slot " + std::to_string(slot));
+            return;
+        }
+        if (node <= MYSELF) {
+            reply.error("ERR I don't know about node " + target);
+            return;
+        }
+        auto migrating = migrating_.find(slot);
+        if (migrating != migrating_.end() && migrating->second != target) {
+            reply.error("ERR Hash slot " + std::to_string(slot) + " is already migrating to " + migrating->second);
+            return;
+        }
+        // From here keys missing locally are looked for at the target
+        migrating_[slot] = target;
+        save();
+    }
+    if (migration_.joinable()) {
+        migration_.join(); // A finished earlier migration
+    }
+    migrating_now_ = true;
+    migration_ = std::thread(&ClusterState::migrate, this, slot, target);
+    reply.simple("OK");
+}
+
+void ClusterState::migrate(uint16_t slot, std::string target) {
+    std::string host;
+    int port = 0;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const int node = find_node(target);
+        host = nodes_[node].host;
+        port = nodes_[node].port;
+    }
+    const std::string where = "slot " + std::to_string(slot) + " to " + host + ":" + std::to_string(port);
+    report(mini_redis::Logger::Level::Info, "Migrating " + where);
+
+    size_t moved = 0;
+    if (migrate_keys(slot, target, host, port, moved)) {
+        std::unique_lock<std::shared_mutex> gate_lock(gate(slot));
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        const int node = find_node(target);
+        if (node > MYSELF && owner_[slot] == MYSELF) {
+            owner_[slot] = node;
+        }
+        migrating_.erase(slot);
+        save();
+        report(mini_redis::Logger::Level::Info, "Migrated " + where + ": " + std::to_string(moved) + " keys");
+    } else {
+        // The slot stays migrating, so every key is still found at one of
+        // the two nodes; CLUSTER MIGRATE again carries on
+        report(mini_redis::Logger::Level::Error, "Migration of " + where + " stopped after " +
+            std::to_string(moved) + " keys");
+    }
+    migrating_now_ = false;
+}
+
+bool ClusterState::migrate_keys(uint16_t slot, const std::string& target, const std::string& host, int port,
+                                size_t& moved) {
+    PeerConnection conn;
+    std::string line;
+    const std::string number = std::to_string(slot);
+    if (!conn.open(host, port) ||
+        !conn.send_command({"CLUSTER", "SETSLOT", number, "IMPORTING", myid()}) || !conn.read_line(line) ||
+        line != "+OK") {
+        report(mini_redis::Logger::Level::Error, "Target refused to import slot " + number + ": " +
+            (line.empty() ? std::string("no reply") : line));
+        return false;
+    }
+
+    KVStore::ScanCursor cursor;
+    std::vector<std::string> keys;
+    std::string payload;
+    bool more = true;
+    while (more) {
+        {
+            std::lock_guard<std::mutex> lock(thread_mutex_);
+            if (stopping_) {
+                return false;
+            }
+        }
+        more = store_.scan(cursor, MIGRATE_SCAN_COUNT, keys,
+                           [slot](std::string_view key) { return mini_redis::key_hash_slot(key) == slot; });
+        if (keys.empty() || (more && keys.size() < MIGRATE_BATCH_KEYS)) {
+            continue;
+        }
+        // The batch's keys cannot change between being copied and deleted
+        std::unique_lock<std::shared_mutex> gate_lock(gate(slot));
+        payload.clear();
+        const size_t dumped = store_.dump_records(keys, payload);
+        line.clear();
+        if (dumped > 0 && (!conn.send_command({"RESTORE-RECORDS", payload}) || !conn.read_line(line) || line != "+OK")) {
+            report(mini_redis::Logger::Level::Error, "Target failed to restore keys of slot " + number + ": " +
+                (line.empty() ? std::string("no reply") : line));
+            return false;
+        }
+        remove_(keys);
+        moved += dumped;
+        keys.clear();
+    }
+
+    // Every key is at the target: it takes the slot over
+    line.clear();
+    if (!conn.send_command({"CLUSTER", "SETSLOT", number, "NODE", target}) || !conn.read_line(line) || line != "+OK") {
+        report(mini_redis::Logger::Level::Error, "Target failed to take over slot " + number + ": " +
+            (line.empty() ? std::string("no reply") : line));
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,157 @@
+// Cluster mode for Mini-Redis
+// The keyspace is split into 16384 hash slots (see utils/crc16.hpp), each
+// served by one node. A command for keys in a slot another node serves is
+// answered with MOVED slot host:port; one for keys that have already left a
+// slot being migrated gets ASK slot host:port, which the client follows by
+// sending ASKING and then the command to the importing node.
+// There is no cluster bus: once a second every node polls the nodes it knows
+// for their CLUSTER NODES view, learning new nodes and the slots each one
+// claims. A node is the authority on the slots it claims itself; when two
+// claim the same slot the higher config epoch wins, and a node bumps its epoch
+// when it takes over a migrated slot.
+// CLUSTER MIGRATE slot node-id moves a slot while it is being served: keys are
+// copied to the target in batches of RDB records (RESTORE-RECORDS) and deleted
+// here, then both nodes hand the slot over.
+
+#pragma once
+
+#include "socket_compat.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <shared_mutex>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+
+class KVStore;
+
+namespace mini_redis {
+class ReplyWriter;
+}
+
+class ClusterState {
+public:
+    // Deletes migrated keys as a write, so the AOF and replicas drop them too
+    // (migration thread)
+    using RemoveFn = std::function<void(const std::vector<std::string>& keys)>;
+
+    // store is database 0, the only one in cluster mode. host and port are
+    // where other nodes and clients reach this node. The node ID and its view
+    // of the cluster are kept in config_path ("" = not kept).
+    ClusterState(KVStore& store, RemoveFn remove, const std::string& host, int port,
+                 const std::string& config_path);
+    ~ClusterState();
+
+    ClusterState(const ClusterState&) = delete;
+    ClusterState& operator=(const ClusterState&) = delete;
+
+    // Start polling the other nodes; stop also waits for a migration to end
+    void start();
+    void stop();
+
+    std::string myid() const;
+
+    // Where a command for the keys args[first], args[first + step], ... before
+    // end is served: "" for here,
+    // otherwise the error to reply with (MOVED, ASK, TRYAGAIN, CROSSSLOT or
+    // CLUSTERDOWN). When served here, guard keeps a migration from moving the
+    // keys until the command is done.
+    std::string route(const std::vector<std::string>& args, size_t first, size_t end, size_t step,
+                      bool asking, std::shared_lock<std::shared_mutex>& guard);
+
+    // CLUSTER <subcommand> [args...], args[0] being the subcommand
+    void command(const std::vector<std::string>& args, mini_redis::ReplyWriter& reply);
+
+private:
+    struct Node {
+        std::string id; // 40 hex characters
+        std::string host;
+        int port = 0;
+        uint64_t config_epoch = 0;
+        bool connected = false; // Last poll succeeded
+        int64_t pong_ms = 0;    // Wall clock of the last successful poll (0 = never)
+    };
+
+    // One line of CLUSTER NODES, as parsed from a peer or the config file
+    struct NodeView {
+        std::string id;
+        std::string host;
+        int port = 0;
+        bool myself = false;
+        uint64_t config_epoch = 0;
+        std::vector<std::pair<int, int>> slots; // Inclusive ranges
+        std::vector<std::pair<int, std::string>> migrating; // [slot->-node]
+        std::vector<std::pair<int, std::string>> importing; // [slot-<-node]
+    };
+
+    // Pending CLUSTER MEET: an address whose node ID is not known yet
+    struct Meet {
+        std::string host;
+        int port = 0;
+        int attempts = 0;
+    };
+
+    static constexpr int MYSELF = 0; // nodes_[0] is this node
+    static constexpr int NO_OWNER = -1;
+    static constexpr size_t GATE_STRIPES = 64;
+
+    // Guards commands in a slot against a migration batch moving their keys
+    std::shared_mutex& gate(uint16_t slot) { return gates_[slot % GATE_STRIPES]; }
+
+    // Topology (mutex_ held)
+    int find_node(const std::string& id) const;
+    std::string address_of(int node) const;
+    std::string nodes_text() const;
+    // Write the config file (mutex_ held at least shared)
+    void save() const;
+
+    // Whether the store still holds live keys in slot
+    bool has_slot_keys(uint16_t slot);
+
+    bool load();
+    static bool parse_nodes(const std::string& text, std::vector<NodeView>& views, uint64_t* current_epoch);
+    // Take in a peer's view of the cluster (mutex_ held)
+    void merge(const std::vector<NodeView>& views);
+
+    // Subcommands
+    void cmd_info(mini_redis::ReplyWriter& reply);
+    void cmd_slots(mini_redis::ReplyWriter& reply);
+    void cmd_addslots(const std::vector<int>& slots, bool add, mini_redis::ReplyWriter& reply);
+    void cmd_setslot(const std::vector<std::string>& args, mini_redis::ReplyWriter& reply);
+    void cmd_migrate(int slot, const std::string& target, mini_redis::ReplyWriter& reply);
+
+    // Poll thread: every second, ask each known node for its view
+    void run();
+    bool poll(const std::string& host, int port, std::vector<NodeView>& views);
+
+    // Migration thread: move slot's keys to target, then hand it over
+    void migrate(uint16_t slot, std::string target);
+    bool migrate_keys(uint16_t slot, const std::string& target, const std::string& host, int port,
+                      size_t& moved);
+
+    KVStore& store_;
+    RemoveFn remove_;
+    const std::string config_path_;
+
+    mutable std::shared_mutex mutex_; // Guards the topology below
+    std::vector<Node> nodes_;
+    std::vector<int> owner_;                 // Slot -> index into nodes_, or NO_OWNER
+    std::map<uint16_t, std::string> migrating_; // Slot -> the node it is moving to
+    std::map<uint16_t, std::string> importing_; // Slot -> the node it is coming from
+    std::vector<Meet> meets_;
+    uint64_t current_epoch_ = 0; // Highest config epoch seen
+
+    std::shared_mutex gates_[GATE_STRIPES];
+
+    std::mutex thread_mutex_; // Guards the threads and the stop flag
+    std::condition_variable thread_cv_;
+    bool stopping_ = false;
+    std::thread poller_;
+    std::thread migration_;
+    std::atomic<bool> migrating_now_{false};
+};
@@ -0,0 +1,1754 @@
+// Command handlers for Mini-Redis
+// One function per command, dispatched through a table indexed by CommandType.
+// Arity is checked once against the shared command table before dispatch.
+
+#include "server/socket_compat.hpp"
+
+#include "../protocol/resp_utils.hpp"
+#include "../protocol/parser.hpp"
+#include "../protocol/command_table.hpp"
+#include "../storage/kv_store.hpp"
+#include "../storage/aof_logger.hpp"
+#include "../storage/lazy_freer.hpp"
+#include "replication.hpp"
+#include "replica_link.hpp"
+#include "cluster.hpp"
+#include "command_stats.hpp"
+#include "pubsub.hpp"
+#include "transaction.hpp"
+#include "scripting.hpp"
+#include "tracking.hpp"
+#include "../utils/glob.hpp"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <mutex>
+#include <shared_mutex>
+#include <cctype>
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <utility>
+#include <stdexcept>
+#include <limits>
+
+#include "server/server_common.hpp"
+
+namespace mini_redis {
+
+namespace {
+
+using mini_redis::detail::ClientContext;
+using mini_redis::detail::CommandResult;
+
+using CommandHandler = CommandResult (*)(const protocol::Command& cmd, ClientContext& ctx,
+                                         KVStore& kv, SOCKET client_socket, ReplyWriter& reply);
+
+CommandResult ok() {
+    return CommandResult{false, true};
+}
+
+// Write an error reply and report failure
+CommandResult fail(ReplyWriter& reply, std::string_view msg) {
+    reply.error(msg);
+    return CommandResult{false, false};
+}
+
+// Log a write to the AOF and forward it to replicas; the client's reply waits
+// for the AOF ticket under appendfsync always
+void propagate(const protocol::Command& cmd, ClientContext& ctx) {
+    if (mini_redis::g_aof_logger) {
+        uint64_t ticket = mini_redis::g_aof_logger->append(cmd, ctx.db_index);
+        if (ticket > ctx.aof_ticket) {
+            ctx.aof_ticket = ticket;
+        }
+    }
+    if (mini_redis::g_replication_manager) {
+        mini_redis::g_replication_manager->replicate_command(cmd, ctx.db_index);
+    }
+}
+
+std::string to_lower(std::string s) {
+    for (char& c : s) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return s;
+}
+
+std::string to_upper(std::string s) {
+    for (char& c : s) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    return s;
+}
+
+// Reply for INCR/DECR/INCRBY/DECRBY, propagating only applied changes
+CommandResult counter_reply(const protocol::Command& cmd, ClientContext& ctx,
+                            const std::pair<int64_t, std::string>& outcome, ReplyWriter& reply) {
+    if (!outcome.second.empty()) {
+        return fail(reply, outcome.second);
+    }
+    propagate(cmd, ctx);
+    reply.integer(outcome.first);
+    return ok();
+}
+
+CommandResult cmd_ping(const protocol::Command&, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    reply.simple("PONG");
+    return ok();
+}
+
+CommandResult cmd_echo(const protocol::Command& cmd, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    reply.bulk(cmd.args[0]);
+    return ok();
+}
+
+CommandResult cmd_set(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    kv.set(cmd.args[0], cmd.args[1]);
+    propagate(cmd, ctx);
+    reply.simple("OK");
+    return ok();
+}
+
+CommandResult cmd_get(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    // Serialize straight from the stored value: one memcpy, no temporary, or
+    // none for a large value the connection sends from the store
+    bool wrong_type = false;
+    if (!kv.read_value(cmd.args[0],
+                       [&](std::string_view value, const SharedValue* shared) { reply.bulk(value, shared); },
+                       &wrong_type)) {
+        if (wrong_type) {
+            return fail(reply, KVStore::WRONGTYPE_ERROR);
+        }
+        reply.nil(); // Key not found is valid
+    }
+    return ok();
+}
+
+// DEL: the whole batch is one AOF record and one replicated command
+CommandResult cmd_del(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    size_t removed = kv.del_many(cmd.args);
+    if (removed > 0) {
+        propagate(cmd, ctx);
+    }
+    reply.integer(static_cast<int64_t>(removed));
+    return ok();
+}
+
+// UNLINK: like DEL, but large values are freed in the background
+CommandResult cmd_unlink(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    size_t removed = kv.unlink_many(cmd.args);
+    if (removed > 0) {
+        propagate(cmd, ctx);
+    }
+    reply.integer(static_cast<int64_t>(removed));
+    return ok();
+}
+
+// FLUSHDB / FLUSHALL [ASYNC | SYNC]: ASYNC only unlinks the keys and leaves
+// freeing them to the background reclaimer
+bool parse_flush_mode(const protocol::Command& cmd, bool& async) {
+    async = false;
+    if (cmd.args.empty()) {
+        return true;
+    }
+    const std::string mode = to_upper(cmd.args[0]);
+    if (cmd.args.size() > 1 || (mode != "ASYNC" && mode != "SYNC")) {
+        return false;
+    }
+    async = mode == "ASYNC";
+    return true;
+}
+
+CommandResult cmd_flushdb(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    bool async = false;
+    if (!parse_flush_mode(cmd, async)) {
+        return fail(reply, "ERR syntax error");
+    }
+    if (async) {
+        kv.clear_async();
+    } else {
+        kv.clear();
+    }
+    propagate(cmd, ctx);
+    reply.simple("OK");
+    return ok();
+}
+
+CommandResult cmd_flushall(const protocol::Command& cmd, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    bool async = false;
+    if (!parse_flush_mode(cmd, async)) {
+        return fail(reply, "ERR syntax error");
+    }
+    for (auto& db : mini_redis::detail::local_databases()) {
+        if (async) {
+            db.clear_async();
+        } else {
+            db.clear();
+        }
+    }
+    propagate(cmd, ctx);
+    reply.simple("OK");
+    return ok();
+}
+
+CommandResult cmd_exists(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    reply.integer(static_cast<int64_t>(kv.exists_many(cmd.args)));
+    return ok();
+}
+
+CommandResult cmd_mset(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    kv.mset(cmd.args);
+    propagate(cmd, ctx);
+    reply.simple("OK");
+    return ok();
+}
+
+CommandResult cmd_msetnx(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    bool set = kv.msetnx(cmd.args);
+    if (set) {
+        propagate(cmd, ctx);
+    }
+    reply.integer(set ? 1 : 0);
+    return ok();
+}
+
+// Filter for a KEYS/SCAN glob pattern; none when it matches every key
+std::function<bool(std::string_view)> key_filter(const std::string& pattern) {
+    if (glob_matches_all(pattern)) {
+        return nullptr;
+    }
+    return [&pattern](std::string_view key) { return glob_match(pattern, key); };
+}
+
+CommandResult cmd_keys(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    std::vector<std::string> all_keys = kv.keys(key_filter(cmd.args[0]));
+    reply.array_header(all_keys.size());
+    for (const auto& key : all_keys) {
+        reply.bulk(key);
+    }
+    return ok();
+}
+
+// SCAN cursor [MATCH pattern] [COUNT count]: visit about count entries from
+// the cursor and reply [next cursor, matching keys]; cursor 0 starts a scan and
+// is returned once it is complete
+CommandResult cmd_scan(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    uint64_t cursor = 0;
+    try {
+        size_t used = 0;
+        if (cmd.args[0].empty() || !std::isdigit(static_cast<unsigned char>(cmd.args[0][0]))) {
+            throw std::invalid_argument("cursor");
+        }
+        cursor = std::stoull(cmd.args[0], &used);
+        if (used != cmd.args[0].size()) {
+            throw std::invalid_argument("cursor");
+        }
+    } catch (...) {
+        return fail(reply, "ERR invalid cursor");
+    }
+
+    std::string pattern = "*";
+    long long count = 10;
+    for (size_t i = 1; i < cmd.args.size(); i += 2) {
+        const std::string option = to_lower(cmd.args[i]);
+        if (i + 1 >= cmd.args.size()) {
+            return fail(reply, "ERR syntax error");
+        }
+        if (option == "match") {
+            pattern = cmd.args[i + 1];
+        } else if (option == "count") {
+            try {
+                count = std::stoll(cmd.args[i + 1]);
+            } catch (...) {
+                return fail(reply, "ERR value is not an integer or out of range");
+            }
+            if (count < 1) {
+                return fail(reply, "ERR syntax error");
+            }
+        } else {
+            return fail(reply, "ERR syntax error");
+        }
+    }
+
+    std::vector<std::string> keys;
+    const uint64_t next = kv.scan(cursor, static_cast<size_t>(count), keys, key_filter(pattern));
+    reply.array_header(2);
+    reply.bulk(std::to_string(next));
+    reply.array_header(keys.size());
+    for (const auto& key : keys) {
+        reply.bulk(key);
+    }
+    return ok();
+}
+
+// As Redis checks EXPIRE/PEXPIRE: amount units from now must still be a
+// valid time in int64 milliseconds
+bool expire_in_range(int64_t amount, int64_t unit_ms) {
+    constexpr int64_t latest = std::numeric_limits<int64_t>::max();
+    constexpr int64_t earliest = std::numeric_limits<int64_t>::min();
+    if (amount > latest / unit_ms || amount < earliest / unit_ms) {
+        return false;
+    }
+    const int64_t milliseconds = amount * unit_ms;
+    return milliseconds <= 0 || KVStore::now_ms() <= latest - milliseconds;
+}
+
+CommandResult cmd_expire(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    int64_t seconds = 0;
+    try {
+        seconds = std::stoll(cmd.args[1]);
+    } catch (...) {
+        return fail(reply, "Invalid seconds value");
+    }
+    if (!expire_in_range(seconds, 1000)) {
+        return fail(reply, "ERR invalid expire time in 'expire' command");
+    }
+    bool set = kv.expire(cmd.args[0], seconds);
+    if (set) {
+        propagate(cmd, ctx);
+    }
+    reply.integer(set ? 1 : 0);
+    return ok();
+}
+
+CommandResult cmd_ttl(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    reply.integer(kv.ttl(cmd.args[0]));
+    return ok();
+}
+
+CommandResult cmd_pexpire(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    int64_t milliseconds = 0;
+    try {
+        milliseconds = std::stoll(cmd.args[1]);
+    } catch (...) {
+        return fail(reply, "Invalid milliseconds value");
+    }
+    if (!expire_in_range(milliseconds, 1)) {
+        return fail(reply, "ERR invalid expire time in 'pexpire' command");
+    }
+    bool set = kv.pexpire(cmd.args[0], milliseconds);
+    if (set) {
+        propagate(cmd, ctx);
+    }
+    reply.integer(set ? 1 : 0);
+    return ok();
+}
+
+CommandResult cmd_pttl(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    reply.integer(kv.pttl(cmd.args[0]));
+    return ok();
+}
+
+CommandResult cmd_pexpireat(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    int64_t unix_ms = 0;
+    try {
+        unix_ms = std::stoll(cmd.args[1]);
+    } catch (...) {
+        return fail(reply, "Invalid timestamp value");
+    }
+    bool set = kv.pexpireat(cmd.args[0], unix_ms);
+    if (set) {
+        propagate(cmd, ctx);
+    }
+    reply.integer(set ? 1 : 0);
+    return ok();
+}
+
+CommandResult cmd_bgrewriteaof(const protocol::Command&, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    if (!mini_redis::g_aof_logger || !mini_redis::g_aof_logger->rewrite_enabled()) {
+        return fail(reply, "ERR AOF rewrite is not available");
+    }
+    if (!mini_redis::g_aof_logger->start_rewrite()) {
+        return fail(reply, "ERR Background append only file rewriting already in progress");
+    }
+    reply.simple("Background append only file rewriting started");
+    return ok();
+}
+
+CommandResult cmd_mget(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    reply.array_header(cmd.args.size());
+    kv.read_values(
+        cmd.args, [&](std::string_view value, const SharedValue* shared) { reply.bulk(value, shared); },
+        [&] { reply.nil(); });
+    return ok();
+}
+
+CommandResult cmd_quit(const protocol::Command&, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    reply.simple("OK");
+    return CommandResult{true, true};
+}
+
+bool any_bgsave_in_progress() {
+    for (const auto& db : mini_redis::detail::local_databases()) {
+        if (db.bgsave_in_progress()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Snapshots of every database at one moment: they are all locked while the
+// snapshots begin, so no transaction is half in the file. Returns false, with
+// none left open, if one of them already has a snapshot open.
+bool begin_snapshots(std::vector<KVStore>& dbs, std::vector<KVStore::SnapshotCursor>& cursors) {
+    mini_redis::ShardLocks locks;
+    for (KVStore& db : dbs) {
+        locks.add_store(db);
+    }
+    locks.lock();
+    cursors.assign(dbs.size(), KVStore::SnapshotCursor{});
+    for (size_t i = 0; i < dbs.size(); ++i) {
+        if (!dbs[i].begin_snapshot(cursors[i])) {
+            for (size_t j = 0; j < i; ++j) {
+                dbs[j].end_snapshot(cursors[j]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+CommandResult cmd_save(const protocol::Command&, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    // SAVE writes every database to the RDB file
+    if (any_bgsave_in_progress()) {
+        return fail(reply, "ERR Background save already in progress");
+    }
+    std::vector<KVStore>& dbs = mini_redis::detail::local_databases();
+    std::vector<KVStore::SnapshotCursor> cursors;
+    if (begin_snapshots(dbs, cursors) && KVStore::write_snapshots(dbs, cursors, mini_redis::detail::rdb_path)) {
+        reply.simple("OK");
+        return ok();
+    }
+    return fail(reply, "ERR Save failed");
+}
+
+CommandResult cmd_bgsave(const protocol::Command&, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    // BGSAVE snapshots every database now and writes them out in the background
+    std::vector<KVStore>& dbs = mini_redis::detail::local_databases();
+    std::vector<KVStore::SnapshotCursor> cursors;
+    if (any_bgsave_in_progress() || !begin_snapshots(dbs, cursors) ||
+        !KVStore::bgsave_snapshots(dbs, std::move(cursors), mini_redis::detail::rdb_path)) {
+        return fail(reply, "ERR Background save already in progress");
+    }
+    reply.simple("Background saving started");
+    return ok();
+}
+
+CommandResult cmd_load(const protocol::Command&, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    // LOAD reads every database from the RDB file
+    if (KVStore::load_databases_from_rdb(mini_redis::detail::local_databases(), mini_redis::detail::rdb_path)) {
+        reply.simple("OK");
+        return ok();
+    }
+    return fail(reply, "ERR Load failed");
+}
+
+// The database a SELECT switches to; nullptr on success, else the error reply
+const char* select_target(const protocol::Command& cmd, int& db_num) {
+    try {
+        db_num = std::stoi(cmd.args[0]);
+    } catch (...) {
+        return "Invalid database number";
+    }
+    if (db_num < 0 || db_num >= static_cast<int>(mini_redis::detail::local_databases().size())) {
+        return "Database index out of range";
+    }
+    if (mini_redis::g_cluster && db_num != 0) {
+        return "ERR SELECT is not allowed in cluster mode";
+    }
+    return nullptr;
+}
+
+CommandResult cmd_select(const protocol::Command& cmd, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    int db_num = 0;
+    if (const char* error = select_target(cmd, db_num)) {
+        return fail(reply, error);
+    }
+    ctx.db_index = db_num;
+    reply.simple("OK");
+    return ok();
+}
+
+// INFO commandstats: calls and time per command that has run
+void append_commandstats(std::stringstream& info) {
+    for (size_t t = 1; t < static_cast<size_t>(protocol::CommandType::COUNT); ++t) {
+        protocol::CommandType type = static_cast<protocol::CommandType>(t);
+        CommandStats stats = command_stats(type);
+        if (stats.calls == 0) {
+            continue;
+        }
+        char per_call[32];
+        std::snprintf(per_call, sizeof(per_call), "%.2f", static_cast<double>(stats.usec) / static_cast<double>(stats.calls));
+        info << "cmdstat_" << to_lower(std::string(protocol::command_spec(type).name)) << ":calls=" << stats.calls
+             << ",usec=" << stats.usec << ",usec_per_call=" << per_call << "\n";
+    }
+}
+
+// INFO latencystats: latency percentiles per command that has run
+void append_latencystats(std::stringstream& info) {
+    for (size_t t = 1; t < static_cast<size_t>(protocol::CommandType::COUNT); ++t) {
+        protocol::CommandType type = static_cast<protocol::CommandType>(t);
+        CommandStats stats = command_stats(type);
+        if (stats.calls == 0) {
+            continue;
+        }
+        info << "latency_percentiles_usec_" << to_lower(std::string(protocol::command_spec(type).name))
+             << ":p50=" << stats.histogram.percentile(50) << ",p99=" << stats.histogram.percentile(99)
+             << ",p99.9=" << stats.histogram.percentile(99.9) << "\n";
+    }
+}
+
+// INFO replication: this node's stream position and its replicas
+void append_replication(std::stringstream& info) {
+    ReplicationManager* repl = mini_redis::g_replication_manager;
+    if (!repl) {
+        return;
+    }
+    std::vector<ReplicationManager::ReplicaInfo> replicas = repl->replicas();
+    const uint64_t offset = repl->master_offset();
+    const uint64_t first = repl->backlog_first_offset();
+    ReplicaLink* link = mini_redis::g_replica_link;
+    if (link && link->active()) {
+        // The primary's stream as applied here; the backlog below is this
+        // node's own stream, for replicas of the replica
+        ReplicaLink::Status status = link->status();
+        info << "role:slave\n";
+        info << "master_host:" << status.host << "\n";
+        info << "master_port:" << status.port << "\n";
+        info << "master_link_status:" << (status.link_up ? "up" : "down") << "\n";
+        info << "master_last_io_seconds_ago:" << (status.last_io_ms < 0 ? -1 : status.last_io_ms / 1000) << "\n";
+        info << "master_sync_in_progress:" << (status.sync_in_progress ? 1 : 0) << "\n";
+        info << "slave_repl_offset:" << status.offset << "\n";
+        info << "slave_lag_ms:" << status.last_io_ms << "\n";
+        info << "slave_read_only:1\n";
+        info << "slave_serving_reads:" << (link->fresh() ? 1 : 0) << "\n";
+    } else {
+        info << "role:master\n";
+    }
+    info << "connected_slaves:" << replicas.size() << "\n";
+    for (size_t i = 0; i < replicas.size(); ++i) {
+        const auto& replica = replicas[i];
+        const size_t colon = replica.address.rfind(':');
+        info << "slave" << i << ":ip=" << replica.address.substr(0, colon)
+             << ",port=" << (colon == std::string::npos ? "0" : replica.address.substr(colon + 1))
+             << ",state=" << replica.state << ",offset=" << replica.ack_offset
+             << ",sent=" << replica.offset << ",lag=" << replica.lag_seconds << "\n";
+    }
+    info << "master_replid:" << repl->replid() << "\n";
+    info << "master_repl_offset:" << (link && link->active() ? link->status().offset : offset) << "\n";
+    info << "repl_backlog_size:" << repl->backlog_capacity() << "\n";
+    info << "repl_backlog_first_byte_offset:" << first << "\n";
+    info << "repl_backlog_histlen:" << offset - first << "\n";
+}
+
+CommandResult cmd_info(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    // INFO [commandstats | latencystats | replication | all]; anything else is the general section
+    const std::string section = cmd.args.empty() ? std::string() : to_lower(cmd.args[0]);
+    if (section == "commandstats" || section == "latencystats" || section == "replication") {
+        std::stringstream stats;
+        if (section == "commandstats") {
+            append_commandstats(stats);
+        } else if (section == "latencystats") {
+            append_latencystats(stats);
+        } else {
+            append_replication(stats);
+        }
+        reply.bulk(stats.str());
+        return ok();
+    }
+
+    time_t now = time(nullptr);
+    long long uptime = now - mini_redis::detail::server_start_time;
+    const std::vector<KVStore>& dbs = mini_redis::detail::local_databases();
+    size_t total_keys = 0;
+    size_t used_memory = 0;
+    uint64_t evicted_keys = 0;
+    uint64_t expired_keys = 0;
+    bool bgsave_in_progress = false;
+    bool last_bgsave_ok = true;
+    int64_t last_save_time = 0;
+    for (const auto& db : dbs) {
+        total_keys += db.size();
+        used_memory += db.used_memory();
+        evicted_keys += db.evicted_keys();
+        expired_keys += db.expired_keys();
+        bgsave_in_progress = bgsave_in_progress || db.bgsave_in_progress();
+        last_bgsave_ok = last_bgsave_ok && db.last_bgsave_ok();
+        last_save_time = std::max(last_save_time, db.last_save_time());
+    }
+    std::stringstream info;
+    info << "uptime:" << uptime << "\n";
+    info << "total_keys:" << total_keys << "\n";
+    info << "commands_processed:" << mini_redis::detail::total_commands_processed.load() << "\n";
+    info << "databases:" << dbs.size() << "\n";
+    info << "used_memory:" << used_memory << "\n";
+    info << "maxmemory:" << kv.maxmemory() << "\n";
+    info << "maxmemory_policy:" << KVStore::eviction_policy_name(kv.eviction_policy()) << "\n";
+    info << "evicted_keys:" << evicted_keys << "\n";
+    info << "expired_keys:" << expired_keys << "\n";
+    if (mini_redis::g_lazy_freer) {
+        info << "lazyfree_pending_objects:" << mini_redis::g_lazy_freer->pending_objects() << "\n";
+        info << "lazyfreed_objects:" << mini_redis::g_lazy_freer->freed_objects() << "\n";
+    }
+    info << "rdb_bgsave_in_progress:" << (bgsave_in_progress ? 1 : 0) << "\n";
+    info << "rdb_last_save_time:" << last_save_time << "\n";
+    info << "rdb_last_bgsave_status:" << (last_bgsave_ok ? "ok" : "err") << "\n";
+    if (mini_redis::g_aof_logger) {
+        info << "aof_current_size:" << mini_redis::g_aof_logger->current_size() << "\n";
+        info << "aof_base_size:" << mini_redis::g_aof_logger->base_size() << "\n";
+        info << "aof_rewrite_in_progress:" << (mini_redis::g_aof_logger->rewrite_in_progress() ? 1 : 0) << "\n";
+        info << "aof_rewrites:" << mini_redis::g_aof_logger->rewrites() << "\n";
+    }
+    info << "pubsub_channels:" << mini_redis::detail::pubsub.channel_count() << "\n";
+    info << "client_output_buffer_limit_disconnections:" << mini_redis::detail::pubsub.limit_disconnections() << "\n";
+    size_t tracked_keys = 0;
+    for (const KVStore& db : mini_redis::detail::local_databases()) {
+        tracked_keys += db.tracked_keys();
+    }
+    info << "tracking_clients:" << mini_redis::detail::tracking.client_count() << "\n";
+    info << "tracking_total_keys:" << tracked_keys << "\n";
+    info << "cluster_enabled:" << (mini_redis::g_cluster ? 1 : 0) << "\n";
+    append_replication(info);
+    if (section == "all" || section == "everything") {
+        append_commandstats(info);
+        append_latencystats(info);
+    }
+    reply.bulk(info.str());
+    return ok();
+}
+
+CommandResult cmd_subscribe(const protocol::Command& cmd, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    if (!ctx.subscriber) {
+        ctx.subscriber = std::make_unique<mini_redis::Subscriber>(mini_redis::detail::pubsub, ctx.wake_subscriber,
+                                                                  ctx.id);
+    }
+    for (const auto& channel : cmd.args) {
+        mini_redis::detail::pubsub.subscribe(*ctx.subscriber, channel);
+    }
+    reply.simple("OK");
+    return ok();
+}
+
+// Queues the message on each subscriber; their servers send it without
+// PUBLISH waiting on their sockets
+CommandResult cmd_publish(const protocol::Command& cmd, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    reply.integer(static_cast<int64_t>(mini_redis::detail::pubsub.publish(cmd.args[0], cmd.args[1])));
+    return ok();
+}
+
+// LATENCY HISTOGRAM [command ...]: per command, its calls and the cumulative
+// count of calls faster than each power-of-two bound in microseconds
+CommandResult cmd_latency(const protocol::Command& cmd, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    if (to_lower(cmd.args[0]) != "histogram") {
+        return fail(reply, "ERR unknown subcommand '" + cmd.args[0] + "'. Try LATENCY HISTOGRAM.");
+    }
+    std::vector<protocol::CommandType> types;
+    if (cmd.args.size() == 1) {
+        for (size_t t = 1; t < static_cast<size_t>(protocol::CommandType::COUNT); ++t) {
+            types.push_back(static_cast<protocol::CommandType>(t));
+        }
+    } else {
+        for (size_t i = 1; i < cmd.args.size(); ++i) {
+            const protocol::CommandSpec* spec = protocol::lookup_command(to_upper(cmd.args[i]));
+            if (spec && std::find(types.begin(), types.end(), spec->type) == types.end()) {
+                types.push_back(spec->type);
+            }
+        }
+    }
+
+    std::vector<std::pair<protocol::CommandType, CommandStats>> found;
+    for (protocol::CommandType type : types) {
+        CommandStats stats = command_stats(type);
+        if (stats.calls > 0) {
+            found.emplace_back(type, std::move(stats));
+        }
+    }
+    reply.array_header(found.size() * 2);
+    for (const auto& entry : found) {
+        const LatencyHistogram& histogram = entry.second.histogram;
+        std::vector<std::pair<uint64_t, uint64_t>> points;
+        uint64_t cumulative = 0;
+        uint64_t reported = 0;
+        for (size_t b = 0; b < LatencyHistogram::BUCKETS && reported < histogram.count(); ++b) {
+            cumulative += histogram.count_at(b);
+            uint64_t bound = LatencyHistogram::bucket_high(b) + 1;
+            if ((bound & (bound - 1)) == 0 && cumulative > reported) {
+                points.emplace_back(bound, cumulative);
+                reported = cumulative;
+            }
+        }
+        reply.bulk(to_lower(std::string(protocol::command_spec(entry.first).name)));
+        reply.array_header(4);
+        reply.bulk("calls");
+        reply.integer(static_cast<long long>(entry.second.calls));
+        reply.bulk("histogram_usec");
+        reply.array_header(points.size() * 2);
+        for (const auto& point : points) {
+            reply.integer(static_cast<long long>(point.first));
+            reply.integer(static_cast<long long>(point.second));
+        }
+    }
+    return ok();
+}
+
+// SLOWLOG GET [count] | LEN | RESET
+CommandResult cmd_slowlog(const protocol::Command& cmd, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    const std::string sub = to_lower(cmd.args[0]);
+    if (sub == "len" && cmd.args.size() == 1) {
+        reply.integer(static_cast<long long>(slowlog_len()));
+        return ok();
+    }
+    if (sub == "reset" && cmd.args.size() == 1) {
+        slowlog_reset();
+        reply.simple("OK");
+        return ok();
+    }
+    if (sub == "get" && cmd.args.size() <= 2) {
+        long long count = 10;
+        if (cmd.args.size() == 2) {
+            try {
+                count = std::stoll(cmd.args[1]);
+            } catch (...) {
+                return fail(reply, "ERR value is not an integer or out of range");
+            }
+        }
+        std::vector<SlowlogEntry> entries = slowlog_get(count < 0 ? SIZE_MAX : static_cast<size_t>(count));
+        reply.array_header(entries.size());
+        for (const auto& entry : entries) {
+            reply.array_header(4);
+            reply.integer(static_cast<long long>(entry.id));
+            reply.integer(entry.timestamp);
+            reply.integer(static_cast<long long>(entry.usec));
+            reply.array_header(entry.args.size());
+            for (const auto& arg : entry.args) {
+                reply.bulk(arg);
+            }
+        }
+        return ok();
+    }
+    return fail(reply, "ERR unknown subcommand or wrong number of arguments for '" + cmd.args[0] +
+                       "'. Try SLOWLOG GET, SLOWLOG LEN, SLOWLOG RESET.");
+}
+
+// PSYNC <replid> <offset>: the connection becomes a replica stream; every
+// reply from here on comes from its sender (use replid ? for a first sync)
+CommandResult cmd_psync(const protocol::Command& cmd, ClientContext&, KVStore&, SOCKET client_socket, ReplyWriter& reply) {
+    if (!mini_redis::g_replication_manager) {
+        return fail(reply, "ERR replication is not available");
+    }
+    uint64_t offset = 0;
+    if (cmd.args[1] != "-1") {
+        try {
+            offset = std::stoull(cmd.args[1]);
+        } catch (...) {
+            return fail(reply, "ERR value is not an integer or out of range");
+        }
+    }
+    std::string error = mini_redis::g_replication_manager->psync(client_socket, cmd.args[0], offset);
+    if (!error.empty()) {
+        return fail(reply, error);
+    }
+    return ok();
+}
+
+// REPLCONF ACK <offset> (no reply) | REPLCONF <option> <value> ...
+CommandResult cmd_replconf(const protocol::Command& cmd, ClientContext&, KVStore&, SOCKET client_socket, ReplyWriter& reply) {
+    if (to_lower(cmd.args[0]) == "ack" && cmd.args.size() == 2) {
+        if (mini_redis::g_replication_manager) {
+            try {
+                mini_redis::g_replication_manager->acknowledge(client_socket, std::stoull(cmd.args[1]));
+            } catch (...) {
+            }
+        }
+        return ok();
+    }
+    if (cmd.args.size() % 2 != 0) {
+        return fail(reply, "ERR syntax error");
+    }
+    reply.simple("OK"); // listening-port, capa and the like need nothing from us
+    return ok();
+}
+
+// REPLICAOF host port: follow a primary, serving reads only | REPLICAOF NO ONE
+CommandResult cmd_replicaof(const protocol::Command& cmd, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    if (!mini_redis::g_replica_link) {
+        return fail(reply, "ERR replication is not available");
+    }
+    if (to_lower(cmd.args[0]) == "no" && to_lower(cmd.args[1]) == "one") {
+        mini_redis::g_replica_link->stop();
+        reply.simple("OK");
+        return ok();
+    }
+    int port = 0;
+    try {
+        port = std::stoi(cmd.args[1]);
+    } catch (...) {
+    }
+    if (port <= 0 || port > 65535) {
+        return fail(reply, "ERR Invalid master port");
+    }
+    mini_redis::g_replica_link->follow(cmd.args[0], port);
+    reply.simple("OK");
+    return ok();
+}
+
+// CLUSTER <subcommand> [args...]
+CommandResult cmd_cluster(const protocol::Command& cmd, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    if (!mini_redis::g_cluster) {
+        return fail(reply, "ERR This instance has cluster support disabled");
+    }
+    mini_redis::g_cluster->command(cmd.args, reply);
+    return ok();
+}
+
+// ASKING: the next command may use a slot this node is importing
+CommandResult cmd_asking(const protocol::Command&, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    if (!mini_redis::g_cluster) {
+        return fail(reply, "ERR This instance has cluster support disabled");
+    }
+    ctx.asking = true;
+    reply.simple("OK");
+    return ok();
+}
+
+// RESTORE-RECORDS <payload>: store a batch of keys in RDB record encoding, as
+// a slot migration sends them
+CommandResult cmd_restore_records(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET,
+                                  ReplyWriter& reply) {
+    if (!kv.restore_records(cmd.args[0])) {
+        return fail(reply, "ERR Bad data format");
+    }
+    propagate(cmd, ctx);
+    reply.simple("OK");
+    return ok();
+}
+
+CommandResult cmd_auth(const protocol::Command&, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    // AUTH stub: for now, accept any password
+    ctx.authenticated = true;
+    reply.simple("OK");
+    return ok();
+}
+
+CommandResult cmd_incr(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    return counter_reply(cmd, ctx, kv.incr(cmd.args[0]), reply);
+}
+
+CommandResult cmd_decr(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    return counter_reply(cmd, ctx, kv.decr(cmd.args[0]), reply);
+}
+
+CommandResult cmd_incrby(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    int64_t delta = 0;
+    try {
+        delta = std::stoll(cmd.args[1]);
+    } catch (...) {
+        return fail(reply, "ERR value is not an integer");
+    }
+    return counter_reply(cmd, ctx, kv.incrby(cmd.args[0], delta), reply);
+}
+
+CommandResult cmd_decrby(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    int64_t delta = 0;
+    try {
+        delta = std::stoll(cmd.args[1]);
+    } catch (...) {
+        return fail(reply, "ERR value is not an integer");
+    }
+    return counter_reply(cmd, ctx, kv.decrby(cmd.args[0], delta), reply);
+}
+
+CommandResult cmd_append(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    bool wrong_type = false;
+    size_t newlen = kv.append(cmd.args[0], cmd.args[1], &wrong_type);
+    if (wrong_type) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    propagate(cmd, ctx);
+    reply.integer(static_cast<int>(newlen));
+    return ok();
+}
+
+CommandResult cmd_strlen(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    bool wrong_type = false;
+    size_t len = kv.strlen(cmd.args[0], &wrong_type);
+    if (wrong_type) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    reply.integer(static_cast<int>(len));
+    return ok();
+}
+
+// Parse a non-negative count or index argument
+bool parse_count(const std::string& arg, int64_t& out) {
+    try {
+        size_t used = 0;
+        out = std::stoll(arg, &used);
+        return used == arg.size() && out >= 0;
+    } catch (...) {
+        return false;
+    }
+}
+
+CommandResult cmd_hset(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    if (cmd.args.size() % 2 == 0) {
+        return fail(reply, "ERR wrong number of arguments for 'hset' command");
+    }
+    size_t added = 0;
+    if (kv.hset(cmd.args, added) == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    propagate(cmd, ctx);
+    reply.integer(static_cast<int64_t>(added));
+    return ok();
+}
+
+CommandResult cmd_hget(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    bool found = false;
+    const KVStore::Lookup lookup = kv.read_collection<HashValue>(cmd.args[0], [&](const HashValue& hash) {
+        std::string_view value;
+        if (hash.get(cmd.args[1], value)) {
+            reply.bulk(value);
+            found = true;
+        }
+    });
+    if (lookup == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    if (!found) {
+        reply.nil();
+    }
+    return ok();
+}
+
+CommandResult cmd_hmget(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    const size_t fields = cmd.args.size() - 1;
+    // The reply is only started once the key is known to be a hash
+    const KVStore::Lookup lookup = kv.read_collection<HashValue>(cmd.args[0], [&](const HashValue& hash) {
+        reply.array_header(fields);
+        for (size_t i = 1; i < cmd.args.size(); ++i) {
+            std::string_view value;
+            if (hash.get(cmd.args[i], value)) {
+                reply.bulk(value);
+            } else {
+                reply.nil();
+            }
+        }
+    });
+    if (lookup == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    if (lookup == KVStore::Lookup::Missing) {
+        reply.array_header(fields);
+        for (size_t i = 0; i < fields; ++i) {
+            reply.nil();
+        }
+    }
+    return ok();
+}
+
+CommandResult push_reply(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, bool front,
+                         ReplyWriter& reply) {
+    size_t length = 0;
+    if (kv.push(cmd.args, front, length) == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    propagate(cmd, ctx);
+    reply.integer(static_cast<int64_t>(length));
+    return ok();
+}
+
+CommandResult cmd_lpush(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    return push_reply(cmd, ctx, kv, true, reply);
+}
+
+CommandResult cmd_rpush(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    return push_reply(cmd, ctx, kv, false, reply);
+}
+
+// RPOP key [count]: the last element, or with a count an array of up to count
+CommandResult cmd_rpop(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    if (cmd.args.size() > 2) {
+        return fail(reply, "ERR syntax error");
+    }
+    const bool has_count = cmd.args.size() == 2;
+    int64_t count = 1;
+    if (has_count && !parse_count(cmd.args[1], count)) {
+        return fail(reply, "ERR value is out of range, must be positive");
+    }
+    std::vector<std::string> popped;
+    const KVStore::Lookup lookup = kv.rpop(cmd.args[0], static_cast<size_t>(count), popped);
+    if (lookup == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    if (!popped.empty()) {
+        propagate(cmd, ctx);
+    }
+    if (!has_count) {
+        if (popped.empty()) {
+            reply.nil();
+        } else {
+            reply.bulk(popped[0]);
+        }
+        return ok();
+    }
+    if (lookup == KVStore::Lookup::Missing) {
+        reply.nil_array();
+        return ok();
+    }
+    reply.array_header(popped.size());
+    for (const auto& value : popped) {
+        reply.bulk(value);
+    }
+    return ok();
+}
+
+// LRANGE key start stop: negative indexes count from the end
+CommandResult cmd_lrange(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    int64_t start = 0;
+    int64_t stop = 0;
+    try {
+        start = std::stoll(cmd.args[1]);
+        stop = std::stoll(cmd.args[2]);
+    } catch (...) {
+        return fail(reply, "ERR value is not an integer or out of range");
+    }
+    const KVStore::Lookup lookup = kv.read_collection<ListValue>(cmd.args[0], [&](const ListValue& list) {
+        const int64_t size = static_cast<int64_t>(list.size());
+        int64_t first = start < 0 ? std::max<int64_t>(0, size + start) : start;
+        int64_t last = stop < 0 ? size + stop : std::min(stop, size - 1);
+        if (first > last) {
+            reply.array_header(0);
+            return;
+        }
+        reply.array_header(static_cast<size_t>(last - first + 1));
+        list.range(static_cast<size_t>(first), static_cast<size_t>(last),
+                   [&](std::string_view value) { reply.bulk(value); });
+    });
+    if (lookup == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    if (lookup == KVStore::Lookup::Missing) {
+        reply.array_header(0);
+    }
+    return ok();
+}
+
+CommandResult cmd_sadd(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    size_t added = 0;
+    if (kv.sadd(cmd.args, added) == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    if (added > 0) {
+        propagate(cmd, ctx);
+    }
+    reply.integer(static_cast<int64_t>(added));
+    return ok();
+}
+
+CommandResult cmd_sismember(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    bool member = false;
+    const KVStore::Lookup lookup = kv.read_collection<SetValue>(
+        cmd.args[0], [&](const SetValue& set) { member = set.contains(cmd.args[1]); });
+    if (lookup == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    reply.integer(member ? 1 : 0);
+    return ok();
+}
+
+// ZADD key [NX|XX] [CH] score member [score member ...]
+CommandResult cmd_zadd(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    ZAddArgs args;
+    if (const char* error = parse_zadd(cmd.args, args)) {
+        return fail(reply, error);
+    }
+    size_t added = 0;
+    size_t changed = 0;
+    if (kv.zadd(cmd.args[0], args, added, changed) == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    if (changed > 0) {
+        propagate(cmd, ctx);
+    }
+    reply.integer(static_cast<int64_t>(args.changed ? changed : added));
+    return ok();
+}
+
+// ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]
+CommandResult cmd_zrangebyscore(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET,
+                                ReplyWriter& reply) {
+    ScoreRange range;
+    if (!parse_score_bound(cmd.args[1], range.min, range.min_exclusive) ||
+        !parse_score_bound(cmd.args[2], range.max, range.max_exclusive)) {
+        return fail(reply, "ERR min or max is not a float");
+    }
+    bool with_scores = false;
+    int64_t offset = 0;
+    int64_t count = -1;
+    for (size_t i = 3; i < cmd.args.size(); ++i) {
+        const std::string option = to_lower(cmd.args[i]);
+        if (option == "withscores") {
+            with_scores = true;
+        } else if (option == "limit" && i + 2 < cmd.args.size()) {
+            try {
+                offset = std::stoll(cmd.args[i + 1]);
+                count = std::stoll(cmd.args[i + 2]);
+            } catch (...) {
+                return fail(reply, "ERR value is not an integer or out of range");
+            }
+            i += 2;
+        } else {
+            return fail(reply, "ERR syntax error");
+        }
+    }
+
+    // Collected first: the reply's length is not known until the walk ends
+    std::vector<std::pair<std::string, double>> members;
+    const KVStore::Lookup lookup = kv.read_collection<ZSetValue>(cmd.args[0], [&](const ZSetValue& zset) {
+        if (offset < 0) {
+            return; // A negative offset selects nothing
+        }
+        zset.range_by_score(range, static_cast<size_t>(offset), count, [&](std::string_view member, double score) {
+            members.emplace_back(std::string(member), score);
+        });
+    });
+    if (lookup == KVStore::Lookup::WrongType) {
+        return fail(reply, KVStore::WRONGTYPE_ERROR);
+    }
+    reply.array_header(members.size() * (with_scores ? 2 : 1));
+    for (const auto& [member, score] : members) {
+        reply.bulk(member);
+        if (with_scores) {
+            reply.bulk(format_score(score));
+        }
+    }
+    return ok();
+}
+
+CommandResult cmd_type(const protocol::Command& cmd, ClientContext&, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    ValueType type;
+    reply.simple(kv.type_of(cmd.args[0], type) ? value_type_name(type) : "none");
+    return ok();
+}
+
+// A write's passes through the AOF and replication write gates, held from
+// applying it to logging and replicating it, so a rewrite or a full resync can
+// cut the data where the log and the stream match it
+struct WritePasses {
+    WriteGate::Pass aof;
+    WriteGate::Pass replication;
+};
+
+WritePasses enter_write_gates() {
+    WritePasses passes;
+    if (mini_redis::g_aof_logger) {
+        passes.aof = mini_redis::g_aof_logger->write_pass();
+    }
+    if (mini_redis::g_replication_manager) {
+        passes.replication = mini_redis::g_replication_manager->write_pass();
+    }
+    return passes;
+}
+
+// Whether a tracking client's reads in this command are remembered
+// (caching: CLIENT CACHING was sent before it)
+bool tracks_reads(const ClientContext& ctx, bool caching) {
+    using TrackingMode = ClientContext::TrackingMode;
+    return ctx.tracking == TrackingMode::Default || (ctx.tracking == TrackingMode::OptIn && caching) ||
+           (ctx.tracking == TrackingMode::OptOut && !caching);
+}
+
+// Remember that client read cmd's keys, for CLIENT TRACKING
+void track_keys(const protocol::Command& cmd, KVStore& kv, uint64_t client) {
+    const protocol::KeyRange keys = protocol::command_keys(cmd);
+    for (size_t i = keys.first; i < keys.end; i += keys.step) {
+        kv.track(cmd.args[i], client);
+    }
+}
+
+// The handler of a command type, or nullptr (defined after HANDLERS)
+CommandHandler handler_for(protocol::CommandType type);
+
+mini_redis::Transaction& transaction_of(ClientContext& ctx) {
+    if (!ctx.transaction) {
+        ctx.transaction = std::make_unique<mini_redis::Transaction>();
+    }
+    return *ctx.transaction;
+}
+
+CommandResult cmd_multi(const protocol::Command&, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    mini_redis::Transaction& tx = transaction_of(ctx);
+    if (tx.in_multi()) {
+        return fail(reply, "ERR MULTI calls can not be nested");
+    }
+    tx.begin();
+    reply.simple("OK");
+    return ok();
+}
+
+CommandResult cmd_discard(const protocol::Command&, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    if (!ctx.transaction || !ctx.transaction->in_multi()) {
+        return fail(reply, "ERR DISCARD without MULTI");
+    }
+    ctx.transaction->end();
+    ctx.transaction->unwatch_all();
+    reply.simple("OK");
+    return ok();
+}
+
+CommandResult cmd_watch(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    mini_redis::Transaction& tx = transaction_of(ctx);
+    if (tx.in_multi()) {
+        return fail(reply, "ERR WATCH inside MULTI is not allowed");
+    }
+    for (const std::string& key : cmd.args) {
+        tx.watch(kv, key);
+    }
+    reply.simple("OK");
+    return ok();
+}
+
+CommandResult cmd_unwatch(const protocol::Command&, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    if (ctx.transaction) {
+        ctx.transaction->unwatch_all();
+    }
+    reply.simple("OK");
+    return ok();
+}
+
+// EXEC: run the queued commands back to back under the locks of every shard
+// they touch, replying with an array of their replies (nil if a watched key
+// changed). Each write is logged and replicated as its own command.
+CommandResult cmd_exec(const protocol::Command&, ClientContext& ctx, KVStore&, SOCKET client_socket, ReplyWriter& reply) {
+    mini_redis::Transaction* tx = ctx.transaction.get();
+    if (!tx || !tx->in_multi()) {
+        return fail(reply, "ERR EXEC without MULTI");
+    }
+    const bool aborted = tx->aborted();
+    std::vector<protocol::Command> queued = tx->take_queued();
+    if (aborted) {
+        tx->unwatch_all();
+        return fail(reply, "EXECABORT Transaction discarded because of previous errors.");
+    }
+
+    // Cluster mode: the keys of the whole transaction must be in one slot served here
+    std::shared_lock<std::shared_mutex> slot_guard;
+    if (mini_redis::g_cluster && !ctx.internal) {
+        std::vector<std::string> keys;
+        for (const protocol::Command& queued_cmd : queued) {
+            const protocol::KeyRange range = protocol::command_keys(queued_cmd);
+            for (size_t i = range.first; i < range.end; i += range.step) {
+                keys.push_back(queued_cmd.args[i]);
+            }
+        }
+        if (!keys.empty()) {
+            std::string redirect = mini_redis::g_cluster->route(keys, 0, keys.size(), 1, false, slot_guard);
+            if (!redirect.empty()) {
+                tx->unwatch_all();
+                return fail(reply, redirect);
+            }
+        }
+    }
+
+    // The write gates come before the shard locks, as in dispatch_command
+    WritePasses passes;
+    if (std::any_of(queued.begin(), queued.end(),
+                    [](const protocol::Command& queued_cmd) { return protocol::is_write_command(queued_cmd.type); })) {
+        passes = enter_write_gates();
+    }
+
+    std::vector<KVStore>& dbs = mini_redis::detail::local_databases();
+    mini_redis::ShardLocks locks;
+    int db_index = ctx.db_index;
+    for (const protocol::Command& queued_cmd : queued) {
+        mini_redis::add_command_locks(queued_cmd, dbs, db_index, locks);
+        int selected = 0;
+        if (queued_cmd.type == protocol::CommandType::SELECT && !select_target(queued_cmd, selected)) {
+            db_index = selected;
+        }
+    }
+    tx->add_watch_locks(locks);
+    locks.lock();
+    const bool intact = tx->watches_intact();
+    tx->unwatch_all();
+    if (!intact) {
+        reply.nil_array();
+        return ok();
+    }
+
+    reply.array_header(queued.size());
+    CommandResult result = ok();
+    for (const protocol::Command& queued_cmd : queued) {
+        const uint64_t start = command_clock_usec();
+        const KeyTracker::WriterScope writer(protocol::is_write_command(queued_cmd.type) ? ctx.id : 0);
+        CommandResult one = handler_for(queued_cmd.type)(queued_cmd, ctx, get_db(ctx), client_socket, reply);
+        if ((protocol::command_spec(queued_cmd.type).flags & protocol::CMD_READ) && tracks_reads(ctx, false)) {
+            track_keys(queued_cmd, get_db(ctx), ctx.id);
+        }
+        record_command(queued_cmd, command_clock_usec() - start);
+        result.should_quit = result.should_quit || one.should_quit;
+    }
+    return result;
+}
+
+// EVAL script numkeys [key ...] [arg ...] / EVALSHA sha1 numkeys ...: the
+// keys' shards stay locked while the script runs. The _RO forms refuse the
+// script's writes, so they are reads (and run on replicas).
+CommandResult eval_reply(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, ReplyWriter& reply,
+                         bool by_sha, bool read_only) {
+    int64_t numkeys = 0;
+    try {
+        numkeys = std::stoll(cmd.args[1]);
+    } catch (...) {
+        return fail(reply, "ERR value is not an integer or out of range");
+    }
+    if (numkeys < 0) {
+        return fail(reply, "ERR Number of keys can't be negative");
+    }
+    if (static_cast<uint64_t>(numkeys) > cmd.args.size() - 2) {
+        return fail(reply, "ERR Number of keys can't be greater than number of args");
+    }
+
+    std::string sha;
+    std::string source;
+    if (by_sha) {
+        sha = to_lower(cmd.args[0]);
+        if (!mini_redis::script_cache.find(sha, source)) {
+            return fail(reply, "NOSCRIPT No matching script. Please use EVAL.");
+        }
+    } else {
+        source = cmd.args[0];
+        sha = mini_redis::script_cache.add(source);
+    }
+
+    const auto keys_end = cmd.args.begin() + 2 + numkeys;
+    const std::vector<std::string> keys(cmd.args.begin() + 2, keys_end);
+    const std::vector<std::string> argv(keys_end, cmd.args.end());
+    mini_redis::ShardLocks locks;
+    for (const std::string& key : keys) {
+        locks.add_key(kv, key);
+    }
+    locks.lock();
+    mini_redis::ScriptRun run{kv, keys, [&ctx](const protocol::Command& write) { propagate(write, ctx); },
+                              read_only};
+    write_script_value(reply, mini_redis::run_script(run, sha, source, argv));
+    return ok();
+}
+
+CommandResult cmd_eval(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    return eval_reply(cmd, ctx, kv, reply, false, false);
+}
+
+CommandResult cmd_evalsha(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    return eval_reply(cmd, ctx, kv, reply, true, false);
+}
+
+CommandResult cmd_eval_ro(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET, ReplyWriter& reply) {
+    return eval_reply(cmd, ctx, kv, reply, false, true);
+}
+
+CommandResult cmd_evalsha_ro(const protocol::Command& cmd, ClientContext& ctx, KVStore& kv, SOCKET,
+                             ReplyWriter& reply) {
+    return eval_reply(cmd, ctx, kv, reply, true, true);
+}
+
+// SCRIPT LOAD script | EXISTS sha1 [sha1 ...] | FLUSH [ASYNC | SYNC]
+CommandResult cmd_script(const protocol::Command& cmd, ClientContext&, KVStore&, SOCKET, ReplyWriter& reply) {
+    const std::string sub = to_lower(cmd.args[0]);
+    if (sub == "load" && cmd.args.size() == 2) {
+        reply.bulk(mini_redis::script_cache.add(cmd.args[1]));
+    } else if (sub == "exists" && cmd.args.size() >= 2) {
+        reply.array_header(cmd.args.size() - 1);
+        for (size_t i = 1; i < cmd.args.size(); ++i) {
+            reply.integer(mini_redis::script_cache.contains(to_lower(cmd.args[i])) ? 1 : 0);
+        }
+    } else if (sub == "flush" && cmd.args.size() <= 2) {
+        // The ASYNC / SYNC mode is accepted but makes no difference
+        if (cmd.args.size() == 2 && to_lower(cmd.args[1]) != "async" && to_lower(cmd.args[1]) != "sync") {
+            return fail(reply, "ERR syntax error");
+        }
+        mini_redis::script_cache.clear();
+        reply.simple("OK");
+    } else {
+        return fail(reply, "ERR unknown subcommand or wrong number of arguments for 'script' command");
+    }
+    return ok();
+}
+
+// The Redis version whose protocol HELLO reports
+constexpr const char* PROTOCOL_VERSION = "7.0.0";
+
+// HELLO [protover [AUTH username password] [SETNAME name]]: switch the
+// connection to RESP2 or RESP3 and describe the server
+CommandResult cmd_hello(const protocol::Command& cmd, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    int resp = ctx.resp;
+    if (!cmd.args.empty()) {
+        if (cmd.args[0] != "2" && cmd.args[0] != "3") {
+            return fail(reply, "NOPROTO unsupported protocol version");
+        }
+        resp = cmd.args[0][0] - '0';
+    }
+    for (size_t i = 1; i < cmd.args.size(); ++i) {
+        const std::string option = to_lower(cmd.args[i]);
+        if (option == "auth" && i + 2 < cmd.args.size()) {
+            ctx.authenticated = true; // Any credentials, as AUTH accepts
+            i += 2;
+        } else if (option == "setname" && i + 1 < cmd.args.size()) {
+            ++i; // Connection names are not kept
+        } else {
+            return fail(reply, "ERR syntax error");
+        }
+    }
+    ctx.resp = resp;
+    reply.set_resp3(resp == 3);
+
+    ReplicaLink* link = mini_redis::g_replica_link;
+    reply.map_header(7);
+    reply.bulk("server");
+    reply.bulk("redis");
+    reply.bulk("version");
+    reply.bulk(PROTOCOL_VERSION);
+    reply.bulk("proto");
+    reply.integer(resp);
+    reply.bulk("id");
+    reply.integer(static_cast<int64_t>(ctx.id));
+    reply.bulk("mode");
+    reply.bulk(mini_redis::g_cluster ? "cluster" : "standalone");
+    reply.bulk("role");
+    reply.bulk(link && link->active() ? "replica" : "master");
+    reply.bulk("modules");
+    reply.array_header(0);
+    return ok();
+}
+
+// CLIENT TRACKING on|off [REDIRECT id] [PREFIX prefix ...] [BCAST] [OPTIN]
+// [OPTOUT] [NOLOOP]
+CommandResult client_tracking(const protocol::Command& cmd, ClientContext& ctx, ReplyWriter& reply) {
+    using TrackingMode = ClientContext::TrackingMode;
+    const std::string state = to_lower(cmd.args[1]);
+    if (state == "off") {
+        if (ctx.tracking != TrackingMode::Off) {
+            mini_redis::detail::tracking.disable(ctx.id);
+            ctx.tracking = TrackingMode::Off;
+        }
+        reply.simple("OK");
+        return ok();
+    }
+    if (state != "on") {
+        return fail(reply, "ERR syntax error");
+    }
+
+    mini_redis::ClientTracking::Options options;
+    bool optin = false;
+    bool optout = false;
+    for (size_t i = 2; i < cmd.args.size(); ++i) {
+        const std::string option = to_lower(cmd.args[i]);
+        if (option == "redirect" && i + 1 < cmd.args.size()) {
+            int64_t id = 0;
+            if (!parse_count(cmd.args[++i], id) || id == 0) {
+                return fail(reply, "ERR Invalid client ID");
+            }
+            options.redirect = static_cast<uint64_t>(id);
+        } else if (option == "prefix" && i + 1 < cmd.args.size()) {
+            options.prefixes.push_back(cmd.args[++i]);
+        } else if (option == "bcast") {
+            options.broadcast = true;
+        } else if (option == "optin") {
+            optin = true;
+        } else if (option == "optout") {
+            optout = true;
+        } else if (option == "noloop") {
+            options.noloop = true;
+        } else {
+            return fail(reply, "ERR syntax error");
+        }
+    }
+    if (!options.prefixes.empty() && !options.broadcast) {
+        return fail(reply, "ERR PREFIX option requires BCAST mode to be enabled");
+    }
+    if (optin && optout) {
+        return fail(reply, "ERR You can't use both OPTIN and OPTOUT");
+    }
+    if ((optin || optout) && options.broadcast) {
+        return fail(reply, "ERR OPTIN and OPTOUT are not compatible with BCAST");
+    }
+    if (options.redirect == ctx.id) {
+        return fail(reply, "ERR A client can't redirect to itself");
+    }
+    // Invalidations are queued like pub/sub messages: the redirect target
+    // must have subscribed, or this client takes them as RESP3 pushes
+    if (options.redirect != 0 && !mini_redis::detail::pubsub.addressable(options.redirect)) {
+        return fail(reply, "ERR The client ID you want redirect to does not exist");
+    }
+    if (options.redirect == 0) {
+        if (ctx.resp != 3) {
+            return fail(reply, "ERR CLIENT TRACKING without REDIRECT needs RESP3 (HELLO 3)");
+        }
+        if (!ctx.subscriber) {
+            ctx.subscriber = std::make_unique<mini_redis::Subscriber>(mini_redis::detail::pubsub,
+                                                                      ctx.wake_subscriber, ctx.id);
+        }
+    }
+
+    ctx.tracking = options.broadcast ? TrackingMode::Broadcast
+                   : optin           ? TrackingMode::OptIn
+                   : optout          ? TrackingMode::OptOut
+                                     : TrackingMode::Default;
+    mini_redis::detail::tracking.enable(ctx.id, std::move(options));
+    reply.simple("OK");
+    return ok();
+}
+
+// CLIENT ID | TRACKING ... | CACHING yes|no | GETREDIR
+CommandResult cmd_client(const protocol::Command& cmd, ClientContext& ctx, KVStore&, SOCKET, ReplyWriter& reply) {
+    using TrackingMode = ClientContext::TrackingMode;
+    const std::string sub = to_lower(cmd.args[0]);
+    if (sub == "id" && cmd.args.size() == 1) {
+        reply.integer(static_cast<int64_t>(ctx.id));
+    } else if (sub == "tracking" && cmd.args.size() >= 2) {
+        return client_tracking(cmd, ctx, reply);
+    } else if (sub == "caching" && cmd.args.size() == 2) {
+        const std::string value = to_lower(cmd.args[1]);
+        if (value != "yes" && value != "no") {
+            return fail(reply, "ERR syntax error");
+        }
+        if (value == "yes" ? ctx.tracking != TrackingMode::OptIn : ctx.tracking != TrackingMode::OptOut) {
+            return fail(reply, value == "yes"
+                                   ? "ERR CLIENT CACHING YES is only valid when tracking is enabled in OPTIN mode."
+                                   : "ERR CLIENT CACHING NO is only valid when tracking is enabled in OPTOUT mode.");
+        }
+        ctx.caching = true;
+        reply.simple("OK");
+    } else if (sub == "getredir" && cmd.args.size() == 1) {
+        reply.integer(mini_redis::detail::tracking.redirect_of(ctx.id));
+    } else {
+        return fail(reply, "ERR unknown subcommand or wrong number of arguments for 'client' command");
+    }
+    return ok();
+}
+
+// Indexed by CommandType, in the same order as the command table
+constexpr CommandHandler HANDLERS[] = {
+    nullptr, // UNKNOWN
+    cmd_ping,
+    cmd_echo,
+    cmd_set,
+    cmd_get,
+    cmd_del,
+    cmd_exists,
+    cmd_keys,
+    cmd_expire,
+    cmd_ttl,
+    cmd_mget,
+    cmd_quit,
+    cmd_save,
+    cmd_load,
+    cmd_select,
+    cmd_info,
+    cmd_subscribe,
+    cmd_publish,
+    cmd_eval,
+    cmd_auth,
+    cmd_incr,
+    cmd_decr,
+    cmd_incrby,
+    cmd_decrby,
+    cmd_append,
+    cmd_strlen,
+    cmd_pexpire,
+    cmd_pttl,
+    cmd_pexpireat,
+    cmd_bgrewriteaof,
+    cmd_bgsave,
+    cmd_latency,
+    cmd_slowlog,
+    cmd_psync,
+    cmd_replconf,
+    cmd_replicaof,
+    cmd_cluster,
+    cmd_asking,
+    cmd_restore_records,
+    cmd_mset,
+    cmd_msetnx,
+    cmd_unlink,
+    cmd_flushdb,
+    cmd_flushall,
+    cmd_scan,
+    cmd_hset,
+    cmd_hget,
+    cmd_hmget,
+    cmd_lpush,
+    cmd_rpush,
+    cmd_rpop,
+    cmd_lrange,
+    cmd_sadd,
+    cmd_sismember,
+    cmd_zadd,
+    cmd_zrangebyscore,
+    cmd_type,
+    cmd_multi,
+    cmd_exec,
+    cmd_discard,
+    cmd_watch,
+    cmd_unwatch,
+    cmd_evalsha,
+    cmd_script,
+    cmd_hello,
+    cmd_client,
+    cmd_eval_ro,
+    cmd_evalsha_ro,
+};
+
+static_assert(sizeof(HANDLERS) / sizeof(HANDLERS[0]) == static_cast<size_t>(protocol::CommandType::COUNT),
+              "every CommandType needs a handler");
+
+CommandHandler handler_for(protocol::CommandType type) {
+    size_t index = static_cast<size_t>(type);
+    return index < static_cast<size_t>(protocol::CommandType::COUNT) ? HANDLERS[index] : nullptr;
+}
+
+// Commands a client in MULTI runs at once instead of queueing
+bool runs_in_multi(protocol::CommandType type) {
+    using protocol::CommandType;
+    return type == CommandType::MULTI || type == CommandType::EXEC || type == CommandType::DISCARD ||
+           type == CommandType::WATCH || type == CommandType::QUIT;
+}
+
+// Commands that take over the connection or the cluster state, which cannot
+// wait in a queue or run under a transaction's locks
+bool refused_in_multi(protocol::CommandType type) {
+    using protocol::CommandType;
+    return type == CommandType::PSYNC || type == CommandType::REPLCONF || type == CommandType::REPLICAOF ||
+           type == CommandType::CLUSTER;
+}
+
+} // anonymous namespace
+
+// Process a single command, appending its reply to out, and return the quit flag
+// Called for each pipelined command by both server implementations
+mini_redis::detail::CommandResult process_command(const protocol::Command& cmd, mini_redis::detail::ClientContext& ctx,
+                                                  SOCKET client_socket, std::string& out) {
+    ctx.request_count++;
+    mini_redis::detail::total_commands_processed++;
+    const uint64_t start = command_clock_usec();
+    mini_redis::detail::CommandResult result = dispatch_command(cmd, ctx, client_socket, out);
+    if (cmd.type != protocol::CommandType::UNKNOWN) {
+        record_command(cmd, command_clock_usec() - start);
+    }
+    return result;
+}
+
+void reply_unknown_command(const protocol::Command& cmd, mini_redis::detail::ClientContext& ctx, std::string& out) {
+    if (ctx.transaction && ctx.transaction->in_multi()) {
+        ctx.transaction->abort();
+    }
+    ReplyWriter(out).error("ERR unknown command '" + cmd.name + "'");
+}
+
+mini_redis::detail::CommandResult dispatch_command(const protocol::Command& cmd, mini_redis::detail::ClientContext& ctx,
+                                                   SOCKET client_socket, std::string& out) {
+    // Large values are spliced in only when out is the connection's own chain
+    ReplyWriter reply = ctx.replies && &ctx.replies->bytes == &out ? ReplyWriter(*ctx.replies) : ReplyWriter(out);
+    reply.set_resp3(ctx.resp == 3);
+    CommandHandler handler = handler_for(cmd.type);
+    const bool caching = std::exchange(ctx.caching, false); // CLIENT CACHING covers one command
+
+    // In MULTI a command is checked as usual, then queued for EXEC; one that
+    // fails its checks makes the EXEC abort
+    mini_redis::Transaction* tx = ctx.transaction.get();
+    const bool queueing = tx && tx->in_multi() && !runs_in_multi(cmd.type);
+    auto reject = [&](std::string_view error) {
+        if (queueing) {
+            tx->abort();
+        }
+        return fail(reply, error);
+    };
+
+    if (!handler) {
+        return reject("Unknown command");
+    }
+
+    const protocol::CommandSpec& spec = protocol::command_spec(cmd.type);
+    if (!protocol::check_arity(spec, cmd.args.size())) {
+        return reject("ERR wrong number of arguments for '" + to_lower(std::string(spec.name)) + "' command");
+    }
+
+    // A replica's data comes from its primary: clients may only read, and
+    // only while the data is within the staleness bound
+    ReplicaLink* link = mini_redis::g_replica_link;
+    if (link && !ctx.internal && (spec.flags & (protocol::CMD_WRITE | protocol::CMD_READ)) && link->active()) {
+        if (spec.flags & protocol::CMD_WRITE) {
+            return reject("READONLY You can't write against a read only replica.");
+        }
+        if (!link->fresh()) {
+            return reject("MASTERDOWN Link with MASTER is down or the replica is still syncing");
+        }
+    }
+
+    // As in Redis, writes are refused while the AOF cannot be written
+    if ((spec.flags & protocol::CMD_WRITE) && !ctx.internal && aof_write_failed()) {
+        return reject(aof_failure_error());
+    }
+
+    // Cluster mode: the keys must all be in one slot served here. The guard
+    // keeps a slot migration from moving them while the command runs.
+    const bool asking = ctx.asking;
+    ctx.asking = false;
+    std::shared_lock<std::shared_mutex> slot_guard;
+    if (mini_redis::g_cluster && !ctx.internal) {
+        const protocol::KeyRange keys = protocol::command_keys(cmd);
+        if (keys.first < keys.end) {
+            std::string redirect =
+                mini_redis::g_cluster->route(cmd.args, keys.first, keys.end, keys.step, asking, slot_guard);
+            if (!redirect.empty()) {
+                return reject(redirect);
+            }
+        }
+    }
+
+    if (queueing) {
+        if (refused_in_multi(cmd.type)) {
+            return reject("ERR Command not allowed inside a transaction");
+        }
+        tx->queue(cmd);
+        reply.simple("QUEUED");
+        return ok();
+    }
+
+    WritePasses passes;
+    if (spec.flags & protocol::CMD_WRITE) {
+        passes = enter_write_gates();
+    }
+    const KeyTracker::WriterScope writer((spec.flags & protocol::CMD_WRITE) ? ctx.id : 0);
+    // A write keeps its keys' shards locked until it is propagated, so the
+    // AOF and the replication stream log writes to a key in the order they
+    // were applied (scripts take their own locks, as EXEC does)
+    const bool tracked = (spec.flags & protocol::CMD_READ) && tracks_reads(ctx, caching);
+    const bool locked_write = (spec.flags & protocol::CMD_WRITE) && !(spec.flags & protocol::CMD_NUMKEYS);
+    if (tracked || locked_write) {
+        // The keys' shards stay locked from a read to its tracking too, so a
+        // change cannot slip in between unannounced
+        KVStore& kv = get_db(ctx);
+        mini_redis::ShardLocks locks;
+        if (locked_write) {
+            mini_redis::add_command_locks(cmd, mini_redis::detail::local_databases(), ctx.db_index, locks);
+        } else {
+            const protocol::KeyRange keys = protocol::command_keys(cmd);
+            for (size_t i = keys.first; i < keys.end; i += keys.step) {
+                locks.add_key(kv, cmd.args[i]);
+            }
+        }
+        locks.lock();
+        CommandResult result = handler(cmd, ctx, kv, client_socket, reply);
+        if (tracked) {
+            track_keys(cmd, kv, ctx.id);
+        }
+        return result;
+    }
+    return handler(cmd, ctx, get_db(ctx), client_socket, reply);
+}
+
+} // namespace mini_redis
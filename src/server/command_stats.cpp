@@ -0,0 +1,203 @@
+// Per-command statistics: thread-local counter blocks and the slow log
+// Each thread owns one block and updates it with plain load+store pairs on
+// relaxed atomics, so recording costs no more than ordinary increments yet
+// readers on other threads may sum the blocks at any time. A thread's counts
+// are folded into a shared block when it exits.
+
+#include "command_stats.hpp"
+#include "../protocol/command_table.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ctime>
+
+namespace mini_redis {
+
+namespace {
+
+constexpr size_t COMMANDS = static_cast<size_t>(protocol::CommandType::COUNT);
+constexpr size_t BUCKETS = LatencyHistogram::BUCKETS;
+constexpr size_t SLOWLOG_MAX_ARGS = 32;       // As Redis: further arguments are summarized
+constexpr size_t SLOWLOG_MAX_ARG_BYTES = 128; // ...and long ones cut short
+
+struct StatsBlock {
+    std::atomic<uint64_t> calls[COMMANDS] = {};
+    std::atomic<uint64_t> usec[COMMANDS] = {};
+    std::atomic<uint64_t> buckets[COMMANDS][BUCKETS] = {};
+};
+
+// Single-writer increment: no read-modify-write instruction needed
+void bump(std::atomic<uint64_t>& counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<StatsBlock*> live;
+    StatsBlock retired; // Counts of threads that have exited (guarded by mutex)
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+// Registers this thread's block on first use and folds it into the retired
+// counts when the thread exits
+struct LocalStats {
+    std::unique_ptr<StatsBlock> block{new StatsBlock()};
+
+    LocalStats() {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.live.push_back(block.get());
+    }
+
+    ~LocalStats() {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (size_t c = 0; c < COMMANDS; ++c) {
+            bump(reg.retired.calls[c], block->calls[c].load(std::memory_order_relaxed));
+            bump(reg.retired.usec[c], block->usec[c].load(std::memory_order_relaxed));
+            for (size_t b = 0; b < BUCKETS; ++b) {
+                bump(reg.retired.buckets[c][b], block->buckets[c][b].load(std::memory_order_relaxed));
+            }
+        }
+        for (size_t i = 0; i < reg.live.size(); ++i) {
+            if (reg.live[i] == block.get()) {
+                reg.live[i] = reg.live.back();
+                reg.live.pop_back();
+                break;
+            }
+        }
+    }
+};
+
+StatsBlock& local_block() {
+    thread_local LocalStats stats;
+    return *stats.block;
+}
+
+struct Slowlog {
+    std::mutex mutex;
+    std::deque<SlowlogEntry> entries; // Newest first
+    uint64_t next_id = 0;
+};
+
+Slowlog& slowlog() {
+    static Slowlog instance;
+    return instance;
+}
+
+std::atomic<int64_t> slowlog_threshold_usec{10000};
+std::atomic<size_t> slowlog_max_len{128};
+
+std::string trim_arg(const std::string& arg) {
+    if (arg.size() <= SLOWLOG_MAX_ARG_BYTES) {
+        return arg;
+    }
+    return arg.substr(0, SLOWLOG_MAX_ARG_BYTES) + "... (" +
+           std::to_string(arg.size() - SLOWLOG_MAX_ARG_BYTES) + " more bytes)";
+}
+
+void log_slow_command(const protocol::Command& cmd, uint64_t usec) {
+    SlowlogEntry entry;
+    entry.timestamp = static_cast<int64_t>(time(nullptr));
+    entry.usec = usec;
+    entry.args.emplace_back(protocol::command_spec(cmd.type).name);
+    size_t shown = cmd.args.size();
+    if (shown + 1 > SLOWLOG_MAX_ARGS) {
+        shown = SLOWLOG_MAX_ARGS - 2; // Leave room for the summary
+    }
+    for (size_t i = 0; i < shown; ++i) {
+        entry.args.push_back(trim_arg(cmd.args[i]));
+    }
+    if (shown < cmd.args.size()) {
+        entry.args.push_back("... (" + std::to_string(cmd.args.size() - shown) + " more arguments)");
+    }
+
+    Slowlog& log = slowlog();
+    std::lock_guard<std::mutex> lock(log.mutex);
+    entry.id = log.next_id++;
+    log.entries.push_front(std::move(entry));
+    while (log.entries.size() > slowlog_max_len.load(std::memory_order_relaxed)) {
+        log.entries.pop_back();
+    }
+}
+
+} // anonymous namespace
+
+void record_command(const protocol::Command& cmd, uint64_t usec) {
+    const size_t c = static_cast<size_t>(cmd.type);
+    if (c >= COMMANDS) {
+        return;
+    }
+    StatsBlock& block = local_block();
+    bump(block.calls[c], 1);
+    bump(block.usec[c], usec);
+    bump(block.buckets[c][LatencyHistogram::bucket_of(usec)], 1);
+
+    const int64_t threshold = slowlog_threshold_usec.load(std::memory_order_relaxed);
+    if (threshold >= 0 && usec >= static_cast<uint64_t>(threshold)) {
+        log_slow_command(cmd, usec);
+    }
+}
+
+CommandStats command_stats(protocol::CommandType type) {
+    CommandStats stats;
+    const size_t c = static_cast<size_t>(type);
+    if (c >= COMMANDS) {
+        return stats;
+    }
+    auto add = [&](const StatsBlock& block) {
+        stats.calls += block.calls[c].load(std::memory_order_relaxed);
+        stats.usec += block.usec[c].load(std::memory_order_relaxed);
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            uint64_t n = block.buckets[c][b].load(std::memory_order_relaxed);
+            if (n) {
+                stats.histogram.add(b, n);
+            }
+        }
+    };
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    add(reg.retired);
+    for (const StatsBlock* block : reg.live) {
+        add(*block);
+    }
+    return stats;
+}
+
+void configure_slowlog(int64_t log_slower_than_usec, size_t max_len) {
+    slowlog_threshold_usec.store(log_slower_than_usec);
+    slowlog_max_len.store(max_len);
+    Slowlog& log = slowlog();
+    std::lock_guard<std::mutex> lock(log.mutex);
+    while (log.entries.size() > max_len) {
+        log.entries.pop_back();
+    }
+}
+
+std::vector<SlowlogEntry> slowlog_get(size_t count) {
+    Slowlog& log = slowlog();
+    std::lock_guard<std::mutex> lock(log.mutex);
+    size_t n = std::min(count, log.entries.size());
+    return std::vector<SlowlogEntry>(log.entries.begin(), log.entries.begin() + static_cast<std::ptrdiff_t>(n));
+}
+
+size_t slowlog_len() {
+    Slowlog& log = slowlog();
+    std::lock_guard<std::mutex> lock(log.mutex);
+    return log.entries.size();
+}
+
+void slowlog_reset() {
+    Slowlog& log = slowlog();
+    std::lock_guard<std::mutex> lock(log.mutex);
+    log.entries.clear();
+}
+
+} // namespace mini_redis
@@ -0,0 +1,51 @@
+// Per-command statistics for Mini-Redis
+// Call counts, total time and a latency histogram for every CommandType, kept
+// in thread-local blocks that only their own thread writes (relaxed stores,
+// no shared cache lines, no locks) and merged when INFO or LATENCY read them.
+// Commands at or above a configurable threshold also go to the slow log.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+
+#include "../protocol/parser.hpp"
+#include "utils/latency_histogram.hpp"
+
+namespace mini_redis {
+
+// Monotonic clock for command timing, in microseconds
+inline uint64_t command_clock_usec() {
+    using namespace std::chrono;
+    return static_cast<uint64_t>(duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+// Record one executed command (cmd.type must be a known command)
+void record_command(const protocol::Command& cmd, uint64_t usec);
+
+// Every thread's counts for one command, merged
+struct CommandStats {
+    uint64_t calls = 0;
+    uint64_t usec = 0;
+    LatencyHistogram histogram;
+};
+CommandStats command_stats(protocol::CommandType type);
+
+// Slow log: commands taking at least log_slower_than_usec (0 = every command,
+// negative = off), newest first, at most max_len entries
+struct SlowlogEntry {
+    uint64_t id;
+    int64_t timestamp; // Unix seconds when the command finished
+    uint64_t usec;
+    std::vector<std::string> args; // Command name first; long argument lists and values are trimmed
+};
+
+void configure_slowlog(int64_t log_slower_than_usec, size_t max_len);
+std::vector<SlowlogEntry> slowlog_get(size_t count);
+size_t slowlog_len();
+void slowlog_reset();
+
+} // namespace mini_redis
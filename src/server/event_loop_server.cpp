@@ -0,0 +1,511 @@
+// Event-loop server implementation for Mini-Redis
+// Edge-triggered epoll on Linux and kqueue on BSD/macOS. Each worker thread runs
+// its own loop over non-blocking sockets with per-connection read/write buffers;
+// an acceptor thread hands new connections to the loops round-robin.
+// Replies go out with sendmsg as one gather list per flush: the serialized
+// bytes plus large values referenced straight from the store. On Linux a large
+// value is sent with MSG_ZEROCOPY, and its reference is held until the kernel
+// reports the send complete on the socket's error queue.
+// A PUBLISH on any thread queues the message on the subscriber and wakes its
+// loop through a Notifier; the loop moves messages to the output once earlier
+// output has been written.
+// Under appendfsync always a batch's replies are held, and the client's input
+// left unread, until the AOF writer reports the batch's writes on disk; the
+// writer wakes the loop through the same Notifier, so the loop never blocks.
+
+#include "server/tcp_server.hpp"
+#include "utils/logger.hpp"
+
+#include "../protocol/resp_utils.hpp"
+#include "../protocol/parser.hpp"
+#include "../protocol/resp_parser.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+
+#include "server/server_common.hpp"
+#include "server/poller.hpp"
+#include "server/pubsub.hpp"
+
+#if defined(MINI_REDIS_HAVE_POLLER)
+
+#include <sys/uio.h>
+#include <deque>
+
+#if defined(MINI_REDIS_USE_EPOLL) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define MINI_REDIS_HAVE_ZEROCOPY 1
+#include <linux/errqueue.h>
+#endif
+
+namespace mini_redis {
+
+namespace {
+
+constexpr size_t READ_CHUNK = 16 * 1024;
+constexpr int MAX_EVENTS = Poller::MAX_WAIT_EVENTS;
+// Stop reading from a client whose unsent replies exceed this until it catches up
+constexpr size_t OUTPUT_PAUSE_BYTES = 4 * 1024 * 1024;
+constexpr size_t MAX_SEND_PIECES = 64; // iovecs per sendmsg
+#if defined(MINI_REDIS_HAVE_ZEROCOPY)
+// Smaller sends are cheaper to copy than to pin and complete asynchronously
+constexpr size_t ZEROCOPY_MIN_BYTES = 64 * 1024;
+#endif
+
+// Per-connection state, owned by exactly one event loop
+struct Connection {
+    mini_redis::detail::ClientContext ctx;
+    SOCKET socket = INVALID_SOCKET;
+    ReplyChain out;           // Replies not yet written
+    bool read_paused = false; // Input left unread while out is over the limit
+    bool closing = false;     // Close once out is flushed (QUIT)
+    bool closed = false;      // Socket closed; freed at the end of the event batch
+    bool held = false;        // Replies wait for the AOF fsync (appendfsync always); input is left unread
+#if defined(MINI_REDIS_HAVE_ZEROCOPY)
+    // A value sent with MSG_ZEROCOPY, kept alive until the kernel is done with it
+    struct ZerocopyHold {
+        uint32_t id; // The kernel's count of zerocopy sends on this socket
+        ValueRef value;
+    };
+    bool zerocopy = false;    // SO_ZEROCOPY is on and still worth using
+    uint32_t zerocopy_next = 0;
+    std::deque<ZerocopyHold> zerocopy_holds;
+#endif
+
+    size_t pending() const { return out.pending(); }
+};
+
+class EventLoop {
+public:
+    EventLoop() : durable_([this] { notifier_.notify(); }) {}
+
+    bool valid() const { return poller_.valid() && notifier_.valid(); }
+
+    // The loop runs for the life of the process, like the accept loop
+    void start() {
+        std::thread(&EventLoop::run, this).detach();
+    }
+
+    // Take ownership of an accepted, non-blocking socket (called by the acceptor)
+    void adopt(SOCKET client_socket) {
+        Connection* conn = new Connection();
+        conn->socket = client_socket;
+        conn->ctx.replies = &conn->out;
+        conn->ctx.wake_subscriber = [this, conn] { wake(conn); };
+#if defined(MINI_REDIS_HAVE_ZEROCOPY)
+        int one = 1;
+        conn->zerocopy = setsockopt(client_socket, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+        if (!poller_.add(conn->socket, conn)) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Failed to register client socket");
+            closesocket(client_socket);
+            delete conn;
+            return;
+        }
+        mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client connected (event loop)");
+    }
+
+private:
+    // A publisher queued messages for conn (any thread)
+    void wake(Connection* conn) {
+        bool first;
+        {
+            std::lock_guard<std::mutex> lock(woken_mutex_);
+            first = woken_.empty();
+            woken_.push_back(conn);
+        }
+        if (first) {
+            notifier_.notify();
+        }
+    }
+
+    void run() {
+        Poller::Event events[MAX_EVENTS];
+        poller_.add(notifier_.fd(), &notifier_, true);
+        while (true) {
+            int n = poller_.wait(events, MAX_EVENTS);
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data == &notifier_) {
+                    notifier_.drain();
+                    send_woken();
+                    continue;
+                }
+                Connection* conn = static_cast<Connection*>(events[i].data);
+                // kqueue reports read and write separately, so an earlier event
+                // in this batch may already have closed the connection
+                if (conn->closed) {
+                    continue;
+                }
+#if defined(MINI_REDIS_HAVE_ZEROCOPY)
+                // Completions arrive as errors (EPOLLERR, reported as readable)
+                if (events[i].readable && !conn->zerocopy_holds.empty()) {
+                    reap_zerocopy(conn);
+                }
+#endif
+                if (events[i].writable) {
+                    handle_writable(conn);
+                }
+                if (events[i].readable && !conn->closed && !conn->read_paused) {
+                    handle_readable(conn);
+                }
+            }
+            durable_.release([this](Connection* conn, bool durable) {
+                conn->held = false;
+                if (!durable) {
+                    fail_held(conn);
+                    return;
+                }
+                handle_readable(conn);
+            });
+            for (Connection* conn : closed_) {
+                delete conn;
+            }
+            closed_.clear();
+        }
+    }
+
+    // Drain the socket (edge-triggered: read until it would block)
+    void handle_readable(Connection* conn) {
+        while (!conn->closing && !conn->held) {
+            if (conn->pending() > OUTPUT_PAUSE_BYTES) {
+                if (!flush(conn)) {
+                    close_connection(conn);
+                    return;
+                }
+                if (conn->pending() > OUTPUT_PAUSE_BYTES) {
+                    // Resumed from handle_writable once the client catches up
+                    conn->read_paused = true;
+                    break;
+                }
+            }
+
+            ssize_t bytes = recv(conn->socket, read_buffer_, sizeof(read_buffer_), 0);
+            if (bytes > 0) {
+                conn->ctx.parser->append(read_buffer_, static_cast<size_t>(bytes));
+                process_input(conn);
+                continue;
+            }
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes < 0 && socket_would_block()) {
+                break;
+            }
+            // Orderly shutdown or hard error
+            close_connection(conn);
+            return;
+        }
+
+        if (!flush(conn) || (conn->closing && !conn->held && conn->pending() == 0)) {
+            close_connection(conn);
+            return;
+        }
+        send_messages(conn);
+    }
+
+    void handle_writable(Connection* conn) {
+        if (!flush(conn)) {
+            close_connection(conn);
+            return;
+        }
+        if (conn->closing && !conn->held && conn->pending() == 0) {
+            close_connection(conn);
+            return;
+        }
+        if (conn->read_paused && conn->pending() <= OUTPUT_PAUSE_BYTES) {
+            conn->read_paused = false;
+            handle_readable(conn);
+            return;
+        }
+        send_messages(conn);
+    }
+
+    void send_woken() {
+        std::vector<Connection*> woken;
+        {
+            std::lock_guard<std::mutex> lock(woken_mutex_);
+            woken.swap(woken_);
+        }
+        for (Connection* conn : woken) {
+            send_messages(conn);
+        }
+    }
+
+    // Move a subscriber's waiting messages to its output once the earlier
+    // output is written, so a slow client's backlog stays in its queue, where
+    // the output buffer limits apply
+    void send_messages(Connection* conn) {
+        if (conn->held) {
+            return; // Resumed once the held replies go out
+        }
+        Subscriber* sub = conn->ctx.subscriber.get();
+        while (sub && !conn->closed && sub->ready()) {
+            if (sub->over_limit()) {
+                mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                        "Closing subscriber over its pub/sub output buffer limit");
+                close_connection(conn);
+                return;
+            }
+            if (conn->pending() > 0) {
+                return; // Resumed from handle_writable
+            }
+            sub->take(conn->out, Subscriber::TAKE_BATCH_BYTES);
+            if (!flush(conn)) {
+                close_connection(conn);
+                return;
+            }
+        }
+    }
+
+    // Run every complete command in the parser, appending replies to conn->out
+    void process_input(Connection* conn) {
+        std::string parse_error;
+        std::vector<protocol::Command> commands = extract_resp_commands(conn->ctx.parser, &parse_error);
+
+        if (commands.empty() && !parse_error.empty()) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "RESP parse error (event loop): " + parse_error);
+            // Parser discarded the malformed data - connection recovers if next command is valid
+            ReplyWriter(conn->out).error(parse_error);
+            return;
+        }
+
+        for (const auto& cmd : commands) {
+            if (cmd.type == protocol::CommandType::UNKNOWN) {
+                reply_unknown_command(cmd, conn->ctx, conn->out.bytes);
+                continue;
+            }
+            mini_redis::detail::CommandResult result = process_command(cmd, conn->ctx, conn->socket, conn->out.bytes);
+            if (result.should_quit) {
+                conn->closing = true;
+                break;
+            }
+        }
+        if (uint64_t ticket = take_aof_ticket(conn->ctx)) {
+            conn->held = true;
+            durable_.park(conn, ticket);
+        }
+    }
+
+    // The AOF failed before conn's held replies were durable: send an error
+    // in their place and disconnect
+    void fail_held(Connection* conn) {
+        conn->out.clear();
+        ReplyWriter(conn->out).error(aof_failure_error());
+        conn->closing = true;
+        if (!flush(conn) || conn->pending() == 0) {
+            close_connection(conn);
+        }
+    }
+
+    // Write as much pending output as the socket accepts. Returns false on a hard error.
+    bool flush(Connection* conn) {
+        while (!conn->held && conn->pending() > 0) {
+            iovec iov[MAX_SEND_PIECES];
+            const ValueRef* values[MAX_SEND_PIECES];
+            size_t count = 0;
+            conn->out.gather(MAX_SEND_PIECES, [&](std::string_view piece, const ValueRef* value) {
+                iov[count].iov_base = const_cast<char*>(piece.data());
+                iov[count].iov_len = piece.size();
+                values[count++] = value;
+            });
+
+            int flags = 0;
+#if defined(MINI_REDIS_HAVE_ZEROCOPY)
+            // A large value goes out alone with MSG_ZEROCOPY; everything
+            // before it is sent (copied) first
+            if (conn->zerocopy) {
+                for (size_t i = 0; i < count; ++i) {
+                    if (values[i] && iov[i].iov_len >= ZEROCOPY_MIN_BYTES) {
+                        if (i == 0) {
+                            flags = MSG_ZEROCOPY;
+                            count = 1;
+                        } else {
+                            count = i;
+                        }
+                        break;
+                    }
+                }
+            }
+#endif
+
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t sent = sendmsg(conn->socket, &msg, flags);
+            if (sent > 0) {
+#if defined(MINI_REDIS_HAVE_ZEROCOPY)
+                if (flags & MSG_ZEROCOPY) {
+                    conn->zerocopy_holds.push_back({conn->zerocopy_next++, *values[0]});
+                }
+#endif
+                // A fully drained chain is cleared, keeping the buffer's capacity
+                conn->out.consume(static_cast<size_t>(sent));
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && socket_would_block()) {
+                return true; // Resumed on the next writable edge
+            }
+#if defined(MINI_REDIS_HAVE_ZEROCOPY)
+            if (sent < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                // No memory left to pin pages: send copied from now on
+                conn->zerocopy = false;
+                continue;
+            }
+#endif
+            return false;
+        }
+        return true;
+    }
+
+#if defined(MINI_REDIS_HAVE_ZEROCOPY)
+    // Release the values of zerocopy sends the kernel has finished with
+    void reap_zerocopy(Connection* conn) {
+        while (!conn->zerocopy_holds.empty()) {
+            char control[128];
+            msghdr msg{};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(conn->socket, &msg, MSG_ERRQUEUE) < 0) {
+                return; // Nothing more queued yet
+            }
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+                const bool recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                                     (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+                if (!recverr) {
+                    continue;
+                }
+                sock_extended_err err;
+                std::memcpy(&err, CMSG_DATA(cm), sizeof(err));
+                if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    // The kernel copied anyway (e.g. loopback): plain sends are cheaper
+                    conn->zerocopy = false;
+                }
+                // Sends [ee_info, ee_data] are done; TCP completes them in order
+                while (!conn->zerocopy_holds.empty() &&
+                       static_cast<int32_t>(err.ee_data - conn->zerocopy_holds.front().id) >= 0) {
+                    conn->zerocopy_holds.pop_front();
+                }
+            }
+        }
+    }
+#endif
+
+    void close_connection(Connection* conn) {
+        // Once it has left its channels no publisher can wake it again
+        if (conn->ctx.subscriber) {
+            conn->ctx.subscriber.reset();
+            std::lock_guard<std::mutex> lock(woken_mutex_);
+            woken_.erase(std::remove(woken_.begin(), woken_.end(), conn), woken_.end());
+        }
+        mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client disconnected (event loop, processed " +
+                                std::to_string(conn->ctx.request_count) + " requests)");
+        // Closing the socket also removes it from the poller
+        closesocket(conn->socket);
+        conn->closed = true;
+        durable_.forget(conn);
+        closed_.push_back(conn);
+    }
+
+    Poller poller_;
+    Notifier notifier_;
+    std::mutex woken_mutex_;
+    std::vector<Connection*> woken_; // Subscribers with messages waiting
+    std::vector<Connection*> closed_; // Freed after the current event batch
+    DurableWaits<Connection*> durable_; // Connections whose replies wait for the AOF
+    char read_buffer_[READ_CHUNK];
+};
+
+} // anonymous namespace
+
+int start_server_event_loop(const Config& cfg) {
+    if (!net_init()) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Socket library initialization failed");
+        return 1;
+    }
+
+    const int port = cfg.port;
+    start_services(cfg);
+
+    SOCKET listen_socket = open_listen_socket(port);
+    if (listen_socket == INVALID_SOCKET) {
+        return 1;
+    }
+
+    const unsigned loop_count = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    for (unsigned i = 0; i < loop_count; ++i) {
+        auto loop = std::make_unique<EventLoop>();
+        if (!loop->valid()) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Failed to create event loop poller");
+            closesocket(listen_socket);
+            return 1;
+        }
+        loop->start();
+        loops.push_back(std::move(loop));
+    }
+
+    mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Mini-Redis event loop server running on port " +
+                            std::to_string(port) + " (" + std::to_string(loop_count) + " loops)");
+
+    // Acceptor: block in accept() and spread connections across the loops
+    size_t next_loop = 0;
+    while (true) {
+        SOCKET client_socket = accept(listen_socket, nullptr, nullptr);
+        if (client_socket == INVALID_SOCKET) {
+            if (errno != EINTR) {
+                mini_redis::Logger::log(mini_redis::Logger::Level::Error, "accept() failed");
+            }
+            continue;
+        }
+        if (!set_nonblocking(client_socket)) {
+            closesocket(client_socket);
+            continue;
+        }
+        set_nodelay(client_socket);
+        loops[next_loop]->adopt(client_socket);
+        next_loop = (next_loop + 1) % loops.size();
+    }
+
+    stop_services();
+    closesocket(listen_socket);
+    return 0;
+}
+
+} // namespace mini_redis
+
+#elif defined(_WIN32)
+
+namespace mini_redis {
+
+// No epoll/kqueue on Windows: IOCP is the native event-driven server there
+int start_server_event_loop(const Config& cfg) {
+    mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                            "epoll/kqueue are not available on Windows, using the IOCP server");
+    return start_server_iocp(cfg);
+}
+
+} // namespace mini_redis
+
+#else
+
+namespace mini_redis {
+
+int start_server_event_loop(const Config& cfg) {
+    mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                            "No epoll/kqueue on this platform, using the thread-per-client server");
+    return start_server(cfg);
+}
+
+} // namespace mini_redis
+
+#endif
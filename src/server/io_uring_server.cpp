@@ -0,0 +1,770 @@
+// io_uring server implementation for Mini-Redis
+// Linux counterpart of the IOCP server: each worker thread owns one ring with a
+// multishot accept on the shared listen socket, a multishot recv per connection
+// fed from a registered provided-buffer ring, and one send in flight per
+// connection. Every loop iteration submits all queued SQEs and reaps all
+// completions with a single io_uring_enter, however many clients are active.
+// The ring is driven through the raw syscalls, so liburing is not required.
+// Publishers wake a ring for its subscribers by writing to an eventfd the ring
+// keeps a read posted on. The AOF writer wakes it the same way once a batch
+// of writes is on disk under appendfsync always: until then the batch's
+// replies are held and the connection's recv is stopped.
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "server/tcp_server.hpp"
+#include "utils/logger.hpp"
+
+#include "../protocol/resp_utils.hpp"
+#include "../protocol/parser.hpp"
+#include "../protocol/resp_parser.hpp"
+
+#include "server/server_common.hpp"
+#include "server/pubsub.hpp"
+
+// Multishot recv (Linux 6.0) is the newest feature used; older headers fall back
+#if defined(IORING_RECV_MULTISHOT)
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mini_redis {
+
+namespace {
+
+constexpr unsigned RING_ENTRIES = 1024;
+constexpr unsigned BUFFER_COUNT = 256;        // Provided buffers per ring (power of two)
+constexpr unsigned BUFFER_SIZE = 16 * 1024;   // Bytes per provided buffer
+constexpr uint16_t BUFFER_GROUP = 0;
+// Stop reading from a client whose unsent replies exceed this until it catches up
+constexpr size_t OUTPUT_PAUSE_BYTES = 4 * 1024 * 1024;
+
+int sys_io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// One io_uring instance: the mmapped submission/completion rings plus the
+// provided-buffer ring that multishot recv picks its buffers from.
+// Not thread-safe; it is created and driven by a single loop thread.
+class Ring {
+public:
+    Ring() = default;
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    ~Ring() {
+        if (buf_ring_ != nullptr) {
+            munmap(buf_ring_, buf_ring_bytes_);
+        }
+        if (sqes_ != nullptr) {
+            munmap(sqes_, sqes_bytes_);
+        }
+        if (cq_map_ != nullptr && cq_map_ != sq_map_) {
+            munmap(cq_map_, cq_map_bytes_);
+        }
+        if (sq_map_ != nullptr) {
+            munmap(sq_map_, sq_map_bytes_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    // Create the ring and map its queues. Newer setup flags are tried first and
+    // dropped on kernels that reject them.
+    bool init(unsigned entries) {
+        const unsigned flag_sets[] = {
+            IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+            IORING_SETUP_COOP_TASKRUN,
+            0,
+        };
+        io_uring_params params{};
+        for (unsigned flags : flag_sets) {
+            std::memset(&params, 0, sizeof(params));
+            params.flags = flags;
+            fd_ = sys_io_uring_setup(entries, &params);
+            if (fd_ >= 0 || errno != EINVAL) {
+                break;
+            }
+        }
+        if (fd_ < 0) {
+            return false;
+        }
+
+        sq_map_bytes_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_map_bytes_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_map_bytes_ = cq_map_bytes_ = std::max(sq_map_bytes_, cq_map_bytes_);
+        }
+
+        sq_map_ = map_queue(sq_map_bytes_, IORING_OFF_SQ_RING);
+        if (sq_map_ == nullptr) {
+            return false;
+        }
+        cq_map_ = single_mmap ? sq_map_ : map_queue(cq_map_bytes_, IORING_OFF_CQ_RING);
+        if (cq_map_ == nullptr) {
+            return false;
+        }
+        sqes_bytes_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(map_queue(sqes_bytes_, IORING_OFF_SQES));
+        if (sqes_ == nullptr) {
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sq_map_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sq_local_tail_ = *sq_tail_;
+
+        char* cq = static_cast<char*>(cq_map_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        return true;
+    }
+
+    // Register `count` buffers of `size` bytes as provided-buffer group `group`
+    bool register_buffers(uint16_t group, unsigned count, unsigned size) {
+        buf_ring_bytes_ = count * sizeof(io_uring_buf);
+        void* mem = mmap(nullptr, buf_ring_bytes_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) {
+            return false;
+        }
+        buf_ring_ = static_cast<io_uring_buf_ring*>(mem);
+
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (sys_io_uring_register(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+            return false;
+        }
+
+        buf_pool_.reset(new char[static_cast<size_t>(count) * size]);
+        buf_mask_ = count - 1;
+        buf_size_ = size;
+        for (unsigned bid = 0; bid < count; ++bid) {
+            recycle(static_cast<uint16_t>(bid));
+        }
+        return true;
+    }
+
+    const char* buffer(uint16_t bid) const {
+        return buf_pool_.get() + static_cast<size_t>(bid) * buf_size_;
+    }
+
+    // Hand a consumed buffer back to the kernel
+    void recycle(uint16_t bid) {
+        // Index the ring as a plain array: in C++ the header's flexible `bufs`
+        // member sits behind an empty struct and is laid out 8 bytes too late
+        io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(buf_ring_)[buf_tail_ & buf_mask_];
+        buf.addr = reinterpret_cast<uint64_t>(buffer(bid));
+        buf.len = buf_size_;
+        buf.bid = bid;
+        ++buf_tail_;
+        __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+    }
+
+    // Make sure `count` consecutive SQEs can be taken (linked SQEs must go out
+    // in the same submission), submitting what is queued if the ring is full
+    void reserve(unsigned count) {
+        if (sq_entries_ - queued() < count) {
+            submit_and_wait(0);
+        }
+    }
+
+    // Next free SQE, zeroed. Submits queued entries first if the ring is full.
+    io_uring_sqe* next_sqe() {
+        reserve(1);
+        unsigned index = sq_local_tail_ & sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        ++sq_local_tail_;
+        return sqe;
+    }
+
+    // Publish queued SQEs and optionally block for `wait_nr` completions
+    void submit_and_wait(unsigned wait_nr) {
+        __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+        unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+        while (true) {
+            unsigned to_submit = queued();
+            if (to_submit == 0 && wait_nr == 0) {
+                return;
+            }
+            if (to_submit == 0 && completions_ready()) {
+                return;
+            }
+            int rc = sys_io_uring_enter(fd_, to_submit, wait_nr, flags);
+            // EINTR: retry; EBUSY/EAGAIN: completions must be reaped first
+            if (rc >= 0 || errno != EINTR) {
+                return;
+            }
+        }
+    }
+
+    // Call fn(cqe) for every completion currently in the queue
+    template <typename Fn>
+    void for_each_completion(Fn&& fn) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            io_uring_cqe cqe = cqes_[head & cq_mask_];
+            ++head;
+            // Release the slot before the handler can queue more work
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            fn(cqe);
+            if (head == tail) {
+                tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            }
+        }
+    }
+
+private:
+    void* map_queue(size_t bytes, uint64_t offset) {
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                       static_cast<off_t>(offset));
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    unsigned queued() const {
+        return sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    }
+
+    bool completions_ready() const {
+        return *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    }
+
+    int fd_ = -1;
+
+    void* sq_map_ = nullptr;
+    size_t sq_map_bytes_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sq_local_tail_ = 0; // Tail including SQEs not yet published
+
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_bytes_ = 0;
+
+    void* cq_map_ = nullptr;
+    size_t cq_map_bytes_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+    unsigned cq_mask_ = 0;
+
+    io_uring_buf_ring* buf_ring_ = nullptr;
+    size_t buf_ring_bytes_ = 0;
+    std::unique_ptr<char[]> buf_pool_;
+    unsigned buf_mask_ = 0;
+    unsigned buf_size_ = 0;
+    uint16_t buf_tail_ = 0;
+};
+
+// Operation kind, stored in the low bits of user_data next to the Connection pointer
+enum Op : uint64_t {
+    OP_ACCEPT = 0,
+    OP_RECV = 1,
+    OP_SEND = 2,
+    OP_SHUTDOWN = 3,
+    OP_CANCEL = 4,
+    OP_WAKE = 5,
+};
+constexpr uint64_t OP_MASK = 7;
+
+// Per-connection state, owned by exactly one ring. It is freed only once no
+// operation that names it in user_data is still in flight.
+struct alignas(8) Connection {
+    mini_redis::detail::ClientContext ctx;
+    SOCKET socket = INVALID_SOCKET;
+    std::string out;              // Replies produced since the last send was queued
+    std::string sending;          // Buffer owned by the in-flight send
+    size_t send_offset = 0;       // Bytes of sending already written
+    bool recv_armed = false;      // Multishot recv still posting completions
+    bool send_inflight = false;
+    bool shutdown_inflight = false;
+    bool read_paused = false;     // recv cancelled while output is over the limit
+    bool closing = false;         // QUIT seen: flush, then shut down
+    bool shut = false;            // Socket shut down; no new operations
+    bool held = false;            // Replies wait for the AOF fsync (appendfsync always)
+
+    size_t pending() const { return out.size() + sending.size() - send_offset; }
+};
+
+uint64_t tag(Connection* conn, Op op) {
+    return reinterpret_cast<uint64_t>(conn) | op;
+}
+
+class UringLoop {
+public:
+    explicit UringLoop(SOCKET listen_socket)
+        : listen_socket_(listen_socket), wake_fd_(eventfd(0, EFD_CLOEXEC)),
+          durable_([this] { signal_wake(); }) {}
+
+    ~UringLoop() {
+        if (wake_fd_ >= 0) {
+            ::close(wake_fd_);
+        }
+    }
+
+    UringLoop(const UringLoop&) = delete;
+    UringLoop& operator=(const UringLoop&) = delete;
+
+    // The loop runs for the life of the process, like the accept loop
+    std::thread start() {
+        return std::thread(&UringLoop::run, this);
+    }
+
+private:
+    void run() {
+        // The ring is created on its own thread so SINGLE_ISSUER holds
+        if (!ring_.init(RING_ENTRIES) || !ring_.register_buffers(BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE)) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Error,
+                                    "io_uring setup failed in worker: " + std::string(std::strerror(errno)));
+            return;
+        }
+        arm_accept();
+        arm_wake();
+        while (true) {
+            ring_.submit_and_wait(1);
+            ring_.for_each_completion([this](const io_uring_cqe& cqe) { dispatch(cqe); });
+            durable_.release([this](Connection* conn, bool durable) {
+                conn->held = false;
+                if (!durable) {
+                    // Send an error in place of the held replies and disconnect
+                    conn->out.clear();
+                    ReplyWriter(conn->out).error(aof_failure_error());
+                    conn->closing = true;
+                } else if (!conn->shut && !conn->closing) {
+                    process_input(conn); // Input that arrived before the recv stopped
+                }
+                flush(conn);
+                send_messages(conn);
+                if (wants_recv(conn)) {
+                    arm_recv(conn);
+                }
+                maybe_free(conn);
+            });
+        }
+    }
+
+    void dispatch(const io_uring_cqe& cqe) {
+        Connection* conn = reinterpret_cast<Connection*>(cqe.user_data & ~OP_MASK);
+        switch (static_cast<Op>(cqe.user_data & OP_MASK)) {
+            case OP_ACCEPT:   on_accept(cqe); break;
+            case OP_RECV:     on_recv(conn, cqe); break;
+            case OP_SEND:     on_send(conn, cqe); break;
+            case OP_SHUTDOWN: on_shutdown(conn, cqe); break;
+            case OP_CANCEL:   break;
+            case OP_WAKE:     on_wake(cqe); break;
+        }
+    }
+
+    // A publisher queued messages for conn (any thread)
+    void wake(Connection* conn) {
+        bool first;
+        {
+            std::lock_guard<std::mutex> lock(woken_mutex_);
+            first = woken_.empty();
+            woken_.push_back(conn);
+        }
+        if (first) {
+            signal_wake();
+        }
+    }
+
+    // Make the posted eventfd read complete (any thread)
+    void signal_wake() {
+        uint64_t one = 1;
+        ssize_t rc = ::write(wake_fd_, &one, sizeof(one));
+        (void)rc; // A saturated counter already guarantees a wakeup
+    }
+
+    void arm_wake() {
+        io_uring_sqe* sqe = ring_.next_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = wake_fd_;
+        sqe->addr = reinterpret_cast<uint64_t>(&wake_count_);
+        sqe->len = sizeof(wake_count_);
+        sqe->user_data = tag(nullptr, OP_WAKE);
+    }
+
+    void on_wake(const io_uring_cqe& cqe) {
+        if (cqe.res < 0 && cqe.res != -EINTR && cqe.res != -EAGAIN) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Error,
+                                    "io_uring wake read failed: " + std::string(std::strerror(-cqe.res)));
+            return;
+        }
+        arm_wake();
+
+        std::vector<Connection*> woken;
+        {
+            std::lock_guard<std::mutex> lock(woken_mutex_);
+            woken.swap(woken_);
+        }
+        // Once each, as maybe_free may delete it
+        std::sort(woken.begin(), woken.end());
+        woken.erase(std::unique(woken.begin(), woken.end()), woken.end());
+        for (Connection* conn : woken) {
+            send_messages(conn);
+            maybe_free(conn);
+        }
+    }
+
+    // Move a subscriber's waiting messages to its output once the earlier
+    // output is sent, so a slow client's backlog stays in its queue, where the
+    // output buffer limits apply. The next batch follows from on_send.
+    void send_messages(Connection* conn) {
+        Subscriber* sub = conn->ctx.subscriber.get();
+        if (!sub || conn->shut || conn->held || !sub->ready()) {
+            return;
+        }
+        if (sub->over_limit()) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                    "Closing subscriber over its pub/sub output buffer limit");
+            begin_shutdown(conn);
+            return;
+        }
+        if (conn->send_inflight || !conn->out.empty()) {
+            return;
+        }
+        sub->take(conn->out, Subscriber::TAKE_BATCH_BYTES);
+        flush(conn);
+    }
+
+    void arm_accept() {
+        io_uring_sqe* sqe = ring_.next_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_socket_;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = tag(nullptr, OP_ACCEPT);
+    }
+
+    void arm_recv(Connection* conn) {
+        io_uring_sqe* sqe = ring_.next_sqe();
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn->socket;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->user_data = tag(conn, OP_RECV);
+        conn->recv_armed = true;
+    }
+
+    void on_accept(const io_uring_cqe& cqe) {
+        if (cqe.res >= 0) {
+            Connection* conn = new Connection();
+            conn->socket = cqe.res;
+            conn->ctx.wake_subscriber = [this, conn] { wake(conn); };
+            set_nodelay(conn->socket);
+            arm_recv(conn);
+            mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client connected (io_uring)");
+        } else {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Error,
+                                    "io_uring accept failed: " + std::string(std::strerror(-cqe.res)));
+        }
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            arm_accept();
+        }
+    }
+
+    void on_recv(Connection* conn, const io_uring_cqe& cqe) {
+        if (!(cqe.flags & IORING_CQE_F_MORE)) {
+            conn->recv_armed = false;
+        }
+
+        if (cqe.res > 0) {
+            uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            conn->ctx.parser->append(ring_.buffer(bid), static_cast<size_t>(cqe.res));
+            ring_.recycle(bid);
+            if (!conn->shut && !conn->closing && !conn->held) {
+                process_input(conn);
+                flush(conn);
+                send_messages(conn);
+            }
+        } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+            // Orderly shutdown or hard error. ENOBUFS only means every provided
+            // buffer was in use; the recv is re-armed below.
+            begin_shutdown(conn);
+        }
+
+        if (!conn->shut && conn->pending() > OUTPUT_PAUSE_BYTES && !conn->read_paused) {
+            // Resumed from on_send once the client catches up
+            conn->read_paused = true;
+            cancel_recv(conn);
+        }
+        if (wants_recv(conn)) {
+            arm_recv(conn);
+        }
+        maybe_free(conn);
+    }
+
+    // Reading stops while output is over the limit or replies are held, so
+    // input cannot pile up in the parser meanwhile
+    bool wants_recv(const Connection* conn) const {
+        return !conn->recv_armed && !conn->shut && !conn->read_paused && !conn->held;
+    }
+
+    // Stop the multishot recv; completions already queued still arrive
+    void cancel_recv(Connection* conn) {
+        if (conn->recv_armed) {
+            io_uring_sqe* sqe = ring_.next_sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = tag(conn, OP_RECV);
+            sqe->user_data = tag(nullptr, OP_CANCEL);
+        }
+    }
+
+    void on_send(Connection* conn, const io_uring_cqe& cqe) {
+        conn->send_inflight = false;
+        if (cqe.res < 0) {
+            conn->sending.clear();
+            conn->send_offset = 0;
+            begin_shutdown(conn);
+            maybe_free(conn);
+            return;
+        }
+
+        conn->send_offset += static_cast<size_t>(cqe.res);
+        if (conn->send_offset < conn->sending.size() && !conn->shut) {
+            submit_send(conn); // Short write: send the rest
+            return;
+        }
+        conn->sending.clear();
+        conn->send_offset = 0;
+
+        if (!conn->shut) {
+            flush(conn);
+            send_messages(conn);
+            if (conn->closing && !conn->held && !conn->send_inflight) {
+                begin_shutdown(conn);
+            } else if (conn->read_paused && conn->pending() <= OUTPUT_PAUSE_BYTES) {
+                conn->read_paused = false;
+                if (wants_recv(conn)) {
+                    arm_recv(conn);
+                }
+            }
+        }
+        maybe_free(conn);
+    }
+
+    void on_shutdown(Connection* conn, const io_uring_cqe& cqe) {
+        conn->shutdown_inflight = false;
+        if (cqe.res < 0) {
+            // Cancelled because the linked send failed: shut down directly
+            ::shutdown(conn->socket, SHUT_RDWR);
+        }
+        maybe_free(conn);
+    }
+
+    // Run every complete command in the parser, appending replies to conn->out
+    void process_input(Connection* conn) {
+        std::string parse_error;
+        std::vector<protocol::Command> commands = extract_resp_commands(conn->ctx.parser, &parse_error);
+
+        if (commands.empty() && !parse_error.empty()) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "RESP parse error (io_uring): " + parse_error);
+            // Parser discarded the malformed data - connection recovers if next command is valid
+            ReplyWriter(conn->out).error(parse_error);
+            return;
+        }
+
+        for (const auto& cmd : commands) {
+            if (cmd.type == protocol::CommandType::UNKNOWN) {
+                reply_unknown_command(cmd, conn->ctx, conn->out);
+                continue;
+            }
+            mini_redis::detail::CommandResult result = process_command(cmd, conn->ctx, conn->socket, conn->out);
+            if (result.should_quit) {
+                conn->closing = true;
+                break;
+            }
+        }
+        if (uint64_t ticket = take_aof_ticket(conn->ctx)) {
+            // Re-armed when the replies are released
+            conn->held = true;
+            durable_.park(conn, ticket);
+            cancel_recv(conn);
+        }
+
+        if (conn->closing && !conn->held && conn->out.empty() && !conn->send_inflight) {
+            begin_shutdown(conn);
+        }
+    }
+
+    // Queue the accumulated replies as one send. Replies must stay ordered, so a
+    // connection has at most one send in flight; output produced meanwhile is
+    // batched into the next one. After QUIT the final send is linked to a
+    // shutdown so the reply is flushed without another round trip through the loop.
+    void flush(Connection* conn) {
+        if (conn->shut || conn->held || conn->send_inflight || conn->out.empty()) {
+            return;
+        }
+        conn->sending.swap(conn->out);
+        conn->out.clear();
+        conn->send_offset = 0;
+        submit_send(conn);
+    }
+
+    void submit_send(Connection* conn) {
+        const bool last = conn->closing && conn->out.empty();
+        ring_.reserve(last ? 2 : 1);
+
+        io_uring_sqe* sqe = ring_.next_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->socket;
+        sqe->addr = reinterpret_cast<uint64_t>(conn->sending.data() + conn->send_offset);
+        sqe->len = static_cast<uint32_t>(conn->sending.size() - conn->send_offset);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = tag(conn, OP_SEND);
+        conn->send_inflight = true;
+
+        if (last) {
+            // A short send would break the link, so ask for all of it
+            sqe->msg_flags |= MSG_WAITALL;
+            sqe->flags |= IOSQE_IO_LINK;
+
+            io_uring_sqe* shut = ring_.next_sqe();
+            shut->opcode = IORING_OP_SHUTDOWN;
+            shut->fd = conn->socket;
+            shut->len = SHUT_RDWR;
+            shut->user_data = tag(conn, OP_SHUTDOWN);
+            conn->shutdown_inflight = true;
+            conn->shut = true;
+        }
+    }
+
+    // Shutting the socket down ends the multishot recv and any in-flight send;
+    // the Connection is freed when their final completions arrive
+    void begin_shutdown(Connection* conn) {
+        if (conn->shut) {
+            return;
+        }
+        conn->shut = true;
+        ::shutdown(conn->socket, SHUT_RDWR);
+    }
+
+    void maybe_free(Connection* conn) {
+        if (!conn->shut || conn->recv_armed || conn->send_inflight || conn->shutdown_inflight) {
+            return;
+        }
+        // Once it has left its channels no publisher can wake it again
+        if (conn->ctx.subscriber) {
+            conn->ctx.subscriber.reset();
+            std::lock_guard<std::mutex> lock(woken_mutex_);
+            woken_.erase(std::remove(woken_.begin(), woken_.end(), conn), woken_.end());
+        }
+        mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client disconnected (io_uring, processed " +
+                                std::to_string(conn->ctx.request_count) + " requests)");
+        durable_.forget(conn);
+        closesocket(conn->socket);
+        delete conn;
+    }
+
+    Ring ring_;
+    SOCKET listen_socket_;
+    int wake_fd_;
+    uint64_t wake_count_ = 0; // Target of the posted eventfd read
+    std::mutex woken_mutex_;
+    std::vector<Connection*> woken_; // Subscribers with messages waiting
+    DurableWaits<Connection*> durable_; // Connections whose replies wait for the AOF
+};
+
+// Check that this kernel supports everything the server needs before committing to it
+bool io_uring_available() {
+    Ring probe;
+    return probe.init(8) && probe.register_buffers(BUFFER_GROUP, 8, 64);
+}
+
+} // anonymous namespace
+
+int start_server_io_uring(const Config& cfg) {
+    if (!io_uring_available()) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                "io_uring is unavailable (" + std::string(std::strerror(errno)) +
+                                "), using the event loop server");
+        return start_server_event_loop(cfg);
+    }
+
+    if (!net_init()) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Socket library initialization failed");
+        return 1;
+    }
+
+    const int port = cfg.port;
+    start_services(cfg);
+
+    SOCKET listen_socket = open_listen_socket(port);
+    if (listen_socket == INVALID_SOCKET) {
+        return 1;
+    }
+
+    // Every ring posts its own multishot accept on the shared listen socket,
+    // so the kernel spreads new connections across the loops
+    const unsigned loop_count = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::unique_ptr<UringLoop>> loops;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < loop_count; ++i) {
+        loops.push_back(std::make_unique<UringLoop>(listen_socket));
+        threads.push_back(loops.back()->start());
+    }
+
+    mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Mini-Redis io_uring server running on port " +
+                            std::to_string(port) + " (" + std::to_string(loop_count) + " rings)");
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    stop_services();
+    closesocket(listen_socket);
+    return 0;
+}
+
+} // namespace mini_redis
+
+#else
+
+namespace mini_redis {
+
+// io_uring is Linux-only (multishot recv needs 6.0 headers); use the native event loop
+int start_server_io_uring(const Config& cfg) {
+    mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                            "io_uring is not available in this build, using the event loop server");
+    return start_server_event_loop(cfg);
+}
+
+} // namespace mini_redis
+
+#endif
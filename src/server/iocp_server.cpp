@@ -1,5 +1,14 @@
 // IOCP-based server implementation for Mini-Redis
 // Uses AcceptEx and asynchronous I/O with completion ports
+// Replies are sent as one WSABUF chain per batch: the serialized bytes plus
+// large values referenced straight from the store, which stay pinned by their
+// ValueRefs until the send completes; a partial send posts the rest
+// A PUBLISH wakes an idle subscriber by cancelling its pending read; the
+// worker that gets the aborted read sends the waiting messages and posts a new
+// read. A busy subscriber sends them before its next read.
+// Under appendfsync always a batch's replies wait, with no I/O posted, until
+// the AOF writer reports its writes on disk and posts the context back to the
+// port, so no worker sits blocked on an fsync.
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -9,8 +18,6 @@
 #include <mswsock.h>
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "mswsock.lib")
-#else
-#error "This implementation currently supports only Windows (Winsock)."
 #endif
 
 #include "server/tcp_server.hpp"
@@ -21,7 +28,9 @@
 #include "../protocol/resp_parser.hpp"
 #include "../storage/kv_store.hpp"
 #include "../storage/aof_logger.hpp"
+#include "../storage/active_expirer.hpp"
 #include "replication.hpp"
+#include "pubsub.hpp"
 
 #include <string>
 #include <thread>
@@ -33,45 +42,119 @@
 #include <mutex>
 #include <atomic>
 #include <fstream>
+#include <memory>
+#include <algorithm>
 
 #include "server/server_common.hpp"
 
-namespace mini_redis {
+#ifdef _WIN32
 
-// Forward declarations for shared functions from tcp_server.cpp
-std::vector<std::vector<std::string>> extract_resp_commands(RespParser* parser, std::string* error_msg = nullptr);
-mini_redis::detail::CommandResult process_command(const protocol::Command& cmd, mini_redis::detail::ClientContext& ctx, SOCKET client_socket);
-KVStore& get_db(mini_redis::detail::ClientContext& ctx);
+namespace mini_redis {
 
 namespace {
 
-// IOCP client context: extends ClientContext with async I/O structures
+constexpr size_t READ_BUFFER_SIZE = 16 * 1024;
+constexpr size_t CONTEXTS_PER_SLAB = 64;
+// Request and reply buffers that grew past this are freed when their connection
+// ends, so idle pooled contexts do not pin the memory of one large command
+constexpr size_t MAX_RETAINED_BUFFER = 1024 * 1024;
+constexpr DWORD ACCEPT_ADDRESS_SIZE = sizeof(sockaddr_in) + 16;
+constexpr size_t MAX_SEND_PIECES = 64; // WSABUFs per WSASend
+
+// IOCP client context: extends ClientContext with async I/O structures.
+// Contexts come from a pool and are reused: the same context serves its AcceptEx
+// and then the connection it accepted, and goes back to the pool on disconnect.
 struct IOCPClientContext {
     mini_redis::detail::ClientContext ctx;  // Reuse existing context
     OVERLAPPED overlapped;       // For async operations
     WSABUF wsa_buf;              // Buffer descriptor
-    char read_buffer[4096];      // Read buffer
-    std::string write_buffer;    // Accumulated write data
-    std::string pending_write;   // Data being written (kept alive during async op)
+    char* read_buffer = nullptr; // READ_BUFFER_SIZE bytes in the slab's read block
+    char accept_buffer[2 * ACCEPT_ADDRESS_SIZE]; // Addresses written by AcceptEx
+    ReplyChain out;              // Replies to send (unchanged while a send is in flight)
     SOCKET socket;               // Client socket
-    enum Operation { OP_READ, OP_WRITE, OP_ACCEPT } operation;
+    enum Operation { OP_READ, OP_WRITE, OP_ACCEPT, OP_DURABLE } operation;
+    IOCPClientContext* next_free = nullptr; // Free list link while pooled
+    std::mutex read_mutex;       // Guards the read flags against publishers' wakes
+    bool read_posted = false;    // A read is pending and may be cancelled
+    bool read_cancelled = false; // A wake cancelled the pending read
+    bool aof_failed = false;     // OP_DURABLE: the AOF failed before the held replies were durable
+    bool close_after_write = false; // Disconnect once out is sent
     
     IOCPClientContext() : socket(INVALID_SOCKET), operation(OP_READ) {
         ZeroMemory(&overlapped, sizeof(OVERLAPPED));
-        wsa_buf.buf = read_buffer;
-        wsa_buf.len = sizeof(read_buffer);
+        ctx.replies = &out;
     }
 };
 
-// Accept context for AcceptEx operations
-struct AcceptContext {
-    OVERLAPPED overlapped;
-    SOCKET accept_socket;
-    char buffer[2 * (sizeof(sockaddr_in) + 16)]; // Required for AcceptEx
-    
-    AcceptContext() : accept_socket(INVALID_SOCKET) {
-        ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+// Free list of client contexts, grown a slab at a time: one slab is
+// CONTEXTS_PER_SLAB contexts (each with its parser already built) and one block
+// holding all their read buffers. Slabs are kept until the server exits, so
+// accepting a connection allocates nothing once the pool has warmed up.
+class ContextPool {
+public:
+    // Keep a buffer's capacity for the next connection unless it grew too large
+    static void trim(std::string& buffer) {
+        if (buffer.capacity() > MAX_RETAINED_BUFFER) {
+            std::string().swap(buffer);
+        } else {
+            buffer.clear();
+        }
+    }
+
+    IOCPClientContext* acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_ == nullptr) {
+            add_slab();
+        }
+        IOCPClientContext* client_ctx = free_;
+        free_ = client_ctx->next_free;
+        client_ctx->next_free = nullptr;
+        return client_ctx;
+    }
+
+    // Return a context whose socket is closed and has no I/O in flight
+    void release(IOCPClientContext* client_ctx) {
+        client_ctx->socket = INVALID_SOCKET;
+        client_ctx->read_posted = false;
+        client_ctx->read_cancelled = false;
+        client_ctx->aof_failed = false;
+        client_ctx->close_after_write = false;
+        client_ctx->out.clear();
+        trim(client_ctx->out.bytes);
+        if (client_ctx->ctx.parser && client_ctx->ctx.parser->capacity() > MAX_RETAINED_BUFFER) {
+            delete client_ctx->ctx.parser;
+            client_ctx->ctx.parser = nullptr;
+        }
+        client_ctx->ctx.reset();
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        client_ctx->next_free = free_;
+        free_ = client_ctx;
+    }
+
+private:
+    struct Slab {
+        std::unique_ptr<IOCPClientContext[]> contexts;
+        std::unique_ptr<char[]> read_buffers;
+    };
+
+    // mutex_ held
+    void add_slab() {
+        Slab slab;
+        slab.contexts.reset(new IOCPClientContext[CONTEXTS_PER_SLAB]);
+        slab.read_buffers.reset(new char[CONTEXTS_PER_SLAB * READ_BUFFER_SIZE]);
+        for (size_t i = CONTEXTS_PER_SLAB; i-- > 0;) {
+            IOCPClientContext* client_ctx = &slab.contexts[i];
+            client_ctx->read_buffer = slab.read_buffers.get() + i * READ_BUFFER_SIZE;
+            client_ctx->next_free = free_;
+            free_ = client_ctx;
+        }
+        slabs_.push_back(std::move(slab));
     }
+
+    std::mutex mutex_;
+    std::vector<Slab> slabs_;
+    IOCPClientContext* free_ = nullptr;
 };
 
 HANDLE g_completion_port = INVALID_HANDLE_VALUE;
@@ -79,6 +162,12 @@ SOCKET g_listen_socket = INVALID_SOCKET;
 LPFN_ACCEPTEX g_AcceptEx = nullptr;
 std::atomic<bool> g_running{true};
 const int WORKER_THREAD_COUNT = 6;
+ContextPool g_pool;
+int g_accept_target = 16;            // AcceptEx calls to keep outstanding (--iocp-accepts)
+std::atomic<int> g_pending_accepts{0};
+// Clients whose replies wait for the AOF fsync, with their tickets
+std::mutex g_durable_mutex;
+std::vector<std::pair<IOCPClientContext*, uint64_t>> g_durable_waits;
 
 // Load AcceptEx function pointer
 bool load_acceptex(SOCKET listen_socket) {
@@ -98,39 +187,90 @@ bool load_acceptex(SOCKET listen_socket) {
     return result == 0;
 }
 
-// Post a new AcceptEx operation
-void post_accept(SOCKET listen_socket) {
-    AcceptContext* accept_ctx = new AcceptContext();
-    accept_ctx->accept_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    
-    if (accept_ctx->accept_socket == INVALID_SOCKET) {
-        delete accept_ctx;
-        return;
+// Post an AcceptEx operation into a pooled context; on failure the context goes
+// back to the pool
+bool post_accept(IOCPClientContext* client_ctx) {
+    client_ctx->operation = IOCPClientContext::OP_ACCEPT;
+    client_ctx->socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (client_ctx->socket == INVALID_SOCKET) {
+        g_pool.release(client_ctx);
+        return false;
     }
+    ZeroMemory(&client_ctx->overlapped, sizeof(OVERLAPPED));
     
+    // Count the accept before posting: its completion may run on another worker first
+    ++g_pending_accepts;
     DWORD bytes = 0;
     BOOL result = g_AcceptEx(
-        listen_socket,
-        accept_ctx->accept_socket,
-        accept_ctx->buffer,
+        g_listen_socket,
+        client_ctx->socket,
+        client_ctx->accept_buffer,
         0,
-        sizeof(sockaddr_in) + 16,
-        sizeof(sockaddr_in) + 16,
+        ACCEPT_ADDRESS_SIZE,
+        ACCEPT_ADDRESS_SIZE,
         &bytes,
-        &accept_ctx->overlapped
+        &client_ctx->overlapped
     );
     
     if (!result && WSAGetLastError() != WSA_IO_PENDING) {
-        closesocket(accept_ctx->accept_socket);
-        delete accept_ctx;
+        --g_pending_accepts;
+        closesocket(client_ctx->socket);
+        g_pool.release(client_ctx);
+        return false;
+    }
+    return true;
+}
+
+// Post accepts until the configured number is outstanding
+void top_up_accepts() {
+    while (g_running && g_pending_accepts < g_accept_target) {
+        if (!post_accept(g_pool.acquire())) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                    "AcceptEx failed with error " + std::to_string(WSAGetLastError()));
+            return;
+        }
     }
 }
 
-// Post a read operation for a client
+// Close a client's connection and return its context to the pool
+void close_client(IOCPClientContext* client_ctx) {
+    // Once it has left its channels no publisher can wake it again
+    client_ctx->ctx.subscriber.reset();
+    closesocket(client_ctx->socket);
+    g_pool.release(client_ctx);
+}
+
+void send_messages(IOCPClientContext* client_ctx);
+
+// A publisher queued messages for the client (any thread): an idle client's
+// read is cancelled so a worker picks the messages up
+void wake(IOCPClientContext* client_ctx) {
+    std::lock_guard<std::mutex> lock(client_ctx->read_mutex);
+    if (client_ctx->read_posted && !client_ctx->read_cancelled) {
+        client_ctx->read_cancelled = true;
+        CancelIoEx(reinterpret_cast<HANDLE>(client_ctx->socket), &client_ctx->overlapped);
+    }
+}
+
+// A read completed; returns true if a wake cancelled it
+bool finish_read(IOCPClientContext* client_ctx) {
+    std::lock_guard<std::mutex> lock(client_ctx->read_mutex);
+    client_ctx->read_posted = false;
+    return std::exchange(client_ctx->read_cancelled, false);
+}
+
+// Post a read operation for a client, unless pub/sub messages are waiting:
+// those are sent first
 void post_read(IOCPClientContext* client_ctx) {
+    std::unique_lock<std::mutex> lock(client_ctx->read_mutex);
+    if (client_ctx->ctx.subscriber && client_ctx->ctx.subscriber->ready()) {
+        lock.unlock();
+        send_messages(client_ctx);
+        return;
+    }
     client_ctx->operation = IOCPClientContext::OP_READ;
     client_ctx->wsa_buf.buf = client_ctx->read_buffer;
-    client_ctx->wsa_buf.len = sizeof(client_ctx->read_buffer);
+    client_ctx->wsa_buf.len = static_cast<ULONG>(READ_BUFFER_SIZE);
     ZeroMemory(&client_ctx->overlapped, sizeof(OVERLAPPED));
     
     DWORD flags = 0;
@@ -146,14 +286,61 @@ void post_read(IOCPClientContext* client_ctx) {
     
     if (result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
         // Error - close connection
-        closesocket(client_ctx->socket);
-        delete client_ctx;
+        lock.unlock();
+        close_client(client_ctx);
+        return;
+    }
+    // Set under the lock the wakes take, so a message queued after the check
+    // above finds the read to cancel
+    client_ctx->read_posted = true;
+}
+
+void post_write(IOCPClientContext* client_ctx);
+
+// Send the replies once the AOF has their writes on disk; until then the
+// client has no I/O posted
+void post_write_when_durable(IOCPClientContext* client_ctx) {
+    uint64_t ticket = take_aof_ticket(client_ctx->ctx);
+    if (ticket != 0) {
+        // Checked again under the lock the AOF writer's listener takes, so
+        // an fsync finishing right now still finds the client
+        std::lock_guard<std::mutex> lock(g_durable_mutex);
+        if (!aof_durable(ticket)) {
+            if (!aof_write_failed()) {
+                g_durable_waits.emplace_back(client_ctx, ticket);
+                return;
+            }
+            client_ctx->out.clear();
+            ReplyWriter(client_ctx->out).error(aof_failure_error());
+            client_ctx->close_after_write = true;
+        }
     }
+    post_write(client_ctx);
 }
 
-// Post a write operation for a client
+// AOF writer thread: hand every client whose writes are now durable (or, once
+// the AOF has failed, every waiting client) back to a worker
+void release_durable() {
+    std::lock_guard<std::mutex> lock(g_durable_mutex);
+    const bool failed = aof_write_failed();
+    auto still_waiting = std::stable_partition(
+        g_durable_waits.begin(), g_durable_waits.end(),
+        [failed](const std::pair<IOCPClientContext*, uint64_t>& entry) {
+            return !failed && !aof_durable(entry.second);
+        });
+    for (auto it = still_waiting; it != g_durable_waits.end(); ++it) {
+        IOCPClientContext* client_ctx = it->first;
+        client_ctx->operation = IOCPClientContext::OP_DURABLE;
+        client_ctx->aof_failed = !aof_durable(it->second);
+        ZeroMemory(&client_ctx->overlapped, sizeof(OVERLAPPED));
+        PostQueuedCompletionStatus(g_completion_port, 0, 0, &client_ctx->overlapped);
+    }
+    g_durable_waits.erase(still_waiting, g_durable_waits.end());
+}
+
+// Post a write of everything pending for a client, as one WSABUF chain
 void post_write(IOCPClientContext* client_ctx) {
-    if (client_ctx->write_buffer.empty()) {
+    if (client_ctx->out.pending() == 0) {
         // No data to write, post next read
         post_read(client_ctx);
         return;
@@ -161,20 +348,21 @@ void post_write(IOCPClientContext* client_ctx) {
     
     client_ctx->operation = IOCPClientContext::OP_WRITE;
     
-    // Move write buffer to pending_write to keep it alive during async operation
-    client_ctx->pending_write = std::move(client_ctx->write_buffer);
-    client_ctx->write_buffer.clear();
-    
-    WSABUF wsa_buf;
-    wsa_buf.buf = const_cast<char*>(client_ctx->pending_write.c_str());
-    wsa_buf.len = static_cast<ULONG>(client_ctx->pending_write.size());
+    // No read is posted while the send is in flight, so the chain stays unchanged
+    WSABUF wsa_bufs[MAX_SEND_PIECES];
+    DWORD count = 0;
+    client_ctx->out.gather(MAX_SEND_PIECES, [&](std::string_view piece, const ValueRef*) {
+        wsa_bufs[count].buf = const_cast<char*>(piece.data());
+        wsa_bufs[count].len = static_cast<ULONG>(piece.size());
+        ++count;
+    });
     ZeroMemory(&client_ctx->overlapped, sizeof(OVERLAPPED));
     
     DWORD bytes_sent = 0;
     int result = WSASend(
         client_ctx->socket,
-        &wsa_buf,
-        1,
+        wsa_bufs,
+        count,
         &bytes_sent,
         0,
         &client_ctx->overlapped,
@@ -183,11 +371,102 @@ void post_write(IOCPClientContext* client_ctx) {
     
     if (result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
         // Error - close connection
-        closesocket(client_ctx->socket);
-        delete client_ctx;
+        close_client(client_ctx);
     }
 }
 
+// Send a batch of a subscriber's waiting messages; no I/O is in flight. The
+// next batch follows when the write completes, so a slow client's backlog
+// stays in its queue, where the output buffer limits apply.
+void send_messages(IOCPClientContext* client_ctx) {
+    Subscriber* sub = client_ctx->ctx.subscriber.get();
+    if (sub->over_limit()) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                "Closing subscriber over its pub/sub output buffer limit");
+        close_client(client_ctx);
+        return;
+    }
+    sub->take(client_ctx->out, Subscriber::TAKE_BATCH_BYTES);
+    post_write(client_ctx);
+}
+
+// An AcceptEx completed: the context now serves the accepted connection
+void on_accept(IOCPClientContext* client_ctx) {
+    // Update accept context
+    setsockopt(
+        client_ctx->socket,
+        SOL_SOCKET,
+        SO_UPDATE_ACCEPT_CONTEXT,
+        reinterpret_cast<char*>(&g_listen_socket),
+        sizeof(g_listen_socket)
+    );
+    
+    // Associate accepted socket with completion port (using client context as key)
+    CreateIoCompletionPort(
+        reinterpret_cast<HANDLE>(client_ctx->socket),
+        g_completion_port,
+        reinterpret_cast<ULONG_PTR>(client_ctx),
+        0
+    );
+    
+    mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client connected (IOCP)");
+    client_ctx->ctx.wake_subscriber = [client_ctx] { wake(client_ctx); };
+    post_read(client_ctx);
+}
+
+// A read completed with bytes_transferred bytes in the read buffer
+void on_read(IOCPClientContext* client_ctx, DWORD bytes_transferred) {
+    if (bytes_transferred == 0) {
+        // Client disconnected
+        mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client disconnected (IOCP)");
+        close_client(client_ctx);
+        return;
+    }
+    
+    // Append received data to parser
+    // Note: client_ctx->read_buffer is the raw socket buffer from the slab
+    // Parser maintains its own buffer and handles binary data correctly
+    if (client_ctx->ctx.parser) {
+        client_ctx->ctx.parser->append(client_ctx->read_buffer, bytes_transferred);
+    }
+    
+    // Extract and process RESP commands
+    std::string parse_error;
+    std::vector<protocol::Command> resp_commands = extract_resp_commands(client_ctx->ctx.parser, &parse_error);
+    
+    // If we got a parse error and no commands, send error and log details
+    if (resp_commands.empty() && !parse_error.empty()) {
+        // Log the parse error with buffer context for debugging
+        mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "RESP parse error (IOCP): " + parse_error);
+        ReplyWriter(client_ctx->out).error(parse_error);
+        // Parser discarded the malformed data - connection recovers if next command is valid
+        post_write(client_ctx);
+        return;
+    }
+    
+    // Process each command
+    for (const auto& cmd : resp_commands) {
+        // Handle parse errors
+        if (cmd.type == protocol::CommandType::UNKNOWN) {
+            reply_unknown_command(cmd, client_ctx->ctx, client_ctx->out.bytes);
+            continue;
+        }
+        
+        // Reply is serialized straight into the connection's write buffer
+        mini_redis::detail::CommandResult result =
+            process_command(cmd, client_ctx->ctx, client_ctx->socket, client_ctx->out.bytes);
+        
+        if (result.should_quit) {
+            // Client wants to quit
+            close_client(client_ctx);
+            return;
+        }
+    }
+    
+    // Post write if we have data, otherwise post next read
+    post_write_when_durable(client_ctx);
+}
+
 // Worker thread function
 DWORD WINAPI worker_thread(LPVOID param) {
     (void)param; // Unused parameter - required by WINAPI signature
@@ -203,162 +482,65 @@ DWORD WINAPI worker_thread(LPVOID param) {
             &overlapped,
             INFINITE
         );
+        const DWORD error = success ? 0 : GetLastError();
         
-        if (!success) {
-            if (overlapped == nullptr) {
-                // Shutdown signal
-                break;
-            }
-            // Error - cleanup
-            if (completion_key == 0) {
-                // Accept context
-                AcceptContext* accept_ctx = CONTAINING_RECORD(overlapped, AcceptContext, overlapped);
-                closesocket(accept_ctx->accept_socket);
-                delete accept_ctx;
-                // Post new accept
-                if (g_running) {
-                    post_accept(g_listen_socket);
-                }
+        if (overlapped == nullptr) {
+            // Shutdown signal
+            break;
+        }
+        
+        // Every operation is posted with its context's OVERLAPPED
+        IOCPClientContext* client_ctx = CONTAINING_RECORD(overlapped, IOCPClientContext, overlapped);
+        
+        if (client_ctx->operation == IOCPClientContext::OP_ACCEPT) {
+            --g_pending_accepts;
+            if (success) {
+                on_accept(client_ctx);
             } else {
-                // Client context
-                IOCPClientContext* client_ctx = reinterpret_cast<IOCPClientContext*>(completion_key);
                 closesocket(client_ctx->socket);
-                // Cleanup from channels
-                {
-                    std::lock_guard<std::mutex> lock(mini_redis::detail::channels_mutex);
-                    for (auto& pair : mini_redis::detail::channels) {
-                        pair.second.erase(client_ctx->socket);
-                    }
-                }
-                delete client_ctx;
+                g_pool.release(client_ctx);
             }
-            continue;
-        }
-        
-        if (completion_key == 0) {
-            // Accept completion
-            AcceptContext* accept_ctx = CONTAINING_RECORD(overlapped, AcceptContext, overlapped);
-            
-            // Update accept context
-            setsockopt(
-                accept_ctx->accept_socket,
-                SOL_SOCKET,
-                SO_UPDATE_ACCEPT_CONTEXT,
-                reinterpret_cast<char*>(&g_listen_socket),
-                sizeof(g_listen_socket)
-            );
-            
-            // Create client context
-            IOCPClientContext* client_ctx = new IOCPClientContext();
-            client_ctx->socket = accept_ctx->accept_socket;
-            
-            // Associate accepted socket with completion port (using client context as key)
-            CreateIoCompletionPort(
-                reinterpret_cast<HANDLE>(client_ctx->socket),
-                g_completion_port,
-                reinterpret_cast<ULONG_PTR>(client_ctx),
-                0
-            );
-            
-            mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client connected (IOCP)");
-            post_read(client_ctx);
-            
-            // Post new accept (cleanup accept context, socket is now owned by client_ctx)
-            delete accept_ctx;
-            if (g_running) {
-                post_accept(g_listen_socket);
+            // Replace the accept that just completed
+            top_up_accepts();
+        } else if (client_ctx->operation == IOCPClientContext::OP_DURABLE) {
+            // Posted by release_durable: the held replies can go out, or an
+            // error goes in their place and the client is disconnected
+            if (client_ctx->aof_failed) {
+                client_ctx->out.clear();
+                ReplyWriter(client_ctx->out).error(aof_failure_error());
+                client_ctx->close_after_write = true;
             }
-        } else {
-            // Client I/O completion
-            IOCPClientContext* client_ctx = reinterpret_cast<IOCPClientContext*>(completion_key);
-            
-            if (client_ctx->operation == IOCPClientContext::OP_READ) {
-                if (bytes_transferred == 0) {
-                    // Client disconnected
-                    closesocket(client_ctx->socket);
-                    {
-                        std::lock_guard<std::mutex> lock(mini_redis::detail::channels_mutex);
-                        for (auto& pair : mini_redis::detail::channels) {
-                            pair.second.erase(client_ctx->socket);
-                        }
-                    }
-                    mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client disconnected (IOCP)");
-                    delete client_ctx;
-                    continue;
-                }
-                
-                // Append received data to parser
-                // Note: client_ctx->read_buffer is the raw socket buffer (char[4096])
-                // Parser maintains its own buffer and handles binary data correctly
-                if (client_ctx->ctx.parser) {
-                    client_ctx->ctx.parser->append(client_ctx->read_buffer, bytes_transferred);
-                }
-                
-                // Extract and process RESP commands
-                std::string parse_error;
-                std::vector<std::vector<std::string>> resp_commands = extract_resp_commands(client_ctx->ctx.parser, &parse_error);
-                
-                // If we got a parse error and no commands, send error and log details
-                if (resp_commands.empty() && !parse_error.empty()) {
-                    // Log the parse error with buffer context for debugging
-                    mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "RESP parse error (IOCP): " + parse_error);
-                    std::string error_reply = resp_err(parse_error);
-                    client_ctx->write_buffer += error_reply;
-                    // Post write if we have data, otherwise post next read
-                    // Don't clear buffer - allows connection to recover if next command is valid
-                    if (!client_ctx->write_buffer.empty()) {
-                        post_write(client_ctx);
-                    } else {
-                        post_read(client_ctx);
-                    }
-                    goto next_operation;
-                }
-                
-                // Process each command
-                for (const auto& resp_array : resp_commands) {
-                    // Convert RESP array to Command struct
-                    protocol::Command cmd = protocol::command_from_resp_array(resp_array);
-                    
-                    // Handle parse errors
-                    if (cmd.type == protocol::CommandType::UNKNOWN && !resp_array.empty()) {
-                        std::string error_reply = resp_err("ERR unknown command '" + resp_array[0] + "'");
-                        client_ctx->write_buffer += error_reply;
-                        continue;
-                    }
-                    
-                    mini_redis::detail::CommandResult result = process_command(cmd, client_ctx->ctx, client_ctx->socket);
-                    
-                    // Accumulate reply
-                    client_ctx->write_buffer += result.reply;
-                    
-                    if (result.should_quit) {
-                        // Client wants to quit
-                        closesocket(client_ctx->socket);
-                        {
-                            std::lock_guard<std::mutex> lock(mini_redis::detail::channels_mutex);
-                            for (auto& pair : mini_redis::detail::channels) {
-                                pair.second.erase(client_ctx->socket);
-                            }
-                        }
-                        delete client_ctx;
-                        goto next_operation;
-                    }
-                }
-                
-                // Post write if we have data, otherwise post next read
-                if (!client_ctx->write_buffer.empty()) {
-                    post_write(client_ctx);
-                } else {
-                    post_read(client_ctx);
-                }
-            } else if (client_ctx->operation == IOCPClientContext::OP_WRITE) {
-                // Write completed, clear pending write and post next read
-                client_ctx->pending_write.clear();
+            post_write(client_ctx);
+        } else if (client_ctx->operation == IOCPClientContext::OP_READ) {
+            if (finish_read(client_ctx) && error == ERROR_OPERATION_ABORTED) {
+                // Cancelled by a publisher: the new read sends the messages first
                 post_read(client_ctx);
+            } else if (!success) {
+                close_client(client_ctx);
+            } else {
+                on_read(client_ctx, bytes_transferred);
+            }
+        } else if (!success) {
+            // Error - cleanup
+            close_client(client_ctx);
+        } else {
+            // Write completed: drop what was sent, releasing spliced values
+            client_ctx->out.consume(bytes_transferred);
+            if (client_ctx->out.pending() > 0) {
+                // Partial send: post the rest
+                post_write(client_ctx);
+                continue;
+            }
+            if (client_ctx->close_after_write) {
+                close_client(client_ctx);
+                continue;
+            }
+            // Keep the buffer for the next reply unless a large one left it oversized
+            if (client_ctx->out.bytes.capacity() > MAX_RETAINED_BUFFER) {
+                std::string().swap(client_ctx->out.bytes);
             }
+            post_read(client_ctx);
         }
-        
-        next_operation:;
     }
     return 0;
 }
@@ -375,30 +557,13 @@ bool init_winsock() {
 
 } // anonymous namespace
 
-int start_server_iocp(int port) {
+int start_server_iocp(const Config& cfg) {
     if (!init_winsock()) {
         return 1;
     }
     
-    // Initialize AOF logger (shared with tcp_server)
-    // Note: This creates a separate instance; in production, these should share the same instance
-    static AOFLogger aof_logger("mini_redis.aof");
-    g_aof_logger = &aof_logger;
-    g_aof_logger->start();
-    
-    // Replay AOF file on startup if it exists
-    std::ifstream aof_check("mini_redis.aof");
-    if (aof_check.good()) {
-        aof_check.close();
-        if (g_aof_logger->replay(mini_redis::detail::databases[0])) {
-            mini_redis::Logger::log(mini_redis::Logger::Level::Info, "AOF file replayed successfully");
-        }
-    }
-    
-    // Initialize replication manager
-    static ReplicationManager replication_manager;
-    g_replication_manager = &replication_manager;
-    g_replication_manager->start();
+    const int port = cfg.port;
+    start_services(cfg);
     
     // Create completion port
     g_completion_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
@@ -409,9 +574,8 @@ int start_server_iocp(int port) {
     }
     
     // Create listen socket
-    g_listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    g_listen_socket = open_listen_socket(port);
     if (g_listen_socket == INVALID_SOCKET) {
-        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "socket() failed");
         CloseHandle(g_completion_port);
         WSACleanup();
         return 1;
@@ -420,30 +584,6 @@ int start_server_iocp(int port) {
     // Associate listen socket with completion port
     CreateIoCompletionPort(reinterpret_cast<HANDLE>(g_listen_socket), g_completion_port, 0, 0);
     
-    char yes = 1;
-    setsockopt(g_listen_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-    
-    sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(static_cast<u_short>(port));
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    
-    if (bind(g_listen_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR) {
-        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "bind() failed");
-        closesocket(g_listen_socket);
-        CloseHandle(g_completion_port);
-        WSACleanup();
-        return 1;
-    }
-    
-    if (listen(g_listen_socket, SOMAXCONN) == SOCKET_ERROR) {
-        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "listen() failed");
-        closesocket(g_listen_socket);
-        CloseHandle(g_completion_port);
-        WSACleanup();
-        return 1;
-    }
-    
     // Load AcceptEx
     if (!load_acceptex(g_listen_socket)) {
         mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Failed to load AcceptEx");
@@ -464,10 +604,11 @@ int start_server_iocp(int port) {
         }
     }
     
-    // Post initial AcceptEx operations
-    for (int i = 0; i < 10; ++i) {
-        post_accept(g_listen_socket);
-    }
+    on_aof_durable(release_durable);
+
+    // Post the initial AcceptEx operations; each completion posts a replacement
+    g_accept_target = std::max(1, cfg.iocp_accepts);
+    top_up_accepts();
     
     // Main loop - just wait (worker threads handle everything)
     while (g_running) {
@@ -488,15 +629,8 @@ int start_server_iocp(int port) {
         CloseHandle(thread);
     }
     
-    // Cleanup AOF logger
-    if (g_aof_logger) {
-        g_aof_logger->stop();
-    }
-    
-    // Cleanup replication manager
-    if (g_replication_manager) {
-        g_replication_manager->stop();
-    }
+    // Stop AOF logging, replication and active expiry
+    stop_services();
     
     closesocket(g_listen_socket);
     CloseHandle(g_completion_port);
@@ -506,3 +640,17 @@ int start_server_iocp(int port) {
 
 } // namespace mini_redis
 
+#else
+
+namespace mini_redis {
+
+// IOCP is Windows-only; elsewhere --iocp selects the native event loop
+int start_server_iocp(const Config& cfg) {
+    mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                            "IOCP is only available on Windows, using the event loop server");
+    return start_server_event_loop(cfg);
+}
+
+} // namespace mini_redis
+
+#endif // _WIN32
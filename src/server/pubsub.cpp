@@ -0,0 +1,191 @@
+// Pub/Sub implementation
+
+#include "pubsub.hpp"
+#include "../protocol/resp_utils.hpp"
+
+#include <chrono>
+
+namespace {
+
+int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // anonymous namespace
+
+namespace mini_redis {
+
+Subscriber::Subscriber(PubSub& hub, Wake wake, uint64_t client)
+    : hub_(hub), wake_(std::move(wake)), client_(client) {
+    if (client_ != 0) {
+        std::unique_lock<std::shared_mutex> lock(hub_.mutex_);
+        hub_.clients_[client_] = this;
+    }
+}
+
+Subscriber::~Subscriber() {
+    hub_.unsubscribe_all(*this);
+    if (client_ != 0) {
+        std::unique_lock<std::shared_mutex> lock(hub_.mutex_);
+        hub_.clients_.erase(client_);
+    }
+}
+
+void Subscriber::push(const ValueRef& message) {
+    const PubSub::Limits& limits = hub_.limits_;
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (overflowed_) {
+            return;
+        }
+        // The owner is already woken for a non-empty queue
+        wake = queue_.empty();
+        queue_.push_back(message);
+        queued_bytes_ += message.size();
+
+        if (limits.hard > 0 && queued_bytes_ > limits.hard) {
+            overflowed_ = true;
+        } else {
+            check_soft_limit(steady_ms());
+        }
+        if (overflowed_) {
+            queue_.clear();
+            queued_bytes_ = 0;
+            hub_.limit_disconnections_.fetch_add(1, std::memory_order_relaxed);
+            wake = true;
+        }
+    }
+    if (wake && wake_) {
+        wake_();
+    }
+}
+
+void Subscriber::check_soft_limit(int64_t now_ms) {
+    const PubSub::Limits& limits = hub_.limits_;
+    if (limits.soft == 0 || queued_bytes_ <= limits.soft) {
+        soft_since_ms_ = 0;
+        return;
+    }
+    if (soft_since_ms_ == 0) {
+        soft_since_ms_ = now_ms;
+    } else if (now_ms - soft_since_ms_ >= limits.soft_seconds * 1000) {
+        overflowed_ = true;
+    }
+}
+
+template <typename Sink>
+bool Subscriber::take_locked(size_t max_bytes, Sink&& sink) {
+    if (overflowed_) {
+        return false;
+    }
+    size_t taken = 0;
+    while (!queue_.empty() && (taken == 0 || taken + queue_.front().size() <= max_bytes)) {
+        taken += queue_.front().size();
+        sink(std::move(queue_.front()));
+        queue_.pop_front();
+    }
+    queued_bytes_ -= taken;
+    if (soft_since_ms_ != 0) {
+        check_soft_limit(steady_ms());
+    }
+    return !overflowed_;
+}
+
+bool Subscriber::take(ReplyChain& out, size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return take_locked(max_bytes, [&out](ValueRef message) {
+        if (message.size() >= ReplyWriter::SPLICE_MIN_BYTES) {
+            out.splice(std::move(message));
+        } else {
+            out.bytes.append(message.view());
+        }
+    });
+}
+
+bool Subscriber::take(std::string& out, size_t max_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return take_locked(max_bytes, [&out](ValueRef message) { out.append(message.view()); });
+}
+
+bool Subscriber::ready() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return overflowed_ || !queue_.empty();
+}
+
+bool Subscriber::over_limit() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return overflowed_;
+}
+
+size_t Subscriber::queued_bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queued_bytes_;
+}
+
+size_t PubSub::subscribe(Subscriber& sub, const std::string& channel) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    channels_[channel].insert(&sub);
+    sub.channels_.insert(channel);
+    return sub.channels_.size();
+}
+
+void PubSub::unsubscribe_all(Subscriber& sub) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    for (const std::string& channel : sub.channels_) {
+        auto it = channels_.find(channel);
+        if (it == channels_.end()) {
+            continue;
+        }
+        it->second.erase(&sub);
+        if (it->second.empty()) {
+            channels_.erase(it);
+        }
+    }
+    sub.channels_.clear();
+}
+
+size_t PubSub::publish(const std::string& channel, const std::string& message) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = channels_.find(channel);
+    if (it == channels_.end()) {
+        return 0;
+    }
+
+    // Serialize once; every subscriber queues a reference to the same bytes
+    auto* frame = new SharedValue();
+    ReplyWriter writer(frame->bytes);
+    writer.array_header(2);
+    writer.bulk(channel);
+    writer.bulk(message);
+    const ValueRef ref(frame);
+    SharedValue::release(frame);
+
+    for (Subscriber* sub : it->second) {
+        sub->push(ref);
+    }
+    return it->second.size();
+}
+
+bool PubSub::deliver(uint64_t client, const ValueRef& frame) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = clients_.find(client);
+    if (it == clients_.end()) {
+        return false;
+    }
+    it->second->push(frame);
+    return true;
+}
+
+bool PubSub::addressable(uint64_t client) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return clients_.count(client) != 0;
+}
+
+size_t PubSub::channel_count() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return channels_.size();
+}
+
+} // namespace mini_redis
@@ -0,0 +1,128 @@
+// Pub/Sub for Mini-Redis
+// PUBLISH serializes a message once, into a reference-counted buffer, and queues
+// a reference to it on every subscriber without touching their sockets. The
+// subscriber's server backend is woken and moves queued messages into its own
+// output once the earlier output is sent, so a slow subscriber's backlog stays
+// in its queue. The queue is bounded like Redis's client-output-buffer-limit
+// pubsub: a client whose backlog passes the hard limit, or stays over the soft
+// limit for soft_seconds, is disconnected.
+// Each subscriber keeps its own channel set, so removing a client costs
+// O(its channels) rather than O(all channels).
+// A subscriber made with its client's id can also be sent frames directly by
+// id (deliver), which is how CLIENT TRACKING invalidations reach a client.
+
+#pragma once
+
+#include "../storage/shared_value.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace mini_redis {
+
+class PubSub;
+class ReplyChain;
+
+// One client's side of pub/sub: its channels and the messages published to
+// them that its connection has not taken yet
+class Subscriber {
+public:
+    // Tells the client's server that take() has work: messages arrived or the
+    // client went over a limit. Runs on a publisher's thread and must not block.
+    using Wake = std::function<void()>;
+
+    // What a server takes per call, so one client's backlog is sent in turns
+    // with the other clients' output
+    static constexpr size_t TAKE_BATCH_BYTES = 64 * 1024;
+
+    // client is the connection's id for deliver (0 = not addressable)
+    Subscriber(PubSub& hub, Wake wake, uint64_t client = 0);
+    ~Subscriber(); // Leaves every channel
+
+    Subscriber(const Subscriber&) = delete;
+    Subscriber& operator=(const Subscriber&) = delete;
+
+    // Owner side: move queued messages, up to about max_bytes (at least one),
+    // to the end of out. Returns false once the client went over a limit; its
+    // connection should then be closed.
+    bool take(ReplyChain& out, size_t max_bytes);
+    bool take(std::string& out, size_t max_bytes);
+    // Whether take() has anything to do
+    bool ready() const;
+    // Whether the client went over a limit (its queue is then dropped)
+    bool over_limit() const;
+    size_t queued_bytes() const;
+
+private:
+    friend class PubSub;
+
+    // Publisher side (hub lock held shared)
+    void push(const ValueRef& message);
+    // Pop messages for take (mutex_ held)
+    template <typename Sink>
+    bool take_locked(size_t max_bytes, Sink&& sink);
+    // Check the soft limit against the current backlog (mutex_ held)
+    void check_soft_limit(int64_t now_ms);
+
+    PubSub& hub_;
+    const Wake wake_;
+    const uint64_t client_;
+    std::set<std::string> channels_; // Written under the hub's lock
+
+    mutable std::mutex mutex_;
+    std::deque<ValueRef> queue_;
+    size_t queued_bytes_ = 0;
+    int64_t soft_since_ms_ = 0; // When the backlog went over the soft limit (0 = it is not)
+    bool overflowed_ = false;
+};
+
+// Channel index and limits, shared by every client
+class PubSub {
+public:
+    // Pub/sub output limits in bytes (0 = no limit)
+    struct Limits {
+        size_t hard = 32 * 1024 * 1024;
+        size_t soft = 8 * 1024 * 1024;
+        int64_t soft_seconds = 60;
+    };
+
+    // Call only during startup
+    void set_limits(const Limits& limits) { limits_ = limits; }
+    const Limits& limits() const { return limits_; }
+
+    // Add sub to channel; returns the number of channels sub is in
+    size_t subscribe(Subscriber& sub, const std::string& channel);
+    // Remove sub from every channel it is in
+    void unsubscribe_all(Subscriber& sub);
+    // Queue message on every subscriber of channel; returns how many there were
+    size_t publish(const std::string& channel, const std::string& message);
+    // Queue an already serialized frame on client's subscriber; false if the
+    // client has none (closed, or never made one)
+    bool deliver(uint64_t client, const ValueRef& frame);
+    // Whether client has a subscriber deliver can reach
+    bool addressable(uint64_t client) const;
+
+    // Channels with at least one subscriber
+    size_t channel_count() const;
+    // Clients disconnected for going over a limit
+    uint64_t limit_disconnections() const { return limit_disconnections_.load(); }
+
+private:
+    friend class Subscriber;
+
+    mutable std::shared_mutex mutex_; // Exclusive to change the index, shared to publish
+    std::unordered_map<std::string, std::unordered_set<Subscriber*>> channels_;
+    std::unordered_map<uint64_t, Subscriber*> clients_; // Addressable subscribers by id
+    Limits limits_;
+    std::atomic<uint64_t> limit_disconnections_{0};
+};
+
+} // namespace mini_redis
@@ -0,0 +1,348 @@
+// Replica link implementation
+// Pulls the replication stream from a primary and applies it locally
+
+#include "socket_compat.hpp"
+
+#include "replica_link.hpp"
+#include "../protocol/parser.hpp"
+#include "../protocol/resp_parser.hpp"
+#include "../protocol/resp_utils.hpp"
+#include "../storage/kv_store.hpp"
+#include "../utils/logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// Wait between connection attempts
+constexpr int RECONNECT_MS = 1000;
+// The link thread checks for a stop this often while the primary is quiet
+constexpr int POLL_MS = 1000;
+// A primary silent this long is assumed lost
+constexpr int64_t REPL_TIMEOUT_MS = 60000;
+constexpr int64_t ACK_INTERVAL_MS = 1000;
+
+int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void report(mini_redis::Logger::Level level, const std::string& message) {
+    mini_redis::Logger::log(level, message);
+}
+
+} // anonymous namespace
+
+ReplicaLink::ReplicaLink(std::vector<KVStore>& databases, ApplyFn apply, ResyncFn on_resync,
+                         int listening_port, int64_t max_lag_ms, const std::string& sync_path)
+    : databases_(databases), apply_(std::move(apply)), on_resync_(std::move(on_resync)),
+      listening_port_(listening_port), max_lag_ms_(max_lag_ms), sync_path_(sync_path) {
+}
+
+ReplicaLink::~ReplicaLink() {
+    stop();
+}
+
+void ReplicaLink::follow(const std::string& host, int port) {
+    std::lock_guard<std::mutex> control(control_mutex_);
+    stop_link();
+    std::lock_guard<std::mutex> lock(mutex_);
+    host_ = host;
+    port_ = port;
+    active_.store(true);
+    running_.store(true);
+    thread_ = std::thread(&ReplicaLink::run, this, host, port);
+    report(mini_redis::Logger::Level::Info, "Replicating from " + host + ":" + std::to_string(port));
+}
+
+void ReplicaLink::stop() {
+    std::lock_guard<std::mutex> control(control_mutex_);
+    stop_link();
+    if (active_.exchange(false)) {
+        report(mini_redis::Logger::Level::Info, "Stopped replicating, serving writes");
+    }
+}
+
+void ReplicaLink::stop_link() {
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_.store(false);
+        if (socket_ != INVALID_SOCKET) {
+            mini_redis::shutdown_socket(socket_); // Unblocks a recv or send
+        }
+        thread = std::move(thread_);
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+bool ReplicaLink::fresh() const {
+    if (!synced_ || syncing_) {
+        return false;
+    }
+    return max_lag_ms_ <= 0 || steady_ms() - last_io_ms_.load() <= max_lag_ms_;
+}
+
+ReplicaLink::Status ReplicaLink::status() const {
+    Status status;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        status.host = host_;
+        status.port = port_;
+    }
+    status.link_up = link_up_.load();
+    status.sync_in_progress = syncing_.load();
+    status.offset = offset_.load();
+    const int64_t last_io = last_io_ms_.load();
+    status.last_io_ms = last_io == 0 ? -1 : steady_ms() - last_io;
+    return status;
+}
+
+void ReplicaLink::run(std::string host, int port) {
+    while (running_) {
+        session(host, port);
+        link_up_.store(false);
+        for (int waited = 0; running_ && waited < RECONNECT_MS; waited += 100) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+void ReplicaLink::session(const std::string& host, int port) {
+    Connection conn;
+    conn.socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (conn.socket == INVALID_SOCKET) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            closesocket(conn.socket);
+            return;
+        }
+        socket_ = conn.socket;
+    }
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<u_short>(port));
+    addr.sin_addr.s_addr = inet_addr(host.c_str());
+    const std::string primary = host + ":" + std::to_string(port);
+    std::string line;
+    if (connect(conn.socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR) {
+        report(mini_redis::Logger::Level::Warn, "Failed to connect to primary " + primary);
+    } else {
+        conn.heard_ms = steady_ms();
+        link_up_.store(true);
+
+        // Handshake: PING, our port, then PSYNC from where we stopped
+        std::string replid;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            replid = replid_;
+        }
+        const bool resume = replid != "?";
+        bool ok = send_command(conn, {"PING"}) && read_line(conn, line) && line == "+PONG" &&
+                  send_command(conn, {"REPLCONF", "listening-port", std::to_string(listening_port_)}) &&
+                  read_line(conn, line) && line == "+OK" &&
+                  send_command(conn, {"PSYNC", replid, resume ? std::to_string(offset_.load()) : "-1"}) &&
+                  read_line(conn, line);
+
+        std::vector<std::string> words;
+        if (ok) {
+            std::istringstream in(line);
+            std::string word;
+            while (in >> word) {
+                words.push_back(word);
+            }
+        }
+        if (ok && words.size() == 4 && words[0] == "+FULLRESYNC") {
+            try {
+                offset_.store(std::stoull(words[2]));
+                ok = full_resync(conn, std::stoul(words[3]));
+            } catch (...) {
+                ok = false;
+            }
+            // After a failed one only another full resync is safe
+            std::lock_guard<std::mutex> lock(mutex_);
+            replid_ = ok ? words[1] : "?";
+        } else if (ok && words.size() == 2 && words[0] == "+CONTINUE" && words[1] == replid) {
+            report(mini_redis::Logger::Level::Info, "Resumed replication from " + primary + " at offset " +
+                std::to_string(offset_.load()));
+        } else {
+            if (running_) {
+                report(mini_redis::Logger::Level::Warn, "Primary " + primary + " refused to sync: " +
+                    (line.empty() ? std::string("connection lost") : line));
+            }
+            ok = false;
+        }
+        if (ok) {
+            stream(conn);
+            if (running_) {
+                report(mini_redis::Logger::Level::Warn, "Lost the link to primary " + primary + " at offset " +
+                    std::to_string(offset_.load()));
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    socket_ = INVALID_SOCKET;
+    closesocket(conn.socket);
+}
+
+bool ReplicaLink::fill(Connection& conn) {
+    char chunk[64 * 1024];
+    while (running_) {
+        if (!mini_redis::wait_readable(conn.socket, POLL_MS)) {
+            if (steady_ms() - conn.heard_ms > REPL_TIMEOUT_MS) {
+                return false;
+            }
+            continue;
+        }
+        const int n = static_cast<int>(recv(conn.socket, chunk, sizeof(chunk), 0));
+        if (n <= 0) {
+            return false;
+        }
+        conn.buffer.append(chunk, static_cast<size_t>(n));
+        conn.heard_ms = steady_ms();
+        return true;
+    }
+    return false;
+}
+
+bool ReplicaLink::read_line(Connection& conn, std::string& line) {
+    size_t eol;
+    while ((eol = conn.buffer.find("\r\n")) == std::string::npos) {
+        if (!fill(conn)) {
+            line.clear();
+            return false;
+        }
+    }
+    line = conn.buffer.substr(0, eol);
+    conn.buffer.erase(0, eol + 2);
+    return true;
+}
+
+bool ReplicaLink::send_command(Connection& conn, const std::vector<std::string>& args) {
+    std::string out;
+    mini_redis::ReplyWriter writer(out);
+    writer.array_header(args.size());
+    for (const auto& arg : args) {
+        writer.bulk(arg);
+    }
+    const char* data = out.data();
+    size_t size = out.size();
+    while (size > 0) {
+        const int sent = static_cast<int>(send(conn.socket, data, static_cast<int>(std::min<size_t>(size, INT_MAX)), 0));
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool ReplicaLink::full_resync(Connection& conn, size_t count) {
+    syncing_.store(true);
+    std::vector<std::string> paths;
+    bool ok = true;
+    for (size_t i = 0; i < count && ok; ++i) {
+        // $<length>\r\n<RDB bytes>\r\n, written straight to a file
+        std::string header;
+        ok = read_line(conn, header) && header.size() > 1 && header[0] == '$';
+        uint64_t remaining = 0;
+        try {
+            remaining = ok ? std::stoull(header.substr(1)) : 0;
+        } catch (...) {
+            ok = false;
+        }
+        paths.push_back(sync_path_ + ".replica." + std::to_string(i));
+        std::ofstream out(paths.back(), std::ios::binary | std::ios::trunc);
+        ok = ok && static_cast<bool>(out);
+        while (ok && remaining > 0) {
+            if (conn.buffer.empty() && !fill(conn)) {
+                ok = false;
+                break;
+            }
+            const size_t take = static_cast<size_t>(std::min<uint64_t>(conn.buffer.size(), remaining));
+            out.write(conn.buffer.data(), static_cast<std::streamsize>(take));
+            conn.buffer.erase(0, take);
+            remaining -= take;
+        }
+        while (ok && conn.buffer.size() < 2) {
+            ok = fill(conn);
+        }
+        ok = ok && conn.buffer.compare(0, 2, "\r\n") == 0 && static_cast<bool>(out);
+        if (ok) {
+            conn.buffer.erase(0, 2);
+        }
+    }
+
+    if (ok) {
+        if (count > databases_.size()) {
+            report(mini_redis::Logger::Level::Warn, "Primary has " + std::to_string(count) + " databases, keeping the first " +
+                std::to_string(databases_.size()));
+        }
+        for (size_t i = 0; i < databases_.size() && ok; ++i) {
+            databases_[i].clear();
+            if (i < count && !databases_[i].load_from_rdb(paths[i])) {
+                report(mini_redis::Logger::Level::Error, "Failed to load database " + std::to_string(i) + " of a full resync");
+                ok = false;
+            }
+        }
+        // Partly replaced data is no copy of anything: the next sync starts over
+        synced_.store(ok);
+        if (ok) {
+            last_io_ms_.store(conn.heard_ms);
+            report(mini_redis::Logger::Level::Info, "Full resync done at offset " + std::to_string(offset_.load()));
+            if (on_resync_) {
+                on_resync_();
+            }
+        }
+    }
+    for (const auto& path : paths) {
+        std::remove(path.c_str());
+    }
+    syncing_.store(false);
+    return ok;
+}
+
+void ReplicaLink::stream(Connection& conn) {
+    RespParser parser;
+    std::vector<std::string_view> args;
+    std::string error;
+    const uint64_t start = offset_.load();
+    uint64_t received = 0;
+    int64_t last_ack_ms = 0;
+    do {
+        parser.append(conn.buffer.data(), conn.buffer.size());
+        received += conn.buffer.size();
+        conn.buffer.clear();
+        RespStatus status;
+        while ((status = parser.parseArgs(args, error)) == RespStatus::Complete) {
+            apply_(protocol::command_from_resp_args(args));
+            offset_.store(start + received - parser.buffered());
+        }
+        if (status == RespStatus::Error) {
+            report(mini_redis::Logger::Level::Error, "Bad replication stream from the primary: " + error);
+            return;
+        }
+        // Up to date with everything the primary has sent so far
+        last_io_ms_.store(conn.heard_ms);
+        const int64_t now = steady_ms();
+        if (now - last_ack_ms >= ACK_INTERVAL_MS) {
+            if (!send_command(conn, {"REPLCONF", "ACK", std::to_string(offset_.load())})) {
+                return;
+            }
+            last_ack_ms = now;
+        }
+    } while (fill(conn));
+}
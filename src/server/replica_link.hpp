@@ -0,0 +1,119 @@
+// Replica side of replication for Mini-Redis
+// REPLICAOF host port makes this node follow a primary. A link thread connects,
+// asks for the stream with PSYNC and the replication ID and offset it has
+// reached (? -1 the first time), loads a full resync's snapshots into the
+// databases and then applies the stream as it arrives, acknowledging its
+// offset every second. A dropped link reconnects and resumes where it stopped.
+// Clients can only read from a replica, and only while its data is fresh: the
+// stream (which PINGs every second when idle) reached it within the staleness
+// bound.
+
+#pragma once
+
+#include "socket_compat.hpp"
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+namespace protocol {
+    struct Command;
+}
+
+class KVStore;
+
+class ReplicaLink {
+public:
+    // Applies one command of the stream to the databases (link thread)
+    using ApplyFn = std::function<void(const protocol::Command&)>;
+    // Runs after a full resync has replaced the databases (link thread)
+    using ResyncFn = std::function<void()>;
+
+    // Snapshots are received into temporary files named after sync_path.
+    // max_lag_ms bounds how stale served reads may be (0 = no bound).
+    ReplicaLink(std::vector<KVStore>& databases, ApplyFn apply, ResyncFn on_resync,
+                int listening_port, int64_t max_lag_ms, const std::string& sync_path);
+    ~ReplicaLink();
+
+    ReplicaLink(const ReplicaLink&) = delete;
+    ReplicaLink& operator=(const ReplicaLink&) = delete;
+
+    // REPLICAOF host port: follow host:port, replacing any current primary
+    void follow(const std::string& host, int port);
+
+    // REPLICAOF NO ONE: stop following and serve writes again, keeping the data
+    void stop();
+
+    // Following a primary (clients cannot write)
+    bool active() const { return active_.load(); }
+
+    // Reads may be served: a sync has completed, no full resync is replacing
+    // the data, and the stream reached us within the staleness bound
+    bool fresh() const;
+
+    // The link, for INFO
+    struct Status {
+        std::string host;
+        int port = 0;
+        bool link_up = false;
+        bool sync_in_progress = false;
+        uint64_t offset = 0;   // Primary stream bytes applied
+        int64_t last_io_ms = -1; // Since the stream last reached us (-1 = never)
+    };
+    Status status() const;
+
+private:
+    struct Connection {
+        SOCKET socket = INVALID_SOCKET;
+        std::string buffer; // Received, not yet consumed
+        int64_t heard_ms = 0; // Last received from the primary
+    };
+
+    // Stop and join the link thread (control lock held)
+    void stop_link();
+
+    // Link thread: sessions until stopped, a second apart
+    void run(std::string host, int port);
+
+    // Connect, handshake, sync and stream until the connection drops
+    void session(const std::string& host, int port);
+
+    // Wait for more bytes from the primary; false on close, error, stop or
+    // once it has been silent too long
+    bool fill(Connection& conn);
+    bool read_line(Connection& conn, std::string& line);
+    bool send_command(Connection& conn, const std::vector<std::string>& args);
+
+    // Receive count RDB bulk strings and load them, one per database
+    bool full_resync(Connection& conn, size_t count);
+
+    // Apply the stream until the connection drops
+    void stream(Connection& conn);
+
+    std::vector<KVStore>& databases_;
+    ApplyFn apply_;
+    ResyncFn on_resync_;
+    const int listening_port_;
+    const int64_t max_lag_ms_;
+    const std::string sync_path_;
+
+    std::mutex control_mutex_; // Serializes follow and stop
+    mutable std::mutex mutex_; // Guards the primary's address, replid_ and the link thread
+    std::string host_;
+    int port_ = 0;
+    std::string replid_ = "?"; // Primary history the offset belongs to (? = none yet)
+    SOCKET socket_ = INVALID_SOCKET; // Current connection, shut down by stop
+    std::thread thread_;
+
+    std::atomic<bool> active_{false};
+    std::atomic<bool> running_{false}; // Link thread should carry on
+    std::atomic<bool> link_up_{false};
+    std::atomic<bool> synced_{false};  // Holds a complete copy of some primary's data
+    std::atomic<bool> syncing_{false}; // A full resync is under way
+    std::atomic<uint64_t> offset_{0};
+    std::atomic<int64_t> last_io_ms_{0}; // When the applied data was last current (0 = never)
+};
@@ -1,165 +1,512 @@
 // Replication manager implementation
-// Sends write commands to replica servers
+// Buffers write commands in the backlog and streams them to replicas
 
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#define _WINSOCK_DEPRECATED_NO_WARNINGS
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-#else
-#error "This implementation currently supports only Windows (Winsock)."
-#endif
+#include "socket_compat.hpp"
 
 #include "replication.hpp"
 #include "../protocol/parser.hpp"
+#include "../protocol/command_table.hpp"
+#include "../storage/kv_store.hpp"
 #include "../utils/logger.hpp"
 
-#include <sstream>
 #include <algorithm>
-#include <cctype>
-
-// Convert command to RESP array format (shared with AOF logger)
-static std::string command_to_resp(const protocol::Command& cmd) {
-    std::string result;
-    
-    // Determine command name from type
-    std::string cmd_name;
-    switch (cmd.type) {
-        case protocol::CommandType::SET: cmd_name = "SET"; break;
-        case protocol::CommandType::DEL: cmd_name = "DEL"; break;
-        case protocol::CommandType::EXPIRE: cmd_name = "EXPIRE"; break;
-        default: return ""; // Only replicate write commands
-    }
-    
-    // Count total arguments (command name + args)
-    size_t arg_count = 1 + cmd.args.size();
-    
-    // Build RESP array: *<count>\r\n
-    result = "*" + std::to_string(arg_count) + "\r\n";
-    
-    // Add command name as bulk string: $<len>\r\n<value>\r\n
-    result += "$" + std::to_string(cmd_name.size()) + "\r\n" + cmd_name + "\r\n";
-    
-    // Add each argument as bulk string
-    for (const auto& arg : cmd.args) {
-        result += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
-    }
-    
-    return result;
-}
-
-ReplicationManager::ReplicationManager() {
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+namespace {
+
+// Largest piece of the stream handed to one send()
+constexpr size_t SEND_CHUNK_BYTES = 256 * 1024;
+constexpr size_t MIN_BACKLOG_BYTES = 16 * 1024;
+// How often a sender waiting on a full socket checks whether it was dropped
+constexpr int SEND_WAIT_MS = 100;
+// Retry interval while a BGSAVE or another full resync holds a snapshot
+constexpr int SNAPSHOT_RETRY_MS = 100;
+// An idle stream carries a PING this often
+constexpr int PING_INTERVAL_MS = 1000;
+constexpr char PING_COMMAND[] = "*1\r\n$4\r\nPING\r\n";
+// Sends never block whatever mode the server left its connection in, so a
+// sender stuck on a full socket can still notice it has been lapped
+#ifdef MSG_DONTWAIT
+constexpr int SEND_FLAGS = MSG_DONTWAIT;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string random_replid() {
+    std::random_device seed;
+    std::mt19937_64 rng((static_cast<uint64_t>(seed()) << 32) ^ seed());
+    static const char hex[] = "0123456789abcdef";
+    std::string id(40, '0');
+    for (char& c : id) {
+        c = hex[rng() % 16];
+    }
+    return id;
+}
+
+std::string peer_address(SOCKET s) {
+    sockaddr_in addr{};
+#ifdef _WIN32
+    int len = sizeof(addr);
+#else
+    socklen_t len = sizeof(addr);
+#endif
+    if (getpeername(s, reinterpret_cast<sockaddr*>(&addr), &len) != 0 || addr.sin_family != AF_INET) {
+        return "unknown";
+    }
+    return std::string(inet_ntoa(addr.sin_addr)) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
+void warn(const std::string& message) {
+    mini_redis::Logger::log(mini_redis::Logger::Level::Warn, message);
+}
+
+} // anonymous namespace
+
+ReplicationManager::ReplicationManager(size_t backlog_bytes)
+    : backlog_capacity_(std::max(backlog_bytes, MIN_BACKLOG_BYTES)), replid_(random_replid()) {
 }
 
 ReplicationManager::~ReplicationManager() {
     stop();
 }
 
-void ReplicationManager::start() {
-    // Nothing to initialize for now
+std::string ReplicationManager::replid() {
+    std::lock_guard<std::mutex> lock(backlog_mutex_);
+    return replid_;
+}
+
+void ReplicationManager::start(std::vector<KVStore>* databases, const std::string& sync_path) {
+    databases_ = databases;
+    sync_path_ = sync_path;
+    running_.store(true);
 }
 
 void ReplicationManager::stop() {
+    running_.store(false);
     std::lock_guard<std::mutex> lock(replicas_mutex_);
-    
-    // Close all replica connections
     for (auto& replica : replicas_) {
-        if (replica.connected && replica.socket != nullptr) {
-            closesocket(reinterpret_cast<SOCKET>(replica.socket));
-            replica.socket = nullptr;
-            replica.connected = false;
-        }
+        cancel(*replica);
+        closesocket(replica->socket);
     }
     replicas_.clear();
 }
 
+void ReplicationManager::reset_history() {
+    {
+        std::lock_guard<std::mutex> lock(backlog_mutex_);
+        replid_ = random_replid();
+        selected_db_ = -1;
+    }
+    std::lock_guard<std::mutex> lock(replicas_mutex_);
+    for (auto it = replicas_.begin(); it != replicas_.end();) {
+        if ((*it)->pushed) {
+            ++it;
+            continue;
+        }
+        cancel(**it);
+        closesocket((*it)->socket);
+        it = replicas_.erase(it);
+    }
+}
+
 void ReplicationManager::add_replica(const std::string& host, int port) {
     std::lock_guard<std::mutex> lock(replicas_mutex_);
-    
+    reap_finished();
+    const std::string address = host + ":" + std::to_string(port);
+
     // Check if replica already exists
     for (const auto& replica : replicas_) {
-        if (replica.host == host && replica.port == port) {
-            mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "Replica " + host + ":" + std::to_string(port) + " already exists");
+        if (replica->pushed && replica->address == address) {
+            warn("Replica " + address + " already exists");
             return;
         }
     }
-    
+
     // Create socket and connect to replica
     SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (sock == INVALID_SOCKET) {
-        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Failed to create socket for replica " + host + ":" + std::to_string(port));
+        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Failed to create socket for replica " + address);
         return;
     }
-    
+
     sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_port = htons(static_cast<u_short>(port));
     addr.sin_addr.s_addr = inet_addr(host.c_str());
-    
+
     if (connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR) {
-        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Failed to connect to replica " + host + ":" + std::to_string(port));
+        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Failed to connect to replica " + address);
         closesocket(sock);
         return;
     }
-    
-    // Add to replicas list
-    ReplicaEndpoint replica;
-    replica.host = host;
-    replica.port = port;
-    replica.socket = reinterpret_cast<void*>(sock);
-    replica.connected = true;
-    replicas_.push_back(replica);
-    
-    mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Connected to replica " + host + ":" + std::to_string(port));
+
+    auto replica = std::make_unique<Replica>();
+    replica->address = address;
+    replica->socket = sock;
+    replica->pushed = true;
+    {
+        std::lock_guard<std::mutex> backlog_lock(backlog_mutex_);
+        activate_backlog();
+        selected_db_ = -1; // The replica's first command carries a SELECT
+        replica->offset.store(offset_);
+    }
+    launch(std::move(replica), false, std::string());
+
+    mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Connected to replica " + address);
 }
 
 void ReplicationManager::remove_replica(const std::string& host, int port) {
     std::lock_guard<std::mutex> lock(replicas_mutex_);
-    
+    const std::string address = host + ":" + std::to_string(port);
+
     for (auto it = replicas_.begin(); it != replicas_.end(); ++it) {
-        if (it->host == host && it->port == port) {
-            if (it->connected && it->socket != nullptr) {
-                closesocket(reinterpret_cast<SOCKET>(it->socket));
-            }
+        if ((*it)->pushed && (*it)->address == address) {
+            cancel(**it);
+            closesocket((*it)->socket);
             replicas_.erase(it);
-            mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Removed replica " + host + ":" + std::to_string(port));
+            mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Removed replica " + address);
             return;
         }
     }
 }
 
-void ReplicationManager::replicate_command(const protocol::Command& cmd) {
-    // Only replicate write commands
-    if (cmd.type != protocol::CommandType::SET && 
-        cmd.type != protocol::CommandType::DEL && 
-        cmd.type != protocol::CommandType::EXPIRE) {
+void ReplicationManager::replicate_command(const protocol::Command& cmd, int db_index) {
+    // Only replicate write commands (as flagged in the command table), and only
+    // once a replica has asked for the stream
+    if (!protocol::is_write_command(cmd.type) || !backlog_active_.load()) {
         return;
     }
-    
-    std::string resp_cmd = command_to_resp(cmd);
+
+    std::string resp_cmd = protocol::command_to_resp(cmd);
     if (resp_cmd.empty()) {
         return;
     }
-    
+
+    std::lock_guard<std::mutex> lock(backlog_mutex_);
+    if (db_index != selected_db_) {
+        protocol::Command select;
+        select.type = protocol::CommandType::SELECT;
+        select.name = "SELECT";
+        select.args.push_back(std::to_string(db_index));
+        std::string resp_select = protocol::command_to_resp(select);
+        append_backlog(resp_select.data(), resp_select.size());
+        selected_db_ = db_index;
+    }
+    append_backlog(resp_cmd.data(), resp_cmd.size());
+    if (waiting_senders_ > 0) {
+        backlog_cv_.notify_all();
+    }
+}
+
+std::string ReplicationManager::psync(SOCKET client_socket, const std::string& replid, uint64_t offset) {
+    if (!running_) {
+        return "ERR replication is not running";
+    }
+    auto replica = std::make_unique<Replica>();
+    replica->address = peer_address(client_socket);
+    replica->client_socket = client_socket;
+
+    bool full_sync = true;
+    std::string greeting;
+    {
+        std::lock_guard<std::mutex> lock(backlog_mutex_);
+        const uint64_t first = offset_ - std::min<uint64_t>(offset_, backlog_capacity_);
+        if (backlog_active_ && replid == replid_ && offset >= first && offset <= offset_) {
+            full_sync = false;
+            replica->offset.store(offset);
+            greeting = "+CONTINUE " + replid_ + "\r\n";
+        }
+    }
+    if (full_sync && !databases_) {
+        return "ERR full resync is not supported by this server";
+    }
+
+    replica->socket = mini_redis::duplicate_socket(client_socket);
+    if (replica->socket == INVALID_SOCKET) {
+        return "ERR failed to attach the replica connection";
+    }
+
+    std::lock_guard<std::mutex> lock(replicas_mutex_);
+    reap_finished();
+    mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Replica " + replica->address +
+                            (full_sync ? " asked for a full resync" : " resumed at offset " + std::to_string(offset)));
+    launch(std::move(replica), full_sync, std::move(greeting));
+    return std::string();
+}
+
+void ReplicationManager::acknowledge(SOCKET client_socket, uint64_t offset) {
     std::lock_guard<std::mutex> lock(replicas_mutex_);
-    
-    // Send command to all connected replicas
     for (auto& replica : replicas_) {
-        if (!replica.connected || replica.socket == nullptr) {
+        if (replica->client_socket == client_socket && !replica->finished) {
+            replica->ack_offset.store(offset);
+            replica->ack_ms.store(steady_ms());
+            return;
+        }
+    }
+}
+
+std::vector<ReplicationManager::ReplicaInfo> ReplicationManager::replicas() {
+    static const char* state_names[] = {"wait_bgsave", "send_bulk", "online"};
+    std::lock_guard<std::mutex> lock(replicas_mutex_);
+    reap_finished();
+    std::vector<ReplicaInfo> out;
+    const int64_t now = steady_ms();
+    for (const auto& replica : replicas_) {
+        const int64_t ack_ms = replica->ack_ms.load();
+        out.push_back(ReplicaInfo{replica->address, state_names[static_cast<int>(replica->state.load())],
+                                  replica->offset.load(), replica->ack_offset.load(),
+                                  ack_ms == 0 ? -1 : (now - ack_ms) / 1000});
+    }
+    return out;
+}
+
+uint64_t ReplicationManager::master_offset() {
+    std::lock_guard<std::mutex> lock(backlog_mutex_);
+    return offset_;
+}
+
+uint64_t ReplicationManager::backlog_first_offset() {
+    std::lock_guard<std::mutex> lock(backlog_mutex_);
+    return offset_ - std::min<uint64_t>(offset_, backlog_capacity_);
+}
+
+void ReplicationManager::launch(std::unique_ptr<Replica> replica, bool full_sync, std::string greeting) {
+    Replica& r = *replica;
+    r.id = ++next_replica_id_;
+#ifdef _WIN32
+    mini_redis::set_nonblocking(r.socket); // No MSG_DONTWAIT; the duplicate has its own mode
+#endif
+    r.state.store(full_sync ? ReplicaState::WaitBgsave : ReplicaState::Online);
+    replicas_.push_back(std::move(replica));
+    r.sender = std::thread(&ReplicationManager::run_replica, this, std::ref(r), full_sync, std::move(greeting));
+}
+
+void ReplicationManager::reap_finished() {
+    for (auto it = replicas_.begin(); it != replicas_.end();) {
+        if ((*it)->finished) {
+            (*it)->sender.join();
+            closesocket((*it)->socket);
+            it = replicas_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void ReplicationManager::cancel(Replica& replica) {
+    replica.cancelled.store(true);
+    mini_redis::shutdown_socket(replica.socket); // Unblocks a blocking send
+    {
+        std::lock_guard<std::mutex> lock(backlog_mutex_);
+        backlog_cv_.notify_all();
+    }
+    if (replica.sender.joinable()) {
+        replica.sender.join();
+    }
+}
+
+void ReplicationManager::run_replica(Replica& replica, bool full_sync, std::string greeting) {
+    bool ok = full_sync ? full_resync(replica) : send_all(replica, greeting.data(), greeting.size());
+    if (ok) {
+        replica.state.store(ReplicaState::Online);
+        stream(replica);
+    }
+    if (running_ && !replica.cancelled) {
+        warn("Replica " + replica.address + " disconnected at offset " + std::to_string(replica.offset.load()));
+    }
+    // Ends the connection for the server reading from it too; the socket
+    // itself is closed once this thread is joined
+    mini_redis::shutdown_socket(replica.socket);
+    replica.finished.store(true);
+}
+
+bool ReplicationManager::full_resync(Replica& replica) {
+    std::vector<KVStore>& dbs = *databases_;
+    std::vector<KVStore::SnapshotCursor> cursors(dbs.size());
+    uint64_t start = 0;
+    std::string replid;
+    while (true) {
+        if (!running_ || replica.cancelled) {
+            return false;
+        }
+        // With the gate closed no write is between applying and replicating,
+        // so the snapshots hold exactly the stream up to start
+        std::unique_lock<std::mutex> cut(cut_mutex_);
+        write_gate_.close();
+        size_t begun = 0;
+        while (begun < dbs.size() && dbs[begun].begin_snapshot(cursors[begun])) {
+            ++begun;
+        }
+        if (begun == dbs.size()) {
+            std::lock_guard<std::mutex> lock(backlog_mutex_);
+            activate_backlog();
+            selected_db_ = -1; // The stream after start must say which database it is on
+            start = offset_;
+            replid = replid_;
+        }
+        write_gate_.open();
+        cut.unlock();
+        if (begun == dbs.size()) {
+            break;
+        }
+        for (size_t i = 0; i < begun; ++i) {
+            dbs[i].end_snapshot(cursors[i]);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(SNAPSHOT_RETRY_MS));
+    }
+    replica.offset.store(start);
+
+    // Write every snapshot out first, so none stays open for the transfer
+    std::vector<std::string> paths;
+    bool ok = true;
+    for (size_t i = 0; i < dbs.size(); ++i) {
+        paths.push_back(sync_path_ + ".sync" + std::to_string(replica.id) + "." + std::to_string(i));
+        ok = dbs[i].write_snapshot(cursors[i], paths.back()) && ok;
+    }
+    if (!ok) {
+        warn("Full resync of replica " + replica.address + " failed: could not write the snapshot");
+    }
+
+    replica.state.store(ReplicaState::SendBulk);
+    const std::string header = "+FULLRESYNC " + replid + " " + std::to_string(start) + " " +
+                               std::to_string(dbs.size()) + "\r\n";
+    ok = ok && send_all(replica, header.data(), header.size());
+    for (const std::string& path : paths) {
+        ok = ok && send_file(replica, path);
+        std::remove(path.c_str());
+    }
+    return ok;
+}
+
+bool ReplicationManager::send_file(Replica& replica, const std::string& path) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) {
+        return false;
+    }
+    const std::string header = "$" + std::to_string(static_cast<long long>(in.tellg())) + "\r\n";
+    in.seekg(0);
+    if (!send_all(replica, header.data(), header.size())) {
+        return false;
+    }
+    std::vector<char> buffer(SEND_CHUNK_BYTES);
+    while (in) {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        if (in.gcount() > 0 && !send_all(replica, buffer.data(), static_cast<size_t>(in.gcount()))) {
+            return false;
+        }
+    }
+    return send_all(replica, "\r\n", 2);
+}
+
+void ReplicationManager::stream(Replica& replica) {
+    std::string chunk;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(backlog_mutex_);
+            ++waiting_senders_;
+            const bool woken = backlog_cv_.wait_for(lock, std::chrono::milliseconds(PING_INTERVAL_MS), [&] {
+                return !running_ || replica.cancelled || offset_ > replica.offset;
+            });
+            --waiting_senders_;
+            if (!running_ || replica.cancelled) {
+                return;
+            }
+            if (!woken) {
+                if (steady_ms() - last_append_ms_ >= PING_INTERVAL_MS) {
+                    append_backlog(PING_COMMAND, sizeof(PING_COMMAND) - 1);
+                    backlog_cv_.notify_all();
+                } else {
+                    continue;
+                }
+            }
+            // Everything written since the last pass goes out in one send
+            chunk.clear();
+            if (!copy_backlog(replica.offset, SEND_CHUNK_BYTES, chunk)) {
+                warn("Replica " + replica.address + " fell behind the replication backlog");
+                return;
+            }
+        }
+        if (!send_all(replica, chunk.data(), chunk.size())) {
+            return;
+        }
+        replica.offset.fetch_add(chunk.size());
+    }
+}
+
+bool ReplicationManager::send_all(Replica& replica, const char* data, size_t size) {
+    while (size > 0) {
+        if (!running_ || replica.cancelled) {
+            return false;
+        }
+        const int piece = static_cast<int>(std::min<size_t>(size, INT_MAX));
+        const int sent = static_cast<int>(send(replica.socket, data, piece, SEND_FLAGS));
+        if (sent > 0) {
+            data += sent;
+            size -= static_cast<size_t>(sent);
             continue;
         }
-        
-        SOCKET sock = reinterpret_cast<SOCKET>(replica.socket);
-        int sent = send(sock, resp_cmd.c_str(), static_cast<int>(resp_cmd.size()), 0);
-        
-        if (sent == SOCKET_ERROR || sent != static_cast<int>(resp_cmd.size())) {
-            // Connection failed, mark as disconnected
-            mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "Failed to send to replica " + replica.host + ":" + std::to_string(replica.port));
-            closesocket(sock);
-            replica.socket = nullptr;
-            replica.connected = false;
+        if (sent == SOCKET_ERROR && mini_redis::socket_would_block()) {
+            mini_redis::wait_writable(replica.socket, SEND_WAIT_MS);
+            std::lock_guard<std::mutex> lock(backlog_mutex_);
+            if (offset_ - replica.offset > backlog_capacity_) {
+                warn("Replica " + replica.address + " fell behind the replication backlog");
+                return false; // It can never catch up: drop it now
+            }
+            continue;
         }
+        return false;
+    }
+    return true;
+}
+
+bool ReplicationManager::copy_backlog(uint64_t offset, size_t max_bytes, std::string& out) const {
+    const uint64_t first = offset_ - std::min<uint64_t>(offset_, backlog_capacity_);
+    if (offset < first) {
+        return false;
     }
+    const size_t bytes = static_cast<size_t>(std::min<uint64_t>(offset_ - offset, max_bytes));
+    const size_t pos = static_cast<size_t>(offset % backlog_capacity_);
+    const size_t head = std::min(bytes, backlog_capacity_ - pos);
+    out.append(backlog_.data() + pos, head);
+    out.append(backlog_.data(), bytes - head);
+    return true;
 }
 
+void ReplicationManager::append_backlog(const char* data, size_t size) {
+    last_append_ms_ = steady_ms();
+    if (size > backlog_capacity_) {
+        // Only the tail survives anyway
+        offset_ += size - backlog_capacity_;
+        data += size - backlog_capacity_;
+        size = backlog_capacity_;
+    }
+    while (size > 0) {
+        const size_t pos = static_cast<size_t>(offset_ % backlog_capacity_);
+        const size_t piece = std::min(size, backlog_capacity_ - pos);
+        std::memcpy(backlog_.data() + pos, data, piece);
+        offset_ += piece;
+        data += piece;
+        size -= piece;
+    }
+}
+
+void ReplicationManager::activate_backlog() {
+    if (!backlog_active_.load()) {
+        backlog_.assign(backlog_capacity_, 0);
+        backlog_active_.store(true);
+    }
+}
+
+mini_redis::WriteGate::Pass ReplicationManager::write_pass() {
+    return databases_ ? mini_redis::WriteGate::Pass(write_gate_) : mini_redis::WriteGate::Pass();
+}
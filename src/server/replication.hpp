@@ -1,45 +1,172 @@
 // Replication manager for Mini-Redis
-// Handles primary-to-replica replication of write commands
+// Write commands are appended to a circular replication backlog (with a SELECT
+// whenever the database changes), and each replica is fed from the backlog by
+// its own sender thread in large writes. The request path only copies bytes:
+// a slow replica never holds up writers or the other replicas.
+// Stream positions are byte offsets. A replica that reconnects with PSYNC and
+// an offset the backlog still holds continues from there; any other gets a
+// full resync: a point-in-time snapshot of every database, then the stream
+// from the snapshot's offset. An idle stream carries a PING every second, so a
+// replica can tell a quiet primary from a lost one.
 
 #pragma once
 
+#include "socket_compat.hpp"
+#include "../utils/write_gate.hpp"
+
 #include <string>
 #include <vector>
+#include <memory>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
 
 namespace protocol {
     struct Command;
 }
 
+class KVStore;
+
 class ReplicationManager {
 public:
-    ReplicationManager();
+    static constexpr size_t DEFAULT_BACKLOG_BYTES = 1024 * 1024;
+
+    explicit ReplicationManager(size_t backlog_bytes = DEFAULT_BACKLOG_BYTES);
     ~ReplicationManager();
-    
-    // Add a replica endpoint (host:port)
+
+    ReplicationManager(const ReplicationManager&) = delete;
+    ReplicationManager& operator=(const ReplicationManager&) = delete;
+
+    // Push replication: connect to host:port and stream writes from now on
+    // (no handshake and no initial sync)
     void add_replica(const std::string& host, int port);
-    
-    // Remove a replica endpoint
+
+    // Disconnect a replica added with add_replica
     void remove_replica(const std::string& host, int port);
-    
-    // Replicate a write command to all connected replicas
-    void replicate_command(const protocol::Command& cmd);
-    
-    // Start replication manager (initialize if needed)
-    void start();
-    
+
+    // Append a write command applied to database db_index to the stream
+    // (other commands are ignored). Never waits for a replica.
+    void replicate_command(const protocol::Command& cmd, int db_index = 0);
+
+    // PSYNC <replid> <offset> from a server connection. The connection is handed
+    // to a sender which replies +CONTINUE <replid> and resumes at offset if the
+    // backlog still holds it, or +FULLRESYNC <replid> <offset> <databases>, one
+    // RDB bulk string per database and the stream from that offset. The socket
+    // is duplicated, so its server keeps reading the replica's REPLCONF ACKs;
+    // the replica must wait for each earlier reply before sending PSYNC.
+    // Returns an error message, empty on success.
+    std::string psync(SOCKET client_socket, const std::string& replid, uint64_t offset);
+
+    // REPLCONF ACK <offset> from the replica attached on client_socket
+    void acknowledge(SOCKET client_socket, uint64_t offset);
+
+    // Held by every write from applying it to replicating it, so a full resync
+    // can snapshot at an exact stream offset. Empty without full resync.
+    mini_redis::WriteGate::Pass write_pass();
+
+    // Start serving replicas. A full resync snapshots databases (null: only
+    // partial resyncs are possible) into temporary files named after sync_path.
+    void start(std::vector<KVStore>* databases = nullptr, const std::string& sync_path = "");
+
     // Stop replication manager (close all connections)
     void stop();
 
+    // The databases were replaced outside the stream (a full resync from this
+    // node's own primary): start a new replication ID and drop the PSYNC
+    // replicas, so each reconnects to a full resync
+    void reset_history();
+
+    // A connected replica, for INFO
+    struct ReplicaInfo {
+        std::string address;
+        const char* state;   // wait_bgsave | send_bulk | online
+        uint64_t offset;     // Stream bytes sent
+        uint64_t ack_offset; // Stream bytes the replica last acknowledged
+        int64_t lag_seconds; // Since the last acknowledgement (-1 = none)
+    };
+    std::vector<ReplicaInfo> replicas();
+
+    std::string replid();
+    uint64_t master_offset();
+    uint64_t backlog_first_offset();
+    size_t backlog_capacity() const { return backlog_capacity_; }
+
 private:
-    struct ReplicaEndpoint {
-        std::string host;
-        int port;
-        void* socket; // SOCKET on Windows
-        bool connected;
+    enum class ReplicaState { WaitBgsave, SendBulk, Online };
+
+    struct Replica {
+        uint64_t id = 0;
+        std::string address;                   // host:port
+        SOCKET socket = INVALID_SOCKET;        // Owned by the sender thread
+        SOCKET client_socket = INVALID_SOCKET; // Server connection it attached on, for ACKs
+        bool pushed = false;                   // Added with add_replica
+        std::atomic<uint64_t> offset{0};       // Next stream byte to send
+        std::atomic<uint64_t> ack_offset{0};
+        std::atomic<int64_t> ack_ms{0};        // Time of the last ACK, 0 = none
+        std::atomic<ReplicaState> state{ReplicaState::Online};
+        std::atomic<bool> cancelled{false};
+        std::atomic<bool> finished{false};
+        std::thread sender;
     };
-    
-    std::vector<ReplicaEndpoint> replicas_;
+
+    // Sender thread: optional full resync, then the stream until an error
+    void run_replica(Replica& replica, bool full_sync, std::string greeting);
+
+    // Snapshot every database at one stream offset, then send it (sender thread)
+    bool full_resync(Replica& replica);
+
+    // Send the backlog from replica.offset on, a chunk per write, with a PING
+    // whenever the stream has been idle for a while (sender thread)
+    void stream(Replica& replica);
+
+    // Send all of data, waiting for the socket as needed; false on error or cancel
+    bool send_all(Replica& replica, const char* data, size_t size);
+    bool send_file(Replica& replica, const std::string& path);
+
+    // Copy up to max_bytes of the stream from offset into out (backlog lock held);
+    // false once the backlog has overwritten offset
+    bool copy_backlog(uint64_t offset, size_t max_bytes, std::string& out) const;
+
+    // Append raw stream bytes (backlog lock held)
+    void append_backlog(const char* data, size_t size);
+
+    // Start recording the stream (backlog lock held)
+    void activate_backlog();
+
+    // Spawn a replica's sender (replicas lock held)
+    void launch(std::unique_ptr<Replica> replica, bool full_sync, std::string greeting);
+
+    // Join and drop replicas whose sender has exited (replicas lock held)
+    void reap_finished();
+
+    // Wake a replica's sender and wait for it to exit (replicas lock held)
+    void cancel(Replica& replica);
+
+    std::vector<KVStore>* databases_ = nullptr;
+    std::string sync_path_;
+    std::atomic<bool> running_{false};
+
+    const size_t backlog_capacity_;
+    std::mutex backlog_mutex_; // Guards the backlog state below
+    std::condition_variable backlog_cv_;
+    std::string replid_;
+    std::vector<char> backlog_;  // Circular: byte i of the stream lives at i % capacity
+    uint64_t offset_ = 0;        // Stream bytes written so far (master_repl_offset)
+    int selected_db_ = -1;       // Database the stream last selected (-1 = none yet)
+    int64_t last_append_ms_ = 0; // When the stream last grew, for heartbeats
+    int waiting_senders_ = 0;
+    // Set once a replica has attached; until then writes skip the backlog. A
+    // full resync sets it with the gate closed, so a write that skipped the
+    // backlog is already in the resync's snapshot.
+    std::atomic<bool> backlog_active_{false};
+
+    mini_redis::WriteGate write_gate_; // Closed while a full resync snapshots
+    std::mutex cut_mutex_;             // One full resync at a time closes the gate
+
     std::mutex replicas_mutex_;
+    std::vector<std::unique_ptr<Replica>> replicas_;
+    uint64_t next_replica_id_ = 0;
 };
-
@@ -0,0 +1,571 @@
+// Script cache, direct command bindings for redis.call, and the Lua glue
+
+#include "scripting.hpp"
+
+#include "../protocol/command_table.hpp"
+#include "../protocol/resp_utils.hpp"
+#include "../storage/kv_store.hpp"
+#include "../utils/sha1.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <memory>
+#include <unordered_set>
+
+#ifdef MINI_REDIS_WITH_LUA
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+}
+#endif
+
+namespace mini_redis {
+
+ScriptCache script_cache;
+
+ScriptValue ScriptValue::of_integer(int64_t value) {
+    ScriptValue out;
+    out.kind = Kind::Integer;
+    out.integer = value;
+    return out;
+}
+
+ScriptValue ScriptValue::status(std::string text) {
+    ScriptValue out;
+    out.kind = Kind::Status;
+    out.text = std::move(text);
+    return out;
+}
+
+ScriptValue ScriptValue::error(std::string text) {
+    ScriptValue out;
+    out.kind = Kind::Error;
+    out.text = std::move(text);
+    return out;
+}
+
+ScriptValue ScriptValue::bulk(std::string text) {
+    ScriptValue out;
+    out.kind = Kind::Bulk;
+    out.text = std::move(text);
+    return out;
+}
+
+void write_script_value(ReplyWriter& reply, const ScriptValue& value) {
+    switch (value.kind) {
+        case ScriptValue::Kind::Nil:
+            reply.nil();
+            break;
+        case ScriptValue::Kind::Integer:
+            reply.integer(value.integer);
+            break;
+        case ScriptValue::Kind::Status:
+            reply.simple(value.text);
+            break;
+        case ScriptValue::Kind::Error:
+            reply.error(value.text);
+            break;
+        case ScriptValue::Kind::Bulk:
+            reply.bulk(value.text);
+            break;
+        case ScriptValue::Kind::Array:
+            reply.array_header(value.elements.size());
+            for (const ScriptValue& element : value.elements) {
+                write_script_value(reply, element);
+            }
+            break;
+    }
+}
+
+std::string ScriptCache::add(const std::string& source) {
+    std::string sha = sha1_hex(source);
+    std::lock_guard<std::mutex> lock(mutex_);
+    scripts_.emplace(sha, source);
+    return sha;
+}
+
+bool ScriptCache::find(const std::string& sha, std::string& source) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = scripts_.find(sha);
+    if (it == scripts_.end()) {
+        return false;
+    }
+    source = it->second;
+    return true;
+}
+
+bool ScriptCache::contains(const std::string& sha) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return scripts_.count(sha) != 0;
+}
+
+void ScriptCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    scripts_.clear();
+    generation_.fetch_add(1, std::memory_order_release);
+}
+
+namespace {
+
+const char* NOT_INTEGER = "ERR value is not an integer or out of range";
+
+bool parse_int(const std::string& s, int64_t& out) {
+    auto parsed = std::from_chars(s.data(), s.data() + s.size(), out);
+    return parsed.ec == std::errc() && parsed.ptr == s.data() + s.size() && !s.empty();
+}
+
+ScriptValue counter_value(const std::pair<int64_t, std::string>& outcome) {
+    return outcome.second.empty() ? ScriptValue::of_integer(outcome.first) : ScriptValue::error(outcome.second);
+}
+
+ScriptValue wrong_type() {
+    return ScriptValue::error(KVStore::WRONGTYPE_ERROR);
+}
+
+// Run a bound command (arity and keys already checked)
+ScriptValue call_command(ScriptRun& run, const protocol::Command& cmd) {
+    using protocol::CommandType;
+    KVStore& db = run.db;
+    const std::vector<std::string>& args = cmd.args;
+    bool wrote = false;
+    ScriptValue out;
+
+    switch (cmd.type) {
+        case CommandType::PING:
+            return ScriptValue::status("PONG");
+        case CommandType::GET: {
+            bool is_wrong_type = false;
+            if (!db.read_value(args[0], [&](std::string_view value) { out = ScriptValue::bulk(std::string(value)); },
+                               &is_wrong_type) && is_wrong_type) {
+                return wrong_type();
+            }
+            return out;
+        }
+        case CommandType::SET:
+            db.set(args[0], args[1]);
+            wrote = true;
+            out = ScriptValue::status("OK");
+            break;
+        case CommandType::DEL: {
+            const size_t removed = db.del_many(args);
+            wrote = removed > 0;
+            out = ScriptValue::of_integer(static_cast<int64_t>(removed));
+            break;
+        }
+        case CommandType::EXISTS:
+            return ScriptValue::of_integer(static_cast<int64_t>(db.exists_many(args)));
+        case CommandType::INCR:
+        case CommandType::DECR:
+        case CommandType::INCRBY:
+        case CommandType::DECRBY: {
+            int64_t delta = 1;
+            if (args.size() > 1 && !parse_int(args[1], delta)) {
+                return ScriptValue::error(NOT_INTEGER);
+            }
+            const bool down = cmd.type == CommandType::DECR || cmd.type == CommandType::DECRBY;
+            out = counter_value(down ? db.decrby(args[0], delta) : db.incrby(args[0], delta));
+            wrote = out.kind != ScriptValue::Kind::Error;
+            break;
+        }
+        case CommandType::EXPIRE:
+        case CommandType::PEXPIRE: {
+            int64_t amount = 0;
+            const bool seconds = cmd.type == CommandType::EXPIRE;
+            if (!parse_int(args[1], amount) || (seconds && (amount < INT32_MIN || amount > INT32_MAX))) {
+                return ScriptValue::error(NOT_INTEGER);
+            }
+            wrote = seconds ? db.expire(args[0], static_cast<int>(amount)) : db.pexpire(args[0], amount);
+            out = ScriptValue::of_integer(wrote ? 1 : 0);
+            break;
+        }
+        case CommandType::TTL:
+            return ScriptValue::of_integer(db.ttl(args[0]));
+        case CommandType::PTTL:
+            return ScriptValue::of_integer(db.pttl(args[0]));
+        case CommandType::APPEND: {
+            bool is_wrong_type = false;
+            const size_t length = db.append(args[0], args[1], &is_wrong_type);
+            if (is_wrong_type) {
+                return wrong_type();
+            }
+            wrote = true;
+            out = ScriptValue::of_integer(static_cast<int64_t>(length));
+            break;
+        }
+        case CommandType::STRLEN: {
+            bool is_wrong_type = false;
+            const size_t length = db.strlen(args[0], &is_wrong_type);
+            return is_wrong_type ? wrong_type() : ScriptValue::of_integer(static_cast<int64_t>(length));
+        }
+        case CommandType::TYPE: {
+            ValueType type;
+            return ScriptValue::status(db.type_of(args[0], type) ? value_type_name(type) : "none");
+        }
+        case CommandType::HSET: {
+            if (args.size() % 2 == 0) {
+                return ScriptValue::error("ERR wrong number of arguments for 'hset' command");
+            }
+            size_t added = 0;
+            if (db.hset(args, added) == KVStore::Lookup::WrongType) {
+                return wrong_type();
+            }
+            wrote = true;
+            out = ScriptValue::of_integer(static_cast<int64_t>(added));
+            break;
+        }
+        case CommandType::HGET: {
+            const KVStore::Lookup lookup = db.read_collection<HashValue>(args[0], [&](const HashValue& hash) {
+                std::string_view value;
+                if (hash.get(args[1], value)) {
+                    out = ScriptValue::bulk(std::string(value));
+                }
+            });
+            return lookup == KVStore::Lookup::WrongType ? wrong_type() : out;
+        }
+        case CommandType::LPUSH:
+        case CommandType::RPUSH: {
+            size_t length = 0;
+            if (db.push(args, cmd.type == CommandType::LPUSH, length) == KVStore::Lookup::WrongType) {
+                return wrong_type();
+            }
+            wrote = true;
+            out = ScriptValue::of_integer(static_cast<int64_t>(length));
+            break;
+        }
+        case CommandType::RPOP: {
+            int64_t count = 1;
+            if (args.size() > 2) {
+                return ScriptValue::error("ERR syntax error");
+            }
+            if (args.size() == 2 && (!parse_int(args[1], count) || count < 0)) {
+                return ScriptValue::error("ERR value is out of range, must be positive");
+            }
+            std::vector<std::string> popped;
+            const KVStore::Lookup lookup = db.rpop(args[0], static_cast<size_t>(count), popped);
+            if (lookup == KVStore::Lookup::WrongType) {
+                return wrong_type();
+            }
+            wrote = !popped.empty();
+            if (args.size() == 1) {
+                out = popped.empty() ? ScriptValue::nil() : ScriptValue::bulk(std::move(popped[0]));
+            } else if (lookup == KVStore::Lookup::Found) {
+                out.kind = ScriptValue::Kind::Array;
+                for (std::string& value : popped) {
+                    out.elements.push_back(ScriptValue::bulk(std::move(value)));
+                }
+            }
+            break;
+        }
+        case CommandType::SADD: {
+            size_t added = 0;
+            if (db.sadd(args, added) == KVStore::Lookup::WrongType) {
+                return wrong_type();
+            }
+            wrote = added > 0;
+            out = ScriptValue::of_integer(static_cast<int64_t>(added));
+            break;
+        }
+        case CommandType::SISMEMBER: {
+            bool member = false;
+            const KVStore::Lookup lookup = db.read_collection<SetValue>(
+                args[0], [&](const SetValue& set) { member = set.contains(args[1]); });
+            return lookup == KVStore::Lookup::WrongType ? wrong_type() : ScriptValue::of_integer(member ? 1 : 0);
+        }
+        case CommandType::ZADD: {
+            ZAddArgs zadd;
+            if (const char* error = parse_zadd(args, zadd)) {
+                return ScriptValue::error(error);
+            }
+            size_t added = 0;
+            size_t changed = 0;
+            if (db.zadd(args[0], zadd, added, changed) == KVStore::Lookup::WrongType) {
+                return wrong_type();
+            }
+            wrote = changed > 0;
+            out = ScriptValue::of_integer(static_cast<int64_t>(zadd.changed ? changed : added));
+            break;
+        }
+        default:
+            return ScriptValue::error("ERR This command is not supported from scripts");
+    }
+
+    if (wrote && run.propagate) {
+        run.propagate(cmd);
+    }
+    return out;
+}
+
+} // anonymous namespace
+
+ScriptValue script_call(ScriptRun& run, const std::vector<std::string>& args) {
+    if (args.empty()) {
+        return ScriptValue::error("ERR Please specify at least one argument for this redis lib call");
+    }
+    std::string name = args[0];
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    const protocol::CommandSpec* spec = protocol::lookup_command(name);
+    if (!spec) {
+        return ScriptValue::error("ERR Unknown Redis command called from script");
+    }
+    protocol::Command cmd;
+    cmd.type = spec->type;
+    cmd.args.assign(args.begin() + 1, args.end());
+    if (!protocol::check_arity(*spec, cmd.args.size())) {
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return ScriptValue::error("ERR wrong number of arguments for '" + name + "' command");
+    }
+    if (run.read_only && (spec->flags & protocol::CMD_WRITE)) {
+        return ScriptValue::error("ERR Write commands are not allowed from read-only scripts");
+    }
+    // Only the declared KEYS may be touched. EVAL locks their shards up front
+    // with ShardLocks, in sorted order, as EXEC does; a script reaching another
+    // key would lock its shard out of that order while holding the others,
+    // and two such scripts (or a script and an EXEC) could deadlock.
+    const protocol::KeyRange keys = protocol::command_keys(cmd);
+    for (size_t i = keys.first; i < keys.end; i += keys.step) {
+        if (std::find(run.keys.begin(), run.keys.end(), cmd.args[i]) == run.keys.end()) {
+            return ScriptValue::error("ERR Script attempted to access a key not declared in KEYS: " + cmd.args[i]);
+        }
+    }
+    return call_command(run, cmd);
+}
+
+#ifdef MINI_REDIS_WITH_LUA
+
+namespace {
+
+// A thread's interpreter, with the scripts it has compiled kept in its
+// registry as "f_<sha>"
+struct LuaState {
+    lua_State* L = nullptr;
+    uint64_t generation = 0; // script_cache.generation() the scripts were compiled under
+    std::unordered_set<std::string> compiled;
+    ScriptRun* run = nullptr; // The script running now
+
+    LuaState();
+    ~LuaState() { lua_close(L); }
+};
+
+// A Lua number, truncated towards zero as Redis does
+int64_t to_integer(lua_State* L, int index) {
+#if LUA_VERSION_NUM >= 503
+    if (lua_isinteger(L, index)) {
+        return static_cast<int64_t>(lua_tointeger(L, index));
+    }
+#endif
+    return static_cast<int64_t>(lua_tonumber(L, index));
+}
+
+void push_value(lua_State* L, const ScriptValue& value) {
+    lua_checkstack(L, 4);
+    switch (value.kind) {
+        case ScriptValue::Kind::Nil:
+            lua_pushboolean(L, 0); // A nil reply is false, so it can sit in a table
+            break;
+        case ScriptValue::Kind::Integer:
+            lua_pushinteger(L, static_cast<lua_Integer>(value.integer));
+            break;
+        case ScriptValue::Kind::Status:
+        case ScriptValue::Kind::Error:
+            lua_newtable(L);
+            lua_pushlstring(L, value.text.data(), value.text.size());
+            lua_setfield(L, -2, value.kind == ScriptValue::Kind::Status ? "ok" : "err");
+            break;
+        case ScriptValue::Kind::Bulk:
+            lua_pushlstring(L, value.text.data(), value.text.size());
+            break;
+        case ScriptValue::Kind::Array:
+            lua_newtable(L);
+            for (size_t i = 0; i < value.elements.size(); ++i) {
+                push_value(L, value.elements[i]);
+                lua_rawseti(L, -2, static_cast<int>(i + 1));
+            }
+            break;
+    }
+}
+
+// The Lua value at index as a reply: numbers are truncated to integers,
+// true is 1, false and nil are nil, {ok=} / {err=} tables are status and
+// error replies, and other tables are arrays up to their first nil
+ScriptValue to_value(lua_State* L, int index) {
+    lua_checkstack(L, 4);
+    switch (lua_type(L, index)) {
+        case LUA_TNUMBER:
+            return ScriptValue::of_integer(to_integer(L, index));
+        case LUA_TSTRING: {
+            size_t len = 0;
+            const char* s = lua_tolstring(L, index, &len);
+            return ScriptValue::bulk(std::string(s, len));
+        }
+        case LUA_TBOOLEAN:
+            return lua_toboolean(L, index) ? ScriptValue::of_integer(1) : ScriptValue::nil();
+        case LUA_TTABLE: {
+            const int table = index < 0 ? lua_gettop(L) + index + 1 : index;
+            for (const char* field : {"err", "ok"}) {
+                lua_getfield(L, table, field);
+                if (lua_type(L, -1) == LUA_TSTRING) {
+                    std::string text = lua_tostring(L, -1);
+                    lua_pop(L, 1);
+                    return field[0] == 'e' ? ScriptValue::error(std::move(text)) : ScriptValue::status(std::move(text));
+                }
+                lua_pop(L, 1);
+            }
+            ScriptValue array;
+            array.kind = ScriptValue::Kind::Array;
+            for (int i = 1;; ++i) {
+                lua_rawgeti(L, table, i);
+                if (lua_isnil(L, -1)) {
+                    lua_pop(L, 1);
+                    break;
+                }
+                array.elements.push_back(to_value(L, -1));
+                lua_pop(L, 1);
+            }
+            return array;
+        }
+        default:
+            return ScriptValue::nil();
+    }
+}
+
+// The C++ half of redis.call / redis.pcall: leaves the reply, or for a
+// failed redis.call the error to raise, on the stack. Kept apart from the
+// lua_CFunction so no C++ object is alive when lua_error unwinds.
+bool call_from_lua(lua_State* L, bool raise) {
+    auto* state = static_cast<LuaState*>(lua_touserdata(L, lua_upvalueindex(1)));
+    const int argc = lua_gettop(L);
+    std::vector<std::string> args;
+    args.reserve(static_cast<size_t>(argc));
+    for (int i = 1; i <= argc; ++i) {
+        const int type = lua_type(L, i);
+        if (type != LUA_TSTRING && type != LUA_TNUMBER) {
+            push_value(L, ScriptValue::error("ERR Lua redis lib command arguments must be strings or integers"));
+            return !raise;
+        }
+        if (type == LUA_TNUMBER) {
+            args.push_back(std::to_string(to_integer(L, i)));
+        } else {
+            size_t len = 0;
+            const char* s = lua_tolstring(L, i, &len);
+            args.emplace_back(s, len);
+        }
+    }
+    const ScriptValue result = script_call(*state->run, args);
+    push_value(L, result);
+    return !raise || result.kind != ScriptValue::Kind::Error;
+}
+
+int lua_redis_call(lua_State* L) {
+    if (!call_from_lua(L, true)) {
+        return lua_error(L);
+    }
+    return 1;
+}
+
+int lua_redis_pcall(lua_State* L) {
+    call_from_lua(L, false);
+    return 1;
+}
+
+LuaState::LuaState() {
+    L = luaL_newstate();
+    luaL_openlibs(L);
+    // Scripts get the language, not the host: no files, processes or modules
+    for (const char* name : {"io", "os", "package", "debug", "dofile", "loadfile", "require"}) {
+        lua_pushnil(L);
+        lua_setglobal(L, name);
+    }
+    lua_newtable(L);
+    lua_pushlightuserdata(L, this);
+    lua_pushcclosure(L, lua_redis_call, 1);
+    lua_setfield(L, -2, "call");
+    lua_pushlightuserdata(L, this);
+    lua_pushcclosure(L, lua_redis_pcall, 1);
+    lua_setfield(L, -2, "pcall");
+    lua_setglobal(L, "redis");
+    luaL_dostring(L, "redis.status_reply = function(s) return {ok = s} end\n"
+                     "redis.error_reply = function(s) return {err = s} end\n");
+    lua_settop(L, 0);
+}
+
+LuaState& thread_lua() {
+    thread_local std::unique_ptr<LuaState> state;
+    const uint64_t generation = script_cache.generation();
+    if (!state || state->generation != generation) {
+        state.reset(); // SCRIPT FLUSH: start over rather than unpick its scripts
+        state = std::make_unique<LuaState>();
+        state->generation = generation;
+    }
+    return *state;
+}
+
+void set_string_array(lua_State* L, const char* name, const std::vector<std::string>& values) {
+    lua_createtable(L, static_cast<int>(values.size()), 0);
+    for (size_t i = 0; i < values.size(); ++i) {
+        lua_pushlstring(L, values[i].data(), values[i].size());
+        lua_rawseti(L, -2, static_cast<int>(i + 1));
+    }
+    lua_setglobal(L, name);
+}
+
+} // anonymous namespace
+
+bool scripting_available() {
+    return true;
+}
+
+ScriptValue run_script(ScriptRun& run, const std::string& sha, const std::string& source,
+                       const std::vector<std::string>& argv) {
+    LuaState& state = thread_lua();
+    lua_State* L = state.L;
+    const std::string name = "f_" + sha;
+    if (!state.compiled.count(sha)) {
+        if (luaL_loadbuffer(L, source.data(), source.size(), "@user_script") != 0) {
+            std::string message = lua_tostring(L, -1);
+            lua_settop(L, 0);
+            return ScriptValue::error("ERR Error compiling script: " + message);
+        }
+        lua_setfield(L, LUA_REGISTRYINDEX, name.c_str());
+        state.compiled.insert(sha);
+    }
+
+    set_string_array(L, "KEYS", run.keys);
+    set_string_array(L, "ARGV", argv);
+    lua_getfield(L, LUA_REGISTRYINDEX, name.c_str());
+    state.run = &run;
+    const int status = lua_pcall(L, 0, 1, 0);
+    state.run = nullptr;
+
+    ScriptValue result;
+    if (status == 0) {
+        result = to_value(L, -1);
+    } else if (lua_type(L, -1) == LUA_TTABLE) {
+        result = to_value(L, -1); // redis.call's error, raised as {err = ...}
+        if (result.kind != ScriptValue::Kind::Error) {
+            result = ScriptValue::error("ERR Error running script");
+        }
+    } else {
+        const char* message = lua_tostring(L, -1);
+        result = ScriptValue::error(std::string("ERR Error running script: ") + (message ? message : "unknown error"));
+    }
+    lua_settop(L, 0);
+    return result;
+}
+
+#else
+
+bool scripting_available() {
+    return false;
+}
+
+ScriptValue run_script(ScriptRun&, const std::string&, const std::string&, const std::vector<std::string>&) {
+    return ScriptValue::error("ERR This server was built without Lua scripting support");
+}
+
+#endif
+
+} // namespace mini_redis
@@ -0,0 +1,89 @@
+// Scripting for Mini-Redis: EVAL, EVALSHA (and their read-only _RO forms) and SCRIPT
+// A script runs on its connection's thread, in a Lua state the thread keeps
+// for every script it runs; each script is compiled once per state and found
+// by its SHA-1 afterwards. The shards of the script's KEYS stay locked for the
+// whole run, as for EXEC, so the script is atomic. redis.call and redis.pcall
+// go straight to the KVStore API (script_call) rather than encoding a RESP
+// command and parsing the reply back, and may only name the declared KEYS:
+// other keys' shards are not locked, and locking them mid-script could wait
+// on another lock holder in a cycle.
+// Writes are logged and replicated as the commands the script called.
+// Lua is optional at build time (MINI_REDIS_WITH_LUA, set when CMake finds
+// it); without it EVAL replies with an error, while SCRIPT still manages the cache.
+
+#pragma once
+
+#include "../protocol/parser.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class KVStore;
+class ReplyWriter;
+
+namespace mini_redis {
+
+// A command reply or script result, as Lua sees it and as the client gets it
+struct ScriptValue {
+    enum class Kind : uint8_t { Nil, Integer, Status, Error, Bulk, Array };
+
+    Kind kind = Kind::Nil;
+    int64_t integer = 0;
+    std::string text; // Status, Error or Bulk
+    std::vector<ScriptValue> elements;
+
+    static ScriptValue nil() { return ScriptValue(); }
+    static ScriptValue of_integer(int64_t value);
+    static ScriptValue status(std::string text);
+    static ScriptValue error(std::string text);
+    static ScriptValue bulk(std::string text);
+};
+
+void write_script_value(ReplyWriter& reply, const ScriptValue& value);
+
+// Script sources by SHA-1 (filled by EVAL and SCRIPT LOAD), shared by every thread
+class ScriptCache {
+public:
+    // Cache source under its SHA-1, which is returned
+    std::string add(const std::string& source);
+    // sha in lowercase hex
+    bool find(const std::string& sha, std::string& source) const;
+    bool contains(const std::string& sha) const;
+    void clear();
+    // Bumped by clear, so threads drop the scripts they compiled
+    uint64_t generation() const { return generation_.load(std::memory_order_acquire); }
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::string> scripts_;
+    std::atomic<uint64_t> generation_{0};
+};
+
+extern ScriptCache script_cache;
+
+// What a running script works on
+struct ScriptRun {
+    KVStore& db;
+    const std::vector<std::string>& keys; // Its KEYS, with their shards locked
+    // Log and replicate a write the script made
+    std::function<void(const protocol::Command&)> propagate;
+    bool read_only = false; // EVAL_RO / EVALSHA_RO: write commands are refused
+};
+
+// redis.call: args[0] is the command name (any case). Errors, including
+// commands scripts cannot call, come back as an Error value.
+ScriptValue script_call(ScriptRun& run, const std::vector<std::string>& args);
+
+// Whether this build can run scripts
+bool scripting_available();
+
+// Run source, cached as sha, with KEYS = run.keys and ARGV = argv
+ScriptValue run_script(ScriptRun& run, const std::string& sha, const std::string& source,
+                       const std::vector<std::string>& argv);
+
+} // namespace mini_redis
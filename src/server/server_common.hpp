@@ -10,13 +10,16 @@
 #include <mutex>
 #include <atomic>
 #include <ctime>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <iterator>
 
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#include <winsock2.h>
-#else
-#error "This implementation currently supports only Windows (Winsock)."
-#endif
+#include "socket_compat.hpp"
+#include "../protocol/parser.hpp"
+#include "utils/config.hpp"
 
 class KVStore;
 
@@ -24,60 +27,237 @@ class KVStore;
 class RespParser;
 
 namespace mini_redis {
+class ReplyChain;
+class PubSub;
+class Subscriber;
+class Transaction;
+class ClientTracking;
 namespace detail {
 
 // Client context: tracks per-client state (database selection, authentication, request count)
 struct ClientContext {
+    // CLIENT TRACKING mode; the other options live in the tracking table
+    enum class TrackingMode : uint8_t { Off, Default, OptIn, OptOut, Broadcast };
+
+    uint64_t id = 0; // Unique per connection (CLIENT ID), renewed by reset()
+    int resp = 2;    // Protocol version chosen with HELLO
     int db_index = 0; // Current database index
     bool authenticated = false; // Authentication status (stub: always true for now)
     int request_count = 0; // Number of requests processed
-    std::set<std::string> subscribed_channels; // Channels this client is subscribed to
+    // Created by the client's first SUBSCRIBE; leaves its channels when destroyed
+    std::unique_ptr<Subscriber> subscriber;
+    // Set by the server: tells it messages are waiting for this client (see
+    // Subscriber::Wake). Without one, messages wait until the client's next command.
+    std::function<void()> wake_subscriber;
+    uint64_t aof_ticket = 0; // AOF position of the latest write not yet waited for (appendfsync always)
+    // Commands the server issues itself (its primary's replication stream, a
+    // slot migration's deletes): may write on a replica and skip cluster routing
+    bool internal = false;
+    bool asking = false; // ASKING was sent: the next command may use a slot being imported
+    // Created by the client's first MULTI or WATCH; unwatches its keys when destroyed
+    std::unique_ptr<Transaction> transaction;
+    TrackingMode tracking = TrackingMode::Off;
+    bool caching = false; // CLIENT CACHING was sent: the next command's reads are (OPTIN) / are not (OPTOUT) tracked
     RespParser* parser = nullptr; // RESP parser instance (owned by this context)
+    // Set by servers that send replies as gather lists: replies into its bytes
+    // may splice in large stored values instead of copying them
+    ReplyChain* replies = nullptr;
     
     // Constructor/destructor implemented in .cpp files (need full RespParser definition)
     ClientContext();
     ~ClientContext();
     
+    // Back to the state of a new connection, keeping the parser and its buffer
+    void reset();
+    
     // Non-copyable (parser ownership)
     ClientContext(const ClientContext&) = delete;
     ClientContext& operator=(const ClientContext&) = delete;
     
-    // Movable
-    ClientContext(ClientContext&& other) noexcept 
-        : db_index(other.db_index), authenticated(other.authenticated),
-          request_count(other.request_count), subscribed_channels(std::move(other.subscribed_channels)),
-          parser(other.parser) {
-        other.parser = nullptr;
-    }
+    // Movable (out of line as well: the transaction's type is incomplete here)
+    ClientContext(ClientContext&& other) noexcept;
 };
 
-// Process a single command and return reply and quit flag
+// Outcome of a single command (the reply itself is written to the output buffer)
 struct CommandResult {
-    std::string reply;
     bool should_quit;
     bool success;
 };
 
 // Shared server resources (defined in tcp_server.cpp)
+// The databases vector is sized once at startup and never resized, so it needs no lock
 extern std::vector<KVStore> databases;
-extern std::mutex databases_mutex;
-extern std::map<std::string, std::set<SOCKET>> channels;
-extern std::mutex channels_mutex;
+extern PubSub pubsub;
+extern ClientTracking tracking;
 extern time_t server_start_time;
 extern std::atomic<long long> total_commands_processed;
+extern std::string rdb_path; // SAVE / BGSAVE / LOAD file (set from the config at startup)
+
+// Databases commands on this thread operate on: null means the shared
+// databases; in thread-per-core mode each core points it at its own slice
+extern thread_local std::vector<KVStore>* thread_databases;
+
+inline std::vector<KVStore>& local_databases() {
+    return thread_databases ? *thread_databases : databases;
+}
 
 } // namespace detail
 
 } // namespace mini_redis
 
 // Forward declarations for global managers (defined in tcp_server.cpp)
-// Note: AOFLogger and ReplicationManager are global classes, not in mini_redis namespace
+// Note: AOFLogger, ReplicationManager, ReplicaLink and ClusterState are global classes, not in mini_redis namespace
 class AOFLogger;
 class ReplicationManager;
+class ReplicaLink;
+class ClusterState;
+class ActiveExpirer;
+class LazyFreer;
 
 namespace mini_redis {
 // Global manager pointers (defined in tcp_server.cpp)
 extern AOFLogger* g_aof_logger;
 extern ReplicationManager* g_replication_manager;
+extern ReplicaLink* g_replica_link; // Null in thread-per-core mode
+extern ClusterState* g_cluster; // Null unless cluster mode is enabled
+extern ActiveExpirer* g_active_expirer;
+extern LazyFreer* g_lazy_freer;
+
+// Shared by every server backend
+
+// Extract complete RESP commands from a client's parser (tcp_server.cpp)
+std::vector<protocol::Command> extract_resp_commands(RespParser* parser, std::string* error_msg = nullptr);
+
+// Current database for a client (tcp_server.cpp)
+KVStore& get_db(detail::ClientContext& ctx);
+
+// Run one command, appending its reply to out (command_handlers.cpp)
+detail::CommandResult process_command(const protocol::Command& cmd, detail::ClientContext& ctx,
+                                      SOCKET client_socket, std::string& out);
+
+// Reply to a command the parser could not name; inside MULTI it also makes
+// the EXEC abort (command_handlers.cpp)
+void reply_unknown_command(const protocol::Command& cmd, detail::ClientContext& ctx, std::string& out);
+
+// process_command without updating the request counters, for work forwarded
+// from the core that already counted it (command_handlers.cpp)
+detail::CommandResult dispatch_command(const protocol::Command& cmd, detail::ClientContext& ctx,
+                                       SOCKET client_socket, std::string& out);
+
+// Before a batch of replies is sent: under appendfsync always, block until
+// every write the batch logged is on disk; false if the AOF failed first.
+// Only for the thread-per-client server; event loops hold the replies back
+// with DurableWaits (tcp_server.cpp)
+bool wait_for_aof(detail::ClientContext& ctx);
+
+// The AOF position the batch's replies must wait for, or 0 if they can go out
+// now; clears the client's ticket either way (tcp_server.cpp)
+uint64_t take_aof_ticket(detail::ClientContext& ctx);
+
+// True once everything up to ticket is on disk (tcp_server.cpp)
+bool aof_durable(uint64_t ticket);
+
+// The AOF cannot be written: writes are refused and held replies fail
+// instead of waiting (tcp_server.cpp)
+bool aof_write_failed();
+
+// Sent in place of a batch's held replies when the AOF fails before they are
+// durable. The connection is closed after it: the client cannot tell which
+// of its writes were logged (tcp_server.cpp)
+std::string aof_failure_error();
+
+// Call listener from the AOF writer after each fsync under appendfsync
+// always (tcp_server.cpp)
+void on_aof_durable(std::function<void()> listener);
+
+// Replies an event loop holds back until the AOF has their writes on disk.
+// The loop parks an item with its ticket and calls release() before it next
+// sleeps; the AOF writer calls wake (from its own thread) once it fsyncs
+// while anything is parked. Owned and used by one loop thread.
+template <typename T>
+class DurableWaits {
+public:
+    explicit DurableWaits(std::function<void()> wake) : state_(std::make_shared<State>()) {
+        state_->wake = std::move(wake);
+        std::shared_ptr<State> state = state_;
+        on_aof_durable([state] {
+            if (state->wanted.load()) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (state->wake) {
+                    state->wake();
+                }
+            }
+        });
+    }
+    ~DurableWaits() {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        state_->wanted = false;
+        state_->wake = nullptr;
+    }
+
+    DurableWaits(const DurableWaits&) = delete;
+    DurableWaits& operator=(const DurableWaits&) = delete;
+
+    bool empty() const { return parked_.empty(); }
+
+    void park(T item, uint64_t ticket) { parked_.emplace_back(std::move(item), ticket); }
+
+    // Drop everything parked for item (e.g. its connection closed)
+    void forget(const T& item) {
+        parked_.erase(std::remove_if(parked_.begin(), parked_.end(),
+                                     [&](const std::pair<T, uint64_t>& entry) { return entry.first == item; }),
+                      parked_.end());
+    }
+
+    // Hand every item whose writes are durable to fn(item, true), or every
+    // item to fn(item, false) once the AOF has failed. Stops once none is
+    // ready: wanted is raised before looking, and the writer stores its
+    // position (or error) before reading wanted, so it is sure to wake the loop.
+    template <typename Fn>
+    void release(Fn&& fn) {
+        while (true) {
+            if (parked_.empty()) {
+                state_->wanted.store(false);
+                return;
+            }
+            state_->wanted.store(true);
+            std::vector<std::pair<T, uint64_t>> ready;
+            const bool failed = aof_write_failed();
+            auto still_waiting = std::stable_partition(
+                parked_.begin(), parked_.end(),
+                [failed](const std::pair<T, uint64_t>& entry) { return !failed && !aof_durable(entry.second); });
+            std::move(still_waiting, parked_.end(), std::back_inserter(ready));
+            parked_.erase(still_waiting, parked_.end());
+            if (ready.empty()) {
+                return;
+            }
+            // fn may park again (a released connection runs its next commands)
+            for (auto& entry : ready) {
+                fn(entry.first, aof_durable(entry.second));
+            }
+        }
+    }
+
+private:
+    struct State {
+        std::atomic<bool> wanted{false};
+        std::mutex mutex;
+        std::function<void()> wake;
+    };
+
+    std::shared_ptr<State> state_;
+    std::vector<std::pair<T, uint64_t>> parked_;
+};
+
+// Apply the config's storage settings to a set of databases (tcp_server.cpp)
+void configure_databases(std::vector<KVStore>& dbs, const Config& cfg);
+
+// Apply the config, replay the AOF and start AOF logging, replication and
+// active expiry; stop_services shuts them down (tcp_server.cpp)
+void start_services(const Config& cfg);
+void stop_services();
+
+// Create a TCP socket bound and listening on port, or INVALID_SOCKET (tcp_server.cpp)
+SOCKET open_listen_socket(int port);
 } // namespace mini_redis
 
@@ -0,0 +1,163 @@
+// Portable socket layer for Mini-Redis
+// Winsock on Windows; BSD sockets elsewhere, exposed under the Winsock names
+// (SOCKET, INVALID_SOCKET, SOCKET_ERROR, closesocket) the servers are written against
+
+#pragma once
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef _WINSOCK_DEPRECATED_NO_WARNINGS
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+
+using SOCKET = int;
+using u_short = unsigned short;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+inline int closesocket(SOCKET s) {
+    return ::close(s);
+}
+#endif
+
+namespace mini_redis {
+
+// Process-wide socket setup: WSAStartup on Windows; elsewhere ignore SIGPIPE so a
+// write to a closed peer fails with EPIPE instead of killing the server
+inline bool net_init() {
+#ifdef _WIN32
+    WSADATA wsaData;
+    return WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+#else
+    std::signal(SIGPIPE, SIG_IGN);
+    return true;
+#endif
+}
+
+inline void net_cleanup() {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+// Switch a socket to non-blocking mode
+inline bool set_nonblocking(SOCKET s) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Disable Nagle so small pipelined replies are not delayed
+inline void set_nodelay(SOCKET s) {
+    int yes = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&yes), sizeof(yes));
+}
+
+// True if the last failed socket call would have blocked (EAGAIN / WSAEWOULDBLOCK)
+inline bool socket_would_block() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+// Wait up to timeout_ms for a socket to have data (or a closed peer); false on timeout
+inline bool wait_readable(SOCKET s, int timeout_ms) {
+#ifdef _WIN32
+    WSAPOLLFD pfd{};
+    pfd.fd = s;
+    pfd.events = POLLRDNORM;
+    return WSAPoll(&pfd, 1, timeout_ms) > 0;
+#else
+    pollfd pfd{};
+    pfd.fd = s;
+    pfd.events = POLLIN;
+    return ::poll(&pfd, 1, timeout_ms) > 0;
+#endif
+}
+
+// Wait up to timeout_ms for a socket to accept more data; false on timeout
+inline bool wait_writable(SOCKET s, int timeout_ms) {
+#ifdef _WIN32
+    WSAPOLLFD pfd{};
+    pfd.fd = s;
+    pfd.events = POLLWRNORM;
+    return WSAPoll(&pfd, 1, timeout_ms) > 0;
+#else
+    pollfd pfd{};
+    pfd.fd = s;
+    pfd.events = POLLOUT;
+    return ::poll(&pfd, 1, timeout_ms) > 0;
+#endif
+}
+
+// Connect within timeout_ms; the socket is left non-blocking
+inline bool connect_with_timeout(SOCKET s, const sockaddr_in& addr, int timeout_ms) {
+    if (!set_nonblocking(s)) {
+        return false;
+    }
+    if (connect(s, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0) {
+        return true;
+    }
+#ifdef _WIN32
+    if (WSAGetLastError() != WSAEWOULDBLOCK) {
+        return false;
+    }
+#else
+    if (errno != EINPROGRESS) {
+        return false;
+    }
+#endif
+    if (!wait_writable(s, timeout_ms)) {
+        return false;
+    }
+    int error = 0;
+    socklen_t len = sizeof(error);
+    return getsockopt(s, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &len) == 0 && error == 0;
+}
+
+// A second handle to the same connection, closed independently of the first
+inline SOCKET duplicate_socket(SOCKET s) {
+#ifdef _WIN32
+    WSAPROTOCOL_INFOW info;
+    if (WSADuplicateSocketW(s, GetCurrentProcessId(), &info) != 0) {
+        return INVALID_SOCKET;
+    }
+    return WSASocketW(FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, FROM_PROTOCOL_INFO, &info, 0, WSA_FLAG_OVERLAPPED);
+#else
+    return ::dup(s);
+#endif
+}
+
+// Stop both directions of a connection, waking any thread blocked on it
+inline void shutdown_socket(SOCKET s) {
+#ifdef _WIN32
+    ::shutdown(s, SD_BOTH);
+#else
+    ::shutdown(s, SHUT_RDWR);
+#endif
+}
+
+} // namespace mini_redis
@@ -1,15 +1,7 @@
 // TCP server implementation for Mini-Redis
 // Handles client connections, command parsing, and RESP protocol responses
 
-#ifdef _WIN32
-#define WIN32_LEAN_AND_MEAN
-#define _WINSOCK_DEPRECATED_NO_WARNINGS
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#pragma comment(lib, "ws2_32.lib")
-#else
-#error "This implementation currently supports only Windows (Winsock)."
-#endif
+#include "server/socket_compat.hpp"
 
 #include "server/tcp_server.hpp"
 #include "utils/logger.hpp"
@@ -19,9 +11,18 @@
 #include "../protocol/resp_parser.hpp"
 #include "../storage/kv_store.hpp"
 #include "../storage/aof_logger.hpp"
+#include "../storage/active_expirer.hpp"
+#include "../storage/lazy_freer.hpp"
 #include "replication.hpp"
+#include "replica_link.hpp"
+#include "cluster.hpp"
+#include "tracking.hpp"
+#include "command_stats.hpp"
+#include "pubsub.hpp"
+#include "transaction.hpp"
 
 #include <string>
+#include <algorithm>
 #include <thread>
 #include <vector>
 #include <map>
@@ -44,50 +45,109 @@ std::mutex stats_mutex; // Keep this local for now
 
 // Global AOF logger instance (initialized in start_server)
 // Declared in server_common.hpp
-AOFLogger* mini_redis::g_aof_logger = nullptr;
+AOFLogger* g_aof_logger = nullptr;
 
 // Global replication manager instance (initialized in start_server)
 // Declared in server_common.hpp
-ReplicationManager* mini_redis::g_replication_manager = nullptr;
+ReplicationManager* g_replication_manager = nullptr;
+
+// Link to this node's primary (initialized in start_services)
+ReplicaLink* g_replica_link = nullptr;
+
+// This node's cluster view (initialized in start_services in cluster mode)
+ClusterState* g_cluster = nullptr;
+
+// Background expiry thread (initialized in start_services)
+ActiveExpirer* g_active_expirer = nullptr;
+
+// Background reclaimer for lazily freed values (initialized in start_services)
+LazyFreer* g_lazy_freer = nullptr;
 
 // Multiple databases: each database is a separate KVStore instance
 std::vector<KVStore> mini_redis::detail::databases(16); // Default 16 databases (0-15)
-std::mutex mini_redis::detail::databases_mutex; // Protects database access
+thread_local std::vector<KVStore>* mini_redis::detail::thread_databases = nullptr;
+
+// Pub/Sub channels and subscriber limits
+mini_redis::PubSub mini_redis::detail::pubsub;
 
-// Pub/Sub: channel -> set of client sockets subscribed to that channel
-std::map<std::string, std::set<SOCKET>> mini_redis::detail::channels;
-std::mutex mini_redis::detail::channels_mutex; // Protects channel subscriptions
+// CLIENT TRACKING clients, sent their invalidations through pubsub
+mini_redis::ClientTracking mini_redis::detail::tracking(mini_redis::detail::pubsub);
+
+namespace {
+std::atomic<uint64_t> next_client_id{1};
+} // anonymous namespace
 
 // Server statistics
 time_t mini_redis::detail::server_start_time = time(nullptr);
 std::atomic<long long> mini_redis::detail::total_commands_processed{0};
+std::string mini_redis::detail::rdb_path = "mini_redis_dump.rdb";
 
 // ClientContext constructor/destructor implementations
-mini_redis::detail::ClientContext::ClientContext() {
+mini_redis::detail::ClientContext::ClientContext() : id(next_client_id.fetch_add(1)) {
     parser = new RespParser();
 }
 
+mini_redis::detail::ClientContext::ClientContext(ClientContext&& other) noexcept
+    : id(other.id), resp(other.resp), db_index(other.db_index), authenticated(other.authenticated),
+      request_count(other.request_count), subscriber(std::move(other.subscriber)),
+      wake_subscriber(std::move(other.wake_subscriber)),
+      aof_ticket(other.aof_ticket), internal(other.internal), asking(other.asking),
+      transaction(std::move(other.transaction)), tracking(other.tracking), caching(other.caching),
+      parser(other.parser), replies(other.replies) {
+    other.parser = nullptr;
+    other.tracking = TrackingMode::Off; // The tracking table entry moved with the id
+}
+
 mini_redis::detail::ClientContext::~ClientContext() {
+    if (tracking != TrackingMode::Off) {
+        mini_redis::detail::tracking.disable(id);
+    }
     if (parser) {
         delete parser;
         parser = nullptr;
     }
 }
 
+void mini_redis::detail::ClientContext::reset() {
+    if (tracking != TrackingMode::Off) {
+        mini_redis::detail::tracking.disable(id);
+        tracking = TrackingMode::Off;
+    }
+    caching = false;
+    id = next_client_id.fetch_add(1);
+    resp = 2;
+    db_index = 0;
+    authenticated = false;
+    request_count = 0;
+    subscriber.reset();
+    wake_subscriber = nullptr;
+    aof_ticket = 0;
+    internal = false;
+    asking = false;
+    transaction.reset();
+    if (parser) {
+        parser->reset();
+    } else {
+        parser = new RespParser();
+    }
+}
+
 // Get current database for a client - made accessible for IOCP server
+// Lock-free: the vector is fixed after startup and each KVStore locks its own shards
 KVStore& get_db(mini_redis::detail::ClientContext& ctx) {
-    std::lock_guard<std::mutex> lock(mini_redis::detail::databases_mutex);
-    if (ctx.db_index < 0 || ctx.db_index >= static_cast<int>(mini_redis::detail::databases.size())) {
+    std::vector<KVStore>& dbs = mini_redis::detail::local_databases();
+    if (ctx.db_index < 0 || ctx.db_index >= static_cast<int>(dbs.size())) {
         ctx.db_index = 0; // Default to database 0 if invalid
     }
-    return mini_redis::detail::databases[ctx.db_index];
+    return dbs[ctx.db_index];
 }
 
 // Extract complete RESP commands using the parser in ClientContext
-// Returns vector of parsed command arrays and error message if any
+// Arguments are copied once, straight from the parser's buffer into each Command
+// Returns vector of parsed commands and error message if any
 // Made accessible for IOCP server
-std::vector<std::vector<std::string>> extract_resp_commands(RespParser* parser, std::string* error_msg = nullptr) {
-    std::vector<std::vector<std::string>> commands;
+std::vector<protocol::Command> extract_resp_commands(RespParser* parser, std::string* error_msg) {
+    std::vector<protocol::Command> commands;
     
     if (!parser) {
         if (error_msg) {
@@ -97,25 +157,27 @@ std::vector<std::vector<std::string>> extract_resp_commands(RespParser* parser,
     }
     
     // Parse all complete RESP commands
+    std::vector<std::string_view> args;
+    std::string error;
     while (true) {
-        RespResult result = parser->parse();
+        RespStatus status = parser->parseArgs(args, error);
         
-        if (!result.complete) {
+        if (status == RespStatus::Incomplete) {
             // Incomplete - need more data
             break;
         }
         
-        if (!result.error.empty()) {
+        if (status == RespStatus::Error) {
             // Parse error
             if (error_msg) {
-                *error_msg = result.error;
+                *error_msg = error;
             }
             break;
         }
         
-        // Got a complete command
-        if (!result.command.empty()) {
-            commands.push_back(std::move(result.command));
+        // Got a complete command (empty arrays are skipped)
+        if (!args.empty()) {
+            commands.push_back(protocol::command_from_resp_args(args));
         }
         // Continue parsing (may have multiple commands pipelined)
     }
@@ -123,412 +185,49 @@ std::vector<std::vector<std::string>> extract_resp_commands(RespParser* parser,
     return commands;
 }
 
-// Process a single command and return reply and quit flag
-// This extracts the command handling logic so it can be called for each pipelined command
-// Made accessible for IOCP server
-mini_redis::detail::CommandResult process_command(const protocol::Command& cmd, mini_redis::detail::ClientContext& ctx, SOCKET client_socket) {
-    mini_redis::detail::CommandResult result;
-    result.should_quit = false;
-    result.success = false;
-    
-    ctx.request_count++;
-    mini_redis::detail::total_commands_processed++;
-    
-    // AUTH stub: for now, accept any password or skip if not required
-    if (cmd.type == protocol::CommandType::AUTH) {
-        ctx.authenticated = true;
-        result.reply = resp_simple("OK");
-        result.success = true;
-        return result;
-    }
-    
-    KVStore& kv = get_db(ctx);
-    
-    switch (cmd.type) {
-        case protocol::CommandType::PING:
-            result.reply = resp_simple("PONG");
-            result.success = true;
-            break;
-
-        case protocol::CommandType::ECHO:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("ECHO requires a message");
-                result.success = false;
-            } else {
-                result.reply = resp_bulk(cmd.args[0]);
-                result.success = true;
-            }
-            break;
-
-        case protocol::CommandType::SET:
-            if (cmd.args.size() < 2) {
-                result.reply = resp_err("SET requires key and value");
-                result.success = false;
-            } else {
-                kv.set(cmd.args[0], cmd.args[1]);
-                result.reply = resp_simple("OK");
-                result.success = true;
-                // Log to AOF if enabled
-                if (mini_redis::g_aof_logger) {
-                    mini_redis::g_aof_logger->append(cmd);
-                }
-                // Replicate to replicas if enabled
-                if (mini_redis::g_replication_manager) {
-                    mini_redis::g_replication_manager->replicate_command(cmd);
-                }
-            }
-            break;
-
-        case protocol::CommandType::GET:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("GET requires a key");
-                result.success = false;
-            } else {
-                std::string value;
-                if (kv.get(cmd.args[0], value)) {
-                    result.reply = resp_bulk(value);
-                    result.success = true;
-                } else {
-                    result.reply = resp_nil();
-                    result.success = true; // Key not found is valid
-                }
-            }
-            break;
-
-        case protocol::CommandType::DEL:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("DEL requires a key");
-                result.success = false;
-            } else {
-                bool removed = kv.del(cmd.args[0]);
-                result.reply = resp_integer(removed ? 1 : 0);
-                result.success = true;
-                // Log to AOF if enabled and key was removed
-                if (mini_redis::g_aof_logger && removed) {
-                    mini_redis::g_aof_logger->append(cmd);
-                }
-                // Replicate to replicas if enabled and key was removed
-                if (mini_redis::g_replication_manager && removed) {
-                    mini_redis::g_replication_manager->replicate_command(cmd);
-                }
-            }
-            break;
-
-        case protocol::CommandType::EXISTS:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("EXISTS requires a key");
-                result.success = false;
-            } else {
-                bool exists = kv.exists(cmd.args[0]);
-                result.reply = resp_integer(exists ? 1 : 0);
-                result.success = true;
-            }
-            break;
-
-        case protocol::CommandType::KEYS:
-            if (cmd.args.empty() || cmd.args[0] != "*") {
-                result.reply = resp_err("KEYS only supports wildcard *");
-                result.success = false;
-            } else {
-                std::vector<std::string> all_keys = kv.keys();
-                result.reply = resp_array(all_keys);
-                result.success = true;
-            }
-            break;
-
-        case protocol::CommandType::EXPIRE:
-            if (cmd.args.size() < 2) {
-                result.reply = resp_err("EXPIRE requires key and seconds");
-                result.success = false;
-            } else {
-                try {
-                    int seconds = std::stoi(cmd.args[1]);
-                    bool set = kv.expire(cmd.args[0], seconds);
-                    result.reply = resp_integer(set ? 1 : 0);
-                    result.success = true;
-                    // Log to AOF if enabled and expiration was set
-                    if (mini_redis::g_aof_logger && set) {
-                        mini_redis::g_aof_logger->append(cmd);
-                    }
-                    // Replicate to replicas if enabled and expiration was set
-                    if (mini_redis::g_replication_manager && set) {
-                        mini_redis::g_replication_manager->replicate_command(cmd);
-                    }
-                } catch (...) {
-                    result.reply = resp_err("Invalid seconds value");
-                    result.success = false;
-                }
-            }
-            break;
-
-        case protocol::CommandType::TTL:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("TTL requires a key");
-                result.success = false;
-            } else {
-                int ttl_value = kv.ttl(cmd.args[0]);
-                result.reply = resp_integer(ttl_value);
-                result.success = true;
-            }
-            break;
-
-        case protocol::CommandType::MGET:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("MGET requires at least one key");
-                result.success = false;
-            } else {
-                std::vector<std::string> values;
-                for (const auto& key : cmd.args) {
-                    std::string value;
-                    if (kv.get(key, value)) {
-                        values.push_back(value);
-                    } else {
-                        values.push_back("");
-                    }
-                }
-                std::string mget_result = "*" + std::to_string(values.size()) + "\r\n";
-                for (const auto& val : values) {
-                    if (val.empty()) {
-                        mget_result += resp_nil();
-                    } else {
-                        mget_result += resp_bulk(val);
-                    }
-                }
-                result.reply = mget_result;
-                result.success = true;
-            }
-            break;
-
-        case protocol::CommandType::QUIT:
-            result.reply = resp_simple("OK");
-            result.should_quit = true;
-            result.success = true;
-            break;
-
-        case protocol::CommandType::SAVE:
-            // SAVE writes current database to RDB file
-            if (kv.save_to_rdb("mini_redis_dump.rdb")) {
-                result.reply = resp_simple("OK");
-                result.success = true;
-            } else {
-                result.reply = resp_err("ERR Save failed");
-                result.success = false;
-            }
-            break;
-
-        case protocol::CommandType::LOAD:
-            // LOAD reads database from RDB file
-            if (kv.load_from_rdb("mini_redis_dump.rdb")) {
-                result.reply = resp_simple("OK");
-                result.success = true;
-            } else {
-                result.reply = resp_err("ERR Load failed");
-                result.success = false;
-            }
-            break;
-
-        case protocol::CommandType::SELECT:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("SELECT requires database number");
-                result.success = false;
-            } else {
-                try {
-                    int db_num = std::stoi(cmd.args[0]);
-                    std::lock_guard<std::mutex> lock(mini_redis::detail::databases_mutex);
-                    if (db_num >= 0 && db_num < static_cast<int>(mini_redis::detail::databases.size())) {
-                        ctx.db_index = db_num;
-                        result.reply = resp_simple("OK");
-                        result.success = true;
-                    } else {
-                        result.reply = resp_err("Database index out of range");
-                        result.success = false;
-                    }
-                } catch (...) {
-                    result.reply = resp_err("Invalid database number");
-                    result.success = false;
-                }
-            }
-            break;
+namespace {
 
-        case protocol::CommandType::INFO: {
-            time_t now = time(nullptr);
-            long long uptime = now - mini_redis::detail::server_start_time;
-            std::lock_guard<std::mutex> lock(mini_redis::detail::databases_mutex);
-            size_t total_keys = 0;
-            for (const auto& db : mini_redis::detail::databases) {
-                total_keys += db.size();
-            }
-            std::stringstream info;
-            info << "uptime:" << uptime << "\n";
-            info << "total_keys:" << total_keys << "\n";
-            info << "commands_processed:" << mini_redis::detail::total_commands_processed.load() << "\n";
-            info << "databases:" << mini_redis::detail::databases.size() << "\n";
-            result.reply = resp_bulk(info.str());
-            result.success = true;
-            break;
+// A subscribed client's thread waits for its next command this long at a time,
+// sending the messages published in between
+constexpr int SUBSCRIBER_POLL_MS = 10;
+
+// Send the messages waiting for a subscribed client; false once it went over
+// its output buffer limit
+bool send_messages(mini_redis::detail::ClientContext& ctx, SOCKET client_socket) {
+    std::string messages;
+    while (ctx.subscriber->ready()) {
+        messages.clear();
+        if (!ctx.subscriber->take(messages, mini_redis::Subscriber::TAKE_BATCH_BYTES)) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                    "Closing subscriber over its pub/sub output buffer limit");
+            return false;
+        }
+        if (send(client_socket, messages.data(), static_cast<int>(messages.size()), 0) <= 0) {
+            return false;
         }
-
-        case protocol::CommandType::SUBSCRIBE:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("SUBSCRIBE requires channel name");
-                result.success = false;
-            } else {
-                std::lock_guard<std::mutex> lock(mini_redis::detail::channels_mutex);
-                for (const auto& channel : cmd.args) {
-                    mini_redis::detail::channels[channel].insert(client_socket);
-                    ctx.subscribed_channels.insert(channel);
-                }
-                result.reply = resp_simple("OK");
-                result.success = true;
-            }
-            break;
-
-        case protocol::CommandType::PUBLISH:
-            if (cmd.args.size() < 2) {
-                result.reply = resp_err("PUBLISH requires channel and message");
-                result.success = false;
-            } else {
-                std::lock_guard<std::mutex> lock(mini_redis::detail::channels_mutex);
-                const std::string& channel = cmd.args[0];
-                const std::string& message = cmd.args[1];
-                auto it = mini_redis::detail::channels.find(channel);
-                int subscribers = 0;
-                if (it != mini_redis::detail::channels.end()) {
-                    for (SOCKET sub_socket : it->second) {
-                        std::string pub_msg = resp_array({channel, message});
-                        send(sub_socket, pub_msg.c_str(), static_cast<int>(pub_msg.size()), 0);
-                        subscribers++;
-                    }
-                }
-                result.reply = resp_integer(subscribers);
-                result.success = true;
-            }
-            break;
-
-        case protocol::CommandType::EVAL:
-            result.reply = resp_err("ERR Scripting not implemented");
-            result.success = false;
-            break;
-
-        case protocol::CommandType::AUTH:
-            // Already handled above
-            break;
-
-        case protocol::CommandType::INCR:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("ERR INCR requires a key");
-                result.success = false;
-            } else {
-                auto [val, err] = kv.incr(cmd.args[0]);
-                if (!err.empty()) {
-                    result.reply = resp_err(err);
-                    result.success = false;
-                } else {
-                    result.reply = resp_integer64(val);
-                    result.success = true;
-                }
-            }
-            break;
-
-        case protocol::CommandType::DECR:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("ERR DECR requires a key");
-                result.success = false;
-            } else {
-                auto [val, err] = kv.decr(cmd.args[0]);
-                if (!err.empty()) {
-                    result.reply = resp_err(err);
-                    result.success = false;
-                } else {
-                    result.reply = resp_integer64(val);
-                    result.success = true;
-                }
-            }
-            break;
-
-        case protocol::CommandType::INCRBY:
-            if (cmd.args.size() < 2) {
-                result.reply = resp_err("ERR INCRBY requires key and increment");
-                result.success = false;
-            } else {
-                try {
-                    int64_t delta = std::stoll(cmd.args[1]);
-                    auto [val, err] = kv.incrby(cmd.args[0], delta);
-                    if (!err.empty()) {
-                        result.reply = resp_err(err);
-                        result.success = false;
-                    } else {
-                        result.reply = resp_integer64(val);
-                        result.success = true;
-                    }
-                } catch (...) {
-                    result.reply = resp_err("ERR value is not an integer");
-                    result.success = false;
-                }
-            }
-            break;
-
-        case protocol::CommandType::DECRBY:
-            if (cmd.args.size() < 2) {
-                result.reply = resp_err("ERR DECRBY requires key and decrement");
-                result.success = false;
-            } else {
-                try {
-                    int64_t delta = std::stoll(cmd.args[1]);
-                    auto [val, err] = kv.decrby(cmd.args[0], delta);
-                    if (!err.empty()) {
-                        result.reply = resp_err(err);
-                        result.success = false;
-                    } else {
-                        result.reply = resp_integer64(val);
-                        result.success = true;
-                    }
-                } catch (...) {
-                    result.reply = resp_err("ERR value is not an integer");
-                    result.success = false;
-                }
-            }
-            break;
-
-        case protocol::CommandType::APPEND:
-            if (cmd.args.size() < 2) {
-                result.reply = resp_err("ERR APPEND requires key and value");
-                result.success = false;
-            } else {
-                size_t newlen = kv.append(cmd.args[0], cmd.args[1]);
-                result.reply = resp_integer(static_cast<int>(newlen));
-                result.success = true;
-            }
-            break;
-
-        case protocol::CommandType::STRLEN:
-            if (cmd.args.empty()) {
-                result.reply = resp_err("ERR STRLEN requires a key");
-                result.success = false;
-            } else {
-                size_t len = kv.strlen(cmd.args[0]);
-                result.reply = resp_integer(static_cast<int>(len));
-                result.success = true;
-            }
-            break;
-
-        default:
-            result.reply = resp_err("Unknown command");
-            result.success = false;
-            break;
     }
-    
-    return result;
+    return true;
 }
 
+} // anonymous namespace
+
 void handle_client(SOCKET client_socket) {
     mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client connected");
     mini_redis::detail::ClientContext ctx;
     bool should_quit = false;
 
     char buffer[1024];
+    std::string out; // Replies for one batch of pipelined commands, reused across reads
 
     while (!should_quit) {
+        if (ctx.subscriber) {
+            if (!send_messages(ctx, client_socket)) {
+                break;
+            }
+            if (!mini_redis::wait_readable(client_socket, SUBSCRIBER_POLL_MS)) {
+                continue;
+            }
+        }
         int bytes = recv(client_socket, buffer, static_cast<int>(sizeof(buffer)), 0);
         if (bytes <= 0) {
             break;
@@ -546,32 +245,30 @@ void handle_client(SOCKET client_socket) {
 
         // Extract all complete RESP commands from parser
         std::string parse_error;
-        std::vector<std::vector<std::string>> resp_commands = extract_resp_commands(ctx.parser, &parse_error);
+        std::vector<protocol::Command> resp_commands = extract_resp_commands(ctx.parser, &parse_error);
         
         // If we got a parse error and no commands, send error and log details
         if (resp_commands.empty() && !parse_error.empty()) {
             // Log the parse error with buffer context for debugging
             mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "RESP parse error: " + parse_error);
-            std::string error_reply = resp_err(parse_error);
-            send(client_socket, error_reply.c_str(), static_cast<int>(error_reply.size()), 0);
-            // Don't clear buffer here - let it accumulate more data or close connection naturally
-            // This allows the connection to recover if the next command is valid
+            out.clear();
+            ReplyWriter(out).error(parse_error);
+            send(client_socket, out.data(), static_cast<int>(out.size()), 0);
+            // The parser discarded the malformed data, so the connection can
+            // recover if the next command is valid
             continue; // Skip to next recv
         }
 
-        // Process each complete command
-        for (const auto& resp_array : resp_commands) {
-            // Convert RESP array to Command struct
-            protocol::Command cmd = protocol::command_from_resp_array(resp_array);
-            
+        // Process each complete command, serializing replies into one buffer
+        out.clear();
+        for (const auto& cmd : resp_commands) {
             // Handle parse errors
-            if (cmd.type == protocol::CommandType::UNKNOWN && !resp_array.empty()) {
-                std::string error_reply = resp_err("ERR unknown command '" + resp_array[0] + "'");
-                send(client_socket, error_reply.c_str(), static_cast<int>(error_reply.size()), 0);
+            if (cmd.type == protocol::CommandType::UNKNOWN) {
+                reply_unknown_command(cmd, ctx, out);
                 continue;
             }
             
-            mini_redis::detail::CommandResult result = process_command(cmd, ctx, client_socket);
+            mini_redis::detail::CommandResult result = process_command(cmd, ctx, client_socket, out);
             
             // Log command result
 #ifdef DEBUG_LOGGING
@@ -581,75 +278,228 @@ void handle_client(SOCKET client_socket) {
                        " (client requests: " + std::to_string(ctx.request_count) + ")");
 #endif
 
-            // Send reply for this command
-            send(client_socket, result.reply.c_str(), static_cast<int>(result.reply.size()), 0);
-            
             // Check if client wants to quit
             if (result.should_quit) {
                 should_quit = true;
                 break;
             }
         }
-    }
 
-    // Cleanup: remove client from all channel subscriptions
-    {
-        std::lock_guard<std::mutex> lock(mini_redis::detail::channels_mutex);
-        for (auto& pair : mini_redis::detail::channels) {
-            pair.second.erase(client_socket);
+        // Send all replies for this batch at once, once the writes are durable
+        if (!wait_for_aof(ctx)) {
+            out.clear();
+            ReplyWriter(out).error(aof_failure_error());
+            should_quit = true;
+        }
+        if (!out.empty()) {
+            send(client_socket, out.data(), static_cast<int>(out.size()), 0);
         }
     }
 
+    // Leave every channel before the socket goes away
+    ctx.subscriber.reset();
+
     mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client disconnected (processed " + 
                std::to_string(ctx.request_count) + " requests)");
     closesocket(client_socket);
 }
 
-bool init_winsock() {
-    WSADATA wsaData;
-    int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
-    if (result != 0) {
-        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "WSAStartup failed with error " + std::to_string(result));
+bool init_network() {
+    if (!net_init()) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Socket library initialization failed");
         return false;
     }
     return true;
 }
 
-int start_server(int port) {
-    if (!init_winsock()) {
-        return 1;
+bool wait_for_aof(mini_redis::detail::ClientContext& ctx) {
+    const uint64_t ticket = std::exchange(ctx.aof_ticket, 0);
+    return ticket == 0 || !mini_redis::g_aof_logger || mini_redis::g_aof_logger->wait_durable(ticket);
+}
+
+uint64_t take_aof_ticket(mini_redis::detail::ClientContext& ctx) {
+    uint64_t ticket = ctx.aof_ticket;
+    ctx.aof_ticket = 0;
+    return aof_durable(ticket) ? 0 : ticket;
+}
+
+bool aof_durable(uint64_t ticket) {
+    return ticket == 0 || !mini_redis::g_aof_logger || mini_redis::g_aof_logger->durable(ticket);
+}
+
+bool aof_write_failed() {
+    return mini_redis::g_aof_logger && mini_redis::g_aof_logger->write_failed();
+}
+
+std::string aof_failure_error() {
+    const std::string reason = mini_redis::g_aof_logger ? mini_redis::g_aof_logger->write_error() : std::string();
+    return "MISCONF Errors writing to the AOF file: " + (reason.empty() ? std::string("unknown error") : reason);
+}
+
+void on_aof_durable(std::function<void()> listener) {
+    if (mini_redis::g_aof_logger) {
+        mini_redis::g_aof_logger->add_durable_listener(std::move(listener));
     }
+}
+
+void configure_databases(const Config& cfg) {
+    configure_databases(mini_redis::detail::databases, cfg);
+}
+
+void configure_databases(std::vector<KVStore>& dbs, const Config& cfg) {
+    size_t shards = cfg.shards > 0 ? static_cast<size_t>(cfg.shards) : 1;
+    size_t max_keys = cfg.max_keys > 0 ? static_cast<size_t>(cfg.max_keys) : 0;
+    size_t samples = cfg.maxmemory_samples > 0 ? static_cast<size_t>(cfg.maxmemory_samples) : 1;
+    EvictionPolicy policy = EvictionPolicy::AllKeysLRU;
+    if (!KVStore::parse_eviction_policy(cfg.maxmemory_policy, policy)) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                "Unknown maxmemory policy '" + cfg.maxmemory_policy + "', using allkeys-lru");
+    }
+    for (auto& db : dbs) {
+        db.set_shard_count(shards);
+        db.set_eviction_limits(max_keys, cfg.maxmemory, policy, samples);
+        db.set_lazy_free(mini_redis::g_lazy_freer, cfg.lazyfree_min_size);
+        db.set_tracking(&mini_redis::detail::tracking,
+                        static_cast<size_t>(std::max<long long>(0, cfg.tracking_table_max_keys)));
+    }
+}
+
+void start_services(const Config& cfg) {
+    // Up first: every database hands its large frees to it
+    static LazyFreer lazy_freer;
+    mini_redis::g_lazy_freer = &lazy_freer;
+    lazy_freer.start();
+    configure_databases(cfg);
+    mini_redis::detail::rdb_path = cfg.rdb_path;
+    mini_redis::detail::pubsub.set_limits({cfg.pubsub_hard_limit, cfg.pubsub_soft_limit, cfg.pubsub_soft_seconds});
+    mini_redis::configure_slowlog(cfg.slowlog_log_slower_than,
+                                  static_cast<size_t>(std::max(cfg.slowlog_max_len, 0)));
     
     // Initialize AOF logger
-    static AOFLogger aof_logger("mini_redis.aof");
+    AOFLogger::FsyncPolicy fsync_policy = AOFLogger::FsyncPolicy::EverySec;
+    if (!AOFLogger::parse_fsync_policy(cfg.appendfsync, fsync_policy)) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                "Unknown appendfsync policy '" + cfg.appendfsync + "', using everysec");
+    }
+    static AOFLogger aof_logger(cfg.aof_path, fsync_policy);
     mini_redis::g_aof_logger = &aof_logger;
-    mini_redis::g_aof_logger->start();
     
-    // Replay AOF file on startup if it exists
-    std::ifstream aof_check("mini_redis.aof");
+    // Replay AOF file on startup if it exists, before anything new is logged
+    std::ifstream aof_check(cfg.aof_path);
     if (aof_check.good()) {
         aof_check.close();
-        if (mini_redis::g_aof_logger->replay(mini_redis::detail::databases[0])) {
+        if (mini_redis::g_aof_logger->replay(mini_redis::detail::databases)) {
             mini_redis::Logger::log(mini_redis::Logger::Level::Info, "AOF file replayed successfully");
         }
     }
+    // In thread-per-core mode each database is split across the cores' own
+    // stores, so there is no single store to rewrite from.
+    if (!cfg.use_thread_per_core) {
+        mini_redis::g_aof_logger->enable_rewrite(mini_redis::detail::databases, cfg.auto_aof_rewrite_percentage,
+                                                 cfg.auto_aof_rewrite_min_size);
+    }
+    mini_redis::g_aof_logger->start();
     
-    // Initialize replication manager
-    static ReplicationManager replication_manager;
+    // Initialize replication manager. A full resync snapshots the shared
+    // databases, which thread-per-core mode splits across the cores.
+    static ReplicationManager replication_manager(cfg.repl_backlog_size);
     mini_redis::g_replication_manager = &replication_manager;
-    mini_redis::g_replication_manager->start();
+    mini_redis::g_replication_manager->start(cfg.use_thread_per_core ? nullptr : &mini_redis::detail::databases,
+                                             cfg.rdb_path);
+    
+    // A replica applies its primary's stream like a client's commands, so the
+    // AOF and this node's own replicas get it too. After a full resync the
+    // data no longer matches either: they start over from it.
+    if (!cfg.use_thread_per_core) {
+        static mini_redis::detail::ClientContext link_ctx;
+        link_ctx.internal = true;
+        static ReplicaLink replica_link(
+            mini_redis::detail::databases,
+            [](const protocol::Command& cmd) {
+                std::string discard;
+                mini_redis::dispatch_command(cmd, link_ctx, INVALID_SOCKET, discard);
+            },
+            [] {
+                mini_redis::g_replication_manager->reset_history();
+                if (mini_redis::g_aof_logger->rewrite_enabled() && !mini_redis::g_aof_logger->start_rewrite()) {
+                    mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                            "AOF rewrite already running during a full resync; "
+                                            "run BGREWRITEAOF once it is done");
+                }
+            },
+            cfg.port, cfg.replica_max_lag_ms, cfg.rdb_path);
+        mini_redis::g_replica_link = &replica_link;
+        if (!cfg.replicaof_host.empty()) {
+            replica_link.follow(cfg.replicaof_host, cfg.replicaof_port);
+        }
+    } else if (!cfg.replicaof_host.empty()) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                "replicaof is not supported in thread-per-core mode, ignoring it");
+    }
+    
+    // Cluster mode: database 0 only, split into hash slots. A migration's
+    // deletes are writes like any other, so the AOF and replicas see them.
+    if (cfg.cluster_enabled && cfg.use_thread_per_core) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                "cluster mode is not supported in thread-per-core mode, ignoring it");
+    } else if (cfg.cluster_enabled) {
+        static mini_redis::detail::ClientContext migration_ctx;
+        migration_ctx.internal = true;
+        static ClusterState cluster(
+            mini_redis::detail::databases[0],
+            [](const std::vector<std::string>& keys) {
+                // One DEL for the whole batch: the AOF and replicas get one record
+                std::string discard;
+                protocol::Command del;
+                del.type = protocol::CommandType::DEL;
+                del.name = "DEL";
+                del.args = keys;
+                mini_redis::dispatch_command(del, migration_ctx, INVALID_SOCKET, discard);
+            },
+            cfg.cluster_announce_ip, cfg.port, cfg.cluster_config_file);
+        mini_redis::g_cluster = &cluster;
+        cluster.start();
+        mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Cluster mode, node " + cluster.myid());
+    }
 
+    // Start background reclamation of expired keys
+    static ActiveExpirer active_expirer(mini_redis::detail::databases, cfg.hz);
+    g_active_expirer = &active_expirer;
+    g_active_expirer->start();
+}
+
+void stop_services() {
+    if (mini_redis::g_cluster) {
+        mini_redis::g_cluster->stop();
+    }
+    if (mini_redis::g_replica_link) {
+        mini_redis::g_replica_link->stop();
+    }
+    if (mini_redis::g_aof_logger) {
+        mini_redis::g_aof_logger->stop();
+    }
+    if (mini_redis::g_replication_manager) {
+        mini_redis::g_replication_manager->stop();
+    }
+    if (g_active_expirer) {
+        g_active_expirer->stop();
+    }
+    if (mini_redis::g_lazy_freer) {
+        mini_redis::g_lazy_freer->stop();
+    }
+}
+
+SOCKET open_listen_socket(int port) {
     SOCKET listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (listen_socket == INVALID_SOCKET) {
         mini_redis::Logger::log(mini_redis::Logger::Level::Error, "socket() failed");
-        WSACleanup();
-        return 1;
+        return INVALID_SOCKET;
     }
 
-    char yes = 1;
-    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    int yes = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof(yes));
 
-    sockaddr_in addr;
+    sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_port = htons(static_cast<u_short>(port));
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -657,14 +507,28 @@ int start_server(int port) {
     if (bind(listen_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR) {
         mini_redis::Logger::log(mini_redis::Logger::Level::Error, "bind() failed");
         closesocket(listen_socket);
-        WSACleanup();
-        return 1;
+        return INVALID_SOCKET;
     }
 
     if (listen(listen_socket, SOMAXCONN) == SOCKET_ERROR) {
         mini_redis::Logger::log(mini_redis::Logger::Level::Error, "listen() failed");
         closesocket(listen_socket);
-        WSACleanup();
+        return INVALID_SOCKET;
+    }
+    return listen_socket;
+}
+
+int start_server(const Config& cfg) {
+    if (!init_network()) {
+        return 1;
+    }
+    
+    const int port = cfg.port;
+    start_services(cfg);
+
+    SOCKET listen_socket = open_listen_socket(port);
+    if (listen_socket == INVALID_SOCKET) {
+        net_cleanup();
         return 1;
     }
 
@@ -677,15 +541,15 @@ int start_server(int port) {
             mini_redis::Logger::log(mini_redis::Logger::Level::Error, "accept() failed");
             continue;
         }
+        set_nodelay(client_socket);
 
         std::thread t(handle_client, client_socket);
         t.detach();
     }
 
     closesocket(listen_socket);
-    WSACleanup();
+    net_cleanup();
     return 0;
 }
 
 } // namespace mini_redis
-
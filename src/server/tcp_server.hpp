@@ -3,16 +3,39 @@
 
 #pragma once
 
+#include "utils/config.hpp"
+
 namespace mini_redis {
 
-// Starts the TCP server on the given port (e.g. 6379).
+// Starts the TCP server on cfg.port (e.g. 6379).
 // Blocks the calling thread and runs the accept loop.
 // Returns 0 on normal shutdown, non-zero on fatal error.
-int start_server(int port);
+int start_server(const Config& cfg);
 
-// Starts the IOCP-based server on the given port.
+// Starts the IOCP-based server on cfg.port.
 // Uses asynchronous I/O with completion ports and worker thread pool.
 // Returns 0 on normal shutdown, non-zero on fatal error.
-int start_server_iocp(int port);
+int start_server_iocp(const Config& cfg);
+
+// Starts the event-loop server on cfg.port: edge-triggered epoll on Linux,
+// kqueue on BSD/macOS, with one loop per worker thread.
+// Returns 0 on normal shutdown, non-zero on fatal error.
+int start_server_event_loop(const Config& cfg);
+
+// Starts the io_uring server on cfg.port (Linux): one ring per worker thread
+// with multishot accept/recv over a registered provided-buffer ring.
+// Falls back to the event-loop server if the kernel lacks io_uring support.
+// Returns 0 on normal shutdown, non-zero on fatal error.
+int start_server_io_uring(const Config& cfg);
+
+// Starts the shared-nothing thread-per-core server on cfg.port: each of
+// cfg.cores event loops owns its connections and a hash slice of every
+// database; commands on other cores' keys are forwarded over SPSC queues.
+// Returns 0 on normal shutdown, non-zero on fatal error.
+int start_server_thread_per_core(const Config& cfg);
+
+// Apply storage settings from the config to every database.
+// Must be called before any client is accepted.
+void configure_databases(const Config& cfg);
 
 } // namespace mini_redis
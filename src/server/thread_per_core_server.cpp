@@ -0,0 +1,1099 @@
+// Thread-per-core server implementation for Mini-Redis
+// Shared-nothing layout: each core runs one event loop, owns the connections
+// handed to it and its own slice of every database (keys are assigned to cores
+// by hash). A command on a key owned by another core is forwarded to that core
+// over a lock-free SPSC queue and the reply comes back the same way; KEYS, INFO
+// and multi-key MGET fan out to every owning core and are merged on the origin
+// core, SCAN walks the cores one after another (the core is the top of its
+// cursor), and a batch (MSET, multi-key DEL/EXISTS/UNLINK) is split into one
+// smaller batch per owning core. Replies are released to each client in
+// request order. A PUBLISH on any core queues the message on each subscriber
+// and wakes the subscriber's core, which sends it after the replies before it.
+// Under appendfsync always a core holds back replies to writes, its own
+// clients' and forwarded ones alike, until the AOF writer wakes it to say they
+// are on disk; the loop keeps serving other connections meanwhile.
+
+#include "server/tcp_server.hpp"
+#include "utils/logger.hpp"
+#include "utils/spsc_queue.hpp"
+
+#include "../protocol/resp_utils.hpp"
+#include "../protocol/parser.hpp"
+#include "../protocol/command_table.hpp"
+#include "../protocol/resp_parser.hpp"
+#include "../storage/kv_store.hpp"
+#include "../storage/active_expirer.hpp"
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+#include "server/server_common.hpp"
+#include "server/poller.hpp"
+#include "server/command_stats.hpp"
+#include "server/pubsub.hpp"
+
+#if defined(MINI_REDIS_HAVE_POLLER)
+
+namespace mini_redis {
+
+namespace {
+
+using mini_redis::detail::ClientContext;
+
+constexpr size_t READ_CHUNK = 16 * 1024;
+constexpr int MAX_EVENTS = Poller::MAX_WAIT_EVENTS;
+// Stop reading from a client whose unsent replies exceed this until it catches up
+constexpr size_t OUTPUT_PAUSE_BYTES = 4 * 1024 * 1024;
+// Stop reading from a client with this many replies still waiting on other cores
+constexpr size_t PENDING_PAUSE_REPLIES = 4096;
+constexpr size_t PEER_QUEUE_CAPACITY = 256;
+constexpr size_t ACCEPT_QUEUE_CAPACITY = 1024;
+
+struct Connection;
+
+// Work passed between two cores: a command for the core that owns its key, or
+// that command's reply on the way back to the connection's core
+struct Message {
+    Connection* conn = nullptr; // Only ever dereferenced by the origin core
+    uint64_t seq = 0;           // Reply slot on conn
+    uint32_t part = 0;          // Part of a fan-out reply
+    int db_index = 0;
+    bool is_reply = false;
+    bool timed = false;         // A client command whose latency is recorded where it runs
+    protocol::Command cmd;
+    std::string reply;
+};
+
+// How a reply assembled from several cores is put back together
+enum class Merge {
+    SINGLE, // One part, sent as-is
+    MGET,   // One bulk/nil per key, in key order
+    KEYS,   // One array per core, concatenated
+    INFO,   // One INFO text per core, per-core counters summed
+    SUM,    // One integer per core, added up (DEL, EXISTS)
+    ALL,    // The same status from every core (MSET, FLUSHDB), or the first error
+    SCAN,   // One core's SCAN reply, its cursor turned back into a global one
+};
+
+// A reply slot still waiting for parts from other cores
+struct PendingReply {
+    Merge merge = Merge::SINGLE;
+    size_t parts_left = 0;
+    std::vector<std::string> parts;
+    size_t core = 0; // Merge::SCAN: the core that scanned
+};
+
+// Per-connection state, owned by exactly one core
+struct Connection {
+    ClientContext ctx;
+    SOCKET socket = INVALID_SOCKET;
+    std::string out;                  // Serialized replies not yet written
+    size_t out_offset = 0;            // Bytes of out already sent
+    std::deque<PendingReply> pending; // Replies that must go out after the ones before them
+    uint64_t first_seq = 0;           // Slot number of pending.front()
+    size_t remote_parts = 0;          // Parts still being computed on other cores
+    bool read_paused = false;
+    bool closing = false;             // Close once every reply is flushed (QUIT)
+    bool closed = false;              // Socket closed; freed once remote_parts drains
+    bool held = false;                // Output waits for the AOF fsync (appendfsync always); input is left unread
+
+    size_t unsent() const { return out.size() - out_offset; }
+};
+
+// "*<n>\r\n<elements>" -> n, with body pointing at the elements
+size_t split_array_reply(const std::string& reply, std::string_view& body) {
+    size_t crlf = reply.find("\r\n");
+    if (reply.empty() || reply[0] != '*' || crlf == std::string::npos) {
+        body = std::string_view();
+        return 0;
+    }
+    body = std::string_view(reply).substr(crlf + 2);
+    return static_cast<size_t>(std::stoll(reply.substr(1, crlf - 1)));
+}
+
+// "$<len>\r\n<text>\r\n" -> text
+std::string_view bulk_payload(const std::string& reply) {
+    size_t crlf = reply.find("\r\n");
+    if (reply.empty() || reply[0] != '$' || crlf == std::string::npos || reply.size() < crlf + 4) {
+        return std::string_view();
+    }
+    return std::string_view(reply).substr(crlf + 2, reply.size() - crlf - 4);
+}
+
+// Combine per-core INFO texts: keyspace counters are summed, server-wide
+// fields are taken from the first core
+std::string merge_info(const std::vector<std::string>& parts) {
+    static const char* summed[] = {"total_keys", "used_memory", "maxmemory", "evicted_keys", "expired_keys"};
+    std::vector<std::pair<std::string, std::string>> fields;
+    std::vector<long long> totals(sizeof(summed) / sizeof(summed[0]), 0);
+
+    for (size_t p = 0; p < parts.size(); ++p) {
+        std::string_view text = bulk_payload(parts[p]);
+        while (!text.empty()) {
+            size_t eol = text.find('\n');
+            std::string_view line = text.substr(0, eol);
+            text = eol == std::string_view::npos ? std::string_view() : text.substr(eol + 1);
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            std::string name(line.substr(0, colon));
+            std::string value(line.substr(colon + 1));
+            size_t i = 0;
+            while (i < totals.size() && name != summed[i]) {
+                ++i;
+            }
+            if (i < totals.size()) {
+                try { totals[i] += std::stoll(value); } catch (...) {}
+            }
+            if (p == 0) {
+                fields.emplace_back(std::move(name), std::move(value));
+            }
+        }
+    }
+
+    std::string info;
+    for (const auto& field : fields) {
+        std::string value = field.second;
+        for (size_t i = 0; i < totals.size(); ++i) {
+            if (field.first == summed[i]) {
+                value = std::to_string(totals[i]);
+            }
+        }
+        info += field.first + ":" + value + "\n";
+    }
+    info += "cores:" + std::to_string(parts.size()) + "\n";
+    return info;
+}
+
+class Core {
+public:
+    Core(size_t id, std::vector<std::unique_ptr<Core>>& cores, const Config& cfg)
+        : id_(id), cores_(cores), databases_(mini_redis::detail::databases.size()),
+          expirer_(databases_, cfg.hz), accepted_(ACCEPT_QUEUE_CAPACITY),
+          durable_([this] { notifier_.notify(); }), durable_replies_([this] { notifier_.notify(); }) {
+        tick_ = std::chrono::milliseconds(1000 / std::max(1, cfg.hz));
+    }
+
+    bool valid() const { return poller_.valid() && notifier_.valid(); }
+
+    std::vector<KVStore>& databases() { return databases_; }
+
+    // Queues are created once every core exists: inbox i carries messages from core i
+    void connect_peers() {
+        for (size_t i = 0; i < cores_.size(); ++i) {
+            inboxes_.push_back(std::make_unique<SpscQueue<Message>>(PEER_QUEUE_CAPACITY));
+        }
+        outboxes_.resize(cores_.size());
+        notify_.assign(cores_.size(), false);
+    }
+
+    // The core runs for the life of the process, like the accept loop
+    void start() {
+        std::thread(&Core::run, this).detach();
+    }
+
+    // Hand over an accepted, non-blocking socket (acceptor thread only)
+    bool adopt(SOCKET client_socket) {
+        if (!accepted_.try_push(client_socket)) {
+            return false;
+        }
+        notifier_.notify();
+        return true;
+    }
+
+private:
+    void run() {
+        // Commands executed on this thread see this core's slice of the keyspace
+        mini_redis::detail::thread_databases = &databases_;
+        poller_.add(notifier_.fd(), &notifier_, true);
+
+        Poller::Event events[MAX_EVENTS];
+        auto next_tick = std::chrono::steady_clock::now() + tick_;
+        while (true) {
+            int timeout = backlog_ ? 1 : static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                             next_tick - std::chrono::steady_clock::now()).count());
+            int n = poller_.wait(events, MAX_EVENTS, std::max(0, timeout));
+            for (int i = 0; i < n; ++i) {
+                if (events[i].data == &notifier_) {
+                    notifier_.drain();
+                    continue;
+                }
+                Connection* conn = static_cast<Connection*>(events[i].data);
+                // kqueue reports read and write separately, so an earlier event
+                // in this batch may already have closed the connection
+                if (conn->closed) {
+                    continue;
+                }
+                if (events[i].writable) {
+                    handle_writable(conn);
+                }
+                if (events[i].readable && !conn->closed && !conn->read_paused) {
+                    handle_readable(conn);
+                }
+            }
+
+            adopt_accepted();
+            drain_inboxes();
+            send_woken();
+            durable_.release([this](Connection* conn, bool durable) {
+                conn->held = false;
+                if (!durable) {
+                    fail_held(conn);
+                    return;
+                }
+                handle_readable(conn);
+            });
+            durable_replies_.release([this](std::vector<std::pair<size_t, Message>>& replies, bool durable) {
+                for (auto& reply : replies) {
+                    if (!durable) {
+                        // Each forwarded write fails in its own reply slot
+                        reply.second.reply.clear();
+                        ReplyWriter(reply.second.reply).error(aof_failure_error());
+                    }
+                    post(reply.first, std::move(reply.second));
+                }
+            });
+
+            // Each core expires its own keys; no other thread touches them
+            auto now = std::chrono::steady_clock::now();
+            if (now >= next_tick) {
+                expirer_.run_cycle();
+                next_tick = now + tick_;
+            }
+
+            flush_outboxes();
+            for (Connection* conn : closed_) {
+                delete conn;
+            }
+            closed_.clear();
+        }
+    }
+
+    size_t owner_of(const std::string& key) const {
+        return std::hash<std::string>{}(key) % cores_.size();
+    }
+
+    void adopt_accepted() {
+        SOCKET client_socket;
+        while (accepted_.try_pop(client_socket)) {
+            Connection* conn = new Connection();
+            conn->socket = client_socket;
+            conn->ctx.wake_subscriber = [this, conn] { wake(conn); };
+            if (!poller_.add(conn->socket, conn)) {
+                mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Failed to register client socket");
+                closesocket(client_socket);
+                delete conn;
+                continue;
+            }
+            mini_redis::Logger::log(mini_redis::Logger::Level::Info,
+                                    "Client connected (core " + std::to_string(id_) + ")");
+            // Data may have arrived before registration; edge-triggered polling
+            // would not report it
+            handle_readable(conn);
+        }
+    }
+
+    // Drain the socket (edge-triggered: read until it would block)
+    void handle_readable(Connection* conn) {
+        while (!conn->closing && !conn->closed && !conn->held) {
+            if (over_limits(conn)) {
+                if (!flush(conn)) {
+                    close_connection(conn);
+                    return;
+                }
+                if (over_limits(conn)) {
+                    // Resumed once the client or the other cores catch up
+                    conn->read_paused = true;
+                    break;
+                }
+            }
+
+            ssize_t bytes = recv(conn->socket, read_buffer_, sizeof(read_buffer_), 0);
+            if (bytes > 0) {
+                conn->ctx.parser->append(read_buffer_, static_cast<size_t>(bytes));
+                process_input(conn);
+                continue;
+            }
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes < 0 && socket_would_block()) {
+                break;
+            }
+            // Orderly shutdown or hard error
+            close_connection(conn);
+            return;
+        }
+        finish_io(conn);
+    }
+
+    void handle_writable(Connection* conn) {
+        finish_io(conn);
+        resume_if_ready(conn);
+    }
+
+    // Flush output and close if the connection is done or broken
+    void finish_io(Connection* conn) {
+        if (conn->closed) {
+            return;
+        }
+        if (!flush(conn) || (conn->closing && !conn->held && conn->pending.empty() && conn->unsent() == 0)) {
+            close_connection(conn);
+            return;
+        }
+        send_messages(conn);
+    }
+
+    // A publisher queued messages for conn (any thread)
+    void wake(Connection* conn) {
+        bool first;
+        {
+            std::lock_guard<std::mutex> lock(woken_mutex_);
+            first = woken_.empty();
+            woken_.push_back(conn);
+        }
+        if (first) {
+            notifier_.notify();
+        }
+    }
+
+    void send_woken() {
+        std::vector<Connection*> woken;
+        {
+            std::lock_guard<std::mutex> lock(woken_mutex_);
+            woken.swap(woken_);
+        }
+        for (Connection* conn : woken) {
+            send_messages(conn);
+        }
+    }
+
+    // Move a subscriber's waiting messages to its output once every earlier
+    // reply is written, so a slow client's backlog stays in its queue, where
+    // the output buffer limits apply
+    void send_messages(Connection* conn) {
+        if (conn->held) {
+            return; // Resumed once the held replies go out
+        }
+        Subscriber* sub = conn->ctx.subscriber.get();
+        while (sub && !conn->closed && sub->ready()) {
+            if (sub->over_limit()) {
+                mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                        "Closing subscriber over its pub/sub output buffer limit");
+                close_connection(conn);
+                return;
+            }
+            if (!conn->pending.empty() || conn->unsent() > 0) {
+                return; // Resumed from finish_io
+            }
+            sub->take(conn->out, Subscriber::TAKE_BATCH_BYTES);
+            if (!flush(conn)) {
+                close_connection(conn);
+                return;
+            }
+        }
+    }
+
+    bool over_limits(const Connection* conn) const {
+        return conn->unsent() > OUTPUT_PAUSE_BYTES || conn->pending.size() > PENDING_PAUSE_REPLIES;
+    }
+
+    void resume_if_ready(Connection* conn) {
+        if (!conn->closed && conn->read_paused && !over_limits(conn)) {
+            conn->read_paused = false;
+            handle_readable(conn);
+        }
+    }
+
+    // Route every complete command in the parser to the core that owns its keys
+    void process_input(Connection* conn) {
+        std::string parse_error;
+        std::vector<protocol::Command> commands = extract_resp_commands(conn->ctx.parser, &parse_error);
+
+        if (commands.empty() && !parse_error.empty()) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "RESP parse error (thread-per-core): " + parse_error);
+            // Parser discarded the malformed data - connection recovers if next command is valid
+            std::string reply;
+            ReplyWriter(reply).error(parse_error);
+            emit(conn, std::move(reply));
+            return;
+        }
+
+        for (auto& cmd : commands) {
+            if (cmd.type == protocol::CommandType::UNKNOWN) {
+                std::string reply;
+                ReplyWriter(reply).error("ERR unknown command '" + cmd.name + "'");
+                emit(conn, std::move(reply));
+                continue;
+            }
+            conn->ctx.request_count++;
+            mini_redis::detail::total_commands_processed++;
+            route(conn, cmd);
+            if (conn->closing) {
+                break;
+            }
+        }
+        if (uint64_t ticket = take_aof_ticket(conn->ctx)) {
+            conn->held = true;
+            durable_.park(conn, ticket);
+        }
+    }
+
+    static bool is_stats_section(const protocol::Command& cmd) {
+        if (cmd.args.empty()) {
+            return false;
+        }
+        std::string section = cmd.args[0];
+        std::transform(section.begin(), section.end(), section.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return section == "commandstats" || section == "latencystats" || section == "replication";
+    }
+
+    // Run, fan out or forward one client command. Its latency is recorded
+    // here unless it is forwarded whole, in which case the owner records it.
+    void route(Connection* conn, protocol::Command& cmd) {
+        const uint64_t start = command_clock_usec();
+        if (!route_command(conn, cmd)) {
+            record_command(cmd, command_clock_usec() - start);
+        }
+    }
+
+    // Returns true if cmd was forwarded (and moved from)
+    bool route_command(Connection* conn, protocol::Command& cmd) {
+        const protocol::CommandSpec& spec = protocol::command_spec(cmd.type);
+        if (!protocol::check_arity(spec, cmd.args.size())) {
+            run_here(conn, cmd); // Replies with the arity error
+            return false;
+        }
+
+        switch (cmd.type) {
+            case protocol::CommandType::KEYS:
+                fan_out_to_all(conn, cmd, Merge::KEYS);
+                return false;
+            case protocol::CommandType::INFO:
+                if (is_stats_section(cmd)) {
+                    run_here(conn, cmd); // Command stats and replication are process-wide already
+                } else {
+                    fan_out_to_all(conn, cmd, Merge::INFO);
+                }
+                return false;
+            case protocol::CommandType::MGET:
+                fan_out_mget(conn, cmd);
+                return false;
+            case protocol::CommandType::SCAN:
+                return route_scan(conn, cmd);
+            case protocol::CommandType::FLUSHDB:
+            case protocol::CommandType::FLUSHALL:
+                fan_out_to_all(conn, cmd, Merge::ALL);
+                return false;
+            case protocol::CommandType::DEL:
+            case protocol::CommandType::UNLINK:
+            case protocol::CommandType::EXISTS:
+            case protocol::CommandType::MSET:
+            case protocol::CommandType::MSETNX:
+                return fan_out_batch(conn, cmd);
+            case protocol::CommandType::SAVE:
+            case protocol::CommandType::LOAD:
+            case protocol::CommandType::BGREWRITEAOF:
+            case protocol::CommandType::BGSAVE:
+            case protocol::CommandType::PSYNC:
+            case protocol::CommandType::REPLICAOF:
+            case protocol::CommandType::CLUSTER:
+            case protocol::CommandType::RESTORE_RECORDS:
+            // A core holds only its own keys' shards, so it cannot lock all of
+            // a transaction's or script's keys
+            case protocol::CommandType::MULTI:
+            case protocol::CommandType::EXEC:
+            case protocol::CommandType::DISCARD:
+            case protocol::CommandType::WATCH:
+            case protocol::CommandType::UNWATCH:
+            case protocol::CommandType::EVAL:
+            case protocol::CommandType::EVALSHA:
+            case protocol::CommandType::EVAL_RO:
+            case protocol::CommandType::EVALSHA_RO:
+            // Replies are merged per core in RESP2, and invalidations would
+            // have to come from every core's tracking table
+            case protocol::CommandType::HELLO:
+            case protocol::CommandType::CLIENT: {
+                std::string reply;
+                ReplyWriter(reply).error("ERR " + std::string(spec.name) + " is not supported in thread-per-core mode");
+                emit(conn, std::move(reply));
+                return false;
+            }
+            default:
+                break;
+        }
+
+        if ((spec.flags & (protocol::CMD_READ | protocol::CMD_WRITE)) != 0) {
+            size_t owner = owner_of(cmd.args[0]);
+            if (owner != id_) {
+                open_slot(conn, Merge::SINGLE, 1);
+                forward(owner, conn, conn->first_seq + conn->pending.size() - 1, 0, std::move(cmd), true);
+                return true;
+            }
+        }
+        run_here(conn, cmd);
+        return false;
+    }
+
+    // Run a command against this core's data on the connection's own context
+    void run_here(Connection* conn, const protocol::Command& cmd) {
+        if (conn->pending.empty()) {
+            // Nothing queued ahead of it: write straight to the output buffer
+            if (dispatch_command(cmd, conn->ctx, conn->socket, conn->out).should_quit) {
+                conn->closing = true;
+            }
+            return;
+        }
+        std::string reply;
+        if (dispatch_command(cmd, conn->ctx, conn->socket, reply).should_quit) {
+            conn->closing = true;
+        }
+        emit(conn, std::move(reply));
+    }
+
+    // Queue a finished reply behind any that are still outstanding
+    void emit(Connection* conn, std::string reply) {
+        if (conn->pending.empty()) {
+            conn->out += reply;
+            return;
+        }
+        PendingReply& slot = open_slot(conn, Merge::SINGLE, 0);
+        slot.parts[0] = std::move(reply);
+        slot.parts_left = 0;
+    }
+
+    PendingReply& open_slot(Connection* conn, Merge merge, size_t parts) {
+        conn->pending.emplace_back();
+        PendingReply& slot = conn->pending.back();
+        slot.merge = merge;
+        slot.parts.resize(std::max<size_t>(parts, 1));
+        slot.parts_left = parts;
+        return slot;
+    }
+
+    void fan_out_to_all(Connection* conn, const protocol::Command& cmd, Merge merge) {
+        PendingReply& slot = open_slot(conn, merge, cores_.size());
+        uint64_t seq = conn->first_seq + conn->pending.size() - 1;
+        for (size_t core = 0; core < cores_.size(); ++core) {
+            if (core == id_) {
+                dispatch_command(cmd, conn->ctx, conn->socket, slot.parts[core]);
+                --slot.parts_left;
+            } else {
+                forward(core, conn, seq, static_cast<uint32_t>(core), protocol::Command(cmd));
+            }
+        }
+        release_ready(conn);
+    }
+
+    // A SCAN cursor holds the core in the bits a single-shard store leaves
+    // unused; the rest is that core's own cursor. Returns true if forwarded.
+    bool route_scan(Connection* conn, protocol::Command& cmd) {
+        const std::string& arg = cmd.args[0];
+        uint64_t cursor = 0;
+        try {
+            if (arg.empty() || !std::all_of(arg.begin(), arg.end(), [](unsigned char c) { return std::isdigit(c) != 0; })) {
+                throw std::invalid_argument("cursor");
+            }
+            cursor = std::stoull(arg);
+        } catch (...) {
+            run_here(conn, cmd); // Replies with the cursor error
+            return false;
+        }
+        const uint64_t local_mask = (uint64_t{1} << KVStore::SCAN_SHARD_SHIFT) - 1;
+        const size_t core = static_cast<size_t>(cursor >> KVStore::SCAN_SHARD_SHIFT);
+        if (core >= cores_.size()) {
+            std::string reply;
+            ReplyWriter(reply).error("ERR invalid cursor");
+            emit(conn, std::move(reply));
+            return false;
+        }
+        cmd.args[0] = std::to_string(cursor & local_mask);
+
+        PendingReply& slot = open_slot(conn, Merge::SCAN, 1);
+        slot.core = core;
+        if (core != id_) {
+            forward(core, conn, conn->first_seq + conn->pending.size() - 1, 0, std::move(cmd), true);
+            return true;
+        }
+        dispatch_command(cmd, conn->ctx, conn->socket, slot.parts[0]);
+        --slot.parts_left;
+        release_ready(conn);
+        return false;
+    }
+
+    // MGET becomes one GET per key on the key's owner
+    void fan_out_mget(Connection* conn, const protocol::Command& cmd) {
+        PendingReply& slot = open_slot(conn, Merge::MGET, cmd.args.size());
+        uint64_t seq = conn->first_seq + conn->pending.size() - 1;
+        for (size_t i = 0; i < cmd.args.size(); ++i) {
+            protocol::Command get;
+            get.type = protocol::CommandType::GET;
+            get.name = "GET";
+            get.args.push_back(cmd.args[i]);
+            size_t owner = owner_of(cmd.args[i]);
+            if (owner == id_) {
+                dispatch_command(get, conn->ctx, conn->socket, slot.parts[i]);
+                --slot.parts_left;
+            } else {
+                forward(owner, conn, seq, static_cast<uint32_t>(i), std::move(get));
+            }
+        }
+        release_ready(conn);
+    }
+
+    // A batch becomes one batch per owning core; one whose keys all live on a
+    // single core is run or forwarded whole. Returns true if cmd was forwarded.
+    bool fan_out_batch(Connection* conn, protocol::Command& cmd) {
+        const protocol::KeyRange keys = protocol::command_keys(protocol::command_spec(cmd.type), cmd.args.size());
+        std::vector<protocol::Command> batches(cores_.size());
+        size_t owners = 0;
+        size_t last_owner = id_;
+        for (size_t i = keys.first; i < keys.end; i += keys.step) {
+            last_owner = owner_of(cmd.args[i]);
+            std::vector<std::string>& args = batches[last_owner].args;
+            owners += args.empty() ? 1 : 0;
+            args.insert(args.end(), cmd.args.begin() + i, cmd.args.begin() + i + keys.step);
+        }
+        if (owners == 1) {
+            if (last_owner == id_) {
+                run_here(conn, cmd);
+                return false;
+            }
+            open_slot(conn, Merge::SINGLE, 1);
+            forward(last_owner, conn, conn->first_seq + conn->pending.size() - 1, 0, std::move(cmd), true);
+            return true;
+        }
+        if (cmd.type == protocol::CommandType::MSETNX) {
+            // All-or-nothing across cores would need a cross-core transaction
+            std::string reply;
+            ReplyWriter(reply).error("ERR MSETNX keys must live on one core in thread-per-core mode");
+            emit(conn, std::move(reply));
+            return false;
+        }
+
+        PendingReply& slot = open_slot(conn, cmd.type == protocol::CommandType::MSET ? Merge::ALL : Merge::SUM, owners);
+        uint64_t seq = conn->first_seq + conn->pending.size() - 1;
+        uint32_t part = 0;
+        for (size_t core = 0; core < cores_.size(); ++core) {
+            protocol::Command& batch = batches[core];
+            if (batch.args.empty()) {
+                continue;
+            }
+            batch.type = cmd.type;
+            batch.name = cmd.name;
+            if (core == id_) {
+                dispatch_command(batch, conn->ctx, conn->socket, slot.parts[part]);
+                --slot.parts_left;
+            } else {
+                forward(core, conn, seq, part, std::move(batch));
+            }
+            ++part;
+        }
+        release_ready(conn);
+        return false;
+    }
+
+    void forward(size_t core, Connection* conn, uint64_t seq, uint32_t part, protocol::Command cmd,
+                 bool timed = false) {
+        Message msg;
+        msg.conn = conn;
+        msg.seq = seq;
+        msg.part = part;
+        msg.timed = timed;
+        msg.db_index = conn->ctx.db_index;
+        msg.cmd = std::move(cmd);
+        ++conn->remote_parts;
+        post(core, std::move(msg));
+    }
+
+    void post(size_t core, Message msg) {
+        auto& backlog = outboxes_[core];
+        if (!backlog.empty() || !cores_[core]->inboxes_[id_]->try_push(msg)) {
+            // Queue full: keep order by parking everything behind it here
+            backlog.push_back(std::move(msg));
+            backlog_ = true;
+        }
+        notify_[core] = true;
+    }
+
+    // Retry parked messages and wake each peer that has new work, once per batch
+    void flush_outboxes() {
+        backlog_ = false;
+        for (size_t core = 0; core < cores_.size(); ++core) {
+            auto& backlog = outboxes_[core];
+            while (!backlog.empty() && cores_[core]->inboxes_[id_]->try_push(backlog.front())) {
+                backlog.pop_front();
+            }
+            backlog_ = backlog_ || !backlog.empty();
+            if (notify_[core]) {
+                cores_[core]->notifier_.notify();
+                notify_[core] = false;
+            }
+        }
+    }
+
+    void drain_inboxes() {
+        Message msg;
+        for (size_t core = 0; core < cores_.size(); ++core) {
+            SpscQueue<Message>& inbox = *inboxes_[core];
+            while (inbox.try_pop(msg)) {
+                if (msg.is_reply) {
+                    deliver(msg);
+                } else {
+                    execute(core, msg);
+                }
+            }
+        }
+        // Replies to forwarded writes go home together once they are durable
+        if (uint64_t ticket = take_aof_ticket(scratch_)) {
+            durable_replies_.park(std::move(executed_), ticket);
+        } else {
+            for (auto& reply : executed_) {
+                post(reply.first, std::move(reply.second));
+            }
+        }
+        executed_.clear();
+    }
+
+    // Run a forwarded command on this core's slice; the reply is sent home
+    // at the end of the batch
+    void execute(size_t origin, Message& msg) {
+        scratch_.db_index = msg.db_index;
+        msg.reply.clear();
+        const uint64_t start = command_clock_usec();
+        dispatch_command(msg.cmd, scratch_, INVALID_SOCKET, msg.reply);
+        if (msg.timed) {
+            record_command(msg.cmd, command_clock_usec() - start);
+        }
+        msg.is_reply = true;
+        msg.cmd = protocol::Command();
+        executed_.emplace_back(origin, std::move(msg));
+    }
+
+    void deliver(Message& msg) {
+        Connection* conn = msg.conn;
+        --conn->remote_parts;
+        if (conn->closed) {
+            if (conn->remote_parts == 0) {
+                closed_.push_back(conn);
+            }
+            return;
+        }
+        PendingReply& slot = conn->pending[static_cast<size_t>(msg.seq - conn->first_seq)];
+        slot.parts[msg.part] = std::move(msg.reply);
+        --slot.parts_left;
+        release_ready(conn);
+        finish_io(conn);
+        resume_if_ready(conn);
+    }
+
+    // Move every completed reply at the head of the queue into the output buffer
+    void release_ready(Connection* conn) {
+        while (!conn->pending.empty() && conn->pending.front().parts_left == 0) {
+            PendingReply& slot = conn->pending.front();
+            ReplyWriter reply(conn->out);
+            switch (slot.merge) {
+                case Merge::SINGLE:
+                    conn->out += slot.parts[0];
+                    break;
+                case Merge::MGET:
+                    reply.array_header(slot.parts.size());
+                    for (const auto& part : slot.parts) {
+                        conn->out += part;
+                    }
+                    break;
+                case Merge::KEYS: {
+                    // Every core rejects a bad pattern the same way: pass its error on
+                    if (!slot.parts[0].empty() && slot.parts[0][0] == '-') {
+                        conn->out += slot.parts[0];
+                        break;
+                    }
+                    size_t total = 0;
+                    std::vector<std::string_view> bodies(slot.parts.size());
+                    for (size_t i = 0; i < slot.parts.size(); ++i) {
+                        total += split_array_reply(slot.parts[i], bodies[i]);
+                    }
+                    reply.array_header(total);
+                    for (std::string_view body : bodies) {
+                        conn->out.append(body.data(), body.size());
+                    }
+                    break;
+                }
+                case Merge::INFO:
+                    reply.bulk(merge_info(slot.parts));
+                    break;
+                case Merge::SUM: {
+                    int64_t total = 0;
+                    const std::string* error = nullptr;
+                    for (const auto& part : slot.parts) {
+                        if (part.size() > 1 && part[0] == ':') {
+                            total += std::stoll(part.substr(1));
+                        } else if (!error) {
+                            error = &part;
+                        }
+                    }
+                    if (error) {
+                        conn->out += *error;
+                    } else {
+                        reply.integer(total);
+                    }
+                    break;
+                }
+                case Merge::ALL: {
+                    const std::string* chosen = &slot.parts[0];
+                    for (const auto& part : slot.parts) {
+                        if (!part.empty() && part[0] == '-') {
+                            chosen = &part;
+                            break;
+                        }
+                    }
+                    conn->out += *chosen;
+                    break;
+                }
+                case Merge::SCAN:
+                    merge_scan(slot, conn->out);
+                    break;
+            }
+            conn->pending.pop_front();
+            ++conn->first_seq;
+        }
+    }
+
+    // "*2 <local cursor> <keys>" -> the same reply with a global cursor: this
+    // core's cursor, or the start of the next core's keys once it is done
+    void merge_scan(const PendingReply& slot, std::string& out) {
+        const std::string& part = slot.parts[0];
+        std::string_view body;
+        if (split_array_reply(part, body) != 2) {
+            out += part; // An error
+            return;
+        }
+        const size_t cursor_end = body.find("\r\n", body.find("\r\n") + 2);
+        const std::string local(bulk_payload(std::string(body.substr(0, cursor_end + 2))));
+        uint64_t next = std::stoull(local);
+        if (next != 0) {
+            next |= static_cast<uint64_t>(slot.core) << KVStore::SCAN_SHARD_SHIFT;
+        } else if (slot.core + 1 < cores_.size()) {
+            next = static_cast<uint64_t>(slot.core + 1) << KVStore::SCAN_SHARD_SHIFT;
+        }
+        ReplyWriter reply(out);
+        reply.array_header(2);
+        reply.bulk(std::to_string(next));
+        out.append(body.data() + cursor_end + 2, body.size() - cursor_end - 2);
+    }
+
+    // The AOF failed before conn's held output was durable: send an error in
+    // its place (after whatever was partly sent) and disconnect
+    void fail_held(Connection* conn) {
+        conn->out.resize(conn->out_offset);
+        ReplyWriter(conn->out).error(aof_failure_error());
+        flush(conn);
+        close_connection(conn);
+    }
+
+    // Write as much pending output as the socket accepts. Returns false on a hard error.
+    bool flush(Connection* conn) {
+        if (conn->held) {
+            return true; // Resumed once the AOF has the writes on disk
+        }
+        while (conn->unsent() > 0) {
+            ssize_t sent = send(conn->socket, conn->out.data() + conn->out_offset, conn->unsent(), 0);
+            if (sent > 0) {
+                conn->out_offset += static_cast<size_t>(sent);
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && socket_would_block()) {
+                return true; // Resumed on the next writable edge
+            }
+            return false;
+        }
+        // Fully drained: reuse the buffer's capacity for the next batch
+        conn->out.clear();
+        conn->out_offset = 0;
+        return true;
+    }
+
+    void close_connection(Connection* conn) {
+        // Once it has left its channels no publisher can wake it again
+        if (conn->ctx.subscriber) {
+            conn->ctx.subscriber.reset();
+            std::lock_guard<std::mutex> lock(woken_mutex_);
+            woken_.erase(std::remove(woken_.begin(), woken_.end(), conn), woken_.end());
+        }
+        mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Client disconnected (core " + std::to_string(id_) +
+                                ", processed " + std::to_string(conn->ctx.request_count) + " requests)");
+        // Closing the socket also removes it from the poller
+        closesocket(conn->socket);
+        conn->closed = true;
+        durable_.forget(conn);
+        // Replies still on their way from other cores name this connection
+        if (conn->remote_parts == 0) {
+            closed_.push_back(conn);
+        }
+    }
+
+    const size_t id_;
+    std::vector<std::unique_ptr<Core>>& cores_;
+    std::vector<KVStore> databases_; // This core's slice of every database
+    ActiveExpirer expirer_;          // Driven from the loop, not its own thread
+    std::chrono::milliseconds tick_;
+
+    Poller poller_;
+    Notifier notifier_;
+    SpscQueue<SOCKET> accepted_;                            // From the acceptor thread
+    std::vector<std::unique_ptr<SpscQueue<Message>>> inboxes_; // inboxes_[i]: from core i
+    std::vector<std::deque<Message>> outboxes_;            // Messages waiting for room, per core
+    std::vector<bool> notify_;                              // Cores to wake after this batch
+    bool backlog_ = false;                                  // Some outbox is non-empty
+    std::mutex woken_mutex_;
+    std::vector<Connection*> woken_;                        // Subscribers with messages waiting
+
+    ClientContext scratch_;           // Context for commands forwarded from other cores
+    std::vector<std::pair<size_t, Message>> executed_; // Forwarded commands run this batch, by origin
+    DurableWaits<Connection*> durable_; // Connections whose output waits for the AOF
+    DurableWaits<std::vector<std::pair<size_t, Message>>> durable_replies_; // Batches of executed_ likewise
+    std::vector<Connection*> closed_; // Freed after the current event batch
+    char read_buffer_[READ_CHUNK];
+};
+
+// Move keys loaded at startup (AOF replay) from the shared databases to their owning cores
+void distribute_keys(std::vector<std::unique_ptr<Core>>& cores) {
+    std::vector<KVStore>& shared = mini_redis::detail::databases;
+    for (size_t db = 0; db < shared.size(); ++db) {
+        // Moved as dumped records, which carry collections and TTLs alike
+        std::vector<std::vector<std::string>> keys_for(cores.size());
+        for (std::string& key : shared[db].keys()) {
+            keys_for[std::hash<std::string>{}(key) % cores.size()].push_back(std::move(key));
+        }
+        for (size_t core = 0; core < cores.size(); ++core) {
+            std::string records;
+            shared[db].dump_records(keys_for[core], records);
+            cores[core]->databases()[db].restore_records(records);
+            shared[db].del_many(keys_for[core]);
+        }
+    }
+}
+
+} // anonymous namespace
+
+int start_server_thread_per_core(const Config& cfg) {
+    if (!net_init()) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Socket library initialization failed");
+        return 1;
+    }
+
+    const int port = cfg.port;
+    start_services(cfg);
+
+    const size_t core_count = cfg.cores > 0 ? static_cast<size_t>(cfg.cores)
+                                            : std::max(1u, std::thread::hardware_concurrency());
+
+    // Each core holds 1/core_count of the keyspace in a single shard: only its
+    // own thread touches it, so striping its locks would buy nothing
+    Config core_cfg = cfg;
+    core_cfg.shards = 1;
+    if (cfg.max_keys > 0) {
+        core_cfg.max_keys = std::max(1, cfg.max_keys / static_cast<int>(core_count));
+    }
+    core_cfg.maxmemory = cfg.maxmemory / core_count;
+
+    std::vector<std::unique_ptr<Core>> cores;
+    for (size_t i = 0; i < core_count; ++i) {
+        cores.push_back(std::make_unique<Core>(i, cores, cfg));
+        if (!cores.back()->valid()) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Error, "Failed to create core event loop");
+            return 1;
+        }
+        configure_databases(cores.back()->databases(), core_cfg);
+    }
+    for (auto& core : cores) {
+        core->connect_peers();
+    }
+    distribute_keys(cores);
+
+    SOCKET listen_socket = open_listen_socket(port);
+    if (listen_socket == INVALID_SOCKET) {
+        return 1;
+    }
+
+    for (auto& core : cores) {
+        core->start();
+    }
+
+    mini_redis::Logger::log(mini_redis::Logger::Level::Info, "Mini-Redis thread-per-core server running on port " +
+                            std::to_string(port) + " (" + std::to_string(core_count) + " cores)");
+
+    // Acceptor: block in accept() and spread connections across the cores
+    size_t next_core = 0;
+    while (true) {
+        SOCKET client_socket = accept(listen_socket, nullptr, nullptr);
+        if (client_socket == INVALID_SOCKET) {
+            if (errno != EINTR) {
+                mini_redis::Logger::log(mini_redis::Logger::Level::Error, "accept() failed");
+            }
+            continue;
+        }
+        if (!set_nonblocking(client_socket)) {
+            closesocket(client_socket);
+            continue;
+        }
+        set_nodelay(client_socket);
+        if (!cores[next_core]->adopt(client_socket)) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "Core accept queue full, dropping client");
+            closesocket(client_socket);
+        }
+        next_core = (next_core + 1) % cores.size();
+    }
+
+    stop_services();
+    closesocket(listen_socket);
+    return 0;
+}
+
+} // namespace mini_redis
+
+#elif defined(_WIN32)
+
+namespace mini_redis {
+
+// No epoll/kqueue on Windows: IOCP is the native event-driven server there
+int start_server_thread_per_core(const Config& cfg) {
+    mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                            "Thread-per-core mode needs epoll/kqueue, using the IOCP server");
+    Config fallback = cfg;
+    fallback.use_thread_per_core = false;
+    return start_server_iocp(fallback);
+}
+
+} // namespace mini_redis
+
+#else
+
+namespace mini_redis {
+
+int start_server_thread_per_core(const Config& cfg) {
+    mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                            "No epoll/kqueue on this platform, using the thread-per-client server");
+    Config fallback = cfg;
+    fallback.use_thread_per_core = false;
+    return start_server(fallback);
+}
+
+} // namespace mini_redis
+
+#endif
@@ -0,0 +1,111 @@
+// Client-side caching (CLIENT TRACKING) implementation
+
+#include "tracking.hpp"
+#include "pubsub.hpp"
+#include "../protocol/resp_utils.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+namespace {
+
+// One key's invalidation, as a RESP3 push or a pub/sub message
+ValueRef invalidation_frame(std::string_view key, bool message) {
+    auto* frame = new SharedValue();
+    mini_redis::ReplyWriter writer(frame->bytes);
+    if (message) {
+        writer.array_header(2);
+        writer.bulk(mini_redis::ClientTracking::INVALIDATE_CHANNEL);
+    } else {
+        writer.push_header(2);
+        writer.bulk("invalidate");
+    }
+    writer.array_header(1);
+    writer.bulk(key);
+    const ValueRef ref(frame);
+    SharedValue::release(frame);
+    return ref;
+}
+
+bool has_prefix(const std::vector<std::string>& prefixes, std::string_view key) {
+    if (prefixes.empty()) {
+        return true;
+    }
+    return std::any_of(prefixes.begin(), prefixes.end(), [&](const std::string& prefix) {
+        return key.substr(0, prefix.size()) == prefix;
+    });
+}
+
+} // anonymous namespace
+
+namespace mini_redis {
+
+void ClientTracking::enable(uint64_t client, Options options) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    broadcasting_.erase(std::remove(broadcasting_.begin(), broadcasting_.end(), client), broadcasting_.end());
+    if (options.broadcast) {
+        broadcasting_.push_back(client);
+    }
+    clients_[client] = std::move(options);
+    broadcast_.store(!broadcasting_.empty(), std::memory_order_relaxed);
+}
+
+void ClientTracking::disable(uint64_t client) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (clients_.erase(client) == 0) {
+        return;
+    }
+    broadcasting_.erase(std::remove(broadcasting_.begin(), broadcasting_.end(), client), broadcasting_.end());
+    broadcast_.store(!broadcasting_.empty(), std::memory_order_relaxed);
+}
+
+int64_t ClientTracking::redirect_of(uint64_t client) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto it = clients_.find(client);
+    return it == clients_.end() ? -1 : static_cast<int64_t>(it->second.redirect);
+}
+
+size_t ClientTracking::client_count() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return clients_.size();
+}
+
+void ClientTracking::send(uint64_t client, const Options& options, std::string_view key, ValueRef& push,
+                          ValueRef& message) {
+    if (options.noloop && client == writer) {
+        return;
+    }
+    if (options.redirect != 0) {
+        if (!message) {
+            message = invalidation_frame(key, true);
+        }
+        hub_.deliver(options.redirect, message);
+        return;
+    }
+    if (!push) {
+        push = invalidation_frame(key, false);
+    }
+    hub_.deliver(client, push);
+}
+
+void ClientTracking::invalidate(std::string_view key, const std::vector<uint64_t>& clients) {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    ValueRef push;
+    ValueRef message;
+    // Clients that turned tracking off (or switched to BCAST) since they read
+    // the key are no longer told
+    for (uint64_t client : clients) {
+        auto it = clients_.find(client);
+        if (it != clients_.end() && !it->second.broadcast) {
+            send(client, it->second, key, push, message);
+        }
+    }
+    for (uint64_t client : broadcasting_) {
+        const Options& options = clients_.at(client);
+        if (has_prefix(options.prefixes, key)) {
+            send(client, options, key, push, message);
+        }
+    }
+}
+
+} // namespace mini_redis
@@ -0,0 +1,63 @@
+// Client-side caching for Mini-Redis: CLIENT TRACKING
+// Each shard of a database remembers which clients read a key
+// (KVStore::track) and hands them to ClientTracking when the key changes.
+// Invalidations are queued on the client's pub/sub queue (PubSub::deliver),
+// so every server backend sends them the way it sends published messages: a
+// RESP3 client gets a push (>2 invalidate [key]), and with REDIRECT the named
+// client gets a message on __redis__:invalidate. BCAST clients are left out of
+// the per-key tables and are sent every changed key under one of their
+// prefixes instead. The per-key tables are bounded by tracking-table-max-keys
+// (see KVStore::set_tracking).
+
+#pragma once
+
+#include "../storage/kv_store.hpp"
+#include "../storage/shared_value.hpp"
+
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace mini_redis {
+
+class PubSub;
+
+class ClientTracking final : public KeyTracker {
+public:
+    static constexpr const char* INVALIDATE_CHANNEL = "__redis__:invalidate";
+
+    // CLIENT TRACKING on's options
+    struct Options {
+        uint64_t redirect = 0;  // Client sent the invalidations (0 = the tracking client, over RESP3)
+        bool broadcast = false; // BCAST: every change under prefixes, nothing per key
+        std::vector<std::string> prefixes; // BCAST prefixes (none = every key)
+        bool noloop = false;    // Skip changes made by the client itself
+    };
+
+    explicit ClientTracking(PubSub& hub) : hub_(hub) {}
+
+    // Start tracking for client, replacing any earlier options / stop it
+    void enable(uint64_t client, Options options);
+    void disable(uint64_t client);
+    // client's REDIRECT id: 0 without one, -1 if it is not tracking (CLIENT GETREDIR)
+    int64_t redirect_of(uint64_t client) const;
+    // Clients with tracking on
+    size_t client_count() const;
+
+    void invalidate(std::string_view key, const std::vector<uint64_t>& clients) override;
+
+private:
+    // Send key's invalidation for client: a push, or a message to its redirect
+    // (the frames are serialized on first use and shared)
+    void send(uint64_t client, const Options& options, std::string_view key, ValueRef& push, ValueRef& message);
+
+    PubSub& hub_;
+    mutable std::shared_mutex mutex_; // Exclusive to change the clients, shared to invalidate
+    std::unordered_map<uint64_t, Options> clients_;
+    std::vector<uint64_t> broadcasting_; // Clients in BCAST mode
+};
+
+} // namespace mini_redis
@@ -0,0 +1,110 @@
+// Transaction queue, WATCH bookkeeping and the lock set EXEC runs under
+
+#include "transaction.hpp"
+
+#include "../protocol/command_table.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace mini_redis {
+
+namespace {
+
+// Lock order: database, then shard index
+bool shard_before(const std::pair<const KVStore*, size_t>& a, const std::pair<const KVStore*, size_t>& b) {
+    return std::less<const KVStore*>()(a.first, b.first) || (a.first == b.first && a.second < b.second);
+}
+
+} // anonymous namespace
+
+void ShardLocks::add_key(const KVStore& db, std::string_view key) {
+    shards_.emplace_back(&db, db.shard_index(key));
+}
+
+void ShardLocks::add_store(const KVStore& db) {
+    for (size_t i = 0; i < db.shard_count(); ++i) {
+        shards_.emplace_back(&db, i);
+    }
+}
+
+void ShardLocks::lock() {
+    std::sort(shards_.begin(), shards_.end(), shard_before);
+    shards_.erase(std::unique(shards_.begin(), shards_.end()), shards_.end());
+    held_.reserve(shards_.size());
+    for (const auto& [db, index] : shards_) {
+        held_.push_back(db->lock_shard(index));
+    }
+}
+
+bool ShardLocks::covers(const KVStore& db, std::string_view key) const {
+    const std::pair<const KVStore*, size_t> shard(&db, db.shard_index(key));
+    return std::binary_search(shards_.begin(), shards_.end(), shard, shard_before);
+}
+
+void add_command_locks(const protocol::Command& cmd, std::vector<KVStore>& dbs, int db_index, ShardLocks& locks) {
+    const protocol::CommandSpec& spec = protocol::command_spec(cmd.type);
+    KVStore& db = dbs[static_cast<size_t>(db_index)];
+    if ((spec.flags & protocol::CMD_ADMIN) || cmd.type == protocol::CommandType::FLUSHALL) {
+        for (KVStore& other : dbs) {
+            locks.add_store(other);
+        }
+    } else if (spec.flags & protocol::CMD_NO_KEYS) {
+        locks.add_store(db);
+    } else {
+        const protocol::KeyRange keys = protocol::command_keys(cmd);
+        for (size_t i = keys.first; i < keys.end; i += keys.step) {
+            locks.add_key(db, cmd.args[i]);
+        }
+    }
+}
+
+Transaction::~Transaction() {
+    unwatch_all();
+}
+
+void Transaction::end() {
+    in_multi_ = false;
+    aborted_ = false;
+    queued_.clear();
+}
+
+std::vector<protocol::Command> Transaction::take_queued() {
+    std::vector<protocol::Command> queued = std::move(queued_);
+    end();
+    return queued;
+}
+
+void Transaction::watch(KVStore& db, const std::string& key) {
+    for (const Watched& watched : watched_) {
+        if (watched.db == &db && watched.key == key) {
+            return;
+        }
+    }
+    const uint64_t version = db.watch(key);
+    watched_.push_back({&db, key, version});
+}
+
+void Transaction::unwatch_all() {
+    for (const Watched& watched : watched_) {
+        watched.db->unwatch(watched.key);
+    }
+    watched_.clear();
+}
+
+void Transaction::add_watch_locks(ShardLocks& locks) const {
+    for (const Watched& watched : watched_) {
+        locks.add_key(*watched.db, watched.key);
+    }
+}
+
+bool Transaction::watches_intact() const {
+    for (const Watched& watched : watched_) {
+        if (watched.db->watch_version(watched.key) != watched.version) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace mini_redis
@@ -0,0 +1,91 @@
+// Transactions for Mini-Redis: MULTI, EXEC, DISCARD and WATCH
+// After MULTI a client's commands are checked and queued in its Transaction
+// instead of run. EXEC runs the queue back to back while holding the shard
+// locks of every key the commands name (every shard of a database for one
+// that names none, such as KEYS or FLUSHDB), so no other client's command
+// sees the keys half way through. Shard locks are recursive, so the queued
+// commands lock their shards again as usual.
+// WATCH records a key's change count (KVStore::watch); EXEC checks the counts
+// once it holds the locks and runs nothing if one of them moved.
+// Locks are taken by database, then shard index, the same order lock_batch
+// and snapshots use, so two lock holders never wait on each other in a cycle.
+
+#pragma once
+
+#include "../protocol/parser.hpp"
+#include "../storage/kv_store.hpp"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace mini_redis {
+
+// Shard locks taken together and held until destruction
+class ShardLocks {
+public:
+    // Include key's shard of db / every shard of db
+    void add_key(const KVStore& db, std::string_view key);
+    void add_store(const KVStore& db);
+    // Take every lock added, in order; call once
+    void lock();
+    // Whether key's shard is locked (after lock)
+    bool covers(const KVStore& db, std::string_view key) const;
+
+private:
+    // The shards to lock, sorted by database address (databases sit in one
+    // vector, in index order) then shard index
+    std::vector<std::pair<const KVStore*, size_t>> shards_;
+    std::vector<std::unique_lock<KVStore::ShardMutex>> held_;
+};
+
+// Add the shards cmd touches when run against dbs[db_index]: its keys, every
+// shard of the database for a data command naming none, and every database
+// for FLUSHALL and server commands (whose INFO or SAVE reads them all)
+void add_command_locks(const protocol::Command& cmd, std::vector<KVStore>& dbs, int db_index, ShardLocks& locks);
+
+// One client's MULTI queue and WATCHed keys
+class Transaction {
+public:
+    Transaction() = default;
+    ~Transaction(); // Stops watching its keys
+
+    Transaction(const Transaction&) = delete;
+    Transaction& operator=(const Transaction&) = delete;
+
+    bool in_multi() const { return in_multi_; }
+    void begin() { in_multi_ = true; }
+    // A command could not be queued: EXEC replies EXECABORT
+    void abort() { aborted_ = true; }
+    bool aborted() const { return aborted_; }
+    void queue(const protocol::Command& cmd) { queued_.push_back(cmd); }
+    const std::vector<protocol::Command>& queued() const { return queued_; }
+    // Leave MULTI, dropping the queue / handing it to EXEC (the watches stay
+    // until unwatch_all)
+    void end();
+    std::vector<protocol::Command> take_queued();
+
+    // WATCH key in db (a no-op if already watched)
+    void watch(KVStore& db, const std::string& key);
+    void unwatch_all();
+    // Include the watched keys' shards in locks
+    void add_watch_locks(ShardLocks& locks) const;
+    // Whether no watched key changed since its WATCH
+    bool watches_intact() const;
+
+private:
+    struct Watched {
+        KVStore* db;
+        std::string key;
+        uint64_t version;
+    };
+
+    bool in_multi_ = false;
+    bool aborted_ = false;
+    std::vector<protocol::Command> queued_;
+    std::vector<Watched> watched_;
+};
+
+} // namespace mini_redis
@@ -0,0 +1,69 @@
+// Active expiration implementation
+// Each tick spends a bounded time budget draining due keys from the expiry heaps
+
+#include "active_expirer.hpp"
+#include "kv_store.hpp"
+
+#include <algorithm>
+
+ActiveExpirer::ActiveExpirer(std::vector<KVStore>& databases, int hz, int budget_percent)
+    : databases_(databases), running_(false) {
+    hz = std::max(1, std::min(hz, 500));
+    budget_percent = std::max(1, std::min(budget_percent, 100));
+    tick_ = std::chrono::microseconds(1000000 / hz);
+    budget_ = tick_ * budget_percent / 100;
+}
+
+ActiveExpirer::~ActiveExpirer() {
+    stop();
+}
+
+void ActiveExpirer::start() {
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    expire_thread_ = std::thread(&ActiveExpirer::expire_thread_func, this);
+}
+
+void ActiveExpirer::stop() {
+    if (!running_) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        running_ = false;
+    }
+    wait_cv_.notify_all();
+    if (expire_thread_.joinable()) {
+        expire_thread_.join();
+    }
+}
+
+size_t ActiveExpirer::run_cycle() {
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + budget_;
+    size_t removed = 0;
+    const size_t n = databases_.size();
+    // Start one database further on each cycle so a busy database cannot starve the rest
+    for (size_t visited = 0; visited < n; ++visited) {
+        auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - clock::now());
+        if (remaining.count() <= 0) {
+            break;
+        }
+        removed += databases_[(next_db_ + visited) % n].active_expire_cycle(remaining);
+    }
+    if (n > 0) {
+        next_db_ = (next_db_ + 1) % n;
+    }
+    return removed;
+}
+
+void ActiveExpirer::expire_thread_func() {
+    while (running_) {
+        run_cycle();
+
+        std::unique_lock<std::mutex> lock(wait_mutex_);
+        wait_cv_.wait_for(lock, tick_, [this] { return !running_; });
+    }
+}
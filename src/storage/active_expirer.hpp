@@ -0,0 +1,42 @@
+// Active expiration for Mini-Redis
+// Background thread that reclaims keys whose TTL elapsed without being read again
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+class KVStore;
+
+class ActiveExpirer {
+public:
+    // hz: cycles per second; budget_percent: share of each tick spent expiring
+    ActiveExpirer(std::vector<KVStore>& databases, int hz = 10, int budget_percent = 25);
+    ~ActiveExpirer();
+
+    // Start the background expire thread
+    void start();
+
+    // Stop the background expire thread gracefully
+    void stop();
+
+    // Run one cycle over all databases (also used by tests). Returns keys removed.
+    size_t run_cycle();
+
+private:
+    // Background thread function: one bounded cycle per tick
+    void expire_thread_func();
+
+    std::vector<KVStore>& databases_;
+    std::chrono::microseconds tick_;
+    std::chrono::microseconds budget_;
+    size_t next_db_ = 0; // Database the next cycle starts from
+    std::mutex wait_mutex_;
+    std::condition_variable wait_cv_;
+    std::thread expire_thread_;
+    std::atomic<bool> running_;
+};
@@ -1,25 +1,369 @@
 // AOF (Append-Only File) logger implementation
-// Logs write commands to file in RESP format using background thread
+// Logs write commands to file in RESP format using background thread.
+// Producers claim space in the ring with a CAS on head_, serialize the command
+// in place and publish it by storing its length in lengths_. The writer walks
+// committed records in order, hands them to writev in one call per batch,
+// fsyncs according to the policy and then releases the space.
+//
+// A rewrite snapshots one shard at a time. Taking the write gate exclusively
+// for that moment gives the shard a cut: every write applied to it so far was
+// logged before the cut, every later one after it. The writer copies records
+// logged during the rewrite, and each is kept only if it lies past its key's
+// cut, so no write is applied twice when the new file is replayed. A command
+// on several keys is cut down to the keys past their own shards' cuts; one
+// that names no keys (FLUSHDB) cannot be placed, and cancels the rewrite.
 
 #include "aof_logger.hpp"
 #include "../protocol/parser.hpp"
+#include "../protocol/command_table.hpp"
+#include "../protocol/resp_parser.hpp"
 #include "kv_store.hpp"
 #include "../utils/logger.hpp"
 
+#include <fstream>
 #include <sstream>
+#include <vector>
+#include <chrono>
+#include <cstring>
 #include <algorithm>
 #include <cctype>
+#include <cstdio>
+#include <cerrno>
 
-AOFLogger::AOFLogger(const std::string& filename) 
-    : filename_(filename), running_(false) {
-    aof_file_.open(filename, std::ios::app);
-    if (!aof_file_.is_open()) {
-        mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "Failed to open AOF file: " + filename);
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+namespace {
+
+constexpr int MAX_BATCH_RECORDS = 1024; // iovecs per writev (IOV_MAX on Linux)
+constexpr size_t REPLAY_CHUNK = 64 * 1024;
+constexpr size_t REWRITE_FLUSH_BYTES = 1024 * 1024; // Snapshot output is written in chunks of about this size
+
+#ifdef _WIN32
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#endif
+
+int64_t steady_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Write every slice, retrying short writes; returns false on a write error
+bool write_slices(int fd, iovec* iov, int count) {
+#ifdef _WIN32
+    for (int i = 0; i < count; ++i) {
+        const char* data = static_cast<const char*>(iov[i].iov_base);
+        size_t left = iov[i].iov_len;
+        while (left > 0) {
+            int n = _write(fd, data, static_cast<unsigned>(std::min<size_t>(left, 1u << 30)));
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            left -= static_cast<size_t>(n);
+        }
+    }
+    return true;
+#else
+    while (count > 0) {
+        ssize_t n = ::writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        // Skip fully written slices and trim a partially written one
+        size_t written = static_cast<size_t>(n);
+        while (count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+#endif
+}
+
+size_t round_to_cell(size_t bytes, size_t cell) {
+    return (bytes + cell - 1) / cell * cell;
+}
+
+bool write_all(int fd, const std::string& data) {
+    iovec iov{const_cast<char*>(data.data()), data.size()};
+    return data.empty() || write_slices(fd, &iov, 1);
+}
+
+int open_append(const std::string& path, bool truncate) {
+#ifdef _WIN32
+    return _open(path.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY | (truncate ? _O_TRUNC : 0),
+                 _S_IREAD | _S_IWRITE);
+#else
+    return ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+#endif
+}
+
+void close_fd(int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+bool sync_fd(int fd) {
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#else
+    return ::fsync(fd) == 0;
+#endif
+}
+
+// Cut off a partly written batch so a retry does not leave half a record behind
+void truncate_fd(int fd, uint64_t size) {
+#ifdef _WIN32
+    _chsize_s(fd, static_cast<long long>(size));
+#else
+    int rc = ::ftruncate(fd, static_cast<off_t>(size));
+    (void)rc; // Nothing more to do if even this fails: the retry appends after it
+#endif
+}
+
+uint64_t file_length(int fd) {
+#ifdef _WIN32
+    long long end = _lseeki64(fd, 0, SEEK_END);
+#else
+    off_t end = ::lseek(fd, 0, SEEK_END);
+#endif
+    return end > 0 ? static_cast<uint64_t>(end) : 0;
+}
+
+// Element index of a logged command (0 = its name); false if the record has none
+bool record_field(const std::string& record, int index, std::string& value) {
+    // *<n>\r\n$<len>\r\n<name>\r\n$<len>\r\n<key>\r\n...
+    size_t pos = record.find("\r\n");
+    for (int field = 0; field <= index && pos != std::string::npos; ++field) {
+        pos += 2;
+        if (pos >= record.size() || record[pos] != '$') {
+            return false;
+        }
+        size_t eol = record.find("\r\n", pos);
+        if (eol == std::string::npos) {
+            return false;
+        }
+        size_t len = 0;
+        try {
+            len = static_cast<size_t>(std::stoul(record.substr(pos + 1, eol - pos - 1)));
+        } catch (...) {
+            return false;
+        }
+        if (eol + 2 + len > record.size()) {
+            return false;
+        }
+        if (field == index) {
+            value.assign(record, eol + 2, len);
+            return true;
+        }
+        pos = eol + 2 + len;
+    }
+    return false;
+}
+
+// Key of a logged command (its first argument); false if the record has none
+bool record_key(const std::string& record, std::string& key) {
+    return record_field(record, 1, key);
+}
+
+// Parse a logged command naming several keys (MSET, multi-key DEL...), which
+// can lie in different shards; false for any other record
+bool parse_batch(const std::string& record, const protocol::CommandSpec* spec, protocol::Command& batch) {
+    if (!spec || !(spec->flags & (protocol::CMD_KEYS_ALL | protocol::CMD_KEY_PAIRS))) {
+        return false;
+    }
+    RespParser parser;
+    parser.append(record.data(), record.size());
+    std::vector<std::string_view> args;
+    std::string error;
+    if (parser.parseArgs(args, error) != RespStatus::Complete || args.empty()) {
+        return false;
+    }
+    const protocol::KeyRange keys = protocol::command_keys(*spec, args.size() - 1);
+    if (keys.end - keys.first <= keys.step) {
+        return false;
+    }
+    batch.type = spec->type;
+    batch.args.assign(args.begin() + 1, args.end());
+    return true;
+}
+
+// SELECT db as a logged record
+std::string select_record(int db) {
+    protocol::Command select;
+    select.type = protocol::CommandType::SELECT;
+    select.args.push_back(std::to_string(db));
+    return protocol::command_to_resp(select);
+}
+
+// Append a SELECT to out if the records after it are on another database
+// than the current one
+void select_in(std::string& out, int& current, int db) {
+    if (db != current) {
+        out += select_record(db);
+        current = db;
+    }
+}
+
+// Elements per command when a collection is rewritten, so one large
+// collection does not become one huge record
+const size_t REWRITE_BATCH_ELEMENTS = 64;
+
+// A collection's snapshot form: HSET / RPUSH / SADD / ZADD commands of up to
+// REWRITE_BATCH_ELEMENTS elements each
+void append_collection(std::string& out, const KVStore::SnapshotEntry& entry) {
+    Listpack elements;
+    if (!Listpack::parse(entry.value, elements)) {
+        return;
+    }
+    protocol::Command cmd;
+    size_t per_element = 1;
+    switch (entry.type) {
+        case ValueType::Hash: cmd.type = protocol::CommandType::HSET; per_element = 2; break;
+        case ValueType::List: cmd.type = protocol::CommandType::RPUSH; break;
+        case ValueType::Set: cmd.type = protocol::CommandType::SADD; break;
+        case ValueType::ZSet: cmd.type = protocol::CommandType::ZADD; per_element = 2; break;
+        case ValueType::String: return;
+    }
+    auto flush = [&]() {
+        if (cmd.args.size() > 1) {
+            out += protocol::command_to_resp(cmd);
+        }
+        cmd.args.resize(1);
+    };
+    cmd.args.push_back(entry.key);
+    for (size_t pos = elements.begin(); pos != elements.end(); pos = elements.next(pos)) {
+        if (entry.type == ValueType::ZSet) {
+            // Dumped as member, score; ZADD takes score, member
+            const size_t score = elements.next(pos);
+            cmd.args.emplace_back(elements.at(score));
+            cmd.args.emplace_back(elements.at(pos));
+            pos = score;
+        } else {
+            cmd.args.emplace_back(elements.at(pos));
+        }
+        if (cmd.args.size() > REWRITE_BATCH_ELEMENTS * per_element) {
+            flush();
+        }
     }
+    flush();
+}
+
+// The snapshot form of a key: SET (or its collection's commands) plus an
+// absolute PEXPIREAT for its TTL
+void append_snapshot_entry(std::string& out, KVStore::SnapshotEntry& entry) {
+    protocol::Command cmd;
+    cmd.type = protocol::CommandType::SET;
+    cmd.args.push_back(entry.key);
+    if (entry.type == ValueType::String) {
+        cmd.args.push_back(std::move(entry.value));
+        out += protocol::command_to_resp(cmd);
+    } else {
+        append_collection(out, entry);
+        cmd.args.emplace_back();
+    }
+    if (entry.expire_at_ms != 0) {
+        cmd.type = protocol::CommandType::PEXPIREAT;
+        cmd.args[1] = std::to_string(entry.expire_at_ms);
+        out += protocol::command_to_resp(cmd);
+    }
+}
+
+} // anonymous namespace
+
+AOFLogger::AOFLogger(const std::string& filename, FsyncPolicy policy, size_t ring_bytes)
+    : filename_(filename), policy_(policy), running_(false) {
+    // Power of two, at least a few cells, so positions wrap with a mask
+    capacity_ = CELL * 4;
+    while (capacity_ < ring_bytes) {
+        capacity_ <<= 1;
+    }
+    mask_ = capacity_ - 1;
+    ring_.reset(new char[capacity_]);
+    lengths_.reset(new std::atomic<uint32_t>[capacity_ / CELL]);
+    for (size_t i = 0; i < capacity_ / CELL; ++i) {
+        lengths_[i].store(0, std::memory_order_relaxed);
+    }
+    record_dbs_.reset(new uint32_t[capacity_ / CELL]());
+    open_file();
 }
 
 AOFLogger::~AOFLogger() {
     stop();
+    close_file();
+}
+
+bool AOFLogger::parse_fsync_policy(const std::string& name, FsyncPolicy& out) {
+    if (name == "always") {
+        out = FsyncPolicy::Always;
+    } else if (name == "everysec") {
+        out = FsyncPolicy::EverySec;
+    } else if (name == "no") {
+        out = FsyncPolicy::No;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* AOFLogger::fsync_policy_name(FsyncPolicy policy) {
+    switch (policy) {
+        case FsyncPolicy::Always: return "always";
+        case FsyncPolicy::EverySec: return "everysec";
+        case FsyncPolicy::No: return "no";
+    }
+    return "everysec";
+}
+
+void AOFLogger::open_file() {
+    fd_ = open_append(filename_, false);
+    if (fd_ < 0) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "Failed to open AOF file: " + filename_);
+        return;
+    }
+    file_size_ = file_length(fd_);
+    base_size_ = file_size_.load();
+    // Records already in the file may end on any database (replay tells which)
+    logged_db_ = file_size_ == 0 ? 0 : -1;
+}
+
+void AOFLogger::close_file() {
+    if (fd_ >= 0) {
+        close_fd(fd_);
+        fd_ = -1;
+    }
+}
+
+bool AOFLogger::sync_file() {
+    unsynced_ = false;
+    last_fsync_ms_ = steady_ms();
+    if (fd_ < 0) {
+        return false;
+    }
+    return sync_fd(fd_);
 }
 
 void AOFLogger::start() {
@@ -27,6 +371,7 @@ void AOFLogger::start() {
         return;
     }
     running_ = true;
+    last_fsync_ms_ = steady_ms();
     writer_thread_ = std::thread(&AOFLogger::writer_thread_func, this);
 }
 
@@ -34,213 +379,749 @@ void AOFLogger::stop() {
     if (!running_) {
         return;
     }
+    {
+        // Abandon a rewrite in progress (the writer is still up to finish a swap already requested)
+        std::lock_guard<std::mutex> lock(rewrite_start_mutex_);
+        rewrite_abort_ = true;
+        if (rewrite_thread_.joinable()) {
+            rewrite_thread_.join();
+        }
+    }
     running_ = false;
-    queue_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+    }
+    wake_cv_.notify_all();
     if (writer_thread_.joinable()) {
         writer_thread_.join();
     }
-    if (aof_file_.is_open()) {
-        aof_file_.close();
-    }
-}
-
-// Convert command to RESP array format: *<count>\r\n$<len>\r\n<arg>\r\n...
-static std::string command_to_resp(const protocol::Command& cmd) {
-    std::string result;
-    
-    // Determine command name from type
-    std::string cmd_name;
-    switch (cmd.type) {
-        case protocol::CommandType::SET: cmd_name = "SET"; break;
-        case protocol::CommandType::DEL: cmd_name = "DEL"; break;
-        case protocol::CommandType::EXPIRE: cmd_name = "EXPIRE"; break;
-        default: return ""; // Only log write commands
-    }
-    
-    // Count total arguments (command name + args)
-    size_t arg_count = 1 + cmd.args.size();
-    
-    // Build RESP array: *<count>\r\n
-    result = "*" + std::to_string(arg_count) + "\r\n";
-    
-    // Add command name as bulk string: $<len>\r\n<value>\r\n
-    result += "$" + std::to_string(cmd_name.size()) + "\r\n" + cmd_name + "\r\n";
-    
-    // Add each argument as bulk string
-    for (const auto& arg : cmd.args) {
-        result += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
-    }
-    
-    return result;
-}
-
-void AOFLogger::append(const protocol::Command& cmd) {
-    // Only log write commands
-    if (cmd.type != protocol::CommandType::SET && 
-        cmd.type != protocol::CommandType::DEL && 
-        cmd.type != protocol::CommandType::EXPIRE) {
-        return;
+    // Everything committed before stop() is written now: wake its waiters
+    notify_durable();
+}
+
+uint64_t AOFLogger::claim(size_t bytes) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    while (true) {
+        // A record never wraps: if it does not fit before the ring's end, the
+        // rest of the ring is claimed as padding and the record starts at 0
+        size_t offset = static_cast<size_t>(head & mask_);
+        size_t pad = offset + bytes > capacity_ ? capacity_ - offset : 0;
+        uint64_t end = head + pad + bytes;
+
+        if (end - tail_.load(std::memory_order_acquire) > capacity_) {
+            // Ring full: let the writer catch up
+            if (writer_sleeping_.load()) {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+                wake_cv_.notify_one();
+            }
+            std::this_thread::yield();
+            head = head_.load(std::memory_order_relaxed);
+            continue;
+        }
+        if (head_.compare_exchange_weak(head, end, std::memory_order_relaxed)) {
+            if (pad > 0) {
+                commit(head, FLAG_PAD | static_cast<uint32_t>(pad));
+            }
+            return head + pad;
+        }
     }
-    
-    std::string resp_cmd = command_to_resp(cmd);
-    if (resp_cmd.empty()) {
-        return;
+}
+
+void AOFLogger::commit(uint64_t start, uint32_t header) {
+    // seq_cst pairs with the writer's sleeping flag so a wakeup is never lost
+    lengths_[cell_of(start)].store(header);
+    if (writer_sleeping_.load()) {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wake_cv_.notify_one();
+    }
+}
+
+uint64_t AOFLogger::append(const protocol::Command& cmd, int db_index) {
+    // Only log write commands (as flagged in the command table)
+    if (!protocol::is_write_command(cmd.type)) {
+        return 0;
+    }
+
+    size_t size = protocol::command_resp_size(cmd);
+    if (size == 0) {
+        return 0;
+    }
+
+    if (size > capacity_ / 4) {
+        // Too big to share the ring: the record carries a pointer to it instead
+        std::string* big = new std::string(protocol::command_to_resp(cmd));
+        uint64_t start = claim(CELL);
+        std::memcpy(ring_.get() + (start & mask_), &big, sizeof(big));
+        record_dbs_[cell_of(start)] = static_cast<uint32_t>(db_index);
+        commit(start, FLAG_INDIRECT | static_cast<uint32_t>(sizeof(big)));
+        return start + CELL;
     }
-    
-    // Add to queue (non-blocking)
+
+    // Serialize straight into the claimed bytes: no per-command allocation
+    size_t bytes = round_to_cell(size, CELL);
+    uint64_t start = claim(bytes);
+    protocol::write_command_resp(cmd, ring_.get() + (start & mask_));
+    record_dbs_[cell_of(start)] = static_cast<uint32_t>(db_index);
+    commit(start, static_cast<uint32_t>(size));
+    return start + bytes;
+}
+
+bool AOFLogger::durable(uint64_t ticket) const {
+    // seq_cst pairs with the store in write_batch: a caller that parks a reply
+    // after seeing false is sure to be told when it becomes true
+    return policy_ != FsyncPolicy::Always || ticket == 0 || durable_.load() >= ticket;
+}
+
+bool AOFLogger::wait_durable(uint64_t ticket) {
+    if (durable(ticket)) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(durable_mutex_);
+    durable_cv_.wait(lock, [&] { return durable(ticket) || write_failed(); });
+    return durable(ticket);
+}
+
+void AOFLogger::set_write_error(int error, const char* what) {
+    if (write_errno_.exchange(error) == 0) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Error, std::string(what) + ": " + filename_ + ": " +
+                                std::strerror(error) + "; refusing writes");
+    }
+}
+
+std::string AOFLogger::write_error() const {
+    const int error = write_errno_.load();
+    return error == 0 ? std::string() : std::string(std::strerror(error));
+}
+
+void AOFLogger::add_durable_listener(std::function<void()> listener) {
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    durable_listeners_.push_back(std::move(listener));
+}
+
+void AOFLogger::notify_durable() {
     {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        command_queue_.push(resp_cmd);
+        std::lock_guard<std::mutex> lock(durable_mutex_);
+    }
+    durable_cv_.notify_all();
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    for (const auto& listener : durable_listeners_) {
+        listener();
     }
-    queue_cv_.notify_one();
 }
 
-void AOFLogger::writer_thread_func() {
-    while (running_) {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        
-        // Wait for commands or shutdown signal
-        queue_cv_.wait(lock, [this] { return !command_queue_.empty() || !running_; });
-        
-        // Process all queued commands
-        while (!command_queue_.empty()) {
-            std::string cmd = command_queue_.front();
-            command_queue_.pop();
-            lock.unlock();
-            
-            // Write to file
-            if (aof_file_.is_open()) {
-                aof_file_ << cmd;
-                aof_file_.flush(); // Ensure data is written
-            }
-            
-            lock.lock();
-        }
-    }
-}
-
-// Simple RESP array parser for AOF replay
-// Parses format: *<count>\r\n$<len>\r\n<value>\r\n...
-static bool parse_resp_array(const std::string& resp_data, size_t& pos, std::vector<std::string>& args) {
-    if (pos >= resp_data.length() || resp_data[pos] != '*') {
-        return false;
+void AOFLogger::wait_for_records(int64_t timeout_ms) {
+    std::atomic<uint32_t>& next = lengths_[cell_of(read_pos_)];
+    writer_sleeping_.store(true);
+    if (next.load() == 0 && running_ && !rewrite_finish_) {
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                          [&] { return next.load() != 0 || !running_ || rewrite_finish_; });
     }
-    pos++; // Skip '*'
-    
-    // Read count
-    size_t count_end = resp_data.find("\r\n", pos);
-    if (count_end == std::string::npos) {
+    writer_sleeping_.store(false);
+}
+
+bool AOFLogger::write_batch() {
+    iovec iov[MAX_BATCH_RECORDS];
+    uint64_t slice_pos[MAX_BATCH_RECORDS];
+    std::string* indirect[MAX_BATCH_RECORDS];
+    size_t record_cells[MAX_BATCH_RECORDS];
+    bool wrote_any = false;
+
+    // Group commit: one writev per run of committed records, then one fsync
+    while (true) {
+        int slices = 0;
+        int records = 0;
+        int big_records = 0;
+        uint64_t pos = read_pos_;
+        // One writev holds the records of one database, after a SELECT if the
+        // file was on another
+        int batch_db = -1;
+        bool selects = false;
+        // Headers are cleared only after the write, so stop after one lap of a
+        // full ring (and leave an iovec for the SELECT)
+        while (records < MAX_BATCH_RECORDS - 1 && pos - read_pos_ < capacity_) {
+            size_t cell = cell_of(pos);
+            uint32_t header = lengths_[cell].load(std::memory_order_acquire);
+            if (header == 0) {
+                break; // Not committed yet: later records wait for it to keep order
+            }
+            if (!(header & FLAG_PAD)) {
+                const int db = static_cast<int>(record_dbs_[cell]);
+                if (batch_db < 0) {
+                    batch_db = db;
+                    if (db != logged_db_) {
+                        select_record_ = select_record(db);
+                        slice_pos[slices] = pos;
+                        iov[slices++] = iovec{&select_record_[0], select_record_.size()};
+                        selects = true;
+                    }
+                } else if (db != batch_db) {
+                    break; // The next batch starts with its SELECT
+                }
+            }
+            record_cells[records++] = cell;
+            size_t length = header & LENGTH_MASK;
+            char* data = ring_.get() + (pos & mask_);
+            if (header & FLAG_PAD) {
+                pos += header & ~FLAG_PAD;
+                continue;
+            }
+            if (header & FLAG_INDIRECT) {
+                std::string* big = nullptr;
+                std::memcpy(&big, data, sizeof(big));
+                indirect[big_records++] = big;
+                slice_pos[slices] = pos;
+                iov[slices++] = iovec{const_cast<char*>(big->data()), big->size()};
+                pos += CELL;
+                continue;
+            }
+            slice_pos[slices] = pos;
+            iov[slices++] = iovec{data, length};
+            pos += round_to_cell(length, CELL);
+        }
+        if (records == 0) {
+            break;
+        }
+
+        // A rewrite in progress gets a copy of everything logged since it began
+        const uint64_t capture_from = capture_from_.load();
+        size_t captured_before = 0;
+        if (capture_from != NOT_CUT) {
+            std::lock_guard<std::mutex> lock(rewrite_mutex_);
+            captured_before = rewrite_tail_.size();
+            // The SELECT is not captured: the new file has its own
+            for (int i = selects ? 1 : 0; i < slices; ++i) {
+                if (slice_pos[i] >= capture_from) {
+                    rewrite_tail_.push_back(TailRecord{
+                        slice_pos[i], batch_db,
+                        std::string(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len)});
+                }
+            }
+        }
+
+        size_t bytes = 0;
+        for (int i = 0; i < slices; ++i) {
+            bytes += iov[i].iov_len;
+        }
+        if (slices > 0 && (fd_ < 0 || !write_slices(fd_, iov, slices))) {
+            // Keep the records in the ring and retry them (writer_thread_func);
+            // until then writes are refused and held replies fail
+            const int error = fd_ < 0 ? EBADF : errno;
+            if (fd_ >= 0) {
+                truncate_fd(fd_, file_size_.load());
+            }
+            if (capture_from != NOT_CUT) {
+                std::lock_guard<std::mutex> lock(rewrite_mutex_);
+                rewrite_tail_.resize(std::min(rewrite_tail_.size(), captured_before));
+            }
+            write_stalled_ = true;
+            set_write_error(error, "AOF write failed");
+            break;
+        }
+        if (write_stalled_) {
+            write_stalled_ = false;
+            if (!fsync_failed_) {
+                write_errno_ = 0;
+                mini_redis::Logger::log(mini_redis::Logger::Level::Info,
+                                        "AOF write error resolved; accepting writes again");
+            }
+        }
+        file_size_ += bytes;
+        unsynced_ = unsynced_ || slices > 0;
+        if (batch_db >= 0) {
+            logged_db_ = batch_db;
+        }
+        wrote_any = true;
+
+        // Free the space: clear the headers before producers can reclaim the cells
+        for (int i = 0; i < records; ++i) {
+            lengths_[record_cells[i]].store(0, std::memory_order_relaxed);
+        }
+        for (int i = 0; i < big_records; ++i) {
+            delete indirect[i];
+        }
+        read_pos_ = pos;
+        tail_.store(pos, std::memory_order_release);
+    }
+
+    if (!wrote_any) {
+        if (write_stalled_ && policy_ == FsyncPolicy::Always) {
+            notify_durable(); // Held replies fail now rather than at the retry
+        }
         return false;
     }
-    int count = std::stoi(resp_data.substr(pos, count_end - pos));
-    pos = count_end + 2; // Skip \r\n
-    
-    // Read each bulk string
-    for (int i = 0; i < count; ++i) {
-        if (pos >= resp_data.length() || resp_data[pos] != '$') {
-            return false;
+    if ((policy_ == FsyncPolicy::Always ||
+         (policy_ == FsyncPolicy::EverySec && steady_ms() - last_fsync_ms_ >= 1000)) &&
+        !sync_file() && !fsync_failed_) {
+        // Not retried: after a failed fsync the kernel may have dropped the
+        // dirty pages, so a later fsync succeeding proves nothing
+        fsync_failed_ = true;
+        set_write_error(errno, "AOF fsync failed");
+    }
+    if (!fsync_failed_) {
+        durable_.store(read_pos_);
+    }
+    if (policy_ == FsyncPolicy::Always) {
+        // Nobody waits under the other policies
+        notify_durable();
+    }
+    return true;
+}
+
+void AOFLogger::writer_thread_func() {
+    while (true) {
+        // Read before taking the batch: a record committed before stop() is
+        // then either in this batch or in the next one, which must come back
+        // empty before the writer exits
+        const bool stopping = !running_;
+        bool wrote = write_batch();
+        if (rewrite_finish_) {
+            finish_rewrite();
         }
-        pos++; // Skip '$'
-        
-        // Read length
-        size_t len_end = resp_data.find("\r\n", pos);
-        if (len_end == std::string::npos) {
-            return false;
+        if (wrote) {
+            maybe_auto_rewrite();
+            continue;
         }
-        int len = std::stoi(resp_data.substr(pos, len_end - pos));
-        pos = len_end + 2; // Skip \r\n
-        
-        // Read value
-        if (pos + len > resp_data.length()) {
-            return false;
+        if (stopping) {
+            if (write_stalled_) {
+                mini_redis::Logger::log(mini_redis::Logger::Level::Error,
+                                        "AOF writer stopped with records it could not write");
+            }
+            break;
+        }
+        if (write_stalled_) {
+            // Retry the failed write once a second, as Redis does
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            wake_cv_.wait_for(lock, std::chrono::milliseconds(1000), [&] { return !running_; });
+            continue;
+        }
+        // Idle: sleep until a record arrives, or until the pending everysec fsync is due
+        int64_t timeout_ms = 1000;
+        if (policy_ == FsyncPolicy::EverySec && unsynced_) {
+            timeout_ms = std::max<int64_t>(0, last_fsync_ms_ + 1000 - steady_ms());
+            if (timeout_ms == 0) {
+                sync_file();
+                continue;
+            }
         }
-        args.push_back(resp_data.substr(pos, len));
-        pos += len;
-        
-        // Skip \r\n after value
-        if (pos + 2 > resp_data.length() || resp_data.substr(pos, 2) != "\r\n") {
+        wait_for_records(timeout_ms);
+    }
+
+    // Shutting down: everything written so far goes to disk unless the policy is "no"
+    if (unsynced_ && policy_ != FsyncPolicy::No) {
+        sync_file();
+    }
+}
+
+bool AOFLogger::drain_rewrite_tail() {
+    std::vector<TailRecord> records;
+    std::vector<uint64_t> cuts;
+    {
+        std::lock_guard<std::mutex> lock(rewrite_mutex_);
+        records.swap(rewrite_tail_);
+        cuts = shard_cuts_;
+    }
+    // The cut of key's shard in database db; a database the rewrite does not
+    // snapshot has nothing in the new file, so all of its records are kept
+    auto cut_of = [&](int db, const std::string& key) {
+        if (db < 0 || static_cast<size_t>(db) >= rewrite_dbs_.size()) {
+            return uint64_t(0);
+        }
+        return cuts[cut_base_[static_cast<size_t>(db)] + rewrite_dbs_[static_cast<size_t>(db)]->shard_index(key)];
+    };
+
+    // A record before its shard's cut (or for a shard not cut yet, whose cut
+    // will come later) is already part of the snapshot
+    std::string out;
+    std::string key;
+    std::string name;
+    protocol::Command batch;
+    for (auto& record : records) {
+        const protocol::CommandSpec* spec =
+            record_field(record.record, 0, name) ? protocol::lookup_command(name) : nullptr;
+        if (spec && (spec->flags & protocol::CMD_NO_KEYS)) {
+            // FLUSHDB, FLUSHALL and RESTORE-RECORDS change keys they do not
+            // name, so no cut can place them: give up and rewrite later
+            mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                    "AOF rewrite cancelled: " + name + " was logged while it ran");
+            rewrite_abort_ = true;
             return false;
         }
-        pos += 2;
+        if (parse_batch(record.record, spec, batch)) {
+            // A batch can straddle cuts: keep only the keys past their own one
+            const protocol::KeyRange keys = protocol::command_keys(protocol::command_spec(batch.type), batch.args.size());
+            protocol::Command rest;
+            // MSETNX already found its keys free, so what is left of it is an MSET
+            rest.type = batch.type == protocol::CommandType::MSETNX ? protocol::CommandType::MSET : batch.type;
+            for (size_t i = keys.first; i < keys.end; i += keys.step) {
+                uint64_t cut = cut_of(record.db, batch.args[i]);
+                if (cut != NOT_CUT && record.pos >= cut) {
+                    rest.args.insert(rest.args.end(), batch.args.begin() + i, batch.args.begin() + i + keys.step);
+                }
+            }
+            if (!rest.args.empty()) {
+                select_in(out, rewrite_db_, record.db);
+                out += protocol::command_to_resp(rest);
+            }
+        } else if (record_key(record.record, key)) {
+            uint64_t cut = cut_of(record.db, key);
+            if (cut == NOT_CUT || record.pos < cut) {
+                continue;
+            }
+            select_in(out, rewrite_db_, record.db);
+            out += record.record;
+        } else {
+            select_in(out, rewrite_db_, record.db);
+            out += record.record;
+        }
+        if (out.size() >= REWRITE_FLUSH_BYTES) {
+            if (!write_all(rewrite_fd_, out)) {
+                return false;
+            }
+            out.clear();
+        }
     }
-    
-    return true;
+    return write_all(rewrite_fd_, out);
 }
 
-bool AOFLogger::replay(KVStore& store) {
-    // Close write file if open
-    if (aof_file_.is_open()) {
-        aof_file_.close();
+void AOFLogger::enable_rewrite(std::vector<KVStore>& dbs, int auto_percentage, uint64_t auto_min_size) {
+    rewrite_dbs_.clear();
+    for (KVStore& db : dbs) {
+        rewrite_dbs_.push_back(&db);
     }
-    
-    std::ifstream file(filename_);
-    if (!file.is_open()) {
+    auto_rewrite_percentage_ = auto_percentage;
+    auto_rewrite_min_size_ = auto_min_size;
+}
+
+void AOFLogger::enable_rewrite(KVStore& store, int auto_percentage, uint64_t auto_min_size) {
+    rewrite_dbs_.assign(1, &store);
+    auto_rewrite_percentage_ = auto_percentage;
+    auto_rewrite_min_size_ = auto_min_size;
+}
+
+mini_redis::WriteGate::Pass AOFLogger::write_pass() {
+    return rewrite_enabled() ? mini_redis::WriteGate::Pass(write_gate_) : mini_redis::WriteGate::Pass();
+}
+
+bool AOFLogger::start_rewrite() {
+    // try_lock: the writer thread may get here (auto rewrite) while stop() holds it
+    std::unique_lock<std::mutex> lock(rewrite_start_mutex_, std::try_to_lock);
+    if (!lock.owns_lock() || !rewrite_enabled() || !running_ || rewriting_) {
         return false;
     }
-    
-    // Read entire file
-    std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    file.close();
-    
-    if (content.empty()) {
-        return true; // Empty file is valid
-    }
-    
-    // Parse RESP arrays from content
-    size_t pos = 0;
-    while (pos < content.length()) {
-        std::vector<std::string> args;
-        size_t start_pos = pos;
-        
-        if (!parse_resp_array(content, pos, args)) {
-            // Skip to next potential command or end
-            size_t next_star = content.find('*', start_pos + 1);
-            if (next_star == std::string::npos) {
-                break;
-            }
-            pos = next_star;
-            continue;
+    if (rewrite_thread_.joinable()) {
+        rewrite_thread_.join(); // The previous rewrite has finished
+    }
+    rewrite_abort_ = false;
+    rewriting_ = true;
+    rewrite_thread_ = std::thread(&AOFLogger::rewrite_thread_func, this);
+    return true;
+}
+
+void AOFLogger::maybe_auto_rewrite() {
+    if (auto_rewrite_percentage_ <= 0 || rewriting_) {
+        return;
+    }
+    const uint64_t size = file_size_.load();
+    const uint64_t base = base_size_.load();
+    if (size < auto_rewrite_min_size_ ||
+        size < base + base * static_cast<uint64_t>(auto_rewrite_percentage_) / 100) {
+        return;
+    }
+    if (start_rewrite()) {
+        mini_redis::Logger::log(mini_redis::Logger::Level::Info,
+                                "Starting automatic AOF rewrite (" + std::to_string(size) + " bytes)");
+    }
+}
+
+void AOFLogger::rewrite_thread_func() {
+    const std::string temp = filename_ + ".rewrite";
+    int fd = open_append(temp, true);
+    bool ok = fd >= 0;
+    size_t shards = 0;
+    {
+        std::lock_guard<std::mutex> lock(rewrite_mutex_);
+        cut_base_.clear();
+        for (KVStore* db : rewrite_dbs_) {
+            cut_base_.push_back(shards);
+            shards += db->shard_count();
         }
-        
-        if (args.empty()) {
-            continue;
+        shard_cuts_.assign(shards, NOT_CUT);
+        rewrite_tail_.clear();
+        rewrite_fd_ = fd;
+        rewrite_db_ = 0; // Replay starts on database 0
+    }
+    // Anything claimed before this point is older than every cut
+    capture_from_ = head_.load();
+
+    // Database after database, each after a SELECT of it
+    std::vector<KVStore::SnapshotEntry> entries;
+    std::string out;
+    for (size_t db = 0; db < rewrite_dbs_.size() && ok && !rewrite_abort_; ++db) {
+        KVStore& store = *rewrite_dbs_[db];
+        for (size_t s = 0; s < store.shard_count() && ok && !rewrite_abort_; ++s) {
+            entries.clear();
+            // No write is between applying and logging while the gate is closed
+            write_gate_.close();
+            store.snapshot_shard(s, entries);
+            {
+                std::lock_guard<std::mutex> lock(rewrite_mutex_);
+                shard_cuts_[cut_base_[db] + s] = head_.load();
+            }
+            write_gate_.open();
+            if (!entries.empty()) {
+                select_in(out, rewrite_db_, static_cast<int>(db));
+            }
+            for (auto& entry : entries) {
+                append_snapshot_entry(out, entry);
+                if (out.size() >= REWRITE_FLUSH_BYTES) {
+                    ok = ok && write_all(fd, out);
+                    out.clear();
+                }
+            }
+            ok = ok && write_all(fd, out) && drain_rewrite_tail();
+            out.clear();
         }
-        
-        // Build command from args (first arg is command name)
-        protocol::Command cmd;
-        std::string cmd_name = args[0];
-        for (char& c : cmd_name) {
-            c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
-        }
-        
-        if (cmd_name == "SET") cmd.type = protocol::CommandType::SET;
-        else if (cmd_name == "DEL") cmd.type = protocol::CommandType::DEL;
-        else if (cmd_name == "EXPIRE") cmd.type = protocol::CommandType::EXPIRE;
-        else continue; // Skip unknown commands
-        
-        // Copy remaining args
-        if (args.size() > 1) {
-            cmd.args.assign(args.begin() + 1, args.end());
+    }
+
+    if (ok && !rewrite_abort_) {
+        // The writer appends the last records and swaps the files between two batches
+        rewrite_finish_ = true;
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+        }
+        wake_cv_.notify_one();
+        std::unique_lock<std::mutex> lock(rewrite_mutex_);
+        rewrite_cv_.wait(lock, [&] { return !rewrite_finish_; });
+    } else {
+        capture_from_ = NOT_CUT;
+        if (fd >= 0) {
+            close_fd(fd);
+        }
+        std::remove(temp.c_str());
+        std::lock_guard<std::mutex> lock(rewrite_mutex_);
+        rewrite_tail_.clear();
+        rewrite_fd_ = -1;
+        if (!ok && !rewrite_abort_) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Error, "AOF rewrite failed: cannot write " + temp);
         }
-        
-        // Execute command on store
-        if (cmd.type == protocol::CommandType::SET && cmd.args.size() >= 2) {
-            store.set(cmd.args[0], cmd.args[1]);
-        } else if (cmd.type == protocol::CommandType::DEL && !cmd.args.empty()) {
-            store.del(cmd.args[0]);
-        } else if (cmd.type == protocol::CommandType::EXPIRE && cmd.args.size() >= 2) {
+    }
+    rewriting_ = false;
+}
+
+void AOFLogger::finish_rewrite() {
+    const std::string temp = filename_ + ".rewrite";
+    // Every record written to the old file so far has been captured
+    bool ok = drain_rewrite_tail() && sync_fd(rewrite_fd_);
+    capture_from_ = NOT_CUT;
+
+    if (ok) {
+#ifdef _WIN32
+        // Windows cannot replace a file that is still open
+        close_fd(rewrite_fd_);
+        close_file();
+        ok = MoveFileExA(temp.c_str(), filename_.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+        open_file();
+        if (ok) {
+            logged_db_ = rewrite_db_;
+        }
+#else
+        ok = ::rename(temp.c_str(), filename_.c_str()) == 0;
+        if (ok) {
+            close_file();
+            fd_ = rewrite_fd_;
+            logged_db_ = rewrite_db_; // The new file ends on the database of its last record
+        } else {
+            close_fd(rewrite_fd_);
+        }
+#endif
+    } else {
+        close_fd(rewrite_fd_);
+    }
+
+    if (ok) {
+        file_size_ = fd_ >= 0 ? file_length(fd_) : 0;
+        base_size_ = file_size_.load();
+        ++rewrites_;
+        unsynced_ = false;
+        mini_redis::Logger::log(mini_redis::Logger::Level::Info,
+                                "AOF rewritten (" + std::to_string(file_size_.load()) + " bytes)");
+    } else {
+        std::remove(temp.c_str());
+        if (!rewrite_abort_) {
+            mini_redis::Logger::log(mini_redis::Logger::Level::Error,
+                                    "AOF rewrite failed: cannot replace " + filename_);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(rewrite_mutex_);
+        rewrite_tail_.clear();
+        rewrite_fd_ = -1;
+        rewrite_finish_ = false;
+    }
+    rewrite_cv_.notify_all();
+}
+
+// Apply one logged write command to the store
+static void apply_command(KVStore& store, const protocol::Command& cmd) {
+    if (cmd.type == protocol::CommandType::SET && cmd.args.size() >= 2) {
+        store.set(cmd.args[0], cmd.args[1]);
+    } else if ((cmd.type == protocol::CommandType::DEL || cmd.type == protocol::CommandType::UNLINK) &&
+               !cmd.args.empty()) {
+        store.del_many(cmd.args);
+    } else if ((cmd.type == protocol::CommandType::MSET || cmd.type == protocol::CommandType::MSETNX) &&
+               !cmd.args.empty() && cmd.args.size() % 2 == 0) {
+        // A logged MSETNX found its keys free, so replaying it sets them all
+        store.mset(cmd.args);
+    } else if (cmd.type == protocol::CommandType::EXPIRE && cmd.args.size() >= 2) {
+        try {
+            int64_t seconds = std::stoll(cmd.args[1]);
+            store.expire(cmd.args[0], seconds);
+        } catch (...) {
+            // Ignore invalid expiration
+        }
+    } else if (cmd.type == protocol::CommandType::PEXPIRE && cmd.args.size() >= 2) {
+        try {
+            int64_t milliseconds = std::stoll(cmd.args[1]);
+            store.pexpire(cmd.args[0], milliseconds);
+        } catch (...) {
+            // Ignore invalid expiration
+        }
+    } else if (cmd.type == protocol::CommandType::PEXPIREAT && cmd.args.size() >= 2) {
+        try {
+            store.pexpireat(cmd.args[0], std::stoll(cmd.args[1]));
+        } catch (...) {
+            // Ignore invalid expiration
+        }
+    } else if (cmd.type == protocol::CommandType::INCR && !cmd.args.empty()) {
+        store.incr(cmd.args[0]);
+    } else if (cmd.type == protocol::CommandType::DECR && !cmd.args.empty()) {
+        store.decr(cmd.args[0]);
+    } else if ((cmd.type == protocol::CommandType::INCRBY || cmd.type == protocol::CommandType::DECRBY) &&
+               cmd.args.size() >= 2) {
+        try {
+            int64_t delta = std::stoll(cmd.args[1]);
+            if (cmd.type == protocol::CommandType::INCRBY) {
+                store.incrby(cmd.args[0], delta);
+            } else {
+                store.decrby(cmd.args[0], delta);
+            }
+        } catch (...) {
+            // Ignore invalid increment
+        }
+    } else if (cmd.type == protocol::CommandType::APPEND && cmd.args.size() >= 2) {
+        store.append(cmd.args[0], cmd.args[1]);
+    } else if (cmd.type == protocol::CommandType::HSET && cmd.args.size() >= 3 && cmd.args.size() % 2 == 1) {
+        size_t added = 0;
+        store.hset(cmd.args, added);
+    } else if ((cmd.type == protocol::CommandType::LPUSH || cmd.type == protocol::CommandType::RPUSH) &&
+               cmd.args.size() >= 2) {
+        size_t length = 0;
+        store.push(cmd.args, cmd.type == protocol::CommandType::LPUSH, length);
+    } else if (cmd.type == protocol::CommandType::RPOP && !cmd.args.empty()) {
+        size_t count = 1;
+        if (cmd.args.size() >= 2) {
             try {
-                int seconds = std::stoi(cmd.args[1]);
-                store.expire(cmd.args[0], seconds);
+                count = static_cast<size_t>(std::stoull(cmd.args[1]));
             } catch (...) {
-                // Ignore invalid expiration
+                return; // Ignore invalid count
             }
         }
+        std::vector<std::string> popped;
+        store.rpop(cmd.args[0], count, popped);
+    } else if (cmd.type == protocol::CommandType::SADD && cmd.args.size() >= 2) {
+        size_t added = 0;
+        store.sadd(cmd.args, added);
+    } else if (cmd.type == protocol::CommandType::ZADD && !cmd.args.empty()) {
+        ZAddArgs zadd;
+        size_t added = 0;
+        size_t changed = 0;
+        if (!parse_zadd(cmd.args, zadd)) {
+            store.zadd(cmd.args[0], zadd, added, changed);
+        }
+    } else if (cmd.type == protocol::CommandType::RESTORE_RECORDS && !cmd.args.empty()) {
+        store.restore_records(cmd.args[0]);
+    } else if (cmd.type == protocol::CommandType::FLUSHDB) {
+        store.clear(); // FLUSHALL is replay's: it clears every database
     }
-    
-    // Reopen file for appending
-    aof_file_.open(filename_, std::ios::app);
-    
-    return true;
 }
 
+bool AOFLogger::replay(std::vector<KVStore>& dbs) {
+    std::vector<KVStore*> stores;
+    for (KVStore& db : dbs) {
+        stores.push_back(&db);
+    }
+    return replay_into(stores);
+}
+
+bool AOFLogger::replay(KVStore& store) {
+    return replay_into({&store});
+}
+
+bool AOFLogger::replay_into(const std::vector<KVStore*>& dbs) {
+    // Reads through its own stream; the append descriptor stays open (O_APPEND)
+    std::ifstream file(filename_, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    // Feed the file through the incremental RESP parser a chunk at a time
+    RespParser parser;
+    std::vector<char> chunk(REPLAY_CHUNK);
+    std::vector<std::string_view> args;
+    std::string error;
+    int db = 0; // -1 after a SELECT of a database that is not there: its commands are skipped
+    while (file) {
+        file.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        std::streamsize got = file.gcount();
+        if (got <= 0) {
+            break;
+        }
+        parser.append(chunk.data(), static_cast<size_t>(got));
+
+        RespStatus status;
+        while ((status = parser.parseArgs(args, error)) == RespStatus::Complete) {
+            if (args.empty()) {
+                continue;
+            }
+            // Command name is upper-cased by the parser
+            const protocol::CommandSpec* spec = protocol::lookup_command(args[0]);
+            if (spec && spec->type == protocol::CommandType::SELECT && args.size() == 2) {
+                try {
+                    db = std::stoi(std::string(args[1]));
+                } catch (...) {
+                    db = -1;
+                }
+                if (db < 0 || static_cast<size_t>(db) >= dbs.size()) {
+                    mini_redis::Logger::log(mini_redis::Logger::Level::Warn,
+                                            "Skipping AOF commands for missing database " + std::string(args[1]));
+                    db = -1;
+                }
+                continue;
+            }
+            if (!spec || !(spec->flags & protocol::CMD_WRITE) || db < 0) {
+                continue; // Skip unknown and non-write commands
+            }
+            protocol::Command cmd;
+            cmd.type = spec->type;
+            cmd.args.assign(args.begin() + 1, args.end());
+            if (cmd.type == protocol::CommandType::FLUSHALL) {
+                for (KVStore* store : dbs) {
+                    store->clear();
+                }
+            } else {
+                apply_command(*dbs[static_cast<size_t>(db)], cmd);
+            }
+        }
+        if (status == RespStatus::Error) {
+            // The parser drops the buffered data and resynchronizes on the next chunk
+            mini_redis::Logger::log(mini_redis::Logger::Level::Warn, "Skipping corrupt AOF data: " + error);
+        }
+    }
+    if (!running_ && db >= 0) {
+        logged_db_ = db; // New records go on after the file's last SELECT
+    }
+
+    return true;
+}
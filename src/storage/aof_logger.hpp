@@ -1,15 +1,26 @@
 // AOF (Append-Only File) logger for Mini-Redis
-// Logs all write commands to a file in RESP format using a background thread
+// Logs all write commands to a file in RESP format using a background thread.
+// Commands are serialized straight into a lock-free multi-producer ring; the
+// writer thread flushes everything committed since its last pass with one
+// writev (group commit) and then applies the appendfsync policy.
+// BGREWRITEAOF compacts the log in the background: a per-shard snapshot of the
+// data plus the writes logged meanwhile go to a new file that replaces the old one.
 
 #pragma once
 
+#include "../utils/write_gate.hpp"
+
 #include <string>
-#include <queue>
+#include <memory>
 #include <mutex>
+#include <vector>
+#include <utility>
 #include <condition_variable>
+#include <functional>
 #include <thread>
 #include <atomic>
-#include <fstream>
+#include <cstdint>
+#include <cstddef>
 
 namespace protocol {
     struct Command;
@@ -19,31 +30,189 @@ class KVStore;
 
 class AOFLogger {
 public:
-    AOFLogger(const std::string& filename);
+    // When written commands are fsynced
+    enum class FsyncPolicy {
+        Always,   // After every group commit; appenders can wait for it
+        EverySec, // At most once per second
+        No,       // Never; the OS flushes on its own schedule
+    };
+
+    static constexpr size_t DEFAULT_RING_BYTES = 8 * 1024 * 1024;
+
+    AOFLogger(const std::string& filename, FsyncPolicy policy = FsyncPolicy::EverySec,
+              size_t ring_bytes = DEFAULT_RING_BYTES);
     ~AOFLogger();
-    
-    // Append a command to the AOF log (non-blocking)
-    void append(const protocol::Command& cmd);
-    
-    // Replay AOF file to restore state in a KVStore
+
+    AOFLogger(const AOFLogger&) = delete;
+    AOFLogger& operator=(const AOFLogger&) = delete;
+
+    // Parse "always" / "everysec" / "no" (returns false if unknown)
+    static bool parse_fsync_policy(const std::string& name, FsyncPolicy& out);
+    static const char* fsync_policy_name(FsyncPolicy policy);
+
+    FsyncPolicy fsync_policy() const { return policy_; }
+
+    // Append a write command on database db_index to the AOF log (lock-free;
+    // non-write commands are ignored). The writer puts a SELECT before it if
+    // the record before it was on another database. Returns a ticket for
+    // wait_durable, or 0 if nothing was logged. Only blocks if the ring is full.
+    uint64_t append(const protocol::Command& cmd, int db_index = 0);
+
+    // Under FsyncPolicy::Always, block until every command up to ticket is on
+    // disk; false if the log failed first (see write_failed). Returns true
+    // immediately under the other policies.
+    bool wait_durable(uint64_t ticket);
+
+    // Non-blocking form of wait_durable: true once ticket needs no more waiting
+    bool durable(uint64_t ticket) const;
+
+    // Set while the log cannot be written: write commands are refused and
+    // replies held for durability fail. A failed write is retried each second
+    // and clears it once it goes through; a failed fsync lasts until restart.
+    bool write_failed() const { return write_errno_.load() != 0; }
+    std::string write_error() const; // strerror text of the failure, empty if none
+
+    // Called from the writer thread after each fsync under FsyncPolicy::Always
+    // (and once on stop), so event loops can release replies they hold back.
+    // Listeners must be cheap and must not call into the logger.
+    void add_durable_listener(std::function<void()> listener);
+
+    // Replay AOF file to restore state in the databases, following its
+    // SELECTs (streamed, so memory is bounded by the largest record rather
+    // than the file). A single store is database 0.
+    bool replay(std::vector<KVStore>& dbs);
     bool replay(KVStore& store);
-    
+
+    // Allow rewrites of the databases' contents (or of one store, as database
+    // 0). A rewrite also starts on its own once the file reaches auto_min_size
+    // bytes and has grown by auto_percentage since the last rewrite (0 = only
+    // on request). Call before start().
+    void enable_rewrite(std::vector<KVStore>& dbs, int auto_percentage, uint64_t auto_min_size);
+    void enable_rewrite(KVStore& store, int auto_percentage, uint64_t auto_min_size);
+    bool rewrite_enabled() const { return !rewrite_dbs_.empty(); }
+
+    // Start a background rewrite; false if one is running or rewrite is not enabled
+    bool start_rewrite();
+    bool rewrite_in_progress() const { return rewriting_.load(); }
+
+    // Held by every write from applying it to logging it, so a rewrite can cut
+    // a shard where the log matches the data. Empty unless rewrite is enabled.
+    mini_redis::WriteGate::Pass write_pass();
+
+    uint64_t current_size() const { return file_size_.load(); }
+    uint64_t base_size() const { return base_size_.load(); } // Size after the last rewrite (or at startup)
+    uint64_t rewrites() const { return rewrites_.load(); }
+
     // Start the background writer thread
     void start();
-    
-    // Stop the background writer thread gracefully
+
+    // Stop the background writer thread gracefully (pending commands are written)
     void stop();
 
 private:
-    // Background thread function that writes commands to file
+    // Ring layout: records start on CELL boundaries; lengths_[cell] holds the
+    // record's length and flags once its bytes are in place (0 = not committed)
+    static constexpr size_t CELL = 16;
+    static constexpr uint32_t FLAG_PAD = 1u << 31;      // Filler up to the ring's end
+    static constexpr uint32_t FLAG_INDIRECT = 1u << 30; // Payload is a heap std::string*
+    static constexpr uint32_t LENGTH_MASK = FLAG_INDIRECT - 1;
+    static constexpr uint64_t NOT_CUT = ~uint64_t(0);
+
+    // Background thread function: drains the ring in batches
     void writer_thread_func();
-    
+
+    // Write and (per policy) fsync every committed record; returns false if none
+    bool write_batch();
+
+    // Block until a record is committed at the read position or the timeout passes
+    void wait_for_records(int64_t timeout_ms);
+
+    // Claim `bytes` contiguous ring bytes; returns the record's start or waits for room
+    uint64_t claim(size_t bytes);
+
+    void commit(uint64_t start, uint32_t header);
+
+    bool replay_into(const std::vector<KVStore*>& dbs);
+
+    // Background rewrite: snapshot each shard, then hand the new file to the writer
+    void rewrite_thread_func();
+
+    // Append captured records that are not already in their shard's snapshot
+    bool drain_rewrite_tail();
+
+    // Writer thread: move the last captured records over and swap the files
+    void finish_rewrite();
+
+    void maybe_auto_rewrite();
+
+    void open_file();
+    void close_file();
+    bool sync_file();
+
+    size_t cell_of(uint64_t pos) const { return static_cast<size_t>((pos & mask_) / CELL); }
+
     std::string filename_;
-    std::ofstream aof_file_;
-    std::queue<std::string> command_queue_;
-    std::mutex queue_mutex_;
-    std::condition_variable queue_cv_;
+    FsyncPolicy policy_;
+    int fd_ = -1;
+
+    size_t capacity_;
+    uint64_t mask_;
+    std::unique_ptr<char[]> ring_;
+    std::unique_ptr<std::atomic<uint32_t>[]> lengths_;
+    std::unique_ptr<uint32_t[]> record_dbs_; // Database of the record at each cell (set before its header)
+    std::atomic<uint64_t> head_{0}; // Next byte producers will claim
+    std::atomic<uint64_t> tail_{0}; // First byte not yet released by the writer
+    uint64_t read_pos_ = 0;         // Writer's position (only the writer thread touches it)
+    int64_t last_fsync_ms_ = 0;
+    bool unsynced_ = false;         // Data written since the last fsync
+    int logged_db_ = 0;             // Database the file's records are on now (-1 = unknown; writer only)
+    std::string select_record_;     // The SELECT of the batch being written
+
+    std::atomic<bool> writer_sleeping_{false};
+    std::mutex wake_mutex_;
+    std::condition_variable wake_cv_;
+
+    std::atomic<uint64_t> durable_{0}; // Everything below this is written (and fsynced under Always)
+    std::mutex durable_mutex_;
+    std::condition_variable durable_cv_;
+    std::mutex listeners_mutex_;
+    std::vector<std::function<void()>> durable_listeners_;
+
+    void notify_durable();
+    void set_write_error(int error, const char* what);
+
+    std::atomic<int> write_errno_{0};
+    bool write_stalled_ = false; // Records left in the ring by a failed write (writer thread only)
+    bool fsync_failed_ = false;  // Writer thread only
+
     std::thread writer_thread_;
     std::atomic<bool> running_;
-};
 
+    std::atomic<uint64_t> file_size_{0};
+    std::atomic<uint64_t> base_size_{0};
+    std::atomic<uint64_t> rewrites_{0};
+
+    std::vector<KVStore*> rewrite_dbs_;
+    int auto_rewrite_percentage_ = 0;
+    uint64_t auto_rewrite_min_size_ = 0;
+    mini_redis::WriteGate write_gate_; // Closed while a rewrite cuts a shard
+    std::mutex rewrite_start_mutex_; // Serializes starting and joining the rewrite thread
+    std::thread rewrite_thread_;
+    std::atomic<bool> rewriting_{false};
+    std::atomic<bool> rewrite_abort_{false};
+    std::atomic<bool> rewrite_finish_{false};      // Snapshot done: the writer swaps the files
+    std::atomic<uint64_t> capture_from_{NOT_CUT}; // Writer copies records from here on
+
+    std::mutex rewrite_mutex_; // Guards the rewrite state below
+    std::condition_variable rewrite_cv_;
+    struct TailRecord {
+        uint64_t pos; // Ring position
+        int db;
+        std::string record;
+    };
+    std::vector<TailRecord> rewrite_tail_; // Captured records
+    std::vector<uint64_t> shard_cuts_; // Ring position each shard was snapshotted at, database after database
+    std::vector<size_t> cut_base_;     // Index in shard_cuts_ of each database's first shard
+    int rewrite_db_ = 0;               // Database the new file's records are on now
+    int rewrite_fd_ = -1;
+};
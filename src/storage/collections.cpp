@@ -0,0 +1,686 @@
+// Collection value implementations
+
+#include "collections.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+namespace {
+
+size_t string_heap_bytes(const std::string& s) {
+    static const size_t inline_capacity = std::string().capacity();
+    return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
+// Cost of one hash table node before the heap bytes of its strings: the
+// element, the next pointer and the cached hash
+template <typename Element>
+constexpr size_t table_node_bytes() {
+    return sizeof(Element) + sizeof(void*) + sizeof(size_t);
+}
+
+template <typename Table>
+size_t bucket_bytes(const Table& table) {
+    return table.bucket_count() * sizeof(void*);
+}
+
+std::string_view format_int(int64_t value, char (&digits)[24]) {
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    return std::string_view(digits, static_cast<size_t>(result.ptr - digits));
+}
+
+// A score stored by this file; formatted by format_score, so it always parses
+double stored_score(std::string_view s) {
+    double score = 0;
+    parse_score(s, score);
+    return score;
+}
+
+bool zless(double a_score, std::string_view a_member, double b_score, std::string_view b_member) {
+    return a_score < b_score || (a_score == b_score && a_member < b_member);
+}
+
+uint64_t next_random(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+} // anonymous namespace
+
+const char* value_type_name(ValueType type) {
+    switch (type) {
+        case ValueType::String: return "string";
+        case ValueType::Hash: return "hash";
+        case ValueType::List: return "list";
+        case ValueType::Set: return "set";
+        case ValueType::ZSet: return "zset";
+    }
+    return "none";
+}
+
+bool parse_canonical_int(std::string_view s, int64_t& out) {
+    if (s.empty() || s.size() > 20) {
+        return false;
+    }
+    const size_t first_digit = s[0] == '-' ? 1 : 0;
+    if (first_digit == s.size() || (s[first_digit] == '0' && s.size() > 1)) {
+        return false;
+    }
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ec == std::errc() && end == s.data() + s.size();
+}
+
+std::unique_ptr<Collection> Collection::restore(ValueType type, std::string_view data) {
+    Listpack elements;
+    if (!Listpack::parse(data, elements)) {
+        return nullptr;
+    }
+    switch (type) {
+        case ValueType::Hash: {
+            if (elements.size() % 2 != 0) {
+                return nullptr;
+            }
+            auto hash = std::make_unique<HashValue>();
+            for (size_t pos = elements.begin(); pos != elements.end();) {
+                const size_t value = elements.next(pos);
+                hash->set(elements.at(pos), elements.at(value));
+                pos = elements.next(value);
+            }
+            return hash;
+        }
+        case ValueType::List: {
+            auto list = std::make_unique<ListValue>();
+            elements.for_each([&](std::string_view value) { list->push_back(value); });
+            return list;
+        }
+        case ValueType::Set: {
+            auto set = std::make_unique<SetValue>();
+            elements.for_each([&](std::string_view member) { set->add(member); });
+            return set;
+        }
+        case ValueType::ZSet: {
+            if (elements.size() % 2 != 0) {
+                return nullptr;
+            }
+            auto zset = std::make_unique<ZSetValue>();
+            for (size_t pos = elements.begin(); pos != elements.end();) {
+                const size_t score_pos = elements.next(pos);
+                double score = 0;
+                if (!parse_score(elements.at(score_pos), score)) {
+                    return nullptr;
+                }
+                zset->add(elements.at(pos), score);
+                pos = elements.next(score_pos);
+            }
+            return zset;
+        }
+        case ValueType::String:
+            break;
+    }
+    return nullptr;
+}
+
+// ---- Hash ----
+
+size_t HashValue::size() const {
+    return packed_ ? pack_.size() / 2 : table_.size();
+}
+
+size_t HashValue::memory() const {
+    return sizeof(*this) + (packed_ ? pack_.memory() : table_bytes_ + bucket_bytes(table_));
+}
+
+bool HashValue::set(std::string_view field, std::string_view value) {
+    if (packed_) {
+        const size_t pos = pack_.find(field, 2);
+        const bool added = pos == pack_.end();
+        if (added) {
+            pack_.push_back(field);
+            pack_.push_back(value);
+        } else {
+            pack_.replace(pack_.next(pos), value);
+        }
+        if (pack_.size() / 2 > LISTPACK_MAX_ENTRIES || field.size() > LISTPACK_MAX_VALUE ||
+            value.size() > LISTPACK_MAX_VALUE) {
+            convert();
+        }
+        return added;
+    }
+
+    auto [it, added] = table_.try_emplace(std::string(field));
+    if (added) {
+        table_bytes_ += table_node_bytes<std::pair<const std::string, std::string>>() + string_heap_bytes(it->first);
+    } else {
+        table_bytes_ -= string_heap_bytes(it->second);
+    }
+    std::string(value).swap(it->second);
+    table_bytes_ += string_heap_bytes(it->second);
+    return added;
+}
+
+bool HashValue::get(std::string_view field, std::string_view& value) const {
+    if (packed_) {
+        const size_t pos = pack_.find(field, 2);
+        if (pos == pack_.end()) {
+            return false;
+        }
+        value = pack_.at(pack_.next(pos));
+        return true;
+    }
+    auto it = table_.find(std::string(field));
+    if (it == table_.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+void HashValue::convert() {
+    Listpack pairs;
+    std::swap(pairs, pack_);
+    packed_ = false;
+    table_.reserve(pairs.size() / 2);
+    for (size_t pos = pairs.begin(); pos != pairs.end();) {
+        const size_t value = pairs.next(pos);
+        set(pairs.at(pos), pairs.at(value));
+        pos = pairs.next(value);
+    }
+}
+
+void HashValue::dump(Listpack& out) const {
+    if (packed_) {
+        out = pack_;
+        return;
+    }
+    out.clear();
+    for (const auto& [field, value] : table_) {
+        out.push_back(field);
+        out.push_back(value);
+    }
+}
+
+// ---- List ----
+
+bool ListValue::fits(const Listpack& node, std::string_view value) {
+    return node.empty() ||
+           (node.size() < NODE_MAX_ENTRIES && node.data().size() + value.size() <= NODE_MAX_BYTES);
+}
+
+void ListValue::push_front(std::string_view value) {
+    if (nodes_.empty() || !fits(nodes_.front(), value)) {
+        nodes_.emplace_front();
+        memory_ += sizeof(Listpack);
+    }
+    Listpack& node = nodes_.front();
+    memory_ -= node.memory();
+    node.push_front(value);
+    memory_ += node.memory();
+    ++count_;
+}
+
+void ListValue::push_back(std::string_view value) {
+    if (nodes_.empty() || !fits(nodes_.back(), value)) {
+        nodes_.emplace_back();
+        memory_ += sizeof(Listpack);
+    }
+    Listpack& node = nodes_.back();
+    memory_ -= node.memory();
+    node.push_back(value);
+    memory_ += node.memory();
+    ++count_;
+}
+
+bool ListValue::pop_back(std::string& out) {
+    if (count_ == 0) {
+        return false;
+    }
+    Listpack& node = nodes_.back();
+    const size_t pos = node.last();
+    out.assign(node.at(pos));
+    memory_ -= node.memory();
+    node.erase(pos);
+    memory_ += node.memory();
+    if (node.empty()) {
+        memory_ -= sizeof(Listpack) + node.memory();
+        nodes_.pop_back();
+    }
+    --count_;
+    return true;
+}
+
+void ListValue::range(size_t first, size_t last, const std::function<void(std::string_view)>& fn) const {
+    size_t index = 0; // Of the current node's first element
+    for (const Listpack& node : nodes_) {
+        if (index > last) {
+            break;
+        }
+        if (first >= index + node.size()) {
+            index += node.size(); // Wholly before the range
+            continue;
+        }
+        size_t i = index;
+        for (size_t pos = node.begin(); pos != node.end() && i <= last; pos = node.next(pos), ++i) {
+            if (i >= first) {
+                fn(node.at(pos));
+            }
+        }
+        index += node.size();
+    }
+}
+
+void ListValue::dump(Listpack& out) const {
+    out.clear();
+    for (const Listpack& node : nodes_) {
+        node.for_each([&](std::string_view value) { out.push_back(value); });
+    }
+}
+
+// ---- Set ----
+
+size_t SetValue::size() const {
+    switch (kind_) {
+        case Kind::IntSet: return ints_.size();
+        case Kind::Packed: return pack_.size();
+        case Kind::Table: break;
+    }
+    return table_.size();
+}
+
+size_t SetValue::memory() const {
+    switch (kind_) {
+        case Kind::IntSet: return sizeof(*this) + ints_.capacity() * sizeof(int64_t);
+        case Kind::Packed: return sizeof(*this) + pack_.memory();
+        case Kind::Table: break;
+    }
+    return sizeof(*this) + table_bytes_ + bucket_bytes(table_);
+}
+
+const char* SetValue::encoding() const {
+    switch (kind_) {
+        case Kind::IntSet: return "intset";
+        case Kind::Packed: return "listpack";
+        case Kind::Table: break;
+    }
+    return "hashtable";
+}
+
+bool SetValue::add(std::string_view member) {
+    if (kind_ == Kind::IntSet) {
+        int64_t value = 0;
+        if (parse_canonical_int(member, value)) {
+            auto it = std::lower_bound(ints_.begin(), ints_.end(), value);
+            if (it != ints_.end() && *it == value) {
+                return false;
+            }
+            ints_.insert(it, value);
+            if (ints_.size() > INTSET_MAX_ENTRIES) {
+                convert(Kind::Table);
+            }
+            return true;
+        }
+        // The first member that is not an integer
+        const bool packs = ints_.size() < LISTPACK_MAX_ENTRIES && member.size() <= LISTPACK_MAX_VALUE;
+        convert(packs ? Kind::Packed : Kind::Table);
+    }
+
+    if (kind_ == Kind::Packed) {
+        if (pack_.find(member) != pack_.end()) {
+            return false;
+        }
+        pack_.push_back(member);
+        if (pack_.size() > LISTPACK_MAX_ENTRIES || member.size() > LISTPACK_MAX_VALUE) {
+            convert(Kind::Table);
+        }
+        return true;
+    }
+
+    auto [it, added] = table_.emplace(member);
+    if (added) {
+        table_bytes_ += table_node_bytes<std::string>() + string_heap_bytes(*it);
+    }
+    return added;
+}
+
+bool SetValue::contains(std::string_view member) const {
+    switch (kind_) {
+        case Kind::IntSet: {
+            int64_t value = 0;
+            return parse_canonical_int(member, value) && std::binary_search(ints_.begin(), ints_.end(), value);
+        }
+        case Kind::Packed:
+            return pack_.find(member) != pack_.end();
+        case Kind::Table:
+            break;
+    }
+    return table_.count(std::string(member)) != 0;
+}
+
+void SetValue::convert(Kind to) {
+    Listpack members;
+    dump(members);
+    std::vector<int64_t>().swap(ints_);
+    pack_.clear();
+    kind_ = to;
+    if (to == Kind::Table) {
+        table_.reserve(members.size());
+    }
+    members.for_each([&](std::string_view member) { add(member); });
+}
+
+void SetValue::dump(Listpack& out) const {
+    if (kind_ == Kind::Packed) {
+        out = pack_;
+        return;
+    }
+    out.clear();
+    if (kind_ == Kind::IntSet) {
+        char digits[24];
+        for (int64_t value : ints_) {
+            out.push_back(format_int(value, digits));
+        }
+        return;
+    }
+    for (const std::string& member : table_) {
+        out.push_back(member);
+    }
+}
+
+// ---- Sorted set ----
+
+bool parse_score(std::string_view s, double& out) {
+    if (s.size() > 1 && s[0] == '+' && s[1] != '-') {
+        s.remove_prefix(1); // from_chars takes no plus sign
+    }
+    if (s.empty()) {
+        return false;
+    }
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ec == std::errc() && end == s.data() + s.size() && !std::isnan(out);
+}
+
+bool parse_score_bound(std::string_view s, double& out, bool& exclusive) {
+    exclusive = !s.empty() && s[0] == '(';
+    if (exclusive) {
+        s.remove_prefix(1);
+    }
+    return parse_score(s, out);
+}
+
+std::string format_score(double score) {
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), score);
+    return std::string(digits, static_cast<size_t>(result.ptr - digits));
+}
+
+size_t ZSkipList::node_bytes(int level, size_t member_len) {
+    return (sizeof(Node) + static_cast<size_t>(level) * sizeof(Node*) + member_len + 7) & ~size_t(7);
+}
+
+ZSkipList::Node* ZSkipList::new_node(int level, double score, std::string_view member) {
+    Node* node = new (::operator new(node_bytes(level, member.size()))) Node();
+    node->score = score;
+    node->member_len = static_cast<uint32_t>(member.size());
+    node->level = static_cast<uint8_t>(level);
+    std::fill(node->links(), node->links() + level, nullptr);
+    std::memcpy(node->links() + level, member.data(), member.size());
+    return node;
+}
+
+ZSkipList::ZSkipList() : head_(new_node(MAX_LEVEL, 0, {})) {
+    memory_ = node_bytes(MAX_LEVEL, 0);
+}
+
+ZSkipList::~ZSkipList() {
+    for (Node* node = head_; node != nullptr;) {
+        Node* next = node->links()[0];
+        node->~Node();
+        ::operator delete(node);
+        node = next;
+    }
+}
+
+int ZSkipList::random_level() {
+    // Each level is a quarter as full as the one below it
+    int level = 1;
+    while (level < MAX_LEVEL && (next_random(rng_state_) & 3) == 0) {
+        ++level;
+    }
+    return level;
+}
+
+void ZSkipList::insert(double score, std::string_view member) {
+    Node* update[MAX_LEVEL];
+    Node* node = head_;
+    for (int i = level_ - 1; i >= 0; --i) {
+        while (node->links()[i] && zless(node->links()[i]->score, node->links()[i]->member(), score, member)) {
+            node = node->links()[i];
+        }
+        update[i] = node;
+    }
+    const int level = random_level();
+    for (int i = level_; i < level; ++i) {
+        update[i] = head_;
+    }
+    level_ = std::max(level_, level);
+
+    Node* added = new_node(level, score, member);
+    for (int i = 0; i < level; ++i) {
+        added->links()[i] = update[i]->links()[i];
+        update[i]->links()[i] = added;
+    }
+    memory_ += node_bytes(level, member.size());
+}
+
+bool ZSkipList::erase(double score, std::string_view member) {
+    Node* update[MAX_LEVEL];
+    Node* node = head_;
+    for (int i = level_ - 1; i >= 0; --i) {
+        while (node->links()[i] && zless(node->links()[i]->score, node->links()[i]->member(), score, member)) {
+            node = node->links()[i];
+        }
+        update[i] = node;
+    }
+    node = node->links()[0];
+    if (!node || node->score != score || node->member() != member) {
+        return false;
+    }
+    for (int i = 0; i < node->level; ++i) {
+        update[i]->links()[i] = node->links()[i];
+    }
+    while (level_ > 1 && head_->links()[level_ - 1] == nullptr) {
+        --level_;
+    }
+    memory_ -= node_bytes(node->level, node->member_len);
+    node->~Node();
+    ::operator delete(node);
+    return true;
+}
+
+const ZSkipList::Node* ZSkipList::first_in(const ScoreRange& range) const {
+    const Node* node = head_;
+    for (int i = level_ - 1; i >= 0; --i) {
+        while (node->links()[i] && !range.above_min(node->links()[i]->score)) {
+            node = node->links()[i];
+        }
+    }
+    return node->links()[0];
+}
+
+size_t ZSetValue::size() const {
+    return packed_ ? pack_.size() / 2 : dict_.size();
+}
+
+size_t ZSetValue::memory() const {
+    return sizeof(*this) + (packed_ ? pack_.memory() : dict_bytes_ + bucket_bytes(dict_) + list_->memory());
+}
+
+void ZSetValue::pack_insert(std::string_view member, double score) {
+    size_t pos = pack_.begin();
+    while (pos != pack_.end()) {
+        const size_t score_pos = pack_.next(pos);
+        if (zless(score, member, stored_score(pack_.at(score_pos)), pack_.at(pos))) {
+            break;
+        }
+        pos = pack_.next(score_pos);
+    }
+    pack_.insert(pos, format_score(score));
+    pack_.insert(pos, member);
+}
+
+ZSetValue::AddResult ZSetValue::add(std::string_view member, double score, int flags) {
+    if (packed_) {
+        const size_t pos = pack_.find(member, 2);
+        if (pos != pack_.end()) {
+            if ((flags & ADD_NX) || stored_score(pack_.at(pack_.next(pos))) == score) {
+                return AddResult::Unchanged;
+            }
+            pack_.erase(pos, 2);
+            pack_insert(member, score);
+            return AddResult::Updated;
+        }
+        if (flags & ADD_XX) {
+            return AddResult::Unchanged;
+        }
+        pack_insert(member, score);
+        if (pack_.size() / 2 > LISTPACK_MAX_ENTRIES || member.size() > LISTPACK_MAX_VALUE) {
+            convert();
+        }
+        return AddResult::Added;
+    }
+
+    auto it = dict_.find(std::string(member));
+    if (it != dict_.end()) {
+        if ((flags & ADD_NX) || it->second == score) {
+            return AddResult::Unchanged;
+        }
+        list_->erase(it->second, member);
+        list_->insert(score, member);
+        it->second = score;
+        return AddResult::Updated;
+    }
+    if (flags & ADD_XX) {
+        return AddResult::Unchanged;
+    }
+    it = dict_.emplace(std::string(member), score).first;
+    dict_bytes_ += table_node_bytes<std::pair<const std::string, double>>() + string_heap_bytes(it->first);
+    list_->insert(score, member);
+    return AddResult::Added;
+}
+
+bool ZSetValue::score(std::string_view member, double& out) const {
+    if (packed_) {
+        const size_t pos = pack_.find(member, 2);
+        if (pos == pack_.end()) {
+            return false;
+        }
+        out = stored_score(pack_.at(pack_.next(pos)));
+        return true;
+    }
+    auto it = dict_.find(std::string(member));
+    if (it == dict_.end()) {
+        return false;
+    }
+    out = it->second;
+    return true;
+}
+
+void ZSetValue::range_by_score(const ScoreRange& range, size_t offset, int64_t count,
+                               const std::function<void(std::string_view, double)>& fn) const {
+    if (packed_) {
+        for (size_t pos = pack_.begin(); pos != pack_.end() && count != 0;) {
+            const size_t score_pos = pack_.next(pos);
+            const double score = stored_score(pack_.at(score_pos));
+            if (!range.below_max(score)) {
+                break;
+            }
+            if (range.above_min(score)) {
+                if (offset > 0) {
+                    --offset;
+                } else {
+                    fn(pack_.at(pos), score);
+                    if (count > 0) {
+                        --count;
+                    }
+                }
+            }
+            pos = pack_.next(score_pos);
+        }
+        return;
+    }
+    for (const ZSkipList::Node* node = list_->first_in(range); node && range.below_max(node->score) && count != 0;
+         node = node->next()) {
+        if (offset > 0) {
+            --offset;
+            continue;
+        }
+        fn(node->member(), node->score);
+        if (count > 0) {
+            --count;
+        }
+    }
+}
+
+void ZSetValue::convert() {
+    Listpack pairs;
+    std::swap(pairs, pack_);
+    packed_ = false;
+    list_ = std::make_unique<ZSkipList>();
+    dict_.reserve(pairs.size() / 2);
+    for (size_t pos = pairs.begin(); pos != pairs.end();) {
+        const size_t score_pos = pairs.next(pos);
+        add(pairs.at(pos), stored_score(pairs.at(score_pos)));
+        pos = pairs.next(score_pos);
+    }
+}
+
+const char* parse_zadd(const std::vector<std::string>& args, ZAddArgs& out) {
+    size_t i = 1;
+    for (; i < args.size(); ++i) {
+        std::string option = args[i];
+        std::transform(option.begin(), option.end(), option.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+        if (option == "NX") {
+            out.flags |= ZSetValue::ADD_NX;
+        } else if (option == "XX") {
+            out.flags |= ZSetValue::ADD_XX;
+        } else if (option == "CH") {
+            out.changed = true;
+        } else {
+            break;
+        }
+    }
+    if ((out.flags & ZSetValue::ADD_NX) && (out.flags & ZSetValue::ADD_XX)) {
+        return "ERR XX and NX options at the same time are not compatible";
+    }
+    if (i == args.size() || (args.size() - i) % 2 != 0) {
+        return "ERR syntax error";
+    }
+    out.items.reserve((args.size() - i) / 2);
+    for (; i < args.size(); i += 2) {
+        double score = 0;
+        if (!parse_score(args[i], score)) {
+            return "ERR value is not a valid float";
+        }
+        out.items.emplace_back(score, args[i + 1]);
+    }
+    return nullptr;
+}
+
+void ZSetValue::dump(Listpack& out) const {
+    if (packed_) {
+        out = pack_;
+        return;
+    }
+    out.clear();
+    ScoreRange all{-INFINITY, INFINITY, false, false};
+    for (const ZSkipList::Node* node = list_->first_in(all); node; node = node->next()) {
+        out.push_back(node->member());
+        out.push_back(format_score(node->score));
+    }
+}
@@ -0,0 +1,251 @@
+// Collection values for Mini-Redis: hashes, lists, sets and sorted sets
+// Each type starts out in a compact encoding and converts itself, once, to a
+// general one when it grows past a size threshold (the defaults of Redis's
+// *-max-listpack-* settings):
+//   hash    listpack of field/value pairs -> hash table
+//   list    one listpack node -> quicklist (a deque of listpack nodes)
+//   set     intset (sorted int64 array) or listpack -> hash table
+//   zset    listpack of member/score pairs in score order -> skiplist + hash table
+// A collection lives behind its key's entry and is only touched under that
+// key's shard lock. memory() is kept current as it changes, so the store can
+// charge every change to the shard's maxmemory budget.
+
+#pragma once
+
+#include "listpack.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+enum class ValueType : uint8_t {
+    String = 0,
+    Hash = 1,
+    List = 2,
+    Set = 3,
+    ZSet = 4
+};
+
+// The TYPE reply for a type ("string", "hash", ...)
+const char* value_type_name(ValueType type);
+
+// Parse a value that is exactly the decimal form of an int64 ("12", "-5",
+// "0"; not "012", "+1", "-0" or " 1"), so formatting it gives the same bytes
+bool parse_canonical_int(std::string_view s, int64_t& out);
+
+class Collection {
+public:
+    virtual ~Collection() = default;
+
+    virtual ValueType type() const = 0;
+    // Number of elements (fields for a hash)
+    virtual size_t size() const = 0;
+    // Bytes held, the object included, for memory accounting
+    virtual size_t memory() const = 0;
+    // Name of the current encoding ("listpack", "hashtable", ...)
+    virtual const char* encoding() const = 0;
+
+    // The persisted form: every element, as a listpack (a hash or sorted set
+    // as field, value / member, score pairs; a list in order)
+    virtual void dump(Listpack& out) const = 0;
+    // Rebuild a collection from dump's output; nullptr if data is malformed
+    // or the type is not a collection
+    static std::unique_ptr<Collection> restore(ValueType type, std::string_view data);
+};
+
+class HashValue final : public Collection {
+public:
+    static const ValueType TYPE = ValueType::Hash;
+    static constexpr size_t LISTPACK_MAX_ENTRIES = 128; // Fields kept packed
+    static constexpr size_t LISTPACK_MAX_VALUE = 64;    // Longest packed field or value
+
+    ValueType type() const override { return TYPE; }
+    size_t size() const override;
+    size_t memory() const override;
+    const char* encoding() const override { return packed_ ? "listpack" : "hashtable"; }
+    void dump(Listpack& out) const override;
+
+    // Set field to value; returns true if the field is new
+    bool set(std::string_view field, std::string_view value);
+    // field's value, valid until the hash changes; false if there is none
+    bool get(std::string_view field, std::string_view& value) const;
+
+private:
+    void convert();
+
+    bool packed_ = true;
+    Listpack pack_; // field, value, field, value, ...
+    std::unordered_map<std::string, std::string> table_;
+    size_t table_bytes_ = 0; // Element bytes in table_, excluding its buckets
+};
+
+class ListValue final : public Collection {
+public:
+    static const ValueType TYPE = ValueType::List;
+    static constexpr size_t NODE_MAX_ENTRIES = 128;    // Elements per listpack node
+    static constexpr size_t NODE_MAX_BYTES = 8 * 1024; // Encoded bytes per node
+
+    ValueType type() const override { return TYPE; }
+    size_t size() const override { return count_; }
+    size_t memory() const override { return sizeof(*this) + memory_; }
+    const char* encoding() const override { return nodes_.size() <= 1 ? "listpack" : "quicklist"; }
+    void dump(Listpack& out) const override;
+
+    void push_front(std::string_view value);
+    void push_back(std::string_view value);
+    // Remove the last element into out; false if the list is empty
+    bool pop_back(std::string& out);
+    // Call fn(value) for elements first..last (0-based, inclusive, in range)
+    void range(size_t first, size_t last, const std::function<void(std::string_view)>& fn) const;
+
+private:
+    // Whether node has room for one more value
+    static bool fits(const Listpack& node, std::string_view value);
+
+    std::deque<Listpack> nodes_;
+    size_t count_ = 0;
+    size_t memory_ = 0;
+};
+
+class SetValue final : public Collection {
+public:
+    static const ValueType TYPE = ValueType::Set;
+    static constexpr size_t INTSET_MAX_ENTRIES = 512;   // Integers kept in the sorted array
+    static constexpr size_t LISTPACK_MAX_ENTRIES = 128; // Members kept packed
+    static constexpr size_t LISTPACK_MAX_VALUE = 64;    // Longest packed member
+
+    ValueType type() const override { return TYPE; }
+    size_t size() const override;
+    size_t memory() const override;
+    const char* encoding() const override;
+    void dump(Listpack& out) const override;
+
+    // Returns true if member is new
+    bool add(std::string_view member);
+    bool contains(std::string_view member) const;
+
+private:
+    enum class Kind : uint8_t { IntSet, Packed, Table };
+
+    // Move to the listpack (if it still fits there) or the hash table
+    void convert(Kind to);
+
+    Kind kind_ = Kind::IntSet;
+    std::vector<int64_t> ints_; // Sorted
+    Listpack pack_;
+    std::unordered_set<std::string> table_;
+    size_t table_bytes_ = 0;
+};
+
+// Score bounds of ZRANGEBYSCORE: min/max, each inclusive unless marked
+struct ScoreRange {
+    double min = 0;
+    double max = 0;
+    bool min_exclusive = false;
+    bool max_exclusive = false;
+
+    bool above_min(double score) const { return min_exclusive ? score > min : score >= min; }
+    bool below_max(double score) const { return max_exclusive ? score < max : score <= max; }
+};
+
+// Parse a score ("1.5", "-3", "+inf", "-inf"); NaN is rejected
+bool parse_score(std::string_view s, double& out);
+// Parse a ZRANGEBYSCORE bound: a score, or "(" and a score for an exclusive one
+bool parse_score_bound(std::string_view s, double& out, bool& exclusive);
+// Shortest decimal form that parses back to the same score
+std::string format_score(double score);
+
+// Members ordered by (score, member), with O(log n) insert, erase and seek
+class ZSkipList {
+public:
+    static const int MAX_LEVEL = 32;
+
+    struct Node {
+        double score;
+        uint32_t member_len;
+        uint8_t level;
+
+        // Forward links, one per level, then the member bytes
+        Node** links() { return reinterpret_cast<Node**>(this + 1); }
+        Node* const* links() const { return reinterpret_cast<Node* const*>(this + 1); }
+        const Node* next() const { return links()[0]; }
+        std::string_view member() const {
+            return {reinterpret_cast<const char*>(links() + level), member_len};
+        }
+    };
+
+    ZSkipList();
+    ~ZSkipList();
+    ZSkipList(const ZSkipList&) = delete;
+    ZSkipList& operator=(const ZSkipList&) = delete;
+
+    void insert(double score, std::string_view member);
+    bool erase(double score, std::string_view member);
+    // The first node whose score is within range's lower bound, or nullptr
+    const Node* first_in(const ScoreRange& range) const;
+    size_t memory() const { return memory_; }
+
+private:
+    static Node* new_node(int level, double score, std::string_view member);
+    static size_t node_bytes(int level, size_t member_len);
+    int random_level();
+
+    Node* head_;
+    int level_ = 1;
+    uint64_t rng_state_ = 0x2545F4914F6CDD1DULL;
+    size_t memory_ = 0;
+};
+
+class ZSetValue final : public Collection {
+public:
+    static const ValueType TYPE = ValueType::ZSet;
+    static constexpr size_t LISTPACK_MAX_ENTRIES = 128; // Members kept packed
+    static constexpr size_t LISTPACK_MAX_VALUE = 64;    // Longest packed member
+
+    // ZADD conditions
+    static const int ADD_NX = 1; // Only add new members
+    static const int ADD_XX = 2; // Only update existing members
+
+    enum class AddResult { Added, Updated, Unchanged };
+
+    ValueType type() const override { return TYPE; }
+    size_t size() const override;
+    size_t memory() const override;
+    const char* encoding() const override { return packed_ ? "listpack" : "skiplist"; }
+    void dump(Listpack& out) const override;
+
+    AddResult add(std::string_view member, double score, int flags = 0);
+    bool score(std::string_view member, double& out) const;
+    // Call fn(member, score) for the members within range, lowest score first,
+    // skipping the first offset of them and stopping after count (-1 = no limit)
+    void range_by_score(const ScoreRange& range, size_t offset, int64_t count,
+                        const std::function<void(std::string_view, double)>& fn) const;
+
+private:
+    // Insert a member/score pair at its place in pack_
+    void pack_insert(std::string_view member, double score);
+    void convert();
+
+    bool packed_ = true;
+    Listpack pack_; // member, score, member, score, ... by (score, member)
+    std::unordered_map<std::string, double> dict_;
+    std::unique_ptr<ZSkipList> list_; // Created on conversion
+    size_t dict_bytes_ = 0;
+};
+
+// ZADD's arguments after the key: [NX|XX] [CH] score member [score member ...]
+struct ZAddArgs {
+    int flags = 0;        // ZSetValue::ADD_NX / ADD_XX
+    bool changed = false; // CH: count rescored members as well as new ones
+    std::vector<std::pair<double, std::string_view>> items; // Members view into args
+};
+
+// Parse a ZADD's args (key first); nullptr on success, else the error reply
+const char* parse_zadd(const std::vector<std::string>& args, ZAddArgs& out);
@@ -2,179 +2,1444 @@
 // Provides thread-safe operations with expiration, LRU eviction, and file persistence
 
 #include "kv_store.hpp"
+#include "lazy_freer.hpp"
 
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <charconv>
+#include <limits>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <thread>
 
-void KVStore::check_and_remove_expired(const std::string& key) {
-    auto exp_it = expirations_.find(key);
-    if (exp_it != expirations_.end()) {
-        time_t now = time(nullptr);
-        if (now >= exp_it->second) {
-            // Key has expired, remove it
-            store_.erase(key);
-            expirations_.erase(exp_it);
-            // Remove from LRU tracking
-            auto lru_it = lru_map_.find(key);
-            if (lru_it != lru_map_.end()) {
-                lru_order_.erase(lru_it->second);
-                lru_map_.erase(lru_it);
+#include "../utils/crc64.hpp"
+#include "../utils/mapped_file.hpp"
+
+namespace {
+
+// Heap bytes owned by a string beyond its inline (SSO) buffer
+size_t string_heap_bytes(const std::string& s) {
+    static const size_t inline_capacity = std::string().capacity();
+    return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
+// Hash table cost per key: its slot, scaled by the table's typical load
+// (between 7/16 and 7/8 full)
+template <typename Table>
+constexpr size_t table_slot_overhead() {
+    return Table::SLOT_BYTES * 3 / 2;
+}
+
+// Longest value embedded in a new entry; longer ones get their own string
+const size_t EMBED_LIMIT = 64;
+
+// Entries a scan visits per shard lock, so a large COUNT does not hold one long
+const size_t SCAN_LOCK_ENTRIES = 1024;
+
+// Room to reserve after the key for a value like this one (0 if it will be
+// an integer or a separate string)
+size_t embed_size_for(std::string_view value) {
+    int64_t unused;
+    if (value.size() > EMBED_LIMIT || parse_canonical_int(value, unused)) {
+        return 0;
+    }
+    return value.size();
+}
+
+// Wrap-around comparison of 32-bit LRU clocks: true if a was touched before b
+bool lru_older(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+}
+
+// LFU tuning, following Redis' lfu-log-factor / lfu-decay-time defaults
+const uint8_t LFU_INIT_VAL = 5;
+const double LFU_LOG_FACTOR = 10.0;
+
+uint16_t lfu_minutes_now() {
+    return static_cast<uint16_t>((time(nullptr) / 60) & 0xFFFF);
+}
+
+uint64_t next_random(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// RDB v4 layout (integers in host byte order, as in version 1):
+//   header  "MRDB" magic, uint32 version
+//   chunks  records back to back, each
+//           [key_len: uint32][key][value_len: uint32][value][expire_at_ms: int64, 0 = none]
+//           and, if key_len has RECORD_TYPED set, [type: uint8] (a ValueType;
+//           the value is then the collection's Collection::dump listpack)
+//   index   per chunk [offset: uint64][length: uint64][keys: uint64][crc64: uint64]
+//           [db: uint64] (the database its keys belong to)
+//   footer  [index_offset: uint64][chunk_count: uint64][crc64: uint64]
+// Chunks are independent, so a loader can verify and decode them in parallel;
+// a chunk never holds keys of two databases. The footer CRC covers the
+// header, the index (and so every chunk's CRC) and the footer fields before
+// it. Version 3 files (the same, without db: all in database 0), version 2
+// files (version 3 with strings only) and version 1 files (a uint32 key
+// count, then records with expiry in whole seconds) are still read.
+const char RDB_MAGIC[4] = {'M', 'R', 'D', 'B'};
+const uint32_t RDB_VERSION = 4;
+const uint32_t RDB_VERSION_ONE_DB = 3;
+const uint32_t RDB_VERSION_STRINGS = 2;
+const uint32_t RECORD_TYPED = 0x80000000u;
+const size_t RDB_HEADER_BYTES = 8;
+const size_t RDB_INDEX_ENTRY_BYTES = 40;
+const size_t RDB_INDEX_ENTRY_BYTES_ONE_DB = 32;
+const size_t RDB_FOOTER_BYTES = 24;
+const size_t RDB_CHUNK_BYTES = 4 << 20; // A new chunk starts once one reaches this size
+const size_t LOAD_BATCH_KEYS = 4096;    // Keys inserted per shard lock hold while loading
+
+struct RdbChunk {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t keys;
+    uint64_t crc;
+    uint64_t db;
+};
+
+template <typename T>
+void append_raw(std::string& out, const T& value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+T read_raw(const char* p) {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+// One record: [key_len: uint32][key][value_len: uint32][value][expire_at_ms: int64]
+// then, for a collection, its type
+void append_record(std::string& out, std::string_view key, std::string_view value, int64_t expire_at_ms,
+                   ValueType type = ValueType::String) {
+    const uint32_t typed = type == ValueType::String ? 0 : RECORD_TYPED;
+    append_raw(out, static_cast<uint32_t>(key.size()) | typed);
+    out.append(key);
+    append_raw(out, static_cast<uint32_t>(value.size()));
+    out.append(value);
+    append_raw(out, expire_at_ms);
+    if (typed) {
+        out.push_back(static_cast<char>(type));
+    }
+}
+
+// Length of the record at the start of data, or 0 if it does not fit in size
+// bytes; lengths are checked so a bad one cannot read past the end
+uint64_t record_length(const char* data, uint64_t size) {
+    if (size < 4) {
+        return 0;
+    }
+    const uint32_t header = read_raw<uint32_t>(data);
+    const uint64_t key_len = header & ~RECORD_TYPED;
+    if (size - 4 < key_len + 4) {
+        return 0;
+    }
+    const uint64_t value_len = read_raw<uint32_t>(data + 4 + key_len);
+    const uint64_t length = 4 + key_len + 4 + value_len + 8 + ((header & RECORD_TYPED) ? 1 : 0);
+    return size < length ? 0 : length;
+}
+
+struct Record {
+    std::string_view key;
+    std::string_view value;
+    int64_t expire_at_ms;
+    ValueType type;
+};
+
+// Decode a record whose length record_length has checked
+Record read_record(const char* data) {
+    const uint32_t header = read_raw<uint32_t>(data);
+    const uint32_t key_len = header & ~RECORD_TYPED;
+    const uint32_t value_len = read_raw<uint32_t>(data + 4 + key_len);
+    const char* value = data + 4 + key_len + 4;
+    Record record{std::string_view(data + 4, key_len), std::string_view(value, value_len),
+                  read_raw<int64_t>(value + value_len), ValueType::String};
+    if (header & RECORD_TYPED) {
+        record.type = static_cast<ValueType>(value[value_len + 8]);
+    }
+    return record;
+}
+
+// Buffered RDB output: records are packed into a large buffer that goes to
+// the file in one write per megabyte, rather than several stream writes per
+// key; chunk CRCs are computed on the buffered bytes as they are added
+class RdbWriter {
+public:
+    static const size_t BUFFER_BYTES = 1 << 20;
+
+    explicit RdbWriter(const std::string& path) : file_(path, std::ios::binary | std::ios::trunc) {
+        buffer_.reserve(BUFFER_BYTES + 4096);
+        buffer_.append(RDB_MAGIC, sizeof(RDB_MAGIC));
+        append_raw(buffer_, RDB_VERSION);
+        header_crc_ = mini_redis::crc64(0, buffer_.data(), buffer_.size());
+        written_ = buffer_.size();
+        chunk_ = RdbChunk{written_, 0, 0, 0, 0};
+    }
+
+    bool good() const { return file_.good(); }
+
+    // The records put from now on belong to database db
+    void begin_db(uint64_t db) {
+        end_chunk();
+        chunk_.db = db;
+    }
+
+    void put_record(const KVStore::SnapshotEntry& e) {
+        const size_t start = buffer_.size();
+        append_record(buffer_, e.key, e.value, e.expire_at_ms, e.type);
+        const size_t bytes = buffer_.size() - start;
+        chunk_.crc = mini_redis::crc64(chunk_.crc, buffer_.data() + start, bytes);
+        chunk_.length += bytes;
+        chunk_.keys++;
+        written_ += bytes;
+        if (chunk_.length >= RDB_CHUNK_BYTES) {
+            end_chunk();
+        }
+        if (buffer_.size() >= BUFFER_BYTES) {
+            flush();
+        }
+    }
+
+    // Write the index and footer after the last chunk and close the file
+    bool finish() {
+        end_chunk();
+        const uint64_t index_offset = written_;
+        const size_t index_start = buffer_.size();
+        for (const RdbChunk& c : chunks_) {
+            append_raw(buffer_, c.offset);
+            append_raw(buffer_, c.length);
+            append_raw(buffer_, c.keys);
+            append_raw(buffer_, c.crc);
+            append_raw(buffer_, c.db);
+        }
+        append_raw(buffer_, index_offset);
+        append_raw(buffer_, static_cast<uint64_t>(chunks_.size()));
+        uint64_t crc = mini_redis::crc64(header_crc_, buffer_.data() + index_start, buffer_.size() - index_start);
+        append_raw(buffer_, crc);
+        flush();
+        file_.close();
+        return !file_.fail();
+    }
+
+private:
+    void end_chunk() {
+        if (chunk_.keys > 0) {
+            chunks_.push_back(chunk_);
+        }
+        chunk_ = RdbChunk{written_, 0, 0, 0, chunk_.db};
+    }
+
+    void flush() {
+        file_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+    }
+
+    std::ofstream file_;
+    std::string buffer_;
+    uint64_t written_ = 0; // File offset of the end of buffer_
+    uint64_t header_crc_ = 0;
+    RdbChunk chunk_;
+    std::vector<RdbChunk> chunks_;
+};
+
+// Run fn(i) for every i in [0, count) on up to hardware_concurrency threads
+template <typename Fn>
+void parallel_for(size_t count, Fn&& fn) {
+    size_t threads = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; ++t) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+}
+
+// Distinguishes the temporary files of saves running at the same time
+std::atomic<uint64_t> rdb_temp_serial{0};
+
+// Move a finished file over the destination (std::rename does not replace
+// an existing file on Windows)
+bool replace_file(const std::string& from, const std::string& to) {
+    if (std::rename(from.c_str(), to.c_str()) == 0) {
+        return true;
+    }
+    std::remove(to.c_str());
+    return std::rename(from.c_str(), to.c_str()) == 0;
+}
+
+} // anonymous namespace
+
+KVStore::KVStore(size_t num_shards) {
+    set_shard_count(num_shards);
+}
+
+KVStore::~KVStore() {
+    std::lock_guard<std::mutex> lock(bgsave_mutex_);
+    if (bgsave_thread_.joinable()) {
+        bgsave_thread_.join();
+    }
+}
+
+void KVStore::set_shard_count(size_t num_shards) {
+    if (num_shards == 0) {
+        num_shards = 1;
+    }
+    std::vector<std::unique_ptr<Shard>> old_shards = std::move(shards_);
+    shards_.clear();
+    shards_.reserve(num_shards);
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+        shards_.back()->rng_state += i;
+    }
+    update_shard_limits();
+
+    // Move existing entries into their new shards, oldest first so the
+    // relative LRU order survives the move
+    for (auto& old_shard : old_shards) {
+        for (Entry* e = old_shard->lru_tail; e != nullptr;) {
+            Entry* newer = e->lru_prev;
+            const int64_t expire_at_ms = e->expire_at_ms;
+            const uint8_t lfu_counter = e->lfu_counter;
+            const uint16_t lfu_minutes = e->lfu_minutes;
+            e->lru_prev = e->lru_next = nullptr;
+            e->heap_index = NOT_IN_HEAP;
+            e->expire_at_ms = 0;
+            Shard& shard = shard_for(e->key());
+            shard.store.insert(e);
+            shard.used_memory += table_slot_overhead<EntryMap>() + entry_bytes(*e);
+            touch_lru(shard, *e);
+            e->lfu_counter = lfu_counter;
+            e->lfu_minutes = lfu_minutes;
+            place_in_expiry_heap(shard, *e, expire_at_ms); // Moved, not changed
+            e = newer;
+        }
+        old_shard->store.clear(); // The entries belong to the new shards now
+    }
+}
+
+KVStore::Shard::~Shard() {
+    store.for_each([](Entry* entry) { free_entry(entry); });
+}
+
+void KVStore::set_lazy_free(LazyFreer* freer, size_t min_size) {
+    lazy_freer_ = freer;
+    lazy_free_min_size_ = min_size;
+}
+
+thread_local uint64_t KeyTracker::writer = 0;
+
+void KVStore::set_tracking(KeyTracker* tracker, size_t max_keys) {
+    tracker_ = tracker;
+    max_tracked_ = max_keys;
+    update_shard_limits();
+}
+
+void KVStore::set_eviction_limits(size_t max_keys, size_t maxmemory,
+                                  EvictionPolicy policy, size_t samples) {
+    max_keys_ = max_keys;
+    maxmemory_ = maxmemory;
+    policy_ = policy;
+    samples_ = samples > 0 ? samples : 1;
+    update_shard_limits();
+    for (auto& shard_ptr : shards_) {
+        std::lock_guard<ShardMutex> lock(shard_ptr->mutex);
+        evict_if_needed(*shard_ptr);
+    }
+}
+
+void KVStore::update_shard_limits() {
+    const size_t n = shards_.empty() ? 1 : shards_.size();
+    max_keys_per_shard_ = max_keys_ ? std::max<size_t>(1, (max_keys_ + n - 1) / n) : 0;
+    maxmemory_per_shard_ = maxmemory_ ? std::max<size_t>(1, maxmemory_ / n) : 0;
+    max_tracked_per_shard_ = max_tracked_ ? std::max<size_t>(1, (max_tracked_ + n - 1) / n) : 0;
+}
+
+bool KVStore::parse_eviction_policy(const std::string& name, EvictionPolicy& out) {
+    if (name == "allkeys-lru") out = EvictionPolicy::AllKeysLRU;
+    else if (name == "volatile-lru") out = EvictionPolicy::VolatileLRU;
+    else if (name == "allkeys-lfu") out = EvictionPolicy::AllKeysLFU;
+    else if (name == "volatile-ttl") out = EvictionPolicy::VolatileTTL;
+    else return false;
+    return true;
+}
+
+const char* KVStore::eviction_policy_name(EvictionPolicy policy) {
+    switch (policy) {
+        case EvictionPolicy::AllKeysLRU: return "allkeys-lru";
+        case EvictionPolicy::VolatileLRU: return "volatile-lru";
+        case EvictionPolicy::AllKeysLFU: return "allkeys-lfu";
+        case EvictionPolicy::VolatileTTL: return "volatile-ttl";
+    }
+    return "allkeys-lru";
+}
+
+KVStore::Shard& KVStore::shard_for(std::string_view key) {
+    return *shards_[shard_index(key)];
+}
+
+size_t KVStore::shard_index(std::string_view key) const {
+    return std::hash<std::string_view>{}(key) % shards_.size();
+}
+
+std::unique_lock<KVStore::ShardMutex> KVStore::lock_shard(size_t index) const {
+    return std::unique_lock<ShardMutex>(shards_[index]->mutex);
+}
+
+uint64_t KVStore::watch(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    find_live(shard, key); // A key already expired is not a change after the WATCH
+    WatchedKey& watched = shard.watched[key];
+    ++watched.watchers;
+    return watched.version;
+}
+
+void KVStore::unwatch(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    auto it = shard.watched.find(key);
+    if (it != shard.watched.end() && --it->second.watchers == 0) {
+        shard.watched.erase(it);
+    }
+}
+
+uint64_t KVStore::watch_version(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    find_live(shard, key); // Expiring since the WATCH counts as a change
+    auto it = shard.watched.find(key);
+    return it != shard.watched.end() ? it->second.version : 0;
+}
+
+void KVStore::track(const std::string& key, uint64_t client) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    std::vector<uint64_t>& clients = shard.tracked[key];
+    if (std::find(clients.begin(), clients.end(), client) == clients.end()) {
+        clients.push_back(client);
+    }
+    if (max_tracked_per_shard_ == 0 || shard.tracked.size() <= max_tracked_per_shard_) {
+        return;
+    }
+
+    // Over the limit: drop a key from a random bucket, other than the one
+    // just read, and tell its clients to forget it
+    const size_t buckets = shard.tracked.bucket_count();
+    size_t b = next_random(shard.rng_state) % buckets;
+    while (shard.tracked.bucket_size(b) == 0 ||
+           (shard.tracked.bucket_size(b) == 1 && shard.tracked.begin(b)->first == key)) {
+        b = (b + 1) % buckets;
+    }
+    auto victim = shard.tracked.begin(b);
+    if (victim->first == key) {
+        ++victim;
+    }
+    auto it = shard.tracked.find(victim->first);
+    const std::vector<uint64_t> dropped = std::move(it->second);
+    const std::string dropped_key = it->first;
+    shard.tracked.erase(it);
+    if (tracker_) {
+        const KeyTracker::WriterScope server_change(0);
+        tracker_->invalidate(dropped_key, dropped);
+    }
+}
+
+size_t KVStore::tracked_keys() const {
+    size_t total = 0;
+    for (const auto& shard_ptr : shards_) {
+        std::lock_guard<ShardMutex> lock(shard_ptr->mutex);
+        total += shard_ptr->tracked.size();
+    }
+    return total;
+}
+
+void KVStore::lock_batch(const std::vector<std::string>& keys, size_t stride, BatchLock& batch) {
+    std::vector<bool> wanted(shards_.size(), false);
+    batch.shard_of.reserve(keys.size() / stride + 1);
+    for (size_t i = 0; i < keys.size(); i += stride) {
+        const size_t index = shard_index(keys[i]);
+        wanted[index] = true;
+        batch.shard_of.push_back(shards_[index].get());
+    }
+    for (size_t index = 0; index < shards_.size(); ++index) {
+        if (wanted[index]) {
+            batch.locks.emplace_back(shards_[index]->mutex);
+        }
+    }
+}
+
+void KVStore::snapshot_shard(size_t index, std::vector<SnapshotEntry>& out) const {
+    const Shard& shard = *shards_[index];
+    const int64_t now = now_ms();
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    out.reserve(out.size() + shard.store.size());
+    shard.store.for_each([&](const Entry* entry) {
+        if (entry->expire_at_ms == 0 || entry->expire_at_ms > now) {
+            out.push_back(snapshot_of(*entry));
+        }
+    });
+}
+
+bool KVStore::begin_snapshot(SnapshotCursor& cursor) {
+    if (snapshot_open_.exchange(true)) {
+        return false;
+    }
+    if (++snapshot_epochs_ == 0) {
+        ++snapshot_epochs_; // 0 means "no snapshot"
+    }
+    cursor = SnapshotCursor{};
+    cursor.epoch = snapshot_epochs_;
+
+    // Every shard switches to copy-on-write at the same instant
+    std::vector<std::unique_lock<ShardMutex>> locks;
+    locks.reserve(shards_.size());
+    for (auto& shard_ptr : shards_) {
+        locks.emplace_back(shard_ptr->mutex);
+    }
+    cursor.taken_ms = now_ms();
+    for (auto& shard_ptr : shards_) {
+        shard_ptr->snapshot_epoch = cursor.epoch;
+        shard_ptr->snapshot_undo.clear();
+    }
+    return true;
+}
+
+bool KVStore::next_snapshot_chunk(SnapshotCursor& cursor, std::vector<SnapshotEntry>& out,
+                                  size_t max_entries) {
+    const size_t limit = out.size() + std::max<size_t>(1, max_entries);
+    auto live = [&cursor](int64_t expire_at_ms) {
+        return expire_at_ms == 0 || expire_at_ms > cursor.taken_ms;
+    };
+    while (cursor.shard < shards_.size() && out.size() < limit) {
+        Shard& shard = *shards_[cursor.shard];
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+
+        // Keys changed since the snapshot began, as they were then
+        for (auto& saved : shard.snapshot_undo) {
+            if (live(saved.expire_at_ms)) {
+                out.push_back(std::move(saved));
             }
         }
+        shard.snapshot_undo.clear();
+
+        // An incremental rehash between chunks only moves keys forward in
+        // the scan; one seen twice carries the epoch and is skipped
+        EntryMap::ScanPos pos{cursor.table, cursor.slot};
+        const bool more = shard.store.scan(pos, [&](Entry* entry) {
+            if (entry->snapshot_epoch == cursor.epoch) {
+                return true; // Already copied, saved aside, or created after the snapshot
+            }
+            entry->snapshot_epoch = cursor.epoch;
+            if (live(entry->expire_at_ms)) {
+                out.push_back(snapshot_of(*entry));
+            }
+            return out.size() < limit;
+        });
+        cursor.table = pos.table;
+        cursor.slot = pos.slot;
+
+        if (!more) {
+            // Shard done: later changes to it no longer concern the snapshot
+            shard.snapshot_epoch = 0;
+            std::vector<SnapshotEntry>().swap(shard.snapshot_undo);
+            ++cursor.shard;
+            cursor.table = 0;
+            cursor.slot = 0;
+        }
     }
+    return cursor.shard < shards_.size();
 }
 
-void KVStore::update_lru(const std::string& key) {
-    // Remove from current position if exists
-    auto lru_it = lru_map_.find(key);
-    if (lru_it != lru_map_.end()) {
-        lru_order_.erase(lru_it->second);
+uint64_t KVStore::scan(uint64_t cursor, size_t count, std::vector<std::string>& keys,
+                       const std::function<bool(std::string_view)>& filter) {
+    const uint64_t table_mask = (uint64_t{1} << SCAN_TABLE_BITS) - 1;
+    const unsigned table_shift = SCAN_SHARD_SHIFT - SCAN_TABLE_BITS;
+    ScanCursor pos;
+    pos.shard = static_cast<size_t>(cursor >> SCAN_SHARD_SHIFT);
+    if (pos.shard >= shards_.size()) {
+        return 0;
+    }
+    pos.slot = static_cast<size_t>(cursor & ((uint64_t{1} << table_shift) - 1));
+    const uint64_t table_low = (cursor >> table_shift) & table_mask;
+    if (table_low != 0 || pos.slot != 0) {
+        Shard& shard = *shards_[pos.shard];
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+        pos.table = shard.store.find_table(table_low, SCAN_TABLE_BITS);
+        if (pos.table == 0) {
+            pos.slot = 0; // Its table is gone: the shard is rescanned
+        }
+    }
+
+    if (!scan(pos, count, keys, filter)) {
+        return 0;
+    }
+    return (static_cast<uint64_t>(pos.shard) << SCAN_SHARD_SHIFT) | ((pos.table & table_mask) << table_shift) |
+           static_cast<uint64_t>(pos.slot);
+}
+
+void KVStore::end_snapshot(SnapshotCursor& cursor) {
+    // Shards an abandoned scan never reached stop copying too
+    for (; cursor.shard < shards_.size(); ++cursor.shard) {
+        Shard& shard = *shards_[cursor.shard];
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+        shard.snapshot_epoch = 0;
+        std::vector<SnapshotEntry>().swap(shard.snapshot_undo);
+    }
+    snapshot_open_.store(false);
+}
+
+void KVStore::preserve_for_snapshot(Shard& shard, Entry& entry) {
+    if (shard.snapshot_epoch != 0 && entry.snapshot_epoch != shard.snapshot_epoch) {
+        shard.snapshot_undo.push_back(snapshot_of(entry));
+        entry.snapshot_epoch = shard.snapshot_epoch;
+    }
+    if (!shard.watched.empty()) {
+        auto it = shard.watched.find(std::string(entry.key()));
+        if (it != shard.watched.end()) {
+            ++it->second.version;
+        }
+    }
+    if (!tracker_) {
+        return;
+    }
+    if (!shard.tracked.empty()) {
+        auto it = shard.tracked.find(std::string(entry.key()));
+        if (it != shard.tracked.end()) {
+            // Untracked until read again, as in Redis
+            const std::vector<uint64_t> clients = std::move(it->second);
+            shard.tracked.erase(it);
+            tracker_->invalidate(entry.key(), clients);
+            return;
+        }
+    }
+    if (tracker_->broadcast()) {
+        tracker_->invalidate(entry.key(), {});
+    }
+}
+
+KVStore::Entry* KVStore::new_entry(std::string_view key, size_t value_size) {
+    // Rounded to the allocator's 8-byte granularity: the slack is room to embed
+    const size_t bytes = (sizeof(Entry) + key.size() + value_size + 7) & ~size_t(7);
+    Entry* entry = new (::operator new(bytes)) Entry();
+    entry->key_len = static_cast<uint32_t>(key.size());
+    entry->embed_capacity = static_cast<uint32_t>(bytes - sizeof(Entry) - key.size());
+    entry->embedded_len = 0;
+    std::memcpy(entry + 1, key.data(), key.size());
+    return entry;
+}
+
+void KVStore::free_entry(Entry* entry) {
+    if (entry->encoding == Encoding::Raw) {
+        SharedValue::release(entry->raw);
+    } else if (entry->encoding == Encoding::Collection) {
+        delete entry->collection;
+    }
+    entry->~Entry();
+    ::operator delete(entry);
+}
+
+size_t KVStore::entry_bytes(const Entry& entry) {
+    size_t bytes = sizeof(Entry) + entry.key_len + entry.embed_capacity;
+    if (entry.encoding == Encoding::Raw) {
+        bytes += sizeof(SharedValue) + string_heap_bytes(entry.raw->bytes);
+    } else if (entry.encoding == Encoding::Collection) {
+        bytes += entry.collection->memory();
+    }
+    return bytes;
+}
+
+std::string_view KVStore::value_of(const Entry& entry, char (&digits)[INT_DIGITS]) {
+    switch (entry.encoding) {
+        case Encoding::Int: {
+            auto result = std::to_chars(digits, digits + INT_DIGITS, entry.integer);
+            return std::string_view(digits, static_cast<size_t>(result.ptr - digits));
+        }
+        case Encoding::Embedded:
+            return std::string_view(entry.embedded(), entry.embedded_len);
+        case Encoding::Raw:
+            return entry.raw->bytes;
+        case Encoding::Collection:
+            break;
     }
-    // Add to front (most recent)
-    lru_order_.push_front(key);
-    lru_map_[key] = lru_order_.begin();
+    return {};
 }
 
-void KVStore::evict_if_needed() {
-    while (store_.size() > MAX_KEYS && !lru_order_.empty()) {
-        // Remove oldest key (from back of list)
-        std::string oldest_key = lru_order_.back();
-        store_.erase(oldest_key);
-        expirations_.erase(oldest_key);
-        lru_map_.erase(oldest_key);
-        lru_order_.pop_back();
+std::string KVStore::copy_value(const Entry& entry) {
+    char digits[INT_DIGITS];
+    return std::string(value_of(entry, digits));
+}
+
+KVStore::SnapshotEntry KVStore::snapshot_of(const Entry& entry) {
+    SnapshotEntry out{std::string(entry.key()), {}, entry.expire_at_ms};
+    if (is_string(entry)) {
+        out.value = copy_value(entry);
+    } else {
+        Listpack elements;
+        entry.collection->dump(elements);
+        out.value.assign(elements.data());
+        out.type = entry.collection->type();
+    }
+    return out;
+}
+
+KVStore::Entry& KVStore::upsert(Shard& shard, std::string_view key, std::string_view value_hint) {
+    auto hit = shard.store.find(key);
+    if (hit) {
+        touch_lru(shard, *hit.value);
+        return *hit.value;
+    }
+    Entry* entry = new_entry(key, embed_size_for(value_hint));
+    entry->snapshot_epoch = shard.snapshot_epoch; // Not part of an open snapshot
+    entry->lfu_counter = LFU_INIT_VAL;
+    entry->lfu_minutes = lfu_minutes_now();
+    shard.store.insert(entry);
+    shard.used_memory += table_slot_overhead<EntryMap>() + entry_bytes(*entry);
+    touch_lru(shard, *entry);
+    return *entry;
+}
+
+void KVStore::release_value(Shard& shard, Entry& entry) {
+    if (entry.encoding == Encoding::Raw) {
+        shard.used_memory -= sizeof(SharedValue) + string_heap_bytes(entry.raw->bytes);
+        SharedValue::release(entry.raw);
+    } else if (entry.encoding == Encoding::Collection) {
+        shard.used_memory -= entry.collection->memory();
+        delete entry.collection;
+    } else {
+        return;
+    }
+    entry.encoding = Encoding::Embedded;
+    entry.embedded_len = 0;
+}
+
+void KVStore::unshare_raw(Shard& shard, Entry& entry) {
+    if (entry.encoding == Encoding::Raw && entry.raw->shared()) {
+        // The reader keeps the old bytes; the entry moves on to its own copy
+        SharedValue* copy = new SharedValue(entry.raw->bytes);
+        shard.used_memory -= string_heap_bytes(entry.raw->bytes);
+        SharedValue::release(entry.raw);
+        entry.raw = copy;
+        shard.used_memory += string_heap_bytes(copy->bytes);
+    }
+}
+
+void KVStore::assign_integer(Shard& shard, Entry& entry, int64_t value) {
+    preserve_for_snapshot(shard, entry);
+    release_value(shard, entry);
+    entry.encoding = Encoding::Int;
+    entry.integer = value;
+}
+
+void KVStore::assign_value(Shard& shard, Entry& entry, std::string_view value) {
+    int64_t number;
+    if (parse_canonical_int(value, number)) {
+        assign_integer(shard, entry, number);
+        return;
+    }
+    preserve_for_snapshot(shard, entry);
+    if (value.size() <= entry.embed_capacity) {
+        release_value(shard, entry);
+        std::memcpy(entry.embedded(), value.data(), value.size());
+        entry.encoding = Encoding::Embedded;
+        entry.embedded_len = static_cast<uint32_t>(value.size());
+        return;
+    }
+    if (entry.encoding == Encoding::Raw && !entry.raw->shared()) {
+        // Swap in a fresh string rather than assign: assigning a shorter value
+        // would keep the old, larger heap buffer alive
+        shard.used_memory -= string_heap_bytes(entry.raw->bytes);
+        std::string(value).swap(entry.raw->bytes);
+    } else {
+        // A value a reader still references is left to it, unchanged
+        release_value(shard, entry);
+        entry.raw = new SharedValue(value);
+        entry.encoding = Encoding::Raw;
+        shard.used_memory += sizeof(SharedValue);
+    }
+    shard.used_memory += string_heap_bytes(entry.raw->bytes);
+}
+
+void KVStore::assign_collection(Shard& shard, Entry& entry, std::unique_ptr<Collection> collection) {
+    preserve_for_snapshot(shard, entry);
+    release_value(shard, entry);
+    shard.used_memory += collection->memory();
+    entry.collection = collection.release();
+    entry.encoding = Encoding::Collection;
+}
+
+int64_t KVStore::now_ms() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+void KVStore::set_expiration(Shard& shard, Entry& entry, int64_t when_ms) {
+    preserve_for_snapshot(shard, entry);
+    place_in_expiry_heap(shard, entry, when_ms);
+}
+
+void KVStore::place_in_expiry_heap(Shard& shard, Entry& entry, int64_t when_ms) {
+    if (when_ms <= 0) {
+        // Clear the TTL: move the last heap slot into this one and re-heapify
+        if (entry.heap_index == NOT_IN_HEAP) {
+            return;
+        }
+        uint32_t index = entry.heap_index;
+        Entry* last = shard.expiry_heap.back();
+        shard.expiry_heap.pop_back();
+        shard.used_memory -= sizeof(Entry*);
+        entry.heap_index = NOT_IN_HEAP;
+        entry.expire_at_ms = 0;
+        if (last != &entry) {
+            shard.expiry_heap[index] = last;
+            last->heap_index = index;
+            heap_sift_up(shard, index);
+            heap_sift_down(shard, last->heap_index);
+        }
+        return;
+    }
+
+    entry.expire_at_ms = when_ms;
+    if (entry.heap_index == NOT_IN_HEAP) {
+        entry.heap_index = static_cast<uint32_t>(shard.expiry_heap.size());
+        shard.expiry_heap.push_back(&entry);
+        shard.used_memory += sizeof(Entry*);
+    }
+    heap_sift_up(shard, entry.heap_index);
+    heap_sift_down(shard, entry.heap_index);
+}
+
+void KVStore::heap_sift_up(Shard& shard, size_t index) {
+    auto& heap = shard.expiry_heap;
+    while (index > 0) {
+        size_t parent = (index - 1) / 2;
+        if (heap[parent]->expire_at_ms <= heap[index]->expire_at_ms) {
+            break;
+        }
+        std::swap(heap[parent], heap[index]);
+        heap[parent]->heap_index = static_cast<uint32_t>(parent);
+        heap[index]->heap_index = static_cast<uint32_t>(index);
+        index = parent;
+    }
+}
+
+void KVStore::heap_sift_down(Shard& shard, size_t index) {
+    auto& heap = shard.expiry_heap;
+    const size_t n = heap.size();
+    while (true) {
+        size_t smallest = index;
+        size_t left = 2 * index + 1;
+        size_t right = left + 1;
+        if (left < n && heap[left]->expire_at_ms < heap[smallest]->expire_at_ms) {
+            smallest = left;
+        }
+        if (right < n && heap[right]->expire_at_ms < heap[smallest]->expire_at_ms) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+        std::swap(heap[smallest], heap[index]);
+        heap[smallest]->heap_index = static_cast<uint32_t>(smallest);
+        heap[index]->heap_index = static_cast<uint32_t>(index);
+        index = smallest;
+    }
+}
+
+void KVStore::erase_entry(Shard& shard, const EntryMap::Hit& hit, bool lazy) {
+    Entry* entry = hit.value;
+    preserve_for_snapshot(shard, *entry);
+    unlink_lru(shard, *entry);
+    place_in_expiry_heap(shard, *entry, 0);
+    shard.used_memory -= table_slot_overhead<EntryMap>() + entry_bytes(*entry);
+    shard.store.erase(hit);
+    dispose_entry(entry, lazy);
+}
+
+void KVStore::dispose_entry(Entry* entry, bool lazy) {
+    // Only a separate value string or a collection can be big enough to be
+    // worth a hand-off
+    const bool large = (entry->encoding == Encoding::Raw && entry->raw->bytes.capacity() >= lazy_free_min_size_) ||
+                       (entry->encoding == Encoding::Collection && entry->collection->memory() >= lazy_free_min_size_);
+    if (lazy && lazy_freer_ && lazy_free_min_size_ != 0 && large) {
+        lazy_freer_->submit([entry] { free_entry(entry); });
+        return;
+    }
+    free_entry(entry);
+}
+
+void KVStore::store_loaded(Shard& shard, std::string_view key, std::string_view value,
+                           std::unique_ptr<Collection> collection, int64_t expire_at_ms) {
+    Entry& entry = upsert(shard, key, collection ? std::string_view() : value);
+    if (collection) {
+        assign_collection(shard, entry, std::move(collection));
+    } else {
+        assign_value(shard, entry, value);
+    }
+    place_in_expiry_heap(shard, entry, expire_at_ms);
+    evict_if_needed(shard);
+}
+
+KVStore::Entry* KVStore::find_live(Shard& shard, std::string_view key) {
+    auto hit = shard.store.find(key);
+    if (!hit) {
+        return nullptr;
+    }
+    if (hit.value->expire_at_ms != 0 && now_ms() >= hit.value->expire_at_ms) {
+        erase_entry(shard, hit);
+        shard.expired_keys++;
+        return nullptr;
     }
+    return hit.value;
+}
+
+void KVStore::check_and_remove_expired(Shard& shard, const std::string& key) {
+    auto hit = shard.store.find(key);
+    if (hit && hit.value->expire_at_ms != 0 &&
+        now_ms() >= hit.value->expire_at_ms) {
+        // Key has expired, remove it
+        erase_entry(shard, hit);
+        shard.expired_keys++;
+    }
+}
+
+void KVStore::unlink_lru(Shard& shard, Entry& entry) {
+    if (entry.lru_prev) {
+        entry.lru_prev->lru_next = entry.lru_next;
+    } else if (shard.lru_head == &entry) {
+        shard.lru_head = entry.lru_next;
+    }
+    if (entry.lru_next) {
+        entry.lru_next->lru_prev = entry.lru_prev;
+    } else if (shard.lru_tail == &entry) {
+        shard.lru_tail = entry.lru_prev;
+    }
+    entry.lru_prev = nullptr;
+    entry.lru_next = nullptr;
+}
+
+void KVStore::touch_lru(Shard& shard, Entry& entry) {
+    entry.lru_clock = ++shard.lru_clock;
+
+    // LFU: decay by one per idle minute, then a probabilistic log increment
+    uint16_t now_minutes = lfu_minutes_now();
+    uint16_t idle = static_cast<uint16_t>(now_minutes - entry.lfu_minutes);
+    if (idle > 0) {
+        entry.lfu_counter = idle >= entry.lfu_counter ? 0 : static_cast<uint8_t>(entry.lfu_counter - idle);
+        entry.lfu_minutes = now_minutes;
+    }
+    if (entry.lfu_counter < 255) {
+        double base = entry.lfu_counter > LFU_INIT_VAL ? entry.lfu_counter - LFU_INIT_VAL : 0;
+        double r = static_cast<double>(next_random(shard.rng_state) >> 11) / static_cast<double>(1ULL << 53);
+        if (r < 1.0 / (base * LFU_LOG_FACTOR + 1.0)) {
+            entry.lfu_counter++;
+        }
+    }
+
+    if (shard.lru_head == &entry) {
+        return; // Already most recent
+    }
+    unlink_lru(shard, entry);
+    // Splice in at the front (most recent)
+    entry.lru_next = shard.lru_head;
+    if (shard.lru_head) {
+        shard.lru_head->lru_prev = &entry;
+    }
+    shard.lru_head = &entry;
+    if (!shard.lru_tail) {
+        shard.lru_tail = &entry;
+    }
+}
+
+KVStore::Entry* KVStore::pick_victim(Shard& shard) {
+    Entry* victim = nullptr;
+    switch (policy_) {
+        case EvictionPolicy::AllKeysLRU:
+            victim = shard.lru_tail;
+            break;
+
+        case EvictionPolicy::AllKeysLFU:
+            shard.store.sample(next_random(shard.rng_state), samples_, [&](Entry* sampled) {
+                Entry& e = *sampled;
+                if (!victim || e.lfu_counter < victim->lfu_counter ||
+                    (e.lfu_counter == victim->lfu_counter && lru_older(e.lru_clock, victim->lru_clock))) {
+                    victim = &e;
+                }
+            });
+            break;
+
+        case EvictionPolicy::VolatileLRU: {
+            // Sample random slots of the expiry heap: every slot holds a volatile key
+            const size_t n = shard.expiry_heap.size();
+            for (size_t i = 0; i < samples_ && n > 0; ++i) {
+                Entry* e = shard.expiry_heap[next_random(shard.rng_state) % n];
+                if (!victim || lru_older(e->lru_clock, victim->lru_clock)) {
+                    victim = e;
+                }
+            }
+            break;
+        }
+
+        case EvictionPolicy::VolatileTTL:
+            // Exact: the heap root is the key that expires soonest
+            if (!shard.expiry_heap.empty()) {
+                victim = shard.expiry_heap.front();
+            }
+            break;
+    }
+    return victim;
+}
+
+void KVStore::evict_if_needed(Shard& shard) {
+    while ((max_keys_per_shard_ && shard.store.size() > max_keys_per_shard_) ||
+           (maxmemory_per_shard_ && shard.used_memory > maxmemory_per_shard_)) {
+        Entry* victim = pick_victim(shard);
+        if (!victim) {
+            break; // No eligible keys under this policy
+        }
+        // The server's change, not the writer's, for NOLOOP
+        const KeyTracker::WriterScope server_change(0);
+        erase_entry(shard, shard.store.find(victim->key()));
+        shard.evicted_keys++;
+    }
+}
+
+size_t KVStore::used_memory() const {
+    size_t total = 0;
+    for (const auto& shard_ptr : shards_) {
+        std::lock_guard<ShardMutex> lock(shard_ptr->mutex);
+        total += shard_ptr->used_memory;
+    }
+    return total;
+}
+
+uint64_t KVStore::evicted_keys() const {
+    uint64_t total = 0;
+    for (const auto& shard_ptr : shards_) {
+        std::lock_guard<ShardMutex> lock(shard_ptr->mutex);
+        total += shard_ptr->evicted_keys;
+    }
+    return total;
+}
+
+uint64_t KVStore::expired_keys() const {
+    uint64_t total = 0;
+    for (const auto& shard_ptr : shards_) {
+        std::lock_guard<ShardMutex> lock(shard_ptr->mutex);
+        total += shard_ptr->expired_keys;
+    }
+    return total;
+}
+
+size_t KVStore::active_expire_cycle(std::chrono::microseconds budget) {
+    using clock = std::chrono::steady_clock;
+    const auto deadline = clock::now() + budget;
+    const size_t n = shards_.size();
+    size_t removed = 0;
+
+    size_t start = expire_cursor_.load(std::memory_order_relaxed);
+    for (size_t visited = 0; visited < n; ++visited) {
+        size_t index = (start + visited) % n;
+        Shard& shard = *shards_[index];
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+        const int64_t now = now_ms();
+        size_t checked = 0;
+        while (!shard.expiry_heap.empty() && shard.expiry_heap.front()->expire_at_ms <= now) {
+            Entry* due = shard.expiry_heap.front();
+            erase_entry(shard, shard.store.find(due->key()));
+            shard.expired_keys++;
+            ++removed;
+            // Checking the clock is not free, so only do it every 16 keys
+            if ((++checked & 15) == 0 && clock::now() >= deadline) {
+                expire_cursor_.store(index, std::memory_order_relaxed); // Resume in this shard
+                return removed;
+            }
+        }
+        if (clock::now() >= deadline) {
+            expire_cursor_.store((index + 1) % n, std::memory_order_relaxed);
+            return removed;
+        }
+    }
+    return removed;
 }
 
 void KVStore::set(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    check_and_remove_expired(key);
-    store_[key] = value;
-    update_lru(key);
-    evict_if_needed();
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    check_and_remove_expired(shard, key);
+    Entry& entry = upsert(shard, key, value);
+    assign_value(shard, entry, value);
+    evict_if_needed(shard);
 }
 
 bool KVStore::get(const std::string& key, std::string& outValue) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    check_and_remove_expired(key);
-    auto it = store_.find(key);
-    if (it == store_.end()) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    Entry* entry = find_live(shard, key);
+    if (!entry || !is_string(*entry)) {
         return false;
     }
-    outValue = it->second;
-    update_lru(key);
+    char digits[INT_DIGITS];
+    outValue.assign(value_of(*entry, digits));
+    touch_lru(shard, *entry);
     return true;
 }
 
 // DEL removes a key from the store if it exists
 // Returns true if the key was removed, false if it didn't exist
 bool KVStore::del(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    check_and_remove_expired(key);
-    auto it = store_.find(key);
-    if (it != store_.end()) {
-        store_.erase(it);
-        expirations_.erase(key);
-        // Remove from LRU tracking
-        auto lru_it = lru_map_.find(key);
-        if (lru_it != lru_map_.end()) {
-            lru_order_.erase(lru_it->second);
-            lru_map_.erase(lru_it);
-        }
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    check_and_remove_expired(shard, key);
+    auto hit = shard.store.find(key);
+    if (hit) {
+        erase_entry(shard, hit, false);
         return true;
     }
     return false;
 }
 
+void KVStore::mset(const std::vector<std::string>& pairs) {
+    BatchLock batch;
+    lock_batch(pairs, 2, batch);
+    for (size_t i = 0; i + 1 < pairs.size(); i += 2) {
+        Shard& shard = *batch.shard_of[i / 2];
+        check_and_remove_expired(shard, pairs[i]);
+        Entry& entry = upsert(shard, pairs[i], pairs[i + 1]);
+        assign_value(shard, entry, pairs[i + 1]);
+    }
+    // Evict after the whole batch is in, once per key's shard
+    for (size_t i = 0; i < batch.shard_of.size(); ++i) {
+        evict_if_needed(*batch.shard_of[i]);
+    }
+}
+
+bool KVStore::msetnx(const std::vector<std::string>& pairs) {
+    BatchLock batch;
+    lock_batch(pairs, 2, batch);
+    for (size_t i = 0; i + 1 < pairs.size(); i += 2) {
+        if (find_live(*batch.shard_of[i / 2], pairs[i])) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i + 1 < pairs.size(); i += 2) {
+        Shard& shard = *batch.shard_of[i / 2];
+        Entry& entry = upsert(shard, pairs[i], pairs[i + 1]);
+        assign_value(shard, entry, pairs[i + 1]);
+    }
+    for (size_t i = 0; i < batch.shard_of.size(); ++i) {
+        evict_if_needed(*batch.shard_of[i]);
+    }
+    return true;
+}
+
+size_t KVStore::del_many(const std::vector<std::string>& keys) {
+    return remove_many(keys, false);
+}
+
+size_t KVStore::unlink_many(const std::vector<std::string>& keys) {
+    return remove_many(keys, true);
+}
+
+size_t KVStore::remove_many(const std::vector<std::string>& keys, bool lazy) {
+    BatchLock batch;
+    lock_batch(keys, 1, batch);
+    size_t removed = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        Shard& shard = *batch.shard_of[i];
+        check_and_remove_expired(shard, keys[i]);
+        auto hit = shard.store.find(keys[i]);
+        if (hit) {
+            erase_entry(shard, hit, lazy);
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+size_t KVStore::exists_many(const std::vector<std::string>& keys) {
+    BatchLock batch;
+    lock_batch(keys, 1, batch);
+    size_t found = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (find_live(*batch.shard_of[i], keys[i])) {
+            ++found;
+        }
+    }
+    return found;
+}
+
+void KVStore::clear() {
+    for (auto& shard_ptr : shards_) {
+        Shard& shard = *shard_ptr;
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+        shard.store.for_each([&](Entry* entry) {
+            preserve_for_snapshot(shard, *entry);
+            free_entry(entry);
+        });
+        shard.store.clear();
+        shard.expiry_heap.clear();
+        shard.lru_head = nullptr;
+        shard.lru_tail = nullptr;
+        shard.used_memory = 0;
+    }
+}
+
+void KVStore::clear_async() {
+    if (!lazy_freer_) {
+        clear();
+        return;
+    }
+    for (auto& shard_ptr : shards_) {
+        Shard& shard = *shard_ptr;
+        auto entries = std::make_shared<std::vector<Entry*>>();
+        {
+            std::lock_guard<ShardMutex> lock(shard.mutex);
+            entries->reserve(shard.store.size());
+            shard.store.for_each([&](Entry* entry) {
+                preserve_for_snapshot(shard, *entry);
+                entries->push_back(entry);
+            });
+            shard.store.clear();
+            shard.expiry_heap.clear();
+            shard.lru_head = nullptr;
+            shard.lru_tail = nullptr;
+            shard.used_memory = 0;
+        }
+        if (!entries->empty()) {
+            const size_t count = entries->size();
+            lazy_freer_->submit([entries] {
+                for (Entry* entry : *entries) {
+                    free_entry(entry);
+                }
+            }, count);
+        }
+    }
+}
+
+bool KVStore::scan(ScanCursor& cursor, size_t count, std::vector<std::string>& keys,
+                   const std::function<bool(std::string_view)>& filter) {
+    const int64_t now = now_ms();
+    size_t budget = std::max<size_t>(1, count);
+    while (cursor.shard < shards_.size() && budget > 0) {
+        Shard& shard = *shards_[cursor.shard];
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+        EntryMap::ScanPos pos{cursor.table, cursor.slot};
+        size_t chunk = std::min(budget, SCAN_LOCK_ENTRIES);
+        budget -= chunk;
+        const bool more = shard.store.scan(pos, [&](Entry* entry) {
+            const std::string_view key = entry->key();
+            if ((entry->expire_at_ms == 0 || entry->expire_at_ms > now) && (!filter || filter(key))) {
+                keys.emplace_back(key);
+            }
+            return --chunk > 0;
+        });
+        budget += chunk; // Left over when the shard ran out first
+        cursor.table = pos.table;
+        cursor.slot = pos.slot;
+        if (!more) {
+            ++cursor.shard;
+            cursor.table = 0;
+            cursor.slot = 0;
+        }
+    }
+    return cursor.shard < shards_.size();
+}
+
+size_t KVStore::dump_records(const std::vector<std::string>& keys, std::string& out) {
+    size_t dumped = 0;
+    for (const auto& key : keys) {
+        Shard& shard = shard_for(key);
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+        Entry* entry = find_live(shard, key);
+        if (entry && is_string(*entry)) {
+            char digits[INT_DIGITS];
+            append_record(out, key, value_of(*entry, digits), entry->expire_at_ms);
+            ++dumped;
+        } else if (entry) {
+            const SnapshotEntry e = snapshot_of(*entry);
+            append_record(out, key, e.value, e.expire_at_ms, e.type);
+            ++dumped;
+        }
+    }
+    return dumped;
+}
+
+bool KVStore::restore_records(std::string_view data, size_t* restored) {
+    // Check every record, and rebuild every collection, before storing any
+    std::vector<Record> records;
+    std::vector<std::unique_ptr<Collection>> collections;
+    for (uint64_t pos = 0; pos < data.size();) {
+        const uint64_t length = record_length(data.data() + pos, data.size() - pos);
+        if (length == 0) {
+            return false;
+        }
+        records.push_back(read_record(data.data() + pos));
+        const Record& record = records.back();
+        collections.emplace_back();
+        if (record.type != ValueType::String) {
+            collections.back() = Collection::restore(record.type, record.value);
+            if (!collections.back()) {
+                return false;
+            }
+        }
+        pos += length;
+    }
+    const int64_t now = now_ms();
+    size_t stored = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        const Record& record = records[i];
+        if (record.expire_at_ms != 0 && record.expire_at_ms <= now) {
+            continue;
+        }
+        Shard& shard = shard_for(record.key);
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+        store_loaded(shard, record.key, record.value, std::move(collections[i]), record.expire_at_ms);
+        ++stored;
+    }
+    if (restored) {
+        *restored = stored;
+    }
+    return true;
+}
+
 // EXISTS checks if a key exists in the store
 // Returns true if the key exists, false otherwise
 bool KVStore::exists(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    check_and_remove_expired(key);
-    return store_.find(key) != store_.end();
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    check_and_remove_expired(shard, key);
+    return static_cast<bool>(shard.store.find(key));
 }
 
 // KEYS returns all keys currently in the store
-// Returns a vector containing all key names
-std::vector<std::string> KVStore::keys() {
-    std::lock_guard<std::mutex> lock(mutex_);
+// Shards are visited one at a time, so only one shard lock is held at once.
+// Expired keys are skipped here and left for the active expire cycle.
+std::vector<std::string> KVStore::keys(const std::function<bool(std::string_view)>& filter) {
     std::vector<std::string> result;
-    result.reserve(store_.size());
-    // Clean expired keys first
-    std::vector<std::string> keys_to_check;
-    for (const auto& pair : store_) {
-        keys_to_check.push_back(pair.first);
-    }
-    for (const auto& key : keys_to_check) {
-        check_and_remove_expired(key);
-    }
-    // Now collect remaining keys
-    for (const auto& pair : store_) {
-        result.push_back(pair.first);
+    const int64_t now = now_ms();
+    for (auto& shard_ptr : shards_) {
+        Shard& shard = *shard_ptr;
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+        result.reserve(result.size() + shard.store.size());
+        shard.store.for_each([&](const Entry* entry) {
+            if ((entry->expire_at_ms == 0 || entry->expire_at_ms > now) && (!filter || filter(entry->key()))) {
+                result.emplace_back(entry->key());
+            }
+        });
     }
     return result;
 }
 
 // EXPIRE sets expiration time for a key in seconds
 // Returns true if key exists and expiration was set, false if key doesn't exist
-bool KVStore::expire(const std::string& key, int seconds) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    check_and_remove_expired(key);
-    if (store_.find(key) == store_.end()) {
+bool KVStore::expire(const std::string& key, int64_t seconds) {
+    // Saturate rather than overflow; the command handlers reject such times
+    constexpr int64_t limit = std::numeric_limits<int64_t>::max() / 1000;
+    return pexpire(key, std::max(-limit, std::min(seconds, limit)) * 1000);
+}
+
+// PEXPIRE sets expiration time for a key in milliseconds
+// Returns true if key exists and expiration was set, false if key doesn't exist
+bool KVStore::pexpire(const std::string& key, int64_t milliseconds) {
+    const int64_t now = now_ms();
+    const int64_t latest = std::numeric_limits<int64_t>::max();
+    return pexpireat(key, milliseconds > latest - now ? latest : now + milliseconds);
+}
+
+// PEXPIREAT sets an absolute expiration time (Unix milliseconds)
+// Returns true if key exists and expiration was set, false if key doesn't exist
+bool KVStore::pexpireat(const std::string& key, int64_t unix_ms) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    check_and_remove_expired(shard, key);
+    auto hit = shard.store.find(key);
+    if (!hit) {
         return false;
     }
-    time_t now = time(nullptr);
-    expirations_[key] = now + seconds;
+    // A deadline in the past still yields a valid one (already due)
+    set_expiration(shard, *hit.value, std::max<int64_t>(1, unix_ms));
     return true;
 }
 
 // TTL returns time-to-live in seconds for a key
-// Returns -1 if key doesn't exist or has no expiration, otherwise returns remaining seconds
-int KVStore::ttl(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    check_and_remove_expired(key);
-    if (store_.find(key) == store_.end()) {
+// Returns -2 if key doesn't exist, -1 if it has no expiration, otherwise remaining seconds
+int64_t KVStore::ttl(const std::string& key) {
+    int64_t remaining_ms = pttl(key);
+    if (remaining_ms < 0) {
+        return remaining_ms;
+    }
+    return (remaining_ms + 500) / 1000;
+}
+
+// PTTL returns time-to-live in milliseconds for a key
+// Returns -2 if key doesn't exist, -1 if it has no expiration, otherwise remaining milliseconds
+int64_t KVStore::pttl(const std::string& key) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    check_and_remove_expired(shard, key);
+    auto hit = shard.store.find(key);
+    if (!hit) {
         return -2; // Key doesn't exist
     }
-    auto exp_it = expirations_.find(key);
-    if (exp_it == expirations_.end()) {
+    if (hit.value->expire_at_ms == 0) {
         return -1; // No expiration set
     }
-    time_t now = time(nullptr);
-    int remaining = static_cast<int>(exp_it->second - now);
+    int64_t remaining = hit.value->expire_at_ms - now_ms();
     return remaining > 0 ? remaining : -2; // -2 if already expired (shouldn't happen after check)
 }
 
-// SIZE returns the number of keys in the store
+// SIZE returns the number of keys in the store (summed shard by shard)
 size_t KVStore::size() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return store_.size();
+    size_t total = 0;
+    for (const auto& shard_ptr : shards_) {
+        std::lock_guard<ShardMutex> lock(shard_ptr->mutex);
+        total += shard_ptr->store.size();
+    }
+    return total;
 }
 
 // SAVE writes the store to a file in simple format: key=value (one per line)
 void KVStore::save_to_file(const std::string& filename) const {
-    std::lock_guard<std::mutex> lock(mutex_);
     std::ofstream file(filename);
     if (!file.is_open()) {
         return;
     }
-    for (const auto& pair : store_) {
-        // Escape newlines and = in key/value
-        std::string key = pair.first;
-        std::string value = pair.second;
-        std::replace(key.begin(), key.end(), '\n', ' ');
-        std::replace(key.begin(), key.end(), '=', ' ');
-        std::replace(value.begin(), value.end(), '\n', ' ');
-        std::replace(value.begin(), value.end(), '=', ' ');
-        file << key << "=" << value << "\n";
+    for (const auto& shard_ptr : shards_) {
+        std::lock_guard<ShardMutex> lock(shard_ptr->mutex);
+        shard_ptr->store.for_each([&](const Entry* entry) {
+            if (!is_string(*entry)) {
+                return; // The text format only holds strings
+            }
+            // Escape newlines and = in key/value
+            std::string key(entry->key());
+            std::string value = copy_value(*entry);
+            std::replace(key.begin(), key.end(), '\n', ' ');
+            std::replace(key.begin(), key.end(), '=', ' ');
+            std::replace(value.begin(), value.end(), '\n', ' ');
+            std::replace(value.begin(), value.end(), '=', ' ');
+            file << key << "=" << value << "\n";
+        });
     }
 }
 
 // LOAD reads the store from a file
 void KVStore::load_from_file(const std::string& filename) {
-    std::lock_guard<std::mutex> lock(mutex_);
     std::ifstream file(filename);
     if (!file.is_open()) {
         return;
@@ -183,80 +1448,288 @@ void KVStore::load_from_file(const std::string& filename) {
     while (std::getline(file, line)) {
         size_t pos = line.find('=');
         if (pos != std::string::npos && pos > 0 && pos < line.length() - 1) {
-            std::string key = line.substr(0, pos);
-            std::string value = line.substr(pos + 1);
-            store_[key] = value;
-            update_lru(key);
+            std::string_view key = std::string_view(line).substr(0, pos);
+            std::string_view value = std::string_view(line).substr(pos + 1);
+            Shard& shard = shard_for(key);
+            std::lock_guard<ShardMutex> lock(shard.mutex);
+            assign_value(shard, upsert(shard, key, value), value);
+            evict_if_needed(shard);
         }
     }
-    evict_if_needed();
 }
 
-// SAVE_TO_RDB writes the store to a file in binary RDB format
-// Format: [num_keys: uint32] then for each key:
-//   [key_length: uint32][key_bytes][value_length: uint32][value_bytes][expiry_timestamp: int64]
-// Returns true on success, false on error
-bool KVStore::save_to_rdb(const std::string& filename) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    // Clean expired keys first to avoid saving them
-    std::vector<std::string> keys_to_check;
-    for (const auto& pair : store_) {
-        keys_to_check.push_back(pair.first);
+// SAVE_TO_RDB writes the store to a file in the RDB v3 format (see RDB_MAGIC)
+// The keys come from a point-in-time snapshot, so writes are only held up for
+// one chunk at a time; the file appears under its name once complete
+// Returns true on success, false on error (or if a snapshot is already open)
+bool KVStore::save_to_rdb(const std::string& filename) {
+    SnapshotCursor cursor;
+    if (!begin_snapshot(cursor)) {
+        return false;
     }
-    for (const auto& key : keys_to_check) {
-        const_cast<KVStore*>(this)->check_and_remove_expired(key);
+    return write_snapshot(cursor, filename);
+}
+
+bool KVStore::write_snapshot(SnapshotCursor& cursor, const std::string& filename) {
+    return write_rdb({this}, &cursor, filename);
+}
+
+bool KVStore::write_snapshots(std::vector<KVStore>& dbs, std::vector<SnapshotCursor>& cursors,
+                              const std::string& filename) {
+    std::vector<KVStore*> stores;
+    for (KVStore& db : dbs) {
+        stores.push_back(&db);
     }
-    
-    std::ofstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        return false;
+    return write_rdb(stores, cursors.data(), filename);
+}
+
+// Database i's records are read from cursors[i]; every snapshot is closed
+bool KVStore::write_rdb(const std::vector<KVStore*>& dbs, SnapshotCursor* cursors, const std::string& filename) {
+    const std::string temp = filename + ".tmp." + std::to_string(++rdb_temp_serial);
+    bool ok = true;
+    {
+        RdbWriter out(temp);
+        std::vector<SnapshotEntry> chunk;
+        for (size_t db = 0; db < dbs.size() && ok; ++db) {
+            out.begin_db(db);
+            bool more = true;
+            while (more && out.good()) {
+                more = dbs[db]->next_snapshot_chunk(cursors[db], chunk);
+                for (const SnapshotEntry& e : chunk) {
+                    out.put_record(e);
+                }
+                chunk.clear();
+            }
+            ok = !more;
+        }
+        ok = ok && out.finish();
     }
-    
-    // Write number of keys
-    uint32_t num_keys = static_cast<uint32_t>(store_.size());
-    file.write(reinterpret_cast<const char*>(&num_keys), sizeof(uint32_t));
-    
-    if (!file.good()) {
-        return false;
+    for (size_t db = 0; db < dbs.size(); ++db) {
+        dbs[db]->end_snapshot(cursors[db]);
     }
-    
-    // Write each key-value pair
-    for (const auto& pair : store_) {
-        const std::string& key = pair.first;
-        const std::string& value = pair.second;
-        
-        // Write key length and key bytes
-        uint32_t key_len = static_cast<uint32_t>(key.size());
-        file.write(reinterpret_cast<const char*>(&key_len), sizeof(uint32_t));
-        file.write(key.c_str(), key_len);
-        
-        // Write value length and value bytes
-        uint32_t value_len = static_cast<uint32_t>(value.size());
-        file.write(reinterpret_cast<const char*>(&value_len), sizeof(uint32_t));
-        file.write(value.c_str(), value_len);
-        
-        // Write expiration timestamp (0 if no expiration)
-        int64_t expiry = 0;
-        auto exp_it = expirations_.find(key);
-        if (exp_it != expirations_.end()) {
-            expiry = static_cast<int64_t>(exp_it->second);
+
+    if (ok) {
+        ok = replace_file(temp, filename);
+    }
+    if (ok) {
+        for (KVStore* db : dbs) {
+            db->last_save_time_.store(static_cast<int64_t>(time(nullptr)));
         }
-        file.write(reinterpret_cast<const char*>(&expiry), sizeof(int64_t));
-        
-        if (!file.good()) {
-            return false;
+    } else {
+        std::remove(temp.c_str());
+    }
+    return ok;
+}
+
+// BGSAVE takes the snapshot here, so it reflects the moment the command ran,
+// and leaves reading and writing it to a background thread
+bool KVStore::bgsave_to_rdb(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(bgsave_mutex_);
+    if (bgsave_running_.load()) {
+        return false;
+    }
+    if (bgsave_thread_.joinable()) {
+        bgsave_thread_.join(); // The previous save has finished
+    }
+    SnapshotCursor cursor;
+    if (!begin_snapshot(cursor)) {
+        return false; // A foreground SAVE is running
+    }
+    bgsave_running_.store(true);
+    bgsave_thread_ = std::thread([this, cursor, filename]() mutable {
+        last_bgsave_ok_.store(write_snapshot(cursor, filename));
+        bgsave_running_.store(false);
+    });
+    return true;
+}
+
+// The save of every database runs on the first one's BGSAVE thread
+bool KVStore::bgsave_snapshots(std::vector<KVStore>& dbs, std::vector<SnapshotCursor> cursors,
+                               const std::string& filename) {
+    KVStore& owner = dbs.front();
+    std::lock_guard<std::mutex> lock(owner.bgsave_mutex_);
+    if (owner.bgsave_running_.load()) {
+        for (size_t db = 0; db < dbs.size(); ++db) {
+            dbs[db].end_snapshot(cursors[db]);
         }
+        return false;
     }
-    
+    if (owner.bgsave_thread_.joinable()) {
+        owner.bgsave_thread_.join(); // The previous save has finished
+    }
+    owner.bgsave_running_.store(true);
+    owner.bgsave_thread_ = std::thread([&dbs, &owner, cursors, filename]() mutable {
+        owner.last_bgsave_ok_.store(write_snapshots(dbs, cursors, filename));
+        owner.bgsave_running_.store(false);
+    });
     return true;
 }
 
 // LOAD_FROM_RDB reads the store from a file in binary RDB format
 // Returns true on success, false on error
 bool KVStore::load_from_rdb(const std::string& filename) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
+    mini_redis::MappedFile file;
+    if (!file.open(filename)) {
+        return false;
+    }
+    if (file.size() >= RDB_HEADER_BYTES && std::memcmp(file.data(), RDB_MAGIC, sizeof(RDB_MAGIC)) == 0) {
+        return load_rdb_v2({this}, file.data(), file.size());
+    }
+    file.close();
+    return load_rdb_v1(filename);
+}
+
+bool KVStore::load_databases_from_rdb(std::vector<KVStore>& dbs, const std::string& filename) {
+    mini_redis::MappedFile file;
+    if (dbs.empty() || !file.open(filename)) {
+        return false;
+    }
+    if (file.size() >= RDB_HEADER_BYTES && std::memcmp(file.data(), RDB_MAGIC, sizeof(RDB_MAGIC)) == 0) {
+        std::vector<KVStore*> stores;
+        for (KVStore& db : dbs) {
+            stores.push_back(&db);
+        }
+        return load_rdb_v2(stores, file.data(), file.size());
+    }
+    file.close();
+    return dbs.front().load_rdb_v1(filename); // Version 1 has database 0 only
+}
+
+// Versions 2 to 4: verify the index, then decode chunks in parallel in two passes.
+// The first checks each chunk's CRC and sorts its records by target shard;
+// nothing is stored unless every chunk is intact and its database is among
+// dbs. The second gives each shard to one thread, which reserves room for all
+// of its keys up front and inserts them without contending with the other
+// loaders.
+bool KVStore::load_rdb_v2(const std::vector<KVStore*>& dbs, const char* data, size_t size) {
+    if (size < RDB_HEADER_BYTES + RDB_FOOTER_BYTES) {
+        return false;
+    }
+    const uint32_t version = read_raw<uint32_t>(data + sizeof(RDB_MAGIC));
+    if (version != RDB_VERSION && version != RDB_VERSION_ONE_DB && version != RDB_VERSION_STRINGS) {
+        return false;
+    }
+    const size_t entry_bytes = version == RDB_VERSION ? RDB_INDEX_ENTRY_BYTES : RDB_INDEX_ENTRY_BYTES_ONE_DB;
+    const char* footer = data + size - RDB_FOOTER_BYTES;
+    const uint64_t index_offset = read_raw<uint64_t>(footer);
+    const uint64_t chunk_count = read_raw<uint64_t>(footer + 8);
+    const uint64_t index_end = size - RDB_FOOTER_BYTES;
+    if (index_offset < RDB_HEADER_BYTES || index_offset > index_end ||
+        (index_end - index_offset) / entry_bytes != chunk_count || (index_end - index_offset) % entry_bytes != 0) {
+        return false;
+    }
+    uint64_t crc = mini_redis::crc64(0, data, RDB_HEADER_BYTES);
+    crc = mini_redis::crc64(crc, data + index_offset, index_end - index_offset + 16);
+    if (crc != read_raw<uint64_t>(footer + 16)) {
+        return false;
+    }
+
+    std::vector<RdbChunk> chunks(static_cast<size_t>(chunk_count));
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        const char* entry = data + index_offset + i * entry_bytes;
+        chunks[i] = RdbChunk{read_raw<uint64_t>(entry), read_raw<uint64_t>(entry + 8),
+                             read_raw<uint64_t>(entry + 16), read_raw<uint64_t>(entry + 24),
+                             version == RDB_VERSION ? read_raw<uint64_t>(entry + 32) : 0};
+        const RdbChunk& c = chunks[i];
+        if (c.offset < RDB_HEADER_BYTES || c.offset > index_offset || c.length > index_offset - c.offset ||
+            c.length > UINT32_MAX || c.db >= dbs.size()) {
+            return false;
+        }
+    }
+
+    // Pass 1: per chunk, the offsets of its live records bucketed by shard
+    // of the chunk's database
+    const int64_t now = now_ms();
+    std::vector<std::vector<std::vector<uint32_t>>> by_shard(chunks.size());
+    std::atomic<bool> intact{true};
+    parallel_for(chunks.size(), [&](size_t i) {
+        const RdbChunk& c = chunks[i];
+        const char* base = data + c.offset;
+        if (mini_redis::crc64(0, base, c.length) != c.crc) {
+            intact = false;
+            return;
+        }
+        const size_t num_shards = dbs[c.db]->shards_.size();
+        std::vector<std::vector<uint32_t>>& buckets = by_shard[i];
+        buckets.resize(num_shards);
+        uint64_t pos = 0;
+        uint64_t keys = 0;
+        while (pos < c.length) {
+            const uint64_t record_len = record_length(base + pos, c.length - pos);
+            if (record_len == 0) {
+                intact = false;
+                return;
+            }
+            const Record record = read_record(base + pos);
+            // Keys that expired while the server was down are dropped
+            if (record.expire_at_ms == 0 || record.expire_at_ms > now) {
+                // Hashes the same as the std::string key would in shard_index
+                buckets[std::hash<std::string_view>{}(record.key) % num_shards].push_back(static_cast<uint32_t>(pos));
+            }
+            pos += record_len;
+            ++keys;
+        }
+        if (keys != c.keys) {
+            intact = false;
+        }
+    });
+    if (!intact) {
+        return false;
+    }
+
+    // Pass 2: one thread per shard at a time (shards of every database)
+    std::vector<std::pair<size_t, size_t>> targets; // (db, shard)
+    for (size_t db = 0; db < dbs.size(); ++db) {
+        for (size_t s = 0; s < dbs[db]->shards_.size(); ++s) {
+            targets.emplace_back(db, s);
+        }
+    }
+    parallel_for(targets.size(), [&](size_t t) {
+        const size_t db = targets[t].first;
+        const size_t s = targets[t].second;
+        KVStore& store = *dbs[db];
+        Shard& shard = *store.shards_[s];
+        size_t incoming = 0;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            if (chunks[i].db == db) {
+                incoming += by_shard[i][s].size();
+            }
+        }
+        if (incoming == 0) {
+            return;
+        }
+        std::unique_lock<ShardMutex> lock(shard.mutex);
+        shard.store.reserve(shard.store.size() + incoming);
+        size_t inserted = 0;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            if (chunks[i].db != db) {
+                continue;
+            }
+            const char* base = data + chunks[i].offset;
+            for (uint32_t pos : by_shard[i][s]) {
+                const Record record = read_record(base + pos);
+                std::unique_ptr<Collection> collection;
+                if (record.type != ValueType::String) {
+                    collection = Collection::restore(record.type, record.value);
+                    if (!collection) {
+                        continue; // Its elements are malformed; the rest of the file is not
+                    }
+                }
+                store.store_loaded(shard, record.key, record.value, std::move(collection), record.expire_at_ms);
+                // Let clients in between batches
+                if (++inserted % LOAD_BATCH_KEYS == 0) {
+                    lock.unlock();
+                    lock.lock();
+                }
+            }
+        }
+    });
+    return true;
+}
+
+// Version 1: [num_keys: uint32] then for each key:
+//   [key_length: uint32][key_bytes][value_length: uint32][value_bytes][expiry_timestamp: int64 seconds]
+bool KVStore::load_rdb_v1(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary);
     if (!file.is_open()) {
         return false;
@@ -307,46 +1780,63 @@ bool KVStore::load_from_rdb(const std::string& filename) {
             return false;
         }
         
-        // Store key-value
-        store_[key] = value;
-        update_lru(key);
-        
-        // Set expiration if timestamp > 0
-        if (expiry > 0) {
-            time_t now = time(nullptr);
-            if (expiry > now) {
-                expirations_[key] = static_cast<time_t>(expiry);
-            }
+        // Keys that expired while the server was down are dropped
+        int64_t expire_at_ms = expiry > 0 ? expiry * 1000 : 0;
+        if (expire_at_ms != 0 && expire_at_ms <= now_ms()) {
+            continue;
         }
+        
+        // Store key-value in its shard
+        Shard& shard = shard_for(key);
+        std::lock_guard<ShardMutex> lock(shard.mutex);
+        Entry& entry = upsert(shard, key, value);
+        assign_value(shard, entry, value);
+        place_in_expiry_heap(shard, entry, expire_at_ms);
+        evict_if_needed(shard);
     }
     
-    evict_if_needed();
     return true;
 }
 
 std::pair<int64_t, std::string> KVStore::incrby(const std::string& key, int64_t delta) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    check_and_remove_expired(key);
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    check_and_remove_expired(shard, key);
     
     int64_t current = 0;
-    auto it = store_.find(key);
-    if (it != store_.end()) {
-        // Parse existing value
-        try {
-            size_t pos = 0;
-            current = std::stoll(it->second, &pos);
-            if (pos != it->second.size()) {
+    auto hit = shard.store.find(key);
+    if (hit) {
+        Entry& entry = *hit.value;
+        if (entry.encoding == Encoding::Int) {
+            current = entry.integer; // The common case: no parsing
+        } else if (!is_string(entry)) {
+            return {0, WRONGTYPE_ERROR};
+        } else {
+            // A string value, e.g. "007", that parses as a number
+            const std::string value = copy_value(entry);
+            try {
+                size_t pos = 0;
+                current = std::stoll(value, &pos);
+                if (pos != value.size()) {
+                    return {0, "ERR value is not an integer"};
+                }
+            } catch (...) {
                 return {0, "ERR value is not an integer"};
             }
-        } catch (...) {
-            return {0, "ERR value is not an integer"};
         }
     }
     
+    if ((delta > 0 && current > INT64_MAX - delta) || (delta < 0 && current < INT64_MIN - delta)) {
+        return {0, "ERR increment or decrement would overflow"};
+    }
     int64_t result = current + delta;
-    store_[key] = std::to_string(result);
-    update_lru(key);
-    evict_if_needed();
+    if (hit) {
+        touch_lru(shard, *hit.value);
+        assign_integer(shard, *hit.value, result);
+    } else {
+        assign_integer(shard, upsert(shard, key), result);
+        evict_if_needed(shard);
+    }
     return {result, ""};
 }
 
@@ -359,33 +1849,151 @@ std::pair<int64_t, std::string> KVStore::decr(const std::string& key) {
 }
 
 std::pair<int64_t, std::string> KVStore::decrby(const std::string& key, int64_t delta) {
+    if (delta == INT64_MIN) {
+        return {0, "ERR increment or decrement would overflow"}; // -delta does not fit
+    }
     return incrby(key, -delta);
 }
 
-size_t KVStore::append(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    check_and_remove_expired(key);
+size_t KVStore::append(const std::string& key, const std::string& value, bool* wrong_type) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    check_and_remove_expired(shard, key);
     
-    auto it = store_.find(key);
-    if (it == store_.end()) {
-        store_[key] = value;
-        update_lru(key);
-        evict_if_needed();
+    auto hit = shard.store.find(key);
+    if (!hit) {
+        assign_value(shard, upsert(shard, key, value), value);
+        evict_if_needed(shard);
         return value.size();
     }
     
-    it->second += value;
-    update_lru(key);
-    return it->second.size();
+    Entry& entry = *hit.value;
+    if (!is_string(entry)) {
+        if (wrong_type) {
+            *wrong_type = true;
+        }
+        return 0;
+    }
+    preserve_for_snapshot(shard, entry);
+    size_t new_len = 0;
+    if (entry.encoding == Encoding::Raw) {
+        unshare_raw(shard, entry);
+        shard.used_memory -= string_heap_bytes(entry.raw->bytes);
+        entry.raw->bytes += value;
+        shard.used_memory += string_heap_bytes(entry.raw->bytes);
+        new_len = entry.raw->bytes.size();
+    } else {
+        // An integer becomes its digits; the result stays embedded if it fits
+        char digits[INT_DIGITS];
+        const std::string_view current = value_of(entry, digits);
+        new_len = current.size() + value.size();
+        if (new_len <= entry.embed_capacity) {
+            std::memmove(entry.embedded(), current.data(), current.size());
+            std::memcpy(entry.embedded() + current.size(), value.data(), value.size());
+            entry.encoding = Encoding::Embedded;
+            entry.embedded_len = static_cast<uint32_t>(new_len);
+        } else {
+            SharedValue* raw = new SharedValue();
+            raw->bytes.reserve(new_len);
+            raw->bytes.append(current).append(value);
+            entry.raw = raw;
+            entry.encoding = Encoding::Raw;
+            shard.used_memory += sizeof(SharedValue) + string_heap_bytes(raw->bytes);
+        }
+    }
+    touch_lru(shard, entry);
+    evict_if_needed(shard);
+    return new_len;
 }
 
-size_t KVStore::strlen(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    check_and_remove_expired(key);
+size_t KVStore::strlen(const std::string& key, bool* wrong_type) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    check_and_remove_expired(shard, key);
     
-    auto it = store_.find(key);
-    if (it == store_.end()) {
+    auto hit = shard.store.find(key);
+    if (!hit) {
         return 0;
     }
-    return it->second.size();
+    if (!is_string(*hit.value)) {
+        if (wrong_type) {
+            *wrong_type = true;
+        }
+        return 0;
+    }
+    char digits[INT_DIGITS];
+    return value_of(*hit.value, digits).size();
+}
+
+bool KVStore::type_of(const std::string& key, ValueType& out) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    Entry* entry = find_live(shard, key);
+    if (!entry) {
+        return false;
+    }
+    out = is_string(*entry) ? ValueType::String : entry->collection->type();
+    return true;
+}
+
+KVStore::Lookup KVStore::hset(const std::vector<std::string>& args, size_t& added) {
+    added = 0;
+    return update_collection<HashValue>(args[0], true, [&](HashValue& hash) {
+        for (size_t i = 1; i + 1 < args.size(); i += 2) {
+            added += hash.set(args[i], args[i + 1]);
+        }
+    });
+}
+
+KVStore::Lookup KVStore::push(const std::vector<std::string>& args, bool front, size_t& length) {
+    length = 0;
+    return update_collection<ListValue>(args[0], true, [&](ListValue& list) {
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (front) {
+                list.push_front(args[i]);
+            } else {
+                list.push_back(args[i]);
+            }
+        }
+        length = list.size();
+    });
+}
+
+KVStore::Lookup KVStore::rpop(const std::string& key, size_t count, std::vector<std::string>& out) {
+    return update_collection<ListValue>(key, false, [&](ListValue& list) {
+        std::string value;
+        while (out.size() < count && list.pop_back(value)) {
+            out.push_back(std::move(value));
+        }
+    });
+}
+
+KVStore::Lookup KVStore::sadd(const std::vector<std::string>& args, size_t& added) {
+    added = 0;
+    return update_collection<SetValue>(args[0], true, [&](SetValue& set) {
+        for (size_t i = 1; i < args.size(); ++i) {
+            added += set.add(args[i]);
+        }
+    });
+}
+
+KVStore::Lookup KVStore::zadd(const std::string& key, const ZAddArgs& zadd, size_t& added, size_t& changed) {
+    added = 0;
+    changed = 0;
+    // With XX a missing key stays missing
+    return update_collection<ZSetValue>(key, !(zadd.flags & ZSetValue::ADD_XX), [&](ZSetValue& zset) {
+        for (const auto& [score, member] : zadd.items) {
+            switch (zset.add(member, score, zadd.flags)) {
+                case ZSetValue::AddResult::Added:
+                    ++added;
+                    ++changed;
+                    break;
+                case ZSetValue::AddResult::Updated:
+                    ++changed;
+                    break;
+                case ZSetValue::AddResult::Unchanged:
+                    break;
+            }
+        }
+    });
 }
@@ -1,56 +1,577 @@
 // Key-Value storage implementation for Mini-Redis
-// Provides thread-safe in-memory storage with expiration, LRU eviction, and persistence
+// Sharded, thread-safe in-memory storage with expiration, eviction, collections and persistence
 
 #pragma once
 
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 #include <ctime>
-#include <list>
 #include <cstdint>
 #include <utility>
+#include <memory>
+#include <chrono>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <type_traits>
+
+#include "swiss_table.hpp"
+#include "shared_value.hpp"
+#include "collections.hpp"
+
+class LazyFreer;
+
+// Told when a key that clients may have cached changes (CLIENT TRACKING)
+class KeyTracker {
+public:
+    virtual ~KeyTracker() = default;
+    // key was written, deleted, expired, evicted or flushed, or dropped from
+    // a full tracking table; clients are those that read it since its last
+    // invalidation (empty when only broadcast() asked for it). Called under
+    // the key's shard lock: must not block or call back into the store.
+    virtual void invalidate(std::string_view key, const std::vector<uint64_t>& clients) = 0;
+    // Whether every changed key is wanted, tracked or not (BCAST clients)
+    bool broadcast() const { return broadcast_.load(std::memory_order_relaxed); }
+
+    // The client whose command is changing the store on this thread, so
+    // NOLOOP can leave out what it changed (0 = none, e.g. an eviction)
+    static thread_local uint64_t writer;
+
+    // Sets writer for a scope and restores the previous one on exit
+    class WriterScope {
+    public:
+        explicit WriterScope(uint64_t client) : previous_(writer) { writer = client; }
+        ~WriterScope() { writer = previous_; }
+        WriterScope(const WriterScope&) = delete;
+        WriterScope& operator=(const WriterScope&) = delete;
+
+    private:
+        uint64_t previous_;
+    };
+
+protected:
+    std::atomic<bool> broadcast_{false};
+};
+
+// Which keys are candidates for eviction and how the victim is chosen
+enum class EvictionPolicy {
+    AllKeysLRU,  // Least recently used key (exact, from the LRU list)
+    VolatileLRU, // Least recently used among sampled keys with a TTL
+    AllKeysLFU,  // Least frequently used among sampled keys
+    VolatileTTL  // Soonest-to-expire among sampled keys with a TTL
+};
 
 class KVStore {
 public:
-    KVStore() = default;
+    using ShardMutex = std::recursive_mutex;
+
+    static const size_t DEFAULT_SHARD_COUNT = 16;
+    static const size_t DEFAULT_MAX_KEYS = 10000;
+    static const size_t DEFAULT_EVICTION_SAMPLES = 5;
+    // SCAN cursor layout: shard index in the top 16 bits, the low 16 bits of
+    // its hash table's id in the next 16, then the slot
+    static const unsigned SCAN_SHARD_SHIFT = 48;
+    static const unsigned SCAN_TABLE_BITS = 16;
+
+    // Reply to a command on a key holding another type
+    static constexpr const char* WRONGTYPE_ERROR =
+        "WRONGTYPE Operation against a key holding the wrong kind of value";
+
+    // A live key as copied out by snapshot_shard and next_snapshot_chunk
+    struct SnapshotEntry {
+        std::string key;
+        std::string value;    // A collection's Collection::dump listpack
+        int64_t expire_at_ms; // Absolute deadline, 0 = no TTL
+        ValueType type = ValueType::String;
+    };
+
+    // How a collection command found its key
+    enum class Lookup {
+        Found,
+        Missing,
+        WrongType // The key holds another type; nothing was changed
+    };
+
+    // Scan position of a point-in-time snapshot (see begin_snapshot)
+    struct SnapshotCursor {
+        uint32_t epoch = 0;     // Stamped on entries the snapshot no longer needs
+        int64_t taken_ms = 0;   // Snapshot time: keys expired by then are left out
+        size_t shard = 0;
+        uint64_t table = 0;      // Position in the shard's hash table
+        size_t slot = 0;
+    };
+
+    // Position of an incremental scan over the keyspace (see scan)
+    struct ScanCursor {
+        size_t shard = 0;
+        uint64_t table = 0;
+        size_t slot = 0;
+    };
+
+    explicit KVStore(size_t num_shards = DEFAULT_SHARD_COUNT);
+    ~KVStore();
+
+    // Rebuild the store with a new shard count, redistributing existing keys.
+    // Not safe against concurrent access: call only during startup.
+    void set_shard_count(size_t num_shards);
+    size_t shard_count() const { return shards_.size(); }
+    // Index of the shard owning a key
+    size_t shard_index(std::string_view key) const;
+    // Lock one shard for a caller running several commands as a unit (MULTI,
+    // EVAL). Shards must be locked in index order, as lock_batch does; the
+    // store's own methods take a held lock again without blocking.
+    std::unique_lock<ShardMutex> lock_shard(size_t index) const;
+
+    // WATCH: start / stop counting changes to key (calls nest, one count per
+    // key); the count is what watch_version returns. Any write to the key,
+    // its expiry or eviction, and a flush while it exists all change it.
+    uint64_t watch(const std::string& key);
+    void unwatch(const std::string& key);
+    uint64_t watch_version(const std::string& key);
+
+    // Client-side caching: remember that client read key, so tracker is told
+    // about its next change. At most max_keys keys are tracked (0 = no
+    // limit, split across shards); past that a tracked key is dropped at
+    // random and invalidated as if it changed. Call set_tracking only during
+    // startup. track takes the key's shard lock, so a caller already holding
+    // it (to read the key) cannot miss a change in between.
+    void set_tracking(KeyTracker* tracker, size_t max_keys);
+    void track(const std::string& key, uint64_t client);
+    size_t tracked_keys() const;
+
+    // Copy every live key of one shard under that shard's lock (for AOF rewrite)
+    void snapshot_shard(size_t index, std::vector<SnapshotEntry>& out) const;
+
+    // Point-in-time snapshot of the whole store, read a chunk at a time while
+    // writes go on. Until the scan has passed a key, the first change to it
+    // copies its old state aside, so every key is seen as it was at
+    // begin_snapshot. One snapshot at a time: begin returns false if one is open.
+    bool begin_snapshot(SnapshotCursor& cursor);
+    // Append up to about max_entries keys to out, holding one shard lock at a
+    // time. Returns false once the whole store has been read.
+    bool next_snapshot_chunk(SnapshotCursor& cursor, std::vector<SnapshotEntry>& out,
+                             size_t max_entries = 1024);
+    void end_snapshot(SnapshotCursor& cursor);
+    // Write an open snapshot out as an RDB file, then close it
+    bool write_snapshot(SnapshotCursor& cursor, const std::string& filename);
+
+    // Configure eviction limits for the whole store (0 disables a limit).
+    // Limits are split evenly across shards. Call only during startup.
+    void set_eviction_limits(size_t max_keys, size_t maxmemory,
+                             EvictionPolicy policy = EvictionPolicy::AllKeysLRU,
+                             size_t samples = DEFAULT_EVICTION_SAMPLES);
+    EvictionPolicy eviction_policy() const { return policy_; }
 
+    // Free values of at least min_size bytes removed by UNLINK, eviction or
+    // expiry on freer's thread, as well as everything clear_async removes
+    // (nullptr = free everything inline; min_size 0 = only clear_async).
+    // Call only during startup.
+    void set_lazy_free(LazyFreer* freer, size_t min_size);
+    size_t maxmemory() const { return maxmemory_; }
+
+    // Policy names as used in config files (e.g. "allkeys-lru")
+    static bool parse_eviction_policy(const std::string& name, EvictionPolicy& out);
+    static const char* eviction_policy_name(EvictionPolicy policy);
+
+    // Accounted bytes for keys, values and container overhead
+    size_t used_memory() const;
+    // Number of keys removed to satisfy max_keys / maxmemory
+    uint64_t evicted_keys() const;
+    // Number of keys removed because their TTL elapsed (lazily or actively)
+    uint64_t expired_keys() const;
+
+    // Active expiration: pop due keys from the shards' expiry heaps, resuming
+    // where the previous call stopped, until no key is due or the budget is spent.
+    // Returns the number of keys removed.
+    size_t active_expire_cycle(std::chrono::microseconds budget);
+
+    // Wall-clock time in milliseconds since the Unix epoch
+    static int64_t now_ms();
+
+    // SET replaces a value of any type
     void set(const std::string& key, const std::string& value);
+    // False if the key is missing or not a string
     bool get(const std::string& key, std::string& outValue);
+    // Call fn(std::string_view value) under the shard lock if the key is live,
+    // so a reply can be serialized from the stored value without copying it out.
+    // fn may also take a second const SharedValue* argument: set when the value
+    // is reference-counted, so fn can keep a ValueRef to it past the lock.
+    // A key holding a collection is not passed to fn and sets *wrong_type.
+    template <typename Fn>
+    bool read_value(const std::string& key, Fn&& fn, bool* wrong_type = nullptr);
     bool del(const std::string& key);
     bool exists(const std::string& key);
-    std::vector<std::string> keys();
-    bool expire(const std::string& key, int seconds);
-    int ttl(const std::string& key);
+    // Batch commands: the keys' shards are locked once each, in index order,
+    // and held for the whole batch, so other commands see all of it or none.
+    // pairs alternates key, value; a key given twice takes its last value.
+    void mset(const std::vector<std::string>& pairs);
+    // MSETNX: set every pair only if none of the keys exists
+    bool msetnx(const std::vector<std::string>& pairs);
+    // Number of keys removed (a key given twice is removed once)
+    size_t del_many(const std::vector<std::string>& keys);
+    // del_many, with large values left to the lazy freer
+    size_t unlink_many(const std::vector<std::string>& keys);
+    // Number of keys that exist (a key given twice counts twice)
+    size_t exists_many(const std::vector<std::string>& keys);
+    // Call fn(std::string_view value) for each live string key and missing()
+    // for each other one, in key order
+    template <typename Fn, typename Missing>
+    void read_values(const std::vector<std::string>& keys, Fn&& fn, Missing&& missing);
+    // Every live key that filter accepts (all if none)
+    std::vector<std::string> keys(const std::function<bool(std::string_view)>& filter = nullptr);
+    bool expire(const std::string& key, int64_t seconds);
+    bool pexpire(const std::string& key, int64_t milliseconds);
+    // Expire at an absolute Unix time in milliseconds
+    bool pexpireat(const std::string& key, int64_t unix_ms);
+    int64_t ttl(const std::string& key);
+    int64_t pttl(const std::string& key);
     size_t size() const;
+    // TYPE: the type of a live key; false if there is none
+    bool type_of(const std::string& key, ValueType& out);
+    // Remove every key (an open snapshot still sees them)
+    void clear();
+    // clear, but only unlink the keys under the locks: the lazy freer frees them
+    void clear_async();
+    // Visit about count more entries from cursor, appending the live keys that
+    // filter accepts (all if none) to keys, one shard lock at a time and at
+    // most SCAN_LOCK_ENTRIES entries per lock. A key present for the whole scan
+    // is returned at least once, however the tables are resized in between.
+    // Returns false once the scan is complete.
+    bool scan(ScanCursor& cursor, size_t count, std::vector<std::string>& keys,
+              const std::function<bool(std::string_view)>& filter = nullptr);
+    // SCAN: scan from a cursor packed into one integer (0 = start), returning
+    // the cursor to continue from (0 once the scan is complete). A cursor whose
+    // table has since been freed resumes at the start of its shard.
+    uint64_t scan(uint64_t cursor, size_t count, std::vector<std::string>& keys,
+                  const std::function<bool(std::string_view)>& filter = nullptr);
+    // Key migration in RDB record encoding (the records of an RDB chunk):
+    // append the live keys among keys to out, returning how many there were
+    size_t dump_records(const std::vector<std::string>& keys, std::string& out);
+    // Store every record of data, replacing existing keys. Returns false, and
+    // stores nothing, if data is malformed.
+    bool restore_records(std::string_view data, size_t* restored = nullptr);
     void save_to_file(const std::string& filename) const;
     void load_from_file(const std::string& filename);
-    bool save_to_rdb(const std::string& filename) const;
+    // Write a point-in-time snapshot to filename (via a temporary file and a
+    // rename). Fails if a background save is running.
+    bool save_to_rdb(const std::string& filename);
     bool load_from_rdb(const std::string& filename);
 
+    // BGSAVE: save_to_rdb on a background thread. Returns false if a save is running.
+    bool bgsave_to_rdb(const std::string& filename);
+    bool bgsave_in_progress() const { return bgsave_running_.load(); }
+    bool last_bgsave_ok() const { return last_bgsave_ok_.load(); }
+    // Unix time of the last successful save, 0 if none
+    int64_t last_save_time() const { return last_save_time_.load(); }
+    // SAVE / BGSAVE / LOAD of every database in one file: cursors[i] is an
+    // open snapshot of dbs[i], taken at the same moment as the others; each
+    // chunk of the file records which database it belongs to. The snapshots
+    // are closed whether or not the save succeeds (or, in the background, starts).
+    static bool write_snapshots(std::vector<KVStore>& dbs, std::vector<SnapshotCursor>& cursors,
+                                const std::string& filename);
+    static bool bgsave_snapshots(std::vector<KVStore>& dbs, std::vector<SnapshotCursor> cursors,
+                                 const std::string& filename);
+    // Fails, storing nothing, if the file holds a database past the end of dbs
+    static bool load_databases_from_rdb(std::vector<KVStore>& dbs, const std::string& filename);
+
     // Atomic counter commands
     std::pair<int64_t, std::string> incr(const std::string& key);
     std::pair<int64_t, std::string> decr(const std::string& key);
     std::pair<int64_t, std::string> incrby(const std::string& key, int64_t delta);
     std::pair<int64_t, std::string> decrby(const std::string& key, int64_t delta);
 
-    // String commands
-    size_t append(const std::string& key, const std::string& value);
-    size_t strlen(const std::string& key);
+    // String commands (a key holding a collection sets *wrong_type)
+    size_t append(const std::string& key, const std::string& value, bool* wrong_type = nullptr);
+    size_t strlen(const std::string& key, bool* wrong_type = nullptr);
+
+    // Collection writes. args are the command's arguments, key first. A
+    // collection is created by its first write and removed with its last element.
+    // HSET key field value [field value ...]: added = fields that were new
+    Lookup hset(const std::vector<std::string>& args, size_t& added);
+    // LPUSH / RPUSH key value [value ...]: length = the list's length after
+    Lookup push(const std::vector<std::string>& args, bool front, size_t& length);
+    // RPOP: up to count values from the tail, last first
+    Lookup rpop(const std::string& key, size_t count, std::vector<std::string>& out);
+    // SADD key member [member ...]: added = members that were new
+    Lookup sadd(const std::vector<std::string>& args, size_t& added);
+    // ZADD: added = new members, changed = new or rescored members
+    Lookup zadd(const std::string& key, const ZAddArgs& zadd, size_t& added, size_t& changed);
+    // Collection reads: call fn(const T&) under the shard lock if the key holds
+    // a T (HashValue, ListValue...), so a reply is written from it in place
+    template <typename T, typename Fn>
+    Lookup read_collection(const std::string& key, Fn&& fn);
 
 private:
-    // Check if key is expired and remove it if so (must be called with lock held)
-    void check_and_remove_expired(const std::string& key);
-    // Update LRU access order (must be called with lock held)
-    void update_lru(const std::string& key);
-    // Evict oldest key if store exceeds threshold (must be called with lock held)
-    void evict_if_needed();
-
-    std::unordered_map<std::string, std::string> store_;
-    std::unordered_map<std::string, time_t> expirations_; // Key -> expiration timestamp
-    std::list<std::string> lru_order_; // Most recent at front, oldest at back
-    std::unordered_map<std::string, std::list<std::string>::iterator> lru_map_; // Key -> position in lru_order_
-    mutable std::mutex mutex_;
-    static const size_t MAX_KEYS = 10000; // LRU eviction threshold
+    static const uint32_t NOT_IN_HEAP = UINT32_MAX;
+    static const size_t INT_DIGITS = 24; // Buffer size for formatting an int64 value
+
+    // How an entry holds its value
+    enum class Encoding : uint8_t {
+        Int,      // A canonical decimal integer, kept as an int64
+        Embedded, // Bytes in the entry's own allocation, right after the key
+        Raw,      // A separate reference-counted string (too long for the room after the key)
+        Collection // A hash, list, set or sorted set, owned by the entry
+    };
+
+    // One key: this header, then the key bytes, then embed_capacity bytes of
+    // room for a short value, all in a single allocation. Entries never move,
+    // so the LRU links, heap slots and the map's key view stay valid until erase.
+    struct Entry {
+        Entry* lru_prev = nullptr;   // Towards the most recently used end
+        Entry* lru_next = nullptr;   // Towards the least recently used end
+        int64_t expire_at_ms = 0;    // Absolute deadline, 0 = no TTL
+        union {
+            int64_t integer = 0;     // Encoding::Int
+            uint32_t embedded_len;   // Encoding::Embedded
+            SharedValue* raw;        // Encoding::Raw
+            ::Collection* collection; // Encoding::Collection
+        };
+        uint32_t heap_index = NOT_IN_HEAP; // Position in the shard's expiry heap
+        uint32_t lru_clock = 0;      // Shard access clock at last touch (wraps)
+        uint32_t snapshot_epoch = 0; // Snapshot that already has this key's state (or never needs it)
+        uint32_t key_len = 0;
+        uint32_t embed_capacity = 0; // Value bytes that fit after the key
+        uint16_t lfu_minutes = 0;    // Minute stamp of the last LFU decay
+        uint8_t lfu_counter = 0;     // Logarithmic access frequency
+        Encoding encoding = Encoding::Embedded;
+
+        std::string_view key() const { return {reinterpret_cast<const char*>(this + 1), key_len}; }
+        char* embedded() { return reinterpret_cast<char*>(this + 1) + key_len; }
+        const char* embedded() const { return reinterpret_cast<const char*>(this + 1) + key_len; }
+    };
+
+    struct EntryKey {
+        std::string_view operator()(const Entry* entry) const { return entry->key(); }
+    };
+    using EntryMap = SwissTable<Entry, EntryKey>;
+
+    struct WatchedKey {
+        size_t watchers = 0;
+        uint64_t version = 0; // Bumped by every change
+    };
+
+    // One independently locked partition of the keyspace
+    struct Shard {
+        ~Shard();
+
+        EntryMap store;
+        std::vector<Entry*> expiry_heap; // Min-heap on expire_at_ms over keys with a TTL
+        Entry* lru_head = nullptr; // Most recently used
+        Entry* lru_tail = nullptr; // Least recently used (next eviction victim)
+        uint32_t lru_clock = 0;    // Bumped on every touch
+        uint64_t rng_state = 0x9E3779B97F4A7C15ULL; // xorshift state for sampling
+        size_t used_memory = 0;
+        uint64_t evicted_keys = 0;
+        uint64_t expired_keys = 0;
+        uint32_t snapshot_epoch = 0; // Open snapshot not yet through this shard (0 = none)
+        std::vector<SnapshotEntry> snapshot_undo; // Snapshot-time state of keys changed since
+        std::unordered_map<std::string, WatchedKey> watched; // Keys under WATCH
+        std::unordered_map<std::string, std::vector<uint64_t>> tracked; // Key -> clients caching it
+        mutable ShardMutex mutex;
+    };
+
+    // Select the shard owning a key
+    Shard& shard_for(std::string_view key);
+
+    // The locks a batch command holds: each shard its keys live in, once
+    struct BatchLock {
+        std::vector<Shard*> shard_of; // Per key
+        std::vector<std::unique_lock<ShardMutex>> locks;
+    };
+    // Lock the shards of keys[0], keys[stride], ... in index order, so two
+    // batches never wait on each other in a cycle
+    void lock_batch(const std::vector<std::string>& keys, size_t stride, BatchLock& batch);
+
+    // Allocate an entry for key with room to embed value_size bytes / free one
+    static Entry* new_entry(std::string_view key, size_t value_size);
+    static void free_entry(Entry* entry);
+    // Bytes an entry accounts for: its allocation plus any separate value
+    static size_t entry_bytes(const Entry& entry);
+    // A string entry's bytes (an Int is formatted into digits) / a copy of them
+    static std::string_view value_of(const Entry& entry, char (&digits)[INT_DIGITS]);
+    static std::string copy_value(const Entry& entry);
+    // An entry's state as a snapshot keeps it
+    static SnapshotEntry snapshot_of(const Entry& entry);
+    static bool is_string(const Entry& entry) { return entry.encoding != Encoding::Collection; }
+    // Hand a live entry's value to a read_value callback
+    template <typename Fn>
+    static void visit_value(const Entry& entry, Fn& fn, char (&digits)[INT_DIGITS]);
+
+    // Find or create the entry for a key, linking new entries into the LRU (lock
+    // held). A new entry has room to embed a value like value_hint.
+    Entry& upsert(Shard& shard, std::string_view key, std::string_view value_hint = {});
+    // Replace an entry's value and update the shard's memory accounting (lock
+    // held). Canonical integers are stored as Encoding::Int.
+    void assign_value(Shard& shard, Entry& entry, std::string_view value);
+    void assign_integer(Shard& shard, Entry& entry, int64_t value);
+    void assign_collection(Shard& shard, Entry& entry, std::unique_ptr<Collection> collection);
+    // Drop a Raw value's string or a collection, charging its bytes back to
+    // the shard (lock held)
+    void release_value(Shard& shard, Entry& entry);
+    // Make a Raw value safe to change in place, copying it if a reader holds a
+    // reference (lock held)
+    void unshare_raw(Shard& shard, Entry& entry);
+    // Set, move or clear (when_ms = 0) an entry's deadline in the expiry heap,
+    // as a change to the key (lock held)
+    void set_expiration(Shard& shard, Entry& entry, int64_t when_ms);
+    // The heap update alone, for callers that already recorded the change or
+    // are not changing the key (lock held)
+    void place_in_expiry_heap(Shard& shard, Entry& entry, int64_t when_ms);
+    void heap_sift_up(Shard& shard, size_t index);
+    void heap_sift_down(Shard& shard, size_t index);
+    // Copy an entry's state aside before its first change during a snapshot,
+    // count the change if the key is watched and invalidate it if it is
+    // tracked (lock held)
+    void preserve_for_snapshot(Shard& shard, Entry& entry);
+    // Remove an entry and all of its metadata (lock held). A lazy erase
+    // leaves a large value to the lazy freer.
+    void erase_entry(Shard& shard, const EntryMap::Hit& hit, bool lazy = true);
+    // Free an unlinked entry, on the lazy freer if lazy and its value is large
+    void dispose_entry(Entry* entry, bool lazy);
+    size_t remove_many(const std::vector<std::string>& keys, bool lazy);
+    // Look up a key, dropping it if expired (lock held). nullptr if absent.
+    Entry* find_live(Shard& shard, std::string_view key);
+    // Check if key is expired and remove it if so (must be called with shard lock held)
+    void check_and_remove_expired(Shard& shard, const std::string& key);
+    // Move an entry to the most recently used position: a pointer splice, no allocation
+    void touch_lru(Shard& shard, Entry& entry);
+    // Detach an entry from the LRU list (lock held)
+    void unlink_lru(Shard& shard, Entry& entry);
+    // Pick the next eviction victim under the configured policy, or nullptr (lock held)
+    Entry* pick_victim(Shard& shard);
+    // Evict until the shard is within its key and memory budgets (must be called with shard lock held)
+    void evict_if_needed(Shard& shard);
+    // Run fn(T&) on key's collection under its shard lock, creating an empty
+    // one first if the key is missing and create is set. Memory is charged
+    // for the change, and a collection left empty is removed with its key.
+    template <typename T, typename Fn>
+    Lookup update_collection(const std::string& key, bool create, Fn&& fn);
+    // Store a loaded or migrated key: a collection if one is given, else the
+    // string value (lock held)
+    void store_loaded(Shard& shard, std::string_view key, std::string_view value,
+                      std::unique_ptr<Collection> collection, int64_t expire_at_ms);
+    // Recompute per-shard budgets from the store-wide limits
+    void update_shard_limits();
+    // Decode a mapped version 2 or 3 file / read a version 1 file
+    // Chunks of database i go to dbs[i]
+    static bool load_rdb_v2(const std::vector<KVStore*>& dbs, const char* data, size_t size);
+    static bool write_rdb(const std::vector<KVStore*>& dbs, SnapshotCursor* cursors, const std::string& filename);
+    bool load_rdb_v1(const std::string& filename);
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<size_t> expire_cursor_{0}; // Next shard for active_expire_cycle
+    size_t max_keys_ = DEFAULT_MAX_KEYS; // Store-wide key limit (0 = unlimited)
+    size_t maxmemory_ = 0;               // Store-wide byte budget (0 = unlimited)
+    EvictionPolicy policy_ = EvictionPolicy::AllKeysLRU;
+    size_t samples_ = DEFAULT_EVICTION_SAMPLES;
+    size_t max_keys_per_shard_ = 0;
+    size_t maxmemory_per_shard_ = 0;
+    LazyFreer* lazy_freer_ = nullptr;
+    size_t lazy_free_min_size_ = 0; // 0 = single keys are freed inline
+    KeyTracker* tracker_ = nullptr;
+    size_t max_tracked_ = 0;           // Store-wide tracked key limit (0 = unlimited)
+    size_t max_tracked_per_shard_ = 0;
+
+    std::atomic<bool> snapshot_open_{false};
+    uint32_t snapshot_epochs_ = 0; // Last epoch handed out (guarded by snapshot_open_)
+    std::mutex bgsave_mutex_;      // Serializes starting and joining the BGSAVE thread
+    std::thread bgsave_thread_;
+    std::atomic<bool> bgsave_running_{false};
+    std::atomic<bool> last_bgsave_ok_{true};
+    std::atomic<int64_t> last_save_time_{0};
 };
+
+template <typename Fn>
+bool KVStore::read_value(const std::string& key, Fn&& fn, bool* wrong_type) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    Entry* entry = find_live(shard, key);
+    if (!entry) {
+        return false;
+    }
+    touch_lru(shard, *entry);
+    if (!is_string(*entry)) {
+        if (wrong_type) {
+            *wrong_type = true;
+        }
+        return false;
+    }
+    char digits[INT_DIGITS];
+    visit_value(*entry, fn, digits);
+    return true;
+}
+
+template <typename Fn, typename Missing>
+void KVStore::read_values(const std::vector<std::string>& keys, Fn&& fn, Missing&& missing) {
+    BatchLock batch;
+    lock_batch(keys, 1, batch);
+    char digits[INT_DIGITS];
+    for (size_t i = 0; i < keys.size(); ++i) {
+        Shard& shard = *batch.shard_of[i];
+        Entry* entry = find_live(shard, keys[i]);
+        if (!entry || !is_string(*entry)) {
+            missing();
+            continue;
+        }
+        touch_lru(shard, *entry);
+        visit_value(*entry, fn, digits);
+    }
+}
+
+template <typename T, typename Fn>
+KVStore::Lookup KVStore::read_collection(const std::string& key, Fn&& fn) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    Entry* entry = find_live(shard, key);
+    if (!entry) {
+        return Lookup::Missing;
+    }
+    if (is_string(*entry) || entry->collection->type() != T::TYPE) {
+        return Lookup::WrongType;
+    }
+    touch_lru(shard, *entry);
+    fn(static_cast<const T&>(*entry->collection));
+    return Lookup::Found;
+}
+
+template <typename T, typename Fn>
+KVStore::Lookup KVStore::update_collection(const std::string& key, bool create, Fn&& fn) {
+    Shard& shard = shard_for(key);
+    std::lock_guard<ShardMutex> lock(shard.mutex);
+    Entry* entry = find_live(shard, key);
+    if (entry && (is_string(*entry) || entry->collection->type() != T::TYPE)) {
+        return Lookup::WrongType;
+    }
+    if (entry) {
+        preserve_for_snapshot(shard, *entry);
+        touch_lru(shard, *entry);
+    } else if (create) {
+        entry = &upsert(shard, key);
+        assign_collection(shard, *entry, std::make_unique<T>());
+    } else {
+        return Lookup::Missing;
+    }
+
+    T& collection = static_cast<T&>(*entry->collection);
+    const size_t before = collection.memory();
+    fn(collection);
+    shard.used_memory = shard.used_memory - before + collection.memory();
+    if (collection.size() == 0) {
+        erase_entry(shard, shard.store.find(key), false);
+    } else {
+        evict_if_needed(shard);
+    }
+    return Lookup::Found;
+}
+
+template <typename Fn>
+void KVStore::visit_value(const Entry& entry, Fn& fn, char (&digits)[INT_DIGITS]) {
+    if constexpr (std::is_invocable_v<Fn&, std::string_view, const SharedValue*>) {
+        fn(value_of(entry, digits), entry.encoding == Encoding::Raw ? entry.raw : nullptr);
+    } else {
+        fn(value_of(entry, digits));
+    }
+}
@@ -0,0 +1,77 @@
+// Lazy free implementation
+// Jobs run in submission order on one thread; the queue is swapped out whole,
+// so producers contend for the lock only as long as a push takes
+
+#include "lazy_freer.hpp"
+
+LazyFreer::~LazyFreer() {
+    stop();
+}
+
+void LazyFreer::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    thread_ = std::thread(&LazyFreer::reclaim_thread_func, this);
+}
+
+void LazyFreer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    work_cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void LazyFreer::submit(Job job, size_t objects) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_) {
+            jobs_.emplace_back(std::move(job), objects);
+            pending_.fetch_add(objects, std::memory_order_relaxed);
+            if (jobs_.size() == 1) {
+                work_cv_.notify_one();
+            }
+            return;
+        }
+    }
+    job();
+}
+
+void LazyFreer::drain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return jobs_.empty() && !busy_; });
+}
+
+void LazyFreer::reclaim_thread_func() {
+    std::deque<std::pair<Job, size_t>> batch;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_cv_.wait(lock, [this] { return !jobs_.empty() || !running_; });
+        if (jobs_.empty()) {
+            break; // Stopping, and everything queued has been freed
+        }
+        batch.swap(jobs_);
+        busy_ = true;
+        lock.unlock();
+        for (auto& job : batch) {
+            job.first();
+            pending_.fetch_sub(job.second, std::memory_order_relaxed);
+            freed_.fetch_add(job.second, std::memory_order_relaxed);
+        }
+        batch.clear();
+        lock.lock();
+        busy_ = false;
+        if (jobs_.empty()) {
+            idle_cv_.notify_all();
+        }
+    }
+}
@@ -0,0 +1,58 @@
+// Lazy free for Mini-Redis
+// Background thread that releases memory the store has already unlinked, so
+// freeing a large value or a whole flushed database does not run on the
+// command's thread while other clients wait for its shard lock
+
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+class LazyFreer {
+public:
+    // Frees memory nothing can reach any more; it touches no shared state
+    using Job = std::function<void()>;
+
+    LazyFreer() = default;
+    ~LazyFreer();
+
+    LazyFreer(const LazyFreer&) = delete;
+    LazyFreer& operator=(const LazyFreer&) = delete;
+
+    // Start the background reclaimer thread
+    void start();
+
+    // Run every job still queued, then stop the thread
+    void stop();
+
+    // Queue job, which frees objects allocations (for INFO). Until start() and
+    // after stop() it runs right away on the caller's thread.
+    void submit(Job job, size_t objects = 1);
+
+    // Block until every job submitted so far has run
+    void drain();
+
+    // Objects queued but not freed yet / freed by the reclaimer so far
+    size_t pending_objects() const { return pending_.load(std::memory_order_relaxed); }
+    uint64_t freed_objects() const { return freed_.load(std::memory_order_relaxed); }
+
+private:
+    void reclaim_thread_func();
+
+    std::mutex mutex_;
+    std::condition_variable work_cv_; // Jobs queued, or stopping
+    std::condition_variable idle_cv_; // Queue emptied
+    std::deque<std::pair<Job, size_t>> jobs_;
+    bool running_ = false;
+    bool busy_ = false; // The thread is running a job taken off the queue
+    std::thread thread_;
+    std::atomic<size_t> pending_{0};
+    std::atomic<uint64_t> freed_{0};
+};
@@ -0,0 +1,178 @@
+// Packed string list implementation
+// Entry layout: [len: varint][bytes][backlen]. The varint is little-endian
+// base 128 with the high bit marking more bytes. backlen is the size of the
+// first two parts in the same groups of 7 bits, stored most significant first
+// with the high bit set on every byte but the first, so reading back from the
+// end of an entry stops at its first byte.
+
+#include "listpack.hpp"
+
+#include <cstring>
+
+namespace {
+
+size_t varint_size(uint64_t value) {
+    size_t bytes = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++bytes;
+    }
+    return bytes;
+}
+
+void put_varint(char* out, uint64_t value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    *out = static_cast<char>(value);
+}
+
+// Decode a varint from [p, p + limit); bytes read, or 0 if it does not fit
+size_t read_varint(const char* p, size_t limit, uint64_t& value) {
+    value = 0;
+    for (size_t i = 0; i < limit && i < 10; ++i) {
+        const uint8_t byte = static_cast<uint8_t>(p[i]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+void put_backlen(char* out, uint64_t value) {
+    const size_t bytes = varint_size(value);
+    for (size_t i = 0; i < bytes; ++i) {
+        // Group i (least significant first) goes i bytes back from the end
+        uint8_t byte = static_cast<uint8_t>((value >> (7 * i)) & 0x7F);
+        if (i + 1 < bytes) {
+            byte |= 0x80;
+        }
+        out[bytes - 1 - i] = static_cast<char>(byte);
+    }
+}
+
+// Decode the backlen that ends just before end (no earlier than start);
+// bytes read, or 0 if malformed
+size_t read_backlen(const char* start, const char* end, uint64_t& value) {
+    value = 0;
+    for (size_t i = 0; end - start > static_cast<ptrdiff_t>(i) && i < 10; ++i) {
+        const uint8_t byte = static_cast<uint8_t>(*(end - 1 - i));
+        value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+        if ((byte & 0x80) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+size_t string_heap_bytes(const std::string& s) {
+    static const size_t inline_capacity = std::string().capacity();
+    return s.capacity() > inline_capacity ? s.capacity() + 1 : 0;
+}
+
+} // anonymous namespace
+
+size_t Listpack::memory() const {
+    return string_heap_bytes(buf_);
+}
+
+std::string_view Listpack::at(size_t pos) const {
+    uint64_t len = 0;
+    const size_t header = read_varint(buf_.data() + pos, buf_.size() - pos, len);
+    return std::string_view(buf_.data() + pos + header, static_cast<size_t>(len));
+}
+
+size_t Listpack::next(size_t pos) const {
+    uint64_t len = 0;
+    const size_t header = read_varint(buf_.data() + pos, buf_.size() - pos, len);
+    const size_t body = header + static_cast<size_t>(len);
+    return pos + body + varint_size(body);
+}
+
+size_t Listpack::prev(size_t pos) const {
+    uint64_t body = 0;
+    const size_t back = read_backlen(buf_.data(), buf_.data() + pos, body);
+    return pos - back - static_cast<size_t>(body);
+}
+
+void Listpack::insert(size_t pos, std::string_view value) {
+    const size_t header = varint_size(value.size());
+    const size_t body = header + value.size();
+    const size_t total = body + varint_size(body);
+    buf_.insert(pos, total, '\0');
+    char* out = &buf_[pos];
+    put_varint(out, value.size());
+    std::memcpy(out + header, value.data(), value.size());
+    put_backlen(out + body, body);
+    ++count_;
+}
+
+void Listpack::replace(size_t pos, std::string_view value) {
+    const size_t old_end = next(pos);
+    const size_t header = varint_size(value.size());
+    const size_t body = header + value.size();
+    const size_t total = body + varint_size(body);
+    buf_.replace(pos, old_end - pos, total, '\0');
+    char* out = &buf_[pos];
+    put_varint(out, value.size());
+    std::memcpy(out + header, value.data(), value.size());
+    put_backlen(out + body, body);
+}
+
+void Listpack::erase(size_t pos, size_t count) {
+    size_t stop = pos;
+    for (size_t i = 0; i < count && stop != end(); ++i) {
+        stop = next(stop);
+        --count_;
+    }
+    buf_.erase(pos, stop - pos);
+    // Give back a buffer that has mostly emptied
+    if (buf_.capacity() > 256 && buf_.size() < buf_.capacity() / 4) {
+        buf_.shrink_to_fit();
+    }
+}
+
+void Listpack::clear() {
+    std::string().swap(buf_);
+    count_ = 0;
+}
+
+size_t Listpack::find(std::string_view value, size_t stride) const {
+    size_t pos = begin();
+    while (pos != end()) {
+        if (at(pos) == value) {
+            return pos;
+        }
+        for (size_t i = 0; i < stride && pos != end(); ++i) {
+            pos = next(pos);
+        }
+    }
+    return end();
+}
+
+bool Listpack::parse(std::string_view data, Listpack& out) {
+    size_t pos = 0;
+    size_t count = 0;
+    while (pos < data.size()) {
+        uint64_t len = 0;
+        const size_t header = read_varint(data.data() + pos, data.size() - pos, len);
+        if (header == 0 || len > data.size() - pos - header) {
+            return false;
+        }
+        const size_t body = header + static_cast<size_t>(len);
+        const size_t back = varint_size(body);
+        uint64_t stored = 0;
+        if (back > data.size() - pos - body ||
+            read_backlen(data.data() + pos + body, data.data() + pos + body + back, stored) != back ||
+            stored != body) {
+            return false;
+        }
+        pos += body + back;
+        ++count;
+    }
+    out.buf_.assign(data);
+    out.count_ = count;
+    return true;
+}
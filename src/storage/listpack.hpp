@@ -0,0 +1,64 @@
+// Packed string list for Mini-Redis
+// A Listpack keeps a short sequence of strings back to back in one buffer, in
+// the spirit of Redis's listpack: each entry is its length as a varint, the
+// bytes, then the size of those two written so it can be read from its end.
+// A small hash, set, sorted set or list node costs one allocation for all of
+// its elements and is walked front to back or back to front with no pointers.
+// Lookups are linear, so the collection types only use it below a few hundred
+// entries. Positions are byte offsets; any change may move the entries after
+// the one changed.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+class Listpack {
+public:
+    size_t size() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    // Heap bytes the buffer holds
+    size_t memory() const;
+
+    // Entry positions: begin() is the first entry, end() one past the last
+    size_t begin() const { return 0; }
+    size_t end() const { return buf_.size(); }
+    // The entry at pos, and the position after it / before it
+    std::string_view at(size_t pos) const;
+    size_t next(size_t pos) const;
+    size_t prev(size_t pos) const;
+    // The position of the last entry (end() if empty)
+    size_t last() const { return empty() ? end() : prev(end()); }
+
+    void push_back(std::string_view value) { insert(end(), value); }
+    void push_front(std::string_view value) { insert(begin(), value); }
+    // Add value before the entry at pos (at end() appends)
+    void insert(size_t pos, std::string_view value);
+    // Overwrite the entry at pos
+    void replace(size_t pos, std::string_view value);
+    // Remove count entries starting at pos
+    void erase(size_t pos, size_t count = 1);
+    void clear();
+
+    // Linear search for an entry equal to value, stepping `stride` entries at a
+    // time from begin() (2 to match only the keys of key/value pairs)
+    size_t find(std::string_view value, size_t stride = 1) const;
+
+    // The encoded entries, as persisted (see parse)
+    std::string_view data() const { return buf_; }
+    // Adopt encoded entries; false (and out unchanged) if they are malformed
+    static bool parse(std::string_view data, Listpack& out);
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (size_t pos = begin(); pos != end(); pos = next(pos)) {
+            fn(at(pos));
+        }
+    }
+
+private:
+    std::string buf_;
+    size_t count_ = 0;
+};
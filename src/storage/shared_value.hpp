@@ -0,0 +1,66 @@
+// Reference-counted value bytes for Mini-Redis
+// A value too long to embed in its entry lives in a SharedValue. A reader can
+// take a ValueRef to it under the shard lock and keep using the bytes after the
+// lock is released, e.g. to send a large GET reply straight from the store.
+// The store only changes a value in place while it holds the sole reference;
+// otherwise it swaps in a new SharedValue, so the bytes behind a ValueRef never
+// change. References are taken under the shard lock and may be dropped anywhere.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+struct SharedValue {
+    std::string bytes;
+    std::atomic<uint32_t> refs{1}; // The entry's reference plus any ValueRefs
+
+    SharedValue() = default;
+    explicit SharedValue(std::string_view value) : bytes(value) {}
+
+    // Whether anyone but the entry holds a reference (shard lock held)
+    bool shared() const { return refs.load(std::memory_order_acquire) > 1; }
+
+    // Drop one reference, freeing the value with the last one
+    static void release(SharedValue* value) {
+        if (value->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete value;
+        }
+    }
+};
+
+// An owning handle to a SharedValue's bytes
+class ValueRef {
+public:
+    ValueRef() = default;
+    // Take a new reference to value
+    explicit ValueRef(const SharedValue* value) : value_(const_cast<SharedValue*>(value)) {
+        if (value_) {
+            value_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    ~ValueRef() { reset(); }
+
+    ValueRef(const ValueRef& other) : ValueRef(other.value_) {}
+    ValueRef(ValueRef&& other) noexcept : value_(std::exchange(other.value_, nullptr)) {}
+    ValueRef& operator=(ValueRef other) noexcept {
+        std::swap(value_, other.value_);
+        return *this;
+    }
+
+    void reset() {
+        if (value_) {
+            SharedValue::release(std::exchange(value_, nullptr));
+        }
+    }
+
+    explicit operator bool() const { return value_ != nullptr; }
+    std::string_view view() const { return value_ ? std::string_view(value_->bytes) : std::string_view(); }
+    size_t size() const { return value_ ? value_->bytes.size() : 0; }
+
+private:
+    SharedValue* value_ = nullptr;
+};
@@ -0,0 +1,425 @@
+// Open-addressing hash table for the keyspace
+// Swiss-table layout: slots come in groups of 16, each with a control byte
+// holding 7 bits of its key's hash (or empty / deleted), so one SIMD compare
+// (SSE2 or NEON, a portable loop elsewhere) finds a group's candidate slots.
+// The 32-bit hash is stored next to each value, so candidates are confirmed
+// without touching the key and a resize never hashes a key again.
+// Resizing is incremental, as in Redis: a new table is allocated and every
+// lookup, insert and erase moves one group of the old one across, so no call
+// pays for the whole rehash. Until the move completes both tables are searched.
+// Values are non-owning pointers; KeyOf{}(value) returns a value's key.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string_view>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MINI_REDIS_SWISS_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define MINI_REDIS_SWISS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace swiss_detail {
+
+constexpr size_t GROUP = 16;
+constexpr uint8_t EMPTY = 0x80;   // Never used: ends a probe
+constexpr uint8_t DELETED = 0xFE; // Tombstone: probes continue past it
+// Full slots hold the low 7 bits of the hash (high bit clear)
+
+inline int lowest_bit(uint64_t bits) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Slots of a group that matched, lowest first. Each slot owns 2^shift bits of
+// bits_, of which at most one is set.
+class BitMask {
+public:
+    BitMask(uint64_t bits, int shift) : bits_(bits), shift_(shift) {}
+    explicit operator bool() const { return bits_ != 0; }
+    size_t lowest() const { return static_cast<size_t>(lowest_bit(bits_) >> shift_); }
+    void clear_lowest() { bits_ &= bits_ - 1; }
+
+private:
+    uint64_t bits_;
+    int shift_;
+};
+
+// The 16 control bytes of one group
+class Group {
+public:
+    explicit Group(const uint8_t* ctrl) {
+#if defined(MINI_REDIS_SWISS_SSE2)
+        ctrl_ = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+#elif defined(MINI_REDIS_SWISS_NEON)
+        ctrl_ = vld1q_u8(ctrl);
+#else
+        std::memcpy(ctrl_, ctrl, GROUP);
+#endif
+    }
+
+    BitMask match(uint8_t h2) const {
+#if defined(MINI_REDIS_SWISS_SSE2)
+        return BitMask(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl_, _mm_set1_epi8(static_cast<char>(h2))))), 0);
+#elif defined(MINI_REDIS_SWISS_NEON)
+        return neon_mask(vceqq_u8(ctrl_, vdupq_n_u8(h2)));
+#else
+        uint64_t bits = 0;
+        for (size_t i = 0; i < GROUP; ++i) {
+            bits |= static_cast<uint64_t>(ctrl_[i] == h2) << i;
+        }
+        return BitMask(bits, 0);
+#endif
+    }
+
+    BitMask match_empty() const { return match(EMPTY); }
+
+    // Empty and deleted slots are the ones with the high bit set
+    BitMask match_free() const {
+#if defined(MINI_REDIS_SWISS_SSE2)
+        return BitMask(static_cast<uint32_t>(_mm_movemask_epi8(ctrl_)), 0);
+#elif defined(MINI_REDIS_SWISS_NEON)
+        return neon_mask(vcltq_s8(vreinterpretq_s8_u8(ctrl_), vdupq_n_s8(0)));
+#else
+        uint64_t bits = 0;
+        for (size_t i = 0; i < GROUP; ++i) {
+            bits |= static_cast<uint64_t>(ctrl_[i] >> 7) << i;
+        }
+        return BitMask(bits, 0);
+#endif
+    }
+
+private:
+#if defined(MINI_REDIS_SWISS_SSE2)
+    __m128i ctrl_;
+#elif defined(MINI_REDIS_SWISS_NEON)
+    // NEON has no movemask: narrow each 0x00/0xFF byte to a nibble and keep
+    // one bit of it, giving 4 bits per slot
+    static BitMask neon_mask(uint8x16_t lanes) {
+        uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(lanes), 4);
+        return BitMask(vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ULL, 2);
+    }
+    uint8x16_t ctrl_;
+#else
+    uint8_t ctrl_[GROUP];
+#endif
+};
+
+} // namespace swiss_detail
+
+template <typename T, typename KeyOf>
+class SwissTable {
+public:
+    // Table memory per slot: control byte, stored hash and value pointer
+    static constexpr size_t SLOT_BYTES = 1 + sizeof(uint32_t) + sizeof(T*);
+
+    // A found value and where it lives; valid until the table next changes
+    struct Hit {
+        T* value = nullptr;
+        bool in_old = false;
+        size_t slot = 0;
+        explicit operator bool() const { return value != nullptr; }
+    };
+
+    // Position of a scan (see scan)
+    struct ScanPos {
+        uint64_t table = 0;
+        size_t slot = 0;
+    };
+
+    SwissTable() = default;
+    SwissTable(const SwissTable&) = delete;
+    SwissTable& operator=(const SwissTable&) = delete;
+
+    size_t size() const { return main_.used + old_.used; }
+    bool empty() const { return size() == 0; }
+    bool rehashing() const { return old_.capacity != 0; }
+
+    Hit find(std::string_view key) {
+        const uint32_t hash = hash_of(key);
+        step_rehash();
+        Hit hit;
+        if (find_in(main_, key, hash, hit.slot)) {
+            hit.value = main_.values[hit.slot];
+        } else if (rehashing() && find_in(old_, key, hash, hit.slot)) {
+            hit.value = old_.values[hit.slot];
+            hit.in_old = true;
+        }
+        return hit;
+    }
+
+    // Add a value whose key is not in the table
+    void insert(T* value) {
+        const uint32_t hash = hash_of(KeyOf{}(value));
+        step_rehash();
+        if (main_.used + main_.deleted >= max_load(main_.capacity)) {
+            grow(main_.used + 1);
+        }
+        insert_in(main_, hash, value);
+    }
+
+    void erase(const Hit& hit) {
+        erase_in(hit.in_old ? old_ : main_, hit.slot);
+        step_rehash();
+    }
+
+    // Make room for n values without further resizing (completes any rehash)
+    void reserve(size_t n) {
+        finish_rehash();
+        if (n > max_load(main_.capacity)) {
+            start_rehash(capacity_for(n));
+            finish_rehash();
+        }
+    }
+
+    // Forget every value (they are not freed)
+    void clear() {
+        main_ = Table();
+        old_ = Table();
+    }
+
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (const Table* table : {&old_, &main_}) {
+            for (size_t i = 0; i < table->capacity; ++i) {
+                if (is_full(table->ctrl[i])) {
+                    fn(table->values[i]);
+                }
+            }
+        }
+    }
+
+    // Call fn(value) for the values from pos on until it returns false, then
+    // leave pos after the last one visited. Returns false once every slot has
+    // been passed. Changes between calls never hide a value that was present
+    // throughout the scan: values only move forward, from the old table to the
+    // new one. A value moved past the scan can be visited a second time.
+    template <typename Fn>
+    bool scan(ScanPos& pos, Fn&& fn) const {
+        for (const Table* table : {&old_, &main_}) {
+            if (table->capacity == 0 || table->id < pos.table) {
+                continue;
+            }
+            if (table->id > pos.table) {
+                pos = ScanPos{table->id, 0}; // The scan's table is gone, or it is done with it
+            }
+            while (pos.slot < table->capacity) {
+                const size_t slot = pos.slot++;
+                if (is_full(table->ctrl[slot]) && !fn(table->values[slot])) {
+                    return true;
+                }
+            }
+            pos.table = table->id + 1;
+            pos.slot = 0;
+        }
+        return false;
+    }
+
+    // The id of a live table whose id ends in the given low bits, or 0 (before
+    // every table) if that table has been freed: a ScanPos kept in fewer bits
+    // is resumed with this
+    uint64_t find_table(uint64_t low, unsigned bits) const {
+        const uint64_t mask = (uint64_t{1} << bits) - 1;
+        for (const Table* table : {&old_, &main_}) {
+            if (table->capacity != 0 && (table->id & mask) == low) {
+                return table->id;
+            }
+        }
+        return 0;
+    }
+
+    // Visit up to count values starting at slot `start` of all slots (taken
+    // modulo their number), for random sampling
+    template <typename Fn>
+    void sample(uint64_t start, size_t count, Fn&& visit) const {
+        const size_t slots = old_.capacity + main_.capacity;
+        if (slots == 0) {
+            return;
+        }
+        size_t index = static_cast<size_t>(start % slots);
+        size_t found = 0;
+        for (size_t visited = 0; visited < slots && found < count; ++visited) {
+            const Table& table = index < old_.capacity ? old_ : main_;
+            const size_t slot = index < old_.capacity ? index : index - old_.capacity;
+            if (is_full(table.ctrl[slot])) {
+                visit(table.values[slot]);
+                ++found;
+            }
+            index = index + 1 == slots ? 0 : index + 1;
+        }
+    }
+
+private:
+    static constexpr size_t GROUP = swiss_detail::GROUP;
+
+    struct Table {
+        std::unique_ptr<unsigned char[]> storage; // values, then hashes, then control bytes
+        T** values = nullptr;
+        uint32_t* hashes = nullptr;
+        uint8_t* ctrl = nullptr;
+        size_t capacity = 0; // Slots: a power-of-two number of groups
+        size_t used = 0;
+        size_t deleted = 0;
+        uint64_t id = 0;     // Allocation order, for scans
+    };
+
+    static bool is_full(uint8_t ctrl) { return (ctrl & 0x80) == 0; }
+
+    // Remix std::hash: keys are spread over shards by the same hash modulo
+    // the shard count, so its low bits are nearly constant within a shard
+    static uint32_t hash_of(std::string_view key) {
+        uint64_t h = static_cast<uint64_t>(std::hash<std::string_view>{}(key));
+        return static_cast<uint32_t>((h * 0x9E3779B97F4A7C15ULL) >> 32);
+    }
+
+    // Up to 7/8 of the slots may be used or deleted
+    static size_t max_load(size_t capacity) { return capacity - capacity / 8; }
+
+    static size_t capacity_for(size_t n) {
+        size_t capacity = GROUP;
+        while (max_load(capacity) < n) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    Table allocate(size_t capacity) {
+        Table table;
+        table.storage.reset(new unsigned char[capacity * SLOT_BYTES]);
+        table.values = reinterpret_cast<T**>(table.storage.get());
+        table.hashes = reinterpret_cast<uint32_t*>(table.values + capacity);
+        table.ctrl = reinterpret_cast<uint8_t*>(table.hashes + capacity);
+        std::memset(table.ctrl, swiss_detail::EMPTY, capacity);
+        table.capacity = capacity;
+        table.id = ++tables_;
+        return table;
+    }
+
+    // Groups are probed quadratically (0, 1, 3, 6, ...), which visits every
+    // group of a power-of-two table
+    static bool find_in(const Table& table, std::string_view key, uint32_t hash, size_t& slot) {
+        if (table.capacity == 0) {
+            return false;
+        }
+        const size_t mask = table.capacity / GROUP - 1;
+        const uint8_t h2 = static_cast<uint8_t>(hash & 0x7F);
+        size_t group = (hash >> 7) & mask;
+        for (size_t step = 0; step <= mask; ++step) {
+            swiss_detail::Group ctrl(table.ctrl + group * GROUP);
+            for (swiss_detail::BitMask match = ctrl.match(h2); match; match.clear_lowest()) {
+                const size_t candidate = group * GROUP + match.lowest();
+                if (table.hashes[candidate] == hash && KeyOf{}(table.values[candidate]) == key) {
+                    slot = candidate;
+                    return true;
+                }
+            }
+            if (ctrl.match_empty()) {
+                return false;
+            }
+            group = (group + step + 1) & mask;
+        }
+        return false;
+    }
+
+    static void insert_in(Table& table, uint32_t hash, T* value) {
+        const size_t mask = table.capacity / GROUP - 1;
+        size_t group = (hash >> 7) & mask;
+        for (size_t step = 0;; ++step) {
+            swiss_detail::BitMask free = swiss_detail::Group(table.ctrl + group * GROUP).match_free();
+            if (free) {
+                const size_t slot = group * GROUP + free.lowest();
+                if (table.ctrl[slot] == swiss_detail::DELETED) {
+                    table.deleted--;
+                }
+                table.ctrl[slot] = static_cast<uint8_t>(hash & 0x7F);
+                table.hashes[slot] = hash;
+                table.values[slot] = value;
+                table.used++;
+                return;
+            }
+            group = (group + step + 1) & mask;
+        }
+    }
+
+    static void erase_in(Table& table, size_t slot) {
+        // A group with an empty slot has never been full, so no probe has
+        // passed through it: the slot can go back to empty
+        const size_t group = slot / GROUP;
+        if (swiss_detail::Group(table.ctrl + group * GROUP).match_empty()) {
+            table.ctrl[slot] = swiss_detail::EMPTY;
+        } else {
+            table.ctrl[slot] = swiss_detail::DELETED;
+            table.deleted++;
+        }
+        table.values[slot] = nullptr;
+        table.used--;
+    }
+
+    // Double when more than 7/16 full, otherwise rebuild at the same size to
+    // clear tombstones
+    void grow(size_t needed) {
+        finish_rehash();
+        size_t capacity = main_.capacity == 0 ? GROUP : main_.capacity;
+        if (needed > capacity * 7 / 16) {
+            capacity *= 2;
+        }
+        start_rehash(capacity);
+    }
+
+    void start_rehash(size_t capacity) {
+        old_ = std::move(main_);
+        main_ = allocate(capacity);
+        migrate_group_ = 0;
+        if (old_.used == 0) {
+            old_ = Table();
+        }
+    }
+
+    // Move one group of the old table: at most 16 values per call. Moved
+    // slots become tombstones, so probes for the rest still get through.
+    void step_rehash() {
+        if (!rehashing()) {
+            return;
+        }
+        const size_t first = migrate_group_ * GROUP;
+        for (size_t slot = first; slot < first + GROUP; ++slot) {
+            if (is_full(old_.ctrl[slot])) {
+                insert_in(main_, old_.hashes[slot], old_.values[slot]);
+                old_.ctrl[slot] = swiss_detail::DELETED;
+                old_.used--;
+            }
+        }
+        if (++migrate_group_ * GROUP >= old_.capacity || old_.used == 0) {
+            old_ = Table();
+        }
+    }
+
+    void finish_rehash() {
+        while (rehashing()) {
+            step_rehash();
+        }
+    }
+
+    Table main_;
+    Table old_;                 // Being moved into main_ (capacity 0 = not rehashing)
+    size_t migrate_group_ = 0;  // Next group of old_ to move
+    uint64_t tables_ = 0;       // Tables allocated so far
+};
@@ -21,6 +21,56 @@ static std::string trim(const std::string& s) {
     return s.substr(start, end - start + 1);
 }
 
+bool parse_memory_size(const std::string& text, size_t& out) {
+    std::string s = trim(text);
+    size_t digits = 0;
+    while (digits < s.size() && std::isdigit(static_cast<unsigned char>(s[digits]))) {
+        ++digits;
+    }
+    if (digits == 0) {
+        return false;
+    }
+    std::string unit = s.substr(digits);
+    std::transform(unit.begin(), unit.end(), unit.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    unsigned long long multiplier = 1;
+    if (unit.empty() || unit == "b") multiplier = 1;
+    else if (unit == "k" || unit == "kb") multiplier = 1024ULL;
+    else if (unit == "m" || unit == "mb") multiplier = 1024ULL * 1024;
+    else if (unit == "g" || unit == "gb") multiplier = 1024ULL * 1024 * 1024;
+    else return false;
+    try {
+        out = static_cast<size_t>(std::stoull(s.substr(0, digits)) * multiplier);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+// client-output-buffer-limit <class> <hard> <soft> <soft seconds>; only the
+// pubsub class has a separate output queue to bound
+static bool parse_output_buffer_limit(const std::string& cls, const std::string& hard, const std::string& soft,
+                                      const std::string& seconds, Config& cfg) {
+    if (cls != "pubsub") {
+        return false;
+    }
+    size_t hard_bytes = 0;
+    size_t soft_bytes = 0;
+    int soft_seconds = 0;
+    if (!parse_memory_size(hard, hard_bytes) || !parse_memory_size(soft, soft_bytes)) {
+        return false;
+    }
+    try {
+        soft_seconds = std::stoi(seconds);
+    } catch (...) {
+        return false;
+    }
+    cfg.pubsub_hard_limit = hard_bytes;
+    cfg.pubsub_soft_limit = soft_bytes;
+    cfg.pubsub_soft_seconds = soft_seconds;
+    return true;
+}
+
 Config parse_args(int argc, char* argv[]) {
     Config cfg;
     
@@ -39,12 +89,106 @@ Config parse_args(int argc, char* argv[]) {
             } catch (...) {
                 // Keep default
             }
+        } else if (arg == "--shards" && i + 1 < argc) {
+            try {
+                cfg.shards = std::stoi(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
+        } else if (arg == "--maxmemory" && i + 1 < argc) {
+            parse_memory_size(argv[++i], cfg.maxmemory);
+        } else if (arg == "--maxmemory-policy" && i + 1 < argc) {
+            cfg.maxmemory_policy = argv[++i];
+        } else if (arg == "--maxmemory-samples" && i + 1 < argc) {
+            try {
+                cfg.maxmemory_samples = std::stoi(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
+        } else if (arg == "--hz" && i + 1 < argc) {
+            try {
+                cfg.hz = std::stoi(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
+        } else if (arg == "--lazyfree-min-size" && i + 1 < argc) {
+            parse_memory_size(argv[++i], cfg.lazyfree_min_size);
         } else if ((arg == "--aof" || arg == "-a") && i + 1 < argc) {
             cfg.aof_path = argv[++i];
+        } else if (arg == "--appendfsync" && i + 1 < argc) {
+            cfg.appendfsync = argv[++i];
+        } else if (arg == "--auto-aof-rewrite-percentage" && i + 1 < argc) {
+            try {
+                cfg.auto_aof_rewrite_percentage = std::stoi(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
+        } else if (arg == "--auto-aof-rewrite-min-size" && i + 1 < argc) {
+            parse_memory_size(argv[++i], cfg.auto_aof_rewrite_min_size);
         } else if ((arg == "--rdb" || arg == "-r") && i + 1 < argc) {
             cfg.rdb_path = argv[++i];
+        } else if (arg == "--slowlog-log-slower-than" && i + 1 < argc) {
+            try {
+                cfg.slowlog_log_slower_than = std::stoll(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
+        } else if (arg == "--slowlog-max-len" && i + 1 < argc) {
+            try {
+                cfg.slowlog_max_len = std::stoi(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
+        } else if (arg == "--client-output-buffer-limit" && i + 4 < argc) {
+            parse_output_buffer_limit(argv[i + 1], argv[i + 2], argv[i + 3], argv[i + 4], cfg);
+            i += 4;
+        } else if (arg == "--tracking-table-max-keys" && i + 1 < argc) {
+            try {
+                cfg.tracking_table_max_keys = std::stoll(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
+        } else if (arg == "--repl-backlog-size" && i + 1 < argc) {
+            parse_memory_size(argv[++i], cfg.repl_backlog_size);
+        } else if (arg == "--replicaof" && i + 2 < argc) {
+            cfg.replicaof_host = argv[++i];
+            try {
+                cfg.replicaof_port = std::stoi(argv[++i]);
+            } catch (...) {
+                cfg.replicaof_host.clear();
+            }
+        } else if (arg == "--replica-max-lag-ms" && i + 1 < argc) {
+            try {
+                cfg.replica_max_lag_ms = std::stoll(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
+        } else if (arg == "--cluster-enabled") {
+            cfg.cluster_enabled = true;
+        } else if (arg == "--cluster-config-file" && i + 1 < argc) {
+            cfg.cluster_config_file = argv[++i];
+        } else if (arg == "--cluster-announce-ip" && i + 1 < argc) {
+            cfg.cluster_announce_ip = argv[++i];
         } else if (arg == "--iocp") {
             cfg.use_iocp = true;
+        } else if (arg == "--event-loop") {
+            cfg.use_event_loop = true;
+        } else if (arg == "--io-uring") {
+            cfg.use_io_uring = true;
+        } else if (arg == "--thread-per-core") {
+            cfg.use_thread_per_core = true;
+        } else if (arg == "--iocp-accepts" && i + 1 < argc) {
+            try {
+                cfg.iocp_accepts = std::stoi(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
+        } else if (arg == "--cores" && i + 1 < argc) {
+            try {
+                cfg.cores = std::stoi(argv[++i]);
+            } catch (...) {
+                // Keep default
+            }
         } else if ((arg == "--config" || arg == "-c") && i + 1 < argc) {
             // Load from config file, then apply remaining CLI args
             cfg = load_config_file(argv[++i]);
@@ -82,12 +226,72 @@ Config load_config_file(const std::string& path) {
             try { cfg.port = std::stoi(value); } catch (...) {}
         } else if (key == "max_keys") {
             try { cfg.max_keys = std::stoi(value); } catch (...) {}
+        } else if (key == "shards") {
+            try { cfg.shards = std::stoi(value); } catch (...) {}
+        } else if (key == "maxmemory") {
+            parse_memory_size(value, cfg.maxmemory);
+        } else if (key == "maxmemory_policy") {
+            cfg.maxmemory_policy = value;
+        } else if (key == "maxmemory_samples") {
+            try { cfg.maxmemory_samples = std::stoi(value); } catch (...) {}
+        } else if (key == "hz") {
+            try { cfg.hz = std::stoi(value); } catch (...) {}
+        } else if (key == "lazyfree_min_size") {
+            parse_memory_size(value, cfg.lazyfree_min_size);
         } else if (key == "aof_path") {
             cfg.aof_path = value;
+        } else if (key == "appendfsync") {
+            cfg.appendfsync = value;
+        } else if (key == "auto_aof_rewrite_percentage") {
+            try { cfg.auto_aof_rewrite_percentage = std::stoi(value); } catch (...) {}
+        } else if (key == "auto_aof_rewrite_min_size") {
+            parse_memory_size(value, cfg.auto_aof_rewrite_min_size);
         } else if (key == "rdb_path") {
             cfg.rdb_path = value;
+        } else if (key == "slowlog_log_slower_than") {
+            try { cfg.slowlog_log_slower_than = std::stoll(value); } catch (...) {}
+        } else if (key == "slowlog_max_len") {
+            try { cfg.slowlog_max_len = std::stoi(value); } catch (...) {}
+        } else if (key == "client_output_buffer_limit") {
+            // client_output_buffer_limit = pubsub <hard> <soft> <seconds>
+            std::istringstream in(value);
+            std::string cls, hard, soft, seconds;
+            if (in >> cls >> hard >> soft >> seconds) {
+                parse_output_buffer_limit(cls, hard, soft, seconds, cfg);
+            }
+        } else if (key == "tracking_table_max_keys") {
+            try { cfg.tracking_table_max_keys = std::stoll(value); } catch (...) {}
+        } else if (key == "repl_backlog_size") {
+            parse_memory_size(value, cfg.repl_backlog_size);
+        } else if (key == "replicaof") {
+            // replicaof = <host> <port>
+            std::istringstream in(value);
+            std::string host;
+            int port = 0;
+            if (in >> host >> port) {
+                cfg.replicaof_host = host;
+                cfg.replicaof_port = port;
+            }
+        } else if (key == "replica_max_lag_ms") {
+            try { cfg.replica_max_lag_ms = std::stoll(value); } catch (...) {}
+        } else if (key == "cluster_enabled") {
+            cfg.cluster_enabled = (value == "true" || value == "1" || value == "yes");
+        } else if (key == "cluster_config_file") {
+            cfg.cluster_config_file = value;
+        } else if (key == "cluster_announce_ip") {
+            cfg.cluster_announce_ip = value;
         } else if (key == "use_iocp") {
             cfg.use_iocp = (value == "true" || value == "1" || value == "yes");
+        } else if (key == "use_event_loop") {
+            cfg.use_event_loop = (value == "true" || value == "1" || value == "yes");
+        } else if (key == "use_io_uring") {
+            cfg.use_io_uring = (value == "true" || value == "1" || value == "yes");
+        } else if (key == "use_thread_per_core") {
+            cfg.use_thread_per_core = (value == "true" || value == "1" || value == "yes");
+        } else if (key == "iocp_accepts") {
+            try { cfg.iocp_accepts = std::stoi(value); } catch (...) {}
+        } else if (key == "cores") {
+            try { cfg.cores = std::stoi(value); } catch (...) {}
         }
     }
     
@@ -5,20 +5,54 @@
 #define MINI_REDIS_CONFIG_HPP
 
 #include <string>
+#include <cstddef>
 
 namespace mini_redis {
 
 struct Config {
     int port = 6379;
     int max_keys = 10000;
+    int shards = 16; // Independently locked partitions per database
+    size_t maxmemory = 0; // Byte budget per database (0 = unlimited)
+    std::string maxmemory_policy = "allkeys-lru";
+    int maxmemory_samples = 5; // Keys sampled per eviction for sampled policies
+    int hz = 10; // Active expire cycles per second
+    size_t lazyfree_min_size = 64 * 1024; // Values this big are freed in the background by UNLINK, eviction and expiry (0 = never)
     std::string aof_path = "mini_redis.aof";
+    std::string appendfsync = "everysec"; // AOF fsync policy: always | everysec | no
+    int auto_aof_rewrite_percentage = 100; // Rewrite once the AOF grows this much past its base size (0 = off)
+    size_t auto_aof_rewrite_min_size = 64 * 1024 * 1024; // ...and is at least this big
     std::string rdb_path = "mini_redis_dump.rdb";
+    long long slowlog_log_slower_than = 10000; // Microseconds (negative = off, 0 = log every command)
+    int slowlog_max_len = 128;
+    // client-output-buffer-limit pubsub: a subscriber whose unsent messages pass
+    // the hard limit, or stay over the soft limit for the given seconds, is
+    // disconnected (0 = no limit)
+    size_t pubsub_hard_limit = 32 * 1024 * 1024;
+    size_t pubsub_soft_limit = 8 * 1024 * 1024;
+    int pubsub_soft_seconds = 60;
+    long long tracking_table_max_keys = 1000000; // Keys CLIENT TRACKING remembers readers of, per database (0 = no limit)
+    size_t repl_backlog_size = 1024 * 1024; // Replication stream kept for partial resyncs
+    std::string replicaof_host; // Primary to follow at startup (empty = none)
+    int replicaof_port = 0;
+    long long replica_max_lag_ms = 10000; // Staleness bound for reads on a replica (0 = none)
+    bool cluster_enabled = false; // Serve only the hash slots this node owns, redirecting the rest
+    std::string cluster_config_file = "nodes.conf"; // Node ID and cluster view, kept across restarts
+    std::string cluster_announce_ip = "127.0.0.1"; // Address other nodes and clients are told to use
     bool use_iocp = false;
+    int iocp_accepts = 16; // AcceptEx calls the IOCP server keeps outstanding
+    bool use_event_loop = false; // epoll (Linux) / kqueue (BSD, macOS) server
+    bool use_io_uring = false; // io_uring server (Linux)
+    bool use_thread_per_core = false; // Shared-nothing server: each core owns a keyspace slice
+    int cores = 0; // Cores for thread-per-core mode (0 = all hardware threads)
 };
 
 // Parse command-line arguments
 Config parse_args(int argc, char* argv[]);
 
+// Parse a byte size with optional k/kb/m/mb/g/gb suffix (returns false on error)
+bool parse_memory_size(const std::string& text, size_t& out);
+
 // Load config from file (returns default if file not found)
 Config load_config_file(const std::string& path);
 
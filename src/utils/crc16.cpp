@@ -0,0 +1,53 @@
+// CRC-16/XMODEM, table-driven, and the key to hash slot mapping
+
+#include "crc16.hpp"
+
+namespace mini_redis {
+
+namespace {
+
+const uint16_t POLY = 0x1021;
+
+struct Crc16Table {
+    uint16_t t[256];
+
+    Crc16Table() {
+        for (int i = 0; i < 256; ++i) {
+            uint16_t crc = static_cast<uint16_t>(i << 8);
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ POLY : crc << 1);
+            }
+            t[i] = crc;
+        }
+    }
+};
+
+const Crc16Table& table() {
+    static const Crc16Table instance;
+    return instance;
+}
+
+} // anonymous namespace
+
+uint16_t crc16(const void* data, size_t len) {
+    const uint16_t* t = table().t;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        crc = static_cast<uint16_t>((crc << 8) ^ t[((crc >> 8) ^ p[i]) & 0xff]);
+    }
+    return crc;
+}
+
+uint16_t key_hash_slot(std::string_view key) {
+    const size_t open = key.find('{');
+    if (open != std::string_view::npos) {
+        const size_t close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close > open + 1) {
+            key = key.substr(open + 1, close - open - 1);
+        }
+    }
+    return static_cast<uint16_t>(crc16(key.data(), key.size()) & (CLUSTER_SLOTS - 1));
+}
+
+} // namespace mini_redis
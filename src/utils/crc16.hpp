@@ -0,0 +1,22 @@
+// CRC-16 and cluster hash slots for Mini-Redis
+// CRC-16/XMODEM (polynomial 0x1021, initial value 0; check value for
+// "123456789" is 0x31c3), the function Redis Cluster maps keys to slots with.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace mini_redis {
+
+constexpr uint16_t CLUSTER_SLOTS = 16384;
+
+uint16_t crc16(const void* data, size_t len);
+
+// Slot of a key: CRC16 of the key mod 16384, or of its hash tag, the part
+// between the first '{' and the next '}' when that is not empty, so keys
+// sharing a tag share a slot
+uint16_t key_hash_slot(std::string_view key);
+
+} // namespace mini_redis
@@ -0,0 +1,61 @@
+// CRC-64 (Jones polynomial, reflected) with slicing-by-8 tables
+
+#include "crc64.hpp"
+
+namespace mini_redis {
+
+namespace {
+
+const uint64_t POLY_REFLECTED = 0x95ac9329ac4bc9b5ULL;
+
+// tables[0] is the classic byte table; tables[k][b] is the CRC of byte b
+// followed by k zero bytes, so eight table lookups consume eight input bytes
+struct Crc64Tables {
+    uint64_t t[8][256];
+
+    Crc64Tables() {
+        for (uint64_t i = 0; i < 256; ++i) {
+            uint64_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? (crc >> 1) ^ POLY_REFLECTED : crc >> 1;
+            }
+            t[0][i] = crc;
+        }
+        for (int k = 1; k < 8; ++k) {
+            for (int i = 0; i < 256; ++i) {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+const Crc64Tables& tables() {
+    static const Crc64Tables instance;
+    return instance;
+}
+
+} // anonymous namespace
+
+uint64_t crc64(uint64_t crc, const void* data, size_t len) {
+    const uint64_t (*t)[256] = tables().t;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    while (len >= 8) {
+        // Assembled byte by byte, so the result does not depend on endianness
+        uint64_t word = 0;
+        for (int i = 7; i >= 0; --i) {
+            word = (word << 8) | p[i];
+        }
+        crc ^= word;
+        crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^ t[5][(crc >> 16) & 0xff] ^
+              t[4][(crc >> 24) & 0xff] ^ t[3][(crc >> 32) & 0xff] ^ t[2][(crc >> 40) & 0xff] ^
+              t[1][(crc >> 48) & 0xff] ^ t[0][crc >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+} // namespace mini_redis
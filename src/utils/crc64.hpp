@@ -0,0 +1,16 @@
+// CRC-64 checksum for Mini-Redis persistence files
+// Jones polynomial in reflected form, as used by Redis for RDB files
+// (check value for "123456789" is 0xe9c6d914c4b8d9ca). Table-driven,
+// eight bytes per step (slicing-by-8).
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mini_redis {
+
+// Extend crc over len bytes; start with crc = 0
+uint64_t crc64(uint64_t crc, const void* data, size_t len);
+
+} // namespace mini_redis
@@ -0,0 +1,108 @@
+// Glob-style pattern matching
+
+#include "glob.hpp"
+
+#include <utility>
+
+namespace mini_redis {
+
+namespace {
+
+// Match c against the set starting just past a '['; returns the position
+// after its closing ']' (or the end of an unterminated set)
+size_t match_set(std::string_view pattern, size_t p, unsigned char c, bool& matched) {
+    const bool negate = p < pattern.size() && pattern[p] == '^';
+    if (negate) {
+        ++p;
+    }
+    matched = false;
+    while (p < pattern.size() && pattern[p] != ']') {
+        if (pattern[p] == '\\' && p + 1 < pattern.size()) {
+            matched = matched || static_cast<unsigned char>(pattern[p + 1]) == c;
+            p += 2;
+        } else if (p + 2 < pattern.size() && pattern[p + 1] == '-' && pattern[p + 2] != ']') {
+            unsigned char lo = static_cast<unsigned char>(pattern[p]);
+            unsigned char hi = static_cast<unsigned char>(pattern[p + 2]);
+            if (lo > hi) {
+                std::swap(lo, hi);
+            }
+            matched = matched || (c >= lo && c <= hi);
+            p += 3;
+        } else {
+            matched = matched || static_cast<unsigned char>(pattern[p]) == c;
+            ++p;
+        }
+    }
+    if (negate) {
+        matched = !matched;
+    }
+    return p < pattern.size() ? p + 1 : p;
+}
+
+} // anonymous namespace
+
+bool glob_match(std::string_view pattern, std::string_view text) {
+    size_t p = 0;
+    size_t t = 0;
+    // The latest * and the text position it currently absorbs up to
+    size_t star_p = std::string_view::npos;
+    size_t star_t = 0;
+
+    while (t < text.size()) {
+        if (p < pattern.size()) {
+            const char pc = pattern[p];
+            if (pc == '*') {
+                while (p < pattern.size() && pattern[p] == '*') {
+                    ++p;
+                }
+                if (p == pattern.size()) {
+                    return true; // A trailing * takes the rest
+                }
+                star_p = p;
+                star_t = t;
+                continue;
+            }
+            if (pc == '?') {
+                ++p;
+                ++t;
+                continue;
+            }
+            if (pc == '[') {
+                bool matched;
+                const size_t next = match_set(pattern, p + 1, static_cast<unsigned char>(text[t]), matched);
+                if (matched) {
+                    p = next;
+                    ++t;
+                    continue;
+                }
+            } else if (pc == '\\' && p + 1 < pattern.size()) {
+                if (pattern[p + 1] == text[t]) {
+                    p += 2;
+                    ++t;
+                    continue;
+                }
+            } else if (pc == text[t]) {
+                ++p;
+                ++t;
+                continue;
+            }
+        }
+        // Mismatch: let the latest * absorb one more byte and retry after it
+        if (star_p == std::string_view::npos) {
+            return false;
+        }
+        p = star_p;
+        t = ++star_t;
+    }
+
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+bool glob_matches_all(std::string_view pattern) {
+    return !pattern.empty() && pattern.find_first_not_of('*') == std::string_view::npos;
+}
+
+} // namespace mini_redis
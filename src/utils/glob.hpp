@@ -0,0 +1,19 @@
+// Glob-style pattern matching for Mini-Redis
+// The KEYS / SCAN MATCH syntax of Redis: * matches any run of bytes, ? any one
+// byte, [abc], [^abc] and [a-z] a byte in (or not in) a set, and \ makes the
+// next byte literal. Matching is a single pass that only ever backtracks to
+// the latest *, so it takes O(pattern * key) time at worst, however many
+// stars the pattern has.
+
+#pragma once
+
+#include <string_view>
+
+namespace mini_redis {
+
+bool glob_match(std::string_view pattern, std::string_view text);
+
+// Whether pattern matches every string ("*", "**", ...), so callers can skip matching
+bool glob_matches_all(std::string_view pattern);
+
+} // namespace mini_redis
@@ -0,0 +1,98 @@
+// Log-linear latency histogram for Mini-Redis
+// HDR-style bucketing of microsecond values: each power of two is split into
+// 8 equal sub-buckets, so any recorded value is known to within 12.5% while
+// 1 us to ~71 minutes fits in 240 buckets. Recording is an index computation
+// and one increment, cheap enough to do on every command.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mini_redis {
+
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr uint64_t SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+    static constexpr uint64_t MAX_VALUE = 0xFFFFFFFFull; // Larger values are clamped
+    static constexpr size_t BUCKETS = (32 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    // Bucket holding value: values below 8 get a bucket each, larger ones
+    // are placed by their top SUB_BUCKET_BITS + 1 significant bits
+    static size_t bucket_of(uint64_t value) {
+        if (value > MAX_VALUE) {
+            value = MAX_VALUE;
+        }
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        int exponent = 63 - count_leading_zeros(value); // >= SUB_BUCKET_BITS
+        uint64_t sub = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return static_cast<size_t>((exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub);
+    }
+
+    // Smallest and largest value that land in a bucket
+    static uint64_t bucket_low(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        uint64_t exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        uint64_t sub = bucket % SUB_BUCKETS;
+        return (SUB_BUCKETS + sub) << (exponent - SUB_BUCKET_BITS);
+    }
+    static uint64_t bucket_high(size_t bucket) {
+        return bucket + 1 < BUCKETS ? bucket_low(bucket + 1) - 1 : MAX_VALUE;
+    }
+
+    void record(uint64_t value) {
+        counts_[bucket_of(value)]++;
+        total_++;
+    }
+
+    // Add n values that fell in bucket (for merging per-thread counts)
+    void add(size_t bucket, uint64_t n) {
+        counts_[bucket] += n;
+        total_ += n;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t count_at(size_t bucket) const { return counts_[bucket]; }
+
+    // Upper bound of the bucket holding the given percentile (0-100), 0 if empty
+    uint64_t percentile(double pct) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(pct / 100.0 * static_cast<double>(total_) + 0.5);
+        if (rank < 1) {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; ++b) {
+            seen += counts_[b];
+            if (seen >= rank) {
+                return bucket_high(b);
+            }
+        }
+        return MAX_VALUE;
+    }
+
+private:
+    static int count_leading_zeros(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_clzll(value);
+#else
+        int n = 0;
+        for (uint64_t bit = 1ull << 63; (value & bit) == 0; bit >>= 1) {
+            ++n;
+        }
+        return n;
+#endif
+    }
+
+    uint64_t counts_[BUCKETS] = {};
+    uint64_t total_ = 0;
+};
+
+} // namespace mini_redis
@@ -0,0 +1,38 @@
+// Read-only memory-mapped file for Mini-Redis
+// Maps a whole file so loaders can decode it in place, from several threads
+// at once, without copying it through stream buffers. mmap on POSIX,
+// CreateFileMapping / MapViewOfFile on Windows.
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+namespace mini_redis {
+
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Map path read-only; false if it cannot be opened or mapped.
+    // An empty file maps successfully with data() == nullptr.
+    bool open(const std::string& path);
+    void close();
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;    // HANDLE
+    void* mapping_ = nullptr; // HANDLE
+#endif
+};
+
+} // namespace mini_redis
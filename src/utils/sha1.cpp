@@ -0,0 +1,93 @@
+// SHA-1 (FIPS 180-4): 64-byte blocks, 80 rounds over five 32-bit words
+
+#include "sha1.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+namespace mini_redis {
+
+namespace {
+
+uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+void process_block(uint32_t (&h)[5], const unsigned char* block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = (static_cast<uint32_t>(block[4 * i]) << 24) | (static_cast<uint32_t>(block[4 * i + 1]) << 16) |
+               (static_cast<uint32_t>(block[4 * i + 2]) << 8) | static_cast<uint32_t>(block[4 * i + 3]);
+    }
+    for (int i = 16; i < 80; ++i) {
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; ++i) {
+        uint32_t f;
+        uint32_t k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        const uint32_t t = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+} // anonymous namespace
+
+std::string sha1_hex(std::string_view data) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+    size_t whole = data.size() / 64 * 64;
+    for (size_t pos = 0; pos < whole; pos += 64) {
+        process_block(h, bytes + pos);
+    }
+
+    // The tail, a 1 bit, zeros, then the length in bits, in one or two blocks
+    unsigned char tail[128] = {};
+    const size_t rest = data.size() - whole;
+    if (rest > 0) {
+        std::memcpy(tail, bytes + whole, rest);
+    }
+    tail[rest] = 0x80;
+    const size_t tail_size = rest < 56 ? 64 : 128;
+    const uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+    for (int i = 0; i < 8; ++i) {
+        tail[tail_size - 1 - i] = static_cast<unsigned char>(bits >> (8 * i));
+    }
+    for (size_t pos = 0; pos < tail_size; pos += 64) {
+        process_block(h, tail + pos);
+    }
+
+    static const char HEX[] = "0123456789abcdef";
+    std::string out(40, '0');
+    for (int i = 0; i < 5; ++i) {
+        for (int j = 0; j < 8; ++j) {
+            out[8 * i + j] = HEX[(h[i] >> (28 - 4 * j)) & 0xF];
+        }
+    }
+    return out;
+}
+
+} // namespace mini_redis
@@ -0,0 +1,17 @@
+// SHA-1 for Mini-Redis
+// Scripts are named by the SHA-1 of their source, as in Redis: EVAL caches a
+// script under it and EVALSHA / SCRIPT EXISTS look it up. (SHA-1 is only an
+// identifier here, not a security measure.)
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace mini_redis {
+
+// The digest of data as 40 lowercase hex digits
+std::string sha1_hex(std::string_view data);
+
+} // namespace mini_redis
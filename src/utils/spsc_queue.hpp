@@ -0,0 +1,77 @@
+// Lock-free single-producer/single-consumer queue for Mini-Redis
+// Bounded ring used to pass work between two fixed threads (e.g. two cores in
+// the thread-per-core server) without a mutex. Exactly one thread may call
+// try_push and exactly one other thread may call try_pop.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace mini_redis {
+
+template <typename T>
+class SpscQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity = 1024) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        slots_.reset(new T[size]);
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Producer side. Returns false (leaving item untouched) if the queue is full.
+    bool try_push(T& item) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = std::move(item);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool try_pop(T& out) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        out = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate; exact only when called from the consumer with no concurrent push
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    // Producer and consumer indices live on separate cache lines; each side also
+    // caches the other's index so the shared line is only read when needed
+    alignas(64) std::atomic<size_t> head_{0}; // Next slot to pop (written by consumer)
+    size_t tail_cache_ = 0;                   // Consumer's last view of tail_
+    alignas(64) std::atomic<size_t> tail_{0}; // Next slot to push (written by producer)
+    size_t head_cache_ = 0;                   // Producer's last view of head_
+    alignas(64) size_t mask_ = 0;
+    std::unique_ptr<T[]> slots_;
+};
+
+} // namespace mini_redis
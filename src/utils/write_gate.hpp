@@ -0,0 +1,73 @@
+// Write gate for Mini-Redis
+// Lets a background task wait until no write is between changing the data
+// and recording the change: an AOF rewrite cutting a shard where the log
+// matches the data, or a full resync snapshotting at an exact stream offset.
+// Every write holds a Pass from applying to recording; close() stops new
+// passes and returns once none is in flight. Writers touch two atomics only,
+// and unlike a reader-writer lock a steady stream of writes cannot starve a
+// close.
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+namespace mini_redis {
+
+class WriteGate {
+public:
+    // Held by a write while it is inside the gate (empty = not inside, e.g.
+    // when the gate's owner has nothing to cut)
+    class Pass {
+    public:
+        Pass() = default;
+        explicit Pass(WriteGate& gate) : gate_(&gate) {
+            // seq_cst on both sides: either close sees this writer or it sees the gate closed
+            while (true) {
+                while (gate_->closed_.load()) {
+                    std::this_thread::yield();
+                }
+                gate_->writers_.fetch_add(1);
+                if (!gate_->closed_.load()) {
+                    return;
+                }
+                gate_->writers_.fetch_sub(1);
+            }
+        }
+        Pass(Pass&& other) noexcept : gate_(other.gate_) { other.gate_ = nullptr; }
+        Pass& operator=(Pass&& other) noexcept {
+            if (this != &other) {
+                release();
+                gate_ = other.gate_;
+                other.gate_ = nullptr;
+            }
+            return *this;
+        }
+        ~Pass() { release(); }
+
+    private:
+        void release() {
+            if (gate_) {
+                gate_->writers_.fetch_sub(1);
+                gate_ = nullptr;
+            }
+        }
+
+        WriteGate* gate_ = nullptr;
+    };
+
+    // New passes wait; returns once none is held
+    void close() {
+        closed_.store(true);
+        while (writers_.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+    void open() { closed_.store(false); }
+
+private:
+    alignas(64) std::atomic<int> writers_{0};
+    std::atomic<bool> closed_{false};
+};
+
+} // namespace mini_redis
@@ -0,0 +1,587 @@
+// Tests for the group-commit AOF logger
+
+#include "../src/storage/aof_logger.hpp"
+#include "../src/storage/kv_store.hpp"
+#include "../src/protocol/parser.hpp"
+#include "../src/protocol/command_table.hpp"
+#include <cassert>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+protocol::Command make_command(protocol::CommandType type, const std::string& name,
+                               std::vector<std::string> args) {
+    protocol::Command cmd;
+    cmd.type = type;
+    cmd.name = name;
+    cmd.args = std::move(args);
+    return cmd;
+}
+
+// Apply a write to the store (database db) and log it, as a server does
+void apply_and_log(AOFLogger& aof, KVStore& store, const protocol::Command& cmd, int db = 0) {
+    auto gate = aof.write_pass();
+    if (cmd.type == protocol::CommandType::SET) {
+        store.set(cmd.args[0], cmd.args[1]);
+    } else if (cmd.type == protocol::CommandType::INCR) {
+        store.incr(cmd.args[0]);
+    } else if (cmd.type == protocol::CommandType::PEXPIRE) {
+        store.pexpire(cmd.args[0], std::stoll(cmd.args[1]));
+    } else if (cmd.type == protocol::CommandType::MSET) {
+        store.mset(cmd.args);
+    } else if (cmd.type == protocol::CommandType::DEL) {
+        store.del_many(cmd.args);
+    } else if (cmd.type == protocol::CommandType::FLUSHDB) {
+        store.clear();
+    }
+    aof.append(cmd, db);
+}
+
+size_t count_of(const std::string& text, const std::string& word) {
+    size_t count = 0;
+    for (size_t pos = text.find(word); pos != std::string::npos; pos = text.find(word, pos + 1)) {
+        ++count;
+    }
+    return count;
+}
+
+void wait_for_rewrite(AOFLogger& aof) {
+    while (aof.rewrite_in_progress()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+std::string read_file(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+} // anonymous namespace
+
+void test_fsync_policy_parsing() {
+    std::cout << "Testing appendfsync policy parsing...\n";
+
+    AOFLogger::FsyncPolicy policy = AOFLogger::FsyncPolicy::No;
+    assert(AOFLogger::parse_fsync_policy("always", policy) && policy == AOFLogger::FsyncPolicy::Always);
+    assert(AOFLogger::parse_fsync_policy("everysec", policy) && policy == AOFLogger::FsyncPolicy::EverySec);
+    assert(AOFLogger::parse_fsync_policy("no", policy) && policy == AOFLogger::FsyncPolicy::No);
+    assert(!AOFLogger::parse_fsync_policy("sometimes", policy));
+    assert(policy == AOFLogger::FsyncPolicy::No); // Untouched on failure
+    assert(std::string(AOFLogger::fsync_policy_name(AOFLogger::FsyncPolicy::Always)) == "always");
+
+    std::cout << "appendfsync policy parsing tests passed!\n";
+}
+
+void test_aof_serialization() {
+    std::cout << "Testing AOF record serialization...\n";
+
+    const char* path = "test_aof_format.aof";
+    std::remove(path);
+    {
+        AOFLogger aof(path);
+        aof.start();
+        assert(aof.append(make_command(protocol::CommandType::SET, "SET", {"key", "value"})) != 0);
+        assert(aof.append(make_command(protocol::CommandType::GET, "GET", {"key"})) == 0); // Reads are not logged
+        aof.stop();
+    }
+    assert(read_file(path) == "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n");
+    std::remove(path);
+
+    std::cout << "AOF record serialization tests passed!\n";
+}
+
+void test_aof_concurrent_appends() {
+    std::cout << "Testing concurrent AOF appends and replay...\n";
+
+    const char* path = "test_aof_concurrent.aof";
+    std::remove(path);
+    const int threads = 4;
+    const int per_thread = 2000;
+    {
+        // Small ring: producers wrap around and wait for the writer many times
+        AOFLogger aof(path, AOFLogger::FsyncPolicy::No, 4096);
+        aof.start();
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&aof, t] {
+                for (int i = 0; i < per_thread; ++i) {
+                    std::string key = "k" + std::to_string(t) + ":" + std::to_string(i);
+                    aof.append(make_command(protocol::CommandType::SET, "SET", {key, std::string(i % 50, 'x')}));
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        aof.stop();
+    }
+
+    KVStore store;
+    store.set_eviction_limits(0, 0);
+    AOFLogger reader(path);
+    assert(reader.replay(store));
+    assert(store.size() == static_cast<size_t>(threads * per_thread));
+    std::string value;
+    for (int t = 0; t < threads; ++t) {
+        std::string key = "k" + std::to_string(t) + ":" + std::to_string(per_thread - 1);
+        assert(store.get(key, value) && value == std::string((per_thread - 1) % 50, 'x'));
+    }
+    std::remove(path);
+
+    std::cout << "Concurrent AOF append tests passed!\n";
+}
+
+void test_aof_always_and_large_records() {
+    std::cout << "Testing appendfsync always and large records...\n";
+
+    const char* path = "test_aof_always.aof";
+    std::remove(path);
+    std::string big(10000, 'b');
+    {
+        // Ring of 4 KB: the 10 KB value is logged out of line
+        AOFLogger aof(path, AOFLogger::FsyncPolicy::Always, 4096);
+        aof.start();
+        uint64_t first = aof.append(make_command(protocol::CommandType::SET, "SET", {"small", "1"}));
+        uint64_t second = aof.append(make_command(protocol::CommandType::SET, "SET", {"big", big}));
+        assert(first != 0 && second > first);
+        aof.wait_durable(second); // Returns once the batch is written and fsynced
+        assert(read_file(path).size() > big.size());
+        aof.append(make_command(protocol::CommandType::DEL, "DEL", {"small"}));
+        aof.stop();
+    }
+
+    KVStore store;
+    AOFLogger reader(path);
+    assert(reader.replay(store));
+    std::string value;
+    assert(store.get("big", value) && value == big);
+    assert(!store.exists("small"));
+    std::remove(path);
+
+    std::cout << "appendfsync always and large record tests passed!\n";
+}
+
+void test_aof_durable_listeners() {
+    std::cout << "Testing AOF durability listeners...\n";
+
+    const char* path = "test_aof_durable.aof";
+    std::remove(path);
+    {
+        AOFLogger aof(path, AOFLogger::FsyncPolicy::Always);
+        std::atomic<int> calls{0};
+        aof.add_durable_listener([&] { ++calls; });
+        aof.start();
+        assert(aof.durable(0));
+        uint64_t ticket = aof.append(make_command(protocol::CommandType::SET, "SET", {"k", "v"}));
+        // An event loop polls instead of blocking; the writer calls the listener after the fsync
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!aof.durable(ticket) && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        assert(aof.durable(ticket));
+        while (calls.load() == 0 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        assert(calls.load() > 0);
+        aof.stop();
+    }
+    {
+        // Nothing is held back under the other policies
+        AOFLogger aof(path, AOFLogger::FsyncPolicy::EverySec);
+        aof.start();
+        uint64_t ticket = aof.append(make_command(protocol::CommandType::SET, "SET", {"k", "v"}));
+        assert(aof.durable(ticket));
+        aof.stop();
+    }
+    std::remove(path);
+
+    std::cout << "AOF durability listener tests passed!\n";
+}
+
+void test_aof_write_failure() {
+#ifdef __linux__
+    std::cout << "Testing AOF write failure...\n";
+
+    // Every write to /dev/full fails with ENOSPC
+    AOFLogger aof("/dev/full", AOFLogger::FsyncPolicy::Always);
+    std::atomic<int> calls{0};
+    aof.add_durable_listener([&] { ++calls; });
+    aof.start();
+    assert(!aof.write_failed());
+    uint64_t ticket = aof.append(make_command(protocol::CommandType::SET, "SET", {"k", "v"}));
+    assert(!aof.wait_durable(ticket)); // Released by the failure, never reported durable
+    assert(aof.write_failed() && !aof.durable(ticket));
+    assert(!aof.write_error().empty());
+    assert(calls.load() > 0);
+    aof.stop();
+    assert(!aof.durable(ticket));
+
+    std::cout << "AOF write failure tests passed!\n";
+#endif
+}
+
+void test_aof_rewrite_compacts() {
+    std::cout << "Testing AOF rewrite...\n";
+
+    const char* path = "test_aof_rewrite.aof";
+    std::remove(path);
+    KVStore store;
+    {
+        AOFLogger aof(path);
+        aof.enable_rewrite(store, 0, 0);
+        assert(!aof.start_rewrite()); // Writer not running yet
+        aof.start();
+        for (int i = 0; i < 1000; ++i) {
+            apply_and_log(aof, store, make_command(protocol::CommandType::SET, "SET", {"key", std::to_string(i)}));
+            apply_and_log(aof, store, make_command(protocol::CommandType::INCR, "INCR", {"counter"}));
+        }
+        apply_and_log(aof, store, make_command(protocol::CommandType::PEXPIRE, "PEXPIRE", {"key", "60000"}));
+
+        assert(aof.start_rewrite());
+        wait_for_rewrite(aof);
+        assert(aof.rewrites() == 1);
+        assert(aof.current_size() == aof.base_size());
+        apply_and_log(aof, store, make_command(protocol::CommandType::INCR, "INCR", {"counter"}));
+        aof.stop();
+    }
+
+    // Two keys and a TTL, plus the INCR logged after the swap
+    std::string content = read_file(path);
+    assert(content.size() < 200);
+    assert(content.find("PEXPIREAT") != std::string::npos);
+
+    KVStore restored;
+    AOFLogger reader(path);
+    assert(reader.replay(restored));
+    std::string value;
+    assert(restored.get("key", value) && value == "999");
+    assert(restored.get("counter", value) && value == "1001");
+    assert(restored.pttl("key") > 59000);
+    std::remove(path);
+
+    std::cout << "AOF rewrite tests passed!\n";
+}
+
+void test_aof_rewrite_collections() {
+    std::cout << "Testing AOF rewrite of collections...\n";
+
+    const char* path = "test_aof_rewrite_collections.aof";
+    std::remove(path);
+    KVStore store;
+    size_t count = 0;
+    for (int i = 0; i < 200; ++i) {
+        store.hset({"hash", "f" + std::to_string(i), std::to_string(i)}, count);
+        store.push({"list", std::to_string(i)}, false, count);
+        store.sadd({"set", std::to_string(i)}, count);
+    }
+    ZAddArgs zadd;
+    zadd.items = {{0.5, "half"}, {-3, "neg"}};
+    size_t changed = 0;
+    store.zadd("zset", zadd, count, changed);
+    store.pexpire("zset", 60000);
+    {
+        AOFLogger aof(path);
+        aof.enable_rewrite(store, 0, 0);
+        aof.start();
+        assert(aof.start_rewrite());
+        wait_for_rewrite(aof);
+        aof.stop();
+    }
+
+    // Large collections are split into several commands
+    const std::string content = read_file(path);
+    assert(content.find("HSET") != content.rfind("HSET"));
+    assert(content.find("ZADD") != std::string::npos);
+
+    KVStore restored;
+    AOFLogger reader(path);
+    assert(reader.replay(restored));
+    ValueType type;
+    assert(restored.type_of("set", type) && type == ValueType::Set);
+    bool ok = false;
+    restored.read_collection<HashValue>("hash", [&](const HashValue& h) {
+        std::string_view value;
+        ok = h.size() == 200 && h.get("f150", value) && value == "150";
+    });
+    assert(ok);
+    restored.read_collection<ListValue>("list", [&](const ListValue& l) {
+        std::string first;
+        l.range(0, 0, [&](std::string_view v) { first = v; });
+        ok = l.size() == 200 && first == "0";
+    });
+    assert(ok);
+    restored.read_collection<ZSetValue>("zset", [&](const ZSetValue& z) {
+        double score = 0;
+        ok = z.score("neg", score) && score == -3;
+    });
+    assert(ok);
+    assert(restored.pttl("zset") > 59000);
+    std::remove(path);
+
+    std::cout << "AOF rewrite of collections tests passed!\n";
+}
+
+void test_aof_rewrite_during_writes() {
+    std::cout << "Testing AOF rewrite under concurrent writes...\n";
+
+    const char* path = "test_aof_rewrite_live.aof";
+    std::remove(path);
+    const int threads = 4;
+    const int keys = 100;
+    KVStore store;
+    store.set_eviction_limits(0, 0);
+    std::vector<int> ops(threads, 0);
+    {
+        AOFLogger aof(path, AOFLogger::FsyncPolicy::No, 64 * 1024);
+        aof.enable_rewrite(store, 0, 0);
+        aof.start();
+        // Enough data that each rewrite takes a while to snapshot
+        for (int i = 0; i < 20000; ++i) {
+            apply_and_log(aof, store, make_command(protocol::CommandType::SET, "SET",
+                                                   {"pad" + std::to_string(i), std::string(64, 'p')}));
+        }
+        std::atomic<bool> done{false};
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                // Counters are not idempotent: one applied twice on replay would show
+                for (int i = 0; !done || i < 1000; ++i) {
+                    apply_and_log(aof, store, make_command(protocol::CommandType::INCR, "INCR",
+                                                           {"c" + std::to_string(i % keys)}));
+                    apply_and_log(aof, store, make_command(protocol::CommandType::SET, "SET",
+                                                           {"k" + std::to_string(t), std::to_string(i)}));
+                    ops[t] = i + 1;
+                }
+            });
+        }
+        // Several rewrites while the writers run
+        for (int r = 0; r < 3; ++r) {
+            while (!aof.start_rewrite()) {
+                std::this_thread::yield();
+            }
+            wait_for_rewrite(aof);
+        }
+        done = true;
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        assert(aof.rewrites() == 3);
+        aof.stop();
+    }
+
+    KVStore restored;
+    restored.set_eviction_limits(0, 0);
+    AOFLogger reader(path);
+    assert(reader.replay(restored));
+    std::string value;
+    for (int c = 0; c < keys; ++c) {
+        int expected = 0;
+        for (int t = 0; t < threads; ++t) {
+            expected += ops[t] / keys + (ops[t] % keys > c ? 1 : 0);
+        }
+        assert(restored.get("c" + std::to_string(c), value) && value == std::to_string(expected));
+    }
+    for (int t = 0; t < threads; ++t) {
+        assert(restored.get("k" + std::to_string(t), value) && value == std::to_string(ops[t] - 1));
+    }
+    std::remove(path);
+
+    std::cout << "AOF rewrite under concurrent writes tests passed!\n";
+}
+
+void test_aof_rewrite_batches() {
+    std::cout << "Testing AOF rewrite of multi-key batches...\n";
+
+    const char* path = "test_aof_rewrite_batch.aof";
+    std::remove(path);
+    const int width = 16; // Keys per batch, spread over the shards
+    KVStore store;
+    store.set_eviction_limits(0, 0);
+    int batches = 0;
+    {
+        AOFLogger aof(path, AOFLogger::FsyncPolicy::No, 64 * 1024);
+        aof.enable_rewrite(store, 0, 0);
+        aof.start();
+        for (int i = 0; i < 20000; ++i) {
+            apply_and_log(aof, store, make_command(protocol::CommandType::SET, "SET",
+                                                   {"pad" + std::to_string(i), std::string(64, 'p')}));
+        }
+        std::atomic<bool> done{false};
+        std::thread writer([&] {
+            // Each batch sets every key, and a DEL every other batch removes
+            // half of them: a batch straddling a cut must leave no stale key
+            for (int i = 0; !done || i < 1000; ++i) {
+                std::vector<std::string> pairs;
+                std::vector<std::string> odd;
+                for (int k = 0; k < width; ++k) {
+                    pairs.push_back("b" + std::to_string(k));
+                    pairs.push_back(std::to_string(i));
+                    if (k % 2 == 1) {
+                        odd.push_back("b" + std::to_string(k));
+                    }
+                }
+                apply_and_log(aof, store, make_command(protocol::CommandType::MSET, "MSET", pairs));
+                if (i % 2 == 1) {
+                    apply_and_log(aof, store, make_command(protocol::CommandType::DEL, "DEL", odd));
+                }
+                batches = i + 1;
+            }
+        });
+        for (int r = 0; r < 3; ++r) {
+            while (!aof.start_rewrite()) {
+                std::this_thread::yield();
+            }
+            wait_for_rewrite(aof);
+        }
+        done = true;
+        writer.join();
+        assert(aof.rewrites() == 3);
+        aof.stop();
+    }
+
+    KVStore restored;
+    restored.set_eviction_limits(0, 0);
+    AOFLogger reader(path);
+    assert(reader.replay(restored));
+    const int last = batches - 1;
+    std::string value;
+    for (int k = 0; k < width; ++k) {
+        const std::string key = "b" + std::to_string(k);
+        if (k % 2 == 1 && last % 2 == 1) {
+            assert(!restored.exists(key));
+        } else {
+            assert(restored.get(key, value) && value == std::to_string(last));
+        }
+    }
+    std::remove(path);
+
+    std::cout << "AOF rewrite of multi-key batch tests passed!\n";
+}
+
+void test_aof_flush_during_rewrite() {
+    std::cout << "Testing AOF FLUSHDB during a rewrite...\n";
+
+    const char* path = "test_aof_rewrite_flush.aof";
+    std::remove(path);
+    KVStore store;
+    store.set_eviction_limits(0, 0);
+    {
+        AOFLogger aof(path, AOFLogger::FsyncPolicy::No, 64 * 1024);
+        aof.enable_rewrite(store, 0, 0);
+        aof.start();
+        for (int i = 0; i < 20000; ++i) {
+            apply_and_log(aof, store, make_command(protocol::CommandType::SET, "SET",
+                                                   {"pad" + std::to_string(i), std::string(64, 'p')}));
+        }
+        // Logged while the rewrite runs, the flush cancels it; logged before
+        // it captures anything, the snapshot is simply empty
+        assert(aof.start_rewrite());
+        apply_and_log(aof, store, make_command(protocol::CommandType::FLUSHDB, "FLUSHDB", {}));
+        apply_and_log(aof, store, make_command(protocol::CommandType::SET, "SET", {"after", "1"}));
+        wait_for_rewrite(aof);
+        assert(aof.rewrites() <= 1);
+        apply_and_log(aof, store, make_command(protocol::CommandType::SET, "SET", {"later", "2"}));
+        aof.stop();
+    }
+
+    KVStore restored;
+    restored.set_eviction_limits(0, 0);
+    AOFLogger reader(path);
+    assert(reader.replay(restored));
+    assert(restored.size() == 2);
+    std::string value;
+    assert(restored.get("after", value) && value == "1");
+    assert(restored.get("later", value) && value == "2");
+    std::remove(path);
+
+    std::cout << "AOF FLUSHDB during a rewrite tests passed!\n";
+}
+
+void test_aof_databases() {
+    std::cout << "Testing AOF logging and rewrite of several databases...\n";
+
+    const char* path = "test_aof_databases.aof";
+    std::remove(path);
+    {
+        AOFLogger aof(path);
+        aof.start();
+        aof.append(make_command(protocol::CommandType::SET, "SET", {"a", "zero"}), 0);
+        aof.append(make_command(protocol::CommandType::SET, "SET", {"a", "two"}), 2);
+        aof.append(make_command(protocol::CommandType::SET, "SET", {"b", "two"}), 2);
+        aof.append(make_command(protocol::CommandType::SET, "SET", {"c", "zero"}), 0);
+        aof.stop();
+    }
+    // A SELECT only where the database changes (none for the first, on 0)
+    assert(count_of(read_file(path), "SELECT") == 2);
+
+    std::vector<KVStore> dbs(3);
+    {
+        AOFLogger aof(path);
+        assert(aof.replay(dbs));
+        std::string value;
+        assert(dbs[0].size() == 2 && dbs[0].get("a", value) && value == "zero");
+        assert(dbs[1].size() == 0);
+        assert(dbs[2].size() == 2 && dbs[2].get("a", value) && value == "two");
+
+        // Appending after the replay carries on from the file's last SELECT,
+        // and a rewrite keeps each key in its database
+        aof.enable_rewrite(dbs, 0, 0);
+        aof.start();
+        apply_and_log(aof, dbs[0], make_command(protocol::CommandType::SET, "SET", {"d", "zero"}), 0);
+        apply_and_log(aof, dbs[1], make_command(protocol::CommandType::SET, "SET", {"d", "one"}), 1);
+        assert(aof.start_rewrite());
+        apply_and_log(aof, dbs[2], make_command(protocol::CommandType::INCR, "INCR", {"n"}), 2);
+        wait_for_rewrite(aof);
+        assert(aof.rewrites() == 1);
+        apply_and_log(aof, dbs[1], make_command(protocol::CommandType::INCR, "INCR", {"n"}), 1);
+        apply_and_log(aof, dbs[2], make_command(protocol::CommandType::INCR, "INCR", {"n"}), 2);
+        aof.stop();
+    }
+
+    std::vector<KVStore> restored(3);
+    AOFLogger reader(path);
+    assert(reader.replay(restored));
+    for (size_t db = 0; db < dbs.size(); ++db) {
+        assert(restored[db].size() == dbs[db].size());
+        for (const std::string& key : dbs[db].keys()) {
+            std::string expected;
+            std::string value;
+            assert(dbs[db].get(key, expected) && restored[db].get(key, value) && value == expected);
+        }
+    }
+    std::string value;
+    assert(restored[2].get("n", value) && value == "2");
+
+    // The commands of a database the replay lacks are skipped
+    std::vector<KVStore> fewer(2);
+    assert(reader.replay(fewer));
+    assert(fewer[0].size() == 3 && fewer[1].size() == 2);
+    std::remove(path);
+
+    std::cout << "AOF logging and rewrite of several databases tests passed!\n";
+}
+
+void run_aof_logger_tests() {
+    test_fsync_policy_parsing();
+    test_aof_serialization();
+    test_aof_concurrent_appends();
+    test_aof_always_and_large_records();
+    test_aof_durable_listeners();
+    test_aof_write_failure();
+    test_aof_rewrite_compacts();
+    test_aof_rewrite_collections();
+    test_aof_rewrite_during_writes();
+    test_aof_rewrite_batches();
+    test_aof_flush_during_rewrite();
+    test_aof_databases();
+}
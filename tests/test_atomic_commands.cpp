@@ -93,6 +93,13 @@ void test_incrby() {
     auto [val4, err4] = kv.incrby("name", 1);
     assert(!err4.empty());
 
+    // Overflow is an error and leaves the value alone
+    kv.set("max", std::to_string(std::numeric_limits<int64_t>::max()));
+    auto [val5, err5] = kv.incrby("max", 1);
+    assert(err5 == "ERR increment or decrement would overflow");
+    auto [val6, err6] = kv.incrby("max", -1);
+    assert(err6.empty() && val6 == std::numeric_limits<int64_t>::max() - 1);
+
     std::cout << "INCRBY tests passed!\n";
 }
 
@@ -115,6 +122,13 @@ void test_decrby() {
     assert(err3.empty());
     assert(val3 == 2);
 
+    // Negating the smallest int64 would overflow
+    auto [val4, err4] = kv.decrby("counter", std::numeric_limits<int64_t>::min());
+    assert(!err4.empty());
+    kv.set("min", std::to_string(std::numeric_limits<int64_t>::min()));
+    auto [val5, err5] = kv.decrby("min", 1);
+    assert(!err5.empty());
+
     std::cout << "DECRBY tests passed!\n";
 }
 
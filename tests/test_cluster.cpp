@@ -0,0 +1,380 @@
+// Tests for cluster mode: hash slots, key migration records, routing and
+// online slot migration between two nodes
+
+#include "../src/server/cluster.hpp"
+#include "../src/storage/kv_store.hpp"
+#include "../src/protocol/parser.hpp"
+#include "../src/protocol/resp_parser.hpp"
+#include "../src/protocol/resp_utils.hpp"
+#include "../src/utils/crc16.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+
+namespace {
+
+uint16_t slot_of(const std::string& key) {
+    return mini_redis::key_hash_slot(key);
+}
+
+std::string reply_of(ClusterState& cluster, std::vector<std::string> args) {
+    std::string out;
+    mini_redis::ReplyWriter reply(out);
+    cluster.command(args, reply);
+    return out;
+}
+
+// route for a single key, outside any migration guard
+std::string route_of(ClusterState& cluster, const std::vector<std::string>& keys, bool asking = false) {
+    std::shared_lock<std::shared_mutex> guard;
+    return cluster.route(keys, 0, keys.size(), 1, asking, guard);
+}
+
+template <typename Pred>
+bool eventually(Pred pred) {
+    for (int i = 0; i < 1000; ++i) {
+        if (pred()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+// A node: its database, cluster state and a server answering what other
+// nodes send it (CLUSTER and RESTORE-RECORDS)
+class Node {
+public:
+    Node() {
+        mini_redis::net_init();
+        listener_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        assert(bind(listener_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        assert(listen(listener_, 16) == 0);
+        socklen_t len = sizeof(addr);
+        getsockname(listener_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port = ntohs(addr.sin_port);
+        store.set_eviction_limits(0, 0);
+        cluster = std::make_unique<ClusterState>(
+            store,
+            [this](const std::vector<std::string>& keys) {
+                for (const auto& key : keys) {
+                    store.del(key);
+                }
+            },
+            "127.0.0.1", port, "");
+        server_ = std::thread([this] { serve(); });
+        cluster->start();
+    }
+
+    ~Node() {
+        cluster->stop();
+        serving_ = false;
+        server_.join();
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& handler : handlers_) {
+            handler.join();
+        }
+        closesocket(listener_);
+    }
+
+    KVStore store;
+    std::unique_ptr<ClusterState> cluster;
+    int port = 0;
+
+private:
+    void serve() {
+        while (serving_) {
+            if (!mini_redis::wait_readable(listener_, 50)) {
+                continue;
+            }
+            SOCKET client = accept(listener_, nullptr, nullptr);
+            std::lock_guard<std::mutex> lock(mutex_);
+            handlers_.emplace_back([this, client] {
+                handle(client);
+                closesocket(client);
+            });
+        }
+    }
+
+    void handle(SOCKET client) {
+        RespParser parser;
+        std::vector<std::string_view> args;
+        std::string error;
+        char chunk[16 * 1024];
+        while (serving_) {
+            if (!mini_redis::wait_readable(client, 50)) {
+                continue;
+            }
+            const int n = static_cast<int>(recv(client, chunk, sizeof(chunk), 0));
+            if (n <= 0) {
+                return;
+            }
+            parser.append(chunk, static_cast<size_t>(n));
+            while (parser.parseArgs(args, error) == RespStatus::Complete) {
+                protocol::Command cmd = protocol::command_from_resp_args(args);
+                std::string out;
+                mini_redis::ReplyWriter reply(out);
+                if (cmd.type == protocol::CommandType::CLUSTER) {
+                    cluster->command(cmd.args, reply);
+                } else if (cmd.type == protocol::CommandType::RESTORE_RECORDS) {
+                    if (store.restore_records(cmd.args[0])) {
+                        reply.simple("OK");
+                    } else {
+                        reply.error("ERR Bad data format");
+                    }
+                } else {
+                    reply.error("ERR unexpected command");
+                }
+                send(client, out.data(), static_cast<int>(out.size()), 0);
+            }
+        }
+    }
+
+    SOCKET listener_ = INVALID_SOCKET;
+    std::thread server_;
+    std::atomic<bool> serving_{true};
+    std::mutex mutex_;
+    std::vector<std::thread> handlers_;
+};
+
+} // anonymous namespace
+
+void test_cluster_hash_slots() {
+    std::cout << "Testing cluster hash slots...\n";
+
+    assert(mini_redis::crc16("123456789", 9) == 0x31c3);
+    assert(mini_redis::crc16("", 0) == 0);
+    // Slots as Redis Cluster assigns them
+    assert(slot_of("foo") == 12182);
+    assert(slot_of("bar") == 5061);
+    assert(slot_of("") == 0);
+
+    // Hash tags: only the part between the first { and the next } counts
+    assert(slot_of("{user1000}.following") == slot_of("{user1000}.followers"));
+    assert(slot_of("{user1000}.following") == slot_of("user1000"));
+    assert(slot_of("foo{}{bar}") == slot_of("foo{}{bar}") && slot_of("foo{}{bar}") != slot_of("bar"));
+    assert(slot_of("foo{{bar}}zap") == slot_of("{bar"));
+    assert(slot_of("foo{bar}{zap}") == slot_of("bar"));
+    assert(slot_of("{bar") != slot_of("bar"));
+
+    std::set<uint16_t> slots;
+    for (int i = 0; i < 10000; ++i) {
+        const uint16_t slot = slot_of("key:" + std::to_string(i));
+        assert(slot < mini_redis::CLUSTER_SLOTS);
+        slots.insert(slot);
+    }
+    assert(slots.size() > 6000); // Spread across the slot space
+
+    std::cout << "Cluster hash slot tests passed!\n";
+}
+
+void test_cluster_scan_and_records() {
+    std::cout << "Testing keyspace scan and migration records...\n";
+
+    KVStore source(4);
+    source.set_eviction_limits(0, 0);
+    for (int i = 0; i < 3000; ++i) {
+        source.set("k" + std::to_string(i), "v" + std::to_string(i));
+    }
+    source.set("{tag}a", "1");
+    source.set("{tag}b", std::string(200, 'x'));
+    source.set("{tag}c", "12345");
+    assert(source.expire("{tag}c", 100));
+
+    // A full scan sees every key once, here with no writes in between
+    KVStore::ScanCursor cursor;
+    std::vector<std::string> keys;
+    size_t steps = 0;
+    while (source.scan(cursor, 100, keys)) {
+        ++steps;
+    }
+    assert(steps > 10);
+    assert(keys.size() == source.size());
+    assert(std::set<std::string>(keys.begin(), keys.end()).size() == keys.size());
+
+    // A filtered scan keeps only the keys of one slot
+    const uint16_t tag_slot = slot_of("{tag}");
+    cursor = KVStore::ScanCursor{};
+    keys.clear();
+    while (source.scan(cursor, 64, keys, [&](std::string_view key) { return slot_of(std::string(key)) == tag_slot; })) {
+    }
+    std::set<std::string> tagged(keys.begin(), keys.end());
+    assert(tagged.count("{tag}a") && tagged.count("{tag}b") && tagged.count("{tag}c"));
+    for (const auto& key : keys) {
+        assert(slot_of(key) == tag_slot);
+    }
+
+    // Records round trip: values, encodings and TTLs
+    keys = {"{tag}a", "{tag}b", "{tag}c", "missing"};
+    std::string payload;
+    assert(source.dump_records(keys, payload) == 3);
+    KVStore target;
+    target.set("{tag}a", "old");
+    size_t restored = 0;
+    assert(target.restore_records(payload, &restored) && restored == 3);
+    std::string value;
+    assert(target.get("{tag}a", value) && value == "1");
+    assert(target.get("{tag}b", value) && value == std::string(200, 'x'));
+    assert(target.get("{tag}c", value) && value == "12345");
+    assert(target.ttl("{tag}c") > 90 && target.ttl("{tag}c") <= 100);
+    assert(target.ttl("{tag}a") == -1);
+    assert(target.incr("{tag}c").first == 12346);
+
+    // Malformed input stores nothing
+    KVStore empty;
+    assert(!empty.restore_records(payload.substr(0, payload.size() - 3)));
+    assert(!empty.restore_records(std::string(payload) + "x"));
+    assert(empty.size() == 0);
+    assert(empty.restore_records("") && empty.size() == 0);
+
+    std::cout << "Keyspace scan and migration record tests passed!\n";
+}
+
+void test_cluster_routing() {
+    std::cout << "Testing cluster routing...\n";
+
+    KVStore store;
+    ClusterState cluster(store, nullptr, "127.0.0.1", 7000, "");
+    assert(cluster.myid().size() == 40);
+
+    // Nothing is served until slots are assigned
+    assert(route_of(cluster, {"foo"}).rfind("CLUSTERDOWN", 0) == 0);
+    assert(reply_of(cluster, {"ADDSLOTSRANGE", "0", "8191"}) == "+OK\r\n");
+    assert(reply_of(cluster, {"ADDSLOTS", "12182"}) == "+OK\r\n");
+    assert(reply_of(cluster, {"ADDSLOTS", "12182"}) == "-ERR Slot 12182 is already busy\r\n");
+    assert(reply_of(cluster, {"ADDSLOTS", "16384"}).rfind("-ERR Invalid", 0) == 0);
+
+    assert(route_of(cluster, {"foo"}).empty());
+    assert(route_of(cluster, {"bar"}).empty());
+    assert(route_of(cluster, {"{bar}x", "{bar}y"}).empty());
+    assert(route_of(cluster, {"foo", "bar"}) == "CROSSSLOT Keys in request don't hash to the same slot");
+    assert(reply_of(cluster, {"KEYSLOT", "foo"}) == ":12182\r\n");
+
+    assert(reply_of(cluster, {"DELSLOTS", "12182"}) == "+OK\r\n");
+    assert(route_of(cluster, {"foo"}).rfind("CLUSTERDOWN", 0) == 0);
+
+    const std::string slots = reply_of(cluster, {"SLOTS"});
+    assert(slots.rfind("*1\r\n*3\r\n:0\r\n:8191\r\n*3\r\n$9\r\n127.0.0.1\r\n:7000\r\n", 0) == 0);
+    const std::string nodes = reply_of(cluster, {"NODES"});
+    assert(nodes.find(cluster.myid() + " 127.0.0.1:7000@17000 myself,master - 0 0 0 connected 0-8191\n") !=
+           std::string::npos);
+    assert(reply_of(cluster, {"INFO"}).find("cluster_slots_assigned:8192\r\n") != std::string::npos);
+
+    // Slot state changes need a known node
+    assert(reply_of(cluster, {"SETSLOT", "5061", "MIGRATING", std::string(40, 'a')}).rfind("-ERR I don't know", 0) == 0);
+    assert(reply_of(cluster, {"SETSLOT", "5061", "MIGRATING", cluster.myid()}).rfind("-ERR I can't", 0) == 0);
+    assert(reply_of(cluster, {"NOPE"}).rfind("-ERR unknown subcommand", 0) == 0);
+
+    store.set("bar", "1");
+    store.set("{bar}2", "2");
+    assert(reply_of(cluster, {"COUNTKEYSINSLOT", "5061"}) == ":2\r\n");
+    assert(reply_of(cluster, {"GETKEYSINSLOT", "5061", "1"}).rfind("*1\r\n", 0) == 0);
+
+    std::cout << "Cluster routing tests passed!\n";
+}
+
+void test_cluster_slot_migration() {
+    std::cout << "Testing online slot migration...\n";
+
+    Node a;
+    Node b;
+    assert(reply_of(*a.cluster, {"ADDSLOTSRANGE", "0", "8191"}) == "+OK\r\n");
+    assert(reply_of(*b.cluster, {"ADDSLOTSRANGE", "8192", "16383"}) == "+OK\r\n");
+
+    // One MEET and both nodes learn each other and their slots
+    assert(reply_of(*a.cluster, {"MEET", "127.0.0.1", std::to_string(b.port)}) == "+OK\r\n");
+    assert(eventually([&] {
+        return route_of(*a.cluster, {"foo"}) == "MOVED 12182 127.0.0.1:" + std::to_string(b.port) &&
+               route_of(*b.cluster, {"bar"}) == "MOVED 5061 127.0.0.1:" + std::to_string(a.port);
+    }));
+    assert(reply_of(*a.cluster, {"INFO"}).find("cluster_state:ok") != std::string::npos);
+
+    // Slot 5061 ("bar") holds more keys than one batch
+    const int count = 2500;
+    for (int i = 0; i < count; ++i) {
+        a.store.set("{bar}" + std::to_string(i), "v" + std::to_string(i));
+    }
+    a.store.set("other", "stays");
+    const std::string b_id = b.cluster->myid();
+
+    // The node refuses to hand over a slot it still holds keys for
+    assert(reply_of(*a.cluster, {"SETSLOT", "5061", "NODE", b_id}).rfind("-ERR Can't assign", 0) == 0);
+
+    // A writer keeps going through the migration, following redirects
+    std::atomic<bool> writing{true};
+    std::atomic<int> writes{0};
+    std::thread writer([&] {
+        for (int i = 0; writing; i = (i + 1) % count) {
+            std::vector<std::string> key = {"{bar}" + std::to_string(i)};
+            std::shared_lock<std::shared_mutex> guard;
+            std::string where = a.cluster->route(key, 0, 1, 1, false, guard);
+            if (where.empty()) {
+                a.store.append(key[0], "+");
+                guard.unlock();
+            } else {
+                assert(where.rfind("ASK 5061 ", 0) == 0 || where.rfind("MOVED 5061 ", 0) == 0);
+                std::shared_lock<std::shared_mutex> there;
+                assert(b.cluster->route(key, 0, 1, 1, where[0] == 'A', there).empty());
+                b.store.append(key[0], "+");
+            }
+            writes++;
+        }
+    });
+    assert(eventually([&] { return writes > 200; }));
+
+    assert(reply_of(*a.cluster, {"MIGRATE", "5061", b_id}) == "+OK\r\n");
+    assert(reply_of(*a.cluster, {"MIGRATE", "5061", b_id}).rfind("-ERR A slot migration", 0) == 0);
+    assert(eventually([&] {
+        return reply_of(*a.cluster, {"INFO"}).find("cluster_migration_in_progress:0") != std::string::npos;
+    }));
+    const int before_done = writes;
+    assert(eventually([&] { return writes > before_done + 200; }));
+    writing = false;
+    writer.join();
+
+    // Every key moved with every write made to it, wherever it was then
+    assert(reply_of(*a.cluster, {"COUNTKEYSINSLOT", "5061"}) == ":0\r\n");
+    assert(reply_of(*b.cluster, {"COUNTKEYSINSLOT", "5061"}) == ":" + std::to_string(count) + "\r\n");
+    size_t appended = 0;
+    for (int i = 0; i < count; ++i) {
+        std::string value;
+        assert(b.store.get("{bar}" + std::to_string(i), value));
+        const std::string base = "v" + std::to_string(i);
+        assert(value.compare(0, base.size(), base) == 0);
+        appended += value.size() - base.size();
+    }
+    assert(appended == static_cast<size_t>(writes.load()));
+    std::string value;
+    assert(a.store.get("other", value) && value == "stays");
+
+    // The target owns the slot with a newer epoch, and both nodes agree
+    assert(route_of(*a.cluster, {"bar"}) == "MOVED 5061 127.0.0.1:" + std::to_string(b.port));
+    assert(route_of(*b.cluster, {"bar"}).empty());
+    assert(reply_of(*b.cluster, {"INFO"}).find("cluster_my_epoch:1") != std::string::npos);
+    assert(reply_of(*a.cluster, {"INFO"}).find("cluster_slots_migrating:0") != std::string::npos);
+    assert(reply_of(*b.cluster, {"INFO"}).find("cluster_slots_importing:0") != std::string::npos);
+    assert(eventually([&] {
+        return reply_of(*a.cluster, {"NODES"}).find(" 1 connected 5061 8192-16383") != std::string::npos;
+    }));
+
+    std::cout << "Online slot migration tests passed!\n";
+}
+
+void run_cluster_tests() {
+    test_cluster_hash_slots();
+    test_cluster_scan_and_records();
+    test_cluster_routing();
+    test_cluster_slot_migration();
+}
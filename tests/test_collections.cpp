@@ -0,0 +1,403 @@
+// Tests for the collection types
+// Verifies the listpack encoding, each type's conversion from its compact
+// encoding, the skiplist's order and range walks, type checks against string
+// commands, memory accounting, and that typed records survive dump and restore
+
+#include "../src/storage/kv_store.hpp"
+#include "../src/storage/listpack.hpp"
+#include "../src/storage/collections.hpp"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::vector<std::string> list_contents(const ListValue& list) {
+    std::vector<std::string> out;
+    list.range(0, list.size() == 0 ? 0 : list.size() - 1, [&](std::string_view v) { out.emplace_back(v); });
+    return out;
+}
+
+std::vector<std::string> zrange(const ZSetValue& zset, const ScoreRange& range, size_t offset = 0,
+                                int64_t count = -1) {
+    std::vector<std::string> out;
+    zset.range_by_score(range, offset, count, [&](std::string_view member, double) { out.emplace_back(member); });
+    return out;
+}
+
+} // anonymous namespace
+
+void test_listpack() {
+    std::cout << "Testing listpack...\n";
+
+    Listpack lp;
+    assert(lp.empty() && lp.last() == lp.end());
+    lp.push_back("b");
+    lp.push_front("a");
+    lp.push_back(std::string(300, 'x')); // A two-byte length and backlen
+    lp.push_back("");
+    assert(lp.size() == 4);
+
+    // Forward and backward walks agree
+    std::vector<std::string> forward;
+    lp.for_each([&](std::string_view v) { forward.emplace_back(v); });
+    assert((forward == std::vector<std::string>{"a", "b", std::string(300, 'x'), ""}));
+    std::vector<std::string> backward;
+    for (size_t pos = lp.last();; pos = lp.prev(pos)) {
+        backward.emplace_back(lp.at(pos));
+        if (pos == lp.begin()) {
+            break;
+        }
+    }
+    assert(backward.size() == 4 && backward[0].empty() && backward[3] == "a");
+
+    assert(lp.find("b") != lp.end());
+    assert(lp.find("missing") == lp.end());
+    // A stride of 2 only looks at even entries
+    assert(lp.find("b", 2) == lp.end());
+
+    lp.replace(lp.find("b"), "longer value");
+    assert(lp.at(lp.next(lp.begin())) == "longer value");
+    lp.erase(lp.begin(), 2);
+    assert(lp.size() == 2 && lp.at(lp.begin()) == std::string(300, 'x'));
+
+    // parse accepts its own encoding and rejects a truncated one
+    Listpack copy;
+    assert(Listpack::parse(lp.data(), copy) && copy.size() == 2);
+    std::string cut(lp.data().substr(0, lp.data().size() - 1));
+    assert(!Listpack::parse(cut, copy) && copy.size() == 2);
+
+    std::cout << "Listpack tests passed!\n";
+}
+
+void test_hash_encoding() {
+    std::cout << "Testing hash encodings...\n";
+
+    HashValue hash;
+    assert(hash.set("f1", "v1"));
+    assert(!hash.set("f1", "v2"));
+    std::string_view value;
+    assert(hash.get("f1", value) && value == "v2");
+    assert(!hash.get("v2", value)); // Values are not fields
+    assert(std::strcmp(hash.encoding(), "listpack") == 0);
+
+    for (size_t i = 0; i < HashValue::LISTPACK_MAX_ENTRIES; ++i) {
+        hash.set("field:" + std::to_string(i), std::to_string(i));
+    }
+    assert(std::strcmp(hash.encoding(), "hashtable") == 0);
+    assert(hash.size() == HashValue::LISTPACK_MAX_ENTRIES + 1);
+    assert(hash.get("f1", value) && value == "v2");
+    assert(hash.get("field:77", value) && value == "77");
+
+    // A long value converts a small hash too
+    HashValue small;
+    small.set("f", std::string(HashValue::LISTPACK_MAX_VALUE + 1, 'v'));
+    assert(std::strcmp(small.encoding(), "hashtable") == 0);
+
+    std::cout << "Hash encoding tests passed!\n";
+}
+
+void test_list_encoding() {
+    std::cout << "Testing list encodings...\n";
+
+    ListValue list;
+    list.push_back("b");
+    list.push_front("a");
+    list.push_back("c");
+    assert((list_contents(list) == std::vector<std::string>{"a", "b", "c"}));
+    assert(std::strcmp(list.encoding(), "listpack") == 0);
+
+    for (int i = 0; i < 1000; ++i) {
+        list.push_back(std::to_string(i));
+    }
+    assert(std::strcmp(list.encoding(), "quicklist") == 0);
+    assert(list.size() == 1003);
+
+    // A range that spans node boundaries
+    std::vector<std::string> middle;
+    list.range(200, 205, [&](std::string_view v) { middle.emplace_back(v); });
+    assert((middle == std::vector<std::string>{"197", "198", "199", "200", "201", "202"}));
+
+    std::string popped;
+    assert(list.pop_back(popped) && popped == "999");
+    while (list.pop_back(popped)) {
+    }
+    assert(popped == "a" && list.size() == 0);
+    assert(list.memory() == sizeof(ListValue));
+
+    std::cout << "List encoding tests passed!\n";
+}
+
+void test_set_encoding() {
+    std::cout << "Testing set encodings...\n";
+
+    SetValue ints;
+    assert(ints.add("3") && ints.add("-1") && !ints.add("3"));
+    assert(std::strcmp(ints.encoding(), "intset") == 0);
+    assert(ints.contains("-1") && !ints.contains("03") && !ints.contains("x"));
+
+    // The first non-integer moves a small set to a listpack
+    assert(ints.add("x"));
+    assert(std::strcmp(ints.encoding(), "listpack") == 0);
+    assert(ints.contains("3") && ints.contains("x") && ints.size() == 3);
+
+    SetValue many;
+    for (size_t i = 0; i <= SetValue::INTSET_MAX_ENTRIES; ++i) {
+        many.add(std::to_string(i));
+    }
+    assert(std::strcmp(many.encoding(), "hashtable") == 0);
+    assert(many.contains("512") && many.size() == SetValue::INTSET_MAX_ENTRIES + 1);
+
+    SetValue words;
+    for (size_t i = 0; i <= SetValue::LISTPACK_MAX_ENTRIES; ++i) {
+        words.add("member:" + std::to_string(i));
+    }
+    assert(std::strcmp(words.encoding(), "hashtable") == 0);
+    assert(words.contains("member:0"));
+
+    std::cout << "Set encoding tests passed!\n";
+}
+
+void test_sorted_set() {
+    std::cout << "Testing sorted sets...\n";
+
+    double score = 0;
+    bool exclusive = false;
+    assert(parse_score("+inf", score) && score > 1e308);
+    assert(parse_score("-2.5", score) && score == -2.5);
+    assert(!parse_score("nan", score) && !parse_score("1x", score) && !parse_score("", score));
+    assert(parse_score_bound("(5", score, exclusive) && exclusive && score == 5);
+    assert(format_score(1.5) == "1.5" && format_score(3) == "3");
+
+    // Both encodings give the same answers
+    for (int members : {10, 1000}) {
+        ZSetValue zset;
+        for (int i = members - 1; i >= 0; --i) {
+            assert(zset.add("m" + std::to_string(i), i) == ZSetValue::AddResult::Added);
+        }
+        assert(std::strcmp(zset.encoding(), members > 128 ? "skiplist" : "listpack") == 0);
+        assert(zset.add("m3", 3) == ZSetValue::AddResult::Unchanged);
+        assert(zset.add("m3", 3.5, ZSetValue::ADD_NX) == ZSetValue::AddResult::Unchanged);
+        assert(zset.add("new", 1, ZSetValue::ADD_XX) == ZSetValue::AddResult::Unchanged);
+        assert(zset.add("m0", 4.5) == ZSetValue::AddResult::Updated);
+        assert(zset.score("m0", score) && score == 4.5);
+        assert(!zset.score("new", score));
+
+        ScoreRange range;
+        range.min = 3;
+        range.max = 5;
+        assert((zrange(zset, range) == std::vector<std::string>{"m3", "m4", "m0", "m5"}));
+        range.min_exclusive = true;
+        range.max_exclusive = true;
+        assert((zrange(zset, range) == std::vector<std::string>{"m4", "m0"}));
+        range.min_exclusive = false;
+        assert((zrange(zset, range, 1, 2) == std::vector<std::string>{"m4", "m0"}));
+
+        // Equal scores order by member
+        zset.add("a", 4);
+        range.min = 4;
+        range.max = 4;
+        range.max_exclusive = false;
+        assert((zrange(zset, range) == std::vector<std::string>{"a", "m4"}));
+    }
+
+    ZSkipList list;
+    list.insert(2, "b");
+    list.insert(1, "a");
+    list.insert(2, "a");
+    assert(list.erase(2, "a") && !list.erase(2, "a"));
+    ScoreRange all{-1e9, 1e9, false, false};
+    const ZSkipList::Node* node = list.first_in(all);
+    assert(node->member() == "a" && node->next()->member() == "b" && node->next()->next() == nullptr);
+
+    ZAddArgs args;
+    std::vector<std::string> zadd_args = {"z", "nx", "CH", "1", "one", "2", "two"};
+    assert(parse_zadd(zadd_args, args) == nullptr);
+    assert(args.flags == ZSetValue::ADD_NX && args.changed && args.items.size() == 2);
+    ZAddArgs bad;
+    std::vector<std::string> both = {"z", "NX", "XX", "1", "one"};
+    assert(parse_zadd(both, bad) != nullptr);
+    std::vector<std::string> odd = {"z", "1", "one", "2"};
+    assert(parse_zadd(odd, bad) != nullptr);
+
+    std::cout << "Sorted set tests passed!\n";
+}
+
+void test_collection_commands() {
+    std::cout << "Testing collection store commands...\n";
+
+    KVStore kv(4);
+    size_t count = 0;
+    assert(kv.hset({"h", "a", "1", "b", "2"}, count) == KVStore::Lookup::Found && count == 2);
+    assert(kv.hset({"h", "a", "3"}, count) == KVStore::Lookup::Found && count == 0);
+    assert(kv.push({"l", "a", "b"}, false, count) == KVStore::Lookup::Found && count == 2);
+    assert(kv.sadd({"s", "1", "2", "1"}, count) == KVStore::Lookup::Found && count == 2);
+    ZAddArgs zadd;
+    zadd.items = {{1.0, "one"}, {2.0, "two"}};
+    size_t changed = 0;
+    assert(kv.zadd("z", zadd, count, changed) == KVStore::Lookup::Found && count == 2);
+
+    ValueType type;
+    assert(kv.type_of("h", type) && type == ValueType::Hash);
+    assert(kv.type_of("z", type) && type == ValueType::ZSet);
+    assert(!kv.type_of("missing", type));
+
+    // String commands and other types reject a collection
+    std::string value;
+    assert(!kv.get("h", value));
+    bool wrong_type = false;
+    assert(!kv.read_value("l", [](std::string_view) {}, &wrong_type) && wrong_type);
+    wrong_type = false;
+    kv.append("s", "x", &wrong_type);
+    assert(wrong_type);
+    assert(kv.incr("z").second == KVStore::WRONGTYPE_ERROR);
+    assert(kv.sadd({"h", "x"}, count) == KVStore::Lookup::WrongType);
+    assert(kv.push({"z", "x"}, true, count) == KVStore::Lookup::WrongType);
+    kv.set("str", "v");
+    assert(kv.hset({"str", "f", "v"}, count) == KVStore::Lookup::WrongType);
+    assert(kv.read_collection<HashValue>("str", [](const HashValue&) {}) == KVStore::Lookup::WrongType);
+
+    std::string_view field;
+    bool found = false;
+    assert(kv.read_collection<HashValue>("h", [&](const HashValue& h) { found = h.get("a", field) && field == "3"; }) ==
+           KVStore::Lookup::Found);
+    assert(found);
+
+    // XX never creates the key
+    ZAddArgs xx;
+    xx.flags = ZSetValue::ADD_XX;
+    xx.items = {{1.0, "one"}};
+    assert(kv.zadd("z2", xx, count, changed) == KVStore::Lookup::Missing && !kv.exists("z2"));
+
+    // Popping the last element removes the key
+    std::vector<std::string> popped;
+    assert(kv.rpop("l", 10, popped) == KVStore::Lookup::Found);
+    assert((popped == std::vector<std::string>{"b", "a"}));
+    assert(!kv.exists("l"));
+    assert(kv.rpop("l", 1, popped) == KVStore::Lookup::Missing);
+
+    // SET replaces a collection
+    kv.set("h", "now a string");
+    assert(kv.get("h", value) && value == "now a string");
+
+    std::cout << "Collection store command tests passed!\n";
+}
+
+void test_collection_memory() {
+    std::cout << "Testing collection memory accounting...\n";
+
+    KVStore kv(1);
+    kv.set_eviction_limits(0, 0);
+    const size_t empty = kv.used_memory();
+    size_t count = 0;
+    for (int i = 0; i < 5000; ++i) {
+        kv.hset({"big", "field:" + std::to_string(i), std::string(100, 'v')}, count);
+    }
+    // At least the bytes of the fields and values
+    const size_t full = kv.used_memory();
+    assert(full - empty > 5000 * 100);
+
+    // Every byte comes back with the key
+    kv.del("big");
+    assert(kv.used_memory() == empty);
+
+    for (int i = 0; i < 1000; ++i) {
+        kv.push({"list", std::string(50, 'x')}, false, count);
+    }
+    std::vector<std::string> popped;
+    kv.rpop("list", 1000, popped);
+    assert(kv.used_memory() == empty);
+
+    // A maxmemory budget evicts collections too
+    KVStore bounded(1);
+    bounded.set_eviction_limits(0, 200 * 1024);
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j < 50; ++j) {
+            bounded.sadd({"set:" + std::to_string(i), "member:" + std::to_string(j) + std::string(40, 'm')}, count);
+        }
+    }
+    assert(bounded.used_memory() <= 200 * 1024);
+    assert(bounded.evicted_keys() > 0);
+
+    std::cout << "Collection memory accounting tests passed!\n";
+}
+
+void test_collection_persistence() {
+    std::cout << "Testing collection dump, restore and RDB...\n";
+
+    KVStore kv(4);
+    size_t count = 0;
+    kv.hset({"h", "f", "v"}, count);
+    for (int i = 0; i < 300; ++i) {
+        kv.push({"l", std::to_string(i)}, false, count);
+        kv.sadd({"s", "m" + std::to_string(i)}, count);
+    }
+    ZAddArgs zadd;
+    zadd.items = {{-1.5, "low"}, {1e100, "high"}};
+    size_t changed = 0;
+    kv.zadd("z", zadd, count, changed);
+    kv.pexpire("z", 60000);
+    kv.set("str", "plain");
+
+    const std::vector<std::string> keys = {"h", "l", "s", "z", "str", "missing"};
+    std::string records;
+    assert(kv.dump_records(keys, records) == 5);
+
+    auto check = [&](KVStore& restored) {
+        std::string_view value;
+        bool ok = false;
+        restored.read_collection<HashValue>("h", [&](const HashValue& h) { ok = h.get("f", value) && value == "v"; });
+        assert(ok);
+        restored.read_collection<ListValue>("l", [&](const ListValue& l) {
+            std::vector<std::string> all = list_contents(l);
+            ok = all.size() == 300 && all.front() == "0" && all.back() == "299";
+        });
+        assert(ok);
+        restored.read_collection<SetValue>("s", [&](const SetValue& s) { ok = s.size() == 300 && s.contains("m7"); });
+        assert(ok);
+        restored.read_collection<ZSetValue>("z", [&](const ZSetValue& z) {
+            double score = 0;
+            ok = z.score("high", score) && score == 1e100 && z.score("low", score) && score == -1.5;
+        });
+        assert(ok);
+        assert(restored.pttl("z") > 59000);
+        std::string str;
+        assert(restored.get("str", str) && str == "plain");
+    };
+
+    KVStore target(2);
+    size_t restored = 0;
+    assert(target.restore_records(records, &restored) && restored == 5);
+    check(target);
+
+    // A collection whose elements are damaged rejects the whole batch
+    std::string damaged = records;
+    const size_t pos = damaged.find("299");
+    damaged[pos + 3] = '\x7f';
+    KVStore untouched(2);
+    assert(!untouched.restore_records(damaged) && untouched.size() == 0);
+
+    const char* path = "test_collections.rdb";
+    assert(kv.save_to_rdb(path));
+    KVStore loaded(3);
+    assert(loaded.load_from_rdb(path));
+    assert(loaded.size() == 5);
+    check(loaded);
+    std::remove(path);
+
+    std::cout << "Collection dump, restore and RDB tests passed!\n";
+}
+
+void run_collections_tests() {
+    test_listpack();
+    test_hash_encoding();
+    test_list_encoding();
+    test_set_encoding();
+    test_sorted_set();
+    test_collection_commands();
+    test_collection_memory();
+    test_collection_persistence();
+}
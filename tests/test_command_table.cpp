@@ -0,0 +1,131 @@
+// Tests for the compile-time command table
+
+#include "../src/protocol/command_table.hpp"
+#include "../src/protocol/parser.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+
+void test_command_lookup() {
+    std::cout << "Testing command table lookup...\n";
+
+    // Every command resolves to its own spec by name
+    for (size_t i = 1; i < static_cast<size_t>(protocol::CommandType::COUNT); ++i) {
+        protocol::CommandType type = static_cast<protocol::CommandType>(i);
+        const protocol::CommandSpec& spec = protocol::command_spec(type);
+        assert(spec.type == type);
+        assert(!spec.name.empty());
+        const protocol::CommandSpec* found = protocol::lookup_command(spec.name);
+        assert(found == &spec);
+    }
+
+    // Unknown, empty and lower-case names are rejected
+    assert(protocol::lookup_command("NOPE") == nullptr);
+    assert(protocol::lookup_command("") == nullptr);
+    assert(protocol::lookup_command("get") == nullptr);
+    assert(protocol::lookup_command("GETX") == nullptr);
+    assert(protocol::lookup_command("GE") == nullptr);
+
+    // Both parsers resolve through the table
+    assert(protocol::parse_command("set k v").type == protocol::CommandType::SET);
+    assert(protocol::command_from_resp_array({"PTTL", "k"}).type == protocol::CommandType::PTTL);
+    assert(protocol::command_from_resp_array({"BOGUS"}).type == protocol::CommandType::UNKNOWN);
+
+    std::cout << "Command table lookup tests passed!\n";
+}
+
+void test_command_arity() {
+    std::cout << "Testing command arity...\n";
+
+    const protocol::CommandSpec& get = protocol::command_spec(protocol::CommandType::GET);
+    assert(!protocol::check_arity(get, 0));
+    assert(protocol::check_arity(get, 1));
+    assert(!protocol::check_arity(get, 2));
+
+    // Negative arity is a minimum
+    const protocol::CommandSpec& mget = protocol::command_spec(protocol::CommandType::MGET);
+    assert(!protocol::check_arity(mget, 0));
+    assert(protocol::check_arity(mget, 1));
+    assert(protocol::check_arity(mget, 10));
+
+    const protocol::CommandSpec& ping = protocol::command_spec(protocol::CommandType::PING);
+    assert(protocol::check_arity(ping, 0));
+    assert(protocol::check_arity(ping, 1));
+
+    // Key value pairs must come in twos
+    const protocol::CommandSpec& mset = protocol::command_spec(protocol::CommandType::MSET);
+    assert(!protocol::check_arity(mset, 1));
+    assert(protocol::check_arity(mset, 2));
+    assert(!protocol::check_arity(mset, 3));
+    assert(protocol::check_arity(mset, 4));
+
+    std::cout << "Command arity tests passed!\n";
+}
+
+void test_command_flags() {
+    std::cout << "Testing command write flags...\n";
+
+    assert(protocol::is_write_command(protocol::CommandType::SET));
+    assert(protocol::is_write_command(protocol::CommandType::DEL));
+    assert(protocol::is_write_command(protocol::CommandType::PEXPIRE));
+    assert(protocol::is_write_command(protocol::CommandType::INCRBY));
+    assert(protocol::is_write_command(protocol::CommandType::APPEND));
+    assert(protocol::is_write_command(protocol::CommandType::PEXPIREAT));
+    assert(!protocol::is_write_command(protocol::CommandType::BGREWRITEAOF));
+    assert(!protocol::is_write_command(protocol::CommandType::BGSAVE));
+    assert(!protocol::is_write_command(protocol::CommandType::GET));
+    assert(!protocol::is_write_command(protocol::CommandType::PING));
+    assert(!protocol::is_write_command(protocol::CommandType::UNKNOWN));
+    // Read-only scripts are reads, so replicas run them
+    assert(protocol::is_write_command(protocol::CommandType::EVAL));
+    assert(!protocol::is_write_command(protocol::CommandType::EVAL_RO));
+    assert(!protocol::is_write_command(protocol::CommandType::EVALSHA_RO));
+
+    protocol::Command cmd;
+    cmd.type = protocol::CommandType::SET;
+    cmd.args = {"key", "value"};
+    assert(protocol::command_to_resp(cmd) == "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n");
+
+    cmd.type = protocol::CommandType::UNKNOWN;
+    assert(protocol::command_to_resp(cmd).empty());
+
+    std::cout << "Command write flag tests passed!\n";
+}
+
+void test_command_keys() {
+    std::cout << "Testing command key positions...\n";
+
+    auto keys = [](protocol::CommandType type, size_t arg_count) {
+        protocol::KeyRange range = protocol::command_keys(protocol::command_spec(type), arg_count);
+        size_t count = 0;
+        for (size_t i = range.first; i < range.end; i += range.step) {
+            ++count;
+        }
+        return count;
+    };
+    assert(keys(protocol::CommandType::GET, 1) == 1);
+    assert(keys(protocol::CommandType::SET, 4) == 1);
+    assert(keys(protocol::CommandType::MGET, 3) == 3);
+    assert(keys(protocol::CommandType::DEL, 2) == 2);
+    assert(keys(protocol::CommandType::EXISTS, 1) == 1);
+    assert(keys(protocol::CommandType::UNLINK, 3) == 3);
+    assert(keys(protocol::CommandType::MSET, 4) == 2);
+    assert(keys(protocol::CommandType::MSETNX, 2) == 1);
+    assert(keys(protocol::CommandType::KEYS, 1) == 0);
+    assert(keys(protocol::CommandType::SCAN, 5) == 0);
+    assert(keys(protocol::CommandType::HSET, 5) == 1);
+    assert(keys(protocol::CommandType::ZRANGEBYSCORE, 6) == 1);
+    assert(keys(protocol::CommandType::RESTORE_RECORDS, 1) == 0);
+    assert(keys(protocol::CommandType::PING, 1) == 0);
+    assert(keys(protocol::CommandType::CLUSTER, 2) == 0);
+    assert(protocol::command_keys(protocol::command_spec(protocol::CommandType::MGET), 2).first == 0);
+
+    std::cout << "Command key position tests passed!\n";
+}
+
+void run_command_table_tests() {
+    test_command_lookup();
+    test_command_arity();
+    test_command_flags();
+    test_command_keys();
+}
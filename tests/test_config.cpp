@@ -15,6 +15,8 @@ void test_default_config() {
     assert(cfg.aof_path == "mini_redis.aof");
     assert(cfg.rdb_path == "mini_redis_dump.rdb");
     assert(cfg.use_iocp == false);
+    assert(cfg.maxmemory == 0);
+    assert(cfg.maxmemory_policy == "allkeys-lru");
     
     std::cout << "Default config tests passed!\n";
 }
@@ -49,6 +51,234 @@ void test_parse_args_iocp() {
     std::cout << "--iocp flag tests passed!\n";
 }
 
+void test_parse_args_event_loop() {
+    std::cout << "Testing --event-loop flag...\n";
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--event-loop"};
+    auto cfg = mini_redis::parse_args(2, args);
+    assert(cfg.use_event_loop == true);
+    assert(cfg.use_iocp == false);
+    
+    std::cout << "--event-loop flag tests passed!\n";
+}
+
+void test_parse_args_io_uring() {
+    std::cout << "Testing --io-uring flag...\n";
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--io-uring"};
+    auto cfg = mini_redis::parse_args(2, args);
+    assert(cfg.use_io_uring == true);
+    assert(cfg.use_event_loop == false);
+    assert(cfg.use_iocp == false);
+    
+    std::cout << "--io-uring flag tests passed!\n";
+}
+
+void test_parse_args_thread_per_core() {
+    std::cout << "Testing --thread-per-core and --cores...\n";
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--thread-per-core", (char*)"--cores", (char*)"8"};
+    auto cfg = mini_redis::parse_args(4, args);
+    assert(cfg.use_thread_per_core == true);
+    assert(cfg.cores == 8);
+    
+    char* defaults[] = {(char*)"mini_redis"};
+    cfg = mini_redis::parse_args(1, defaults);
+    assert(cfg.use_thread_per_core == false);
+    assert(cfg.cores == 0);
+    
+    std::cout << "--thread-per-core flag tests passed!\n";
+}
+
+void test_parse_args_iocp_accepts() {
+    std::cout << "Testing --iocp-accepts...\n";
+    
+    mini_redis::Config defaults;
+    assert(defaults.iocp_accepts == 16);
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--iocp", (char*)"--iocp-accepts", (char*)"64"};
+    auto cfg = mini_redis::parse_args(4, args);
+    assert(cfg.use_iocp == true);
+    assert(cfg.iocp_accepts == 64);
+    
+    std::cout << "--iocp-accepts flag tests passed!\n";
+}
+
+void test_aof_config() {
+    std::cout << "Testing AOF config...\n";
+    
+    mini_redis::Config defaults;
+    assert(defaults.appendfsync == "everysec");
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--appendfsync", (char*)"always"};
+    auto cfg = mini_redis::parse_args(3, args);
+    assert(cfg.appendfsync == "always");
+    
+    const char* test_cfg = "test_mini_redis_fsync.conf";
+    {
+        std::ofstream f(test_cfg);
+        f << "appendfsync = no\n";
+    }
+    cfg = mini_redis::load_config_file(test_cfg);
+    assert(cfg.appendfsync == "no");
+    std::remove(test_cfg);
+    
+    assert(defaults.auto_aof_rewrite_percentage == 100);
+    assert(defaults.auto_aof_rewrite_min_size == 64 * 1024 * 1024);
+    char* rewrite_args[] = {(char*)"mini_redis", (char*)"--auto-aof-rewrite-percentage", (char*)"50",
+                            (char*)"--auto-aof-rewrite-min-size", (char*)"1mb"};
+    cfg = mini_redis::parse_args(5, rewrite_args);
+    assert(cfg.auto_aof_rewrite_percentage == 50);
+    assert(cfg.auto_aof_rewrite_min_size == 1024 * 1024);
+    
+    std::cout << "AOF config tests passed!\n";
+}
+
+void test_slowlog_config() {
+    std::cout << "Testing slowlog config...\n";
+    
+    mini_redis::Config defaults;
+    assert(defaults.slowlog_log_slower_than == 10000);
+    assert(defaults.slowlog_max_len == 128);
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--slowlog-log-slower-than", (char*)"-1",
+                    (char*)"--slowlog-max-len", (char*)"16"};
+    auto cfg = mini_redis::parse_args(5, args);
+    assert(cfg.slowlog_log_slower_than == -1);
+    assert(cfg.slowlog_max_len == 16);
+    
+    const char* test_cfg = "test_mini_redis_slowlog.conf";
+    {
+        std::ofstream f(test_cfg);
+        f << "slowlog_log_slower_than = 0\n";
+        f << "slowlog_max_len = 4\n";
+    }
+    cfg = mini_redis::load_config_file(test_cfg);
+    assert(cfg.slowlog_log_slower_than == 0);
+    assert(cfg.slowlog_max_len == 4);
+    std::remove(test_cfg);
+    
+    std::cout << "Slowlog config tests passed!\n";
+}
+
+void test_repl_backlog_config() {
+    std::cout << "Testing repl backlog config...\n";
+    
+    mini_redis::Config defaults;
+    assert(defaults.repl_backlog_size == 1024 * 1024);
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--repl-backlog-size", (char*)"64mb"};
+    auto cfg = mini_redis::parse_args(3, args);
+    assert(cfg.repl_backlog_size == 64 * 1024 * 1024);
+    
+    const char* test_cfg = "test_mini_redis_repl.conf";
+    {
+        std::ofstream f(test_cfg);
+        f << "repl_backlog_size = 256kb\n";
+    }
+    cfg = mini_redis::load_config_file(test_cfg);
+    assert(cfg.repl_backlog_size == 256 * 1024);
+    std::remove(test_cfg);
+    
+    std::cout << "Repl backlog config tests passed!\n";
+}
+
+void test_replicaof_config() {
+    std::cout << "Testing replicaof config...\n";
+    
+    mini_redis::Config defaults;
+    assert(defaults.replicaof_host.empty());
+    assert(defaults.replica_max_lag_ms == 10000);
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--replicaof", (char*)"10.0.0.1", (char*)"6380",
+                    (char*)"--replica-max-lag-ms", (char*)"500"};
+    auto cfg = mini_redis::parse_args(6, args);
+    assert(cfg.replicaof_host == "10.0.0.1");
+    assert(cfg.replicaof_port == 6380);
+    assert(cfg.replica_max_lag_ms == 500);
+    
+    const char* test_cfg = "test_mini_redis_replicaof.conf";
+    {
+        std::ofstream f(test_cfg);
+        f << "replicaof = 127.0.0.1 7000\n";
+        f << "replica_max_lag_ms = 0\n";
+    }
+    cfg = mini_redis::load_config_file(test_cfg);
+    assert(cfg.replicaof_host == "127.0.0.1");
+    assert(cfg.replicaof_port == 7000);
+    assert(cfg.replica_max_lag_ms == 0);
+    std::remove(test_cfg);
+    
+    std::cout << "Replicaof config tests passed!\n";
+}
+
+void test_cluster_config() {
+    std::cout << "Testing cluster config...\n";
+    
+    mini_redis::Config defaults;
+    assert(!defaults.cluster_enabled);
+    assert(defaults.cluster_config_file == "nodes.conf");
+    assert(defaults.cluster_announce_ip == "127.0.0.1");
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--cluster-enabled", (char*)"--cluster-config-file",
+                    (char*)"nodes-7000.conf", (char*)"--cluster-announce-ip", (char*)"10.0.0.5"};
+    auto cfg = mini_redis::parse_args(6, args);
+    assert(cfg.cluster_enabled);
+    assert(cfg.cluster_config_file == "nodes-7000.conf");
+    assert(cfg.cluster_announce_ip == "10.0.0.5");
+    
+    const char* test_cfg = "test_mini_redis_cluster.conf";
+    {
+        std::ofstream f(test_cfg);
+        f << "cluster_enabled = yes\n";
+        f << "cluster_config_file = cluster/nodes.conf\n";
+        f << "cluster_announce_ip = 192.168.1.2\n";
+    }
+    cfg = mini_redis::load_config_file(test_cfg);
+    assert(cfg.cluster_enabled);
+    assert(cfg.cluster_config_file == "cluster/nodes.conf");
+    assert(cfg.cluster_announce_ip == "192.168.1.2");
+    std::remove(test_cfg);
+    
+    std::cout << "Cluster config tests passed!\n";
+}
+
+void test_output_buffer_limit_config() {
+    std::cout << "Testing client-output-buffer-limit config...\n";
+    
+    mini_redis::Config defaults;
+    assert(defaults.pubsub_hard_limit == 32 * 1024 * 1024);
+    assert(defaults.pubsub_soft_limit == 8 * 1024 * 1024);
+    assert(defaults.pubsub_soft_seconds == 60);
+    
+    char* args[] = {(char*)"mini_redis", (char*)"--client-output-buffer-limit", (char*)"pubsub",
+                    (char*)"1mb", (char*)"256kb", (char*)"5", (char*)"--port", (char*)"7000"};
+    auto cfg = mini_redis::parse_args(8, args);
+    assert(cfg.pubsub_hard_limit == 1024 * 1024);
+    assert(cfg.pubsub_soft_limit == 256 * 1024);
+    assert(cfg.pubsub_soft_seconds == 5);
+    assert(cfg.port == 7000);
+    
+    // Other classes have no separate queue to bound and are ignored
+    char* normal[] = {(char*)"mini_redis", (char*)"--client-output-buffer-limit", (char*)"normal",
+                      (char*)"0", (char*)"0", (char*)"0"};
+    cfg = mini_redis::parse_args(6, normal);
+    assert(cfg.pubsub_hard_limit == defaults.pubsub_hard_limit);
+    
+    const char* test_cfg = "test_mini_redis_output_limit.conf";
+    {
+        std::ofstream f(test_cfg);
+        f << "client_output_buffer_limit = pubsub 0 0 0\n";
+    }
+    cfg = mini_redis::load_config_file(test_cfg);
+    assert(cfg.pubsub_hard_limit == 0);
+    assert(cfg.pubsub_soft_limit == 0);
+    assert(cfg.pubsub_soft_seconds == 0);
+    std::remove(test_cfg);
+    
+    std::cout << "client-output-buffer-limit config tests passed!\n";
+}
+
 void test_parse_args_multiple() {
     std::cout << "Testing multiple args...\n";
     
@@ -96,12 +326,66 @@ void test_missing_config_file() {
     std::cout << "Missing config file tests passed!\n";
 }
 
+void test_maxmemory_config() {
+    std::cout << "Testing maxmemory config...\n";
+
+    size_t bytes = 0;
+    assert(mini_redis::parse_memory_size("100", bytes) && bytes == 100);
+    assert(mini_redis::parse_memory_size("64kb", bytes) && bytes == 64 * 1024);
+    assert(mini_redis::parse_memory_size("2MB", bytes) && bytes == 2 * 1024 * 1024);
+    assert(mini_redis::parse_memory_size("1g", bytes) && bytes == 1024ULL * 1024 * 1024);
+    assert(!mini_redis::parse_memory_size("lots", bytes));
+    assert(!mini_redis::parse_memory_size("10xb", bytes));
+
+    char* args[] = {(char*)"mini_redis", (char*)"--maxmemory", (char*)"100mb",
+                    (char*)"--maxmemory-policy", (char*)"allkeys-lfu"};
+    auto cfg = mini_redis::parse_args(5, args);
+    assert(cfg.maxmemory == 100 * 1024 * 1024);
+    assert(cfg.maxmemory_policy == "allkeys-lfu");
+
+    std::cout << "maxmemory config tests passed!\n";
+}
+
+void test_lazyfree_config() {
+    std::cout << "Testing lazyfree config...\n";
+
+    mini_redis::Config defaults;
+    assert(defaults.lazyfree_min_size == 64 * 1024);
+
+    char* args[] = {(char*)"mini_redis", (char*)"--lazyfree-min-size", (char*)"1mb"};
+    auto cfg = mini_redis::parse_args(3, args);
+    assert(cfg.lazyfree_min_size == 1024 * 1024);
+
+    const char* test_cfg = "test_mini_redis_lazyfree.conf";
+    {
+        std::ofstream f(test_cfg);
+        f << "lazyfree_min_size = 0\n";
+    }
+    cfg = mini_redis::load_config_file(test_cfg);
+    assert(cfg.lazyfree_min_size == 0);
+    std::remove(test_cfg);
+
+    std::cout << "lazyfree config tests passed!\n";
+}
+
 void run_config_tests() {
     test_default_config();
     test_parse_args_port();
     test_parse_args_short();
     test_parse_args_iocp();
+    test_parse_args_event_loop();
+    test_parse_args_io_uring();
+    test_parse_args_thread_per_core();
+    test_parse_args_iocp_accepts();
+    test_aof_config();
+    test_slowlog_config();
+    test_repl_backlog_config();
+    test_replicaof_config();
+    test_cluster_config();
+    test_output_buffer_limit_config();
     test_parse_args_multiple();
     test_config_file();
     test_missing_config_file();
+    test_maxmemory_config();
+    test_lazyfree_config();
 }
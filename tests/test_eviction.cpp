@@ -0,0 +1,184 @@
+// Tests for KVStore LRU eviction
+// Uses a single shard so the eviction order is fully deterministic
+
+#include "../src/storage/kv_store.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+
+void test_lru_evicts_oldest() {
+    std::cout << "Testing LRU eviction order...\n";
+
+    KVStore kv(1);
+    for (int i = 0; i < 10000; ++i) {
+        kv.set("key:" + std::to_string(i), "v");
+    }
+    assert(kv.size() == 10000);
+
+    // Touch the oldest key so key:1 becomes the LRU victim
+    std::string value;
+    assert(kv.get("key:0", value));
+
+    kv.set("key:10000", "v");
+    assert(kv.size() == 10000);
+    assert(kv.exists("key:0"));
+    assert(!kv.exists("key:1"));
+    assert(kv.exists("key:10000"));
+
+    std::cout << "LRU eviction order tests passed!\n";
+}
+
+void test_lru_after_delete() {
+    std::cout << "Testing LRU after delete...\n";
+
+    KVStore kv(1);
+    kv.set("a", "1");
+    kv.set("b", "2");
+    kv.set("c", "3");
+
+    // Unlink head, middle and tail positions, then reuse the keys
+    assert(kv.del("c"));
+    assert(kv.del("a"));
+    kv.set("a", "4");
+    assert(kv.del("b"));
+    assert(kv.size() == 1);
+
+    std::string value;
+    assert(kv.get("a", value));
+    assert(value == "4");
+    assert(kv.del("a"));
+    assert(kv.size() == 0);
+
+    // List is empty again and accepts new entries
+    kv.set("d", "5");
+    assert(kv.get("d", value));
+    assert(value == "5");
+
+    std::cout << "LRU after delete tests passed!\n";
+}
+
+void test_memory_accounting() {
+    std::cout << "Testing memory accounting...\n";
+
+    KVStore kv(1);
+    assert(kv.used_memory() == 0);
+
+    kv.set("small", "v");
+    size_t after_small = kv.used_memory();
+    assert(after_small > 0);
+
+    // A large value is charged for its heap buffer
+    kv.set("big", std::string(100000, 'x'));
+    assert(kv.used_memory() >= after_small + 100000);
+
+    // Overwriting with a short value and deleting give the bytes back
+    kv.set("big", "y");
+    assert(kv.used_memory() < after_small + 1000);
+    assert(kv.expire("small", 100));
+    assert(kv.del("big"));
+    assert(kv.del("small"));
+    assert(kv.used_memory() == 0);
+
+    std::cout << "Memory accounting tests passed!\n";
+}
+
+void test_maxmemory_allkeys_lru() {
+    std::cout << "Testing maxmemory allkeys-lru...\n";
+
+    KVStore kv(1);
+    kv.set_eviction_limits(0, 64 * 1024, EvictionPolicy::AllKeysLRU);
+
+    const std::string value(1024, 'v');
+    for (int i = 0; i < 200; ++i) {
+        kv.set("key:" + std::to_string(i), value);
+    }
+    assert(kv.used_memory() <= 64 * 1024);
+    assert(kv.evicted_keys() > 0);
+    assert(kv.size() + kv.evicted_keys() == 200);
+
+    // Most recent writes survive, the oldest were evicted
+    assert(kv.exists("key:199"));
+    assert(!kv.exists("key:0"));
+
+    std::cout << "maxmemory allkeys-lru tests passed!\n";
+}
+
+void test_maxmemory_volatile_policies() {
+    std::cout << "Testing maxmemory volatile policies...\n";
+
+    // volatile-lru only evicts keys that carry a TTL
+    KVStore lru(1);
+    lru.set_eviction_limits(0, 32 * 1024, EvictionPolicy::VolatileLRU, 10);
+    const std::string value(1024, 'v');
+    for (int i = 0; i < 10; ++i) {
+        lru.set("persistent:" + std::to_string(i), value);
+    }
+    for (int i = 0; i < 60; ++i) {
+        std::string key = "volatile:" + std::to_string(i);
+        lru.set(key, value);
+        lru.expire(key, 1000);
+    }
+    for (int i = 0; i < 10; ++i) {
+        assert(lru.exists("persistent:" + std::to_string(i)));
+    }
+    assert(lru.evicted_keys() > 0);
+
+    // volatile-ttl prefers the key that expires soonest
+    KVStore ttl(1);
+    ttl.set_eviction_limits(2, 0, EvictionPolicy::VolatileTTL, 10);
+    ttl.set("later", "v");
+    ttl.expire("later", 1000);
+    ttl.set("sooner", "v");
+    ttl.expire("sooner", 10);
+    ttl.set("third", "v");
+    // Only "later" and "sooner" are volatile; "sooner" goes first
+    assert(!ttl.exists("sooner"));
+    assert(ttl.exists("later"));
+    assert(ttl.exists("third"));
+
+    std::cout << "maxmemory volatile policy tests passed!\n";
+}
+
+void test_maxmemory_allkeys_lfu() {
+    std::cout << "Testing maxmemory allkeys-lfu...\n";
+
+    KVStore kv(1);
+    kv.set_eviction_limits(20, 0, EvictionPolicy::AllKeysLFU, 20);
+    kv.set("hot", "v");
+    std::string value;
+    for (int i = 0; i < 1000; ++i) {
+        kv.get("hot", value);
+    }
+    for (int i = 0; i < 100; ++i) {
+        kv.set("cold:" + std::to_string(i), "v");
+    }
+    assert(kv.size() == 20);
+    assert(kv.exists("hot"));
+
+    std::cout << "maxmemory allkeys-lfu tests passed!\n";
+}
+
+void test_policy_names() {
+    std::cout << "Testing eviction policy names...\n";
+
+    EvictionPolicy policy = EvictionPolicy::AllKeysLRU;
+    assert(KVStore::parse_eviction_policy("volatile-ttl", policy));
+    assert(policy == EvictionPolicy::VolatileTTL);
+    assert(std::string(KVStore::eviction_policy_name(policy)) == "volatile-ttl");
+    assert(KVStore::parse_eviction_policy("allkeys-lfu", policy));
+    assert(policy == EvictionPolicy::AllKeysLFU);
+    assert(!KVStore::parse_eviction_policy("bogus", policy));
+    assert(policy == EvictionPolicy::AllKeysLFU);
+
+    std::cout << "Eviction policy name tests passed!\n";
+}
+
+void run_eviction_tests() {
+    test_lru_evicts_oldest();
+    test_lru_after_delete();
+    test_memory_accounting();
+    test_maxmemory_allkeys_lru();
+    test_maxmemory_volatile_policies();
+    test_maxmemory_allkeys_lfu();
+    test_policy_names();
+}
@@ -0,0 +1,153 @@
+// Tests for millisecond expiration and the active expire cycle
+
+#include "../src/storage/kv_store.hpp"
+#include "../src/storage/active_expirer.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <limits>
+
+void test_pexpire_pttl() {
+    std::cout << "Testing PEXPIRE/PTTL...\n";
+
+    KVStore kv;
+    kv.set("key", "value");
+    assert(kv.pttl("key") == -1);
+    assert(kv.pttl("missing") == -2);
+    assert(!kv.pexpire("missing", 100));
+
+    assert(kv.pexpire("key", 1500));
+    int64_t remaining = kv.pttl("key");
+    assert(remaining > 1000 && remaining <= 1500);
+    int seconds = kv.ttl("key");
+    assert(seconds == 1 || seconds == 2);
+
+    // Re-arming moves the deadline
+    assert(kv.pexpire("key", 60000));
+    assert(kv.pttl("key") > 59000);
+
+    // Short TTLs lapse at millisecond granularity
+    assert(kv.pexpire("key", 5));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    assert(!kv.exists("key"));
+    assert(kv.pttl("key") == -2);
+
+    // A deadline past the end of int64 milliseconds saturates instead of
+    // wrapping into the past
+    kv.set("far", "value");
+    assert(kv.pexpire("far", std::numeric_limits<int64_t>::max()));
+    assert(kv.pttl("far") > 0);
+    assert(kv.expire("far", std::numeric_limits<int64_t>::max()));
+    assert(kv.ttl("far") > 0);
+
+    std::cout << "PEXPIRE/PTTL tests passed!\n";
+}
+
+void test_active_expire_cycle() {
+    std::cout << "Testing active expire cycle...\n";
+
+    KVStore kv(4);
+    for (int i = 0; i < 100; ++i) {
+        std::string key = "short:" + std::to_string(i);
+        kv.set(key, "v");
+        kv.pexpire(key, 1 + i % 5);
+    }
+    for (int i = 0; i < 10; ++i) {
+        std::string key = "long:" + std::to_string(i);
+        kv.set(key, "v");
+        kv.expire(key, 1000);
+    }
+    kv.set("persistent", "v");
+    assert(kv.size() == 111);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    // Nobody reads the short keys; the cycle alone must reclaim them
+    size_t removed = kv.active_expire_cycle(std::chrono::milliseconds(100));
+    assert(removed == 100);
+    assert(kv.size() == 11);
+    assert(kv.expired_keys() == 100);
+    assert(kv.exists("long:3"));
+    assert(kv.exists("persistent"));
+
+    // Nothing else is due
+    assert(kv.active_expire_cycle(std::chrono::milliseconds(100)) == 0);
+
+    std::cout << "Active expire cycle tests passed!\n";
+}
+
+void test_active_expirer_thread() {
+    std::cout << "Testing active expirer thread...\n";
+
+    std::vector<KVStore> databases(2);
+    databases[0].set("a", "1");
+    databases[0].pexpire("a", 1);
+    databases[1].set("b", "2");
+    databases[1].pexpire("b", 1);
+    databases[1].set("c", "3");
+
+    ActiveExpirer expirer(databases, 100);
+    expirer.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    expirer.stop();
+
+    assert(databases[0].size() == 0);
+    assert(databases[1].size() == 1);
+    assert(databases[1].exists("c"));
+
+    std::cout << "Active expirer thread tests passed!\n";
+}
+
+void test_keys_skips_expired() {
+    std::cout << "Testing KEYS skips expired...\n";
+
+    KVStore kv;
+    kv.set("live", "v");
+    kv.set("dead", "v");
+    kv.pexpire("dead", 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    auto keys = kv.keys();
+    assert(keys.size() == 1);
+    assert(keys[0] == "live");
+
+    std::cout << "KEYS skips expired tests passed!\n";
+}
+
+void test_pexpireat_snapshot() {
+    std::cout << "Testing PEXPIREAT and shard snapshots...\n";
+
+    KVStore kv(4);
+    assert(!kv.pexpireat("missing", KVStore::now_ms() + 1000));
+    kv.set("key", "value");
+    kv.set("plain", "v");
+    kv.set("dead", "v");
+    const int64_t deadline = KVStore::now_ms() + 60000;
+    assert(kv.pexpireat("key", deadline));
+    assert(kv.pttl("key") > 59000);
+    assert(kv.pexpireat("dead", KVStore::now_ms() - 1000)); // Already due
+
+    // Snapshots carry the absolute deadline and leave out expired keys
+    std::vector<KVStore::SnapshotEntry> entries;
+    for (size_t s = 0; s < kv.shard_count(); ++s) {
+        kv.snapshot_shard(s, entries);
+    }
+    assert(entries.size() == 2);
+    for (const auto& entry : entries) {
+        assert(entry.key == "key" || entry.key == "plain");
+        assert(entry.expire_at_ms == (entry.key == "key" ? deadline : 0));
+    }
+
+    std::cout << "PEXPIREAT and shard snapshot tests passed!\n";
+}
+
+void run_expiration_tests() {
+    test_pexpire_pttl();
+    test_pexpireat_snapshot();
+    test_active_expire_cycle();
+    test_active_expirer_thread();
+    test_keys_skips_expired();
+}
@@ -0,0 +1,142 @@
+// Tests for latency histograms, per-command statistics and the slow log
+
+#include "../src/utils/latency_histogram.hpp"
+#include "../src/server/command_stats.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+protocol::Command make_command(protocol::CommandType type, const std::string& name,
+                               std::vector<std::string> args) {
+    protocol::Command cmd;
+    cmd.type = type;
+    cmd.name = name;
+    cmd.args = std::move(args);
+    return cmd;
+}
+
+} // anonymous namespace
+
+void test_histogram_buckets() {
+    std::cout << "Testing latency histogram buckets...\n";
+
+    using mini_redis::LatencyHistogram;
+    // Every bucket covers a contiguous range that maps back to it
+    uint64_t expected_low = 0;
+    for (size_t b = 0; b < LatencyHistogram::BUCKETS; ++b) {
+        assert(LatencyHistogram::bucket_low(b) == expected_low);
+        assert(LatencyHistogram::bucket_of(LatencyHistogram::bucket_low(b)) == b);
+        assert(LatencyHistogram::bucket_of(LatencyHistogram::bucket_high(b)) == b);
+        expected_low = LatencyHistogram::bucket_high(b) + 1;
+    }
+    assert(LatencyHistogram::bucket_high(LatencyHistogram::BUCKETS - 1) == LatencyHistogram::MAX_VALUE);
+    assert(LatencyHistogram::bucket_of(uint64_t(1) << 40) == LatencyHistogram::BUCKETS - 1); // Clamped
+
+    // Within 12.5% of the recorded value
+    for (uint64_t v : {9ull, 100ull, 1000ull, 123456ull}) {
+        size_t b = LatencyHistogram::bucket_of(v);
+        assert(LatencyHistogram::bucket_high(b) - LatencyHistogram::bucket_low(b) + 1 <= v / 8 + 1);
+    }
+
+    std::cout << "Latency histogram bucket tests passed!\n";
+}
+
+void test_histogram_percentiles() {
+    std::cout << "Testing latency histogram percentiles...\n";
+
+    mini_redis::LatencyHistogram h;
+    assert(h.percentile(50) == 0);
+    for (int i = 0; i < 990; ++i) {
+        h.record(5);
+    }
+    for (int i = 0; i < 10; ++i) {
+        h.record(1000);
+    }
+    assert(h.count() == 1000);
+    assert(h.percentile(50) == 5);
+    assert(h.percentile(99) == 5);
+    uint64_t tail = h.percentile(99.9);
+    assert(tail >= 1000 && tail < 1000 + 1000 / 8);
+    assert(h.percentile(100) == tail);
+
+    std::cout << "Latency histogram percentile tests passed!\n";
+}
+
+void test_command_stats_threads() {
+    std::cout << "Testing per-command stats across threads...\n";
+
+    const auto type = protocol::CommandType::PEXPIRE;
+    mini_redis::CommandStats before = mini_redis::command_stats(type);
+    const int threads = 4;
+    const int per_thread = 1000;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        // Each thread exits before the read below, so its counts must survive it
+        workers.emplace_back([type] {
+            protocol::Command cmd = make_command(type, "PEXPIRE", {"key", "1"});
+            for (int i = 0; i < per_thread; ++i) {
+                mini_redis::record_command(cmd, 3);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    mini_redis::record_command(make_command(type, "PEXPIRE", {"key", "1"}), 20);
+
+    mini_redis::CommandStats after = mini_redis::command_stats(type);
+    assert(after.calls - before.calls == threads * per_thread + 1);
+    assert(after.usec - before.usec == threads * per_thread * 3 + 20);
+    assert(after.histogram.count() == after.calls);
+
+    std::cout << "Per-command stats across threads tests passed!\n";
+}
+
+void test_slowlog() {
+    std::cout << "Testing slow log...\n";
+
+    mini_redis::configure_slowlog(100, 3);
+    mini_redis::slowlog_reset();
+    mini_redis::record_command(make_command(protocol::CommandType::GET, "GET", {"fast"}), 99);
+    assert(mini_redis::slowlog_len() == 0);
+
+    mini_redis::record_command(make_command(protocol::CommandType::SET, "SET", {"a", std::string(1000, 'v')}), 100);
+    std::vector<std::string> many(100, "k");
+    mini_redis::record_command(make_command(protocol::CommandType::MGET, "MGET", many), 500);
+    assert(mini_redis::slowlog_len() == 2);
+
+    auto entries = mini_redis::slowlog_get(10);
+    assert(entries.size() == 2);
+    assert(entries[0].usec == 500 && entries[1].usec == 100); // Newest first
+    assert(entries[0].id > entries[1].id);
+    assert(entries[0].args[0] == "MGET" && entries[0].args.size() < many.size());
+    assert(entries[1].args[0] == "SET" && entries[1].args[1] == "a");
+    assert(entries[1].args[2].size() < 1000);
+
+    // Oldest entries drop off past max_len
+    for (int i = 0; i < 5; ++i) {
+        mini_redis::record_command(make_command(protocol::CommandType::GET, "GET", {"slow"}), 1000 + i);
+    }
+    assert(mini_redis::slowlog_len() == 3);
+    assert(mini_redis::slowlog_get(1)[0].usec == 1004);
+
+    mini_redis::configure_slowlog(-1, 3);
+    mini_redis::record_command(make_command(protocol::CommandType::GET, "GET", {"slow"}), 1000000);
+    assert(mini_redis::slowlog_len() == 3); // Logging off
+    mini_redis::slowlog_reset();
+    assert(mini_redis::slowlog_len() == 0);
+    mini_redis::configure_slowlog(10000, 128);
+
+    std::cout << "Slow log tests passed!\n";
+}
+
+void run_latency_stats_tests() {
+    test_histogram_buckets();
+    test_histogram_percentiles();
+    test_command_stats_threads();
+    test_slowlog();
+}
@@ -0,0 +1,154 @@
+// Tests for lazy free
+// Verifies UNLINK, eviction, expiry and FLUSHDB ASYNC hand large values to the
+// background reclaimer while small ones and plain DEL are freed inline
+
+#include "../src/storage/lazy_freer.hpp"
+#include "../src/storage/kv_store.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <atomic>
+
+void test_lazy_freer_jobs() {
+    std::cout << "Testing lazy freer jobs...\n";
+
+    LazyFreer freer;
+    // Not started: a job runs on the caller's thread
+    int ran = 0;
+    freer.submit([&] { ++ran; });
+    assert(ran == 1);
+    assert(freer.freed_objects() == 0);
+
+    freer.start();
+    std::atomic<int> done{0};
+    const auto caller = std::this_thread::get_id();
+    std::atomic<bool> elsewhere{true};
+    for (int i = 0; i < 100; ++i) {
+        freer.submit([&] {
+            elsewhere = elsewhere && std::this_thread::get_id() != caller;
+            ++done;
+        }, 2);
+    }
+    freer.drain();
+    assert(done == 100);
+    assert(elsewhere);
+    assert(freer.pending_objects() == 0);
+    assert(freer.freed_objects() == 200);
+
+    // stop runs whatever is still queued
+    for (int i = 0; i < 10; ++i) {
+        freer.submit([&] { ++done; });
+    }
+    freer.stop();
+    assert(done == 110);
+
+    std::cout << "Lazy freer job tests passed!\n";
+}
+
+void test_unlink_frees_lazily() {
+    std::cout << "Testing UNLINK lazy free...\n";
+
+    LazyFreer freer;
+    freer.start();
+    KVStore kv(4);
+    kv.set_lazy_free(&freer, 1024);
+    const std::string big(64 * 1024, 'x');
+    kv.set("big1", big);
+    kv.set("big2", big);
+    kv.set("small", "v");
+
+    // DEL frees inline; UNLINK hands only the large value over
+    assert(kv.del_many({"big1"}) == 1);
+    freer.drain();
+    assert(freer.freed_objects() == 0);
+    assert(kv.unlink_many({"big2", "small", "missing"}) == 2);
+    freer.drain();
+    assert(freer.freed_objects() == 1);
+    assert(kv.size() == 0);
+
+    // min_size 0 keeps single keys inline
+    kv.set_lazy_free(&freer, 0);
+    kv.set("big3", big);
+    assert(kv.unlink_many({"big3"}) == 1);
+    freer.drain();
+    assert(freer.freed_objects() == 1);
+
+    std::cout << "UNLINK lazy free tests passed!\n";
+}
+
+void test_eviction_and_expiry_free_lazily() {
+    std::cout << "Testing eviction and expiry lazy free...\n";
+
+    LazyFreer freer;
+    freer.start();
+    KVStore kv(1);
+    kv.set_lazy_free(&freer, 1024);
+    kv.set_eviction_limits(4, 0);
+    const std::string big(8 * 1024, 'y');
+    for (int i = 0; i < 10; ++i) {
+        kv.set("evict" + std::to_string(i), big);
+    }
+    assert(kv.size() == 4);
+    freer.drain();
+    assert(freer.freed_objects() == 6);
+
+    kv.set("ttl", big);
+    assert(kv.pexpire("ttl", 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    assert(!kv.exists("ttl"));
+    freer.drain();
+    assert(freer.freed_objects() == 8); // The set evicted one more, then the key expired
+
+    std::cout << "Eviction and expiry lazy free tests passed!\n";
+}
+
+void test_flush_async() {
+    std::cout << "Testing FLUSHDB ASYNC...\n";
+
+    LazyFreer freer;
+    freer.start();
+    KVStore kv(8);
+    kv.set_eviction_limits(0, 0);
+    kv.set_lazy_free(&freer, 0);
+    for (int i = 0; i < 1000; ++i) {
+        kv.set("k" + std::to_string(i), std::to_string(i));
+    }
+    kv.clear_async();
+    assert(kv.size() == 0);
+    assert(kv.used_memory() == 0);
+    // The store is usable straight away while its old keys are freed
+    kv.set("k1", "new");
+    std::string value;
+    assert(kv.get("k1", value) && value == "new");
+    freer.drain();
+    assert(freer.freed_objects() == 1000);
+
+    // A snapshot taken before the flush still sees the old keys
+    kv.set("snap", "old");
+    KVStore::SnapshotCursor cursor;
+    assert(kv.begin_snapshot(cursor));
+    kv.clear_async();
+    std::vector<KVStore::SnapshotEntry> entries;
+    while (kv.next_snapshot_chunk(cursor, entries)) {
+    }
+    kv.end_snapshot(cursor);
+    assert(entries.size() == 2);
+
+    // Without a freer it is a plain clear
+    KVStore inline_kv;
+    inline_kv.set("a", "1");
+    inline_kv.clear_async();
+    assert(inline_kv.size() == 0);
+
+    std::cout << "FLUSHDB ASYNC tests passed!\n";
+}
+
+void run_lazy_free_tests() {
+    test_lazy_freer_jobs();
+    test_unlink_frees_lazily();
+    test_eviction_and_expiry_free_lazily();
+    test_flush_async();
+}
@@ -173,6 +173,118 @@ void test_resp_parser() {
         assert(result.command[0].empty()); // Nil bulk string should be empty
     }
 
+    // Test 9: Frame split across appends resumes without losing state
+    {
+        RespParser parser;
+        const char* part1 = "*3\r\n$3\r\nSET\r\n$3\r\nke";
+        const char* part2 = "y\r\n$5\r\nva";
+        const char* part3 = "lue\r\n";
+        parser.append(part1, strlen(part1));
+        assert(!parser.parse().complete);
+        parser.append(part2, strlen(part2));
+        assert(!parser.parse().complete);
+        parser.append(part3, strlen(part3));
+        RespResult result = parser.parse();
+        assert(result.complete);
+        assert(result.error.empty());
+        assert(result.command.size() == 3);
+        assert(result.command[1] == "key");
+        assert(result.command[2] == "value");
+        assert(parser.buffered() == 0);
+    }
+
+    // Test 10: Byte-at-a-time delivery of a pipelined batch
+    {
+        RespParser parser;
+        std::string data;
+        for (int i = 0; i < 50; ++i) {
+            data += "*2\r\n$3\r\nGET\r\n$" + std::to_string(std::to_string(i).size()) + "\r\n" + std::to_string(i) + "\r\n";
+        }
+        int parsed = 0;
+        for (char c : data) {
+            parser.append(&c, 1);
+            RespResult result = parser.parse();
+            if (result.complete) {
+                assert(result.error.empty());
+                assert(result.command[1] == std::to_string(parsed));
+                ++parsed;
+            }
+        }
+        assert(parsed == 50);
+    }
+
+    // Test 11: String views point into the buffer; binary-safe payloads
+    {
+        RespParser parser;
+        std::string data = std::string("*2\r\n$4\r\necho\r\n$5\r\na\0\r\nb\r\n", 25);
+        parser.append(data.data(), data.size());
+        std::vector<std::string_view> args;
+        std::string error;
+        assert(parser.parseArgs(args, error) == RespStatus::Complete);
+        assert(args.size() == 2);
+        assert(args[0] == "ECHO");
+        assert(args[1] == std::string_view("a\0\r\nb", 5));
+        assert(parser.parseArgs(args, error) == RespStatus::Incomplete);
+    }
+
+    // Test 12: Protocol errors discard the bad data so the next command parses
+    {
+        RespParser parser;
+        const char* bad = "*1\r\n$x\r\n";
+        parser.append(bad, strlen(bad));
+        RespResult result = parser.parse();
+        assert(result.complete);
+        assert(!result.error.empty());
+        const char* good = "*1\r\n$4\r\nPING\r\n";
+        parser.append(good, strlen(good));
+        result = parser.parse();
+        assert(result.complete);
+        assert(result.error.empty());
+        assert(result.command[0] == "PING");
+    }
+
+    // Test 13: reset drops a partial frame so a reused parser starts clean
+    {
+        RespParser parser;
+        const char* partial = "*2\r\n$3\r\nGET\r\n$5\r\nab";
+        parser.append(partial, strlen(partial));
+        assert(!parser.parse().complete);
+        parser.reset();
+        assert(parser.buffered() == 0);
+        const char* next = "*1\r\n$4\r\nPING\r\n";
+        parser.append(next, strlen(next));
+        RespResult result = parser.parse();
+        assert(result.complete);
+        assert(result.error.empty());
+        assert(result.command.size() == 1 && result.command[0] == "PING");
+    }
+
+    // Test 14: oversized headers are refused before any element is buffered
+    {
+        RespParser parser;
+        const char* huge_array = "*1048577\r\n";
+        parser.append(huge_array, strlen(huge_array));
+        RespResult result = parser.parse();
+        assert(result.complete);
+        assert(result.error == "ERR Protocol error: invalid multibulk length");
+
+        const char* largest_array = "*1048576\r\n";
+        parser.append(largest_array, strlen(largest_array));
+        assert(!parser.parse().complete); // Allowed: waits for its elements
+        parser.reset();
+
+        const char* huge_bulk = "*1\r\n$536870913\r\n";
+        parser.append(huge_bulk, strlen(huge_bulk));
+        result = parser.parse();
+        assert(result.complete);
+        assert(result.error == "ERR Protocol error: invalid bulk length");
+
+        const char* good = "*1\r\n$4\r\nPING\r\n";
+        parser.append(good, strlen(good));
+        result = parser.parse();
+        assert(result.complete && result.error.empty() && result.command[0] == "PING");
+    }
+
     std::cout << "RESP parser tests passed!\n";
 }
 
@@ -245,6 +357,72 @@ extern void run_atomic_command_tests();
 // Forward declaration for config tests
 extern void run_config_tests();
 
+// Forward declaration for sharded store tests
+extern void run_sharded_store_tests();
+
+// Forward declaration for eviction tests
+extern void run_eviction_tests();
+
+// Forward declaration for expiration tests
+extern void run_expiration_tests();
+
+// Forward declaration for command table tests
+extern void run_command_table_tests();
+
+// Forward declaration for reply writer tests
+extern void run_reply_writer_tests();
+
+// Forward declaration for SPSC queue tests
+extern void run_spsc_queue_tests();
+
+// Forward declaration for AOF logger tests
+extern void run_aof_logger_tests();
+
+// Forward declaration for snapshot tests
+extern void run_snapshot_tests();
+
+// Forward declaration for RDB format tests
+extern void run_rdb_tests();
+
+// Forward declaration for latency stats tests
+extern void run_latency_stats_tests();
+
+// Forward declaration for value encoding tests
+extern void run_value_encoding_tests();
+
+// Forward declaration for swiss table tests
+extern void run_swiss_table_tests();
+
+// Forward declaration for replication tests
+extern void run_replication_tests();
+
+// Forward declaration for replica link tests
+extern void run_replica_link_tests();
+
+// Forward declaration for cluster tests
+extern void run_cluster_tests();
+
+// Forward declaration for lazy free tests
+extern void run_lazy_free_tests();
+
+// Forward declaration for pub/sub tests
+extern void run_pubsub_tests();
+
+// Forward declaration for scan tests
+extern void run_scan_tests();
+
+// Forward declaration for collection tests
+extern void run_collections_tests();
+
+// Forward declaration for transaction and scripting tests
+extern void run_transaction_tests();
+
+// Forward declaration for client-side caching tests
+extern void run_tracking_tests();
+
+// Forward declaration for write gate tests
+extern void run_write_gate_tests();
+
 int main() {
     std::cout << "Running Mini-Redis unit tests...\n\n";
     
@@ -254,6 +432,28 @@ int main() {
         test_kvstore();
         run_atomic_command_tests();
         run_config_tests();
+        run_sharded_store_tests();
+        run_eviction_tests();
+        run_expiration_tests();
+        run_command_table_tests();
+        run_reply_writer_tests();
+        run_spsc_queue_tests();
+        run_aof_logger_tests();
+        run_snapshot_tests();
+        run_rdb_tests();
+        run_latency_stats_tests();
+        run_value_encoding_tests();
+        run_swiss_table_tests();
+        run_replication_tests();
+        run_replica_link_tests();
+        run_cluster_tests();
+        run_lazy_free_tests();
+        run_pubsub_tests();
+        run_scan_tests();
+        run_collections_tests();
+        run_transaction_tests();
+        run_tracking_tests();
+        run_write_gate_tests();
         std::cout << "\nAll tests passed!\n";
         return 0;
     } catch (const std::exception& e) {
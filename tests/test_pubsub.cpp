@@ -0,0 +1,200 @@
+// Tests for pub/sub fan-out
+// Verifies PUBLISH queues one shared frame per message on every subscriber,
+// wakes each subscriber once per backlog, and enforces the output buffer limits
+
+#include "../src/server/pubsub.hpp"
+#include "../src/protocol/resp_utils.hpp"
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using mini_redis::PubSub;
+using mini_redis::ReplyChain;
+using mini_redis::Subscriber;
+
+static std::string frame(const std::string& channel, const std::string& message) {
+    return "*2\r\n$" + std::to_string(channel.size()) + "\r\n" + channel + "\r\n$" +
+           std::to_string(message.size()) + "\r\n" + message + "\r\n";
+}
+
+void test_pubsub_fan_out() {
+    std::cout << "Testing pub/sub fan-out...\n";
+
+    PubSub hub;
+    int wakes[3] = {0, 0, 0};
+    std::vector<std::unique_ptr<Subscriber>> subs;
+    for (int i = 0; i < 3; ++i) {
+        subs.push_back(std::make_unique<Subscriber>(hub, [&wakes, i] { ++wakes[i]; }));
+        hub.subscribe(*subs.back(), "news");
+    }
+    assert(hub.subscribe(*subs[0], "sports") == 2);
+    assert(hub.channel_count() == 2);
+
+    assert(hub.publish("news", "hello") == 3);
+    assert(hub.publish("news", "world") == 3);
+    assert(hub.publish("sports", "goal") == 1);
+    assert(hub.publish("nobody", "x") == 0);
+
+    // Woken when the queue fills, not again for each later message
+    assert(wakes[0] == 1 && wakes[1] == 1 && wakes[2] == 1);
+
+    std::string out;
+    assert(subs[0]->ready());
+    assert(subs[0]->take(out, Subscriber::TAKE_BATCH_BYTES));
+    assert(out == frame("news", "hello") + frame("news", "world") + frame("sports", "goal"));
+    assert(!subs[0]->ready());
+    assert(subs[0]->queued_bytes() == 0);
+
+    // A small budget still takes one message per call
+    out.clear();
+    assert(subs[1]->take(out, 1));
+    assert(out == frame("news", "hello"));
+    assert(subs[1]->ready());
+
+    // Emptied and filled again: woken again
+    hub.publish("sports", "again");
+    assert(wakes[0] == 2);
+
+    std::cout << "Pub/sub fan-out tests passed!\n";
+}
+
+void test_pubsub_shared_frames() {
+    std::cout << "Testing pub/sub shared frames...\n";
+
+    PubSub hub;
+    Subscriber a(hub, nullptr);
+    Subscriber b(hub, nullptr);
+    hub.subscribe(a, "big");
+    hub.subscribe(b, "big");
+
+    const std::string message(64 * 1024, 'm');
+    hub.publish("big", message);
+
+    // Large frames are spliced into each reply chain: both point at one copy
+    ReplyChain chain_a;
+    ReplyChain chain_b;
+    assert(a.take(chain_a, Subscriber::TAKE_BATCH_BYTES));
+    assert(b.take(chain_b, Subscriber::TAKE_BATCH_BYTES));
+    const char* piece_a = nullptr;
+    const char* piece_b = nullptr;
+    chain_a.gather(1, [&](std::string_view piece, const ValueRef* value) {
+        assert(value != nullptr);
+        piece_a = piece.data();
+    });
+    chain_b.gather(1, [&](std::string_view piece, const ValueRef*) { piece_b = piece.data(); });
+    assert(piece_a != nullptr && piece_a == piece_b);
+    assert(chain_a.pending() == frame("big", message).size());
+    assert(chain_a.bytes.empty());
+
+    // Small frames are copied into the serialized bytes
+    hub.publish("big", "small");
+    assert(a.take(chain_a, Subscriber::TAKE_BATCH_BYTES));
+    assert(chain_a.bytes == frame("big", "small"));
+
+    std::cout << "Pub/sub shared frame tests passed!\n";
+}
+
+void test_pubsub_hard_limit() {
+    std::cout << "Testing pub/sub hard limit...\n";
+
+    PubSub hub;
+    hub.set_limits({1000, 0, 0});
+    int wakes = 0;
+    Subscriber slow(hub, [&wakes] { ++wakes; });
+    Subscriber fast(hub, nullptr);
+    hub.subscribe(slow, "feed");
+    hub.subscribe(fast, "feed");
+
+    const std::string message(600, 'x');
+    hub.publish("feed", message);
+    assert(!slow.over_limit());
+    std::string out;
+    assert(fast.take(out, Subscriber::TAKE_BATCH_BYTES));
+
+    // Over the hard limit: the backlog is dropped and the owner woken to close
+    hub.publish("feed", message);
+    assert(wakes == 2);
+    assert(slow.over_limit());
+    assert(slow.ready());
+    assert(slow.queued_bytes() == 0);
+    out.clear();
+    assert(!slow.take(out, Subscriber::TAKE_BATCH_BYTES));
+    assert(out.empty());
+    assert(hub.limit_disconnections() == 1);
+
+    // Nothing more is queued; the subscriber that kept up is unaffected
+    assert(fast.take(out, Subscriber::TAKE_BATCH_BYTES));
+    hub.publish("feed", message);
+    assert(slow.queued_bytes() == 0);
+    assert(!fast.over_limit());
+    assert(fast.queued_bytes() == frame("feed", message).size());
+
+    std::cout << "Pub/sub hard limit tests passed!\n";
+}
+
+void test_pubsub_soft_limit() {
+    std::cout << "Testing pub/sub soft limit...\n";
+
+    PubSub hub;
+    hub.set_limits({0, 100, 0}); // Over 100 bytes for any time at all
+    Subscriber sub(hub, nullptr);
+    hub.subscribe(sub, "feed");
+
+    const std::string message(150, 's');
+    // The first message over the soft limit starts its timer
+    hub.publish("feed", message);
+    assert(!sub.over_limit());
+
+    // Catching up below the limit clears it
+    std::string out;
+    assert(sub.take(out, Subscriber::TAKE_BATCH_BYTES));
+    hub.publish("feed", message);
+    assert(!sub.over_limit());
+
+    // Still over at the next message, with the timer expired
+    hub.publish("feed", message);
+    assert(sub.over_limit());
+    assert(hub.limit_disconnections() == 1);
+
+    std::cout << "Pub/sub soft limit tests passed!\n";
+}
+
+void test_pubsub_unsubscribe() {
+    std::cout << "Testing pub/sub unsubscribe...\n";
+
+    PubSub hub;
+    Subscriber stays(hub, nullptr);
+    hub.subscribe(stays, "shared");
+    {
+        Subscriber leaves(hub, nullptr);
+        hub.subscribe(leaves, "shared");
+        hub.subscribe(leaves, "a");
+        hub.subscribe(leaves, "b");
+        assert(hub.subscribe(leaves, "a") == 3); // Already in it
+        assert(hub.channel_count() == 3);
+        assert(hub.publish("shared", "m") == 2);
+    } // Leaves its channels when destroyed
+
+    assert(hub.channel_count() == 1);
+    assert(hub.publish("shared", "m") == 1);
+    assert(hub.publish("a", "m") == 0);
+
+    hub.unsubscribe_all(stays);
+    assert(hub.channel_count() == 0);
+    // Messages queued before leaving are still delivered
+    std::string out;
+    assert(stays.take(out, Subscriber::TAKE_BATCH_BYTES));
+    assert(out == frame("shared", "m") + frame("shared", "m"));
+
+    std::cout << "Pub/sub unsubscribe tests passed!\n";
+}
+
+void run_pubsub_tests() {
+    test_pubsub_fan_out();
+    test_pubsub_shared_frames();
+    test_pubsub_hard_limit();
+    test_pubsub_soft_limit();
+    test_pubsub_unsubscribe();
+}
@@ -0,0 +1,210 @@
+// Tests for the RDB v2 format: CRC64, chunked save and parallel load
+
+#include "../src/storage/kv_store.hpp"
+#include "../src/utils/crc64.hpp"
+#include <cassert>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+
+namespace {
+
+std::string read_file(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+void write_file(const char* path, const std::string& content) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(content.data(), static_cast<std::streamsize>(content.size()));
+}
+
+template <typename T>
+void append_raw(std::string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+} // anonymous namespace
+
+void test_crc64() {
+    std::cout << "Testing CRC64...\n";
+
+    const std::string check = "123456789";
+    assert(mini_redis::crc64(0, check.data(), check.size()) == 0xe9c6d914c4b8d9caULL);
+    assert(mini_redis::crc64(0, nullptr, 0) == 0);
+
+    // Extending in pieces matches one pass, whatever the alignment
+    std::string data;
+    for (int i = 0; i < 1000; ++i) {
+        data.push_back(static_cast<char>(i * 31));
+    }
+    uint64_t whole = mini_redis::crc64(0, data.data(), data.size());
+    uint64_t parts = mini_redis::crc64(0, data.data(), 3);
+    parts = mini_redis::crc64(parts, data.data() + 3, 500);
+    parts = mini_redis::crc64(parts, data.data() + 503, data.size() - 503);
+    assert(whole == parts);
+
+    std::cout << "CRC64 tests passed!\n";
+}
+
+void test_rdb_v2_roundtrip() {
+    std::cout << "Testing RDB v2 save and parallel load...\n";
+
+    const char* path = "test_rdb_v2.rdb";
+    std::remove(path);
+    const int keys = 12000;
+    KVStore kv(16);
+    kv.set_eviction_limits(0, 0);
+    for (int i = 0; i < keys; ++i) {
+        kv.set("key:" + std::to_string(i), std::string(1000, static_cast<char>('a' + i % 26)));
+    }
+    kv.set("ttl", "x");
+    kv.pexpire("ttl", 60000);
+    kv.set("short", "gone");
+    kv.pexpire("short", 30);
+    assert(kv.save_to_rdb(path));
+
+    std::string content = read_file(path);
+    assert(content.compare(0, 4, "MRDB") == 0);
+    assert(content.size() > static_cast<size_t>(keys) * 1000); // Several 4 MB chunks
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+
+    // A different shard count: records are redistributed on load
+    KVStore restored(3);
+    restored.set_eviction_limits(0, 0);
+    assert(restored.load_from_rdb(path));
+    assert(restored.size() == static_cast<size_t>(keys) + 1); // "short" expired before the load
+    std::string value;
+    for (int i = 0; i < keys; i += 101) {
+        assert(restored.get("key:" + std::to_string(i), value));
+        assert(value == std::string(1000, static_cast<char>('a' + i % 26)));
+    }
+    // Deadlines keep millisecond precision
+    int64_t pttl = restored.pttl("ttl");
+    assert(pttl > 59000 && pttl <= 60000);
+    assert(!restored.exists("short"));
+    std::remove(path);
+
+    std::cout << "RDB v2 save and parallel load tests passed!\n";
+}
+
+void test_rdb_v2_corruption() {
+    std::cout << "Testing RDB v2 corruption detection...\n";
+
+    const char* path = "test_rdb_corrupt.rdb";
+    KVStore kv;
+    for (int i = 0; i < 100; ++i) {
+        kv.set("k" + std::to_string(i), "value" + std::to_string(i));
+    }
+    assert(kv.save_to_rdb(path));
+    const std::string good = read_file(path);
+
+    // A flipped byte in a record fails that chunk's CRC and nothing is loaded
+    std::string bad = good;
+    bad[20] = static_cast<char>(bad[20] ^ 0x40);
+    write_file(path, bad);
+    KVStore target;
+    assert(!target.load_from_rdb(path));
+    assert(target.size() == 0);
+
+    // A flipped byte in the index fails the footer CRC
+    bad = good;
+    bad[bad.size() - 30] = static_cast<char>(bad[bad.size() - 30] ^ 0x01);
+    write_file(path, bad);
+    assert(!target.load_from_rdb(path));
+
+    // Truncated files are rejected
+    write_file(path, good.substr(0, good.size() - 1));
+    assert(!target.load_from_rdb(path));
+    write_file(path, good.substr(0, 10));
+    assert(!target.load_from_rdb(path));
+
+    write_file(path, good);
+    assert(target.load_from_rdb(path) && target.size() == 100);
+    std::remove(path);
+
+    std::cout << "RDB v2 corruption detection tests passed!\n";
+}
+
+void test_rdb_databases() {
+    std::cout << "Testing RDB save and load of several databases...\n";
+
+    const char* path = "test_rdb_dbs.rdb";
+    std::vector<KVStore> dbs(3);
+    dbs[0].set("shared", "zero");
+    dbs[2].set("shared", "two");
+    for (int i = 0; i < 50; ++i) {
+        dbs[2].set("k" + std::to_string(i), std::to_string(i));
+    }
+    std::vector<KVStore::SnapshotCursor> cursors(dbs.size());
+    for (size_t i = 0; i < dbs.size(); ++i) {
+        assert(dbs[i].begin_snapshot(cursors[i]));
+    }
+    assert(KVStore::write_snapshots(dbs, cursors, path));
+    assert(dbs[0].last_save_time() > 0 && dbs[2].last_save_time() > 0);
+
+    // Each key goes back to the database it came from
+    std::vector<KVStore> restored(3);
+    assert(KVStore::load_databases_from_rdb(restored, path));
+    std::string value;
+    assert(restored[0].size() == 1 && restored[0].get("shared", value) && value == "zero");
+    assert(restored[1].size() == 0);
+    assert(restored[2].size() == 51 && restored[2].get("shared", value) && value == "two");
+
+    // A database the target lacks fails the load, and nothing is stored
+    std::vector<KVStore> fewer(2);
+    assert(!KVStore::load_databases_from_rdb(fewer, path));
+    assert(fewer[0].size() == 0 && fewer[1].size() == 0);
+    std::remove(path);
+
+    std::cout << "RDB save and load of several databases tests passed!\n";
+}
+
+void test_rdb_v1_compatibility() {
+    std::cout << "Testing RDB v1 compatibility...\n";
+
+    const char* path = "test_rdb_v1.rdb";
+    int64_t expiry_s = KVStore::now_ms() / 1000 + 3600;
+    std::string v1;
+    append_raw<uint32_t>(v1, 2);
+    append_raw<uint32_t>(v1, 3);
+    v1 += "one";
+    append_raw<uint32_t>(v1, 1);
+    v1 += "1";
+    append_raw<int64_t>(v1, 0);
+    append_raw<uint32_t>(v1, 3);
+    v1 += "two";
+    append_raw<uint32_t>(v1, 1);
+    v1 += "2";
+    append_raw<int64_t>(v1, expiry_s);
+    write_file(path, v1);
+
+    KVStore kv;
+    assert(kv.load_from_rdb(path));
+    std::string value;
+    assert(kv.get("one", value) && value == "1");
+    assert(kv.get("two", value) && value == "2");
+    assert(kv.ttl("two") > 3500);
+    std::remove(path);
+
+    assert(!kv.load_from_rdb("test_rdb_missing.rdb"));
+
+    std::cout << "RDB v1 compatibility tests passed!\n";
+}
+
+void run_rdb_tests() {
+    test_crc64();
+    test_rdb_v2_roundtrip();
+    test_rdb_v2_corruption();
+    test_rdb_databases();
+    test_rdb_v1_compatibility();
+}
@@ -0,0 +1,276 @@
+// Tests for the replica side: following a primary with REPLICAOF semantics
+
+#include "../src/server/replica_link.hpp"
+#include "../src/server/replication.hpp"
+#include "../src/storage/kv_store.hpp"
+#include "../src/protocol/parser.hpp"
+#include "../src/protocol/resp_parser.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace {
+
+protocol::Command make_command(protocol::CommandType type, const std::string& name,
+                               std::vector<std::string> args) {
+    protocol::Command cmd;
+    cmd.type = type;
+    cmd.name = name;
+    cmd.args = std::move(args);
+    return cmd;
+}
+
+// The primary: its databases, replication manager and a server answering
+// the replica handshake on a loopback port
+class Primary {
+public:
+    Primary() : dbs(2), repl(64 * 1024) {
+        mini_redis::net_init();
+        repl.start(&dbs, "test_link_primary.rdb");
+        listener_ = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        assert(bind(listener_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+        assert(listen(listener_, 4) == 0);
+        socklen_t len = sizeof(addr);
+        getsockname(listener_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port = ntohs(addr.sin_port);
+        server_ = std::thread([this] { serve(); });
+    }
+
+    ~Primary() {
+        serving_ = false;
+        drop_connection();
+        server_.join();
+        repl.stop();
+        closesocket(listener_);
+    }
+
+    void write(int db, const protocol::Command& cmd) {
+        auto gate = repl.write_pass();
+        if (cmd.type == protocol::CommandType::SET) {
+            dbs[db].set(cmd.args[0], cmd.args[1]);
+        } else if (cmd.type == protocol::CommandType::INCR) {
+            dbs[db].incr(cmd.args[0]);
+        }
+        repl.replicate_command(cmd, db);
+    }
+
+    // End the current replica connection, as a network fault would
+    void drop_connection() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (client_ != INVALID_SOCKET) {
+            mini_redis::shutdown_socket(client_);
+        }
+    }
+
+    void set_accepting(bool accepting) { accepting_ = accepting; }
+
+    std::vector<std::string> psyncs() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return psyncs_;
+    }
+
+    std::vector<KVStore> dbs;
+    ReplicationManager repl;
+    int port = 0;
+
+private:
+    void serve() {
+        while (serving_) {
+            if (!mini_redis::wait_readable(listener_, 50) || !accepting_) {
+                continue;
+            }
+            SOCKET client = accept(listener_, nullptr, nullptr);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                client_ = client;
+            }
+            handle(client);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                client_ = INVALID_SOCKET;
+            }
+            closesocket(client);
+        }
+    }
+
+    // What a server does for the commands a replica sends
+    void handle(SOCKET client) {
+        RespParser parser;
+        std::vector<std::string_view> args;
+        std::string error;
+        char chunk[4096];
+        int n;
+        while ((n = static_cast<int>(recv(client, chunk, sizeof(chunk), 0))) > 0) {
+            parser.append(chunk, static_cast<size_t>(n));
+            while (parser.parseArgs(args, error) == RespStatus::Complete) {
+                protocol::Command cmd = protocol::command_from_resp_args(args);
+                std::string reply;
+                if (cmd.type == protocol::CommandType::PING) {
+                    reply = "+PONG\r\n";
+                } else if (cmd.type == protocol::CommandType::REPLCONF && cmd.args[0] == "ACK") {
+                    repl.acknowledge(client, std::stoull(cmd.args[1]));
+                } else if (cmd.type == protocol::CommandType::REPLCONF) {
+                    reply = "+OK\r\n";
+                } else if (cmd.type == protocol::CommandType::PSYNC) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        psyncs_.push_back(cmd.args[0] + " " + cmd.args[1]);
+                    }
+                    const uint64_t offset = cmd.args[1] == "-1" ? 0 : std::stoull(cmd.args[1]);
+                    assert(repl.psync(client, cmd.args[0], offset).empty());
+                }
+                if (!reply.empty()) {
+                    send(client, reply.data(), static_cast<int>(reply.size()), 0);
+                }
+            }
+        }
+    }
+
+    SOCKET listener_ = INVALID_SOCKET;
+    std::thread server_;
+    std::atomic<bool> serving_{true};
+    std::atomic<bool> accepting_{true};
+    std::mutex mutex_;
+    SOCKET client_ = INVALID_SOCKET;
+    std::vector<std::string> psyncs_;
+};
+
+// The replica's databases and what the server would apply to them
+struct Replica {
+    Replica() : dbs(2) {}
+
+    void apply(const protocol::Command& cmd) {
+        switch (cmd.type) {
+            case protocol::CommandType::SELECT: db = std::stoi(cmd.args[0]); break;
+            case protocol::CommandType::SET: dbs[db].set(cmd.args[0], cmd.args[1]); break;
+            case protocol::CommandType::INCR: dbs[db].incr(cmd.args[0]); break;
+            case protocol::CommandType::PING: break;
+            default: assert(false);
+        }
+    }
+
+    std::vector<KVStore> dbs;
+    int db = 0; // Only touched by the link thread
+    std::atomic<int> resyncs{0};
+};
+
+std::string value_of(KVStore& db, const std::string& key) {
+    std::string value;
+    return db.get(key, value) ? value : "(nil)";
+}
+
+template <typename Pred>
+bool eventually(Pred pred) {
+    for (int i = 0; i < 500; ++i) {
+        if (pred()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+void test_replica_link_sync_and_resume() {
+    std::cout << "Testing replica link sync and resume...\n";
+
+    Primary primary;
+    primary.dbs[0].set("greeting", "hello");
+    primary.dbs[1].set("other", "db");
+
+    Replica replica;
+    replica.dbs[0].set("stale", "gone after the full resync");
+    ReplicaLink link(replica.dbs, [&](const protocol::Command& cmd) { replica.apply(cmd); },
+                     [&] { replica.resyncs++; }, 7000, 1500, "test_link_replica.rdb");
+    assert(!link.active() && !link.fresh());
+    link.follow("127.0.0.1", primary.port);
+    assert(link.active());
+
+    // First sync: a full resync replacing whatever the replica held
+    assert(eventually([&] { return link.fresh(); }));
+    assert(replica.resyncs == 1);
+    assert(primary.psyncs()[0] == "? -1");
+    assert(value_of(replica.dbs[0], "greeting") == "hello");
+    assert(value_of(replica.dbs[1], "other") == "db");
+    assert(value_of(replica.dbs[0], "stale") == "(nil)");
+
+    // Then the stream, with the offset acknowledged back
+    for (int i = 0; i < 100; ++i) {
+        primary.write(0, make_command(protocol::CommandType::INCR, "INCR", {"counter"}));
+    }
+    primary.write(1, make_command(protocol::CommandType::SET, "SET", {"other", "changed"}));
+    assert(eventually([&] { return link.status().offset == primary.repl.master_offset(); }));
+    assert(value_of(replica.dbs[0], "counter") == "100");
+    assert(value_of(replica.dbs[1], "other") == "changed");
+    assert(eventually([&] {
+        auto replicas = primary.repl.replicas();
+        return replicas.size() == 1 && replicas[0].ack_offset == primary.repl.master_offset();
+    }));
+    ReplicaLink::Status status = link.status();
+    assert(status.link_up && !status.sync_in_progress && status.port == primary.port);
+
+    // A dropped link resumes from its offset: only the missed writes are sent
+    primary.set_accepting(false);
+    primary.drop_connection();
+    assert(eventually([&] { return !link.status().link_up; }));
+    for (int i = 0; i < 50; ++i) {
+        primary.write(0, make_command(protocol::CommandType::INCR, "INCR", {"counter"}));
+    }
+    const uint64_t resumed_at = link.status().offset;
+    primary.set_accepting(true);
+    assert(eventually([&] { return link.status().offset == primary.repl.master_offset(); }));
+    assert(value_of(replica.dbs[0], "counter") == "150");
+    assert(primary.psyncs().size() == 2);
+    assert(primary.psyncs()[1] == primary.repl.replid() + " " + std::to_string(resumed_at));
+    assert(replica.resyncs == 1);
+
+    // A new history on the primary means a full resync
+    primary.repl.reset_history();
+    assert(eventually([&] { return replica.resyncs == 2; }));
+    assert(eventually([&] { return link.fresh(); }));
+    assert(value_of(replica.dbs[0], "counter") == "150");
+
+    link.stop();
+    assert(!link.active());
+
+    std::cout << "Replica link sync and resume tests passed!\n";
+}
+
+void test_replica_link_staleness() {
+    std::cout << "Testing replica link staleness bound...\n";
+
+    Primary primary;
+    Replica replica;
+    ReplicaLink link(replica.dbs, [&](const protocol::Command& cmd) { replica.apply(cmd); },
+                     [&] { replica.resyncs++; }, 7000, 1500, "test_link_stale.rdb");
+    link.follow("127.0.0.1", primary.port);
+    assert(eventually([&] { return link.fresh(); }));
+
+    // An idle primary's heartbeats keep the replica fresh
+    std::this_thread::sleep_for(std::chrono::milliseconds(2500));
+    assert(link.fresh() && link.status().link_up);
+
+    // Once the primary is unreachable reads go stale after the bound
+    primary.set_accepting(false);
+    primary.drop_connection();
+    assert(eventually([&] { return !link.fresh(); }));
+    assert(link.active());
+
+    link.stop();
+    std::cout << "Replica link staleness tests passed!\n";
+}
+
+void run_replica_link_tests() {
+    test_replica_link_sync_and_resume();
+    test_replica_link_staleness();
+}
@@ -0,0 +1,338 @@
+// Tests for the replication backlog, partial and full resync
+
+#include "../src/server/replication.hpp"
+#include "../src/storage/kv_store.hpp"
+#include "../src/protocol/parser.hpp"
+#include "../src/protocol/resp_parser.hpp"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+namespace {
+
+protocol::Command make_command(protocol::CommandType type, const std::string& name,
+                               std::vector<std::string> args) {
+    protocol::Command cmd;
+    cmd.type = type;
+    cmd.name = name;
+    cmd.args = std::move(args);
+    return cmd;
+}
+
+// Apply a write and replicate it, as a server does
+void apply_and_replicate(ReplicationManager& repl, std::vector<KVStore>& dbs, int db,
+                         const protocol::Command& cmd) {
+    auto gate = repl.write_pass();
+    if (cmd.type == protocol::CommandType::SET) {
+        dbs[db].set(cmd.args[0], cmd.args[1]);
+    } else if (cmd.type == protocol::CommandType::INCR) {
+        dbs[db].incr(cmd.args[0]);
+    }
+    repl.replicate_command(cmd, db);
+}
+
+// A connected loopback pair: first is the primary's end, second the replica's
+std::pair<SOCKET, SOCKET> connected_pair() {
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    assert(bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+    assert(listen(listener, 1) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len);
+    SOCKET replica = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    assert(connect(replica, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0);
+    SOCKET primary = accept(listener, nullptr, nullptr);
+    closesocket(listener);
+    return {primary, replica};
+}
+
+// The replica's end: the handshake, then the stream applied to its own databases
+class ReplicaEnd {
+public:
+    ReplicaEnd(SOCKET socket, size_t db_count) : dbs(db_count), socket_(socket) {
+        for (auto& db : dbs) {
+            db.set_eviction_limits(0, 0);
+        }
+    }
+    ~ReplicaEnd() { closesocket(socket_); }
+
+    std::string line() {
+        size_t eol;
+        while ((eol = buffer_.find("\r\n")) == std::string::npos) {
+            fill();
+        }
+        std::string out = buffer_.substr(0, eol);
+        buffer_.erase(0, eol + 2);
+        return out;
+    }
+
+    // One RDB bulk string of a full resync, loaded into database db
+    void load_bulk(size_t db) {
+        std::string header = line();
+        assert(header[0] == '$');
+        const size_t size = std::stoul(header.substr(1));
+        while (buffer_.size() < size + 2) {
+            fill();
+        }
+        const char* path = "test_replica_load.rdb";
+        {
+            std::ofstream out(path, std::ios::binary);
+            out.write(buffer_.data(), static_cast<std::streamsize>(size));
+        }
+        buffer_.erase(0, size + 2);
+        assert(dbs[db].load_from_rdb(path));
+        std::remove(path);
+    }
+
+    // Apply the stream until offset reaches target
+    void apply_until(uint64_t target) {
+        while (offset < target) {
+            if (buffer_.empty()) {
+                fill();
+            }
+            const size_t take = static_cast<size_t>(std::min<uint64_t>(buffer_.size(), target - offset));
+            parser_.append(buffer_.data(), take);
+            buffer_.erase(0, take);
+            offset += take;
+            std::vector<std::string_view> args;
+            std::string error;
+            while (parser_.parseArgs(args, error) == RespStatus::Complete) {
+                apply(protocol::command_from_resp_args(args));
+            }
+        }
+    }
+
+    std::vector<KVStore> dbs;
+    uint64_t offset = 0;
+
+private:
+    void fill() {
+        char chunk[16 * 1024];
+        int n = static_cast<int>(recv(socket_, chunk, sizeof(chunk), 0));
+        assert(n > 0);
+        buffer_.append(chunk, static_cast<size_t>(n));
+    }
+
+    void apply(const protocol::Command& cmd) {
+        switch (cmd.type) {
+            case protocol::CommandType::SELECT: db_ = std::stoi(cmd.args[0]); break;
+            case protocol::CommandType::SET: dbs[db_].set(cmd.args[0], cmd.args[1]); break;
+            case protocol::CommandType::INCR: dbs[db_].incr(cmd.args[0]); break;
+            case protocol::CommandType::PING: break; // Heartbeat
+            default: assert(false);
+        }
+    }
+
+    SOCKET socket_;
+    std::string buffer_;
+    RespParser parser_;
+    int db_ = 0;
+};
+
+std::vector<std::string> split(const std::string& text) {
+    std::istringstream in(text);
+    std::vector<std::string> words;
+    std::string word;
+    while (in >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+// Read +FULLRESYNC and the snapshot; the replica's offset becomes the snapshot's
+void receive_full_resync(ReplicaEnd& replica, const std::string& replid) {
+    std::vector<std::string> words = split(replica.line());
+    assert(words.size() == 4 && words[0] == "+FULLRESYNC" && words[1] == replid);
+    assert(std::stoul(words[3]) == replica.dbs.size());
+    replica.offset = std::stoull(words[2]);
+    for (size_t db = 0; db < replica.dbs.size(); ++db) {
+        replica.load_bulk(db);
+    }
+}
+
+std::string value_of(KVStore& db, const std::string& key) {
+    std::string value;
+    return db.get(key, value) ? value : "(nil)";
+}
+
+// One replica, streaming
+bool online(ReplicationManager& repl) {
+    auto replicas = repl.replicas();
+    return replicas.size() == 1 && std::string(replicas[0].state) == "online";
+}
+
+template <typename Pred>
+bool eventually(Pred pred) {
+    for (int i = 0; i < 500; ++i) {
+        if (pred()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+} // anonymous namespace
+
+void test_replication_full_then_partial_resync() {
+    std::cout << "Testing full and partial resync...\n";
+
+    mini_redis::net_init();
+    std::vector<KVStore> dbs(2);
+    dbs[0].set("before", "snapshot");
+    dbs[1].set("other", "db");
+    ReplicationManager repl(16 * 1024);
+    repl.start(&dbs, "test_repl_sync.rdb");
+
+    // Nothing is buffered until a replica has attached
+    apply_and_replicate(repl, dbs, 0, make_command(protocol::CommandType::INCR, "INCR", {"counter"}));
+    assert(repl.master_offset() == 0);
+
+    auto first = connected_pair();
+    uint64_t offset = 0;
+    {
+        ReplicaEnd replica(first.second, dbs.size());
+        assert(repl.psync(first.first, "?", 0).empty());
+        receive_full_resync(replica, repl.replid());
+        assert(value_of(replica.dbs[0], "before") == "snapshot");
+        assert(value_of(replica.dbs[0], "counter") == "1");
+        assert(value_of(replica.dbs[1], "other") == "db");
+
+        for (int i = 0; i < 100; ++i) {
+            apply_and_replicate(repl, dbs, 0, make_command(protocol::CommandType::INCR, "INCR", {"counter"}));
+        }
+        apply_and_replicate(repl, dbs, 1, make_command(protocol::CommandType::SET, "SET", {"other", "changed"}));
+        replica.apply_until(repl.master_offset());
+        assert(value_of(replica.dbs[0], "counter") == "101");
+        assert(value_of(replica.dbs[1], "other") == "changed"); // After a SELECT 1
+        assert(eventually([&] { return online(repl); }));
+        repl.acknowledge(first.first, replica.offset);
+        assert(repl.replicas()[0].ack_offset == replica.offset);
+        offset = replica.offset;
+    }
+    closesocket(first.first);
+
+    // Writes while the replica is away stay in the backlog
+    for (int i = 0; i < 50; ++i) {
+        apply_and_replicate(repl, dbs, 0, make_command(protocol::CommandType::INCR, "INCR", {"counter"}));
+    }
+    auto second = connected_pair();
+    {
+        ReplicaEnd replica(second.second, dbs.size());
+        replica.offset = offset;
+        assert(repl.psync(second.first, repl.replid(), offset).empty());
+        assert(replica.line() == "+CONTINUE " + repl.replid());
+        replica.apply_until(repl.master_offset());
+        assert(value_of(replica.dbs[0], "counter") == "50"); // Only the missed INCRs were resent
+    }
+    closesocket(second.first);
+
+    // Once the backlog has moved past an offset, or for another replid, it is a full resync
+    for (int i = 0; i < 200; ++i) {
+        apply_and_replicate(repl, dbs, 0, make_command(protocol::CommandType::SET, "SET",
+                                                       {"pad", std::string(100, 'p')}));
+    }
+    assert(repl.backlog_first_offset() > offset);
+    auto third = connected_pair();
+    {
+        ReplicaEnd replica(third.second, dbs.size());
+        assert(repl.psync(third.first, repl.replid(), offset).empty());
+        receive_full_resync(replica, repl.replid());
+        assert(value_of(replica.dbs[0], "counter") == "151");
+    }
+    closesocket(third.first);
+    repl.stop();
+
+    std::cout << "Full and partial resync tests passed!\n";
+}
+
+void test_replication_resync_during_writes() {
+    std::cout << "Testing full resync under concurrent writes...\n";
+
+    std::vector<KVStore> dbs(1);
+    dbs[0].set_eviction_limits(0, 0);
+    for (int i = 0; i < 20000; ++i) {
+        dbs[0].set("pad" + std::to_string(i), std::string(32, 'p'));
+    }
+    ReplicationManager repl(64 * 1024 * 1024);
+    repl.start(&dbs, "test_repl_live.rdb");
+
+    const int threads = 4;
+    const int keys = 20;
+    std::atomic<bool> synced{false};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            // Counters are not idempotent: one both in the snapshot and resent would show
+            for (int i = 0; i < 20000 || !synced; ++i) {
+                apply_and_replicate(repl, dbs, 0, make_command(protocol::CommandType::INCR, "INCR",
+                                                               {"c" + std::to_string(i % keys)}));
+            }
+        });
+    }
+
+    auto pair = connected_pair();
+    ReplicaEnd replica(pair.second, dbs.size());
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    assert(repl.psync(pair.first, "?", 0).empty());
+    receive_full_resync(replica, repl.replid());
+    synced = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    replica.apply_until(repl.master_offset());
+    for (int c = 0; c < keys; ++c) {
+        const std::string key = "c" + std::to_string(c);
+        assert(value_of(replica.dbs[0], key) == value_of(dbs[0], key));
+    }
+    assert(replica.dbs[0].size() == dbs[0].size());
+    repl.stop();
+    closesocket(pair.first);
+
+    std::cout << "Full resync under concurrent writes tests passed!\n";
+}
+
+void test_replication_slow_replica() {
+    std::cout << "Testing slow replica...\n";
+
+    std::vector<KVStore> dbs(1);
+    ReplicationManager repl(64 * 1024);
+    repl.start(&dbs, "test_repl_slow.rdb");
+    auto pair = connected_pair();
+    assert(repl.psync(pair.first, "?", 0).empty());
+    assert(eventually([&] { return online(repl); }));
+
+    // The replica never reads: writers carry on and it is dropped once the
+    // backlog has moved past what it was sent
+    const std::string value(1024, 'v');
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 20000; ++i) {
+        apply_and_replicate(repl, dbs, 0, make_command(protocol::CommandType::SET, "SET", {"k", value}));
+    }
+    assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+    assert(eventually([&] { return repl.replicas().empty(); }));
+    repl.stop();
+    closesocket(pair.first);
+    closesocket(pair.second);
+
+    std::cout << "Slow replica tests passed!\n";
+}
+
+void run_replication_tests() {
+    test_replication_full_then_partial_resync();
+    test_replication_resync_during_writes();
+    test_replication_slow_replica();
+}
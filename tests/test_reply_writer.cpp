@@ -0,0 +1,226 @@
+// Tests for the RESP reply writer
+
+#include "../src/protocol/resp_utils.hpp"
+#include "../src/storage/kv_store.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+void test_reply_writer_encoding() {
+    std::cout << "Testing reply writer encoding...\n";
+
+    std::string out;
+    mini_redis::ReplyWriter reply(out);
+    reply.simple("OK");
+    reply.error("ERR bad");
+    reply.bulk("hello");
+    reply.bulk("");
+    reply.nil();
+    reply.integer(0);
+    reply.integer(-42);
+    reply.integer(INT64_MAX);
+    reply.integer(INT64_MIN);
+    reply.array_header(3);
+    assert(out ==
+           "+OK\r\n"
+           "-ERR bad\r\n"
+           "$5\r\nhello\r\n"
+           "$0\r\n\r\n"
+           "$-1\r\n"
+           ":0\r\n"
+           ":-42\r\n"
+           ":9223372036854775807\r\n"
+           ":-9223372036854775808\r\n"
+           "*3\r\n");
+
+    // Binary-safe bulk strings
+    out.clear();
+    reply.bulk(std::string("a\0b", 3));
+    assert(out == std::string("$3\r\na\0b\r\n", 9));
+
+    // Wrappers match the writer
+    assert(mini_redis::resp_integer64(-7) == ":-7\r\n");
+    assert(mini_redis::resp_array({"a", "bc"}) == "*2\r\n$1\r\na\r\n$2\r\nbc\r\n");
+
+    std::cout << "Reply writer encoding tests passed!\n";
+}
+
+void test_reply_writer_resp3() {
+    std::cout << "Testing RESP3 reply encoding...\n";
+
+    std::string out;
+    mini_redis::ReplyWriter resp2(out);
+    resp2.map_header(2);
+    resp2.nil();
+    resp2.nil_array();
+    assert(out == "*4\r\n$-1\r\n*-1\r\n");
+
+    out.clear();
+    mini_redis::ReplyWriter resp3(out);
+    resp3.set_resp3(true);
+    resp3.map_header(2);
+    resp3.nil();
+    resp3.nil_array();
+    resp3.push_header(2);
+    assert(out == "%2\r\n_\r\n_\r\n>2\r\n");
+
+    std::cout << "RESP3 reply encoding tests passed!\n";
+}
+
+void test_reply_writer_reuses_buffer() {
+    std::cout << "Testing reply writer buffer reuse...\n";
+
+    std::string out;
+    out.reserve(256);
+    const char* data = out.data();
+    mini_redis::ReplyWriter reply(out);
+    for (int i = 0; i < 10; ++i) {
+        out.clear();
+        reply.bulk("some value");
+        reply.integer(i);
+    }
+    assert(out.data() == data); // No reallocation once the buffer is sized
+
+    std::cout << "Reply writer buffer reuse tests passed!\n";
+}
+
+void test_read_value() {
+    std::cout << "Testing KVStore read_value...\n";
+
+    KVStore kv;
+    kv.set("key", "value");
+
+    std::string out;
+    mini_redis::ReplyWriter reply(out);
+    assert(kv.read_value("key", [&](std::string_view value) { reply.bulk(value); }));
+    assert(out == "$5\r\nvalue\r\n");
+
+    bool called = false;
+    assert(!kv.read_value("missing", [&](std::string_view) { called = true; }));
+    assert(!called);
+
+    // Expired keys are not visible
+    kv.pexpire("key", -1);
+    assert(!kv.read_value("key", [&](std::string_view) { called = true; }));
+    assert(!called);
+
+    std::cout << "KVStore read_value tests passed!\n";
+}
+
+// Flatten what a chain would send, one gather list at a time
+static std::string drain_chain(mini_redis::ReplyChain& chain, size_t max_pieces, size_t max_send) {
+    std::string wire;
+    while (chain.pending() > 0) {
+        size_t budget = max_send;
+        size_t sent = 0;
+        chain.gather(max_pieces, [&](std::string_view piece, const ValueRef*) {
+            const size_t take = std::min(budget, piece.size());
+            wire.append(piece.data(), take);
+            budget -= take;
+            sent += take;
+        });
+        chain.consume(sent);
+    }
+    return wire;
+}
+
+void test_reply_chain_splices_values() {
+    std::cout << "Testing reply chain splicing...\n";
+
+    KVStore kv;
+    const std::string big(mini_redis::ReplyWriter::SPLICE_MIN_BYTES + 100, 'x');
+    kv.set("big", big);
+    kv.set("small", "tiny");
+
+    mini_redis::ReplyChain chain;
+    mini_redis::ReplyWriter reply(chain);
+    auto get = [&](const std::string& key) {
+        assert(kv.read_value(key, [&](std::string_view value, const SharedValue* shared) {
+            reply.bulk(value, shared);
+        }));
+    };
+    get("small");
+    get("big");
+    reply.integer(7);
+    get("big");
+
+    // The large value is referenced, not copied into the chain's bytes
+    const std::string expected = "$4\r\ntiny\r\n$" + std::to_string(big.size()) + "\r\n" + big + "\r\n:7\r\n$" +
+                                 std::to_string(big.size()) + "\r\n" + big + "\r\n";
+    assert(chain.bytes.size() < 100);
+    assert(chain.pending() == expected.size());
+
+    size_t pieces = 0;
+    const ValueRef* first_value = nullptr;
+    chain.gather(16, [&](std::string_view, const ValueRef* value) {
+        if (value && !first_value) {
+            first_value = value;
+        }
+        ++pieces;
+    });
+    assert(pieces == 5);
+    assert(first_value && first_value->view() == big);
+
+    // Partial sends resume mid-piece; a drained chain is cleared
+    assert(drain_chain(chain, 2, 1000) == expected);
+    assert(chain.pending() == 0 && chain.bytes.empty());
+
+    // Without a chain, or for small values, the bytes are copied
+    std::string out;
+    mini_redis::ReplyWriter plain(out);
+    assert(kv.read_value("big", [&](std::string_view value, const SharedValue* shared) {
+        assert(shared != nullptr);
+        plain.bulk(value, shared);
+    }));
+    assert(out == "$" + std::to_string(big.size()) + "\r\n" + big + "\r\n");
+
+    std::cout << "Reply chain splicing tests passed!\n";
+}
+
+void test_value_ref_outlives_writes() {
+    std::cout << "Testing value references across writes...\n";
+
+    KVStore kv;
+    const std::string first(40000, 'a');
+    kv.set("key", first);
+
+    ValueRef ref;
+    assert(kv.read_value("key", [&](std::string_view, const SharedValue* shared) { ref = ValueRef(shared); }));
+    assert(ref.view() == first);
+
+    // Writes while a reference is out leave its bytes alone
+    kv.append("key", "tail");
+    assert(ref.view() == first);
+    std::string value;
+    assert(kv.get("key", value) && value == first + "tail");
+
+    const std::string second(50000, 'b');
+    kv.set("key", second);
+    assert(ref.view() == first);
+    assert(kv.get("key", value) && value == second);
+
+    // The reference keeps the bytes alive after the key is gone
+    kv.del("key");
+    kv.clear();
+    assert(ref.view() == first);
+    ValueRef copy = ref;
+    ref.reset();
+    assert(copy.view() == first);
+
+    // Short values are not reference-counted
+    kv.set("short", "value");
+    assert(kv.read_value("short", [&](std::string_view, const SharedValue* shared) { assert(shared == nullptr); }));
+
+    std::cout << "Value reference tests passed!\n";
+}
+
+void run_reply_writer_tests() {
+    test_reply_writer_encoding();
+    test_reply_writer_resp3();
+    test_reply_writer_reuses_buffer();
+    test_read_value();
+    test_reply_chain_splices_values();
+    test_value_ref_outlives_writes();
+}
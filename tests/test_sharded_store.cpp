@@ -0,0 +1,209 @@
+// Tests for the sharded (lock-striped) KVStore
+// Verifies keys land in one shard each, whole-store ops visit every shard and
+// batch commands apply to all their shards at once
+
+#include "../src/storage/kv_store.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+void test_shard_count() {
+    std::cout << "Testing shard count...\n";
+
+    KVStore kv;
+    assert(kv.shard_count() == KVStore::DEFAULT_SHARD_COUNT);
+
+    KVStore single(1);
+    assert(single.shard_count() == 1);
+
+    // Zero is clamped to a single shard
+    KVStore clamped(0);
+    assert(clamped.shard_count() == 1);
+
+    std::cout << "Shard count tests passed!\n";
+}
+
+void test_sharded_keyspace() {
+    std::cout << "Testing sharded keyspace...\n";
+
+    KVStore kv(8);
+    for (int i = 0; i < 200; ++i) {
+        kv.set("key:" + std::to_string(i), "value:" + std::to_string(i));
+    }
+    assert(kv.size() == 200);
+
+    auto keys = kv.keys();
+    assert(keys.size() == 200);
+    assert(std::find(keys.begin(), keys.end(), "key:0") != keys.end());
+    assert(std::find(keys.begin(), keys.end(), "key:199") != keys.end());
+
+    std::string value;
+    assert(kv.get("key:42", value));
+    assert(value == "value:42");
+    assert(kv.del("key:42"));
+    assert(kv.size() == 199);
+
+    std::cout << "Sharded keyspace tests passed!\n";
+}
+
+void test_reshard_keeps_data() {
+    std::cout << "Testing reshard...\n";
+
+    KVStore kv(4);
+    for (int i = 0; i < 50; ++i) {
+        kv.set("k" + std::to_string(i), std::to_string(i));
+    }
+    assert(kv.expire("k7", 100));
+
+    kv.set_shard_count(32);
+    assert(kv.shard_count() == 32);
+    assert(kv.size() == 50);
+
+    std::string value;
+    assert(kv.get("k7", value));
+    assert(value == "7");
+    int ttl = kv.ttl("k7");
+    assert(ttl > 0 && ttl <= 100);
+
+    std::cout << "Reshard tests passed!\n";
+}
+
+void test_sharded_rdb_roundtrip() {
+    std::cout << "Testing sharded RDB roundtrip...\n";
+
+    KVStore kv(8);
+    for (int i = 0; i < 100; ++i) {
+        kv.set("rdb:" + std::to_string(i), std::to_string(i * i));
+    }
+    assert(kv.save_to_rdb("test_sharded.rdb"));
+
+    // Load into a store with a different shard layout
+    KVStore kv2(3);
+    assert(kv2.load_from_rdb("test_sharded.rdb"));
+    assert(kv2.size() == 100);
+    std::string value;
+    assert(kv2.get("rdb:9", value));
+    assert(value == "81");
+
+    std::remove("test_sharded.rdb");
+
+    std::cout << "Sharded RDB roundtrip tests passed!\n";
+}
+
+void test_concurrent_counters() {
+    std::cout << "Testing concurrent counters...\n";
+
+    KVStore kv;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&kv]() {
+            for (int i = 0; i < 1000; ++i) {
+                kv.incr("counter:" + std::to_string(i % 10));
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (int i = 0; i < 10; ++i) {
+        std::string value;
+        assert(kv.get("counter:" + std::to_string(i), value));
+        assert(value == "400");
+    }
+
+    std::cout << "Concurrent counter tests passed!\n";
+}
+
+void test_batch_commands() {
+    std::cout << "Testing batch commands...\n";
+
+    KVStore kv(8);
+    kv.mset({"b1", "one", "b2", "2", "b3", "three", "b1", "uno"});
+    assert(kv.size() == 3);
+    std::string value;
+    assert(kv.get("b1", value) && value == "uno"); // The last value wins
+    assert(kv.exists_many({"b1", "b2", "missing", "b1"}) == 3);
+
+    std::vector<std::string> values;
+    size_t misses = 0;
+    kv.read_values({"b3", "missing", "b2"}, [&](std::string_view v) { values.emplace_back(v); },
+                   [&] { ++misses; });
+    assert(values.size() == 2 && values[0] == "three" && values[1] == "2");
+    assert(misses == 1);
+
+    // MSETNX sets nothing if any key exists
+    assert(!kv.msetnx({"n1", "x", "b2", "y"}));
+    assert(!kv.exists("n1"));
+    assert(kv.get("b2", value) && value == "2");
+    assert(kv.msetnx({"n1", "x", "n2", "y"}));
+    assert(kv.exists_many({"n1", "n2"}) == 2);
+
+    // An expired key counts as missing
+    assert(kv.pexpire("n2", 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    assert(kv.msetnx({"n2", "z"}));
+    assert(kv.ttl("n2") == -1);
+
+    assert(kv.del_many({"b1", "b2", "b1", "missing"}) == 2);
+    assert(kv.exists_many({"b1", "b2"}) == 0);
+    assert(kv.size() == 3);
+
+    std::cout << "Batch command tests passed!\n";
+}
+
+void test_batches_are_atomic() {
+    std::cout << "Testing batch atomicity...\n";
+
+    KVStore kv(16);
+    std::vector<std::string> keys;
+    for (int i = 0; i < 32; ++i) {
+        keys.push_back("atomic:" + std::to_string(i));
+    }
+    std::atomic<bool> done{false};
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 2; ++t) {
+        writers.emplace_back([&, t] {
+            std::vector<std::string> pairs;
+            for (int i = 0; !done; ++i) {
+                pairs.clear();
+                // The two writers lock the same shards, listed in opposite orders
+                for (size_t k = 0; k < keys.size(); ++k) {
+                    pairs.push_back(keys[t == 0 ? k : keys.size() - 1 - k]);
+                    pairs.push_back(std::to_string(t) + ":" + std::to_string(i));
+                }
+                kv.mset(pairs);
+            }
+        });
+    }
+    // A reader sees every key of a batch from the same MSET
+    for (int round = 0; round < 2000; ++round) {
+        std::vector<std::string> values;
+        kv.read_values(keys, [&](std::string_view v) { values.emplace_back(v); }, [] {});
+        for (const auto& v : values) {
+            assert(v == values[0]);
+        }
+    }
+    done = true;
+    for (auto& writer : writers) {
+        writer.join();
+    }
+
+    std::cout << "Batch atomicity tests passed!\n";
+}
+
+void run_sharded_store_tests() {
+    test_shard_count();
+    test_sharded_keyspace();
+    test_reshard_keeps_data();
+    test_sharded_rdb_roundtrip();
+    test_concurrent_counters();
+    test_batch_commands();
+    test_batches_are_atomic();
+}
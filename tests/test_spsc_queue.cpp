@@ -0,0 +1,79 @@
+// Tests for the lock-free SPSC queue
+
+#include "../src/utils/spsc_queue.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+
+void test_spsc_queue_basic() {
+    std::cout << "Testing SPSC queue basics...\n";
+
+    mini_redis::SpscQueue<std::string> queue(3);
+    assert(queue.capacity() == 4); // Rounded up to a power of two
+    assert(queue.empty());
+
+    std::string out;
+    assert(!queue.try_pop(out));
+
+    for (int i = 0; i < 4; ++i) {
+        std::string item = "item" + std::to_string(i);
+        assert(queue.try_push(item));
+    }
+    std::string extra = "extra";
+    assert(!queue.try_push(extra));
+    assert(extra == "extra"); // Left untouched when full
+
+    for (int i = 0; i < 4; ++i) {
+        assert(queue.try_pop(out));
+        assert(out == "item" + std::to_string(i)); // FIFO
+    }
+    assert(!queue.try_pop(out));
+    assert(queue.empty());
+
+    // Full again after wrapping around
+    for (int round = 0; round < 10; ++round) {
+        std::string item = std::to_string(round);
+        assert(queue.try_push(item));
+        assert(queue.try_pop(out));
+        assert(out == std::to_string(round));
+    }
+
+    std::cout << "SPSC queue basic tests passed!\n";
+}
+
+void test_spsc_queue_threads() {
+    std::cout << "Testing SPSC queue across threads...\n";
+
+    const int count = 200000;
+    mini_redis::SpscQueue<int> queue(64);
+
+    std::thread producer([&]() {
+        for (int i = 0; i < count; ++i) {
+            int item = i;
+            while (!queue.try_push(item)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    int expected = 0;
+    int value = 0;
+    while (expected < count) {
+        if (queue.try_pop(value)) {
+            assert(value == expected); // Every item, in order
+            ++expected;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    assert(!queue.try_pop(value));
+
+    std::cout << "SPSC queue thread tests passed!\n";
+}
+
+void run_spsc_queue_tests() {
+    test_spsc_queue_basic();
+    test_spsc_queue_threads();
+}
@@ -0,0 +1,170 @@
+// Tests for the open-addressing keyspace table
+
+#include "../src/storage/swiss_table.hpp"
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <set>
+#include <vector>
+
+namespace {
+
+struct Item {
+    std::string key;
+    int visits = 0;
+};
+
+struct ItemKey {
+    std::string_view operator()(const Item* item) const { return item->key; }
+};
+
+using Table = SwissTable<Item, ItemKey>;
+
+std::vector<std::unique_ptr<Item>> make_items(int count, const std::string& prefix = "key:") {
+    std::vector<std::unique_ptr<Item>> items;
+    for (int i = 0; i < count; ++i) {
+        items.push_back(std::make_unique<Item>(Item{prefix + std::to_string(i)}));
+    }
+    return items;
+}
+
+} // anonymous namespace
+
+void test_swiss_insert_find_erase() {
+    std::cout << "Testing swiss table insert/find/erase...\n";
+
+    Table table;
+    assert(table.empty() && !table.find("missing"));
+    auto items = make_items(100000);
+    for (size_t i = 0; i < items.size(); ++i) {
+        table.insert(items[i].get());
+        assert(table.find(items[i]->key).value == items[i].get());
+    }
+    assert(table.size() == items.size());
+    for (const auto& item : items) {
+        assert(table.find(item->key).value == item.get());
+    }
+    assert(!table.find("key:100000") && !table.find(""));
+
+    // Erase every other key; tombstones must not hide the rest
+    for (size_t i = 0; i < items.size(); i += 2) {
+        auto hit = table.find(items[i]->key);
+        assert(hit);
+        table.erase(hit);
+    }
+    assert(table.size() == items.size() / 2);
+    for (size_t i = 0; i < items.size(); ++i) {
+        assert(static_cast<bool>(table.find(items[i]->key)) == (i % 2 == 1));
+    }
+
+    // Churn at a steady size reuses slots instead of growing without bound
+    auto churn = make_items(200000, "churn:");
+    for (size_t i = 0; i < churn.size(); ++i) {
+        table.insert(churn[i].get());
+        if (i >= 1000) {
+            table.erase(table.find(churn[i - 1000]->key));
+        }
+    }
+    assert(table.size() == items.size() / 2 + 1000);
+    for (size_t i = churn.size() - 1000; i < churn.size(); ++i) {
+        assert(table.find(churn[i]->key).value == churn[i].get());
+    }
+
+    table.clear();
+    assert(table.empty() && !table.find("key:1"));
+
+    std::cout << "Swiss table insert/find/erase tests passed!\n";
+}
+
+void test_swiss_incremental_rehash() {
+    std::cout << "Testing swiss table incremental rehash...\n";
+
+    Table table;
+    auto items = make_items(5000);
+    bool saw_rehash = false;
+    for (size_t i = 0; i < items.size(); ++i) {
+        table.insert(items[i].get());
+        if (table.rehashing()) {
+            saw_rehash = true;
+            // Mid-rehash, keys in either table are found
+            assert(table.find(items[i / 2]->key).value == items[i / 2].get());
+            assert(table.find(items[i]->key).value == items[i].get());
+        }
+    }
+    assert(saw_rehash);
+
+    // Lookups alone finish the move
+    for (int i = 0; i < 10000 && table.rehashing(); ++i) {
+        table.find("missing");
+    }
+    assert(!table.rehashing());
+
+    // reserve completes the resize at once
+    Table reserved;
+    reserved.reserve(items.size());
+    for (const auto& item : items) {
+        reserved.insert(item.get());
+        assert(!reserved.rehashing());
+    }
+
+    std::cout << "Swiss table incremental rehash tests passed!\n";
+}
+
+void test_swiss_scan_during_changes() {
+    std::cout << "Testing swiss table scan under inserts and erases...\n";
+
+    Table table;
+    auto stable = make_items(3000, "stable:");
+    auto extra = make_items(20000, "extra:");
+    for (const auto& item : stable) {
+        table.insert(item.get());
+    }
+
+    // Scan a few slots at a time while the table grows through several
+    // rehashes and loses keys: every key present throughout is seen
+    Table::ScanPos pos;
+    size_t next_extra = 0;
+    int steps = 0;
+    bool more = true;
+    while (more) {
+        int budget = 7;
+        more = table.scan(pos, [&](Item* item) {
+            item->visits++;
+            return --budget > 0;
+        });
+        for (int i = 0; i < 5 && next_extra < extra.size(); ++i) {
+            table.insert(extra[next_extra].get());
+            if (next_extra >= 10) {
+                table.erase(table.find(extra[next_extra - 10]->key));
+            }
+            ++next_extra;
+        }
+        ++steps;
+    }
+    assert(steps > 100);
+    for (const auto& item : stable) {
+        assert(item->visits >= 1);
+    }
+
+    // Sampling visits distinct live values
+    std::set<Item*> sampled;
+    table.sample(12345, 8, [&](Item* item) { sampled.insert(item); });
+    assert(sampled.size() == 8);
+    for (Item* item : sampled) {
+        assert(table.find(item->key).value == item);
+    }
+
+    size_t counted = 0;
+    table.for_each([&](Item*) { ++counted; });
+    assert(counted == table.size());
+
+    std::cout << "Swiss table scan tests passed!\n";
+}
+
+void run_swiss_table_tests() {
+    test_swiss_insert_find_erase();
+    test_swiss_incremental_rehash();
+    test_swiss_scan_during_changes();
+}
@@ -0,0 +1,228 @@
+// Tests for client-side caching (CLIENT TRACKING)
+// Verifies the store's per-key tracking tables and their limit, and that
+// ClientTracking sends invalidations as pushes, redirected messages and
+// BCAST prefix matches
+
+#include "../src/server/tracking.hpp"
+#include "../src/server/pubsub.hpp"
+#include "../src/storage/kv_store.hpp"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using mini_redis::ClientTracking;
+using mini_redis::PubSub;
+using mini_redis::Subscriber;
+
+namespace {
+
+// Records what the store reports
+class RecordingTracker final : public KeyTracker {
+public:
+    void invalidate(std::string_view key, const std::vector<uint64_t>& clients) override {
+        keys.emplace_back(key);
+        readers.push_back(clients);
+    }
+    void set_broadcast(bool on) { broadcast_ = on; }
+
+    std::vector<std::string> keys;
+    std::vector<std::vector<uint64_t>> readers;
+};
+
+std::string push_frame(const std::string& key) {
+    return ">2\r\n$10\r\ninvalidate\r\n*1\r\n$" + std::to_string(key.size()) + "\r\n" + key + "\r\n";
+}
+
+std::string message_frame(const std::string& key) {
+    return "*2\r\n$20\r\n__redis__:invalidate\r\n*1\r\n$" + std::to_string(key.size()) + "\r\n" + key + "\r\n";
+}
+
+std::string take_all(Subscriber& sub) {
+    std::string out;
+    while (sub.ready()) {
+        sub.take(out, Subscriber::TAKE_BATCH_BYTES);
+    }
+    return out;
+}
+
+} // anonymous namespace
+
+void test_store_tracking() {
+    std::cout << "Testing store tracking tables...\n";
+
+    RecordingTracker tracker;
+    KVStore store(4);
+    store.set_tracking(&tracker, 0);
+
+    // Reads are remembered per key; writes to other keys are not reported
+    store.set("a", "1");
+    store.track("a", 7);
+    store.track("a", 8);
+    store.track("a", 7);
+    store.track("missing", 7);
+    assert(store.tracked_keys() == 2);
+    store.set("b", "x");
+    assert(tracker.keys.empty());
+
+    // A change reports every reader once, then the key is untracked
+    store.set("a", "2");
+    assert(tracker.keys.size() == 1 && tracker.keys[0] == "a");
+    assert((tracker.readers[0] == std::vector<uint64_t>{7, 8}));
+    store.set("a", "3");
+    assert(tracker.keys.size() == 1);
+
+    // Creating a key read while missing counts too, as do deletes and expiry
+    store.set("missing", "now");
+    assert(tracker.keys.size() == 2 && tracker.keys[1] == "missing");
+    store.track("b", 9);
+    store.del("b");
+    assert(tracker.keys.size() == 3 && tracker.keys.back() == "b");
+    store.track("a", 9);
+    assert(store.pexpire("a", 1));
+    assert(tracker.keys.back() == "a");
+    store.track("a", 9);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    std::string value;
+    assert(!store.get("a", value));
+    assert(tracker.keys.back() == "a" && tracker.keys.size() == 5);
+
+    // A flush reports the tracked keys that existed
+    store.set("c", "1");
+    store.track("c", 1);
+    store.clear();
+    assert(tracker.keys.back() == "c");
+    assert(store.tracked_keys() == 0);
+
+    // With broadcast set, every change is reported, tracked or not
+    tracker.set_broadcast(true);
+    store.set("d", "1");
+    assert(tracker.keys.back() == "d" && tracker.readers.back().empty());
+    // Once per delete, with or without a TTL
+    size_t reported = tracker.keys.size();
+    store.del("d");
+    assert(tracker.keys.size() == reported + 1);
+    store.set("e", "1");
+    assert(store.pexpire("e", 100000));
+    reported = tracker.keys.size();
+    store.del("e");
+    assert(tracker.keys.size() == reported + 1 && tracker.keys.back() == "e");
+    tracker.set_broadcast(false);
+
+    std::cout << "Store tracking table tests passed!\n";
+}
+
+void test_store_tracking_limit() {
+    std::cout << "Testing tracking table limit...\n";
+
+    RecordingTracker tracker;
+    KVStore store(1);
+    store.set_tracking(&tracker, 4);
+    for (int i = 0; i < 4; ++i) {
+        store.track("k" + std::to_string(i), 1);
+    }
+    assert(store.tracked_keys() == 4 && tracker.keys.empty());
+
+    // Past the limit another key is dropped, and invalidated so its readers
+    // stop trusting their copy
+    store.track("new", 2);
+    assert(store.tracked_keys() == 4);
+    assert(tracker.keys.size() == 1 && tracker.keys[0] != "new");
+    assert((tracker.readers[0] == std::vector<uint64_t>{1}));
+    store.set("new", "v");
+    assert(tracker.keys.back() == "new");
+
+    std::cout << "Tracking table limit tests passed!\n";
+}
+
+void test_client_tracking() {
+    std::cout << "Testing invalidation delivery...\n";
+
+    PubSub hub;
+    ClientTracking tracking(hub);
+    KVStore store(4);
+    store.set_tracking(&tracking, 0);
+
+    Subscriber resp3(hub, [] {}, 1);
+    Subscriber listener(hub, [] {}, 2);
+    Subscriber broadcaster(hub, [] {}, 3);
+    assert(hub.addressable(1) && !hub.addressable(42));
+
+    tracking.enable(1, {});
+    ClientTracking::Options redirected;
+    redirected.redirect = 2;
+    tracking.enable(4, redirected);
+    ClientTracking::Options bcast;
+    bcast.broadcast = true;
+    bcast.prefixes = {"user:"};
+    tracking.enable(3, bcast);
+    assert(tracking.client_count() == 3);
+    assert(tracking.redirect_of(4) == 2 && tracking.redirect_of(1) == 0 && tracking.redirect_of(9) == -1);
+
+    // A push for the RESP3 client, a message for the redirected one's target
+    store.track("k", 1);
+    store.track("k", 4);
+    store.set("k", "v");
+    assert(take_all(resp3) == push_frame("k"));
+    assert(take_all(listener) == message_frame("k"));
+    assert(take_all(broadcaster).empty());
+
+    // BCAST: every change under a prefix, without reads
+    store.set("user:1", "x");
+    store.set("other", "x");
+    assert(take_all(broadcaster) == push_frame("user:1"));
+
+    // One push per DEL, whether or not the key had a TTL
+    store.del("user:1");
+    assert(take_all(broadcaster) == push_frame("user:1"));
+    store.set("user:1", "x");
+    assert(store.pexpire("user:1", 100000));
+    take_all(broadcaster);
+    store.del("user:1");
+    assert(take_all(broadcaster) == push_frame("user:1"));
+
+    // NOLOOP skips the client's own writes; disabled clients are not told
+    ClientTracking::Options noloop;
+    noloop.noloop = true;
+    tracking.enable(1, noloop);
+    store.track("k", 1);
+    {
+        const KeyTracker::WriterScope writer(1);
+        store.set("k", "mine");
+    }
+    assert(KeyTracker::writer == 0);
+    assert(take_all(resp3).empty());
+
+    // A key the server evicts during the client's write is not its change
+    KVStore small(1);
+    small.set_tracking(&tracking, 0);
+    small.set_eviction_limits(2, 0);
+    small.set("old", "v");
+    small.track("old", 1);
+    small.set("newer", "v");
+    {
+        const KeyTracker::WriterScope writer(1);
+        small.set("newest", "v");
+    }
+    assert(take_all(resp3) == push_frame("old"));
+    store.track("k", 1);
+    tracking.disable(1);
+    store.set("k", "later");
+    assert(take_all(resp3).empty());
+
+    tracking.disable(3);
+    store.set("user:2", "x");
+    assert(take_all(broadcaster).empty());
+    assert(!tracking.broadcast());
+
+    std::cout << "Invalidation delivery tests passed!\n";
+}
+
+void run_tracking_tests() {
+    test_store_tracking();
+    test_store_tracking_limit();
+    test_client_tracking();
+}
@@ -0,0 +1,351 @@
+// Tests for transactions and scripting support
+// Verifies SHA-1 digests, WATCH change counting in the store, recursive shard
+// locks and ShardLocks ordering, the direct command bindings scripts use,
+// and (when built with Lua) running scripts
+
+#include "../src/server/transaction.hpp"
+#include "../src/server/scripting.hpp"
+#include "../src/protocol/command_table.hpp"
+#include "../src/storage/kv_store.hpp"
+#include "../src/utils/sha1.hpp"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using mini_redis::ScriptRun;
+using mini_redis::ScriptValue;
+using mini_redis::ShardLocks;
+using mini_redis::Transaction;
+
+void test_sha1() {
+    std::cout << "Testing SHA-1...\n";
+
+    assert(mini_redis::sha1_hex("") == "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    assert(mini_redis::sha1_hex("abc") == "a9993e364706816aba3e25717850c26c9cd0d89d");
+    // 56 bytes: the length no longer fits in the first padding block
+    assert(mini_redis::sha1_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+           "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+    assert(mini_redis::sha1_hex(std::string(1000000, 'a')) == "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+    // Redis's own example: the digest EVAL "return 1" is cached under
+    assert(mini_redis::sha1_hex("return 1") == "e0e1f9fabfc9d4800c877a703b823ac0578ff8db");
+
+    std::cout << "SHA-1 tests passed!\n";
+}
+
+void test_watch_versions() {
+    std::cout << "Testing WATCH change counts...\n";
+
+    KVStore store(4);
+    store.set("a", "1");
+    const uint64_t a = store.watch("a");
+    const uint64_t missing = store.watch("missing");
+    assert(store.watch_version("a") == a);
+    assert(store.watch_version("missing") == missing);
+
+    // Reads are not changes; writes, deletes and new keys are
+    std::string value;
+    assert(store.get("a", value));
+    assert(store.watch_version("a") == a);
+    store.set("a", "2");
+    assert(store.watch_version("a") != a);
+    store.set("missing", "now");
+    assert(store.watch_version("missing") != missing);
+
+    // A key the store expires counts as changed once it is gone
+    const uint64_t before = store.watch_version("missing");
+    assert(store.pexpire("missing", 1));
+    const uint64_t armed = store.watch_version("missing");
+    assert(armed != before);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    assert(store.watch_version("missing") != armed);
+
+    // A flush changes the watched keys that existed
+    const uint64_t flushed = store.watch_version("a");
+    store.clear();
+    assert(store.watch_version("a") != flushed);
+
+    // Watches nest; the count is dropped with the last one
+    store.watch("a");
+    store.unwatch("a");
+    store.unwatch("a");
+    store.unwatch("missing");
+    store.set("a", "3");
+    assert(store.watch_version("a") == 0);
+
+    // Collection writes count too
+    const uint64_t list = store.watch("list");
+    size_t length = 0;
+    store.push({"list", "x"}, false, length);
+    assert(length == 1);
+    assert(store.watch_version("list") != list);
+    store.unwatch("list");
+
+    std::cout << "WATCH change count tests passed!\n";
+}
+
+void test_transaction_watches() {
+    std::cout << "Testing Transaction watches...\n";
+
+    KVStore store(4);
+    store.set("k", "v");
+    {
+        Transaction tx;
+        tx.watch(store, "k");
+        tx.watch(store, "k"); // Once per key
+        assert(tx.watches_intact());
+        store.set("other", "x");
+        assert(tx.watches_intact());
+        store.set("k", "v2");
+        assert(!tx.watches_intact());
+
+        tx.unwatch_all();
+        tx.watch(store, "k");
+        assert(tx.watches_intact());
+        // Destroyed while watching: the store forgets the key
+    }
+    store.set("k", "v3");
+    assert(store.watch_version("k") == 0);
+
+    // The queue is handed over once and MULTI ends with it
+    Transaction tx;
+    tx.begin();
+    protocol::Command cmd;
+    cmd.type = protocol::CommandType::SET;
+    cmd.args = {"k", "v"};
+    tx.queue(cmd);
+    tx.abort();
+    assert(tx.in_multi() && tx.aborted());
+    std::vector<protocol::Command> queued = tx.take_queued();
+    assert(queued.size() == 1 && queued[0].args[0] == "k");
+    assert(!tx.in_multi() && !tx.aborted() && tx.queued().empty());
+
+    std::cout << "Transaction watch tests passed!\n";
+}
+
+void test_shard_locks() {
+    std::cout << "Testing transaction shard locks...\n";
+
+    std::vector<KVStore> dbs(2);
+    ShardLocks locks;
+    locks.add_key(dbs[1], "b");
+    locks.add_key(dbs[0], "a");
+    locks.add_key(dbs[0], "a");
+    locks.lock();
+    assert(locks.covers(dbs[0], "a"));
+    assert(locks.covers(dbs[1], "b"));
+    assert(!locks.covers(dbs[1], "a") || dbs[1].shard_index("a") == dbs[1].shard_index("b"));
+
+    // The holder's own commands take the locks again
+    dbs[0].set("a", "1");
+    std::string value;
+    assert(dbs[0].get("a", value) && value == "1");
+
+    // Another thread waits for the transaction to finish
+    std::atomic<bool> done{false};
+    std::thread other([&] {
+        dbs[0].set("a", "2");
+        done = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    assert(!done);
+    {
+        ShardLocks released = std::move(locks);
+    }
+    other.join();
+    assert(dbs[0].get("a", value) && value == "2");
+
+    // Commands without keys lock their database; FLUSHALL and admin commands all of them
+    protocol::Command keys_cmd;
+    keys_cmd.type = protocol::CommandType::KEYS;
+    keys_cmd.args = {"*"};
+    ShardLocks whole;
+    mini_redis::add_command_locks(keys_cmd, dbs, 1, whole);
+    whole.lock();
+    assert(whole.covers(dbs[1], "anything") && !whole.covers(dbs[0], "anything"));
+
+    protocol::Command info;
+    info.type = protocol::CommandType::INFO;
+    ShardLocks all;
+    mini_redis::add_command_locks(info, dbs, 0, all);
+    all.lock();
+    assert(all.covers(dbs[0], "x") && all.covers(dbs[1], "y"));
+
+    // EVAL locks its declared keys
+    protocol::Command eval;
+    eval.type = protocol::CommandType::EVAL;
+    eval.args = {"return 1", "1", "k1", "arg"};
+    const protocol::KeyRange range = protocol::command_keys(eval);
+    assert(range.first == 2 && range.end == 3);
+    eval.args[1] = "5";
+    assert(protocol::command_keys(eval).end == 0);
+
+    std::cout << "Transaction shard lock tests passed!\n";
+}
+
+void test_script_calls() {
+    std::cout << "Testing script command bindings...\n";
+
+    KVStore store(4);
+    const std::vector<std::string> keys = {"counter", "name", "h", "list", "set", "z", "ghost"};
+    std::vector<protocol::Command> written;
+    ScriptRun run{store, keys, [&](const protocol::Command& cmd) { written.push_back(cmd); }};
+
+    ScriptValue v = mini_redis::script_call(run, {"set", "name", "alice"});
+    assert(v.kind == ScriptValue::Kind::Status && v.text == "OK");
+    v = mini_redis::script_call(run, {"GET", "name"});
+    assert(v.kind == ScriptValue::Kind::Bulk && v.text == "alice");
+    v = mini_redis::script_call(run, {"incrby", "counter", "5"});
+    assert(v.kind == ScriptValue::Kind::Integer && v.integer == 5);
+    v = mini_redis::script_call(run, {"decr", "counter"});
+    assert(v.integer == 4);
+    assert(mini_redis::script_call(run, {"get", "counter"}).text == "4");
+
+    // Collections, with the same wrong-type errors as the commands
+    assert(mini_redis::script_call(run, {"hset", "h", "f", "1", "g", "2"}).integer == 2);
+    assert(mini_redis::script_call(run, {"hget", "h", "g"}).text == "2");
+    assert(mini_redis::script_call(run, {"hget", "h", "none"}).kind == ScriptValue::Kind::Nil);
+    assert(mini_redis::script_call(run, {"rpush", "list", "a", "b", "c"}).integer == 3);
+    v = mini_redis::script_call(run, {"rpop", "list", "2"});
+    assert(v.kind == ScriptValue::Kind::Array && v.elements.size() == 2 && v.elements[0].text == "c");
+    assert(mini_redis::script_call(run, {"sadd", "set", "m", "m"}).integer == 1);
+    assert(mini_redis::script_call(run, {"sismember", "set", "m"}).integer == 1);
+    assert(mini_redis::script_call(run, {"zadd", "z", "1.5", "m"}).integer == 1);
+    assert(mini_redis::script_call(run, {"type", "z"}).text == "zset");
+    v = mini_redis::script_call(run, {"get", "h"});
+    assert(v.kind == ScriptValue::Kind::Error && v.text == KVStore::WRONGTYPE_ERROR);
+
+    // Writes are passed on as the commands called, and only when they changed something
+    const size_t writes = written.size();
+    assert(writes == 8);
+    assert(written[0].type == protocol::CommandType::SET && written[0].args[1] == "alice");
+    assert(mini_redis::script_call(run, {"sadd", "set", "m"}).integer == 0);
+    assert(mini_redis::script_call(run, {"del", "ghost"}).integer == 0);
+    assert(written.size() == writes);
+
+    // Undeclared keys, unknown or unsupported commands and bad arity are errors
+    v = mini_redis::script_call(run, {"get", "elsewhere"});
+    assert(v.kind == ScriptValue::Kind::Error && v.text.find("not declared") != std::string::npos);
+    assert(mini_redis::script_call(run, {"nosuchcmd"}).kind == ScriptValue::Kind::Error);
+    assert(mini_redis::script_call(run, {"keys", "*"}).kind == ScriptValue::Kind::Error);
+    assert(mini_redis::script_call(run, {"get"}).kind == ScriptValue::Kind::Error);
+    assert(mini_redis::script_call(run, {}).kind == ScriptValue::Kind::Error);
+    assert(mini_redis::script_call(run, {"incrby", "counter", "x"}).kind == ScriptValue::Kind::Error);
+
+    // A read-only script (EVAL_RO) may read but not write
+    ScriptRun read_only{store, keys, [&](const protocol::Command& cmd) { written.push_back(cmd); }, true};
+    assert(mini_redis::script_call(read_only, {"get", "counter"}).text == "4");
+    v = mini_redis::script_call(read_only, {"incr", "counter"});
+    assert(v.kind == ScriptValue::Kind::Error && v.text.find("read-only") != std::string::npos);
+    assert(mini_redis::script_call(run, {"get", "counter"}).text == "4");
+    assert(written.size() == writes);
+
+    std::cout << "Script command binding tests passed!\n";
+}
+
+void test_script_cache() {
+    std::cout << "Testing script cache...\n";
+
+    mini_redis::ScriptCache cache;
+    const uint64_t generation = cache.generation();
+    const std::string sha = cache.add("return 1");
+    assert(sha == mini_redis::sha1_hex("return 1"));
+    std::string source;
+    assert(cache.find(sha, source) && source == "return 1");
+    assert(cache.contains(sha));
+    cache.clear();
+    assert(!cache.contains(sha) && !cache.find(sha, source));
+    assert(cache.generation() != generation);
+
+    // A build without Lua answers EVAL with an error rather than a wrong result
+    KVStore store(1);
+    const std::vector<std::string> keys;
+    ScriptRun run{store, keys, nullptr};
+    ScriptValue result = mini_redis::run_script(run, sha, "return 1", {});
+    if (mini_redis::scripting_available()) {
+        assert(result.kind == ScriptValue::Kind::Integer && result.integer == 1);
+    } else {
+        assert(result.kind == ScriptValue::Kind::Error);
+    }
+
+    std::cout << "Script cache tests passed!\n";
+}
+
+void test_eval_scripts() {
+    std::cout << "Testing EVAL scripts...\n";
+
+#ifdef MINI_REDIS_WITH_LUA
+    // A Lua build must run scripts, not answer them with the no-Lua error
+    assert(mini_redis::scripting_available());
+#endif
+    if (!mini_redis::scripting_available()) {
+        std::cout << "EVAL script tests skipped (built without Lua)\n";
+        return;
+    }
+
+    KVStore store(4);
+    const std::vector<std::string> keys = {"k", "n"};
+    std::vector<protocol::Command> written;
+    ScriptRun run{store, keys, [&](const protocol::Command& cmd) { written.push_back(cmd); }};
+    auto eval = [&](const std::string& source, const std::vector<std::string>& argv = {}) {
+        return mini_redis::run_script(run, mini_redis::sha1_hex(source), source, argv);
+    };
+
+    // KEYS, ARGV and redis.call replies as Lua values
+    ScriptValue v = eval("return redis.call('SET', KEYS[1], ARGV[1])", {"hello"});
+    assert(v.kind == ScriptValue::Kind::Status && v.text == "OK");
+    v = eval("return redis.call('GET', KEYS[1])");
+    assert(v.kind == ScriptValue::Kind::Bulk && v.text == "hello");
+    assert(eval("return redis.call('INCRBY', KEYS[2], 5)").integer == 5);
+    assert(eval("return redis.call('GET', 'k') == 'hello' and #ARGV", {"a", "b"}).integer == 2);
+    store.del("n");
+    assert(eval("return redis.call('GET', KEYS[2]) == false").integer == 1);
+
+    // Lua values as replies: numbers truncate, true is 1, false and nil are
+    // nil, tables are arrays up to their first nil
+    v = eval("return 3.9");
+    assert(v.kind == ScriptValue::Kind::Integer && v.integer == 3);
+    assert(eval("return true").integer == 1);
+    assert(eval("return false").kind == ScriptValue::Kind::Nil);
+    assert(eval("return nil").kind == ScriptValue::Kind::Nil);
+    v = eval("return {1, 'two', {3}, nil, 5}");
+    assert(v.kind == ScriptValue::Kind::Array && v.elements.size() == 3);
+    assert(v.elements[1].text == "two" && v.elements[2].elements[0].integer == 3);
+    v = eval("return redis.status_reply('FINE')");
+    assert(v.kind == ScriptValue::Kind::Status && v.text == "FINE");
+    v = eval("return redis.error_reply('ERR custom')");
+    assert(v.kind == ScriptValue::Kind::Error && v.text == "ERR custom");
+
+    // redis.call raises a command's error; redis.pcall returns it
+    v = eval("redis.call('GET', 'undeclared') return 1");
+    assert(v.kind == ScriptValue::Kind::Error && v.text.find("not declared") != std::string::npos);
+    v = eval("return redis.pcall('INCR', KEYS[1])");
+    assert(v.kind == ScriptValue::Kind::Error && v.text == "ERR value is not an integer or out of range");
+    assert(eval("return redis.pcall('GET', {})").kind == ScriptValue::Kind::Error);
+
+    // Compile and runtime errors, and no access to the host
+    v = eval("return +");
+    assert(v.kind == ScriptValue::Kind::Error && v.text.find("Error compiling script") != std::string::npos);
+    v = eval("error('boom')");
+    assert(v.kind == ScriptValue::Kind::Error && v.text.find("boom") != std::string::npos);
+    assert(eval("return os == nil and io == nil and require == nil").integer == 1);
+
+    // Only the writes that happened were passed on: SET and INCRBY
+    assert(written.size() == 2);
+    assert(written[0].type == protocol::CommandType::SET && written[1].type == protocol::CommandType::INCRBY);
+
+    std::cout << "EVAL script tests passed!\n";
+}
+
+void run_transaction_tests() {
+    test_sha1();
+    test_watch_versions();
+    test_transaction_watches();
+    test_shard_locks();
+    test_script_calls();
+    test_script_cache();
+    test_eval_scripts();
+}
@@ -0,0 +1,120 @@
+// Tests for compact value encodings: integers stored as int64, short values
+// embedded in the entry, long ones in their own string
+
+#include "../src/storage/kv_store.hpp"
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+void test_integer_values_round_trip() {
+    std::cout << "Testing integer-encoded values...\n";
+    KVStore kv;
+    std::string value;
+
+    // Canonical integers come back byte for byte
+    for (const char* n : {"0", "7", "-1", "1234567890", "9223372036854775807", "-9223372036854775808"}) {
+        kv.set("n", n);
+        assert(kv.get("n", value) && value == n);
+        assert(kv.strlen("n") == std::string(n).size());
+    }
+
+    // Strings that merely look numeric keep their exact bytes
+    for (const char* s : {"007", "-0", "+1", " 1", "1 ", "9223372036854775808", "12345678901234567890123", "-"}) {
+        kv.set("s", s);
+        assert(kv.get("s", value) && value == s);
+    }
+
+    // INCR on a numeric-looking string still parses it, as before
+    kv.set("padded", "007");
+    auto [result, err] = kv.incr("padded");
+    assert(err.empty() && result == 8);
+    assert(kv.get("padded", value) && value == "8");
+
+    std::cout << "Integer-encoded value tests passed!\n";
+}
+
+void test_embedded_and_raw_values() {
+    std::cout << "Testing embedded and separate values...\n";
+    KVStore kv;
+    std::string value;
+
+    const std::string shorter = "abc";
+    const std::string longer(200, 'L');
+    kv.set("k", shorter);
+    kv.set("k", longer); // Too long for the room after the key
+    assert(kv.get("k", value) && value == longer);
+    kv.set("k", shorter); // Back into the entry
+    assert(kv.get("k", value) && value == shorter);
+    kv.set("k", "");
+    assert(kv.get("k", value) && value.empty());
+
+    // APPEND grows in place, then moves out once it no longer fits
+    std::string expected;
+    for (int i = 0; i < 50; ++i) {
+        expected += "xyz";
+        assert(kv.append("grow", "xyz") == expected.size());
+        assert(kv.get("grow", value) && value == expected);
+    }
+
+    // APPEND to an integer appends to its digits
+    kv.set("num", "42");
+    assert(kv.append("num", "7") == 3);
+    assert(kv.get("num", value) && value == "427");
+    assert(kv.incr("num").first == 428);
+    assert(kv.append("num", std::string(100, '0')) == 103);
+    assert(kv.get("num", value) && value == "428" + std::string(100, '0'));
+
+    // read_value hands out the same bytes for every encoding
+    kv.set("int", "-99");
+    std::string seen;
+    assert(kv.read_value("int", [&](std::string_view v) { seen.assign(v); }));
+    assert(seen == "-99");
+    assert(kv.read_value("k", [&](std::string_view v) { seen.assign(v); }) && seen.empty());
+
+    std::cout << "Embedded and separate value tests passed!\n";
+}
+
+void test_counter_memory() {
+    std::cout << "Testing counter memory footprint...\n";
+    KVStore kv(1);
+    kv.set_eviction_limits(0, 0);
+
+    const int counters = 10000;
+    for (int i = 0; i < counters; ++i) {
+        kv.incrby("counter:" + std::to_string(i), i);
+    }
+    // One allocation per key: header, key bytes and the int64, plus the map node
+    const size_t per_key = kv.used_memory() / counters;
+    assert(per_key <= 160);
+
+    // Values survive a shard-count change, snapshots and RDB files
+    kv.set("text", "hello");
+    kv.set("long", std::string(1000, 'q'));
+    assert(kv.pexpire("counter:5", 60000));
+    kv.set_shard_count(4);
+    std::string value;
+    assert(kv.get("counter:9999", value) && value == "9999");
+    assert(kv.pttl("counter:5") > 0);
+
+    const char* path = "test_value_encoding.rdb";
+    assert(kv.save_to_rdb(path));
+    KVStore restored(3);
+    restored.set_eviction_limits(0, 0);
+    assert(restored.load_from_rdb(path));
+    assert(restored.size() == kv.size());
+    assert(restored.get("counter:1234", value) && value == "1234");
+    assert(restored.incr("counter:1234").first == 1235);
+    assert(restored.get("text", value) && value == "hello");
+    assert(restored.get("long", value) && value == std::string(1000, 'q'));
+    std::remove(path);
+
+    std::cout << "Counter memory footprint tests passed!\n";
+}
+
+void run_value_encoding_tests() {
+    test_integer_values_round_trip();
+    test_embedded_and_raw_values();
+    test_counter_memory();
+}